@@ -18,11 +18,16 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <utime.h>
 
 #include <chrono>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <utility>
 
@@ -30,11 +35,63 @@
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
+#include <android-base/properties.h>
 
 namespace {
 
 const char BOOTSTAT_DATA_DIR[] = "/data/misc/bootstat/";
 
+// The name of the single record file in the store directory.
+const char RECORD_FILE_NAME[] = "boot_event_records";
+
+// The record file is a header followed by fixed-size records, in the order
+// the events were first added. It grows a page at a time.
+constexpr uint32_t kRecordFileMagic = 0x52564542;  // "BEVR"
+constexpr uint32_t kRecordFileVersion = 1;
+constexpr size_t kRecordFileGrowth = 4096;
+constexpr size_t kRecordNameSize = 60;
+
+struct RecordFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  // Only ever grows, and only after the new record is in place.
+  uint32_t count;
+  uint32_t reserved;
+};
+
+struct Record {
+  // NUL-terminated.
+  char name[kRecordNameSize];
+  int32_t value;
+};
+
+static_assert(sizeof(RecordFileHeader) == 16, "unexpected record file header layout");
+static_assert(sizeof(Record) == 64, "unexpected record layout");
+
+std::string RecordName(const Record& record) {
+  return std::string(record.name, strnlen(record.name, sizeof(record.name)));
+}
+
+// Holds an flock() on the record file for as long as it is around.
+class ScopedFlock {
+ public:
+  ScopedFlock(int fd, int operation) : fd_(fd) {
+    if (TEMP_FAILURE_RETRY(flock(fd_, operation)) == -1) {
+      PLOG(ERROR) << "Failed to lock the boot event record file";
+      fd_ = -1;
+    }
+  }
+  ~ScopedFlock() {
+    if (fd_ != -1) flock(fd_, LOCK_UN);
+  }
+  bool locked() const { return fd_ != -1; }
+
+ private:
+  int fd_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedFlock);
+};
+
 // Given a boot even record file at |path|, extracts the event's relative time
 // from the record into |uptime|.
 bool ParseRecordEventTime(const std::string& path, int32_t* uptime) {
@@ -53,10 +110,17 @@ bool ParseRecordEventTime(const std::string& path, int32_t* uptime) {
 
 }  // namespace
 
-BootEventRecordStore::BootEventRecordStore() {
+BootEventRecordStore::BootEventRecordStore()
+    : use_record_file_(android::base::GetBoolProperty("ro.bootstat.record_file", false)) {
   SetStorePath(BOOTSTAT_DATA_DIR);
 }
 
+BootEventRecordStore::~BootEventRecordStore() {
+  if (records_ != nullptr) {
+    munmap(records_, records_size_);
+  }
+}
+
 void BootEventRecordStore::AddBootEvent(const std::string& event) {
   auto uptime = std::chrono::duration_cast<std::chrono::seconds>(
       android::base::boot_clock::now().time_since_epoch());
@@ -67,6 +131,11 @@ void BootEventRecordStore::AddBootEvent(const std::string& event) {
 // attribute to store the value associated with a boot event in order to
 // optimize on-disk size requirements and small-file thrashing.
 void BootEventRecordStore::AddBootEventWithValue(const std::string& event, int32_t value) {
+  if (use_record_file_) {
+    AddRecordFileEvent(event, value);
+    return;
+  }
+
   std::string record_path = GetBootEventPath(event);
   int record_fd = creat(record_path.c_str(), S_IRUSR | S_IWUSR);
   if (record_fd == -1) {
@@ -99,6 +168,22 @@ bool BootEventRecordStore::GetBootEvent(const std::string& event, BootEventRecor
   CHECK_NE(static_cast<BootEventRecord*>(nullptr), record);
   CHECK(!event.empty());
 
+  if (use_record_file_) {
+    if (!OpenRecordFile()) return false;
+    ScopedFlock lock(record_fd_.get(), LOCK_SH);
+    if (!lock.locked() || !RemapRecordFile()) return false;
+
+    const auto* header = static_cast<const RecordFileHeader*>(records_);
+    const auto* records = reinterpret_cast<const Record*>(header + 1);
+    for (uint32_t i = 0; i < header->count; ++i) {
+      if (event == RecordName(records[i])) {
+        *record = std::make_pair(event, records[i].value);
+        return true;
+      }
+    }
+    return false;
+  }
+
   const std::string record_path = GetBootEventPath(event);
   int32_t uptime;
   if (!ParseRecordEventTime(record_path, &uptime)) {
@@ -113,6 +198,20 @@ bool BootEventRecordStore::GetBootEvent(const std::string& event, BootEventRecor
 std::vector<BootEventRecordStore::BootEventRecord> BootEventRecordStore::GetAllBootEvents() const {
   std::vector<BootEventRecord> events;
 
+  if (use_record_file_) {
+    if (!OpenRecordFile()) return events;
+    ScopedFlock lock(record_fd_.get(), LOCK_SH);
+    if (!lock.locked() || !RemapRecordFile()) return events;
+
+    const auto* header = static_cast<const RecordFileHeader*>(records_);
+    const auto* records = reinterpret_cast<const Record*>(header + 1);
+    events.reserve(header->count);
+    for (uint32_t i = 0; i < header->count; ++i) {
+      events.emplace_back(RecordName(records[i]), records[i].value);
+    }
+    return events;
+  }
+
   std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(store_path_.c_str()), closedir);
 
   // This case could happen due to external manipulation of the filesystem,
@@ -127,6 +226,11 @@ std::vector<BootEventRecordStore::BootEventRecord> BootEventRecordStore::GetAllB
     }
 
     const std::string event = entry->d_name;
+    // Left behind if the store was switched back from the record file.
+    if (event == RECORD_FILE_NAME) {
+      continue;
+    }
+
     BootEventRecord record;
     if (!GetBootEvent(event, &record)) {
       LOG(ERROR) << "Failed to parse boot time event: " << event;
@@ -144,7 +248,170 @@ void BootEventRecordStore::SetStorePath(const std::string& path) {
   store_path_ = path;
 }
 
+void BootEventRecordStore::SetUseRecordFile(bool use_record_file) {
+  use_record_file_ = use_record_file;
+}
+
 std::string BootEventRecordStore::GetBootEventPath(const std::string& event) const {
   DCHECK_EQ('/', store_path_.back());
   return store_path_ + event;
 }
+
+bool BootEventRecordStore::OpenRecordFile() const {
+  if (records_ != nullptr) {
+    return true;
+  }
+
+  const std::string path = store_path_ + RECORD_FILE_NAME;
+  record_fd_.reset(
+      TEMP_FAILURE_RETRY(open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR)));
+  if (record_fd_ == -1) {
+    PLOG(ERROR) << "Failed to open " << path;
+    return false;
+  }
+
+  ScopedFlock lock(record_fd_.get(), LOCK_EX);
+  if (!lock.locked()) {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(record_fd_.get(), &file_stat) == -1) {
+    PLOG(ERROR) << "Failed to read " << path;
+    return false;
+  }
+  if (static_cast<size_t>(file_stat.st_size) < kRecordFileGrowth &&
+      ftruncate(record_fd_.get(), kRecordFileGrowth) == -1) {
+    PLOG(ERROR) << "Failed to size " << path;
+    return false;
+  }
+  if (!RemapRecordFile()) {
+    return false;
+  }
+
+  auto* header = static_cast<RecordFileHeader*>(records_);
+  if (header->magic == kRecordFileMagic && header->version == kRecordFileVersion) {
+    return true;
+  }
+  if (header->magic != 0) {
+    LOG(ERROR) << path << " is not a boot event record file";
+    munmap(records_, records_size_);
+    records_ = nullptr;
+    return false;
+  }
+
+  // A new record file, or one that didn't get its header before a crash.
+  // Move the per-event files into it; they go only once their records are
+  // on disk.
+  *header = {kRecordFileMagic, kRecordFileVersion, 0, 0};
+  std::vector<std::string> legacy_paths;
+  std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(store_path_.c_str()), closedir);
+  if (dir) {
+    struct dirent* entry;
+    while ((entry = readdir(dir.get())) != NULL) {
+      const std::string event = entry->d_name;
+      if (entry->d_type != DT_REG || event == RECORD_FILE_NAME) {
+        continue;
+      }
+      int32_t value;
+      if (!ParseRecordEventTime(GetBootEventPath(event), &value)) {
+        continue;
+      }
+      WriteRecord(event, value);
+      legacy_paths.push_back(GetBootEventPath(event));
+    }
+  }
+  if (msync(records_, records_size_, MS_SYNC) == -1) {
+    PLOG(ERROR) << "Failed to sync " << path;
+    return true;
+  }
+  for (const auto& legacy_path : legacy_paths) {
+    unlink(legacy_path.c_str());
+  }
+  return true;
+}
+
+bool BootEventRecordStore::RemapRecordFile() const {
+  struct stat file_stat;
+  if (fstat(record_fd_.get(), &file_stat) == -1) {
+    PLOG(ERROR) << "Failed to read the boot event record file";
+    return false;
+  }
+  const size_t size = file_stat.st_size;
+  if (records_ != nullptr && size == records_size_) {
+    return true;
+  }
+  if (size < kRecordFileGrowth) {
+    LOG(ERROR) << "Truncated boot event record file";
+    return false;
+  }
+
+  void* records = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, record_fd_.get(), 0);
+  if (records == MAP_FAILED) {
+    PLOG(ERROR) << "Failed to map the boot event record file";
+    return false;
+  }
+  if (records_ != nullptr) {
+    munmap(records_, records_size_);
+  }
+  records_ = records;
+  records_size_ = size;
+
+  // Never trust the count beyond what the file holds.
+  auto* header = static_cast<RecordFileHeader*>(records_);
+  const size_t capacity = (records_size_ - sizeof(RecordFileHeader)) / sizeof(Record);
+  if (header->count > capacity) {
+    LOG(ERROR) << "Boot event record file claims " << header->count << " records, holds "
+               << capacity;
+    header->count = capacity;
+  }
+  return true;
+}
+
+void BootEventRecordStore::AddRecordFileEvent(const std::string& event, int32_t value) const {
+  if (!OpenRecordFile()) {
+    return;
+  }
+  ScopedFlock lock(record_fd_.get(), LOCK_EX);
+  if (lock.locked() && RemapRecordFile()) {
+    WriteRecord(event, value);
+  }
+}
+
+// Updates the event in place if it has a record already, and appends a record
+// for it otherwise. The count goes up only once the record is complete, so a
+// reader never sees a half-written one.
+void BootEventRecordStore::WriteRecord(const std::string& event, int32_t value) const {
+  if (event.size() >= kRecordNameSize) {
+    LOG(ERROR) << "Boot event name too long for the record file: " << event;
+    return;
+  }
+
+  auto* header = static_cast<RecordFileHeader*>(records_);
+  auto* records = reinterpret_cast<Record*>(header + 1);
+  for (uint32_t i = 0; i < header->count; ++i) {
+    if (event == RecordName(records[i])) {
+      records[i].value = value;
+      return;
+    }
+  }
+
+  const size_t capacity = (records_size_ - sizeof(RecordFileHeader)) / sizeof(Record);
+  if (header->count == capacity) {
+    if (ftruncate(record_fd_.get(), records_size_ + kRecordFileGrowth) == -1) {
+      PLOG(ERROR) << "Failed to grow the boot event record file";
+      return;
+    }
+    if (!RemapRecordFile()) {
+      return;
+    }
+    header = static_cast<RecordFileHeader*>(records_);
+    records = reinterpret_cast<Record*>(header + 1);
+  }
+
+  Record* record = &records[header->count];
+  memset(record->name, 0, sizeof(record->name));
+  memcpy(record->name, event.data(), event.size());
+  record->value = value;
+  __atomic_store_n(&header->count, header->count + 1, __ATOMIC_RELEASE);
+}
@@ -18,6 +18,7 @@
 #define BOOT_EVENT_RECORD_STORE_H_
 
 #include <android-base/macros.h>
+#include <android-base/unique_fd.h>
 #include <gtest/gtest_prod.h>
 #include <cstdint>
 #include <string>
@@ -26,6 +27,11 @@
 
 // BootEventRecordStore manages the persistence of boot events to the record
 // store and the retrieval of all boot event records from the store.
+//
+// By default each event is a file of its own in the store directory, with the
+// event's value as its mtime. With ro.bootstat.record_file=true all the events
+// live in a single record file there instead, which replaces the per-event
+// files the first time it is opened.
 class BootEventRecordStore {
  public:
   // A BootEventRecord consists of the event name and the timestamp the event
@@ -33,6 +39,7 @@ class BootEventRecordStore {
   typedef std::pair<std::string, int32_t> BootEventRecord;
 
   BootEventRecordStore();
+  ~BootEventRecordStore();
 
   // Persists the boot |event| in the record store.
   void AddBootEvent(const std::string& event);
@@ -56,16 +63,45 @@ class BootEventRecordStore {
   FRIEND_TEST(BootEventRecordStoreTest, AddBootEventWithValue);
   FRIEND_TEST(BootEventRecordStoreTest, GetBootEvent);
   FRIEND_TEST(BootEventRecordStoreTest, GetBootEventNoFileContent);
+  FRIEND_TEST(BootEventRecordStoreTest, RecordFileAddAndGet);
+  FRIEND_TEST(BootEventRecordStoreTest, RecordFileUpdatesInPlace);
+  FRIEND_TEST(BootEventRecordStoreTest, RecordFileGrows);
+  FRIEND_TEST(BootEventRecordStoreTest, RecordFileMigratesLegacyRecords);
+  FRIEND_TEST(BootEventRecordStoreTest, RecordFileSharedBetweenStores);
 
   // Sets the filesystem path of the record store.
   void SetStorePath(const std::string& path);
 
+  // Selects the single record file over the per-event files.
+  void SetUseRecordFile(bool use_record_file);
+
   // Constructs the full path of the given boot |event|.
   std::string GetBootEventPath(const std::string& event) const;
 
+  // Opens and maps the record file, creating it from the per-event files if it
+  // doesn't exist yet. Returns true iff the record file is usable.
+  bool OpenRecordFile() const;
+
+  // Remaps the record file if another store has grown it. Must be called with
+  // the file locked.
+  bool RemapRecordFile() const;
+
+  void AddRecordFileEvent(const std::string& event, int32_t value) const;
+
+  // Stores |value| for |event| in the record file. Must be called with the
+  // file locked.
+  void WriteRecord(const std::string& event, int32_t value) const;
+
   // The filesystem path of the record store.
   std::string store_path_;
 
+  bool use_record_file_;
+
+  // The record file, mapped while the store is around.
+  mutable android::base::unique_fd record_fd_;
+  mutable void* records_ = nullptr;
+  mutable size_t records_size_ = 0;
+
   DISALLOW_COPY_AND_ASSIGN(BootEventRecordStore);
 };
 
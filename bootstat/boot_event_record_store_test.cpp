@@ -223,3 +223,113 @@ TEST_F(BootEventRecordStoreTest, GetBootEventNoFileContent) {
   EXPECT_EQ("devonian", record.first);
   EXPECT_EQ(2718, record.second);
 }
+
+TEST_F(BootEventRecordStoreTest, RecordFileAddAndGet) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+  store.SetUseRecordFile(true);
+
+  BootEventRecordStore::BootEventRecord record;
+  EXPECT_FALSE(store.GetBootEvent("silurian", &record));
+
+  store.AddBootEventWithValue("silurian", 443);
+  store.AddBootEventWithValue("ordovician", 485);
+
+  EXPECT_TRUE(store.GetBootEvent("silurian", &record));
+  EXPECT_EQ("silurian", record.first);
+  EXPECT_EQ(443, record.second);
+
+  auto events = store.GetAllBootEvents();
+  ASSERT_EQ(2U, events.size());
+  EXPECT_EQ("silurian", events[0].first);
+  EXPECT_EQ(443, events[0].second);
+  EXPECT_EQ("ordovician", events[1].first);
+  EXPECT_EQ(485, events[1].second);
+
+  // The records share a single file rather than one each.
+  EXPECT_NE(-1, access((GetStorePathForTesting() + "boot_event_records").c_str(), F_OK));
+  EXPECT_EQ(-1, access(store.GetBootEventPath("silurian").c_str(), F_OK));
+}
+
+TEST_F(BootEventRecordStoreTest, RecordFileUpdatesInPlace) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+  store.SetUseRecordFile(true);
+
+  store.AddBootEventWithValue("cambrian", 1);
+  store.AddBootEventWithValue("cambrian", 541);
+
+  auto events = store.GetAllBootEvents();
+  ASSERT_EQ(1U, events.size());
+  EXPECT_EQ("cambrian", events[0].first);
+  EXPECT_EQ(541, events[0].second);
+}
+
+TEST_F(BootEventRecordStoreTest, RecordFileGrows) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+  store.SetUseRecordFile(true);
+
+  // Several pages' worth of records.
+  const int kEvents = 200;
+  for (int i = 0; i < kEvents; ++i) {
+    store.AddBootEventWithValue("ediacaran." + std::to_string(i), i);
+  }
+
+  auto events = store.GetAllBootEvents();
+  ASSERT_EQ(static_cast<size_t>(kEvents), events.size());
+  for (int i = 0; i < kEvents; ++i) {
+    EXPECT_EQ("ediacaran." + std::to_string(i), events[i].first);
+    EXPECT_EQ(i, events[i].second);
+  }
+
+  // Names that don't fit in a record are dropped.
+  store.AddBootEventWithValue(std::string(100, 'x'), 1);
+  EXPECT_EQ(static_cast<size_t>(kEvents), store.GetAllBootEvents().size());
+}
+
+TEST_F(BootEventRecordStoreTest, RecordFileMigratesLegacyRecords) {
+  BootEventRecordStore legacy_store;
+  legacy_store.SetStorePath(GetStorePathForTesting());
+  legacy_store.AddBootEventWithValue("tonian", 720);
+  legacy_store.AddBootEventWithValue("cryogenian", 635);
+
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+  store.SetUseRecordFile(true);
+
+  std::vector<std::string> names;
+  std::vector<int32_t> values;
+  for (const auto& event : store.GetAllBootEvents()) {
+    names.push_back(event.first);
+    values.push_back(event.second);
+  }
+  EXPECT_THAT(names, UnorderedElementsAreArray({"tonian", "cryogenian"}));
+  EXPECT_THAT(values, UnorderedElementsAreArray({720, 635}));
+
+  // The per-event files are gone, and the legacy layout skips the record file.
+  EXPECT_EQ(-1, access(store.GetBootEventPath("tonian").c_str(), F_OK));
+  EXPECT_TRUE(legacy_store.GetAllBootEvents().empty());
+}
+
+TEST_F(BootEventRecordStoreTest, RecordFileSharedBetweenStores) {
+  BootEventRecordStore reader;
+  reader.SetStorePath(GetStorePathForTesting());
+  reader.SetUseRecordFile(true);
+  EXPECT_TRUE(reader.GetAllBootEvents().empty());
+
+  // Another store appending past the reader's mapping.
+  {
+    BootEventRecordStore writer;
+    writer.SetStorePath(GetStorePathForTesting());
+    writer.SetUseRecordFile(true);
+    for (int i = 0; i < 100; ++i) {
+      writer.AddBootEventWithValue("stenian." + std::to_string(i), i);
+    }
+  }
+
+  BootEventRecordStore::BootEventRecord record;
+  EXPECT_TRUE(reader.GetBootEvent("stenian.99", &record));
+  EXPECT_EQ(99, record.second);
+  EXPECT_EQ(100U, reader.GetAllBootEvents().size());
+}
@@ -22,6 +22,7 @@
 #include <sys/klog.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <cstddef>
@@ -33,6 +34,7 @@
 #include <regex>
 #include <string>
 #include <string_view>
+#include <tuple>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -42,9 +44,11 @@
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android/log.h>
 #include <cutils/android_reboot.h>
+#include <cutils/boot_events.h>
 #include <cutils/properties.h>
 #include <statslog.h>
 
@@ -219,7 +223,8 @@ void ShowHelp(const char* cmd) {
           "  --record_boot_complete  Record metrics related to the time for the device boot\n"
           "  --record_boot_reason    Record the reason why the device booted\n"
           "  --record_time_since_factory_reset  Record the time since the device was reset\n"
-          "  --boot_reason_enum=<reason>  Report the match to the kBootReasonMap table\n");
+          "  --boot_reason_enum=<reason>  Report the match to the kBootReasonMap table\n"
+          "  --boot_events_trace     Print the boot timeline as a trace for the Perfetto UI\n");
 }
 
 // Constructs a readable, printable string from the givencommand line
@@ -1301,6 +1306,102 @@ android::base::boot_clock::duration GetUptime() {
   return android::base::boot_clock::now().time_since_epoch() - GetBootTimeOffset();
 }
 
+// Reads the boot timeline recorded by init, ueventd, fs_mgr and the other
+// early boot processes, with timestamps adjusted like GetUptime().
+std::vector<boot_event> ReadBootTimeline() {
+  std::vector<boot_event> events(BOOT_EVENTS_MAX);
+  ssize_t count = boot_events_read(BOOT_EVENTS_FILE, events.data(), events.size());
+  if (count < 0) {
+    PLOG(WARNING) << "Failed to read the boot timeline from " << BOOT_EVENTS_FILE;
+    return {};
+  }
+  events.resize(count);
+
+  const uint64_t offset_ns = GetBootTimeOffset().count();
+  for (auto& event : events) {
+    event.timestamp_ns = event.timestamp_ns > offset_ns ? event.timestamp_ns - offset_ns : 0;
+  }
+  return events;
+}
+
+struct BootTimelineSpan {
+  std::string category;
+  std::string name;
+  int32_t pid;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+};
+
+// Pairs each end event with the latest unmatched begin event of the same
+// process, category and name. Begin events that were never ended are dropped.
+std::vector<BootTimelineSpan> GetBootTimelineSpans(const std::vector<boot_event>& events) {
+  std::map<std::tuple<int32_t, std::string, std::string>, std::vector<uint64_t>> open_spans;
+  std::vector<BootTimelineSpan> spans;
+  for (const auto& event : events) {
+    auto key = std::make_tuple(event.pid, std::string(event.category), std::string(event.name));
+    if (event.phase == BOOT_EVENT_BEGIN) {
+      open_spans[key].push_back(event.timestamp_ns);
+    } else if (event.phase == BOOT_EVENT_END) {
+      auto it = open_spans.find(key);
+      if (it == open_spans.end() || it->second.empty()) continue;
+      uint64_t start_ns = it->second.back();
+      it->second.pop_back();
+      uint64_t duration_ns = event.timestamp_ns > start_ns ? event.timestamp_ns - start_ns : 0;
+      spans.push_back({event.category, event.name, event.pid, start_ns, duration_ns});
+    }
+  }
+  return spans;
+}
+
+// Logs the longest spans of the boot timeline. They are logged rather than
+// recorded as boot events, as their names differ from device to device.
+void LogBootTimelineSummary() {
+  constexpr size_t kMaxSpans = 20;
+
+  auto spans = GetBootTimelineSpans(ReadBootTimeline());
+  auto count = std::min(spans.size(), kMaxSpans);
+  std::partial_sort(spans.begin(), spans.begin() + count, spans.end(),
+                    [](const auto& a, const auto& b) { return a.duration_ns > b.duration_ns; });
+  LOG(INFO) << "Boot timeline has " << spans.size() << " spans, the longest are:";
+  for (size_t i = 0; i < count; ++i) {
+    const auto& span = spans[i];
+    LOG(INFO) << "  " << span.category << "/" << span.name << " (pid " << span.pid << ") took "
+              << span.duration_ns / 1000000.0 << " ms, starting at "
+              << span.start_ns / 1000000.0 << " ms";
+  }
+}
+
+std::string EscapeJsonString(const char* str) {
+  std::string escaped;
+  for (const char* c = str; *c != '\0'; ++c) {
+    if (*c == '"' || *c == '\\') {
+      escaped += '\\';
+      escaped += *c;
+    } else if (static_cast<unsigned char>(*c) < 0x20) {
+      escaped += android::base::StringPrintf("\\u%04x", *c);
+    } else {
+      escaped += *c;
+    }
+  }
+  return escaped;
+}
+
+// Prints the boot timeline in the Trace Event Format, which the Perfetto UI
+// and chrome://tracing can open.
+void PrintBootTimelineTrace() {
+  auto events = ReadBootTimeline();
+  printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (size_t i = 0; i < events.size(); ++i) {
+    const auto& event = events[i];
+    printf("%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,"
+           "\"tid\":%d%s}",
+           i == 0 ? "" : ",", EscapeJsonString(event.name).c_str(),
+           EscapeJsonString(event.category).c_str(), event.phase, event.timestamp_ns / 1000.0,
+           event.pid, event.tid, event.phase == BOOT_EVENT_INSTANT ? ",\"s\":\"p\"" : "");
+  }
+  printf("\n]}\n");
+}
+
 // Records several metrics related to the time it takes to boot the device,
 // including disambiguating boot time on encrypted or non-encrypted devices.
 void RecordBootComplete() {
@@ -1369,6 +1470,8 @@ void RecordBootComplete() {
 
   LogBootInfoToStatsd(boot_end_time, absolute_boot_time, bootloader_boot_duration,
                       time_since_last_boot);
+
+  LogBootTimelineSummary();
 }
 
 // Records the boot_reason metric by querying the ro.boot.bootreason system
@@ -1495,6 +1598,7 @@ int main(int argc, char** argv) {
   static const char boot_reason_str[] = "record_boot_reason";
   static const char factory_reset_str[] = "record_time_since_factory_reset";
   static const char boot_reason_enum_str[] = "boot_reason_enum";
+  static const char boot_events_trace_str[] = "boot_events_trace";
   static const struct option long_options[] = {
       // clang-format off
       { "help",                 no_argument,       NULL,   'h' },
@@ -1507,6 +1611,7 @@ int main(int argc, char** argv) {
       { boot_reason_str,        no_argument,       NULL,   0 },
       { factory_reset_str,      no_argument,       NULL,   0 },
       { boot_reason_enum_str,   optional_argument, NULL,   0 },
+      { boot_events_trace_str,  no_argument,       NULL,   0 },
       { NULL,                   0,                 NULL,   0 }
       // clang-format on
   };
@@ -1533,6 +1638,8 @@ int main(int argc, char** argv) {
           RecordFactoryReset();
         } else if (option_name == boot_reason_enum_str) {
           PrintBootReasonEnum(optarg);
+        } else if (option_name == boot_events_trace_str) {
+          PrintBootTimelineTrace();
         } else {
           LOG(ERROR) << "Invalid option: " << option_name;
         }
@@ -17,9 +17,13 @@
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <linux/kcmp.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
@@ -238,6 +242,18 @@ static void Initialize(char** argv) {
   });
 }
 
+static bool is_valid_dump_type(DebuggerdDumpType dump_type) {
+  switch (dump_type) {
+    case kDebuggerdNativeBacktrace:
+    case kDebuggerdTombstone:
+    case kDebuggerdTombstoneProto:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
 static void ParseArgs(int argc, char** argv, pid_t* pseudothread_tid, DebuggerdDumpType* dump_type) {
   if (argc != 4) {
     LOG(FATAL) << "wrong number of args: " << argc << " (expected 4)";
@@ -257,14 +273,8 @@ static void ParseArgs(int argc, char** argv, pid_t* pseudothread_tid, DebuggerdD
   }
 
   *dump_type = static_cast<DebuggerdDumpType>(dump_type_int);
-  switch (*dump_type) {
-    case kDebuggerdNativeBacktrace:
-    case kDebuggerdTombstone:
-    case kDebuggerdTombstoneProto:
-      break;
-
-    default:
-      LOG(FATAL) << "invalid requested dump type: " << dump_type_int;
+  if (!is_valid_dump_type(*dump_type)) {
+    LOG(FATAL) << "invalid requested dump type: " << dump_type_int;
   }
 }
 
@@ -388,65 +398,14 @@ static void InstallSigPipeHandler() {
   sigaction(SIGPIPE, &action, nullptr);
 }
 
-int main(int argc, char** argv) {
-  DefuseSignalHandlers();
-  InstallSigPipeHandler();
-
-  // There appears to be a bug in the kernel where our death causes SIGHUP to
-  // be sent to our process group if we exit while it has stopped jobs (e.g.
-  // because of wait_for_debugger). Use setsid to create a new process group to
-  // avoid hitting this.
-  setsid();
-
-  atrace_begin(ATRACE_TAG, "before reparent");
-  pid_t target_process = getppid();
-
-  // Open /proc/`getppid()` before we daemonize.
-  std::string target_proc_path = "/proc/" + std::to_string(target_process);
-  int target_proc_fd = open(target_proc_path.c_str(), O_DIRECTORY | O_RDONLY);
-  if (target_proc_fd == -1) {
-    PLOG(FATAL) << "failed to open " << target_proc_path;
-  }
-
-  // Make sure getppid() hasn't changed.
-  if (getppid() != target_process) {
-    LOG(FATAL) << "parent died";
-  }
-  atrace_end(ATRACE_TAG);
-
-  // Reparent ourselves to init, so that the signal handler can waitpid on the
-  // original process to avoid leaving a zombie for non-fatal dumps.
-  // Move the input/output pipes off of stdout/stderr, out of paranoia.
-  unique_fd output_pipe(dup(STDOUT_FILENO));
-  unique_fd input_pipe(dup(STDIN_FILENO));
-
-  unique_fd fork_exit_read, fork_exit_write;
-  if (!Pipe(&fork_exit_read, &fork_exit_write)) {
-    PLOG(FATAL) << "failed to create pipe";
-  }
-
-  pid_t forkpid = fork();
-  if (forkpid == -1) {
-    PLOG(FATAL) << "fork failed";
-  } else if (forkpid == 0) {
-    fork_exit_read.reset();
-  } else {
-    // We need the pseudothread to live until we get around to verifying the vm pid against it.
-    // The last thing it does is block on a waitpid on us, so wait until our child tells us to die.
-    fork_exit_write.reset();
-    char buf;
-    TEMP_FAILURE_RETRY(read(fork_exit_read.get(), &buf, sizeof(buf)));
-    _exit(0);
-  }
-
-  ATRACE_NAME("after reparent");
-  pid_t pseudothread_tid;
-  DebuggerdDumpType dump_type;
+// Dump |target_process|, whose pseudothread is waiting on us.
+// |input_pipe| carries the crash info from the pseudothread, writing to |output_pipe| tells it to
+// fork the vm process, and closing |release_fd| lets it exit.
+static int dump_process(pid_t target_process, int target_proc_fd, uid_t target_uid,
+                        pid_t pseudothread_tid, DebuggerdDumpType dump_type, unique_fd input_pipe,
+                        unique_fd output_pipe, unique_fd release_fd) {
   ProcessInfo process_info;
 
-  Initialize(argv);
-  ParseArgs(argc, argv, &pseudothread_tid, &dump_type);
-
   // Die if we take too long.
   //
   // Note: processes with many threads and minidebug-info can take a bit to
@@ -488,7 +447,7 @@ int main(int argc, char** argv) {
       ThreadInfo info;
       info.pid = target_process;
       info.tid = thread;
-      info.uid = getuid();
+      info.uid = target_uid;
       info.thread_name = get_thread_name(thread);
 
       unique_fd attr_fd(openat(target_proc_fd, "attr/current", O_RDONLY | O_CLOEXEC));
@@ -555,7 +514,7 @@ int main(int argc, char** argv) {
   }
 
   // The pseudothread can die now.
-  fork_exit_write.reset();
+  release_fd.reset();
 
   // Defer the message until later, for readability.
   bool wait_for_debugger = android::base::GetBoolProperty(
@@ -565,7 +524,8 @@ int main(int argc, char** argv) {
     wait_for_debugger = false;
   }
 
-  // Detach from all of our attached threads before resuming.
+  // Detach from all of our attached threads before resuming. Everything after this works on the
+  // vm process, so the target doesn't wait for the unwinding or symbolization.
   for (const auto& [tid, thread] : thread_info) {
     int resume_signal = thread.signo == BIONIC_SIGNAL_DEBUGGER ? 0 : thread.signo;
     if (wait_for_debugger) {
@@ -627,6 +587,9 @@ int main(int argc, char** argv) {
   if (!unwinder.Init()) {
     LOG(FATAL) << "Failed to init unwinder object.";
   }
+  // The vm process is a stopped copy of the target, which process_vm_readv() can read from any
+  // of our threads.
+  process_info.unwind_pid = vm_pid;
 
   std::string amfd_data;
   if (backtrace) {
@@ -674,3 +637,226 @@ int main(int argc, char** argv) {
 
   return 0;
 }
+
+static bool receive_worker_request(int sock, CrashWorkerRequest* request, unique_fd* input_pipe,
+                                   unique_fd* output_pipe) {
+  struct iovec iov = {.iov_base = request, .iov_len = sizeof(*request)};
+  alignas(struct cmsghdr) char cmsg_buf[CMSG_SPACE(sizeof(int) * 2)];
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = cmsg_buf,
+      .msg_controllen = sizeof(cmsg_buf),
+  };
+  ssize_t rc = TEMP_FAILURE_RETRY(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC));
+  if (rc == -1) {
+    PLOG(ERROR) << "failed to receive crash_dump worker request";
+    return false;
+  }
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+      cmsg->cmsg_len == CMSG_LEN(sizeof(int) * 2)) {
+    int fds[2];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    input_pipe->reset(fds[0]);
+    output_pipe->reset(fds[1]);
+  }
+
+  if (rc != sizeof(*request) || *output_pipe == -1 || (msg.msg_flags & MSG_CTRUNC)) {
+    LOG(ERROR) << "malformed crash_dump worker request";
+    return false;
+  }
+  return true;
+}
+
+// Anyone can connect to the worker, so make sure that the request came from the process it asks
+// us to dump. The pidfd pins the peer, and kcmp proves that the pseudothread named in the request
+// is the one holding the other ends of the pipes we were handed.
+static bool validate_worker_request(int sock, const CrashWorkerRequest& request,
+                                    const unique_fd& input_pipe, const unique_fd& output_pipe,
+                                    pid_t* target_process, uid_t* target_uid,
+                                    unique_fd* target_proc_fd) {
+  ucred cr = {};
+  socklen_t len = sizeof(cr);
+  if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cr, &len) != 0) {
+    PLOG(ERROR) << "failed to get crash_dump worker peer credentials";
+    return false;
+  }
+
+  if (!is_valid_dump_type(request.dump_type)) {
+    LOG(ERROR) << "invalid requested dump type: " << request.dump_type;
+    return false;
+  }
+
+  unique_fd pidfd(syscall(__NR_pidfd_open, cr.pid, 0));
+  if (pidfd == -1) {
+    PLOG(ERROR) << "failed to open pidfd for " << cr.pid;
+    return false;
+  }
+
+  std::string target_proc_path = "/proc/" + std::to_string(cr.pid);
+  target_proc_fd->reset(open(target_proc_path.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC));
+  if (*target_proc_fd == -1) {
+    PLOG(ERROR) << "failed to open " << target_proc_path;
+    return false;
+  }
+
+  // If the pidfd's process is still alive, the /proc directory we just opened is its.
+  struct pollfd pfd = {.fd = pidfd.get(), .events = POLLIN};
+  if (TEMP_FAILURE_RETRY(poll(&pfd, 1, 0)) != 0) {
+    LOG(ERROR) << "process " << cr.pid << " died before it could be dumped";
+    return false;
+  }
+
+  if (!pid_contains_tid(target_proc_fd->get(), request.crashing_tid) ||
+      !pid_contains_tid(target_proc_fd->get(), request.pseudothread_tid)) {
+    LOG(ERROR) << "process " << cr.pid << " asked for a dump of threads " << request.crashing_tid
+               << " and " << request.pseudothread_tid << " that it doesn't own";
+    return false;
+  }
+
+  pid_t self = getpid();
+  if (syscall(__NR_kcmp, self, request.pseudothread_tid, KCMP_FILE, input_pipe.get(),
+              request.crash_info_fd) != 0 ||
+      syscall(__NR_kcmp, self, request.pseudothread_tid, KCMP_FILE, output_pipe.get(),
+              request.ack_fd) != 0) {
+    LOG(ERROR) << "pseudothread " << request.pseudothread_tid
+               << " doesn't hold the pipes sent with its request";
+    return false;
+  }
+
+  *target_process = cr.pid;
+  *target_uid = cr.uid;
+  return true;
+}
+
+// Handle a single request, in a child of the worker.
+static int serve_worker_request(char** argv, unique_fd sock) {
+  // Die if we take too long, even before dump_process sets its own timeout.
+  alarm(30 * android::base::HwTimeoutMultiplier());
+  setsid();
+
+  CrashWorkerRequest request;
+  unique_fd input_pipe, output_pipe, target_proc_fd;
+  pid_t target_process;
+  uid_t target_uid;
+  if (!receive_worker_request(sock.get(), &request, &input_pipe, &output_pipe) ||
+      !validate_worker_request(sock.get(), request, input_pipe, output_pipe, &target_process,
+                               &target_uid, &target_proc_fd)) {
+    // Closing the socket without acking sends the signal handler down the exec path.
+    return 1;
+  }
+
+  g_target_thread = request.crashing_tid;
+  Initialize(argv);
+
+  if (TEMP_FAILURE_RETRY(write(sock.get(), "\1", 1)) != 1) {
+    PLOG(FATAL) << "failed to accept crash_dump worker request";
+  }
+
+  return dump_process(target_process, target_proc_fd.release(), target_uid,
+                      request.pseudothread_tid, request.dump_type, std::move(input_pipe),
+                      std::move(output_pipe), std::move(sock));
+}
+
+// Serve dump requests from signal handlers on the socket init created for us, forking a child
+// for each so that it starts with everything already loaded and initialized.
+static int run_worker(char** argv) {
+  android::base::InitLogging(argv);
+
+  int listen_fd = android_get_control_socket(kTombstonedCrashWorkerSocketName);
+  if (listen_fd == -1) {
+    LOG(FATAL) << "failed to get socket from init";
+  }
+  fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+
+  // Let the kernel reap the children.
+  signal(SIGCHLD, SIG_IGN);
+
+  LOG(INFO) << "crash_dump worker waiting for requests";
+  while (true) {
+    unique_fd sock(TEMP_FAILURE_RETRY(accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC)));
+    if (sock == -1) {
+      PLOG(ERROR) << "failed to accept crash_dump worker connection";
+      continue;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+      // Dropping the connection sends the signal handler down the exec path.
+      PLOG(ERROR) << "failed to fork crash_dump worker child";
+    } else if (pid == 0) {
+      close(listen_fd);
+      // ptrace relies on waitpid, which SIG_IGN would break.
+      signal(SIGCHLD, SIG_DFL);
+      _exit(serve_worker_request(argv, std::move(sock)));
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  DefuseSignalHandlers();
+  InstallSigPipeHandler();
+
+  if (argc == 2 && strcmp(argv[1], "--worker") == 0) {
+    return run_worker(argv);
+  }
+
+  // There appears to be a bug in the kernel where our death causes SIGHUP to
+  // be sent to our process group if we exit while it has stopped jobs (e.g.
+  // because of wait_for_debugger). Use setsid to create a new process group to
+  // avoid hitting this.
+  setsid();
+
+  atrace_begin(ATRACE_TAG, "before reparent");
+  pid_t target_process = getppid();
+
+  // Open /proc/`getppid()` before we daemonize.
+  std::string target_proc_path = "/proc/" + std::to_string(target_process);
+  int target_proc_fd = open(target_proc_path.c_str(), O_DIRECTORY | O_RDONLY);
+  if (target_proc_fd == -1) {
+    PLOG(FATAL) << "failed to open " << target_proc_path;
+  }
+
+  // Make sure getppid() hasn't changed.
+  if (getppid() != target_process) {
+    LOG(FATAL) << "parent died";
+  }
+  atrace_end(ATRACE_TAG);
+
+  // Reparent ourselves to init, so that the signal handler can waitpid on the
+  // original process to avoid leaving a zombie for non-fatal dumps.
+  // Move the input/output pipes off of stdout/stderr, out of paranoia.
+  unique_fd output_pipe(dup(STDOUT_FILENO));
+  unique_fd input_pipe(dup(STDIN_FILENO));
+
+  unique_fd fork_exit_read, fork_exit_write;
+  if (!Pipe(&fork_exit_read, &fork_exit_write)) {
+    PLOG(FATAL) << "failed to create pipe";
+  }
+
+  pid_t forkpid = fork();
+  if (forkpid == -1) {
+    PLOG(FATAL) << "fork failed";
+  } else if (forkpid == 0) {
+    fork_exit_read.reset();
+  } else {
+    // We need the pseudothread to live until we get around to verifying the vm pid against it.
+    // The last thing it does is block on a waitpid on us, so wait until our child tells us to die.
+    fork_exit_write.reset();
+    char buf;
+    TEMP_FAILURE_RETRY(read(fork_exit_read.get(), &buf, sizeof(buf)));
+    _exit(0);
+  }
+
+  ATRACE_NAME("after reparent");
+  pid_t pseudothread_tid;
+  DebuggerdDumpType dump_type;
+
+  Initialize(argv);
+  ParseArgs(argc, argv, &pseudothread_tid, &dump_type);
+
+  return dump_process(target_process, target_proc_fd, getuid(), pseudothread_tid, dump_type,
+                      std::move(input_pipe), std::move(output_pipe), std::move(fork_exit_write));
+}
@@ -17,15 +17,24 @@
 #include <err.h>
 #include <errno.h>
 #include <sched.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include <benchmark/benchmark.h>
 #include <debuggerd/client.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/Memory.h>
+
+#include "libdebuggerd/utility.h"
 
 using namespace std::chrono_literals;
 
@@ -63,7 +72,7 @@ static std::chrono::duration<double> GetMaximumPause(std::atomic<ThreadState>& s
   return max_diff;
 }
 
-static void PerformDump() {
+static void PerformDump(DebuggerdDumpType dump_type) {
   pid_t target = getpid();
   pid_t forkpid = fork();
   if (forkpid == -1) {
@@ -84,7 +93,7 @@ static void PerformDump() {
       err(1, "failed to open /dev/null");
     }
 
-    if (!debuggerd_trigger_dump(target, kDebuggerdNativeBacktrace, 1000, std::move(output_fd))) {
+    if (!debuggerd_trigger_dump(target, dump_type, 1000, std::move(output_fd))) {
       errx(1, "failed to trigger dump");
     }
 
@@ -92,9 +101,41 @@ static void PerformDump() {
   }
 }
 
+// Threads that sit idle for as long as the object lives, so that there's more for crash_dump to
+// stop, read and unwind.
+class IdleThreads {
+ public:
+  explicit IdleThreads(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      threads_.emplace_back([this]() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stopping_; });
+      });
+    }
+  }
+
+  ~IdleThreads() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
 template <typename Fn>
 static void BM_maximum_pause_impl(benchmark::State& state, const Fn& function) {
   SetScheduler();
+  IdleThreads idle_threads(state.range(0));
 
   for (auto _ : state) {
     std::chrono::duration<double> max_pause;
@@ -118,11 +159,77 @@ static void BM_maximum_pause_noop(benchmark::State& state) {
   BM_maximum_pause_impl(state, []() {});
 }
 
+// The pause only covers the time the target is stopped: crash_dump lets it go as soon as it has
+// the registers and a copy of its address space, and unwinds and symbolizes the copy afterwards.
+// The argument is the number of extra threads in the target, which the pause should grow with
+// while the unwinding and symbolization time shouldn't show up in it.
 static void BM_maximum_pause_debuggerd(benchmark::State& state) {
-  BM_maximum_pause_impl(state, []() { PerformDump(); });
+  BM_maximum_pause_impl(state, []() { PerformDump(kDebuggerdNativeBacktrace); });
+}
+
+static void BM_maximum_pause_debuggerd_tombstone(benchmark::State& state) {
+  BM_maximum_pause_impl(state, []() { PerformDump(kDebuggerdTombstone); });
+}
+
+BENCHMARK(BM_maximum_pause_noop)->Arg(0)->Iterations(128)->UseManualTime();
+BENCHMARK(BM_maximum_pause_debuggerd)->Arg(0)->Arg(64)->Iterations(128)->UseManualTime();
+BENCHMARK(BM_maximum_pause_debuggerd_tombstone)->Arg(0)->Arg(64)->Iterations(128)->UseManualTime();
+
+// Dumping the memory around the registers of a crashing thread, from a child with the same
+// address space as ours, with each register pointing to a different page.
+static constexpr size_t kNumRegisters = 32;
+alignas(4096) static uint8_t g_register_targets[(kNumRegisters + 1) * 4096];
+
+template <typename Fn>
+static void BM_dump_memory_registers_impl(benchmark::State& state, const Fn& make_memory) {
+  memset(g_register_targets, 0x5a, sizeof(g_register_targets));
+  pid_t child = fork();
+  if (child == -1) {
+    err(1, "fork failed");
+  } else if (child == 0) {
+    while (true) {
+      pause();
+    }
+  }
+
+  unwindstack::RemoteMaps maps(child);
+  if (!maps.Parse()) {
+    errx(1, "failed to parse maps of %d", child);
+  }
+  std::vector<uint64_t> addrs;
+  for (size_t i = 0; i < kNumRegisters; ++i) {
+    addrs.push_back(reinterpret_cast<uintptr_t>(&g_register_targets[(i + 1) * 4096]));
+  }
+
+  for (auto _ : state) {
+    std::shared_ptr<unwindstack::Memory> process_memory =
+        unwindstack::Memory::CreateProcessMemoryCached(child);
+    std::unique_ptr<unwindstack::Memory> memory = make_memory(child, process_memory, &maps, addrs);
+    for (uint64_t addr : addrs) {
+      uint8_t data[256];
+      uint8_t tags[256 / kTagGranuleSize];
+      benchmark::DoNotOptimize(dump_memory(data, sizeof(data), tags, sizeof(tags), &addr,
+                                           memory ? memory.get() : process_memory.get()));
+    }
+  }
+
+  kill(child, SIGKILL);
+  waitpid(child, nullptr, 0);
+}
+
+static void BM_dump_memory_registers(benchmark::State& state) {
+  BM_dump_memory_registers_impl(state, [](auto...) { return nullptr; });
+}
+
+static void BM_dump_memory_registers_batched(benchmark::State& state) {
+  BM_dump_memory_registers_impl(state, [](pid_t pid, std::shared_ptr<unwindstack::Memory> memory,
+                                          unwindstack::Maps* maps,
+                                          const std::vector<uint64_t>& addrs) {
+    return std::make_unique<MemoryDumpBatch>(pid, memory.get(), maps, addrs);
+  });
 }
 
-BENCHMARK(BM_maximum_pause_noop)->Iterations(128)->UseManualTime();
-BENCHMARK(BM_maximum_pause_debuggerd)->Iterations(128)->UseManualTime();
+BENCHMARK(BM_dump_memory_registers);
+BENCHMARK(BM_dump_memory_registers_batched);
 
 BENCHMARK_MAIN();
@@ -303,6 +303,75 @@ static DebuggerdDumpType get_dump_type(const debugger_thread_info* thread_info)
   return kDebuggerdTombstoneProto;
 }
 
+#if defined(__LP64__)
+// Hand the dump off to the crash_dump worker that init keeps running alongside tombstoned, which
+// saves exec'ing a new crash_dump and waiting for it to start up. The worker gets the same pipe
+// ends that an exec'd crash_dump would have as stdin and stdout.
+// Returns the connection to the worker if it accepted the dump, or an invalid fd if we need to
+// exec crash_dump ourselves.
+static unique_fd connect_crash_worker(const debugger_thread_info* thread_info, int crash_info_fd,
+                                      int ack_fd) {
+  unique_fd sock(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+  if (sock == -1) {
+    return {};
+  }
+
+  sockaddr_un addr = {.sun_family = AF_UNIX};
+  async_safe_format_buffer(addr.sun_path, sizeof(addr.sun_path), "/dev/socket/%s",
+                           kTombstonedCrashWorkerSocketName);
+  if (connect(sock.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    // The worker isn't running, which is the common case.
+    return {};
+  }
+
+  // Don't let a wedged worker hold up the fallback for long.
+  struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+  setsockopt(sock.get(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  setsockopt(sock.get(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  CrashWorkerRequest request = {
+      .crashing_tid = thread_info->crashing_tid,
+      .pseudothread_tid = thread_info->pseudothread_tid,
+      .dump_type = get_dump_type(thread_info),
+      .crash_info_fd = crash_info_fd,
+      .ack_fd = ack_fd,
+  };
+  struct iovec iov = {.iov_base = &request, .iov_len = sizeof(request)};
+
+  int fds[2] = {crash_info_fd, ack_fd};
+  alignas(struct cmsghdr) char cmsg_buf[CMSG_SPACE(sizeof(fds))] = {};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = cmsg_buf,
+      .msg_controllen = sizeof(cmsg_buf),
+  };
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (TEMP_FAILURE_RETRY(sendmsg(sock.get(), &msg, 0)) != sizeof(request)) {
+    async_safe_format_log(ANDROID_LOG_WARN, "libc", "failed to send request to crash_dump worker: %s",
+                          strerror(errno));
+    return {};
+  }
+
+  char ack;
+  if (TEMP_FAILURE_RETRY(read(sock.get(), &ack, sizeof(ack))) != 1 || ack != '\1') {
+    async_safe_format_log(ANDROID_LOG_WARN, "libc",
+                          "crash_dump worker rejected the dump, falling back to exec");
+    return {};
+  }
+
+  // From here on the worker is bound by crash_dump's own timeout.
+  tv.tv_sec = 0;
+  setsockopt(sock.get(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  return sock;
+}
+#endif
+
 static int debuggerd_dispatch_pseudothread(void* arg) {
   debugger_thread_info* thread_info = static_cast<debugger_thread_info*>(arg);
 
@@ -365,9 +434,16 @@ static int debuggerd_dispatch_pseudothread(void* arg) {
     fatal("failed to write crash info, wrote %zd bytes, expected %zd", rc, expected);
   }
 
+  unique_fd worker_socket;
+#if defined(__LP64__)
+  worker_socket = connect_crash_worker(thread_info, output_read.get(), input_write.get());
+#endif
+
   // Don't use fork(2) to avoid calling pthread_atfork handlers.
-  pid_t crash_dump_pid = __fork();
-  if (crash_dump_pid == -1) {
+  pid_t crash_dump_pid = -1;
+  if (worker_socket != -1) {
+    // The worker has taken over the dump.
+  } else if ((crash_dump_pid = __fork()) == -1) {
     async_safe_format_log(ANDROID_LOG_FATAL, "libc",
                           "failed to fork in debuggerd signal handler: %s", strerror(errno));
   } else if (crash_dump_pid == 0) {
@@ -426,9 +502,12 @@ static int debuggerd_dispatch_pseudothread(void* arg) {
     }
   }
 
-  // Don't leave a zombie child.
   int status;
-  if (TEMP_FAILURE_RETRY(waitpid(crash_dump_pid, &status, 0)) == -1) {
+  if (worker_socket != -1) {
+    // The worker closes the connection once it's done with this thread.
+    TEMP_FAILURE_RETRY(read(worker_socket.get(), &buf, sizeof(buf)));
+  } else if (TEMP_FAILURE_RETRY(waitpid(crash_dump_pid, &status, 0)) == -1) {
+    // Don't leave a zombie child.
     async_safe_format_log(ANDROID_LOG_FATAL, "libc", "failed to wait for crash_dump helper: %s",
                           strerror(errno));
   } else if (WIFSTOPPED(status) || WIFSIGNALED(status)) {
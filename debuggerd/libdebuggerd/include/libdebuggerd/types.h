@@ -54,4 +54,8 @@ struct ProcessInfo {
   bool has_fault_address = false;
   uintptr_t untagged_fault_address = 0;
   uintptr_t maybe_tagged_fault_address = 0;
+
+  // The process whose memory the unwinder reads, if threads other than the tracer can read it
+  // too. When set, threads with registers are unwound in parallel.
+  pid_t unwind_pid = 0;
 };
@@ -23,8 +23,10 @@
 #include <sys/types.h>
 
 #include <string>
+#include <vector>
 
 #include <android-base/macros.h>
+#include <unwindstack/Memory.h>
 
 struct log_t {
   // Tombstone file descriptor.
@@ -73,6 +75,7 @@ void _LOG(log_t* log, logtype ltype, const char* fmt, ...) __attribute__((format
 void _VLOG(log_t* log, logtype ltype, const char* fmt, va_list ap);
 
 namespace unwindstack {
+class Maps;
 class Unwinder;
 class Memory;
 }
@@ -83,6 +86,29 @@ ssize_t dump_memory(void* out, size_t len, uint8_t* tags, size_t tags_len, uint6
                     unwindstack::Memory* memory);
 void dump_memory(log_t* log, unwindstack::Memory* backtrace, uint64_t addr, const std::string&);
 
+// Memory for dumping the memory around many addresses of another process at once. The regions
+// dump_memory() would show for each of the addresses are read up front, with as few
+// process_vm_readv() calls as possible, instead of one read (or, failing that, one ptrace peek per
+// word) at a time. Reads of anything else, and of regions that couldn't be read in one piece, go
+// to the memory it wraps.
+class MemoryDumpBatch : public unwindstack::Memory {
+ public:
+  MemoryDumpBatch(pid_t pid, unwindstack::Memory* memory, unwindstack::Maps* maps,
+                  const std::vector<uint64_t>& addrs);
+
+  size_t Read(uint64_t addr, void* dst, size_t size) override;
+  long ReadTag(uint64_t addr) override;
+
+ private:
+  struct Region {
+    uint64_t start;
+    std::vector<uint8_t> data;
+  };
+
+  unwindstack::Memory* memory_;
+  std::vector<Region> regions_;
+};
+
 void drop_capabilities();
 
 bool signal_has_sender(const siginfo_t*, pid_t caller_pid);
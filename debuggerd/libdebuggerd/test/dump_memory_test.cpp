@@ -21,6 +21,7 @@
 
 #include <android-base/file.h>
 #include <gtest/gtest.h>
+#include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
 
 #include "libdebuggerd/utility.h"
@@ -594,3 +595,28 @@ TEST_F(DumpMemoryTest, first_read_empty_next_page_out_of_range_fence_post) {
   ASSERT_STREQ("", getFakeLogBuf().c_str());
   ASSERT_STREQ("", getFakeLogPrint().c_str());
 }
+
+TEST_F(DumpMemoryTest, batch) {
+  alignas(16) static uint8_t buffer[512];
+  for (size_t i = 0; i < sizeof(buffer); i++) {
+    buffer[i] = i;
+  }
+
+  unwindstack::LocalMaps maps;
+  ASSERT_TRUE(maps.Parse());
+
+  // The memory mock has no data, so anything dumped has to come from the batch.
+  uint64_t readable = reinterpret_cast<uintptr_t>(&buffer[64]);
+  uint64_t unreadable = 0x1000;
+  MemoryDumpBatch batch(getpid(), memory_mock_.get(), &maps, {readable, unreadable, readable});
+
+  uint8_t data[256];
+  uint8_t tags[256 / kTagGranuleSize];
+  uint64_t addr = readable;
+  ASSERT_EQ(256, dump_memory(data, sizeof(data), tags, sizeof(tags), &addr, &batch));
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(&buffer[32]), addr);
+  ASSERT_EQ(0, memcmp(&buffer[32], data, sizeof(data)));
+
+  addr = unreadable;
+  ASSERT_EQ(-1, dump_memory(data, sizeof(data), tags, sizeof(tags), &addr, &batch));
+}
@@ -33,10 +33,14 @@
 #include <sys/sysinfo.h>
 #include <time.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <optional>
 #include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <async_safe/log.h>
 
@@ -348,9 +352,10 @@ void fill_in_backtrace_frame(BacktraceFrame* f, const unwindstack::FrameData& fr
   f->set_build_id(frame.map_info->GetPrintableBuildID());
 }
 
+// If unwind_pid is set, the memory around the registers is read from it all at once.
 static void dump_registers(unwindstack::Unwinder* unwinder,
                            const std::unique_ptr<unwindstack::Regs>& regs, Thread& thread,
-                           bool memory_dump) {
+                           bool memory_dump, pid_t unwind_pid = 0) {
   if (regs == nullptr) {
     return;
   }
@@ -358,6 +363,14 @@ static void dump_registers(unwindstack::Unwinder* unwinder,
   unwindstack::Maps* maps = unwinder->GetMaps();
   unwindstack::Memory* memory = unwinder->GetProcessMemory().get();
 
+  std::unique_ptr<MemoryDumpBatch> batch;
+  if (memory_dump && unwind_pid != 0) {
+    std::vector<uint64_t> addrs;
+    regs->IterateRegisters([&addrs](const char*, uint64_t value) { addrs.push_back(value); });
+    batch = std::make_unique<MemoryDumpBatch>(unwind_pid, memory, maps, addrs);
+    memory = batch.get();
+  }
+
   regs->IterateRegisters([&thread, memory_dump, maps, memory](const char* name, uint64_t value) {
     Register r;
     r.set_name(name);
@@ -446,14 +459,13 @@ static void dump_thread_backtrace(unwindstack::Unwinder* unwinder, Thread& threa
   }
 }
 
-static void dump_thread(Tombstone* tombstone, unwindstack::Unwinder* unwinder,
-                        const ThreadInfo& thread_info, bool memory_dump = false) {
-  Thread thread;
-
-  thread.set_id(thread_info.tid);
-  thread.set_name(thread_info.thread_name);
-  thread.set_tagged_addr_ctrl(thread_info.tagged_addr_ctrl);
-  thread.set_pac_enabled_keys(thread_info.pac_enabled_keys);
+// Returns false if the thread couldn't be unwound at all, and shouldn't appear in the tombstone.
+static bool unwind_thread(Thread* thread, unwindstack::Unwinder* unwinder,
+                          const ThreadInfo& thread_info, bool memory_dump, pid_t unwind_pid = 0) {
+  thread->set_id(thread_info.tid);
+  thread->set_name(thread_info.thread_name);
+  thread->set_tagged_addr_ctrl(thread_info.tagged_addr_ctrl);
+  thread->set_pac_enabled_keys(thread_info.pac_enabled_keys);
 
   if (thread_info.registers == nullptr) {
     // Fallback path for non-main thread, doing unwind from running process.
@@ -462,23 +474,107 @@ static void dump_thread(Tombstone* tombstone, unwindstack::Unwinder* unwinder,
       async_safe_format_log(ANDROID_LOG_ERROR, LOG_TAG,
                             "Unable to initialize ThreadUnwinder object.");
       log_unwinder_error(&thread_unwinder);
-      return;
+      return false;
     }
 
     std::unique_ptr<unwindstack::Regs> initial_regs;
     thread_unwinder.UnwindWithSignal(BIONIC_SIGNAL_BACKTRACE, thread_info.tid, &initial_regs);
-    dump_registers(&thread_unwinder, initial_regs, thread, memory_dump);
-    dump_thread_backtrace(&thread_unwinder, thread);
+    dump_registers(&thread_unwinder, initial_regs, *thread, memory_dump);
+    dump_thread_backtrace(&thread_unwinder, *thread);
   } else {
-    dump_registers(unwinder, thread_info.registers, thread, memory_dump);
+    dump_registers(unwinder, thread_info.registers, *thread, memory_dump, unwind_pid);
     std::unique_ptr<unwindstack::Regs> regs_copy(thread_info.registers->Clone());
     unwinder->SetRegs(regs_copy.get());
     unwinder->Unwind();
-    dump_thread_backtrace(unwinder, thread);
+    dump_thread_backtrace(unwinder, *thread);
+  }
+  return true;
+}
+
+static void dump_thread(Tombstone* tombstone, unwindstack::Unwinder* unwinder,
+                        const ThreadInfo& thread_info, bool memory_dump = false,
+                        pid_t unwind_pid = 0) {
+  Thread thread;
+  if (!unwind_thread(&thread, unwinder, thread_info, memory_dump, unwind_pid)) {
+    return;
   }
 
   auto& threads = *tombstone->mutable_threads();
-  threads[thread_info.tid] = thread;
+  threads[thread_info.tid] = std::move(thread);
+}
+
+// Below this many threads, starting more unwinders costs more than it saves.
+static constexpr size_t kMinThreadsForParallelUnwind = 8;
+static constexpr size_t kMaxUnwindWorkers = 4;
+
+// Unwinds all threads but the target thread, several at a time if the process memory can be read
+// from other threads. Each worker has an unwinder of its own, sharing the maps (and the Elf objects
+// they hold) but reading memory through its own cache, which isn't thread safe.
+// The threads are added to the tombstone in tid order either way.
+static void dump_other_threads(Tombstone* tombstone, unwindstack::Unwinder* unwinder,
+                               const std::map<pid_t, ThreadInfo>& threads, pid_t target_thread,
+                               const ProcessInfo& process_info) {
+  std::vector<const ThreadInfo*> parallel_threads;
+  if (process_info.unwind_pid != 0) {
+    for (const auto& [tid, thread_info] : threads) {
+      if (tid != target_thread && thread_info.registers != nullptr) {
+        parallel_threads.push_back(&thread_info);
+      }
+    }
+  }
+
+  size_t num_workers = std::min({static_cast<size_t>(std::thread::hardware_concurrency()),
+                                 kMaxUnwindWorkers, parallel_threads.size()});
+  if (parallel_threads.size() < kMinThreadsForParallelUnwind || num_workers < 2) {
+    for (const auto& [tid, thread_info] : threads) {
+      if (tid != target_thread) {
+        dump_thread(tombstone, unwinder, thread_info);
+      }
+    }
+    return;
+  }
+
+  std::vector<Thread> results(parallel_threads.size());
+  // Not vector<bool>, whose elements can't be written from different threads.
+  std::vector<char> unwound(parallel_threads.size());
+  std::atomic<size_t> next_thread = 0;
+  auto worker = [&]() {
+    // Init() gives each worker its own process memory and jit/dex debug state.
+    unwindstack::UnwinderFromPid worker_unwinder(kMaxFrames, process_info.unwind_pid,
+                                                 unwinder->Arch(), unwinder->GetMaps());
+    if (!worker_unwinder.Init()) {
+      async_safe_format_log(ANDROID_LOG_ERROR, LOG_TAG, "failed to init unwinder object");
+      return;
+    }
+    size_t i;
+    while ((i = next_thread++) < parallel_threads.size()) {
+      unwound[i] = unwind_thread(&results[i], &worker_unwinder, *parallel_threads[i], false);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < num_workers; ++i) {
+    workers.emplace_back(worker);
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+
+  // Unwind anything the workers didn't get to, along with the threads without registers.
+  auto& tombstone_threads = *tombstone->mutable_threads();
+  size_t i = 0;
+  for (const auto& [tid, thread_info] : threads) {
+    if (i < parallel_threads.size() && parallel_threads[i] == &thread_info) {
+      if (unwound[i]) {
+        tombstone_threads[tid] = std::move(results[i]);
+      } else if (next_thread <= i) {
+        dump_thread(tombstone, unwinder, thread_info);
+      }
+      ++i;
+    } else if (tid != target_thread) {
+      dump_thread(tombstone, unwinder, thread_info);
+    }
+  }
 }
 
 static void dump_mappings(Tombstone* tombstone, unwindstack::Unwinder* unwinder) {
@@ -512,11 +608,19 @@ static void dump_mappings(Tombstone* tombstone, unwindstack::Unwinder* unwinder)
   }
 }
 
+// Only the most recent entries of each buffer are asked of logd, and the oldest of those are
+// dropped again if their text is too much, so that a chatty process doesn't make for a huge
+// tombstone (or a slow one).
+static constexpr unsigned int kMaxLogEntries = 1000;
+static constexpr size_t kMaxLogBytes = 256 * 1024;
+
 static void dump_log_file(Tombstone* tombstone, const char* logger, pid_t pid) {
-  logger_list* logger_list =
-      android_logger_list_open(android_name_to_log_id(logger), ANDROID_LOG_NONBLOCK, 0, pid);
+  logger_list* logger_list = android_logger_list_open(android_name_to_log_id(logger),
+                                                      ANDROID_LOG_NONBLOCK, kMaxLogEntries, pid);
 
   LogBuffer buffer;
+  std::vector<size_t> message_sizes;
+  size_t total_bytes = 0;
 
   while (true) {
     log_msg log_entry;
@@ -577,10 +681,22 @@ static void dump_log_file(Tombstone* tombstone, const char* logger, pid_t pid) {
       log_msg->set_priority(prio);
       log_msg->set_tag(tag);
       log_msg->set_message(msg);
+
+      size_t message_size = timestamp.size() + strlen(tag) + strlen(msg);
+      message_sizes.push_back(message_size);
+      total_bytes += message_size;
     } while ((msg = nl));
   }
   android_logger_list_free(logger_list);
 
+  size_t dropped = 0;
+  while (total_bytes > kMaxLogBytes) {
+    total_bytes -= message_sizes[dropped++];
+  }
+  if (dropped > 0) {
+    buffer.mutable_logs()->DeleteSubrange(0, dropped);
+  }
+
   if (!buffer.logs().empty()) {
     buffer.set_name(logger);
     *tombstone->add_log_buffers() = std::move(buffer);
@@ -699,13 +815,9 @@ void engrave_tombstone_proto(Tombstone* tombstone, unwindstack::Unwinder* unwind
   dump_abort_message(&result, unwinder, process_info);
 
   // Dump the main thread, but save the memory around the registers.
-  dump_thread(&result, unwinder, main_thread, /* memory_dump */ true);
+  dump_thread(&result, unwinder, main_thread, /* memory_dump */ true, process_info.unwind_pid);
 
-  for (const auto& [tid, thread_info] : threads) {
-    if (tid != target_thread) {
-      dump_thread(&result, unwinder, thread_info);
-    }
-  }
+  dump_other_threads(&result, unwinder, threads, target_thread, process_info);
 
   dump_probable_cause(&result, unwinder, process_info, main_thread);
 
@@ -19,15 +19,18 @@
 #include "libdebuggerd/utility.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/capability.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <set>
 #include <string>
 
@@ -39,6 +42,7 @@
 #include <bionic/reserved_signals.h>
 #include <debuggerd/handler.h>
 #include <log/log.h>
+#include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
 #include <unwindstack/Unwinder.h>
 
@@ -129,8 +133,8 @@ void _VLOG(log_t* log, enum logtype ltype, const char* fmt, va_list ap) {
 #define MEMORY_BYTES_PER_LINE 16
 static_assert(MEMORY_BYTES_PER_LINE == kTagGranuleSize);
 
-ssize_t dump_memory(void* out, size_t len, uint8_t* tags, size_t tags_len, uint64_t* addr,
-                    unwindstack::Memory* memory) {
+// Moves addr to the start of the memory dumped for it, returning false if there's nothing to dump.
+static bool dump_memory_start(uint64_t* addr) {
   // Align the address to the number of bytes per line to avoid confusing memory tag output if
   // memory is tagged and we start from a misaligned address. Start 32 bytes before the address.
   *addr &= ~(MEMORY_BYTES_PER_LINE - 1);
@@ -144,7 +148,12 @@ ssize_t dump_memory(void* out, size_t len, uint8_t* tags, size_t tags_len, uint6
   // Don't bother if the address would overflow, taking tag bits into account. Note that
   // untag_address truncates to 32 bits on 32-bit platforms as a side effect of returning a
   // uintptr_t, so this also checks for 32-bit overflow.
-  if (untag_address(*addr + MEMORY_BYTES_TO_DUMP - 1) < *addr) {
+  return untag_address(*addr + MEMORY_BYTES_TO_DUMP - 1) >= *addr;
+}
+
+ssize_t dump_memory(void* out, size_t len, uint8_t* tags, size_t tags_len, uint64_t* addr,
+                    unwindstack::Memory* memory) {
+  if (!dump_memory_start(addr)) {
     return -1;
   }
 
@@ -249,6 +258,68 @@ void dump_memory(log_t* log, unwindstack::Memory* memory, uint64_t addr, const s
   }
 }
 
+MemoryDumpBatch::MemoryDumpBatch(pid_t pid, unwindstack::Memory* memory, unwindstack::Maps* maps,
+                                 const std::vector<uint64_t>& addrs)
+    : memory_(memory) {
+  // Only ask for regions that are readable in one piece, so that process_vm_readv(), which stops
+  // at the first one it can't read, rarely has to be restarted. Lots of registers hold the same or
+  // nearby pointers, so each region only needs reading once.
+  std::vector<uint64_t> starts;
+  for (uint64_t addr : addrs) {
+    if (!dump_memory_start(&addr)) {
+      continue;
+    }
+    auto map_info = maps->Find(addr);
+    if (map_info == nullptr || !(map_info->flags() & PROT_READ) ||
+        map_info->end() < addr + MEMORY_BYTES_TO_DUMP) {
+      continue;
+    }
+    starts.push_back(addr);
+  }
+  std::sort(starts.begin(), starts.end());
+  starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+  std::vector<Region> regions(starts.size());
+  std::vector<iovec> local(starts.size());
+  std::vector<iovec> remote(starts.size());
+  for (size_t i = 0; i < starts.size(); ++i) {
+    regions[i].start = starts[i];
+    regions[i].data.resize(MEMORY_BYTES_TO_DUMP);
+    local[i] = {regions[i].data.data(), MEMORY_BYTES_TO_DUMP};
+    remote[i] = {reinterpret_cast<void*>(starts[i]), MEMORY_BYTES_TO_DUMP};
+  }
+
+  size_t next = 0;
+  while (next < regions.size()) {
+    size_t count = std::min(regions.size() - next, static_cast<size_t>(IOV_MAX));
+    ssize_t rc = process_vm_readv(pid, &local[next], count, &remote[next], count, 0);
+    if (rc == -1 && errno != EFAULT) {
+      // Leave everything to the fallback.
+      break;
+    }
+    size_t complete = rc == -1 ? 0 : rc / MEMORY_BYTES_TO_DUMP;
+    for (size_t i = next; i < next + complete; ++i) {
+      regions_.emplace_back(std::move(regions[i]));
+    }
+    // Skip the region the read stopped at, if it did.
+    next += complete < count ? complete + 1 : complete;
+  }
+}
+
+size_t MemoryDumpBatch::Read(uint64_t addr, void* dst, size_t size) {
+  for (const Region& region : regions_) {
+    if (addr >= region.start && addr + size <= region.start + region.data.size()) {
+      memcpy(dst, &region.data[addr - region.start], size);
+      return size;
+    }
+  }
+  return memory_->Read(addr, dst, size);
+}
+
+long MemoryDumpBatch::ReadTag(uint64_t addr) {
+  return memory_->ReadTag(addr);
+}
+
 void drop_capabilities() {
   __user_cap_header_struct capheader;
   memset(&capheader, 0, sizeof(capheader));
@@ -28,6 +28,7 @@
 constexpr char kTombstonedCrashSocketName[] = "tombstoned_crash";
 constexpr char kTombstonedJavaTraceSocketName[] = "tombstoned_java_trace";
 constexpr char kTombstonedInterceptSocketName[] = "tombstoned_intercept";
+constexpr char kTombstonedCrashWorkerSocketName[] = "tombstoned_crash_worker";
 
 enum class CrashPacketType : uint8_t {
   // Initial request from crash_dump.
@@ -57,6 +58,20 @@ struct TombstonedCrashPacket {
   } packet;
 };
 
+// Sent by the signal handler to the crash_dump worker, instead of exec'ing crash_dump.
+// Comes with two file descriptors via SCM_RIGHTS: the read end of the crash info pipe and the
+// write end of the pipe back to the pseudothread, which an exec'd crash_dump would get as stdin
+// and stdout. Their fd numbers in the pseudothread are sent too, so that the worker can kcmp them.
+// The worker replies with a single '\1' once it has accepted the dump, and closes the socket once
+// the pseudothread can exit.
+struct CrashWorkerRequest {
+  int32_t crashing_tid;
+  int32_t pseudothread_tid;
+  DebuggerdDumpType dump_type;
+  int32_t crash_info_fd;
+  int32_t ack_fd;
+};
+
 // Comes with a file descriptor via SCM_RIGHTS.
 // This packet should be sent before an actual dump happens.
 struct InterceptRequest {
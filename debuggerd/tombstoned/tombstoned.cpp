@@ -22,8 +22,12 @@
 #include <unistd.h>
 
 #include <array>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 
@@ -92,8 +96,28 @@ struct Crash {
   event* crash_event = nullptr;
 
   DebuggerdDumpType crash_type;
+
+  // When the request was read, and when the dump was started after any time in the queue.
+  std::chrono::steady_clock::time_point received_time;
+  std::chrono::steady_clock::time_point started_time;
+};
+
+// What's left to do for a completed crash: linking its files into place, which can be slow, so
+// it's done off the event loop.
+struct CrashFinalization {
+  CrashOutput output;
+  CrashArtifactPaths paths;
+  pid_t crash_pid;
+  DebuggerdDumpType crash_type;
+
+  std::chrono::steady_clock::time_point received_time;
+  std::chrono::steady_clock::time_point started_time;
+  std::chrono::steady_clock::time_point completed_time;
 };
 
+class CrashQueue;
+static void finalize_crash(CrashQueue* queue, CrashFinalization finalization);
+
 class CrashQueue {
  public:
   CrashQueue(const std::string& dir_path, const std::string& file_name_prefix, size_t max_artifacts,
@@ -115,6 +139,10 @@ class CrashQueue {
     CHECK(max_artifacts_ > max_concurrent_dumps_);
 
     find_oldest_artifact();
+
+    // One thread per queue keeps the files of a queue being written in the order their names were
+    // handed out, while a slow write for one queue doesn't hold up the other, or the event loop.
+    std::thread([this]() { finalization_thread(); }).detach();
   }
 
   static CrashQueue* for_crash(const Crash* crash) {
@@ -226,7 +254,27 @@ class CrashQueue {
 
   void on_crash_completed() { --num_concurrent_dumps_; }
 
+  void finalize_async(CrashFinalization&& finalization) {
+    {
+      std::lock_guard<std::mutex> lock(finalizations_mutex_);
+      finalizations_.emplace_back(std::move(finalization));
+    }
+    finalizations_cv_.notify_one();
+  }
+
  private:
+  void finalization_thread() {
+    while (true) {
+      std::unique_lock<std::mutex> lock(finalizations_mutex_);
+      finalizations_cv_.wait(lock, [this]() { return !finalizations_.empty(); });
+      CrashFinalization finalization = std::move(finalizations_.front());
+      finalizations_.pop_front();
+      lock.unlock();
+
+      finalize_crash(this, std::move(finalization));
+    }
+  }
+
   void find_oldest_artifact() {
     size_t oldest_tombstone = 0;
     time_t oldest_time = std::numeric_limits<time_t>::max();
@@ -269,6 +317,10 @@ class CrashQueue {
 
   std::deque<std::unique_ptr<Crash>> queued_requests_;
 
+  std::mutex finalizations_mutex_;
+  std::condition_variable finalizations_cv_;
+  std::deque<CrashFinalization> finalizations_;
+
   DISALLOW_COPY_AND_ASSIGN(CrashQueue);
 };
 
@@ -328,6 +380,7 @@ static void perform_request(std::unique_ptr<Crash> crash) {
                crash_completed_cb, crash.get());
   event_add(crash->crash_event, &timeout);
   CrashQueue::for_crash(crash)->on_crash_started();
+  crash->started_time = std::chrono::steady_clock::now();
 
   // The crash is now owned by the event loop.
   crash.release();
@@ -400,6 +453,7 @@ static void crash_request_cb(evutil_socket_t sockfd, short ev, void* arg) {
 
   pid_t crash_pid = crash->crash_pid;
   LOG(INFO) << "received crash request for pid " << crash_pid;
+  crash->received_time = std::chrono::steady_clock::now();
 
   if (CrashQueue::for_crash(crash)->maybe_enqueue_crash(std::move(crash))) {
     LOG(INFO) << "enqueueing crash request for pid " << crash_pid;
@@ -453,11 +507,26 @@ static void crash_completed(borrowed_fd sockfd, std::unique_ptr<Crash> crash) {
     return;
   }
 
-  CrashArtifactPaths paths = queue->get_next_artifact_paths();
+  queue->finalize_async({
+      .output = std::move(crash->output),
+      .paths = queue->get_next_artifact_paths(),
+      .crash_pid = crash->crash_pid,
+      .crash_type = crash->crash_type,
+      .received_time = crash->received_time,
+      .started_time = crash->started_time,
+      .completed_time = std::chrono::steady_clock::now(),
+  });
+}
+
+static void finalize_crash(CrashQueue* queue, CrashFinalization finalization) {
+  auto finalize_start = std::chrono::steady_clock::now();
+  CrashOutput* output = &finalization.output;
+  const CrashArtifactPaths& paths = finalization.paths;
+  int rc;
 
-  if (rename_tombstone_fd(crash->output.text.fd, queue->dir_fd(), paths.text)) {
-    if (crash->crash_type == kDebuggerdJavaBacktrace) {
-      LOG(ERROR) << "Traces for pid " << crash->crash_pid << " written to: " << paths.text;
+  if (rename_tombstone_fd(output->text.fd, queue->dir_fd(), paths.text)) {
+    if (finalization.crash_type == kDebuggerdJavaBacktrace) {
+      LOG(ERROR) << "Traces for pid " << finalization.crash_pid << " written to: " << paths.text;
     } else {
       // NOTE: Several tools parse this log message to figure out where the
       // tombstone associated with a given native crash was written. Any changes
@@ -466,27 +535,37 @@ static void crash_completed(borrowed_fd sockfd, std::unique_ptr<Crash> crash) {
     }
   }
 
-  if (crash->output.proto && crash->output.proto->fd != -1) {
+  if (output->proto && output->proto->fd != -1) {
     if (!paths.proto) {
       LOG(ERROR) << "missing path for proto tombstone";
     } else {
-      rename_tombstone_fd(crash->output.proto->fd, queue->dir_fd(), *paths.proto);
+      rename_tombstone_fd(output->proto->fd, queue->dir_fd(), *paths.proto);
     }
   }
 
   // If we don't have O_TMPFILE, we need to clean up after ourselves.
-  if (crash->output.text.temporary_path) {
-    rc = unlinkat(queue->dir_fd().get(), crash->output.text.temporary_path->c_str(), 0);
+  if (output->text.temporary_path) {
+    rc = unlinkat(queue->dir_fd().get(), output->text.temporary_path->c_str(), 0);
     if (rc != 0) {
       PLOG(ERROR) << "failed to unlink temporary tombstone at " << paths.text;
     }
   }
-  if (crash->output.proto && crash->output.proto->temporary_path) {
-    rc = unlinkat(queue->dir_fd().get(), crash->output.proto->temporary_path->c_str(), 0);
+  if (output->proto && output->proto->temporary_path) {
+    rc = unlinkat(queue->dir_fd().get(), output->proto->temporary_path->c_str(), 0);
     if (rc != 0) {
       PLOG(ERROR) << "failed to unlink temporary proto tombstone";
     }
   }
+
+  auto ms = [](auto duration) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+  };
+  auto now = std::chrono::steady_clock::now();
+  LOG(INFO) << "crash for pid " << finalization.crash_pid << ": queued for "
+            << ms(finalization.started_time - finalization.received_time) << "ms, dumped in "
+            << ms(finalization.completed_time - finalization.started_time)
+            << "ms, waited for i/o for " << ms(finalize_start - finalization.completed_time)
+            << "ms, written in " << ms(now - finalize_start) << "ms";
 }
 
 static void crash_completed_cb(evutil_socket_t sockfd, short ev, void* arg) {
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+// The data phase of a compressed "stream-flash" is a sequence of frames, each
+// this header followed by |compressed_size| bytes. Every frame decompresses
+// to |raw_size| bytes on its own, so frames can be decompressed in parallel.
+// A frame whose |compressed_size| equals its |raw_size| is stored as is.
+// Fields are little endian.
+struct CompressedFrameHeader {
+    uint32_t compressed_size;
+    uint32_t raw_size;
+} __attribute__((packed));
+
+// The most a frame can decompress to.
+constexpr uint32_t kMaxCompressedFrameRawSize = 1024 * 1024;
+
+#define FB_COMPRESSION_LZ4 "lz4"
+#define FB_COMPRESSION_ZSTD "zstd"
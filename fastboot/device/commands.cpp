@@ -20,6 +20,7 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#include <memory>
 #include <unordered_set>
 
 #include <android-base/logging.h>
@@ -40,6 +41,7 @@
 #include <storage_literals/storage_literals.h>
 #include <uuid/uuid.h>
 
+#include "compressed_stream.h"
 #include "constants.h"
 #include "fastboot_device.h"
 #include "flashing.h"
@@ -148,6 +150,9 @@ bool GetVarHandler(FastbootDevice* device, const std::vector<std::string>& args)
             {FB_VAR_SECURITY_PATCH_LEVEL, {GetSecurityPatchLevel, nullptr}},
             {FB_VAR_TREBLE_ENABLED, {GetTrebleEnabled, nullptr}},
             {FB_VAR_MAX_FETCH_SIZE, {GetMaxFetchSize, nullptr}},
+            {FB_VAR_ASYNC_FLASH, {GetAsyncFlash, nullptr}},
+            {FB_VAR_STREAM_FLASH, {GetStreamFlash, nullptr}},
+            {FB_VAR_COMPRESSION, {GetCompression, nullptr}},
     };
 
     if (args.size() < 2) {
@@ -576,33 +581,129 @@ void CancelPartitionSnapshot(FastbootDevice* device, const std::string& partitio
     builder.Write();
 }
 
-bool FlashHandler(FastbootDevice* device, const std::vector<std::string>& args) {
-    if (args.size() < 2) {
-        return device->WriteStatus(FastbootResult::FAIL, "Invalid arguments");
-    }
+enum class FlashMode {
+    kSync,
+    kAsync,
+    // The image is received by the flash command itself; see StreamFlash().
+    kStream,
+};
 
+static bool DoFlash(FastbootDevice* device, const std::string& partition_name, FlashMode mode,
+                    uint32_t stream_size = 0,
+                    StreamCompression compression = StreamCompression::kNone,
+                    uint32_t raw_size = 0) {
     if (GetDeviceLockStatus()) {
         return device->WriteStatus(FastbootResult::FAIL,
                                    "Flashing is not allowed on locked devices");
     }
 
-    const auto& partition_name = args[1];
     if (IsProtectedPartitionDuringMerge(device, partition_name)) {
         auto message = "Cannot flash " + partition_name + " while a snapshot update is in progress";
         return device->WriteFail(message);
     }
 
+    // A failed background flash of an earlier piece fails the whole image.
+    int ret = device->TakeAsyncFlashResult();
+    if (ret < 0) {
+        return device->WriteStatus(FastbootResult::FAIL, strerror(-ret));
+    }
+
     if (LogicalPartitionExists(device, partition_name)) {
         CancelPartitionSnapshot(device, partition_name);
     }
 
-    int ret = Flash(device, partition_name);
+    if (mode == FlashMode::kAsync) {
+        // Give the flash its own buffer; the next download fills a new one.
+        auto data = std::make_shared<std::vector<char>>(std::move(device->download_data()));
+        device->StartAsyncFlash([device, partition_name, data]() -> int {
+            return Flash(device, partition_name, std::move(*data));
+        });
+        return device->WriteStatus(FastbootResult::OKAY, "Flashing started");
+    }
+
+    if (mode == FlashMode::kStream) {
+        if (!device->WriteStatus(FastbootResult::DATA,
+                                 android::base::StringPrintf("%08x", stream_size))) {
+            return false;
+        }
+        bool transport_error;
+        ret = StreamFlash(device, partition_name, stream_size, &transport_error, compression,
+                          raw_size);
+        if (transport_error) {
+            PLOG(ERROR) << "Couldn't download data";
+            return false;
+        }
+    } else {
+        ret = Flash(device, partition_name);
+    }
     if (ret < 0) {
         return device->WriteStatus(FastbootResult::FAIL, strerror(-ret));
     }
     return device->WriteStatus(FastbootResult::OKAY, "Flashing succeeded");
 }
 
+bool FlashHandler(FastbootDevice* device, const std::vector<std::string>& args) {
+    if (args.size() < 2) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid arguments");
+    }
+    return DoFlash(device, args[1], FlashMode::kSync);
+}
+
+// Like flash, but replies as soon as the flash has started, so that the host
+// can download the next piece of a sparse image while this one is written.
+// Errors are reported by the next flash or flash-async command.
+bool FlashAsyncHandler(FastbootDevice* device, const std::vector<std::string>& args) {
+    if (args.size() < 2) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid arguments");
+    }
+    return DoFlash(device, args[1], FlashMode::kAsync);
+}
+
+static bool ParseStreamSize(const std::string& arg, unsigned int* size) {
+    return arg.length() == 8 && android::base::ParseUint("0x" + arg, size);
+}
+
+// stream-flash:%08x:<partition> combines download and flash. The data phase is
+// the same as for download, but the device writes the raw or sparse image to
+// the partition as it arrives, so the image is neither buffered in RAM nor
+// limited by max-download-size.
+//
+// stream-flash:%08x:<partition>:<compression>:%08x sends the image as
+// compressed frames instead (see compressed_stream.h), the second size being
+// that of the decompressed image.
+bool StreamFlashHandler(FastbootDevice* device, const std::vector<std::string>& args) {
+    if (args.size() != 3 && args.size() != 5) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid arguments");
+    }
+    if (args[1].length() != 8) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size (length of size != 8)");
+    }
+    unsigned int size;
+    if (!ParseStreamSize(args[1], &size)) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size");
+    }
+    if (size == 0) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size (0)");
+    }
+    if (args.size() == 3) {
+        return DoFlash(device, args[2], FlashMode::kStream, size);
+    }
+
+    StreamCompression compression;
+    if (args[3] == FB_COMPRESSION_LZ4) {
+        compression = StreamCompression::kLz4;
+    } else if (args[3] == FB_COMPRESSION_ZSTD) {
+        compression = StreamCompression::kZstd;
+    } else {
+        return device->WriteStatus(FastbootResult::FAIL, "Unsupported compression " + args[3]);
+    }
+    unsigned int raw_size;
+    if (!ParseStreamSize(args[4], &raw_size) || raw_size == 0) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid decompressed size");
+    }
+    return DoFlash(device, args[2], FlashMode::kStream, size, compression, raw_size);
+}
+
 bool UpdateSuperHandler(FastbootDevice* device, const std::vector<std::string>& args) {
     if (args.size() < 2) {
         return device->WriteFail("Invalid arguments");
@@ -84,6 +84,8 @@ FastbootDevice::FastbootDevice()
               {FB_CMD_GSI, GsiHandler},
               {FB_CMD_SNAPSHOT_UPDATE, SnapshotUpdateHandler},
               {FB_CMD_FETCH, FetchHandler},
+              {FB_CMD_FLASH_ASYNC, FlashAsyncHandler},
+              {FB_CMD_STREAM_FLASH, StreamFlashHandler},
       }),
       boot_control_hal_(IBootControl::getService()),
       health_hal_(get_health_service()),
@@ -108,6 +110,7 @@ FastbootDevice::FastbootDevice()
 }
 
 FastbootDevice::~FastbootDevice() {
+    WaitForAsyncFlash();
     CloseDevice();
 }
 
@@ -131,6 +134,26 @@ std::string FastbootDevice::GetCurrentSlot() {
     return suffix;
 }
 
+void FastbootDevice::StartAsyncFlash(std::function<int()> flash) {
+    WaitForAsyncFlash();
+    async_flash_ = std::async(std::launch::async, std::move(flash));
+}
+
+void FastbootDevice::WaitForAsyncFlash() {
+    if (!async_flash_.valid()) {
+        return;
+    }
+    int ret = async_flash_.get();
+    if (ret < 0 && !async_flash_result_) {
+        async_flash_result_ = ret;
+    }
+}
+
+int FastbootDevice::TakeAsyncFlashResult() {
+    WaitForAsyncFlash();
+    return std::exchange(async_flash_result_, 0);
+}
+
 bool FastbootDevice::WriteStatus(FastbootResult result, const std::string& message) {
     constexpr size_t kResponseReasonSize = 4;
     constexpr size_t kNumResponseTypes = 4;  // "FAIL", "OKAY", "INFO", "DATA"
@@ -210,6 +233,11 @@ void FastbootDevice::ExecuteCommands() {
             WriteStatus(FastbootResult::FAIL, "Unrecognized command " + args[0]);
             continue;
         }
+        // Only downloads may overlap a background flash; anything else could
+        // touch the partition being written.
+        if (cmd_name != FB_CMD_DOWNLOAD) {
+            WaitForAsyncFlash();
+        }
         if (!found_command->second(this, args)) {
             return;
         }
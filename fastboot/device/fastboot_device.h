@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -61,6 +63,16 @@ class FastbootDevice {
 
     void set_active_slot(const std::string& active_slot) { active_slot_ = active_slot; }
 
+    // Runs a flash started by flash-async in the background. Only one runs
+    // at a time; the host keeps downloading the next image meanwhile.
+    void StartAsyncFlash(std::function<int()> flash);
+    // Waits for the background flash, if any. Its result is kept until
+    // TakeAsyncFlashResult() reports it.
+    void WaitForAsyncFlash();
+    // Waits for the background flash and returns the first unreported
+    // error of a background flash, or 0.
+    int TakeAsyncFlashResult();
+
   private:
     const std::unordered_map<std::string, CommandHandler> kCommandMap;
 
@@ -71,4 +83,6 @@ class FastbootDevice {
     android::sp<android::hardware::fastboot::V1_1::IFastboot> fastboot_hal_;
     std::vector<char> download_data_;
     std::string active_slot_;
+    std::future<int> async_flash_;
+    int async_flash_result_ = 0;
 };
@@ -21,10 +21,15 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -37,8 +42,11 @@
 #include <liblp/builder.h>
 #include <liblp/liblp.h>
 #include <libsnapshot/snapshot.h>
+#include <lz4.h>
 #include <sparse/sparse.h>
+#include <zstd.h>
 
+#include "compressed_stream.h"
 #include "fastboot_device.h"
 #include "utility.h"
 
@@ -74,6 +82,12 @@ void WipeOverlayfsForPartition(FastbootDevice* device, const std::string& partit
     }
 }
 
+bool IsBootPartition(const std::string& partition_name) {
+    return partition_name == "boot" || partition_name == "boot_a" || partition_name == "boot_b" ||
+           partition_name == "init_boot" || partition_name == "init_boot_a" ||
+           partition_name == "init_boot_b";
+}
+
 }  // namespace
 
 int FlashRawDataChunk(PartitionHandle* handle, const char* data, size_t len) {
@@ -168,22 +182,22 @@ static void CopyAVBFooter(std::vector<char>* data, const uint64_t block_device_s
 }
 
 int Flash(FastbootDevice* device, const std::string& partition_name) {
+    return Flash(device, partition_name, std::move(device->download_data()));
+}
+
+int Flash(FastbootDevice* device, const std::string& partition_name, std::vector<char> data) {
     PartitionHandle handle;
     if (!OpenPartition(device, partition_name, &handle, O_WRONLY | O_DIRECT)) {
         return -ENOENT;
     }
 
-    std::vector<char> data = std::move(device->download_data());
     if (data.size() == 0) {
         return -EINVAL;
     }
     uint64_t block_device_size = get_block_device_size(handle.fd());
     if (data.size() > block_device_size) {
         return -EOVERFLOW;
-    } else if (data.size() < block_device_size &&
-               (partition_name == "boot" || partition_name == "boot_a" ||
-                partition_name == "boot_b" || partition_name == "init_boot" ||
-                partition_name == "init_boot_a" || partition_name == "init_boot_b")) {
+    } else if (data.size() < block_device_size && IsBootPartition(partition_name)) {
         CopyAVBFooter(&data, block_device_size);
     }
     if (android::base::GetProperty("ro.system.build.type", "") != "user") {
@@ -194,6 +208,625 @@ int Flash(FastbootDevice* device, const std::string& partition_name) {
     return result;
 }
 
+namespace {
+
+// The subset of the sparse format that StreamFlash() needs; see
+// system/core/libsparse/sparse_format.h.
+struct SparseHeader {
+    uint32_t magic;
+    uint16_t major_version;
+    uint16_t minor_version;
+    uint16_t file_hdr_sz;
+    uint16_t chunk_hdr_sz;
+    uint32_t blk_sz;
+    uint32_t total_blks;
+    uint32_t total_chunks;
+    uint32_t image_checksum;
+} __attribute__((packed));
+
+struct SparseChunkHeader {
+    uint16_t chunk_type;
+    uint16_t reserved1;
+    uint32_t chunk_sz;
+    uint32_t total_sz;
+} __attribute__((packed));
+
+constexpr uint16_t kChunkTypeRaw = 0xcac1;
+constexpr uint16_t kChunkTypeFill = 0xcac2;
+constexpr uint16_t kChunkTypeDontCare = 0xcac3;
+constexpr uint16_t kChunkTypeCrc32 = 0xcac4;
+
+constexpr size_t kStreamBufferSize = 1024 * 1024;
+constexpr size_t kNumStreamBuffers = 4;
+
+// Reads frames of a compressed stream-flash from the transport, and
+// decompresses them in order on a few threads, reading ahead to keep them all
+// busy.
+class FrameDecompressor {
+  public:
+    FrameDecompressor(FastbootDevice* device, uint64_t size, StreamCompression compression)
+        : device_(device), remaining_(size), compression_(compression) {}
+    ~FrameDecompressor() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            done_ = true;
+        }
+        cv_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void Init() {
+        size_t num_threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1,
+                                                kMaxDecompressThreads);
+        for (size_t i = 0; i < num_threads; i++) {
+            threads_.emplace_back([this] { Run(); });
+        }
+        max_frames_ = num_threads * 2;
+    }
+
+    // Replaces |out| with the next frame's data. Returns false at the end of
+    // the download or on error.
+    bool Next(std::vector<char>* out) {
+        while (frames_.size() < max_frames_ && remaining_) {
+            if (!ReadFrame()) {
+                return false;
+            }
+        }
+        if (frames_.empty()) {
+            return false;
+        }
+
+        std::shared_ptr<Frame> frame = std::move(frames_.front());
+        frames_.pop_front();
+        std::unique_lock<std::mutex> lock(lock_);
+        cv_.wait(lock, [&frame] { return frame->done; });
+        if (!frame->ok) {
+            LOG(ERROR) << "Failed to decompress frame";
+            return false;
+        }
+        *out = std::move(frame->out);
+        return true;
+    }
+
+    bool Drain() {
+        std::vector<char> buffer(std::min<uint64_t>(remaining_, kStreamBufferSize));
+        while (remaining_) {
+            size_t n = std::min<uint64_t>(remaining_, buffer.size());
+            if (!device_->HandleData(true, buffer.data(), n)) {
+                return Fail();
+            }
+            remaining_ -= n;
+        }
+        return true;
+    }
+
+    bool transport_error() const { return transport_error_; }
+
+  private:
+    static constexpr size_t kMaxDecompressThreads = 4;
+
+    struct Frame {
+        std::vector<char> data;
+        std::vector<char> out;
+        bool done = false;
+        bool ok = false;
+    };
+
+    bool ReadFrame() {
+        CompressedFrameHeader header;
+        if (remaining_ < sizeof(header)) {
+            LOG(ERROR) << "Truncated frame header";
+            return false;
+        }
+        if (!device_->HandleData(true, reinterpret_cast<char*>(&header), sizeof(header))) {
+            return Fail();
+        }
+        remaining_ -= sizeof(header);
+        if (!header.raw_size || header.raw_size > kMaxCompressedFrameRawSize ||
+            header.compressed_size > header.raw_size || header.compressed_size > remaining_) {
+            LOG(ERROR) << "Invalid frame sizes " << header.compressed_size << "/"
+                       << header.raw_size;
+            return false;
+        }
+
+        auto frame = std::make_shared<Frame>();
+        frame->data.resize(header.compressed_size);
+        if (!device_->HandleData(true, &frame->data)) {
+            return Fail();
+        }
+        remaining_ -= header.compressed_size;
+
+        if (header.compressed_size == header.raw_size) {
+            frame->out = std::move(frame->data);
+            frame->done = frame->ok = true;
+        } else {
+            frame->out.resize(header.raw_size);
+            std::lock_guard<std::mutex> lock(lock_);
+            jobs_.push_back(frame);
+            cv_.notify_all();
+        }
+        frames_.emplace_back(std::move(frame));
+        return true;
+    }
+
+    void Run() {
+        std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> zstd(ZSTD_createDCtx(),
+                                                                  ZSTD_freeDCtx);
+        std::unique_lock<std::mutex> lock(lock_);
+        while (true) {
+            cv_.wait(lock, [this] { return done_ || !jobs_.empty(); });
+            if (done_) {
+                return;
+            }
+            std::shared_ptr<Frame> frame = std::move(jobs_.front());
+            jobs_.pop_front();
+
+            lock.unlock();
+            bool ok = Decompress(zstd.get(), frame.get());
+            lock.lock();
+
+            frame->ok = ok;
+            frame->done = true;
+            cv_.notify_all();
+        }
+    }
+
+    bool Decompress(ZSTD_DCtx* zstd, Frame* frame) {
+        switch (compression_) {
+            case StreamCompression::kLz4:
+                return LZ4_decompress_safe(frame->data.data(), frame->out.data(),
+                                           frame->data.size(), frame->out.size()) ==
+                       static_cast<int>(frame->out.size());
+            case StreamCompression::kZstd:
+                return zstd && ZSTD_decompressDCtx(zstd, frame->out.data(), frame->out.size(),
+                                                   frame->data.data(), frame->data.size()) ==
+                                       frame->out.size();
+            default:
+                return false;
+        }
+    }
+
+    bool Fail() {
+        transport_error_ = true;
+        remaining_ = 0;
+        return false;
+    }
+
+    FastbootDevice* device_;
+    uint64_t remaining_;
+    StreamCompression compression_;
+    size_t max_frames_ = 1;
+    // Frames in the order they were sent, read but not yet returned by Next().
+    std::deque<std::shared_ptr<Frame>> frames_;
+    bool transport_error_ = false;
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<Frame>> jobs_;
+    std::vector<std::thread> threads_;
+    bool done_ = false;
+};
+
+// Reads a download of a known size from the transport, in large reads. With a
+// FrameDecompressor, |size| is that of the decompressed data, and the reads
+// come from the decompressor instead.
+class StreamReader {
+  public:
+    StreamReader(FastbootDevice* device, uint64_t size,
+                 FrameDecompressor* decompressor = nullptr)
+        : device_(device),
+          decompressor_(decompressor),
+          remaining_(size),
+          buffer_(kStreamBufferSize) {}
+
+    bool Read(void* data, size_t len) {
+        char* out = static_cast<char*>(data);
+        while (len) {
+            if (pos_ == end_) {
+                // Large reads skip the staging buffer.
+                if (!decompressor_ && len >= buffer_.size() && len <= remaining_) {
+                    if (!device_->HandleData(true, out, len)) {
+                        return Fail();
+                    }
+                    remaining_ -= len;
+                    return true;
+                }
+                if (!Fill()) {
+                    return false;
+                }
+            }
+            size_t n = std::min(len, end_ - pos_);
+            memcpy(out, buffer_.data() + pos_, n);
+            pos_ += n;
+            out += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    bool Skip(uint64_t len) {
+        while (len) {
+            if (pos_ == end_ && !Fill()) {
+                return false;
+            }
+            size_t n = std::min<uint64_t>(len, end_ - pos_);
+            pos_ += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    // Reads and drops the rest of the download, so the host and device stay
+    // in sync after an error.
+    bool Drain() {
+        if (decompressor_) {
+            pos_ = end_ = 0;
+            return decompressor_->Drain();
+        }
+        return Skip(remaining_ + (end_ - pos_));
+    }
+
+    bool transport_error() const {
+        return transport_error_ || (decompressor_ && decompressor_->transport_error());
+    }
+
+  private:
+    bool Fill() {
+        if (decompressor_) {
+            if (!remaining_ || !decompressor_->Next(&buffer_)) {
+                return false;
+            }
+            if (buffer_.size() > remaining_) {
+                LOG(ERROR) << "Compressed data is larger than its given size";
+                return false;
+            }
+            remaining_ -= buffer_.size();
+            pos_ = 0;
+            end_ = buffer_.size();
+            return true;
+        }
+
+        size_t n = std::min<uint64_t>(remaining_, buffer_.size());
+        if (!n) {
+            return false;
+        }
+        if (!device_->HandleData(true, buffer_.data(), n)) {
+            return Fail();
+        }
+        remaining_ -= n;
+        pos_ = 0;
+        end_ = n;
+        return true;
+    }
+
+    bool Fail() {
+        transport_error_ = true;
+        remaining_ = 0;
+        pos_ = end_ = 0;
+        return false;
+    }
+
+    FastbootDevice* device_;
+    FrameDecompressor* decompressor_;
+    uint64_t remaining_;
+    std::vector<char> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    bool transport_error_ = false;
+};
+
+// Writes buffers to a partition on a separate thread, so that storage and the
+// transport are busy at the same time. Memory is bounded by a fixed pool of
+// buffers; Get() blocks until the writer hands one back.
+class PartitionStreamWriter {
+  public:
+    using Buffer = std::unique_ptr<char, decltype(&free)>;
+
+    PartitionStreamWriter(PartitionHandle* handle, uint64_t partition_size)
+        : handle_(handle), partition_size_(partition_size) {}
+    ~PartitionStreamWriter() { Finish(); }
+
+    bool Init() {
+        for (size_t i = 0; i < kNumStreamBuffers; i++) {
+            void* ptr;
+            if (posix_memalign(&ptr, 4096, kStreamBufferSize)) {
+                PLOG(ERROR) << "Failed to allocate write buffer";
+                return false;
+            }
+            free_.emplace_back(static_cast<char*>(ptr), free);
+        }
+        thread_ = std::thread([this] { Run(); });
+        return true;
+    }
+
+    Buffer Get() {
+        std::unique_lock<std::mutex> lock(lock_);
+        cv_.wait(lock, [this] { return !free_.empty(); });
+        Buffer buffer = std::move(free_.back());
+        free_.pop_back();
+        return buffer;
+    }
+
+    // Queues len bytes of buffer to be written at offset.
+    int Write(uint64_t offset, Buffer buffer, size_t len) {
+        if (offset + len > partition_size_) {
+            LOG(ERROR) << "Write of " << len << " bytes at " << offset << " exceeds partition size "
+                       << partition_size_;
+            Put(std::move(buffer));
+            return -EOVERFLOW;
+        }
+        std::lock_guard<std::mutex> lock(lock_);
+        if (error_) {
+            free_.emplace_back(std::move(buffer));
+            return error_;
+        }
+        queue_.push_back({offset, len, std::move(buffer)});
+        cv_.notify_all();
+        return 0;
+    }
+
+    void Put(Buffer buffer) {
+        std::lock_guard<std::mutex> lock(lock_);
+        free_.emplace_back(std::move(buffer));
+        cv_.notify_all();
+    }
+
+    // Waits for all queued writes and returns the first error, if any.
+    int Finish() {
+        if (thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                done_ = true;
+            }
+            cv_.notify_all();
+            thread_.join();
+        }
+        return error_;
+    }
+
+  private:
+    struct Request {
+        uint64_t offset;
+        size_t len;
+        Buffer buffer;
+    };
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(lock_);
+        while (true) {
+            cv_.wait(lock, [this] { return done_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            Request request = std::move(queue_.front());
+            queue_.pop_front();
+
+            lock.unlock();
+            int ret = error_ ? 0 : WriteRequest(request);
+            lock.lock();
+
+            if (ret < 0 && !error_) {
+                error_ = ret;
+            }
+            free_.emplace_back(std::move(request.buffer));
+            cv_.notify_all();
+        }
+    }
+
+    int WriteRequest(const Request& request) {
+        // O_DIRECT only takes 4KB aligned writes, like FlashRawDataChunk().
+        if ((request.offset | request.len) & 0xFFF) {
+            if (!handle_->Reset(O_WRONLY)) {
+                PLOG(ERROR) << "Failed to reset file descriptor";
+                return -EIO;
+            }
+        }
+        if (!android::base::WriteFullyAtOffset(handle_->fd(), request.buffer.get(), request.len,
+                                               request.offset)) {
+            PLOG(ERROR) << "Failed to flash data of len " << request.len << " at "
+                        << request.offset;
+            return -errno;
+        }
+        return 0;
+    }
+
+    PartitionHandle* handle_;
+    uint64_t partition_size_;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::vector<Buffer> free_;
+    std::deque<Request> queue_;
+    std::thread thread_;
+    bool done_ = false;
+    int error_ = 0;
+};
+
+// Copies len bytes of the download to the partition at offset.
+int StreamData(StreamReader* reader, PartitionStreamWriter* writer, uint64_t offset,
+               uint64_t len) {
+    while (len) {
+        size_t n = std::min<uint64_t>(len, kStreamBufferSize);
+        auto buffer = writer->Get();
+        if (!reader->Read(buffer.get(), n)) {
+            writer->Put(std::move(buffer));
+            return -EIO;
+        }
+        int ret = writer->Write(offset, std::move(buffer), n);
+        if (ret < 0) {
+            return ret;
+        }
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int StreamFill(PartitionStreamWriter* writer, uint64_t offset, uint64_t len, uint32_t fill) {
+    while (len) {
+        size_t n = std::min<uint64_t>(len, kStreamBufferSize);
+        auto buffer = writer->Get();
+        std::fill_n(reinterpret_cast<uint32_t*>(buffer.get()), n / sizeof(fill), fill);
+        int ret = writer->Write(offset, std::move(buffer), n);
+        if (ret < 0) {
+            return ret;
+        }
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int StreamSparse(StreamReader* reader, PartitionStreamWriter* writer, const SparseHeader& header) {
+    if (header.major_version != 1 || header.file_hdr_sz < sizeof(SparseHeader) ||
+        header.chunk_hdr_sz < sizeof(SparseChunkHeader) || !header.blk_sz ||
+        header.blk_sz % sizeof(uint32_t)) {
+        LOG(ERROR) << "Invalid sparse header";
+        return -EINVAL;
+    }
+    if (!reader->Skip(header.file_hdr_sz - sizeof(SparseHeader))) {
+        return -EIO;
+    }
+
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < header.total_chunks; i++) {
+        SparseChunkHeader chunk;
+        if (!reader->Read(&chunk, sizeof(chunk)) ||
+            !reader->Skip(header.chunk_hdr_sz - sizeof(chunk))) {
+            return -EIO;
+        }
+
+        if (chunk.total_sz < header.chunk_hdr_sz) {
+            LOG(ERROR) << "Invalid sparse chunk size " << chunk.total_sz;
+            return -EINVAL;
+        }
+        uint64_t len = static_cast<uint64_t>(chunk.chunk_sz) * header.blk_sz;
+        uint64_t data_len = chunk.total_sz - header.chunk_hdr_sz;
+        int ret = 0;
+        switch (chunk.chunk_type) {
+            case kChunkTypeRaw:
+                if (data_len != len) {
+                    return -EINVAL;
+                }
+                ret = StreamData(reader, writer, offset, len);
+                break;
+            case kChunkTypeFill: {
+                uint32_t fill;
+                if (data_len != sizeof(fill)) {
+                    return -EINVAL;
+                }
+                if (!reader->Read(&fill, sizeof(fill))) {
+                    return -EIO;
+                }
+                ret = StreamFill(writer, offset, len, fill);
+                break;
+            }
+            case kChunkTypeDontCare:
+                if (!reader->Skip(data_len)) {
+                    return -EIO;
+                }
+                break;
+            case kChunkTypeCrc32:
+                len = 0;
+                if (!reader->Skip(data_len)) {
+                    return -EIO;
+                }
+                break;
+            default:
+                LOG(ERROR) << "Unknown sparse chunk type " << chunk.chunk_type;
+                return -EINVAL;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        offset += len;
+    }
+    return 0;
+}
+
+}  // namespace
+
+int StreamFlash(FastbootDevice* device, const std::string& partition_name, uint32_t size,
+                bool* transport_error, StreamCompression compression, uint32_t raw_size) {
+    *transport_error = false;
+
+    std::unique_ptr<FrameDecompressor> decompressor;
+    if (compression != StreamCompression::kNone) {
+        decompressor = std::make_unique<FrameDecompressor>(device, size, compression);
+        decompressor->Init();
+        size = raw_size;
+    }
+    StreamReader reader(device, size, decompressor.get());
+
+    // Boot images get their AVB footer moved to the end of the partition,
+    // which needs the whole image; buffer those like a normal download.
+    if (IsBootPartition(partition_name)) {
+        device->download_data().resize(size);
+        if (!reader.Read(device->download_data().data(), size)) {
+            reader.Drain();
+            *transport_error = reader.transport_error();
+            return -EIO;
+        }
+        return Flash(device, partition_name);
+    }
+
+    PartitionHandle handle;
+    if (!OpenPartition(device, partition_name, &handle, O_WRONLY | O_DIRECT)) {
+        *transport_error = !reader.Drain() && reader.transport_error();
+        return -ENOENT;
+    }
+    if (android::base::GetProperty("ro.system.build.type", "") != "user") {
+        WipeOverlayfsForPartition(device, partition_name);
+    }
+
+    PartitionStreamWriter writer(&handle, get_block_device_size(handle.fd()));
+    if (!writer.Init()) {
+        *transport_error = !reader.Drain() && reader.transport_error();
+        return -ENOMEM;
+    }
+
+    int ret;
+    SparseHeader header = {};
+    size_t header_len = std::min<size_t>(size, sizeof(header));
+    if (!reader.Read(&header, header_len)) {
+        ret = -EIO;
+    } else if (header_len == sizeof(header) && header.magic == SPARSE_HEADER_MAGIC) {
+        ret = StreamSparse(&reader, &writer, header);
+    } else {
+        // A raw image; the bytes read to look for the magic are its start.
+        // Complete the first buffer so that later writes stay aligned.
+        size_t len = std::min<size_t>(size, kStreamBufferSize);
+        auto buffer = writer.Get();
+        memcpy(buffer.get(), &header, header_len);
+        if (!reader.Read(buffer.get() + header_len, len - header_len)) {
+            writer.Put(std::move(buffer));
+            ret = -EIO;
+        } else {
+            ret = writer.Write(0, std::move(buffer), len);
+        }
+        if (!ret) {
+            ret = StreamData(&reader, &writer, len, size - len);
+        }
+    }
+
+    int write_ret = writer.Finish();
+    if (!ret) {
+        ret = write_ret;
+    }
+    if (ret < 0) {
+        *transport_error = !reader.Drain() && reader.transport_error();
+        return ret;
+    }
+    // Compressed data may end with frames that a sparse image didn't need.
+    if (decompressor && !reader.Drain()) {
+        *transport_error = reader.transport_error();
+        return -EIO;
+    }
+    sync();
+    return 0;
+}
+
 static void RemoveScratchPartition() {
     AutoMountMetadata mount_metadata;
     android::fs_mgr::TeardownAllOverlayForMountPoint();
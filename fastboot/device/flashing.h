@@ -22,4 +22,17 @@
 class FastbootDevice;
 
 int Flash(FastbootDevice* device, const std::string& partition_name);
+int Flash(FastbootDevice* device, const std::string& partition_name, std::vector<char> data);
+enum class StreamCompression {
+    kNone,
+    kLz4,
+    kZstd,
+};
+// Writes a raw or sparse image of |size| bytes to a partition while it is being
+// received, instead of buffering the whole download. Sets |transport_error| if
+// the connection to the host broke. With |compression|, the |size| bytes are
+// compressed frames that decompress to an image of |raw_size| bytes.
+int StreamFlash(FastbootDevice* device, const std::string& partition_name, uint32_t size,
+                bool* transport_error, StreamCompression compression = StreamCompression::kNone,
+                uint32_t raw_size = 0);
 bool UpdateSuper(FastbootDevice* device, const std::string& super_name, bool wipe);
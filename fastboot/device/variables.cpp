@@ -28,6 +28,7 @@
 #include <fs_mgr.h>
 #include <liblp/liblp.h>
 
+#include "compressed_stream.h"
 #include "fastboot_device.h"
 #include "flashing.h"
 #include "utility.h"
@@ -518,3 +519,21 @@ bool GetMaxFetchSize(FastbootDevice* /* device */, const std::vector<std::string
     *message = android::base::StringPrintf("0x%X", kMaxFetchSizeDefault);
     return true;
 }
+
+bool GetAsyncFlash(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                   std::string* message) {
+    *message = "yes";
+    return true;
+}
+
+bool GetStreamFlash(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                    std::string* message) {
+    *message = "yes";
+    return true;
+}
+
+bool GetCompression(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                    std::string* message) {
+    *message = FB_COMPRESSION_LZ4 "," FB_COMPRESSION_ZSTD;
+    return true;
+}
@@ -82,6 +82,12 @@ bool GetTrebleEnabled(FastbootDevice* device, const std::vector<std::string>& ar
                       std::string* message);
 bool GetMaxFetchSize(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
                      std::string* message);
+bool GetAsyncFlash(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                   std::string* message);
+bool GetStreamFlash(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                    std::string* message);
+bool GetCompression(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                    std::string* message);
 
 // Helpers for getvar all.
 std::vector<std::vector<std::string>> GetAllPartitionArgsWithSlot(FastbootDevice* device);
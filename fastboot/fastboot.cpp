@@ -45,6 +45,8 @@
 
 #include <chrono>
 #include <functional>
+#include <future>
+#include <mutex>
 #include <regex>
 #include <string>
 #include <thread>
@@ -67,6 +69,7 @@
 #include <ziparchive/zip_archive.h>
 
 #include "bootimg_utils.h"
+#include "compressed_stream.h"
 #include "constants.h"
 #include "diagnose_usb.h"
 #include "fastboot_driver.h"
@@ -622,18 +625,22 @@ static int make_temporary_fd(const char* what) {
 
 #endif
 
-static unique_fd unzip_to_file(ZipArchiveHandle zip, const char* entry_name) {
+static unique_fd unzip_to_file(ZipArchiveHandle zip, const char* entry_name, bool quiet = false) {
     unique_fd fd(make_temporary_fd(entry_name));
 
     ZipEntry64 zip_entry;
     if (FindEntry(zip, entry_name, &zip_entry) != 0) {
-        fprintf(stderr, "archive does not contain '%s'\n", entry_name);
+        if (!quiet) {
+            fprintf(stderr, "archive does not contain '%s'\n", entry_name);
+        }
         errno = ENOENT;
         return unique_fd();
     }
 
-    fprintf(stderr, "extracting %s (%" PRIu64 " MB) to disk...", entry_name,
-            zip_entry.uncompressed_length / 1024 / 1024);
+    if (!quiet) {
+        fprintf(stderr, "extracting %s (%" PRIu64 " MB) to disk...", entry_name,
+                zip_entry.uncompressed_length / 1024 / 1024);
+    }
     double start = now();
     int error = ExtractEntryToFile(zip, &zip_entry, fd.get());
     if (error != 0) {
@@ -644,7 +651,9 @@ static unique_fd unzip_to_file(ZipArchiveHandle zip, const char* entry_name) {
         die("\nlseek on extracted file '%s' failed: %s", entry_name, strerror(errno));
     }
 
-    fprintf(stderr, " took %.3fs\n", now() - start);
+    if (!quiet) {
+        fprintf(stderr, " took %.3fs\n", now() - start);
+    }
 
     return fd;
 }
@@ -828,14 +837,9 @@ static struct sparse_file** load_sparse_files(int fd, int64_t max_size) {
       die("invalid max size %" PRId64, max_size);
     }
 
-    int files = sparse_file_resparse(s, max_size, nullptr, 0);
-    if (files < 0) die("Failed to resparse");
-
-    sparse_file** out_s = reinterpret_cast<sparse_file**>(calloc(sizeof(struct sparse_file *), files + 1));
-    if (!out_s) die("Failed to allocate sparse file array");
-
-    files = sparse_file_resparse(s, max_size, out_s, files);
-    if (files < 0) die("Failed to resparse");
+    int files;
+    sparse_file** out_s = sparse_file_resparse_all(s, max_size, &files);
+    if (!out_s) die("Failed to resparse");
 
     return out_s;
 }
@@ -1073,6 +1077,33 @@ static void copy_avb_footer(const std::string& partition, struct fastboot_buffer
     lseek(buf->fd.get(), 0, SEEK_SET);
 }
 
+static bool supports_async_flash() {
+    std::string value;
+    return fb->GetVar(FB_VAR_ASYNC_FLASH, &value) == fastboot::SUCCESS && value == "yes";
+}
+
+static bool supports_stream_flash() {
+    std::string value;
+    return fb->GetVar(FB_VAR_STREAM_FLASH, &value) == fastboot::SUCCESS && value == "yes";
+}
+
+// Returns the compression to send stream-flash data with, or "" if the device
+// takes none that we can produce. zstd goes first: the link is the bottleneck,
+// and zstd compresses better.
+static std::string get_stream_compression() {
+    std::string value;
+    if (fb->GetVar(FB_VAR_COMPRESSION, &value) != fastboot::SUCCESS) {
+        return "";
+    }
+    auto supported = Split(value, ",");
+    for (const char* compression : {FB_COMPRESSION_ZSTD, FB_COMPRESSION_LZ4}) {
+        if (std::find(supported.begin(), supported.end(), compression) != supported.end()) {
+            return compression;
+        }
+    }
+    return "";
+}
+
 static void flash_buf(const std::string& partition, struct fastboot_buffer *buf)
 {
     sparse_file** s;
@@ -1098,22 +1129,43 @@ static void flash_buf(const std::string& partition, struct fastboot_buffer *buf)
 
     switch (buf->type) {
         case FB_BUFFER_SPARSE: {
-            std::vector<std::pair<sparse_file*, int64_t>> sparse_files;
-            s = reinterpret_cast<sparse_file**>(buf->data);
-            while (*s) {
-                int64_t sz = sparse_file_len(*s, true, false);
-                sparse_files.emplace_back(*s, sz);
-                ++s;
+            std::vector<sparse_file*> sparse_files;
+            for (s = reinterpret_cast<sparse_file**>(buf->data); *s; ++s) {
+                sparse_files.emplace_back(*s);
             }
 
+            std::vector<int64_t> sizes(sparse_files.size());
+            if (sparse_file_len_parallel(sparse_files.data(), sparse_files.size(), true, false,
+                                         sizes.data()) < 0) {
+                die("Failed to compute sparse file sizes");
+            }
+
+            // Devices with stream-flash write each piece as it arrives.
+            if (supports_stream_flash()) {
+                std::string compression = get_stream_compression();
+                for (size_t i = 0; i < sparse_files.size(); ++i) {
+                    fb->StreamFlashPartition(partition, sparse_files[i], sizes[i], i + 1,
+                                             sparse_files.size(), compression);
+                }
+                break;
+            }
+
+            // Otherwise let the device write each piece while the next one is
+            // sent. The last piece is flashed synchronously, which also
+            // reports any failure of the earlier ones.
+            bool async = sparse_files.size() > 1 && supports_async_flash();
             for (size_t i = 0; i < sparse_files.size(); ++i) {
-                const auto& pair = sparse_files[i];
-                fb->FlashPartition(partition, pair.first, pair.second, i + 1, sparse_files.size());
+                fb->FlashPartition(partition, sparse_files[i], sizes[i], i + 1,
+                                   sparse_files.size(), async && i + 1 < sparse_files.size());
             }
             break;
         }
         case FB_BUFFER_FD:
-            fb->FlashPartition(partition, buf->fd, buf->sz);
+            if (supports_stream_flash()) {
+                fb->StreamFlashPartition(partition, buf->fd, buf->sz, get_stream_compression());
+            } else {
+                fb->FlashPartition(partition, buf->fd, buf->sz);
+            }
             break;
         default:
             die("unknown buffer type: %d", buf->type);
@@ -1368,6 +1420,7 @@ static bool is_userspace_fastboot() {
     return fb->GetVar("is-userspace", &value) == fastboot::SUCCESS && value == "yes";
 }
 
+
 static void reboot_to_userspace_fastboot() {
     fb->RebootTo("fastboot");
 
@@ -1401,6 +1454,9 @@ class ImageSource {
     virtual ~ImageSource() {};
     virtual bool ReadFile(const std::string& name, std::vector<char>* out) const = 0;
     virtual unique_fd OpenFile(const std::string& name) const = 0;
+    // Like OpenFile(), but called from a background thread while the device is
+    // busy, so it must not write to the terminal.
+    virtual unique_fd PrepareFile(const std::string& name) const { return OpenFile(name); }
 };
 
 class FlashAllTool {
@@ -1477,6 +1533,12 @@ void FlashAllTool::Flash() {
     FlashImages(os_images_);
 }
 
+struct PreparedImage {
+    bool loaded = false;
+    int error = 0;
+    fastboot_buffer buf;
+};
+
 void FlashAllTool::CheckRequirements() {
     std::vector<char> contents;
     if (!source_.ReadFile("android-info.txt", &contents)) {
@@ -1519,17 +1581,39 @@ void FlashAllTool::CollectImages() {
     }
 }
 
+// Extracting and resparsing an image takes about as long as sending it, so the
+// next image is prepared on another thread while the current one is flashed.
+// Anything that talks to the device stays on this thread.
 void FlashAllTool::FlashImages(const std::vector<std::pair<const Image*, std::string>>& images) {
-    for (const auto& [image, slot] : images) {
-        fastboot_buffer buf;
-        unique_fd fd = source_.OpenFile(image->img_name);
-        if (fd < 0 || !load_buf_fd(std::move(fd), &buf)) {
+    auto prepare = [this](const Image* image) -> PreparedImage {
+        PreparedImage prepared;
+        unique_fd fd = source_.PrepareFile(image->img_name);
+        prepared.loaded = fd >= 0 && load_buf_fd(std::move(fd), &prepared.buf);
+        prepared.error = errno;
+        return prepared;
+    };
+
+    // load_buf_fd() queries max-download-size on first use; do it from here.
+    get_sparse_limit(0);
+
+    std::future<PreparedImage> next;
+    if (!images.empty()) {
+        next = std::async(std::launch::async, prepare, images[0].first);
+    }
+    for (size_t i = 0; i < images.size(); i++) {
+        const auto& [image, slot] = images[i];
+        PreparedImage prepared = next.get();
+        if (i + 1 < images.size()) {
+            next = std::async(std::launch::async, prepare, images[i + 1].first);
+        }
+
+        if (!prepared.loaded) {
             if (image->optional_if_no_image) {
                 continue;
             }
-            die("could not load '%s': %s", image->img_name, strerror(errno));
+            die("could not load '%s': %s", image->img_name, strerror(prepared.error));
         }
-        FlashImage(*image, slot, &buf);
+        FlashImage(*image, slot, &prepared.buf);
     }
 }
 
@@ -1589,19 +1673,29 @@ class ZipImageSource final : public ImageSource {
     explicit ZipImageSource(ZipArchiveHandle zip) : zip_(zip) {}
     bool ReadFile(const std::string& name, std::vector<char>* out) const override;
     unique_fd OpenFile(const std::string& name) const override;
+    unique_fd PrepareFile(const std::string& name) const override;
 
   private:
     ZipArchiveHandle zip_;
+    // ZipArchiveHandle may not be used from two threads at once.
+    mutable std::mutex lock_;
 };
 
 bool ZipImageSource::ReadFile(const std::string& name, std::vector<char>* out) const {
+    std::lock_guard<std::mutex> lock(lock_);
     return UnzipToMemory(zip_, name, out);
 }
 
 unique_fd ZipImageSource::OpenFile(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(lock_);
     return unzip_to_file(zip_, name.c_str());
 }
 
+unique_fd ZipImageSource::PrepareFile(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return unzip_to_file(zip_, name.c_str(), true /* quiet */);
+}
+
 static void do_update(const char* filename, const std::string& slot_override, bool skip_secondary,
                       bool force_flash) {
     ZipArchiveHandle zip;
@@ -36,9 +36,12 @@
 #include <string.h>
 #include <algorithm>
 #include <chrono>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <memory>
 #include <regex>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -47,8 +50,11 @@
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
+#include <lz4.h>
 #include <storage_literals/storage_literals.h>
+#include <zstd.h>
 
+#include "compressed_stream.h"
 #include "constants.h"
 #include "transport.h"
 
@@ -96,6 +102,12 @@ RetCode FastBootDriver::Flash(const std::string& partition, std::string* respons
     return RawCommand(FB_CMD_FLASH ":" + partition, "Writing '" + partition + "'", response, info);
 }
 
+RetCode FastBootDriver::FlashAsync(const std::string& partition, std::string* response,
+                                   std::vector<std::string>* info) {
+    return RawCommand(FB_CMD_FLASH_ASYNC ":" + partition, "Writing '" + partition + "'", response,
+                      info);
+}
+
 RetCode FastBootDriver::GetVar(const std::string& key, std::string* val,
                                std::vector<std::string>* info) {
     return RawCommand(FB_CMD_GETVAR ":" + key, val, info);
@@ -154,12 +166,165 @@ RetCode FastBootDriver::FlashPartition(const std::string& partition, android::ba
 }
 
 RetCode FastBootDriver::FlashPartition(const std::string& partition, sparse_file* s, uint32_t size,
-                                       size_t current, size_t total) {
+                                       size_t current, size_t total, bool async) {
     RetCode ret;
     if ((ret = Download(partition, s, size, current, total, false))) {
         return ret;
     }
-    return Flash(partition);
+    return async ? FlashAsync(partition) : Flash(partition);
+}
+
+namespace {
+
+// Splits data into frames for a compressed stream-flash (see
+// compressed_stream.h), and compresses them on a few threads.
+class FrameCompressor {
+  public:
+    explicit FrameCompressor(const std::string& compression)
+        : compression_(compression),
+          max_pending_(std::max(std::thread::hardware_concurrency(), 1U) * 2) {
+        frame_.reserve(kMaxCompressedFrameRawSize);
+    }
+
+    void Add(const char* data, size_t len) {
+        raw_size_ += len;
+        while (len) {
+            size_t n = std::min(len, kMaxCompressedFrameRawSize - frame_.size());
+            frame_.insert(frame_.end(), data, data + n);
+            data += n;
+            len -= n;
+            if (frame_.size() == kMaxCompressedFrameRawSize) {
+                Flush();
+            }
+        }
+    }
+
+    // Returns the frames of all the data added.
+    std::vector<char> Finish() {
+        if (!frame_.empty()) {
+            Flush();
+        }
+        while (!pending_.empty()) {
+            Collect();
+        }
+        return std::move(out_);
+    }
+
+    uint64_t raw_size() const { return raw_size_; }
+
+  private:
+    void Flush() {
+        if (pending_.size() >= max_pending_) {
+            Collect();
+        }
+        pending_.emplace_back(std::async(std::launch::async, Compress, compression_,
+                                         std::move(frame_)));
+        frame_.clear();
+        frame_.reserve(kMaxCompressedFrameRawSize);
+    }
+
+    void Collect() {
+        std::vector<char> frame = pending_.front().get();
+        pending_.pop_front();
+        out_.insert(out_.end(), frame.begin(), frame.end());
+    }
+
+    // Returns the frame header and data for |raw|, which is stored as is if it
+    // doesn't compress.
+    static std::vector<char> Compress(const std::string& compression, std::vector<char> raw) {
+        CompressedFrameHeader header = {};
+        header.raw_size = raw.size();
+
+        std::vector<char> frame;
+        if (compression == FB_COMPRESSION_LZ4) {
+            frame.resize(sizeof(header) + LZ4_compressBound(raw.size()));
+            int rc = LZ4_compress_default(raw.data(), frame.data() + sizeof(header), raw.size(),
+                                          frame.size() - sizeof(header));
+            header.compressed_size = rc > 0 ? rc : 0;
+        } else if (compression == FB_COMPRESSION_ZSTD) {
+            frame.resize(sizeof(header) + ZSTD_compressBound(raw.size()));
+            size_t rc = ZSTD_compress(frame.data() + sizeof(header), frame.size() - sizeof(header),
+                                      raw.data(), raw.size(), ZSTD_CLEVEL_DEFAULT);
+            header.compressed_size = ZSTD_isError(rc) ? 0 : rc;
+        }
+
+        if (!header.compressed_size || header.compressed_size >= header.raw_size) {
+            header.compressed_size = header.raw_size;
+            frame.resize(sizeof(header));
+            frame.insert(frame.end(), raw.begin(), raw.end());
+        } else {
+            frame.resize(sizeof(header) + header.compressed_size);
+        }
+        memcpy(frame.data(), &header, sizeof(header));
+        return frame;
+    }
+
+    std::string compression_;
+    size_t max_pending_;
+    std::vector<char> frame_;
+    std::deque<std::future<std::vector<char>>> pending_;
+    std::vector<char> out_;
+    uint64_t raw_size_ = 0;
+};
+
+}  // namespace
+
+RetCode FastBootDriver::StreamFlashPartition(const std::string& partition,
+                                             android::base::borrowed_fd fd, uint32_t size,
+                                             const std::string& compression) {
+    prolog_(StringPrintf("Writing '%s' (%u KB)", partition.c_str(), size / 1024));
+    RetCode result;
+    if (compression.empty()) {
+        result = SendData(fd, size, partition, nullptr, nullptr);
+    } else {
+        // Map the file a piece at a time, like SendBuffer().
+        static constexpr uint32_t MAX_MAP_SIZE = 512 * 1024 * 1024;
+        FrameCompressor compressor(compression);
+        result = SUCCESS;
+        for (uint32_t offset = 0; offset < size;) {
+            uint32_t len = std::min(size - offset, MAX_MAP_SIZE);
+            auto mapping = android::base::MappedFile::FromFd(fd, offset, len, PROT_READ);
+            if (!mapping) {
+                error_ = "Creating filemap failed";
+                result = IO_ERROR;
+                break;
+            }
+            compressor.Add(mapping->data(), mapping->size());
+            offset += len;
+        }
+        if (!result) {
+            result = SendCompressed(partition, compression, compressor.Finish(),
+                                    compressor.raw_size());
+        }
+    }
+    epilog_(result);
+    return result;
+}
+
+RetCode FastBootDriver::StreamFlashPartition(const std::string& partition, sparse_file* s,
+                                             uint32_t size, size_t current, size_t total,
+                                             const std::string& compression) {
+    prolog_(StringPrintf("Writing sparse '%s' %zu/%zu (%u KB)", partition.c_str(), current, total,
+                         size / 1024));
+    RetCode result;
+    if (compression.empty()) {
+        result = SendSparse(s, false, partition, nullptr, nullptr);
+    } else {
+        FrameCompressor compressor(compression);
+        auto cb = [](void* priv, const void* buf, size_t len) -> int {
+            static_cast<FrameCompressor*>(priv)->Add(static_cast<const char*>(buf), len);
+            return 0;
+        };
+        if (sparse_file_callback(s, true, false, cb, &compressor) < 0) {
+            error_ = "Error reading sparse file";
+            result = IO_ERROR;
+        } else {
+            result = SendCompressed(partition, compression, compressor.Finish(),
+                                    compressor.raw_size());
+        }
+    }
+    epilog_(result);
+    return result;
 }
 
 RetCode FastBootDriver::Partitions(std::vector<std::tuple<std::string, uint64_t>>* partitions) {
@@ -194,6 +359,12 @@ RetCode FastBootDriver::Download(const std::string& name, android::base::borrowe
 
 RetCode FastBootDriver::Download(android::base::borrowed_fd fd, size_t size, std::string* response,
                                  std::vector<std::string>* info) {
+    return SendData(fd, size, "", response, info);
+}
+
+RetCode FastBootDriver::SendData(android::base::borrowed_fd fd, size_t size,
+                                 const std::string& stream_partition, std::string* response,
+                                 std::vector<std::string>* info) {
     RetCode ret;
 
     if ((size <= 0 || size > MAX_DOWNLOAD_SIZE) && !disable_checks_) {
@@ -202,7 +373,9 @@ RetCode FastBootDriver::Download(android::base::borrowed_fd fd, size_t size, std
     }
 
     uint32_t u32size = static_cast<uint32_t>(size);
-    if ((ret = DownloadCommand(u32size, response, info))) {
+    ret = stream_partition.empty() ? DownloadCommand(u32size, response, info)
+                                   : StreamFlashCommand(stream_partition, u32size, response, info);
+    if (ret) {
         return ret;
     }
 
@@ -257,6 +430,12 @@ RetCode FastBootDriver::Download(const std::string& partition, struct sparse_fil
 
 RetCode FastBootDriver::Download(sparse_file* s, bool use_crc, std::string* response,
                                  std::vector<std::string>* info) {
+    return SendSparse(s, use_crc, "", response, info);
+}
+
+RetCode FastBootDriver::SendSparse(sparse_file* s, bool use_crc,
+                                   const std::string& stream_partition, std::string* response,
+                                   std::vector<std::string>* info) {
     error_ = "";
     int64_t size = sparse_file_len(s, true, use_crc);
     if (size <= 0 || size > MAX_DOWNLOAD_SIZE) {
@@ -266,7 +445,9 @@ RetCode FastBootDriver::Download(sparse_file* s, bool use_crc, std::string* resp
 
     RetCode ret;
     uint32_t u32size = static_cast<uint32_t>(size);
-    if ((ret = DownloadCommand(u32size, response, info))) {
+    ret = stream_partition.empty() ? DownloadCommand(u32size, response, info)
+                                   : StreamFlashCommand(stream_partition, u32size, response, info);
+    if (ret) {
         return ret;
     }
 
@@ -459,6 +640,36 @@ RetCode FastBootDriver::DownloadCommand(uint32_t size, std::string* response,
     return SUCCESS;
 }
 
+RetCode FastBootDriver::StreamFlashCommand(const std::string& partition, uint32_t size,
+                                           std::string* response, std::vector<std::string>* info,
+                                           const std::string& compression, uint32_t raw_size) {
+    std::string cmd(android::base::StringPrintf("%s:%08" PRIx32 ":%s", FB_CMD_STREAM_FLASH, size,
+                                                partition.c_str()));
+    if (!compression.empty()) {
+        cmd += android::base::StringPrintf(":%s:%08" PRIx32, compression.c_str(), raw_size);
+    }
+    return RawCommand(cmd, response, info);
+}
+
+RetCode FastBootDriver::SendCompressed(const std::string& partition,
+                                       const std::string& compression,
+                                       const std::vector<char>& frames, uint64_t raw_size) {
+    if (frames.empty() || frames.size() > MAX_DOWNLOAD_SIZE || raw_size > MAX_DOWNLOAD_SIZE) {
+        error_ = "Image is too large or empty";
+        return BAD_ARG;
+    }
+
+    RetCode ret;
+    if ((ret = StreamFlashCommand(partition, frames.size(), nullptr, nullptr, compression,
+                                  raw_size))) {
+        return ret;
+    }
+    if ((ret = SendBuffer(frames))) {
+        return ret;
+    }
+    return HandleResponse();
+}
+
 RetCode FastBootDriver::HandleResponse(std::string* response, std::vector<std::string>* info,
                                        int* dsize) {
     char status[FB_RESPONSE_SZ + 1];
@@ -529,6 +740,17 @@ RetCode FastBootDriver::SendBuffer(android::base::borrowed_fd fd, size_t size) {
     uint32_t remaining = size;
     RetCode ret;
 
+    // Let the transport send straight from the file if it can.
+    if (size) {
+        ssize_t tmp = transport_->WriteFromFd(fd.get(), 0, size);
+        if (tmp >= 0 && static_cast<size_t>(tmp) == size) {
+            return SUCCESS;
+        } else if (tmp >= 0 || errno != ENOTSUP) {
+            error_ = ErrnoStr("Write to device failed in SendBuffer()");
+            return IO_ERROR;
+        }
+    }
+
     while (remaining) {
         // Memory map the file
         size_t len = std::min(remaining, MAX_MAP_SIZE);
@@ -94,6 +94,8 @@ class FastBootDriver {
                   std::vector<std::string>* info = nullptr);
     RetCode Flash(const std::string& partition, std::string* response = nullptr,
                   std::vector<std::string>* info = nullptr);
+    RetCode FlashAsync(const std::string& partition, std::string* response = nullptr,
+                       std::vector<std::string>* info = nullptr);
     RetCode GetVar(const std::string& key, std::string* val,
                    std::vector<std::string>* info = nullptr);
     RetCode GetVarAll(std::vector<std::string>* response);
@@ -116,7 +118,15 @@ class FastBootDriver {
     RetCode FlashPartition(const std::string& partition, android::base::borrowed_fd fd,
                            uint32_t sz);
     RetCode FlashPartition(const std::string& partition, sparse_file* s, uint32_t sz,
-                           size_t current, size_t total);
+                           size_t current, size_t total, bool async = false);
+    // Send and flash an image in one command, for devices with stream-flash.
+    // A non-empty |compression| is one of the methods the device lists in the
+    // "compression" variable, to send the image compressed with.
+    RetCode StreamFlashPartition(const std::string& partition, android::base::borrowed_fd fd,
+                                 uint32_t sz, const std::string& compression = "");
+    RetCode StreamFlashPartition(const std::string& partition, sparse_file* s, uint32_t sz,
+                                 size_t current, size_t total,
+                                 const std::string& compression = "");
 
     RetCode Partitions(std::vector<std::tuple<std::string, uint64_t>>* partitions);
     RetCode Require(const std::string& var, const std::vector<std::string>& allowed, bool* reqmet,
@@ -142,6 +152,21 @@ class FastBootDriver {
   protected:
     RetCode DownloadCommand(uint32_t size, std::string* response = nullptr,
                             std::vector<std::string>* info = nullptr);
+    RetCode StreamFlashCommand(const std::string& partition, uint32_t size,
+                               std::string* response = nullptr,
+                               std::vector<std::string>* info = nullptr,
+                               const std::string& compression = "", uint32_t raw_size = 0);
+    // Sends compressed |frames| that decompress to |raw_size| bytes with
+    // stream-flash.
+    RetCode SendCompressed(const std::string& partition, const std::string& compression,
+                           const std::vector<char>& frames, uint64_t raw_size);
+    // An empty |stream_partition| sends the data with download, otherwise it
+    // is flashed to that partition with stream-flash.
+    RetCode SendData(android::base::borrowed_fd fd, size_t size,
+                     const std::string& stream_partition, std::string* response,
+                     std::vector<std::string>* info);
+    RetCode SendSparse(sparse_file* s, bool use_crc, const std::string& stream_partition,
+                       std::string* response, std::vector<std::string>* info);
     RetCode HandleResponse(std::string* response = nullptr,
                            std::vector<std::string>* info = nullptr, int* dsize = nullptr);
 
@@ -29,8 +29,20 @@
 #include "socket.h"
 
 #ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/select.h>
 #endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <errno.h>
+
+#include <algorithm>
+#include <vector>
 
 #include <android-base/errors.h>
 #include <android-base/stringprintf.h>
@@ -72,6 +84,11 @@ ssize_t Socket::ReceiveAll(void* data, size_t length, int timeout_ms) {
     return total;
 }
 
+bool Socket::SendFile(const void*, size_t, int, int64_t, size_t) {
+    errno = ENOTSUP;
+    return false;
+}
+
 int Socket::GetLocalPort() {
     return socket_get_local_port(sock_);
 }
@@ -177,6 +194,10 @@ class TcpSocket : public Socket {
 
     bool Send(const void* data, size_t length) override;
     bool Send(std::vector<cutils_socket_buffer_t> buffers) override;
+#if defined(__linux__)
+    bool SendFile(const void* header, size_t header_length, int fd, int64_t offset,
+                  size_t length) override;
+#endif
     ssize_t Receive(void* data, size_t length, int timeout_ms) override;
 
     std::unique_ptr<Socket> Accept() override;
@@ -233,6 +254,64 @@ bool TcpSocket::Send(std::vector<cutils_socket_buffer_t> buffers) {
     return true;
 }
 
+#if defined(__linux__)
+bool TcpSocket::SendFile(const void* header, size_t header_length, int fd, int64_t offset,
+                         size_t length) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        errno = ENOTSUP;
+        return false;
+    }
+
+    // MSG_MORE keeps the header queued so it goes out with the start of the file.
+    const char* data = reinterpret_cast<const char*>(header);
+    while (header_length > 0) {
+        ssize_t sent = TEMP_FAILURE_RETRY(send(sock_, data, header_length, MSG_MORE));
+        if (sent == -1) {
+            return false;
+        }
+        data += sent;
+        header_length -= sent;
+    }
+
+    off_t pos = offset;
+    while (length > 0) {
+        ssize_t sent = TEMP_FAILURE_RETRY(sendfile(sock_, fd, &pos, length));
+        if (sent > 0) {
+            length -= sent;
+            continue;
+        }
+        if (sent == 0) {
+            // The file is shorter than the caller said.
+            errno = EIO;
+            return false;
+        }
+        if (errno != EINVAL && errno != ENOSYS) {
+            return false;
+        }
+
+        // Some filesystems can't be sendfile()d from. The header is already on the wire, so
+        // finish the message with ordinary reads.
+        std::vector<char> buffer(std::min<size_t>(length, 1024 * 1024));
+        while (length > 0) {
+            ssize_t bytes = TEMP_FAILURE_RETRY(
+                    pread(fd, buffer.data(), std::min(length, buffer.size()), pos));
+            if (bytes <= 0) {
+                if (bytes == 0) errno = EIO;
+                return false;
+            }
+            if (!Send(buffer.data(), bytes)) {
+                return false;
+            }
+            pos += bytes;
+            length -= bytes;
+        }
+    }
+
+    return true;
+}
+#endif
+
 ssize_t TcpSocket::Receive(void* data, size_t length, int timeout_ms) {
     if (!WaitForRecv(timeout_ms)) {
         return -1;
@@ -259,6 +338,12 @@ std::unique_ptr<Socket> Socket::NewClient(Protocol protocol, const std::string&
     } else {
         cutils_socket_t sock = socket_network_client(host.c_str(), port, SOCK_STREAM);
         if (sock != INVALID_SOCKET) {
+            // Commands and responses are small messages that each wait on the previous one, so
+            // don't let Nagle's algorithm hold them back waiting for ACKs of a large download.
+            // Buffer sizes are left to the OS, since setting them disables auto-tuning.
+            int on = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on),
+                       sizeof(on));
             return std::unique_ptr<TcpSocket>(new TcpSocket(sock));
         }
     }
@@ -79,6 +79,13 @@ class Socket {
     // would require an additional sendto() variation of multi-buffer write.
     virtual bool Send(std::vector<cutils_socket_buffer_t> buffers) = 0;
 
+    // Sends |header_length| bytes of |header| followed by |length| bytes of the regular file |fd|
+    // starting at |offset|, letting the kernel copy the file straight to the socket. Returns true
+    // on success. Returns false with errno set to ENOTSUP, before sending anything, if this socket
+    // or |fd| can't be used this way; only TCP sockets on Linux support it.
+    virtual bool SendFile(const void* header, size_t header_length, int fd, int64_t offset,
+                          size_t length);
+
     // Waits up to |timeout_ms| to receive up to |length| bytes of data. |timout_ms| of 0 will
     // block forever. Returns the number of bytes received or -1 on error/timeout; see
     // ReceiveTimedOut() to distinguish between the two.
@@ -23,8 +23,12 @@
 #include "socket.h"
 #include "socket_mock.h"
 
+#include <unistd.h>
+
 #include <list>
 
+#include <android-base/file.h>
+
 #include <gtest/gtest-spi.h>
 #include <gtest/gtest.h>
 
@@ -280,6 +284,47 @@ TEST(SocketTest, TestTcpSendBuffers) {
     }
 }
 
+#if defined(__linux__)
+// Tests sending a header and part of a file over TCP.
+TEST(SocketTest, TestTcpSendFile) {
+    std::unique_ptr<Socket> server, client;
+    ASSERT_TRUE(MakeConnectedSockets(Socket::Protocol::kTcp, &server, &client));
+
+    TemporaryFile tf;
+    std::string contents(32 * 1024, '\0');
+    for (size_t i = 0; i < contents.length(); ++i) {
+        contents[i] = static_cast<char>(i * 7);
+    }
+    ASSERT_TRUE(android::base::WriteStringToFd(contents, tf.fd));
+
+    EXPECT_TRUE(client->SendFile("head", 4, tf.fd, 5, contents.length() - 10));
+    EXPECT_TRUE(ReceiveString(server.get(), "head" + contents.substr(5, contents.length() - 10)));
+
+    // Reading past the end of the file fails.
+    EXPECT_FALSE(client->SendFile("head", 4, tf.fd, 5, contents.length()));
+}
+
+// Tests that sockets which can't send from a file fail before sending anything.
+TEST(SocketTest, TestSendFileUnsupported) {
+    std::unique_ptr<Socket> server, client;
+    ASSERT_TRUE(MakeConnectedSockets(Socket::Protocol::kUdp, &server, &client));
+
+    TemporaryFile tf;
+    errno = 0;
+    EXPECT_FALSE(client->SendFile("head", 4, tf.fd, 0, 1));
+    EXPECT_EQ(ENOTSUP, errno);
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_TRUE(MakeConnectedSockets(Socket::Protocol::kTcp, &server, &client));
+    errno = 0;
+    EXPECT_FALSE(client->SendFile("head", 4, fds[0], 0, 1));
+    EXPECT_EQ(ENOTSUP, errno);
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
 TEST(SocketMockTest, TestSendSuccess) {
     SocketMock mock;
 
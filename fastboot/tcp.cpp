@@ -28,6 +28,8 @@
 
 #include "tcp.h"
 
+#include <errno.h>
+
 #include <android-base/parseint.h>
 #include <android-base/stringprintf.h>
 
@@ -63,6 +65,7 @@ class TcpTransport : public Transport {
 
     ssize_t Read(void* data, size_t length) override;
     ssize_t Write(const void* data, size_t length) override;
+    ssize_t WriteFromFd(int fd, int64_t offset, size_t length) override;
     int Close() override;
     int Reset() override;
 
@@ -169,6 +172,25 @@ ssize_t TcpTransport::Write(const void* data, size_t length) {
     return length;
 }
 
+ssize_t TcpTransport::WriteFromFd(int fd, int64_t offset, size_t length) {
+    if (socket_ == nullptr) {
+        return -1;
+    }
+
+    // The data still goes out as a single length-prefixed message.
+    char header[8];
+    EncodeMessageLength(length, header);
+    if (!socket_->SendFile(header, 8, fd, offset, length)) {
+        // On ENOTSUP nothing was sent and the caller can fall back to Write().
+        if (errno != ENOTSUP) {
+            Close();
+        }
+        return -1;
+    }
+
+    return length;
+}
+
 int TcpTransport::Close() {
     if (socket_ == nullptr) {
         return 0;
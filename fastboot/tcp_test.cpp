@@ -216,6 +216,17 @@ TEST_F(TcpTest, TestWriteFailure) {
     EXPECT_EQ(-1, transport_->Write("foo", 3));
 }
 
+TEST_F(TcpTest, TestWriteFromFdUnsupported) {
+    // SocketMock can't send from a file, so the transport should report ENOTSUP and stay usable
+    // for a plain Write().
+    errno = 0;
+    EXPECT_EQ(-1, transport_->WriteFromFd(0, 0, 3));
+    EXPECT_EQ(ENOTSUP, errno);
+
+    mock_->ExpectSend(std::string{0, 0, 0, 0, 0, 0, 0, 3} + "foo");
+    EXPECT_TRUE(Write("foo"));
+}
+
 TEST_F(TcpTest, TestTransportClose) {
     EXPECT_EQ(0, transport_->Close());
 
@@ -16,6 +16,10 @@
 
 #pragma once
 
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 #include <android-base/macros.h>
 
 // General interface to allow the fastboot protocol to be used over different
@@ -33,6 +37,16 @@ class Transport {
     // written or -1 on error.
     virtual ssize_t Write(const void* data, size_t len) = 0;
 
+    // Writes |len| bytes of |fd| starting at |offset|, as if they had been
+    // passed to Write(), without first copying them into user memory. Returns
+    // the number of bytes written or -1 on error. Transports that can't send
+    // from |fd| fail with errno set to ENOTSUP before writing anything, and the
+    // caller should fall back to Write().
+    virtual ssize_t WriteFromFd(int /* fd */, int64_t /* offset */, size_t /* len */) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
     // Closes the underlying transport. Returns 0 on success.
     virtual int Close() = 0;
 
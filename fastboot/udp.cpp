@@ -33,6 +33,8 @@
 #include <errno.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <deque>
 #include <list>
 #include <memory>
 #include <vector>
@@ -68,6 +70,7 @@ class Header {
     ~Header() = default;
 
     uint8_t id() const { return bytes_[kIndexId]; }
+    uint16_t sequence() const { return ExtractUint16(bytes_ + kIndexSeqH); }
     const uint8_t* bytes() const { return bytes_; }
 
     void Set(uint8_t id, uint16_t sequence, Flag flag);
@@ -131,9 +134,14 @@ class UdpTransport : public Transport {
                                    uint8_t* rx_data, size_t rx_length, int attempts,
                                    std::string* error);
 
+    // Writes |tx_length| bytes of fastboot data keeping up to |window_size_| packets in flight,
+    // and only re-transmits the ones that have not been acknowledged. Returns true on success.
+    bool SendDataWindowed(const uint8_t* tx_data, size_t tx_length, std::string* error);
+
     std::unique_ptr<Socket> socket_;
     int sequence_ = -1;
     size_t max_data_length_ = kMinPacketSize - kHeaderSize;
+    size_t window_size_ = 1;
     std::vector<uint8_t> rx_packet_;
 
     DISALLOW_COPY_AND_ASSIGN(UdpTransport);
@@ -151,7 +159,7 @@ std::unique_ptr<UdpTransport> UdpTransport::NewTransport(std::unique_ptr<Socket>
 }
 
 bool UdpTransport::InitializeProtocol(std::string* error) {
-    uint8_t rx_data[4];
+    uint8_t rx_data[6];
 
     sequence_ = 0;
     rx_packet_.resize(kMinPacketSize);
@@ -184,7 +192,7 @@ bool UdpTransport::InitializeProtocol(std::string* error) {
     // The first two data bytes contain the version, the second two bytes contain the target max
     // supported packet size, which must be at least 512 bytes.
     uint16_t version = ExtractUint16(rx_data);
-    if (version < kProtocolVersion) {
+    if (version < kMinProtocolVersion) {
         *error = android::base::StringPrintf("target reported invalid protocol version %d",
                                              version);
         return false;
@@ -199,6 +207,13 @@ bool UdpTransport::InitializeProtocol(std::string* error) {
     max_data_length_ = packet_size - kHeaderSize;
     rx_packet_.resize(packet_size);
 
+    // Version 2 devices follow with the number of packets they accept in flight.
+    window_size_ = 1;
+    if (version >= kWindowProtocolVersion && rx_bytes >= 6) {
+        uint16_t window_size = ExtractUint16(rx_data + 4);
+        window_size_ = std::clamp<uint16_t>(window_size, 1, kHostMaxWindowSize);
+    }
+
     return true;
 }
 
@@ -325,6 +340,91 @@ ssize_t UdpTransport::SendSinglePacketHelper(
     return total_data_bytes;
 }
 
+bool UdpTransport::SendDataWindowed(const uint8_t* tx_data, size_t tx_length,
+                                    std::string* error) {
+    struct Packet {
+        Header header;
+        const uint8_t* data;
+        size_t length;
+        bool acked;
+    };
+
+    if (socket_ == nullptr) {
+        *error = "socket is closed";
+        return false;
+    }
+    error->clear();
+
+    std::deque<Packet> window;
+    int attempts_left = kMaxTransmissionAttempts;
+    while (tx_length > 0 || !window.empty()) {
+        // Fill the window.
+        while (tx_length > 0 && window.size() < window_size_) {
+            Packet packet;
+            packet.data = tx_data;
+            packet.length = std::min(tx_length, max_data_length_);
+            packet.acked = false;
+            packet.header.Set(kIdFastboot, sequence_++,
+                              tx_length > packet.length ? kFlagContinuation : kFlagNone);
+            if (!socket_->Send({{packet.header.bytes(), kHeaderSize},
+                                {packet.data, packet.length}})) {
+                *error = Socket::GetErrorMessage();
+                return false;
+            }
+            tx_data += packet.length;
+            tx_length -= packet.length;
+            window.push_back(packet);
+        }
+
+        ssize_t bytes = socket_->Receive(rx_packet_.data(), rx_packet_.size(), kResponseTimeoutMs);
+        if (bytes == -1) {
+            if (!socket_->ReceiveTimedOut()) {
+                *error = Socket::GetErrorMessage();
+                return false;
+            }
+            if (--attempts_left <= 0) {
+                *error = "no response from target";
+                return false;
+            }
+            // Only re-transmit what the device hasn't acknowledged.
+            for (const Packet& packet : window) {
+                if (!packet.acked && !socket_->Send({{packet.header.bytes(), kHeaderSize},
+                                                     {packet.data, packet.length}})) {
+                    *error = Socket::GetErrorMessage();
+                    return false;
+                }
+            }
+            continue;
+        } else if (bytes < static_cast<ssize_t>(kHeaderSize)) {
+            *error = "protocol error: incomplete header";
+            return false;
+        }
+
+        // Ignore anything that doesn't belong to a packet in the window.
+        uint16_t index = ExtractUint16(rx_packet_.data() + kIndexSeqH) -
+                         window.front().header.sequence();
+        if (index >= window.size() || !window[index].header.Matches(rx_packet_.data())) {
+            continue;
+        }
+
+        if (rx_packet_[kIndexId] == kIdError) {
+            error->assign(rx_packet_.data() + kHeaderSize, rx_packet_.data() + bytes);
+            *error = "target reported error: " + *error;
+            return false;
+        } else if (bytes > static_cast<ssize_t>(kHeaderSize)) {
+            *error = "target sent fastboot data out-of-turn";
+            return false;
+        }
+
+        window[index].acked = true;
+        attempts_left = kMaxTransmissionAttempts;
+        while (!window.empty() && window.front().acked) {
+            window.pop_front();
+        }
+    }
+    return true;
+}
+
 ssize_t UdpTransport::Read(void* data, size_t length) {
     // Read from the target by sending an empty packet.
     std::string error;
@@ -346,6 +446,14 @@ ssize_t UdpTransport::Read(void* data, size_t length) {
 
 ssize_t UdpTransport::Write(const void* data, size_t length) {
     std::string error;
+    if (window_size_ > 1 && length > max_data_length_) {
+        if (!SendDataWindowed(reinterpret_cast<const uint8_t*>(data), length, &error)) {
+            fprintf(stderr, "UDP error: %s\n", error.c_str());
+            return -1;
+        }
+        return length;
+    }
+
     ssize_t bytes = SendData(kIdFastboot, reinterpret_cast<const uint8_t*>(data), length, nullptr,
                              0, kMaxTransmissionAttempts, &error);
 
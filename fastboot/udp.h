@@ -45,10 +45,15 @@ std::unique_ptr<Transport> Connect(const std::string& hostname, int port, std::s
 // Internal namespace for test use only.
 namespace internal {
 
-constexpr uint16_t kProtocolVersion = 1;
+// The version the host sends; the minimum of this and the device version is used.
+constexpr uint16_t kProtocolVersion = 2;
+constexpr uint16_t kMinProtocolVersion = 1;
+// Protocol version 2 allows a window of unacknowledged packets while writing.
+constexpr uint16_t kWindowProtocolVersion = 2;
 
 // This will be negotiated with the device so may end up being smaller.
 constexpr uint16_t kHostMaxPacketSize = 8192;
+constexpr uint16_t kHostMaxWindowSize = 64;
 
 // Retransmission constants. Retransmission timeout must be at least 500ms, and the host must
 // attempt to send packets for at least 1 minute once the device has connected. See
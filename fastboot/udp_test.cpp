@@ -132,6 +132,14 @@ TEST_F(UdpConnectTest, InitializationVersionMismatch) {
     mock_socket_->AddReceive(InitPacket(0, 0, 1024));
 
     EXPECT_FALSE(UdpConnect());
+
+    // Version 1 devices are still supported.
+    mock_socket_->ExpectSend(QueryPacket(0));
+    mock_socket_->AddReceive(QueryPacket(0, 0));
+    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->AddReceive(InitPacket(0, 1, 1024));
+
+    EXPECT_TRUE(UdpConnect());
 }
 
 TEST_F(UdpConnectTest, QueryResponseTimeoutFailure) {
@@ -309,15 +317,21 @@ class UdpTest : public ::testing::Test {
     }
 
     // Sets up |mock_socket_| to correctly initialize the protocol and creates |transport_|. This
-    // can be called multiple times in a test if needed.
-    bool InitializeTransport(uint16_t starting_sequence, int device_max_packet_size = 512) {
+    // can be called multiple times in a test if needed. A non-zero |device_window_size| is sent
+    // in the init response to enable windowed writes.
+    bool InitializeTransport(uint16_t starting_sequence, int device_max_packet_size = 512,
+                             uint16_t device_window_size = 0) {
         mock_socket_ = new SocketMock;
         mock_socket_->ExpectSend(QueryPacket(0));
         mock_socket_->AddReceive(QueryPacket(0, starting_sequence));
         mock_socket_->ExpectSend(
                 InitPacket(starting_sequence, kProtocolVersion, kHostMaxPacketSize));
-        mock_socket_->AddReceive(
-                InitPacket(starting_sequence, kProtocolVersion, device_max_packet_size));
+        std::string init_response =
+                InitPacket(starting_sequence, kProtocolVersion, device_max_packet_size);
+        if (device_window_size) {
+            init_response += PacketValue(device_window_size);
+        }
+        mock_socket_->AddReceive(init_response);
 
         std::string error;
         transport_ = Connect(std::unique_ptr<Socket>(mock_socket_), &error);
@@ -522,6 +536,66 @@ TEST_F(UdpTest, ErrorResponse) {
     EXPECT_FALSE(Write("foo"));
 }
 
+// Returns |count| chunks of test data for windowed writes with 512-byte packets.
+static std::vector<std::string> WindowChunks(size_t count) {
+    std::vector<std::string> chunks;
+    for (size_t i = 0; i < count; ++i) {
+        chunks.emplace_back(508, static_cast<char>('a' + i));
+    }
+    return chunks;
+}
+
+// Tests that a window of packets is sent before waiting for the ACKs.
+TEST_F(UdpTest, WindowedWrite) {
+    ASSERT_TRUE(InitializeTransport(0xFFFE, 512, 2));
+    auto chunks = WindowChunks(3);
+
+    mock_socket_->ExpectSend(FastbootPacket(0xFFFF, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(0x0000, chunks[1], kFlagContinuation));
+    mock_socket_->AddReceive(FastbootPacket(0xFFFF));
+    mock_socket_->ExpectSend(FastbootPacket(0x0001, chunks[2]));
+    mock_socket_->AddReceive(FastbootPacket(0x0000));
+    mock_socket_->AddReceive(FastbootPacket(0x0001));
+
+    EXPECT_TRUE(Write(chunks[0] + chunks[1] + chunks[2]));
+
+    // The sequence continues after the window.
+    mock_socket_->ExpectSend(FastbootPacket(0x0002));
+    mock_socket_->AddReceive(FastbootPacket(0x0002, "OKAY"));
+    EXPECT_TRUE(Read("OKAY"));
+}
+
+// Tests that only unacknowledged packets are re-transmitted after a timeout.
+TEST_F(UdpTest, WindowedWriteSelectiveRetransmission) {
+    ASSERT_TRUE(InitializeTransport(0, 512, 3));
+    auto chunks = WindowChunks(3);
+
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(3, chunks[2]));
+    mock_socket_->AddReceive(FastbootPacket(2));
+    mock_socket_->AddReceiveTimeout();
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(3, chunks[2]));
+    mock_socket_->AddReceive(FastbootPacket(3));
+    mock_socket_->AddReceive(FastbootPacket(1));
+
+    EXPECT_TRUE(Write(chunks[0] + chunks[1] + chunks[2]));
+}
+
+// Tests that stale ACKs are ignored and errors abort a windowed write.
+TEST_F(UdpTest, WindowedWriteError) {
+    ASSERT_TRUE(InitializeTransport(0, 512, 2));
+    auto chunks = WindowChunks(2);
+
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1]));
+    mock_socket_->AddReceive(FastbootPacket(0));
+    mock_socket_->AddReceive(ErrorPacket(2, "test error"));
+
+    EXPECT_FALSE(Write(chunks[0] + chunks[1]));
+}
+
 // Tests that attempting to use a closed transport returns -1 without making any socket calls.
 TEST_F(UdpTest, CloseTransport) {
     char buffer[32];
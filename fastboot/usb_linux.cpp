@@ -30,6 +30,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,6 +49,7 @@
 #include <chrono>
 #include <memory>
 #include <thread>
+#include <vector>
 
 #include "usb.h"
 #include "util.h"
@@ -85,6 +87,14 @@ using namespace std::chrono_literals;
 // kernel.
 #define MAX_USBFS_BULK_SIZE (16 * 1024)
 
+// Large writes are sent as several URBs queued at once, so that the host
+// controller always has the next transfer ready when one completes. Kernels
+// too old for URBs this size reject the first submission; the size is then
+// reduced to MAX_USBFS_BULK_SIZE, and if that fails too, writes fall back to
+// synchronous USBDEVFS_BULK.
+#define MAX_USBFS_URB_SIZE (256 * 1024)
+#define NUM_WRITE_URBS 8
+
 struct usb_handle
 {
     char fname[64];
@@ -106,8 +116,15 @@ class LinuxUsbTransport : public UsbTransport {
     int WaitForDisconnect() override;
 
   private:
+    ssize_t WriteSync(unsigned char* data, size_t len);
+    ssize_t WriteAsync(unsigned char* data, size_t len);
+    int ReapUrb(usbdevfs_urb** urb);
+    void DiscardUrbs(std::vector<usbdevfs_urb>& urbs, std::vector<bool>& in_flight);
+
     std::unique_ptr<usb_handle> handle_;
     const uint32_t ms_timeout_;
+    size_t urb_size_ = MAX_USBFS_URB_SIZE;
+    bool async_write_ = true;
 
     DISALLOW_COPY_AND_ASSIGN(LinuxUsbTransport);
 };
@@ -403,14 +420,26 @@ LinuxUsbTransport::~LinuxUsbTransport() {
 ssize_t LinuxUsbTransport::Write(const void* _data, size_t len)
 {
     unsigned char *data = (unsigned char*) _data;
-    unsigned count = 0;
-    struct usbdevfs_bulktransfer bulk;
-    int n;
 
     if (handle_->ep_out == 0 || handle_->desc == -1) {
         return -1;
     }
 
+    if (async_write_ && len > MAX_USBFS_BULK_SIZE) {
+        ssize_t n = WriteAsync(data, len);
+        if (n != -EOPNOTSUPP) {
+            return n;
+        }
+    }
+    return WriteSync(data, len);
+}
+
+ssize_t LinuxUsbTransport::WriteSync(unsigned char* data, size_t len)
+{
+    unsigned count = 0;
+    struct usbdevfs_bulktransfer bulk;
+    int n;
+
     do {
         int xfer;
         xfer = (len > MAX_USBFS_BULK_SIZE) ? MAX_USBFS_BULK_SIZE : len;
@@ -435,6 +464,116 @@ ssize_t LinuxUsbTransport::Write(const void* _data, size_t len)
     return count;
 }
 
+// Waits for the next URB to complete, for at most ms_timeout_ if one is set.
+int LinuxUsbTransport::ReapUrb(usbdevfs_urb** urb)
+{
+    if (ms_timeout_ == 0) {
+        return TEMP_FAILURE_RETRY(ioctl(handle_->desc, USBDEVFS_REAPURB, urb));
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms_timeout_);
+    while (true) {
+        if (ioctl(handle_->desc, USBDEVFS_REAPURBNDELAY, urb) == 0) {
+            return 0;
+        }
+        if (errno != EAGAIN) {
+            return -1;
+        }
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (left <= 0ms) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        // usbfs reports POLLOUT when a URB has completed.
+        struct pollfd pfd = {.fd = handle_->desc, .events = POLLOUT};
+        if (poll(&pfd, 1, left.count()) < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+void LinuxUsbTransport::DiscardUrbs(std::vector<usbdevfs_urb>& urbs, std::vector<bool>& in_flight)
+{
+    for (size_t i = 0; i < urbs.size(); i++) {
+        if (in_flight[i]) {
+            ioctl(handle_->desc, USBDEVFS_DISCARDURB, &urbs[i]);
+        }
+    }
+    // Discarded URBs still have to be reaped before their memory goes away.
+    for (size_t i = 0; i < urbs.size(); i++) {
+        if (!in_flight[i]) {
+            continue;
+        }
+        usbdevfs_urb* urb;
+        if (TEMP_FAILURE_RETRY(ioctl(handle_->desc, USBDEVFS_REAPURB, &urb)) < 0) {
+            break;
+        }
+        in_flight[urb - urbs.data()] = false;
+    }
+}
+
+// Returns -EOPNOTSUPP, before anything was sent, if the kernel can't take
+// asynchronous URBs.
+ssize_t LinuxUsbTransport::WriteAsync(unsigned char* data, size_t len)
+{
+    std::vector<usbdevfs_urb> urbs(NUM_WRITE_URBS);
+    std::vector<bool> in_flight(NUM_WRITE_URBS);
+    size_t num_in_flight = 0;
+    size_t submitted = 0;
+    size_t count = 0;
+
+    while (count < len) {
+        for (size_t i = 0; i < urbs.size() && submitted < len; i++) {
+            if (in_flight[i]) {
+                continue;
+            }
+            usbdevfs_urb* urb = &urbs[i];
+            memset(urb, 0, sizeof(*urb));
+            urb->type = USBDEVFS_URB_TYPE_BULK;
+            urb->endpoint = handle_->ep_out;
+            urb->buffer = data + submitted;
+            urb->buffer_length = std::min(len - submitted, urb_size_);
+
+            if (ioctl(handle_->desc, USBDEVFS_SUBMITURB, urb) < 0) {
+                if (submitted == 0 && (errno == ENOMEM || errno == EINVAL)) {
+                    if (urb_size_ > MAX_USBFS_BULK_SIZE) {
+                        urb_size_ = MAX_USBFS_BULK_SIZE;
+                        i--;
+                        continue;
+                    }
+                    async_write_ = false;
+                    return -EOPNOTSUPP;
+                }
+                DBG("ERROR: submit urb failed, errno = %d (%s)\n", errno, strerror(errno));
+                DiscardUrbs(urbs, in_flight);
+                return -1;
+            }
+            in_flight[i] = true;
+            num_in_flight++;
+            submitted += urb->buffer_length;
+        }
+
+        usbdevfs_urb* urb;
+        if (ReapUrb(&urb) < 0) {
+            DBG("ERROR: reap urb failed, errno = %d (%s)\n", errno, strerror(errno));
+            DiscardUrbs(urbs, in_flight);
+            return -1;
+        }
+        in_flight[urb - urbs.data()] = false;
+        num_in_flight--;
+
+        if (urb->status != 0 || urb->actual_length != urb->buffer_length) {
+            DBG("ERROR: urb status = %d, actual_length = %d\n", urb->status, urb->actual_length);
+            DiscardUrbs(urbs, in_flight);
+            return -1;
+        }
+        count += urb->actual_length;
+    }
+
+    return count;
+}
+
 ssize_t LinuxUsbTransport::Read(void* _data, size_t len)
 {
     unsigned char *data = (unsigned char*) _data;
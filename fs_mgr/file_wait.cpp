@@ -25,6 +25,7 @@
 #include <unistd.h>
 #endif
 
+#include <algorithm>
 #include <functional>
 #include <thread>
 
@@ -67,6 +68,22 @@ bool PollForFileDeleted(const std::string& path, const std::chrono::milliseconds
 }
 
 #if defined(__linux__)
+// Watches for |path| being created. Its parent directory might not exist yet
+// either (for example, /dev/block/mapper/by-uuid before the first dm device),
+// in which case the closest ancestor that does exist is watched. Callers
+// re-add the watch after each wakeup to move it down as directories appear.
+static bool AddParentWatch(int inotify_fd, const std::string& path) {
+    std::string dir = android::base::Dirname(path);
+    while (inotify_add_watch(inotify_fd, dir.c_str(), IN_CREATE) < 0) {
+        if (errno != ENOENT || dir == "/" || dir == ".") {
+            PLOG(ERROR) << "inotify_add_watch failed: " << dir;
+            return false;
+        }
+        dir = android::base::Dirname(dir);
+    }
+    return true;
+}
+
 class OneShotInotify {
   public:
     OneShotInotify(const std::string& path, uint32_t mask,
@@ -75,6 +92,7 @@ class OneShotInotify {
     bool Wait();
 
   private:
+    bool AddWatch(int inotify_fd);
     bool CheckCompleted();
     int64_t RemainingMs() const;
     bool ConsumeEvents();
@@ -106,16 +124,7 @@ OneShotInotify::OneShotInotify(const std::string& path, uint32_t mask,
         return;
     }
 
-    std::string watch_path;
-    if (mask == IN_CREATE) {
-        watch_path = android::base::Dirname(path);
-    } else {
-        watch_path = path;
-    }
-    if (inotify_add_watch(inotify_fd, watch_path.c_str(), mask) < 0) {
-        PLOG(ERROR) << "inotify_add_watch failed";
-        return;
-    }
+    if (!AddWatch(inotify_fd)) return;
 
     // It's possible the condition was met before the add_watch. Check for
     // this and abort early if so.
@@ -124,6 +133,17 @@ OneShotInotify::OneShotInotify(const std::string& path, uint32_t mask,
     inotify_fd_ = std::move(inotify_fd);
 }
 
+bool OneShotInotify::AddWatch(int inotify_fd) {
+    if (mask_ == IN_CREATE) {
+        return AddParentWatch(inotify_fd, path_);
+    }
+    if (inotify_add_watch(inotify_fd, path_.c_str(), mask_) < 0) {
+        PLOG(ERROR) << "inotify_add_watch failed";
+        return false;
+    }
+    return true;
+}
+
 bool OneShotInotify::Wait() {
     Result result = WaitImpl();
     if (result == Result::Success) return true;
@@ -174,6 +194,8 @@ OneShotInotify::Result OneShotInotify::WaitImpl() {
         // If it's not, we consume all the events available and continue.
         if (CheckCompleted()) return Result::Success;
         if (!ConsumeEvents()) return Result::Error;
+        if (mask_ == IN_CREATE && !AddWatch(inotify_fd_)) return Result::Error;
+        if (CheckCompleted()) return Result::Success;
     }
 }
 
@@ -224,6 +246,112 @@ bool WaitForFile(const std::string& path, const std::chrono::milliseconds relati
 #endif
 }
 
+#if defined(__linux__)
+// Like OneShotInotify, but for a set of files that are being created. One
+// inotify instance watches every parent directory, so waiting on many device
+// nodes costs a single wakeup per batch of uevents instead of one wait per
+// node.
+static bool WaitForFilesInotify(std::vector<std::string>* pending,
+                                const std::chrono::milliseconds relative_timeout) {
+    auto start_time = std::chrono::steady_clock::now();
+    auto remaining_ms = [&]() -> int64_t {
+        if (relative_timeout == std::chrono::milliseconds::max()) {
+            return std::chrono::milliseconds::max().count();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start_time);
+        return (relative_timeout - elapsed).count();
+    };
+    auto check_completed = [&]() -> bool {
+        auto iter = pending->begin();
+        while (iter != pending->end()) {
+            if (!access(iter->c_str(), F_OK) || errno != ENOENT) {
+                iter = pending->erase(iter);
+            } else {
+                iter++;
+            }
+        }
+        return pending->empty();
+    };
+
+    if (check_completed()) return true;
+
+    unique_fd inotify_fd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+    if (inotify_fd < 0) {
+        PLOG(ERROR) << "inotify_init1 failed";
+        return false;
+    }
+
+    while (true) {
+        // Adding a watch that already exists is cheap, and keeps the watches
+        // following directories as they are created.
+        for (const auto& path : *pending) {
+            if (!AddParentWatch(inotify_fd, path)) return false;
+        }
+        if (check_completed()) return true;
+
+        auto timeout = remaining_ms();
+        if (timeout <= 0) return true;
+
+        struct pollfd event = {
+                .fd = inotify_fd,
+                .events = POLLIN,
+                .revents = 0,
+        };
+        int rv = poll(&event, 1, static_cast<int>(std::min<int64_t>(timeout, INT_MAX)));
+        if (rv <= 0) {
+            if (rv == 0 || errno == EINTR) {
+                continue;
+            }
+            PLOG(ERROR) << "poll for inotify failed";
+            return false;
+        }
+        if (event.revents & POLLERR) {
+            LOG(ERROR) << "error reading inotify";
+            return false;
+        }
+
+        // As in OneShotInotify, the events themselves don't matter; drain
+        // them and check the files again.
+        static constexpr size_t kBufferSize = sizeof(struct inotify_event) + NAME_MAX + 1;
+        char buffer[kBufferSize];
+        while (true) {
+            ssize_t rv = TEMP_FAILURE_RETRY(read(inotify_fd, buffer, sizeof(buffer)));
+            if (rv > 0) continue;
+            if (rv == 0 || errno == EAGAIN) break;
+            PLOG(ERROR) << "read inotify failed";
+            return false;
+        }
+    }
+}
+#endif
+
+bool WaitForFiles(const std::vector<std::string>& paths,
+                  const std::chrono::milliseconds relative_timeout) {
+    auto start_time = std::chrono::steady_clock::now();
+    std::vector<std::string> pending = paths;
+
+#if defined(__linux__)
+    // On an inotify error, fall back to polling for whatever is left. A
+    // timeout leaves files in |pending| too, and is reported below.
+    WaitForFilesInotify(&pending, relative_timeout);
+#endif
+
+    for (const auto& path : pending) {
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
+        auto timeout = relative_timeout;
+        if (relative_timeout != std::chrono::milliseconds::max()) {
+            timeout = std::max(relative_timeout - elapsed, 0ms);
+        }
+        if (!PollForFile(path, timeout)) {
+            LOG(ERROR) << "Timed out waiting for " << path;
+            return false;
+        }
+    }
+    return true;
+}
+
 // Wait at most |relative_timeout| milliseconds for |path| to stop existing.
 bool WaitForFileDeleted(const std::string& path, const std::chrono::milliseconds relative_timeout) {
 #if defined(__linux__)
@@ -34,11 +34,15 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <thread>
@@ -53,6 +57,7 @@
 #include <android-base/unique_fd.h>
 #include <cutils/android_filesystem_config.h>
 #include <cutils/android_reboot.h>
+#include <cutils/boot_events.h>
 #include <cutils/partition_utils.h>
 #include <cutils/properties.h>
 #include <ext4_utils/ext4.h>
@@ -86,6 +91,8 @@
 #define ZRAM_CONF_DEV   "/sys/block/zram0/disksize"
 #define ZRAM_CONF_MCS   "/sys/block/zram0/max_comp_streams"
 #define ZRAM_BACK_DEV   "/sys/block/zram0/backing_dev"
+#define ZRAM_CONF_ALGO  "/sys/block/zram0/comp_algorithm"
+#define ZRAM_CONF_RECOMP_ALGO "/sys/block/zram0/recomp_algorithm"
 
 #define SYSFS_EXT4_VERITY "/sys/fs/ext4/features/verity"
 #define SYSFS_EXT4_CASEFOLD "/sys/fs/ext4/features/casefold"
@@ -798,6 +805,7 @@ static int __mount(const std::string& source, const std::string& target, const F
     bool try_f2fs_gc_allowance = is_f2fs(entry.fs_type) && entry.fs_checkpoint_opts.length() > 0;
     bool try_f2fs_fallback = false;
     Timer t;
+    boot_event_begin("fs_mgr", target.c_str());
 
     do {
         if (save_errno == EINVAL && (try_f2fs_gc_allowance || try_f2fs_fallback)) {
@@ -825,6 +833,7 @@ static int __mount(const std::string& source, const std::string& target, const F
         if (try_f2fs_gc_allowance) gc_allowance += 10;
     } while ((ret && save_errno == EAGAIN && gc_allowance <= 100) ||
              (ret && save_errno == EINVAL && (try_f2fs_gc_allowance || try_f2fs_fallback)));
+    boot_event_end("fs_mgr", target.c_str());
     const char* target_missing = "";
     const char* source_missing = "";
     if (save_errno == ENOENT) {
@@ -1339,6 +1348,120 @@ static bool IsMountPointMounted(const std::string& mount_point) {
     return GetEntryForMountPoint(&fstab, mount_point) != nullptr;
 }
 
+// Entries with the "parallelmount" flag are checked and mounted on a small
+// pool of threads once the serial walk over the fstab reaches an entry that
+// must wait for them. Only entries without encryption setup or formatting
+// steps qualify, since those talk to vold and may restart the walk.
+static constexpr size_t kMaxParallelMounts = 4;
+
+struct ParallelMount {
+    int start_idx;
+    int attempted_idx = -1;
+    bool mounted = false;
+    int mount_errno = 0;
+    std::chrono::milliseconds duration = 0ms;
+};
+
+static bool CanMountInParallel(const FstabEntry& entry) {
+    return entry.fs_mgr_flags.parallel_mount && !entry.fs_mgr_flags.formattable &&
+           !should_use_metadata_encryption(entry) && entry.mount_point != "/data";
+}
+
+// Returns true if one of the mount points is the other, or is below it.
+static bool MountPointsNested(const std::string& a, const std::string& b) {
+    const std::string& outer = a.size() <= b.size() ? a : b;
+    const std::string& inner = a.size() <= b.size() ? b : a;
+    if (!StartsWith(inner, outer)) {
+        return false;
+    }
+    return inner.size() == outer.size() || outer.back() == '/' || inner[outer.size()] == '/';
+}
+
+static bool DependsOnParallelMounts(const Fstab& fstab, const std::vector<ParallelMount>& mounts,
+                                    const FstabEntry& entry) {
+    for (const auto& mount : mounts) {
+        if (MountPointsNested(fstab[mount.start_idx].mount_point, entry.mount_point)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Runs mount_with_alternatives() for each entry in |mounts|. Entries whose
+// mount points are nested wait for each other, in fstab order.
+static void RunParallelMounts(const Fstab& fstab, std::vector<ParallelMount>* mounts) {
+    if (mounts->empty()) {
+        return;
+    }
+
+    std::vector<std::vector<size_t>> deps(mounts->size());
+    for (size_t i = 0; i < mounts->size(); i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (MountPointsNested(fstab[(*mounts)[i].start_idx].mount_point,
+                                  fstab[(*mounts)[j].start_idx].mount_point)) {
+                deps[i].emplace_back(j);
+            }
+        }
+    }
+
+    std::mutex lock;
+    std::condition_variable cv;
+    std::vector<bool> started(mounts->size()), done(mounts->size());
+
+    auto worker = [&]() -> void {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            // Jobs only depend on earlier jobs, so as long as any is left,
+            // one of them is either runnable or waiting on a running job.
+            size_t index = 0;
+            bool pending = false;
+            for (; index < mounts->size(); index++) {
+                if (started[index]) continue;
+                pending = true;
+                if (std::all_of(deps[index].begin(), deps[index].end(),
+                                [&](size_t dep) -> bool { return done[dep]; })) {
+                    break;
+                }
+            }
+            if (!pending) {
+                return;
+            }
+            if (index == mounts->size()) {
+                cv.wait(guard);
+                continue;
+            }
+            started[index] = true;
+            guard.unlock();
+
+            auto& mount = (*mounts)[index];
+            Timer t;
+            int end_idx;
+            mount.mounted =
+                    mount_with_alternatives(fstab, mount.start_idx, &end_idx, &mount.attempted_idx);
+            mount.mount_errno = errno;
+            mount.duration = t.duration();
+            LINFO << "Parallel mount of " << fstab[mount.start_idx].mount_point << " "
+                  << (mount.mounted ? "succeeded" : "failed") << " in " << mount.duration.count()
+                  << "ms";
+
+            guard.lock();
+            done[index] = true;
+            cv.notify_all();
+        }
+    };
+
+    Timer t;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::min(kMaxParallelMounts, mounts->size()); i++) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    LINFO << "Mounted " << mounts->size() << " entries with " << threads.size() << " threads in "
+          << t.duration().count() << "ms";
+}
+
 // When multiple fstab records share the same mount_point, it will try to mount each
 // one in turn, and ignore any duplicates after a first successful mount.
 // Returns -1 on error, and  FS_MGR_MNTALL_* otherwise.
@@ -1354,6 +1477,38 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
         return {FS_MGR_MNTALL_FAIL, userdata_mounted};
     }
 
+    // Mounts the queued "parallelmount" entries, and accounts for the results
+    // the same way as for entries that are mounted one at a time.
+    std::vector<ParallelMount> parallel_mounts;
+    auto finish_parallel_mounts = [&]() -> void {
+        RunParallelMounts(*fstab, &parallel_mounts);
+        for (const auto& mount : parallel_mounts) {
+            const auto& attempted_entry = (*fstab)[mount.attempted_idx];
+            if (mount.mounted) {
+                // These are never metadata encrypted, so there is nothing
+                // left to set up here.
+                int status = handle_encryptable(attempted_entry);
+                if (status != FS_MGR_MNTALL_DEV_NOT_ENCRYPTABLE) {
+                    if (encryptable != FS_MGR_MNTALL_DEV_NOT_ENCRYPTABLE) {
+                        LERROR << "Only one encryptable/encrypted partition supported";
+                    }
+                    encryptable = status;
+                }
+                continue;
+            }
+            errno = mount.mount_errno;
+            if (attempted_entry.fs_mgr_flags.no_fail) {
+                PERROR << "Ignoring failure to mount " << attempted_entry.blk_device << " at "
+                       << attempted_entry.mount_point;
+            } else {
+                PERROR << "Failed to mount " << attempted_entry.blk_device << " at "
+                       << attempted_entry.mount_point;
+                ++error_count;
+            }
+        }
+        parallel_mounts.clear();
+    };
+
     // Keep i int to prevent unsigned integer overflow from (i = top_idx - 1),
     // where top_idx is 0. It will give SIGABRT
     for (int i = 0; i < static_cast<int>(fstab->size()); i++) {
@@ -1447,6 +1602,19 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
             }
         }
 
+        if (CanMountInParallel(current_entry)) {
+            parallel_mounts.push_back({.start_idx = i});
+            // Skip over the alternatives, which mount_with_alternatives() tries.
+            while (i + 1 < static_cast<int>(fstab->size()) &&
+                   (*fstab)[i + 1].mount_point == current_entry.mount_point) {
+                i++;
+            }
+            continue;
+        }
+        if (DependsOnParallelMounts(*fstab, parallel_mounts, current_entry)) {
+            finish_parallel_mounts();
+        }
+
         int last_idx_inspected;
         int top_idx = i;
         int attempted_idx = -1;
@@ -1568,6 +1736,8 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
         }
     }
 
+    finish_parallel_mounts();
+
     set_type_property(encryptable);
 
 #if ALLOW_ADBD_DISABLE_VERITY == 1  // "userdebug" build
@@ -2047,6 +2217,81 @@ static bool PrepareZramBackingDevice(off64_t size) {
     return InstallZramDevice(loop_device);
 }
 
+// Selects the primary compression algorithm and, on kernels with zram
+// recompression, the secondary ones. Both must be set before the disk size.
+static bool ConfigureZramAlgorithms(const FstabEntry& entry) {
+    if (!entry.zram_comp_algorithm.empty() &&
+        !android::base::WriteStringToFile(entry.zram_comp_algorithm, ZRAM_CONF_ALGO)) {
+        PERROR << "Unable to set zram compression algorithm " << entry.zram_comp_algorithm;
+        return false;
+    }
+
+    // Secondary algorithms are listed in order of priority, starting at 1.
+    auto algorithms = android::base::Split(entry.zram_recomp_algorithm, ":");
+    for (size_t i = 0; i < algorithms.size(); i++) {
+        if (algorithms[i].empty()) continue;
+        auto value = android::base::StringPrintf("algo=%s priority=%zu", algorithms[i].c_str(),
+                                                 i + 1);
+        if (!android::base::WriteStringToFile(value, ZRAM_CONF_RECOMP_ALGO)) {
+            PERROR << "Unable to set zram recompression algorithm " << algorithms[i];
+            return false;
+        }
+    }
+    return true;
+}
+
+// Writes a version 1 swap header, like mkswap does, without forking it. The
+// swap area needs nothing else to be initialized; the rest of the device is
+// never read before it is written.
+static bool WriteSwapHeader(const std::string& blk_device) {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(blk_device.c_str(), O_WRONLY | O_CLOEXEC)));
+    if (fd < 0) {
+        PERROR << "Cannot open " << blk_device;
+        return false;
+    }
+
+    uint64_t size;
+    if (ioctl(fd.get(), BLKGETSIZE64, &size) < 0) {
+        PERROR << "Cannot get size of " << blk_device;
+        return false;
+    }
+
+    // mkswap rejects anything with fewer than 10 pages as well.
+    const size_t page_size = getpagesize();
+    if (size / page_size < 10) {
+        LERROR << "Swap area " << blk_device << " is too small: " << size;
+        return false;
+    }
+
+    // Layout of union swap_header.info, which starts at byte 1024 of the first
+    // page. The magic is in the last 10 bytes of that page.
+    struct SwapHeaderInfo {
+        uint32_t version;
+        uint32_t last_page;
+        uint32_t nr_badpages;
+        uint8_t uuid[16];
+        char volume_name[16];
+    };
+    static constexpr size_t kSwapInfoOffset = 1024;
+    static constexpr char kSwapMagic[] = "SWAPSPACE2";
+
+    SwapHeaderInfo info = {};
+    info.version = 1;
+    info.last_page = static_cast<uint32_t>(
+            std::min<uint64_t>(size / page_size - 1, std::numeric_limits<uint32_t>::max()));
+
+    std::string header(page_size, '\0');
+    memcpy(&header[kSwapInfoOffset], &info, sizeof(info));
+    memcpy(&header[page_size - strlen(kSwapMagic)], kSwapMagic, strlen(kSwapMagic));
+
+    if (!android::base::WriteFullyAtOffset(fd.get(), header.data(), header.size(), 0) ||
+        fsync(fd.get()) < 0) {
+        PERROR << "Cannot write swap header to " << blk_device;
+        return false;
+    }
+    return true;
+}
+
 bool fs_mgr_swapon_all(const Fstab& fstab) {
     bool ret = true;
     for (const auto& entry : fstab) {
@@ -2074,6 +2319,11 @@ bool fs_mgr_swapon_all(const Fstab& fstab) {
                 fprintf(zram_mcs_fp.get(), "%d\n", entry.max_comp_streams);
             }
 
+            if (!ConfigureZramAlgorithms(entry)) {
+                ret = false;
+                continue;
+            }
+
             auto zram_fp =
                     std::unique_ptr<FILE, decltype(&fclose)>{fopen(ZRAM_CONF_DEV, "re+"), fclose};
             if (zram_fp == nullptr) {
@@ -2090,13 +2340,17 @@ bool fs_mgr_swapon_all(const Fstab& fstab) {
             continue;
         }
 
-        // Initialize the swap area.
-        const char* mkswap_argv[2] = {
-                MKSWAP_BIN,
-                entry.blk_device.c_str(),
-        };
-        int err = logwrap_fork_execvp(ARRAY_SIZE(mkswap_argv), mkswap_argv, nullptr, false,
+        // Initialize the swap area. Fall back to mkswap if the header can't be
+        // written directly, e.g. if the device does not report its size.
+        int err = 0;
+        if (!WriteSwapHeader(entry.blk_device)) {
+            const char* mkswap_argv[2] = {
+                    MKSWAP_BIN,
+                    entry.blk_device.c_str(),
+            };
+            err = logwrap_fork_execvp(ARRAY_SIZE(mkswap_argv), mkswap_argv, nullptr, false,
                                       LOG_KLOG, false, nullptr);
+        }
         if (err) {
             LERROR << "mkswap failed for " << entry.blk_device;
             ret = false;
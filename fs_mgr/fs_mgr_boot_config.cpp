@@ -16,6 +16,9 @@
 
 #include <algorithm>
 #include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -114,26 +117,81 @@ bool fs_mgr_get_boot_config_from_kernel(const std::string& cmdline, const std::s
     return false;
 }
 
+namespace {
+
+// /proc/bootconfig, /proc/cmdline and the device tree can't change once the
+// kernel has booted, but are looked up many times during boot. Each source is
+// read and parsed once per process into a map from the full key to its value.
+// As with a linear search of the parsed list, the first occurrence of a key
+// wins.
+using BootConfigIndex = std::map<std::string, std::string>;
+
+std::optional<BootConfigIndex> LoadBootConfigIndex(
+        const std::string& path,
+        std::vector<std::pair<std::string, std::string>> (*parse)(const std::string&)) {
+    std::string contents;
+    if (!android::base::ReadFileToString(path, &contents)) return std::nullopt;
+    if (!contents.empty() && contents.back() == '\n') {
+        contents.pop_back();
+    }
+
+    BootConfigIndex index;
+    for (auto& [key, value] : parse(contents)) {
+        index.emplace(std::move(key), std::move(value));
+    }
+    return index;
+}
+
+// Returns false without touching |out_val| if the source could not be read.
+bool LookupBootConfigIndex(const std::optional<BootConfigIndex>& index,
+                           const std::string& android_key, std::string* out_val) {
+    FS_MGR_CHECK(out_val != nullptr);
+
+    if (!index) return false;
+    auto iter = index->find("androidboot." + android_key);
+    if (iter == index->end()) {
+        *out_val = "";
+        return false;
+    }
+    *out_val = iter->second;
+    return true;
+}
+
+bool GetBootConfigFromDt(const std::string& key, std::string* out_val) {
+    static std::mutex lock;
+    static std::map<std::string, std::optional<std::string>> cache;
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto iter = cache.find(key);
+    if (iter == cache.end()) {
+        std::optional<std::string> value;
+        std::string file_name = get_android_dt_dir() + "/" + key;
+        std::string contents;
+        if (android::base::ReadFileToString(file_name, &contents) && !contents.empty()) {
+            contents.pop_back();  // Trims the trailing '\0' out.
+            value = std::move(contents);
+        }
+        iter = cache.emplace(key, std::move(value)).first;
+    }
+    if (!iter->second) return false;
+    *out_val = *iter->second;
+    return true;
+}
+
+}  // namespace
+
 // Tries to get the given boot config value from bootconfig.
 // Returns true if successfully found, false otherwise.
 bool fs_mgr_get_boot_config_from_bootconfig_source(const std::string& key, std::string* out_val) {
-    std::string bootconfig;
-    if (!android::base::ReadFileToString("/proc/bootconfig", &bootconfig)) return false;
-    if (!bootconfig.empty() && bootconfig.back() == '\n') {
-        bootconfig.pop_back();
-    }
-    return fs_mgr_get_boot_config_from_bootconfig(bootconfig, key, out_val);
+    static const auto index = LoadBootConfigIndex("/proc/bootconfig", fs_mgr_parse_proc_bootconfig);
+    return LookupBootConfigIndex(index, key, out_val);
 }
 
 // Tries to get the given boot config value from kernel cmdline.
 // Returns true if successfully found, false otherwise.
 bool fs_mgr_get_boot_config_from_kernel_cmdline(const std::string& key, std::string* out_val) {
-    std::string cmdline;
-    if (!android::base::ReadFileToString("/proc/cmdline", &cmdline)) return false;
-    if (!cmdline.empty() && cmdline.back() == '\n') {
-        cmdline.pop_back();
-    }
-    return fs_mgr_get_boot_config_from_kernel(cmdline, key, out_val);
+    static const auto index = LoadBootConfigIndex("/proc/cmdline", fs_mgr_parse_cmdline);
+    return LookupBootConfigIndex(index, key, out_val);
 }
 
 // Tries to get the boot config value in device tree, properties and
@@ -143,14 +201,8 @@ bool fs_mgr_get_boot_config(const std::string& key, std::string* out_val) {
     FS_MGR_CHECK(out_val != nullptr);
 
     // firstly, check the device tree
-    if (is_dt_compatible()) {
-        std::string file_name = get_android_dt_dir() + "/" + key;
-        if (android::base::ReadFileToString(file_name, out_val)) {
-            if (!out_val->empty()) {
-                out_val->pop_back();  // Trims the trailing '\0' out.
-                return true;
-            }
-        }
+    if (is_dt_compatible() && GetBootConfigFromDt(key, out_val)) {
+        return true;
     }
 
     // next, check if we have "ro.boot" property already
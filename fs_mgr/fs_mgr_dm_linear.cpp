@@ -31,7 +31,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <map>
 #include <sstream>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -92,9 +94,31 @@ static bool GetPhysicalPartitionDevicePath(const CreateLogicalPartitionParams& p
 bool CreateDmTableInternal(const CreateLogicalPartitionParams& params, DmTable* table) {
     const auto& super_device = params.block_device;
 
-    uint64_t sector = 0;
+    // Extents that continue one another on the same block device can share a
+    // target, which keeps the table (and the kernel's per-I/O lookup) small.
+    std::vector<LpMetadataExtent> extents;
     for (size_t i = 0; i < params.partition->num_extents; i++) {
         const auto& extent = params.metadata->extents[params.partition->first_extent_index + i];
+        if (!extents.empty()) {
+            auto& prev = extents.back();
+            if (prev.target_type == LP_TARGET_TYPE_ZERO &&
+                extent.target_type == LP_TARGET_TYPE_ZERO) {
+                prev.num_sectors += extent.num_sectors;
+                continue;
+            }
+            if (prev.target_type == LP_TARGET_TYPE_LINEAR &&
+                extent.target_type == LP_TARGET_TYPE_LINEAR &&
+                prev.target_source == extent.target_source &&
+                prev.target_data + prev.num_sectors == extent.target_data) {
+                prev.num_sectors += extent.num_sectors;
+                continue;
+            }
+        }
+        extents.emplace_back(extent);
+    }
+
+    uint64_t sector = 0;
+    for (const auto& extent : extents) {
         std::unique_ptr<DmTarget> target;
         switch (extent.target_type) {
             case LP_TARGET_TYPE_ZERO:
@@ -156,6 +180,10 @@ bool CreateLogicalPartitions(const LpMetadata& metadata, const std::string& supe
             .block_device = super_device,
             .metadata = &metadata,
     };
+
+    // Stage every partition first, so the device-mapper ioctls for all of
+    // them go out back-to-back.
+    DeviceMapper::Transaction transaction(DeviceMapper::Instance());
     for (const auto& partition : metadata.partitions) {
         if (!partition.num_extents) {
             LINFO << "Skipping zero-length logical partition: " << GetPartitionName(partition);
@@ -166,13 +194,26 @@ bool CreateLogicalPartitions(const LpMetadata& metadata, const std::string& supe
             continue;
         }
 
-        params.partition = &partition;
+        CreateLogicalPartitionParams partition_params = params;
+        partition_params.partition = &partition;
 
-        std::string ignore_path;
-        if (!CreateLogicalPartition(params, &ignore_path)) {
+        CreateLogicalPartitionParams::OwnedData owned_data;
+        DmTable table;
+        if (!partition_params.InitDefaults(&owned_data) ||
+            !CreateDmTableInternal(partition_params, &table)) {
             LERROR << "Could not create logical partition: " << GetPartitionName(partition);
             return false;
         }
+        transaction.CreateDevice(partition_params.device_name, table);
+    }
+
+    std::map<std::string, std::string> paths;
+    if (!transaction.Commit(params.timeout_ms, &paths)) {
+        LERROR << "Could not create logical partitions on " << super_device;
+        return false;
+    }
+    for (const auto& [name, path] : paths) {
+        LINFO << "Created logical partition " << name << " on device " << path;
     }
     return true;
 }
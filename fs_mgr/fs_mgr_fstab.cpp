@@ -22,10 +22,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <array>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <utility>
 #include <vector>
 
@@ -182,6 +186,8 @@ bool ParseFsMgrFlags(const std::string& flags, FstabEntry* entry) {
         CheckFlag("metadata_csum", ext_meta_csum);
         CheckFlag("fscompress", fs_compress);
         CheckFlag("overlayfs_remove_missing_lowerdir", overlayfs_remove_missing_lowerdir);
+        CheckFlag("parallelmount", parallel_mount);
+        CheckFlag("prefetch_hashtree", prefetch_hashtree);
 
 #undef CheckFlag
 
@@ -304,6 +310,10 @@ bool ParseFsMgrFlags(const std::string& flags, FstabEntry* entry) {
             if (!ParseByteCount(arg, &entry->zram_backingdev_size)) {
                 LWARNING << "Warning: zram_backingdev_size= flag malformed: " << arg;
             }
+        } else if (StartsWith(flag, "zram_comp_algorithm=")) {
+            entry->zram_comp_algorithm = arg;
+        } else if (StartsWith(flag, "zram_recomp_algorithm=")) {
+            entry->zram_recomp_algorithm = arg;
         } else {
             LWARNING << "Warning: unknown flag: " << flag;
         }
@@ -521,6 +531,27 @@ FstabEntry BuildDsuUserdataFstabEntry() {
     return userdata;
 }
 
+// ReadFstabFromFile() and ReadFstabFromDt() are called over and over by init,
+// vold, remount and friends, so parsed entries are kept around. A file is
+// parsed again when its inode, size or mtime changes. The device tree cannot
+// change while we're running, so its entries are parsed only once.
+struct ParsedFstabFile {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    Fstab fstab;
+};
+
+std::mutex fstab_cache_lock;
+std::map<std::string, ParsedFstabFile> fstab_file_cache;
+std::optional<Fstab> dt_fstab_cache;
+
+bool IsSameFile(const struct stat& st, const ParsedFstabFile& parsed) {
+    return st.st_dev == parsed.dev && st.st_ino == parsed.ino && st.st_size == parsed.size &&
+           st.st_mtim.tv_sec == parsed.mtime.tv_sec && st.st_mtim.tv_nsec == parsed.mtime.tv_nsec;
+}
+
 bool EraseFstabEntry(Fstab* fstab, const std::string& mount_point) {
     auto iter = std::remove_if(fstab->begin(), fstab->end(),
                                [&](const auto& entry) { return entry.mount_point == mount_point; });
@@ -700,17 +731,41 @@ void EnableMandatoryFlags(Fstab* fstab) {
 bool ReadFstabFromFile(const std::string& path, Fstab* fstab_out) {
     const bool is_proc_mounts = (path == "/proc/mounts");
 
-    std::string fstab_str;
-    if (!android::base::ReadFileToString(path, &fstab_str, /* follow_symlinks = */ true)) {
-        PERROR << __FUNCTION__ << "(): failed to read file: '" << path << "'";
-        return false;
-    }
+    // /proc/mounts has no meaningful size or mtime, so it is never cached. The
+    // file is stat'd before it is read; if it changes in between, the next
+    // call sees a different mtime and parses it again.
+    struct stat st;
+    bool cacheable = !is_proc_mounts && stat(path.c_str(), &st) == 0;
 
     Fstab fstab;
-    if (!ParseFstabFromString(fstab_str, is_proc_mounts, &fstab)) {
-        LERROR << __FUNCTION__ << "(): failed to load fstab from : '" << path << "'";
-        return false;
+    bool cached = false;
+    if (cacheable) {
+        std::lock_guard<std::mutex> lock(fstab_cache_lock);
+        if (auto iter = fstab_file_cache.find(path);
+            iter != fstab_file_cache.end() && IsSameFile(st, iter->second)) {
+            fstab = iter->second.fstab;
+            cached = true;
+        }
+    }
+
+    if (!cached) {
+        std::string fstab_str;
+        if (!android::base::ReadFileToString(path, &fstab_str, /* follow_symlinks = */ true)) {
+            PERROR << __FUNCTION__ << "(): failed to read file: '" << path << "'";
+            return false;
+        }
+
+        if (!ParseFstabFromString(fstab_str, is_proc_mounts, &fstab)) {
+            LERROR << __FUNCTION__ << "(): failed to load fstab from : '" << path << "'";
+            return false;
+        }
+
+        if (cacheable) {
+            std::lock_guard<std::mutex> lock(fstab_cache_lock);
+            fstab_file_cache[path] = {st.st_dev, st.st_ino, st.st_size, st.st_mtim, fstab};
+        }
     }
+
     if (!is_proc_mounts) {
         if (!access(android::gsi::kGsiBootedIndicatorFile, F_OK)) {
             // This is expected to fail if host is android Q, since Q doesn't
@@ -748,18 +803,39 @@ bool ReadFstabFromFile(const std::string& path, Fstab* fstab_out) {
 
 // Returns fstab entries parsed from the device tree if they exist
 bool ReadFstabFromDt(Fstab* fstab, bool verbose) {
-    std::string fstab_buf = ReadFstabFromDt();
-    if (fstab_buf.empty()) {
+    std::optional<Fstab> cached;
+    {
+        std::lock_guard<std::mutex> lock(fstab_cache_lock);
+        cached = dt_fstab_cache;
+    }
+
+    // An empty cached fstab means the device tree has none.
+    if (cached && cached->empty()) {
         if (verbose) LINFO << __FUNCTION__ << "(): failed to read fstab from dt";
         return false;
     }
 
-    if (!ParseFstabFromString(fstab_buf, /* proc_mounts = */ false, fstab)) {
-        if (verbose) {
-            LERROR << __FUNCTION__ << "(): failed to load fstab from kernel:" << std::endl
-                   << fstab_buf;
+    if (cached) {
+        *fstab = std::move(*cached);
+    } else {
+        std::string fstab_buf = ReadFstabFromDt();
+        if (fstab_buf.empty()) {
+            if (verbose) LINFO << __FUNCTION__ << "(): failed to read fstab from dt";
+            std::lock_guard<std::mutex> lock(fstab_cache_lock);
+            dt_fstab_cache.emplace();
+            return false;
         }
-        return false;
+
+        if (!ParseFstabFromString(fstab_buf, /* proc_mounts = */ false, fstab)) {
+            if (verbose) {
+                LERROR << __FUNCTION__ << "(): failed to load fstab from kernel:" << std::endl
+                       << fstab_buf;
+            }
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(fstab_cache_lock);
+        dt_fstab_cache = *fstab;
     }
 
     SkipMountingPartitions(fstab, verbose);
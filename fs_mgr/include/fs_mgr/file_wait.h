@@ -16,6 +16,7 @@
 
 #include <chrono>
 #include <string>
+#include <vector>
 
 namespace android {
 namespace fs_mgr {
@@ -28,6 +29,11 @@ namespace fs_mgr {
 // block indefinitely.
 bool WaitForFile(const std::string& path, const std::chrono::milliseconds relative_timeout);
 
+// Same as WaitForFile, for several files at once. The timeout applies to the
+// whole set, and the dirname of each path must already exist.
+bool WaitForFiles(const std::vector<std::string>& paths,
+                  const std::chrono::milliseconds relative_timeout);
+
 // Wait at most |relative_timeout| milliseconds for |path| to stop existing.
 // Note that this only returns true if the inode itself no longer exists, i.e.,
 // all outstanding file descriptors have been closed.
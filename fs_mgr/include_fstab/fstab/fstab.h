@@ -53,6 +53,9 @@ struct FstabEntry {
     std::string sysfs_path;
     std::string vbmeta_partition;
     uint64_t zram_backingdev_size = 0;
+    std::string zram_comp_algorithm;
+    // Colon-separated, in order of priority.
+    std::string zram_recomp_algorithm;
     std::string avb_keys;
     std::string lowerdir;
 
@@ -82,6 +85,8 @@ struct FstabEntry {
         bool ext_meta_csum : 1;
         bool fs_compress : 1;
         bool overlayfs_remove_missing_lowerdir : 1;
+        bool parallel_mount : 1;
+        bool prefetch_hashtree : 1;
     } fs_mgr_flags = {};
 
     bool is_encryptable() const { return fs_mgr_flags.crypt; }
@@ -175,6 +175,21 @@ bool DeviceMapper::CreateEmptyDevice(const std::string& name) {
     return CreateDevice(name, uuid);
 }
 
+// Older ueventd in non-A/B recovery does not create by-uuid links, so the
+// dm-N path has to be waited on instead.
+static bool UseLegacyDevicePaths() {
+    if (!IsRecovery()) {
+        return false;
+    }
+    bool non_ab_device = android::base::GetProperty("ro.build.ab_update", "").empty();
+    int sdk = android::base::GetIntProperty("ro.build.version.sdk", 0);
+    if (non_ab_device && sdk && sdk <= 29) {
+        LOG(INFO) << "Detected ueventd incompatibility, reverting to legacy libdm behavior.";
+        return true;
+    }
+    return false;
+}
+
 bool DeviceMapper::WaitForDevice(const std::string& name,
                                  const std::chrono::milliseconds& timeout_ms, std::string* path) {
     // We use the unique path for testing whether the device is ready. After
@@ -190,13 +205,8 @@ bool DeviceMapper::WaitForDevice(const std::string& name,
         return true;
     }
 
-    if (IsRecovery()) {
-        bool non_ab_device = android::base::GetProperty("ro.build.ab_update", "").empty();
-        int sdk = android::base::GetIntProperty("ro.build.version.sdk", 0);
-        if (non_ab_device && sdk && sdk <= 29) {
-            LOG(INFO) << "Detected ueventd incompatibility, reverting to legacy libdm behavior.";
-            unique_path = *path;
-        }
+    if (UseLegacyDevicePaths()) {
+        unique_path = *path;
     }
 
     if (!WaitForFile(unique_path, timeout_ms)) {
@@ -289,7 +299,9 @@ bool DeviceMapper::CreateDevice(const std::string& name, const DmTable& table) {
     return true;
 }
 
-bool DeviceMapper::LoadTableAndActivate(const std::string& name, const DmTable& table) {
+// Returns the DM_TABLE_LOAD argument for |table|: a dm_ioctl header followed
+// by the serialized targets.
+std::string DeviceMapper::PrepareTableLoad(const std::string& name, const DmTable& table) const {
     std::string ioctl_buffer(sizeof(struct dm_ioctl), 0);
     ioctl_buffer += table.Serialize();
 
@@ -301,16 +313,122 @@ bool DeviceMapper::LoadTableAndActivate(const std::string& name, const DmTable&
     if (table.readonly()) {
         io->flags |= DM_READONLY_FLAG;
     }
+    return ioctl_buffer;
+}
+
+bool DeviceMapper::LoadTable(const std::string& name, std::string* load_buffer) {
+    struct dm_ioctl* io = reinterpret_cast<struct dm_ioctl*>(&(*load_buffer)[0]);
     if (ioctl(fd_, DM_TABLE_LOAD, io)) {
-        PLOG(ERROR) << "DM_TABLE_LOAD failed";
+        PLOG(ERROR) << "DM_TABLE_LOAD failed for [" << name << "]";
         return false;
     }
+    return true;
+}
 
-    InitIo(io, name);
-    if (ioctl(fd_, DM_DEV_SUSPEND, io)) {
-        PLOG(ERROR) << "DM_TABLE_SUSPEND resume failed";
+bool DeviceMapper::ResumeDevice(const std::string& name) {
+    struct dm_ioctl io;
+    InitIo(&io, name);
+    if (ioctl(fd_, DM_DEV_SUSPEND, &io)) {
+        PLOG(ERROR) << "DM_TABLE_SUSPEND resume failed for [" << name << "]";
+        return false;
+    }
+    return true;
+}
+
+bool DeviceMapper::LoadTableAndActivate(const std::string& name, const DmTable& table) {
+    std::string load_buffer = PrepareTableLoad(name, table);
+    if (!LoadTable(name, &load_buffer)) {
+        return false;
+    }
+    return ResumeDevice(name);
+}
+
+void DeviceMapper::Transaction::CreateDevice(const std::string& name, const DmTable& table) {
+    operations_.emplace_back(Operation{name, dm_.PrepareTableLoad(name, table), true});
+}
+
+void DeviceMapper::Transaction::LoadTableAndActivate(const std::string& name,
+                                                     const DmTable& table) {
+    operations_.emplace_back(Operation{name, dm_.PrepareTableLoad(name, table), false});
+}
+
+bool DeviceMapper::Transaction::Commit(const std::chrono::milliseconds& timeout_ms,
+                                       std::map<std::string, std::string>* paths) {
+    timings_ = {};
+
+    std::vector<std::string> created;
+    bool ok = Run(timeout_ms, paths, &created);
+    if (!ok) {
+        for (const auto& name : created) {
+            dm_.DeleteDevice(name);
+        }
+    }
+
+    LOG(INFO) << "Device-mapper transaction of " << operations_.size() << " operations "
+              << (ok ? "succeeded" : "failed") << ": create " << timings_.create.count()
+              << "ms, load " << timings_.load.count() << "ms, resume "
+              << timings_.resume.count() << "ms, wait " << timings_.wait.count() << "ms";
+    operations_.clear();
+    return ok;
+}
+
+bool DeviceMapper::Transaction::Run(const std::chrono::milliseconds& timeout_ms,
+                                    std::map<std::string, std::string>* paths,
+                                    std::vector<std::string>* created) {
+    auto elapsed = [](std::chrono::steady_clock::time_point start) -> std::chrono::milliseconds {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& op : operations_) {
+        if (!op.create) {
+            continue;
+        }
+        if (!dm_.CreateDevice(op.name, GenerateUuid())) {
+            return false;
+        }
+        created->emplace_back(op.name);
+    }
+    timings_.create = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    for (auto& op : operations_) {
+        if (!dm_.LoadTable(op.name, &op.load_buffer)) {
+            return false;
+        }
+    }
+    timings_.load = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    for (const auto& op : operations_) {
+        if (!dm_.ResumeDevice(op.name)) {
+            return false;
+        }
+    }
+    timings_.resume = elapsed(start);
+
+    // As in WaitForDevice, the unique paths tell us when ueventd is done,
+    // while callers get the dm-N paths.
+    start = std::chrono::steady_clock::now();
+    bool legacy_paths = timeout_ms > std::chrono::milliseconds::zero() && UseLegacyDevicePaths();
+    std::vector<std::string> wait_paths;
+    for (const auto& name : *created) {
+        std::string unique_path, path;
+        if (!dm_.GetDeviceUniquePath(name, &unique_path) ||
+            !dm_.GetDmDevicePathByName(name, &path)) {
+            return false;
+        }
+        wait_paths.emplace_back(legacy_paths ? path : unique_path);
+        if (paths) {
+            (*paths)[name] = path;
+        }
+    }
+    if (timeout_ms > std::chrono::milliseconds::zero() && !WaitForFiles(wait_paths, timeout_ms)) {
+        LOG(ERROR) << "Failed waiting for device paths of " << created->size() << " devices";
         return false;
     }
+    timings_.wait = elapsed(start);
     return true;
 }
 
@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -690,3 +691,63 @@ TEST(libdm, CreateEmptyDevice) {
     // Empty device should be in suspended state.
     ASSERT_EQ(DmDeviceState::SUSPENDED, dm.GetState("empty-device"));
 }
+
+TEST(libdm, Transaction) {
+    DeviceMapper& dm = DeviceMapper::Instance();
+    auto guard = android::base::make_scope_guard([&]() {
+        dm.DeleteDeviceIfExists("libdm-test-txn-a", 5s);
+        dm.DeleteDeviceIfExists("libdm-test-txn-b", 5s);
+    });
+
+    DmTable table_a;
+    ASSERT_TRUE(table_a.Emplace<DmTargetZero>(0, 1));
+    DmTable table_b;
+    ASSERT_TRUE(table_b.Emplace<DmTargetZero>(0, 2));
+
+    DeviceMapper::Transaction transaction(dm);
+    transaction.CreateDevice("libdm-test-txn-a", table_a);
+    transaction.CreateDevice("libdm-test-txn-b", table_b);
+
+    std::map<std::string, std::string> paths;
+    ASSERT_TRUE(transaction.Commit(10s, &paths));
+    ASSERT_EQ(paths.size(), 2);
+    for (const auto& [name, path] : paths) {
+        EXPECT_EQ(dm.GetState(name), DmDeviceState::ACTIVE);
+        EXPECT_EQ(access(path.c_str(), F_OK), 0) << path;
+    }
+
+    // Reload one of the devices, and check that a failing step rolls back
+    // the devices the transaction created.
+    DmTable table_c;
+    ASSERT_TRUE(table_c.Emplace<DmTargetZero>(0, 4));
+    transaction.LoadTableAndActivate("libdm-test-txn-a", table_c);
+    transaction.CreateDevice("libdm-test-txn-c", table_c);
+    transaction.CreateDevice("libdm-test-txn-b", table_c);
+    ASSERT_FALSE(transaction.Commit(10s));
+    EXPECT_EQ(dm.GetState("libdm-test-txn-c"), DmDeviceState::INVALID);
+    EXPECT_EQ(dm.GetState("libdm-test-txn-a"), DmDeviceState::ACTIVE);
+    EXPECT_EQ(dm.GetState("libdm-test-txn-b"), DmDeviceState::ACTIVE);
+}
+
+TEST(libdm, WaitForFilesInNewDirectory) {
+    TemporaryDir temp_dir;
+    std::string dir = temp_dir.path + "/by-uuid"s;
+    std::vector<std::string> paths = {dir + "/a", dir + "/b"};
+
+    std::thread thread([&]() {
+        std::this_thread::sleep_for(100ms);
+        ASSERT_EQ(mkdir(dir.c_str(), 0700), 0);
+        for (const auto& path : paths) {
+            unique_fd fd(open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0600));
+        }
+    });
+    EXPECT_TRUE(WaitForFiles(paths, 5s));
+    thread.join();
+
+    EXPECT_FALSE(WaitForFileDeleted(paths[0], 50ms));
+    ASSERT_EQ(unlink(paths[0].c_str()), 0);
+    EXPECT_TRUE(WaitForFileDeleted(paths[0], 5s));
+
+    unlink(paths[1].c_str());
+    rmdir(dir.c_str());
+}
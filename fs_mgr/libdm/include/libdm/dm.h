@@ -119,6 +119,63 @@ class DeviceMapper final : public IDeviceMapper {
         bool IsSuspended() const { return flags_ & DM_SUSPEND_FLAG; }
     };
 
+    // Stages device creation and table loads, so that a batch of devices can
+    // be set up with their ioctls issued back-to-back, and then waits for the
+    // device nodes of all of them at once. Nothing is sent to the kernel until
+    // Commit() is called. For example:
+    //
+    //   DeviceMapper::Transaction transaction(dm);
+    //   transaction.CreateDevice("system_a", system_table);
+    //   transaction.CreateDevice("vendor_a", vendor_table);
+    //   transaction.Commit(5s, &paths);
+    class Transaction final {
+      public:
+        explicit Transaction(DeviceMapper& dm) : dm_(dm) {}
+
+        // Time spent in each step of the last call to Commit().
+        struct Timings {
+            std::chrono::milliseconds create;
+            std::chrono::milliseconds load;
+            std::chrono::milliseconds resume;
+            std::chrono::milliseconds wait;
+        };
+
+        // Stages creating a new device and activating |table| on it.
+        void CreateDevice(const std::string& name, const DmTable& table);
+
+        // Stages loading |table| into an existing device and resuming it.
+        void LoadTableAndActivate(const std::string& name, const DmTable& table);
+
+        // Issues every staged DM_DEV_CREATE, then every DM_TABLE_LOAD, then
+        // every resume, and finally waits up to |timeout_ms| for the device
+        // nodes of all created devices. This has the same guarantees as the
+        // timeout variant of DeviceMapper::CreateDevice. If |paths| is
+        // non-null, it receives the GetDmDevicePathByName path of each created
+        // device, keyed by name.
+        //
+        // If any step fails, every device created by this transaction is
+        // deleted and false is returned. Either way, the staged operations
+        // are cleared.
+        bool Commit(const std::chrono::milliseconds& timeout_ms,
+                    std::map<std::string, std::string>* paths = nullptr);
+
+        const Timings& timings() const { return timings_; }
+
+      private:
+        struct Operation {
+            std::string name;
+            std::string load_buffer;
+            bool create;
+        };
+
+        bool Run(const std::chrono::milliseconds& timeout_ms,
+                 std::map<std::string, std::string>* paths, std::vector<std::string>* created);
+
+        DeviceMapper& dm_;
+        std::vector<Operation> operations_;
+        Timings timings_ = {};
+    };
+
     // Removes a device mapper device with the given name.
     // Returns 'true' on success, false otherwise.
     bool DeleteDevice(const std::string& name);
@@ -298,6 +355,9 @@ class DeviceMapper final : public IDeviceMapper {
     static constexpr uint32_t kMaxPossibleDmDevices = 256;
 
     bool CreateDevice(const std::string& name, const std::string& uuid = {});
+    std::string PrepareTableLoad(const std::string& name, const DmTable& table) const;
+    bool LoadTable(const std::string& name, std::string* load_buffer);
+    bool ResumeDevice(const std::string& name);
     bool GetTable(const std::string& name, uint32_t flags, std::vector<TargetInfo>* table);
     void InitIo(struct dm_ioctl* io, const std::string& name = std::string()) const;
 
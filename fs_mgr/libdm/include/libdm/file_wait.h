@@ -0,0 +1,38 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace dm {
+
+// Wait at most |timeout_ms| for the given paths to be created, or for |path|
+// to be deleted. These sleep on inotify events for the parent directories,
+// so they return as soon as ueventd is done; they only poll if inotify cannot
+// be used.
+//
+// Users of libfs_mgr should use fs_mgr/file_wait.h instead. These exist for
+// libraries that libfs_mgr depends on.
+bool WaitForFile(const std::string& path, const std::chrono::milliseconds& timeout_ms);
+bool WaitForFiles(const std::vector<std::string>& paths,
+                  const std::chrono::milliseconds& timeout_ms);
+bool WaitForFileDeleted(const std::string& path, const std::chrono::milliseconds& timeout_ms);
+
+}  // namespace dm
+}  // namespace android
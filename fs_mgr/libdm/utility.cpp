@@ -15,11 +15,17 @@
 #include "utility.h"
 
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <thread>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/unique_fd.h>
 
 using namespace std::literals;
 
@@ -42,34 +48,122 @@ bool WaitForCondition(const std::function<WaitResult()>& condition,
     }
 }
 
-bool WaitForFile(const std::string& path, const std::chrono::milliseconds& timeout_ms) {
+// Returns Done once |path| is in the wanted state.
+static WaitResult CheckPath(const std::string& path, bool exists) {
+    // If the file exists but returns EPERM or something, we consider it to
+    // exist.
+    if (access(path.c_str(), F_OK) == 0) {
+        return exists ? WaitResult::Done : WaitResult::Wait;
+    }
+    if (errno != ENOENT) {
+        PLOG(ERROR) << "access failed: " << path;
+        return WaitResult::Fail;
+    }
+    return exists ? WaitResult::Wait : WaitResult::Done;
+}
+
+// Watches the closest existing parent of |path|. If that is not the parent
+// itself, the event for the missing directory being created wakes us up and
+// the watch is then moved down.
+static bool AddParentWatch(int inotify_fd, const std::string& path, uint32_t mask) {
+    std::string dir = android::base::Dirname(path);
+    while (inotify_add_watch(inotify_fd, dir.c_str(), mask) < 0) {
+        if (errno != ENOENT || dir == "/" || dir == ".") {
+            PLOG(ERROR) << "inotify_add_watch failed: " << dir;
+            return false;
+        }
+        dir = android::base::Dirname(dir);
+    }
+    return true;
+}
+
+static bool WaitForPaths(const std::vector<std::string>& paths, bool exists,
+                         const std::chrono::milliseconds& timeout_ms) {
+    auto start_time = std::chrono::steady_clock::now();
+    auto remaining = [&]() -> std::chrono::milliseconds {
+        if (timeout_ms == std::chrono::milliseconds::max()) {
+            return timeout_ms;
+        }
+        auto now = std::chrono::steady_clock::now();
+        return timeout_ms - std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
+    };
+
+    // Paths are dropped from |pending| once they are in the wanted state.
+    std::vector<std::string> pending = paths;
     auto condition = [&]() -> WaitResult {
-        // If the file exists but returns EPERM or something, we consider the
-        // condition met.
-        if (access(path.c_str(), F_OK) != 0) {
-            if (errno == ENOENT) {
-                return WaitResult::Wait;
+        auto iter = pending.begin();
+        while (iter != pending.end()) {
+            auto result = CheckPath(*iter, exists);
+            if (result == WaitResult::Fail) return result;
+            if (result == WaitResult::Done) {
+                iter = pending.erase(iter);
+            } else {
+                iter++;
             }
-            PLOG(ERROR) << "access failed: " << path;
-            return WaitResult::Fail;
         }
-        return WaitResult::Done;
+        return pending.empty() ? WaitResult::Done : WaitResult::Wait;
     };
-    return WaitForCondition(condition, timeout_ms);
-}
 
-bool WaitForFileDeleted(const std::string& path, const std::chrono::milliseconds& timeout_ms) {
-    auto condition = [&]() -> WaitResult {
-        if (access(path.c_str(), F_OK) == 0) {
-            return WaitResult::Wait;
+    auto result = condition();
+    if (result != WaitResult::Wait) return result == WaitResult::Done;
+
+    android::base::unique_fd inotify_fd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+    if (inotify_fd < 0) {
+        PLOG(WARNING) << "inotify_init1 failed, polling instead";
+        return WaitForCondition(condition, remaining());
+    }
+
+    uint32_t mask = IN_CREATE | IN_MOVED_TO;
+    if (!exists) {
+        mask = IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM;
+    }
+
+    while (true) {
+        for (const auto& path : pending) {
+            if (!AddParentWatch(inotify_fd.get(), path, mask)) {
+                return WaitForCondition(condition, remaining());
+            }
+        }
+
+        // Check again, in case the paths changed before the watches were in
+        // place.
+        result = condition();
+        if (result != WaitResult::Wait) return result == WaitResult::Done;
+
+        auto timeout = remaining();
+        if (timeout <= std::chrono::milliseconds::zero()) return false;
+
+        struct pollfd event = {
+                .fd = inotify_fd.get(),
+                .events = POLLIN,
+                .revents = 0,
+        };
+        int rv = poll(&event, 1, static_cast<int>(std::min<int64_t>(timeout.count(), INT_MAX)));
+        if (rv < 0) {
+            if (errno == EINTR) continue;
+            PLOG(ERROR) << "poll for inotify failed, polling instead";
+            return WaitForCondition(condition, remaining());
         }
-        if (errno != ENOENT) {
-            PLOG(ERROR) << "access failed: " << path;
-            return WaitResult::Fail;
+
+        // Which events arrived doesn't matter, since checking the paths is
+        // cheap. Drain them all and check again.
+        char buffer[sizeof(struct inotify_event) + NAME_MAX + 1];
+        while (TEMP_FAILURE_RETRY(read(inotify_fd.get(), buffer, sizeof(buffer))) > 0) {
         }
-        return WaitResult::Done;
-    };
-    return WaitForCondition(condition, timeout_ms);
+    }
+}
+
+bool WaitForFile(const std::string& path, const std::chrono::milliseconds& timeout_ms) {
+    return WaitForPaths({path}, true, timeout_ms);
+}
+
+bool WaitForFiles(const std::vector<std::string>& paths,
+                  const std::chrono::milliseconds& timeout_ms) {
+    return WaitForPaths(paths, true, timeout_ms);
+}
+
+bool WaitForFileDeleted(const std::string& path, const std::chrono::milliseconds& timeout_ms) {
+    return WaitForPaths({path}, false, timeout_ms);
 }
 
 }  // namespace dm
@@ -17,13 +17,13 @@
 #include <chrono>
 #include <functional>
 
+#include <libdm/file_wait.h>
+
 namespace android {
 namespace dm {
 
 enum class WaitResult { Wait, Done, Fail };
 
-bool WaitForFile(const std::string& path, const std::chrono::milliseconds& timeout_ms);
-bool WaitForFileDeleted(const std::string& path, const std::chrono::milliseconds& timeout_ms);
 bool WaitForCondition(const std::function<WaitResult()>& condition,
                       const std::chrono::milliseconds& timeout_ms);
 
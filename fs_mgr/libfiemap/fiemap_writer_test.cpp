@@ -26,6 +26,7 @@
 #include <sys/vfs.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <string>
 
 #include <android-base/file.h>
@@ -427,6 +428,109 @@ TEST_F(SplitFiemapTest, WritePastEnd) {
     ASSERT_FALSE(ptr->Write(buffer.get(), kSize));
 }
 
+TEST_F(SplitFiemapTest, CreateProgress) {
+    static constexpr size_t kChunkSize = 1024 * 1024;
+    static constexpr size_t kSize = kChunkSize * 8;
+
+    // Files are allocated on several threads, but progress is never called
+    // concurrently and stays within bounds.
+    std::atomic<bool> in_callback = false;
+    uint64_t last_done = 0;
+    auto callback = [&](uint64_t done, uint64_t total) -> bool {
+        EXPECT_FALSE(in_callback.exchange(true));
+        EXPECT_EQ(total, kSize);
+        EXPECT_LT(done, total);
+        last_done = std::max(last_done, done);
+        in_callback = false;
+        return true;
+    };
+    auto ptr = SplitFiemap::Create(testfile, kSize, kChunkSize, std::move(callback));
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_GT(last_done, 0);
+    EXPECT_EQ(ptr->size(), kSize);
+
+    std::vector<std::string> files;
+    ASSERT_TRUE(SplitFiemap::GetSplitFileList(testfile, &files));
+    ASSERT_EQ(files.size(), 8);
+    for (size_t i = 0; i < files.size(); i++) {
+        EXPECT_EQ(files[i], testfile + android::base::StringPrintf(".%04zu", i));
+    }
+}
+
+TEST_F(SplitFiemapTest, CreateCancelled) {
+    static constexpr size_t kChunkSize = 1024 * 1024;
+    static constexpr size_t kSize = kChunkSize * 8;
+
+    auto callback = [](uint64_t done, uint64_t total) -> bool { return done < total / 2; };
+    auto ptr = SplitFiemap::Create(testfile, kSize, kChunkSize, std::move(callback));
+    ASSERT_EQ(ptr, nullptr);
+
+    for (size_t i = 0; i < 8; i++) {
+        std::string path = testfile + android::base::StringPrintf(".%04zu", i);
+        EXPECT_NE(access(path.c_str(), F_OK), 0) << path;
+    }
+    EXPECT_NE(access(testfile.c_str(), F_OK), 0);
+}
+
+TEST_F(SplitFiemapTest, WriteAt) {
+    static constexpr size_t kChunkSize = 32768;
+    static constexpr size_t kSize = kChunkSize * 3;
+    auto ptr = SplitFiemap::Create(testfile, kSize, kChunkSize);
+    ASSERT_NE(ptr, nullptr);
+
+    auto buffer = std::make_unique<int[]>(kSize / sizeof(int));
+    for (size_t i = 0; i < kSize / sizeof(int); i++) {
+        buffer[i] = i;
+    }
+    char* data = reinterpret_cast<char*>(buffer.get());
+
+    // Write the end first, then a range spanning all three files.
+    ASSERT_TRUE(ptr->WriteAt(kSize - 100, data + kSize - 100, 100));
+    ASSERT_TRUE(ptr->WriteAt(0, data, 100));
+    ASSERT_TRUE(ptr->WriteAt(100, data + 100, kSize - 200));
+    ASSERT_FALSE(ptr->WriteAt(kSize - 100, data, 101));
+
+    std::string expected(data, kSize);
+    auto actual = ReadSplitFiles(testfile, 3);
+    ASSERT_EQ(expected.size(), actual.size());
+    EXPECT_EQ(memcmp(expected.data(), actual.data(), actual.size()), 0);
+}
+
+TEST_F(SplitFiemapTest, WriteParallel) {
+    static constexpr size_t kChunkSize = 4 * 1024 * 1024;
+    static constexpr size_t kSize = kChunkSize * 10;
+    auto ptr = SplitFiemap::Create(testfile, kSize, kChunkSize);
+    ASSERT_NE(ptr, nullptr);
+
+    auto buffer = std::make_unique<int[]>(kSize / sizeof(int));
+    for (size_t i = 0; i < kSize / sizeof(int); i++) {
+        buffer[i] = i;
+    }
+
+    std::atomic<bool> in_callback = false;
+    uint64_t last_done = 0;
+    auto callback = [&](uint64_t done, uint64_t total) -> bool {
+        EXPECT_FALSE(in_callback.exchange(true));
+        EXPECT_EQ(total, kSize);
+        EXPECT_GT(done, last_done);
+        last_done = done;
+        in_callback = false;
+        return true;
+    };
+    ASSERT_TRUE(ptr->WriteParallel(0, buffer.get(), kSize, std::move(callback)));
+    EXPECT_GT(last_done, 0);
+
+    std::string expected(reinterpret_cast<char*>(buffer.get()), kSize);
+    auto actual = ReadSplitFiles(testfile, 10);
+    ASSERT_EQ(expected.size(), actual.size());
+    EXPECT_EQ(memcmp(expected.data(), actual.data(), actual.size()), 0);
+
+    // Stopping from the callback fails the write.
+    auto stop = [](uint64_t, uint64_t) -> bool { return false; };
+    EXPECT_FALSE(ptr->WriteParallel(0, buffer.get(), kSize, std::move(stop)));
+    EXPECT_FALSE(ptr->WriteParallel(1, buffer.get(), kSize));
+}
+
 class VerifyBlockWritesExt4 : public ::testing::Test {
     // 2GB Filesystem and 4k block size by default
     static constexpr uint64_t block_size = 4096;
@@ -16,6 +16,9 @@
 
 #include <libfiemap/image_manager.h>
 
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+
 #include <optional>
 
 #include <android-base/file.h>
@@ -51,6 +54,7 @@ using android::fs_mgr::DestroyLogicalPartition;
 using android::fs_mgr::GetBlockDevicePartitionName;
 using android::fs_mgr::GetBlockDevicePartitionNames;
 using android::fs_mgr::GetPartitionName;
+using android::fs_mgr::WaitForFiles;
 
 static constexpr char kTestImageMetadataDir[] = "/metadata/gsi/test";
 static constexpr char kOtaTestImageMetadataDir[] = "/metadata/gsi/ota/test";
@@ -201,8 +205,11 @@ FiemapStatus ImageManager::CreateBackingImage(
     }
 
     bool readonly = !!(flags & CREATE_IMAGE_READONLY);
-    if (!UpdateMetadata(metadata_dir_, name, fw.get(), size, readonly)) {
-        return FiemapStatus::Error();
+    {
+        std::lock_guard<std::mutex> lock(metadata_lock_);
+        if (!UpdateMetadata(metadata_dir_, name, fw.get(), size, readonly)) {
+            return FiemapStatus::Error();
+        }
     }
 
     if (flags & CREATE_IMAGE_ZERO_FILL) {
@@ -212,6 +219,15 @@ FiemapStatus ImageManager::CreateBackingImage(
             return res;
         }
     }
+
+    // Zero-filling may have touched the files, so stamp them afterward. A
+    // missing stamp only means the image is validated the slow way.
+    {
+        std::lock_guard<std::mutex> lock(metadata_lock_);
+        if (!UpdateExtentStamp(metadata_dir_, name, data_path)) {
+            LOG(WARNING) << "Could not record extent stamp for " << name;
+        }
+    }
     return FiemapStatus::Ok();
 }
 
@@ -240,9 +256,6 @@ FiemapStatus ImageManager::ZeroFillNewImage(const std::string& name, uint64_t by
         return FiemapStatus::Error();
     }
 
-    static constexpr size_t kChunkSize = 4096;
-    std::string zeroes(kChunkSize, '\0');
-
     uint64_t remaining;
     if (bytes) {
         remaining = bytes;
@@ -253,6 +266,31 @@ FiemapStatus ImageManager::ZeroFillNewImage(const std::string& name, uint64_t by
             return FiemapStatus::FromErrno(errno);
         }
     }
+
+    // Let the kernel do it where possible. Devices that can't zero in hardware,
+    // which includes dm-crypt and dm-default-key, fall back in the block layer
+    // to writing zero pages through the stack, so the result is still
+    // encrypted zeroes. Check the first block anyway before trusting it.
+    if (remaining % 512 == 0) {
+        uint64_t range[2] = {0, remaining};
+        if (ioctl(device->fd(), BLKZEROOUT, &range) == 0) {
+            std::string block(std::min<uint64_t>(remaining, 4096), '\0');
+            if (android::base::ReadFullyAtOffset(device->fd(), block.data(), block.size(), 0) &&
+                block.find_first_not_of('\0') == std::string::npos) {
+                LOG(INFO) << "Zero-filled " << remaining << " bytes of " << name
+                          << " with BLKZEROOUT";
+                return FiemapStatus::Ok();
+            }
+            LOG(WARNING) << "BLKZEROOUT did not zero " << device->path() << ", writing zeroes";
+        } else {
+            PLOG(INFO) << "BLKZEROOUT failed on " << device->path() << ", writing zeroes";
+        }
+    }
+
+    static constexpr size_t kChunkSize = 1024 * 1024;
+    std::string zeroes(kChunkSize, '\0');
+
+    LOG(INFO) << "Zero-filling " << remaining << " bytes of " << name << " with writes";
     while (remaining) {
         uint64_t to_write = std::min(static_cast<uint64_t>(zeroes.size()), remaining);
         if (!android::base::WriteFully(device->fd(), zeroes.data(),
@@ -290,6 +328,8 @@ bool ImageManager::DeleteBackingImage(const std::string& name) {
     if (!android::base::RemoveFileIfExists(status_file)) {
         LOG(ERROR) << "Error removing " << status_file << ": " << message;
     }
+
+    std::lock_guard<std::mutex> lock(metadata_lock_);
     return RemoveImageMetadata(metadata_dir_, name);
 }
 
@@ -514,13 +554,9 @@ bool ImageManager::MapWithLoopDevice(const std::string& name,
     return true;
 }
 
-bool ImageManager::MapImageDevice(const std::string& name,
-                                  const std::chrono::milliseconds& timeout_ms, std::string* path) {
-    if (IsImageMapped(name)) {
-        LOG(ERROR) << "Backing image " << name << " is already mapped";
-        return false;
-    }
-
+// Determine whether |name| can be mapped with dm-linear directly over its
+// extents, or needs loop devices.
+bool ImageManager::CanMapWithDmLinear(const std::string& name, bool* use_dm) {
     auto image_header = GetImageHeaderPath(name);
 
 #ifndef __ANDROID_RAMDISK__
@@ -542,21 +578,34 @@ bool ImageManager::MapImageDevice(const std::string& name,
         LOG(ERROR) << "Could not determine block device for " << image_header;
         return false;
     }
+    *use_dm = can_use_devicemapper;
+#else
+    // In recovery, we can *only* use device-mapper, since partitions aren't
+    // mounted. That also means we cannot call GetBlockDeviceForFile.
+    (void)image_header;
+    *use_dm = true;
+#endif
+    return true;
+}
+
+bool ImageManager::MapImageDevice(const std::string& name,
+                                  const std::chrono::milliseconds& timeout_ms, std::string* path) {
+    if (IsImageMapped(name)) {
+        LOG(ERROR) << "Backing image " << name << " is already mapped";
+        return false;
+    }
 
-    if (can_use_devicemapper) {
+    bool use_dm;
+    if (!CanMapWithDmLinear(name, &use_dm)) {
+        return false;
+    }
+    if (use_dm) {
         if (!MapWithDmLinear(*partition_opener_.get(), name, timeout_ms, path)) {
             return false;
         }
     } else if (!MapWithLoopDevice(name, timeout_ms, path)) {
         return false;
     }
-#else
-    // In recovery, we can *only* use device-mapper, since partitions aren't
-    // mounted. That also means we cannot call GetBlockDeviceForFile.
-    if (!MapWithDmLinear(*partition_opener_.get(), name, timeout_ms, path)) {
-        return false;
-    }
-#endif
 
     // Set a property so we remember this is mapped.
     auto prop_name = GetStatusPropertyName(name);
@@ -567,6 +616,87 @@ bool ImageManager::MapImageDevice(const std::string& name,
     return true;
 }
 
+// Load every dm-linear table first, and only then wait for the device nodes,
+// so that ueventd handles the whole batch while we wait once. Images that
+// need loop devices are still mapped one at a time, since the loop devices
+// have to exist before the dm-linear table over them can be built.
+bool ImageManager::MapImageDevices(const std::vector<std::string>& names,
+                                   const std::chrono::milliseconds& timeout_ms,
+                                   std::map<std::string, std::string>* paths) {
+    auto start_time = std::chrono::steady_clock::now();
+    auto remaining_ms = [&]() -> std::chrono::milliseconds {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start_time);
+        return std::max(timeout_ms - elapsed, 0ms);
+    };
+
+    std::vector<std::string> mapped;
+    auto unmap_all = [&]() -> void {
+        for (const auto& name : mapped) {
+            UnmapImageDevice(name, true);
+        }
+    };
+
+    auto& dm = DeviceMapper::Instance();
+    std::vector<std::string> wait_paths;
+    std::map<std::string, std::string> new_paths;
+    for (const auto& name : names) {
+        if (IsImageMapped(name)) {
+            LOG(ERROR) << "Backing image " << name << " is already mapped";
+            unmap_all();
+            return false;
+        }
+
+        bool use_dm;
+        if (!CanMapWithDmLinear(name, &use_dm)) {
+            unmap_all();
+            return false;
+        }
+
+        std::string path;
+        if (use_dm) {
+            // Don't wait for the device here; it is waited for with the rest
+            // of the batch below.
+            if (!MapWithDmLinear(*partition_opener_.get(), name, {}, &path)) {
+                unmap_all();
+                return false;
+            }
+            mapped.emplace_back(name);
+
+            std::string unique_path;
+            if (!dm.GetDeviceUniquePath(name, &unique_path)) {
+                unmap_all();
+                return false;
+            }
+            wait_paths.emplace_back(unique_path);
+        } else {
+            if (!MapWithLoopDevice(name, remaining_ms(), &path)) {
+                unmap_all();
+                return false;
+            }
+            mapped.emplace_back(name);
+        }
+        new_paths[name] = path;
+    }
+
+    if (timeout_ms > 0ms && !wait_paths.empty() && !WaitForFiles(wait_paths, remaining_ms())) {
+        LOG(ERROR) << "Timed out waiting for " << wait_paths.size() << " image devices";
+        unmap_all();
+        return false;
+    }
+
+    for (const auto& [name, path] : new_paths) {
+        auto prop_name = GetStatusPropertyName(name);
+        if (!android::base::SetProperty(prop_name, path)) {
+            unmap_all();
+            return false;
+        }
+    }
+
+    paths->insert(new_paths.begin(), new_paths.end());
+    return true;
+}
+
 bool ImageManager::MapImageWithDeviceMapper(const IPartitionOpener& opener, const std::string& name,
                                             std::string* dev) {
     std::string ignore_path;
@@ -655,6 +785,20 @@ bool ImageManager::RemoveAllImages() {
     return ok && RemoveAllMetadata(metadata_dir_);
 }
 
+// Same as SplitFiemap::HasPinnedExtents, without reading the extents.
+static bool HasPinnedFiles(const std::string& image_header) {
+    std::vector<std::string> files;
+    if (!SplitFiemap::GetSplitFileList(image_header, &files)) {
+        return false;
+    }
+    for (const auto& file : files) {
+        if (!FiemapWriter::HasPinnedExtents(file)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool ImageManager::Validate() {
     auto metadata = OpenMetadata(metadata_dir_);
     if (!metadata) {
@@ -665,6 +809,14 @@ bool ImageManager::Validate() {
     for (const auto& partition : metadata->partitions) {
         auto name = GetPartitionName(partition);
         auto image_path = GetImageHeaderPath(name);
+        if (CheckExtentStamp(metadata_dir_, name, image_path)) {
+            if (!HasPinnedFiles(image_path)) {
+                LOG(ERROR) << "Image doesn't have pinned extents: " << image_path;
+                ok = false;
+            }
+            continue;
+        }
+
         auto fiemap = SplitFiemap::Open(image_path);
         if (fiemap == nullptr) {
             LOG(ERROR) << "SplitFiemap::Open(\"" << image_path << "\") failed";
@@ -810,6 +962,17 @@ bool ImageManager::ValidateImageMaps() {
     for (const auto& partition : metadata->partitions) {
         auto name = GetPartitionName(partition);
         auto image_path = GetImageHeaderPath(name);
+
+        // The files have not changed since their extents were recorded, so
+        // there is nothing to gain from reading them back with FIEMAP.
+        if (CheckExtentStamp(metadata_dir_, name, image_path)) {
+            if (!HasPinnedFiles(image_path)) {
+                LOG(ERROR) << "Image doesn't have pinned extents: " << image_path;
+                return false;
+            }
+            continue;
+        }
+
         auto fiemap = SplitFiemap::Open(image_path);
         if (fiemap == nullptr) {
             LOG(ERROR) << "SplitFiemap::Open(\"" << image_path << "\") failed";
@@ -849,6 +1012,11 @@ bool ImageManager::ValidateImageMaps() {
             LOG(ERROR) << "Metadata for " << image_path << " does not match fiemap";
             return false;
         }
+
+        std::lock_guard<std::mutex> lock(metadata_lock_);
+        if (!UpdateExtentStamp(metadata_dir_, name, image_path)) {
+            LOG(WARNING) << "Could not record extent stamp for " << name;
+        }
     }
 
     return true;
@@ -898,6 +1066,24 @@ MappedDevice::~MappedDevice() {
     manager_->UnmapImageDevice(name_);
 }
 
+bool IImageManager::MapImageDevices(const std::vector<std::string>& names,
+                                    const std::chrono::milliseconds& timeout_ms,
+                                    std::map<std::string, std::string>* paths) {
+    std::map<std::string, std::string> new_paths;
+    for (const auto& name : names) {
+        std::string path;
+        if (!MapImageDevice(name, timeout_ms, &path)) {
+            for (const auto& [mapped_name, mapped_path] : new_paths) {
+                UnmapImageDevice(mapped_name);
+            }
+            return false;
+        }
+        new_paths[name] = path;
+    }
+    paths->insert(new_paths.begin(), new_paths.end());
+    return true;
+}
+
 bool IImageManager::UnmapImageIfExists(const std::string& name) {
     // No lock is needed even though this seems to be vulnerable to TOCTOU. If process A
     // calls MapImageDevice() while process B calls UnmapImageIfExists(), and MapImageDevice()
@@ -135,6 +135,35 @@ TEST_F(NativeTest, GetMappedImageDevice) {
     ASSERT_TRUE(manager_->UnmapImageDevice(base_name_));
 }
 
+TEST_F(NativeTest, MapImageDevices) {
+    std::vector<std::string> names = {base_name_ + "_a", base_name_ + "_b"};
+    for (const auto& name : names) {
+        ASSERT_TRUE(manager_->CreateBackingImage(name, kTestImageSize, false, nullptr));
+    }
+
+    std::map<std::string, std::string> paths;
+    ASSERT_TRUE(manager_->MapImageDevices(names, 5s, &paths));
+    ASSERT_EQ(paths.size(), names.size());
+    for (const auto& name : names) {
+        ASSERT_TRUE(manager_->IsImageMapped(name));
+        ASSERT_EQ(android::base::GetProperty("gsid.mapped_image." + name, ""), paths[name]);
+
+        unique_fd fd(open(paths[name].c_str(), O_RDWR | O_NOFOLLOW | O_CLOEXEC));
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(get_block_device_size(fd), kTestImageSize);
+    }
+
+    // Mapping an image twice fails the whole batch.
+    std::map<std::string, std::string> more_paths;
+    ASSERT_FALSE(manager_->MapImageDevices(names, 5s, &more_paths));
+    ASSERT_TRUE(more_paths.empty());
+
+    for (const auto& name : names) {
+        ASSERT_TRUE(manager_->UnmapImageDevice(name));
+        ASSERT_TRUE(manager_->DeleteBackingImage(name));
+    }
+}
+
 namespace {
 
 struct IsSubdirTestParam {
@@ -20,10 +20,13 @@
 
 #include <chrono>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 #include <libfiemap/fiemap_status.h>
@@ -59,7 +62,7 @@ class IImageManager {
     // is true, the image will be zero-filled. Otherwise, the initial content
     // of the image is undefined. If zero-fill is requested, and the operation
     // cannot be completed, the image will be deleted and this function will
-    // return false.
+    // return false. Different images may be created concurrently.
     virtual FiemapStatus CreateBackingImage(
             const std::string& name, uint64_t size, int flags,
             std::function<bool(uint64_t, uint64_t)>&& on_progress = nullptr) = 0;
@@ -80,6 +83,14 @@ class IImageManager {
     virtual bool MapImageDevice(const std::string& name,
                                 const std::chrono::milliseconds& timeout_ms, std::string* path) = 0;
 
+    // Same as MapImageDevice, for several images at once. Implementations may
+    // create all of the devices before waiting for any of them, so that the
+    // timeout covers the whole set. On success, |paths| maps each name to its
+    // device. On failure, none of the images are left mapped by this call.
+    virtual bool MapImageDevices(const std::vector<std::string>& names,
+                                 const std::chrono::milliseconds& timeout_ms,
+                                 std::map<std::string, std::string>* paths);
+
     // Unmap a block device previously mapped with mapBackingImage.
     virtual bool UnmapImageDevice(const std::string& name) = 0;
 
@@ -155,6 +166,9 @@ class ImageManager final : public IImageManager {
     bool DeleteBackingImage(const std::string& name) override;
     bool MapImageDevice(const std::string& name, const std::chrono::milliseconds& timeout_ms,
                         std::string* path) override;
+    bool MapImageDevices(const std::vector<std::string>& names,
+                         const std::chrono::milliseconds& timeout_ms,
+                         std::map<std::string, std::string>* paths) override;
     bool UnmapImageDevice(const std::string& name) override;
     bool BackingImageExists(const std::string& name) override;
     bool IsImageMapped(const std::string& name) override;
@@ -192,6 +206,7 @@ class ImageManager final : public IImageManager {
                                const std::chrono::milliseconds& timeout_ms, std::string* path);
     bool MapWithDmLinear(const IPartitionOpener& opener, const std::string& name,
                          const std::chrono::milliseconds& timeout_ms, std::string* path);
+    bool CanMapWithDmLinear(const std::string& name, bool* use_dm);
     bool UnmapImageDevice(const std::string& name, bool force);
     bool IsUnreliablePinningAllowed() const;
     bool MetadataDirIsTest() const;
@@ -205,6 +220,8 @@ class ImageManager final : public IImageManager {
     std::string data_dir_;
     std::unique_ptr<IPartitionOpener> partition_opener_;
     DeviceInfo device_info_;
+    // Serializes updates of the lp_metadata file in |metadata_dir_|.
+    std::mutex metadata_lock_;
 };
 
 // RAII helper class for mapping and opening devices with an ImageManager.
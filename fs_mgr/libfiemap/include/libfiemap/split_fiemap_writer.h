@@ -40,7 +40,8 @@ class SplitFiemap final {
     // Create a new split fiemap file. If |max_piece_size| is 0, the number of
     // pieces will be determined automatically by detecting the filesystem.
     // Otherwise, the file will be split evenly (with the remainder in the
-    // final file).
+    // final file). Pieces after the first are allocated on several threads;
+    // |progress| is still only called from one thread at a time.
     static std::unique_ptr<SplitFiemap> Create(const std::string& file_path, uint64_t file_size,
                                                uint64_t max_piece_size,
                                                ProgressCallback progress = {});
@@ -67,6 +68,18 @@ class SplitFiemap final {
     // method (yet); this starts at 0 and increments the position by |bytes|.
     bool Write(const void* data, uint64_t bytes);
 
+    // Write |bytes| of |data| starting at |offset|, spanning files as needed.
+    // This does not use or move the Write() cursor, and may be called from
+    // several threads at once for ranges that do not overlap.
+    bool WriteAt(uint64_t offset, const void* data, uint64_t bytes);
+
+    // Same as WriteAt(), but splits the range across up to |max_threads|
+    // threads (0 picks a default). |progress| receives the bytes written so
+    // far and |bytes|, from one thread at a time; if it returns false, the
+    // write stops and fails.
+    bool WriteParallel(uint64_t offset, const void* data, uint64_t bytes,
+                       ProgressCallback progress = {}, size_t max_threads = 0);
+
     // Flush all writes to all split files.
     bool Flush();
 
@@ -84,10 +97,13 @@ class SplitFiemap final {
   private:
     SplitFiemap() = default;
     void AddFile(FiemapUniquePtr&& file);
+    size_t FindFile(uint64_t offset) const;
 
     bool creating_ = false;
     std::string list_file_;
     std::vector<FiemapUniquePtr> files_;
+    // Offset of each file in |files_| within the split file.
+    std::vector<uint64_t> file_offsets_;
     std::vector<struct fiemap_extent> extents_;
     uint64_t total_size_ = 0;
 
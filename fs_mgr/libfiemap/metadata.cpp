@@ -16,12 +16,20 @@
 
 #include "metadata.h"
 
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <vector>
+
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <liblp/builder.h>
 
 #include "utility.h"
@@ -37,6 +45,10 @@ std::string GetMetadataFile(const std::string& metadata_dir) {
     return JoinPaths(metadata_dir, "lp_metadata");
 }
 
+static std::string GetExtentStampFile(const std::string& metadata_dir) {
+    return JoinPaths(metadata_dir, "lp_metadata.stamp");
+}
+
 bool MetadataExists(const std::string& metadata_dir) {
     auto metadata_file = GetMetadataFile(metadata_dir);
     if (access(metadata_file.c_str(), F_OK)) {
@@ -123,6 +135,11 @@ bool RemoveAllMetadata(const std::string& dir) {
         LOG(ERROR) << "Could not remove metadata file: " << err;
         return false;
     }
+    auto stamp_file = GetExtentStampFile(dir);
+    if (!android::base::RemoveFileIfExists(stamp_file, &err)) {
+        LOG(ERROR) << "Could not remove extent stamp file: " << err;
+        return false;
+    }
     return true;
 }
 
@@ -176,7 +193,11 @@ bool RemoveImageMetadata(const std::string& metadata_dir, const std::string& par
         return false;
     }
     builder->RemovePartition(partition_name);
-    return SaveMetadata(builder.get(), metadata_dir);
+    if (!SaveMetadata(builder.get(), metadata_dir)) {
+        return false;
+    }
+    RemoveExtentStamp(metadata_dir, partition_name);
+    return true;
 }
 
 bool UpdateMetadata(const std::string& metadata_dir, const std::string& partition_name,
@@ -221,5 +242,132 @@ bool AddAttributes(const std::string& metadata_dir, const std::string& partition
     return SaveMetadata(builder.get(), metadata_dir);
 }
 
+// The stamp file has one line per file backing an image:
+//
+//   <partition name> <inode> <generation> <size> <mtime sec> <mtime nsec>
+//
+// It is advisory. Anything that fails to match just means the extents have
+// to be read back from the filesystem.
+static bool GetExtentStamp(const std::string& partition_name, const std::string& image_header,
+                           std::vector<std::string>* lines) {
+    std::vector<std::string> files;
+    if (!SplitFiemap::GetSplitFileList(image_header, &files)) {
+        return false;
+    }
+
+    for (const auto& file : files) {
+        android::base::unique_fd fd(open(file.c_str(), O_RDONLY | O_CLOEXEC));
+        if (fd < 0) {
+            PLOG(ERROR) << "Open " << file << " failed";
+            return false;
+        }
+
+        struct stat s;
+        if (fstat(fd.get(), &s)) {
+            PLOG(ERROR) << "Stat " << file << " failed";
+            return false;
+        }
+
+        // Not every filesystem has a generation number; the inode, size and
+        // mtime still catch a file that was replaced or resized.
+        int generation = 0;
+        if (ioctl(fd.get(), FS_IOC_GETVERSION, &generation)) {
+            generation = 0;
+        }
+
+        lines->emplace_back(android::base::StringPrintf(
+                "%s %llu %u %lld %lld %ld", partition_name.c_str(),
+                static_cast<unsigned long long>(s.st_ino), static_cast<unsigned int>(generation),
+                static_cast<long long>(s.st_size), static_cast<long long>(s.st_mtim.tv_sec),
+                static_cast<long>(s.st_mtim.tv_nsec)));
+    }
+    return true;
+}
+
+// Return every line of the stamp file, except those for |partition_name|.
+static std::vector<std::string> ReadOtherExtentStamps(const std::string& metadata_dir,
+                                                      const std::string& partition_name,
+                                                      std::vector<std::string>* matching) {
+    std::vector<std::string> others;
+
+    std::string contents;
+    if (!android::base::ReadFileToString(GetExtentStampFile(metadata_dir), &contents)) {
+        return others;
+    }
+
+    auto prefix = partition_name + " ";
+    for (auto& line : android::base::Split(contents, "\n")) {
+        if (line.empty()) {
+            continue;
+        }
+        if (android::base::StartsWith(line, prefix)) {
+            if (matching) {
+                matching->emplace_back(std::move(line));
+            }
+        } else {
+            others.emplace_back(std::move(line));
+        }
+    }
+    return others;
+}
+
+static bool WriteExtentStamps(const std::string& metadata_dir,
+                              const std::vector<std::string>& lines) {
+    auto stamp_file = GetExtentStampFile(metadata_dir);
+    if (lines.empty()) {
+        return android::base::RemoveFileIfExists(stamp_file);
+    }
+
+    // Write a new file and rename it over the old one, so that a crash never
+    // leaves a torn stamp behind.
+    auto tmp_file = stamp_file + ".tmp";
+    auto contents = android::base::Join(lines, "\n") + "\n";
+    if (!android::base::WriteStringToFile(contents, tmp_file)) {
+        PLOG(ERROR) << "Could not write " << tmp_file;
+        return false;
+    }
+    if (rename(tmp_file.c_str(), stamp_file.c_str())) {
+        PLOG(ERROR) << "Could not rename " << tmp_file << " to " << stamp_file;
+        unlink(tmp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool UpdateExtentStamp(const std::string& metadata_dir, const std::string& partition_name,
+                       const std::string& image_header) {
+    auto lines = ReadOtherExtentStamps(metadata_dir, partition_name, nullptr);
+    if (!GetExtentStamp(partition_name, image_header, &lines)) {
+        // Don't leave a stale stamp behind.
+        RemoveExtentStamp(metadata_dir, partition_name);
+        return false;
+    }
+    return WriteExtentStamps(metadata_dir, lines);
+}
+
+bool CheckExtentStamp(const std::string& metadata_dir, const std::string& partition_name,
+                      const std::string& image_header) {
+    std::vector<std::string> saved;
+    ReadOtherExtentStamps(metadata_dir, partition_name, &saved);
+    if (saved.empty()) {
+        return false;
+    }
+
+    std::vector<std::string> current;
+    if (!GetExtentStamp(partition_name, image_header, &current)) {
+        return false;
+    }
+    return saved == current;
+}
+
+bool RemoveExtentStamp(const std::string& metadata_dir, const std::string& partition_name) {
+    std::vector<std::string> saved;
+    auto lines = ReadOtherExtentStamps(metadata_dir, partition_name, &saved);
+    if (saved.empty()) {
+        return true;
+    }
+    return WriteExtentStamps(metadata_dir, lines);
+}
+
 }  // namespace fiemap
 }  // namespace android
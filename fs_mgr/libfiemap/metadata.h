@@ -39,5 +39,15 @@ bool FillPartitionExtents(android::fs_mgr::MetadataBuilder* builder,
                           android::fs_mgr::Partition* partition, android::fiemap::SplitFiemap* file,
                           uint64_t partition_size);
 
+// Record the inode, generation, size and mtime of each file behind an image,
+// next to the extents saved in its lp_metadata. CheckExtentStamp returns true
+// if the files still match, in which case the extents in the metadata are
+// still valid and the image does not need to be read back with FIEMAP.
+bool UpdateExtentStamp(const std::string& metadata_dir, const std::string& partition_name,
+                       const std::string& image_header);
+bool CheckExtentStamp(const std::string& metadata_dir, const std::string& partition_name,
+                      const std::string& image_header);
+bool RemoveExtentStamp(const std::string& metadata_dir, const std::string& partition_name);
+
 }  // namespace fiemap
 }  // namespace android
@@ -22,8 +22,13 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <android-base/file.h>
@@ -42,6 +47,13 @@ using android::base::unique_fd;
 // We use a four-digit suffix at the end of filenames.
 static const size_t kMaxFilePieces = 500;
 
+// Split files after the first are allocated on up to this many threads.
+static const size_t kMaxCreateThreads = 4;
+
+// Default thread count and work unit for WriteParallel().
+static const size_t kMaxWriteThreads = 4;
+static const uint64_t kWriteChunkSize = 16 * 1024 * 1024;
+
 std::unique_ptr<SplitFiemap> SplitFiemap::Create(const std::string& file_path, uint64_t file_size,
                                                  uint64_t max_piece_size,
                                                  ProgressCallback progress) {
@@ -74,50 +86,116 @@ FiemapStatus SplitFiemap::Create(const std::string& file_path, uint64_t file_siz
     RemoveSplitFiles(file_path);
 
     // Call |progress| only when the total percentage would significantly change.
+    // Files are allocated concurrently, so the total is tracked per file and
+    // |progress| is called under |progress_lock|.
+    std::mutex progress_lock;
+    bool cancelled = false;
     int permille = -1;
     uint64_t total_bytes_written = 0;
-    auto on_progress = [&](uint64_t written, uint64_t) -> bool {
-        uint64_t actual_written = total_bytes_written + written;
-        int new_permille = (actual_written * 1000) / file_size;
-        if (new_permille != permille && actual_written < file_size) {
-            if (progress && !progress(actual_written, file_size)) {
+    std::vector<uint64_t> file_bytes_written(kMaxFilePieces);
+    auto on_progress = [&](size_t index, uint64_t written) -> bool {
+        std::lock_guard<std::mutex> lock(progress_lock);
+        if (cancelled) {
+            return false;
+        }
+        total_bytes_written += written - file_bytes_written[index];
+        file_bytes_written[index] = written;
+        int new_permille = (total_bytes_written * 1000) / file_size;
+        if (new_permille != permille && total_bytes_written < file_size) {
+            if (progress && !progress(total_bytes_written, file_size)) {
+                cancelled = true;
                 return false;
             }
             permille = new_permille;
         }
         return true;
     };
+    auto create_chunk = [&](size_t index, uint64_t chunk_size,
+                            FiemapUniquePtr* writer) -> FiemapStatus {
+        std::string chunk_path =
+                android::base::StringPrintf("%s.%04d", file_path.c_str(), (int)index);
+        auto status = FiemapWriter::Open(
+                chunk_path, chunk_size, writer, true,
+                [&, index](uint64_t written, uint64_t) { return on_progress(index, written); });
+        if (status.is_ok()) {
+            // To make sure the alignment doesn't create too much inconsistency, we
+            // account the *actual* size, not the requested size.
+            std::lock_guard<std::mutex> lock(progress_lock);
+            total_bytes_written += (*writer)->size() - file_bytes_written[index];
+            file_bytes_written[index] = (*writer)->size();
+        }
+        return status;
+    };
+
     std::unique_ptr<SplitFiemap> out(new SplitFiemap());
     out->creating_ = true;
     out->list_file_ = file_path;
 
-    // Create the split files.
-    uint64_t remaining_bytes = file_size;
+    // Create the first split file, which tells us the block size.
+    FiemapUniquePtr first;
+    auto status = create_chunk(0, std::min(max_piece_size, file_size), &first);
+    if (!status.is_ok()) {
+        out.reset();
+        return status;
+    }
+    uint64_t block_size = first->block_size();
+    uint64_t remaining_bytes = file_size > first->size() ? (file_size - first->size()) : 0;
+    out->AddFile(std::move(first));
+
+    // FiemapWriter aligns each file up to the block size, so the sizes of the
+    // remaining files can be worked out before allocating any of them.
+    std::vector<uint64_t> chunk_sizes;
     while (remaining_bytes) {
-        if (out->files_.size() >= kMaxFilePieces) {
+        if (out->files_.size() + chunk_sizes.size() >= kMaxFilePieces) {
             LOG(ERROR) << "Requested size " << file_size << " created too many split files";
             out.reset();
             return FiemapStatus::Error();
         }
-        std::string chunk_path =
-                android::base::StringPrintf("%s.%04d", file_path.c_str(), (int)out->files_.size());
         uint64_t chunk_size = std::min(max_piece_size, remaining_bytes);
-        FiemapUniquePtr writer;
-        auto status = FiemapWriter::Open(chunk_path, chunk_size, &writer, true, on_progress);
-        if (!status.is_ok()) {
-            out.reset();
-            return status;
-        }
+        uint64_t actual_size = (chunk_size + block_size - 1) / block_size * block_size;
+        chunk_sizes.emplace_back(chunk_size);
 
-        // To make sure the alignment doesn't create too much inconsistency, we
-        // account the *actual* size, not the requested size.
-        total_bytes_written += writer->size();
+        // The aligned size could be bigger than remaining_bytes. If so, set
+        // remaining_bytes to 0 to avoid underflow error.
+        remaining_bytes = remaining_bytes > actual_size ? (remaining_bytes - actual_size) : 0;
+    }
 
-        // writer->size() is block size aligned and could be bigger than remaining_bytes
-        // If remaining_bytes is bigger, set remaining_bytes to 0 to avoid underflow error.
-        remaining_bytes = remaining_bytes > writer->size() ? (remaining_bytes - writer->size()) : 0;
+    // Allocate the rest in parallel. The first failure cancels the others
+    // through their progress callbacks.
+    std::vector<FiemapUniquePtr> writers(chunk_sizes.size());
+    std::atomic<size_t> next_chunk = 0;
+    FiemapStatus first_error = FiemapStatus::Ok();
+    auto worker = [&]() {
+        for (size_t i = next_chunk++; i < chunk_sizes.size(); i = next_chunk++) {
+            auto chunk_status = create_chunk(i + 1, chunk_sizes[i], &writers[i]);
+            std::lock_guard<std::mutex> lock(progress_lock);
+            if (!chunk_status.is_ok() && first_error.is_ok()) {
+                first_error = chunk_status;
+            }
+            if (!chunk_status.is_ok() || cancelled) {
+                cancelled = true;
+                return;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(kMaxCreateThreads, chunk_sizes.size()); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
 
-        out->AddFile(std::move(writer));
+    // Hand every file that was created to |out|, so it unlinks them on failure.
+    for (auto& writer : writers) {
+        if (writer) {
+            out->AddFile(std::move(writer));
+        }
+    }
+    if (!first_error.is_ok()) {
+        out.reset();
+        return first_error;
     }
 
     // Create the split file list.
@@ -277,6 +355,97 @@ bool SplitFiemap::Write(const void* data, uint64_t bytes) {
     return true;
 }
 
+bool SplitFiemap::WriteAt(uint64_t offset, const void* data, uint64_t bytes) {
+    if (offset > total_size_ || bytes > total_size_ - offset) {
+        LOG(ERROR) << "write past end of file requested";
+        return false;
+    }
+
+    const uint8_t* data_ptr = reinterpret_cast<const uint8_t*>(data);
+    for (size_t index = FindFile(offset); bytes; index++) {
+        FiemapWriter* file = files_[index].get();
+        uint64_t file_pos = offset - file_offsets_[index];
+        uint64_t bytes_to_write = std::min(file->size() - file_pos, bytes);
+
+        unique_fd fd(open(file->file_path().c_str(), O_CLOEXEC | O_WRONLY));
+        if (fd < 0) {
+            PLOG(ERROR) << "open failed: " << file->file_path();
+            return false;
+        }
+        if (!FiemapWriter::HasPinnedExtents(file->file_path())) {
+            LOG(ERROR) << "file is no longer pinned: " << file->file_path();
+            return false;
+        }
+        if (!android::base::WriteFullyAtOffset(fd, data_ptr, bytes_to_write, file_pos)) {
+            PLOG(ERROR) << "write failed: " << file->file_path();
+            return false;
+        }
+        data_ptr += bytes_to_write;
+        offset += bytes_to_write;
+        bytes -= bytes_to_write;
+    }
+    return true;
+}
+
+bool SplitFiemap::WriteParallel(uint64_t offset, const void* data, uint64_t bytes,
+                                ProgressCallback progress, size_t max_threads) {
+    if (offset > total_size_ || bytes > total_size_ - offset) {
+        LOG(ERROR) << "write past end of file requested";
+        return false;
+    }
+    if (!max_threads) {
+        max_threads = kMaxWriteThreads;
+    }
+
+    // Hand out the range in pieces that stay within one file, so each
+    // WriteAt() only opens a single file.
+    std::vector<std::pair<uint64_t, uint64_t>> chunks;
+    for (uint64_t pos = offset, end = offset + bytes; pos < end;) {
+        size_t index = FindFile(pos);
+        uint64_t file_end = file_offsets_[index] + files_[index]->size();
+        uint64_t chunk_size = std::min({end, file_end, pos + kWriteChunkSize}) - pos;
+        chunks.emplace_back(pos, chunk_size);
+        pos += chunk_size;
+    }
+
+    std::mutex progress_lock;
+    bool failed = false;
+    int permille = -1;
+    uint64_t bytes_written = 0;
+    std::atomic<size_t> next_chunk = 0;
+    auto worker = [&]() {
+        const uint8_t* data_ptr = reinterpret_cast<const uint8_t*>(data);
+        for (size_t i = next_chunk++; i < chunks.size(); i = next_chunk++) {
+            const auto& [chunk_offset, chunk_size] = chunks[i];
+            bool ok = WriteAt(chunk_offset, data_ptr + (chunk_offset - offset), chunk_size);
+
+            std::lock_guard<std::mutex> lock(progress_lock);
+            if (!ok || failed) {
+                failed = true;
+                return;
+            }
+            bytes_written += chunk_size;
+            int new_permille = (bytes_written * 1000) / bytes;
+            if (new_permille != permille && bytes_written < bytes) {
+                if (progress && !progress(bytes_written, bytes)) {
+                    failed = true;
+                    return;
+                }
+                permille = new_permille;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(max_threads, chunks.size()); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return !failed;
+}
+
 bool SplitFiemap::Flush() {
     for (const auto& file : files_) {
         unique_fd fd(open(file->file_path().c_str(), O_RDONLY | O_CLOEXEC));
@@ -308,10 +477,16 @@ SplitFiemap::~SplitFiemap() {
 }
 
 void SplitFiemap::AddFile(FiemapUniquePtr&& file) {
+    file_offsets_.emplace_back(total_size_);
     total_size_ += file->size();
     files_.emplace_back(std::move(file));
 }
 
+size_t SplitFiemap::FindFile(uint64_t offset) const {
+    auto iter = std::upper_bound(file_offsets_.begin(), file_offsets_.end(), offset);
+    return std::distance(file_offsets_.begin(), iter) - 1;
+}
+
 uint32_t SplitFiemap::block_size() const {
     return files_[0]->block_size();
 }
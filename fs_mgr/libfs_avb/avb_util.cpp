@@ -16,14 +16,21 @@
 
 #include "avb_util.h"
 
+#include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <future>
+#include <iterator>
 #include <sstream>
+#include <thread>
+#include <utility>
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
+#include <libdm/file_wait.h>
 
 #include "util.h"
 
@@ -88,6 +95,55 @@ bool ConstructVerityTable(const FsAvbHashtreeDescriptor& hashtree_desc,
     return table->AddTarget(std::make_unique<android::dm::DmTargetVerity>(target));
 }
 
+// Warms up the hash cache of a new verity device in the background, so that
+// the first reads from the mounted filesystem don't stall on cold hashtree
+// reads. dm-verity reads hash blocks through dm-bufio rather than the page
+// cache of the underlying device, so readahead of the hashtree region itself
+// would not help. Instead this asks for readahead of one data block per hash
+// leaf block through the verity device; verifying it pulls the leaf and every
+// level above it into the cache.
+static void PrefetchHashtree(const std::string& dev_path,
+                             const FsAvbHashtreeDescriptor& hashtree_desc) {
+    if (!hashtree_desc.data_block_size || !hashtree_desc.hash_block_size ||
+        !hashtree_desc.root_digest_len) {
+        return;
+    }
+
+    // dm-verity pads each digest in a hash block to a power of two.
+    uint64_t digest_size = 1;
+    while (digest_size < hashtree_desc.root_digest_len) digest_size <<= 1;
+
+    const uint64_t data_block_size = hashtree_desc.data_block_size;
+    const uint64_t stride =
+            data_block_size * std::max<uint64_t>(hashtree_desc.hash_block_size / digest_size, 1);
+    const uint64_t image_size = hashtree_desc.image_size;
+
+    std::thread([=]() -> void {
+        auto start = std::chrono::steady_clock::now();
+        if (!android::dm::WaitForFile(dev_path, 5s)) {
+            LWARNING << "Not prefetching hashtree, timed out waiting for " << dev_path;
+            return;
+        }
+        unique_fd fd(TEMP_FAILURE_RETRY(open(dev_path.c_str(), O_RDONLY | O_CLOEXEC)));
+        if (fd < 0) {
+            PWARNING << "Not prefetching hashtree, failed to open " << dev_path;
+            return;
+        }
+        for (uint64_t offset = 0; offset < image_size; offset += stride) {
+            int rv = posix_fadvise(fd.get(), offset, data_block_size, POSIX_FADV_WILLNEED);
+            if (rv) {
+                errno = rv;
+                PWARNING << "Hashtree prefetch of " << dev_path << " stopped at " << offset;
+                return;
+            }
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+        LINFO << "Queued hashtree prefetch of " << dev_path << " in " << duration.count()
+              << "ms";
+    }).detach();
+}
+
 bool HashtreeDmVeritySetup(FstabEntry* fstab_entry, const FsAvbHashtreeDescriptor& hashtree_desc,
                            bool wait_for_verity_dev) {
     android::dm::DmTable table;
@@ -112,6 +168,10 @@ bool HashtreeDmVeritySetup(FstabEntry* fstab_entry, const FsAvbHashtreeDescripto
     // Marks the underlying block device as read-only.
     SetBlockDeviceReadOnly(fstab_entry->blk_device);
 
+    if (fstab_entry->fs_mgr_flags.prefetch_hashtree) {
+        PrefetchHashtree(dev_path, hashtree_desc);
+    }
+
     // Updates fstab_rec->blk_device to verity device name.
     fstab_entry->blk_device = dev_path;
     return true;
@@ -576,12 +636,26 @@ VBMetaVerifyResult LoadAndVerifyVbmetaByPartition(
         if (fatal_error) {
             return VBMetaVerifyResult::kError;
         }
+        // The chained partitions only depend on the public keys we already
+        // have, so load and verify them all at once. That overlaps both the
+        // reads and the signature checks. The results are then consumed in
+        // descriptor order, exactly as if they had been loaded one by one.
+        std::vector<std::future<std::pair<VBMetaVerifyResult, std::vector<VBMetaData>>>> results;
         for (auto& chain : chain_partitions) {
-            auto sub_ret = LoadAndVerifyVbmetaByPartition(
-                chain.partition_name, ab_suffix, ab_other_suffix, chain.public_key_blob,
-                allow_verification_error, load_chained_vbmeta, rollback_protection,
-                device_path_constructor, true, /* is_chained_vbmeta */
-                out_vbmeta_images);
+            results.emplace_back(std::async(std::launch::async, [&, chain]() {
+                std::vector<VBMetaData> chain_vbmeta_images;
+                auto sub_ret = LoadAndVerifyVbmetaByPartition(
+                        chain.partition_name, ab_suffix, ab_other_suffix, chain.public_key_blob,
+                        allow_verification_error, load_chained_vbmeta, rollback_protection,
+                        device_path_constructor, true, /* is_chained_vbmeta */
+                        &chain_vbmeta_images);
+                return std::make_pair(sub_ret, std::move(chain_vbmeta_images));
+            }));
+        }
+        for (auto& result : results) {
+            auto [sub_ret, chain_vbmeta_images] = result.get();
+            std::move(chain_vbmeta_images.begin(), chain_vbmeta_images.end(),
+                      std::back_inserter(*out_vbmeta_images));
             if (sub_ret != VBMetaVerifyResult::kSuccess) {
                 verify_result = sub_ret;  // might be 'ERROR' or 'ERROR VERIFICATION'.
                 if (verify_result == VBMetaVerifyResult::kError) {
@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
 
 #include <android-base/unique_fd.h>
@@ -95,11 +96,21 @@ bool ZeroExtent::operator==(const android::fs_mgr::Extent& other) const {
     return other.GetExtentType() == ExtentType::kZero && num_sectors_ == other.num_sectors();
 }
 
+static uint64_t NextPartitionGeneration() {
+    static std::atomic<uint64_t> generation = 0;
+    return ++generation;
+}
+
 Partition::Partition(std::string_view name, std::string_view group_name, uint32_t attributes)
-    : name_(name), group_name_(group_name), attributes_(attributes), size_(0) {}
+    : name_(name),
+      group_name_(group_name),
+      attributes_(attributes),
+      size_(0),
+      generation_(NextPartitionGeneration()) {}
 
 void Partition::AddExtent(std::unique_ptr<Extent>&& extent) {
     size_ += extent->num_sectors() * LP_SECTOR_SIZE;
+    generation_ = NextPartitionGeneration();
 
     if (LinearExtent* new_extent = extent->AsLinearExtent()) {
         if (!extents_.empty() && extents_.back()->AsLinearExtent()) {
@@ -121,6 +132,7 @@ void Partition::AddExtent(std::unique_ptr<Extent>&& extent) {
 void Partition::RemoveExtents() {
     size_ = 0;
     extents_.clear();
+    generation_ = NextPartitionGeneration();
 }
 
 void Partition::ShrinkTo(uint64_t aligned_size) {
@@ -131,6 +143,7 @@ void Partition::ShrinkTo(uint64_t aligned_size) {
 
     // Remove or shrink extents of any kind until the total partition size is
     // equal to the requested size.
+    generation_ = NextPartitionGeneration();
     uint64_t sectors_to_remove = (size_ - aligned_size) / LP_SECTOR_SIZE;
     while (sectors_to_remove) {
         Extent* extent = extents_.back().get();
@@ -541,7 +554,12 @@ Partition* MetadataBuilder::AddPartition(std::string_view name, std::string_view
         return nullptr;
     }
     partitions_.push_back(std::make_unique<Partition>(name, group_name, attributes));
-    return partitions_.back().get();
+
+    // A new partition has no extents, so the allocation maps are already
+    // accurate for it.
+    Partition* partition = partitions_.back().get();
+    allocated_generations_[partition] = partition->generation_;
+    return partition;
 }
 
 Partition* MetadataBuilder::FindPartition(std::string_view name) const {
@@ -576,12 +594,89 @@ uint64_t MetadataBuilder::TotalSizeOfGroup(PartitionGroup* group) const {
 void MetadataBuilder::RemovePartition(std::string_view name) {
     for (auto iter = partitions_.begin(); iter != partitions_.end(); iter++) {
         if ((*iter)->name() == name) {
+            Partition* partition = iter->get();
+            if (IsAllocationSynced(partition)) {
+                for (const auto& extent : partition->extents()) {
+                    if (LinearExtent* linear = extent->AsLinearExtent()) {
+                        Release(linear->device_index(), linear->physical_sector(),
+                                linear->end_sector());
+                    }
+                }
+            }
+            allocated_generations_.erase(partition);
             partitions_.erase(iter);
             return;
         }
     }
 }
 
+// Bring |allocated_| up to date with the partition table. This only rebuilds
+// the maps when a partition was changed outside of the builder.
+void MetadataBuilder::SyncAllocations() const {
+    bool stale = allocated_.size() != block_devices_.size() ||
+                 allocated_generations_.size() != partitions_.size();
+    for (auto iter = partitions_.begin(); !stale && iter != partitions_.end(); iter++) {
+        stale = !IsAllocationSynced(iter->get());
+    }
+    if (!stale) {
+        return;
+    }
+
+    allocated_.clear();
+    allocated_.resize(block_devices_.size());
+    allocated_generations_.clear();
+    for (const auto& partition : partitions_) {
+        for (const auto& extent : partition->extents()) {
+            if (LinearExtent* linear = extent->AsLinearExtent()) {
+                CHECK(linear->device_index() < allocated_.size());
+                Allocate(*linear);
+            }
+        }
+        allocated_generations_[partition.get()] = partition->generation_;
+    }
+}
+
+bool MetadataBuilder::IsAllocationSynced(const Partition* partition) const {
+    auto iter = allocated_generations_.find(partition);
+    return allocated_.size() == block_devices_.size() && iter != allocated_generations_.end() &&
+           iter->second == partition->generation_;
+}
+
+void MetadataBuilder::Allocate(const LinearExtent& extent) const {
+    if (!extent.num_sectors()) {
+        return;
+    }
+    auto& allocated = allocated_[extent.device_index()];
+    auto [iter, inserted] = allocated.emplace(extent.physical_sector(), extent.end_sector());
+    if (!inserted) {
+        // Overlapping extents are invalid, but don't lose track of either.
+        iter->second = std::max(iter->second, extent.end_sector());
+    }
+}
+
+void MetadataBuilder::Release(uint32_t device_index, uint64_t start, uint64_t end) const {
+    auto& allocated = allocated_[device_index];
+    auto iter = allocated.upper_bound(start);
+    if (iter != allocated.begin()) {
+        iter--;
+    }
+    while (iter != allocated.end() && iter->first < end) {
+        uint64_t range_start = iter->first;
+        uint64_t range_end = iter->second;
+        if (range_end <= start) {
+            iter++;
+            continue;
+        }
+        iter = allocated.erase(iter);
+        if (range_start < start) {
+            allocated.emplace(range_start, start);
+        }
+        if (range_end > end) {
+            allocated.emplace(end, range_end);
+        }
+    }
+}
+
 void MetadataBuilder::ExtentsToFreeList(const std::vector<Interval>& extents,
                                         std::vector<Interval>* free_regions) const {
     // Convert the extent list into a list of gaps between the extents; i.e.,
@@ -612,34 +707,30 @@ void MetadataBuilder::ExtentsToFreeList(const std::vector<Interval>& extents,
 auto MetadataBuilder::GetFreeRegions() const -> std::vector<Interval> {
     std::vector<Interval> free_regions;
 
-    // Collect all extents in the partition table, per-device, then sort them
-    // by starting sector.
-    std::vector<std::vector<Interval>> device_extents(block_devices_.size());
-    for (const auto& partition : partitions_) {
-        for (const auto& extent : partition->extents()) {
-            LinearExtent* linear = extent->AsLinearExtent();
-            if (!linear) {
-                continue;
-            }
-            CHECK(linear->device_index() < device_extents.size());
-            auto& extents = device_extents[linear->device_index()];
-            extents.emplace_back(linear->device_index(), linear->physical_sector(),
-                                 linear->physical_sector() + extent->num_sectors());
-        }
-    }
+    // The allocation maps already hold every extent in the partition table,
+    // per-device, sorted by starting sector.
+    SyncAllocations();
 
     // Add 0-length intervals for the first and last sectors. This will cause
     // ExtentToFreeList() to treat the space in between as available.
-    for (size_t i = 0; i < device_extents.size(); i++) {
-        auto& extents = device_extents[i];
+    for (size_t i = 0; i < allocated_.size(); i++) {
         const auto& block_device = block_devices_[i];
-
         uint64_t first_sector = block_device.first_logical_sector;
         uint64_t last_sector = block_device.size / LP_SECTOR_SIZE;
+
+        std::vector<Interval> extents;
+        extents.reserve(allocated_[i].size() + 2);
         extents.emplace_back(i, first_sector, first_sector);
+        for (const auto& [start, end] : allocated_[i]) {
+            extents.emplace_back(i, start, end);
+        }
         extents.emplace_back(i, last_sector, last_sector);
 
-        std::sort(extents.begin(), extents.end());
+        // Extents are never outside of these bounds in valid metadata, but
+        // keep the list ordered if they are.
+        if (!std::is_sorted(extents.begin(), extents.end())) {
+            std::sort(extents.begin(), extents.end());
+        }
         ExtentsToFreeList(extents, &free_regions);
     }
     return free_regions;
@@ -764,13 +855,67 @@ bool MetadataBuilder::GrowPartition(Partition* partition, uint64_t aligned_size,
         return false;
     }
 
-    // Everything succeeded, so commit the new extents.
+    // Everything succeeded, so commit the new extents. GetFreeRegions() just
+    // synced the allocation maps, so they can be updated in place.
     for (auto& extent : new_extents) {
+        Allocate(*extent.get());
         partition->AddExtent(std::move(extent));
     }
+    allocated_generations_[partition] = partition->generation_;
     return true;
 }
 
+bool MetadataBuilder::CompactPartition(Partition* partition) {
+    if (partition->extents().size() <= 1) {
+        return true;
+    }
+    for (const auto& extent : partition->extents()) {
+        if (!extent->AsLinearExtent()) {
+            return true;
+        }
+    }
+
+    // Hand the partition's space back to the free list, but keep its extents
+    // around in case nothing better can be found.
+    SyncAllocations();
+    uint64_t size = partition->size();
+    std::vector<std::unique_ptr<Extent>> old_extents = std::move(partition->extents_);
+    for (const auto& extent : old_extents) {
+        LinearExtent* linear = extent->AsLinearExtent();
+        Release(linear->device_index(), linear->physical_sector(), linear->end_sector());
+    }
+    partition->RemoveExtents();
+    allocated_generations_[partition] = partition->generation_;
+
+    // Take the smallest free region that fits the whole partition, so that
+    // large regions stay available for other partitions.
+    uint64_t sectors_needed = size / LP_SECTOR_SIZE;
+    std::vector<Interval> free_regions = GetFreeRegions();
+    const Interval* best = nullptr;
+    for (const auto& region : free_regions) {
+        if (region.length() >= sectors_needed && (!best || region.length() < best->length())) {
+            best = &region;
+        }
+    }
+    if (best) {
+        auto extent =
+                std::make_unique<LinearExtent>(sectors_needed, best->device_index, best->start);
+        Allocate(*extent.get());
+        partition->AddExtent(std::move(extent));
+        allocated_generations_[partition] = partition->generation_;
+        return true;
+    }
+
+    // No single region is large enough. Leave the partition as it was, since
+    // a fresh greedy allocation would be no less fragmented.
+    for (auto& extent : old_extents) {
+        Allocate(*extent->AsLinearExtent());
+        partition->AddExtent(std::move(extent));
+    }
+    allocated_generations_[partition] = partition->generation_;
+    return false;
+}
+
 std::vector<Interval> MetadataBuilder::PrioritizeSecondHalfOfSuper(
         const std::vector<Interval>& free_list) {
     const auto& super = block_devices_[0];
@@ -854,22 +999,43 @@ bool MetadataBuilder::IsAnyRegionCovered(const std::vector<Interval>& regions,
 }
 
 bool MetadataBuilder::IsAnyRegionAllocated(const LinearExtent& candidate) const {
-    for (const auto& partition : partitions_) {
-        for (const auto& extent : partition->extents()) {
-            LinearExtent* linear = extent->AsLinearExtent();
-            if (!linear) {
-                continue;
-            }
-            if (linear->OverlapsWith(candidate)) {
-                return true;
-            }
-        }
+    SyncAllocations();
+    if (candidate.device_index() >= allocated_.size() || !candidate.num_sectors()) {
+        return false;
     }
-    return false;
+
+    // Only the last range starting before the candidate ends can overlap it,
+    // since allocated ranges never overlap each other.
+    const auto& allocated = allocated_[candidate.device_index()];
+    auto iter = allocated.lower_bound(candidate.end_sector());
+    if (iter == allocated.begin()) {
+        return false;
+    }
+    iter--;
+    return iter->second > candidate.physical_sector();
 }
 
 void MetadataBuilder::ShrinkPartition(Partition* partition, uint64_t aligned_size) {
+    if (!IsAllocationSynced(partition)) {
+        partition->ShrinkTo(aligned_size);
+        return;
+    }
+
+    // Release the sectors that ShrinkTo() is about to drop from the end of
+    // the partition.
+    uint64_t sectors_to_remove = (partition->size() - aligned_size) / LP_SECTOR_SIZE;
+    for (auto iter = partition->extents().rbegin();
+         sectors_to_remove && iter != partition->extents().rend(); iter++) {
+        Extent* extent = iter->get();
+        uint64_t sectors = std::min(sectors_to_remove, extent->num_sectors());
+        if (LinearExtent* linear = extent->AsLinearExtent()) {
+            Release(linear->device_index(), linear->end_sector() - sectors, linear->end_sector());
+        }
+        sectors_to_remove -= sectors;
+    }
+
     partition->ShrinkTo(aligned_size);
+    allocated_generations_[partition] = partition->generation_;
 }
 
 std::unique_ptr<LpMetadata> MetadataBuilder::Export() {
@@ -1234,7 +1400,14 @@ bool MetadataBuilder::AddLinearExtent(Partition* partition, const std::string& b
     }
 
     auto extent = std::make_unique<LinearExtent>(num_sectors, device_index, physical_sector);
+    bool synced = IsAllocationSynced(partition);
+    if (synced) {
+        Allocate(*extent.get());
+    }
     partition->AddExtent(std::move(extent));
+    if (synced) {
+        allocated_generations_[partition] = partition->generation_;
+    }
     return true;
 }
 
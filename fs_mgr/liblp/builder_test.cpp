@@ -1001,6 +1001,117 @@ TEST_F(BuilderTest, CollidedExtents) {
     ASSERT_TRUE(overlap.empty());
 }
 
+static void ExpectSameFreeRegions(MetadataBuilder* builder) {
+    // A builder imported from exported metadata computes its free regions
+    // from scratch.
+    auto exported = builder->Export();
+    ASSERT_NE(exported, nullptr);
+    auto fresh = MetadataBuilder::New(*exported.get());
+    ASSERT_NE(fresh, nullptr);
+
+    auto expected = fresh->GetFreeRegions();
+    auto actual = builder->GetFreeRegions();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < actual.size(); i++) {
+        EXPECT_EQ(actual[i].device_index, expected[i].device_index);
+        EXPECT_EQ(actual[i].start, expected[i].start);
+        EXPECT_EQ(actual[i].end, expected[i].end);
+    }
+}
+
+TEST_F(BuilderTest, FreeRegionsTrackChanges) {
+    unique_ptr<MetadataBuilder> builder = MetadataBuilder::New(1_GiB, 1024, 2);
+    ASSERT_NE(builder, nullptr);
+
+    Partition* system = builder->AddPartition("system", 0);
+    Partition* vendor = builder->AddPartition("vendor", 0);
+    Partition* product = builder->AddPartition("product", 0);
+    ASSERT_NE(system, nullptr);
+    ASSERT_NE(vendor, nullptr);
+    ASSERT_NE(product, nullptr);
+
+    // Interleave the partitions so that they become fragmented.
+    for (int i = 1; i <= 4; i++) {
+        ASSERT_TRUE(builder->ResizePartition(system, i * 16_MiB));
+        ASSERT_TRUE(builder->ResizePartition(vendor, i * 8_MiB));
+        ASSERT_TRUE(builder->ResizePartition(product, i * 4_MiB));
+        ExpectSameFreeRegions(builder.get());
+    }
+
+    ASSERT_TRUE(builder->ResizePartition(system, 20_MiB));
+    ExpectSameFreeRegions(builder.get());
+    ASSERT_TRUE(builder->ResizePartition(vendor, 0));
+    ExpectSameFreeRegions(builder.get());
+
+    builder->RemovePartition("product");
+    ExpectSameFreeRegions(builder.get());
+
+    // Changes made directly to a partition are picked up too.
+    system->RemoveExtents();
+    ExpectSameFreeRegions(builder.get());
+    ASSERT_TRUE(builder->AddLinearExtent(system, "super", 2048, 4096));
+    ExpectSameFreeRegions(builder.get());
+    system->AddExtent(std::make_unique<LinearExtent>(2048, 0, 8192));
+    ExpectSameFreeRegions(builder.get());
+
+    ASSERT_TRUE(builder->ResizePartition(vendor, 64_MiB));
+    ExpectSameFreeRegions(builder.get());
+}
+
+TEST_F(BuilderTest, CompactPartition) {
+    unique_ptr<MetadataBuilder> builder = MetadataBuilder::New(128_MiB, 1024, 2);
+    ASSERT_NE(builder, nullptr);
+
+    Partition* system = builder->AddPartition("system", 0);
+    Partition* vendor = builder->AddPartition("vendor", 0);
+    Partition* product = builder->AddPartition("product", 0);
+    ASSERT_NE(system, nullptr);
+    ASSERT_NE(vendor, nullptr);
+    ASSERT_NE(product, nullptr);
+
+    // Interleave the partitions so that both become fragmented.
+    for (int i = 1; i <= 4; i++) {
+        ASSERT_TRUE(builder->ResizePartition(system, i * 4_MiB));
+        ASSERT_TRUE(builder->ResizePartition(vendor, i * 2_MiB));
+    }
+    ASSERT_EQ(system->extents().size(), 4);
+    ASSERT_EQ(vendor->extents().size(), 4);
+
+    // Use up the rest of the disk, so that no free region is large enough.
+    uint64_t free_space = 0;
+    for (const auto& region : builder->GetFreeRegions()) {
+        free_space += region.length() * LP_SECTOR_SIZE;
+    }
+    ASSERT_TRUE(builder->ResizePartition(product, free_space));
+
+    std::vector<Interval> old_intervals;
+    for (const auto& extent : vendor->extents()) {
+        old_intervals.emplace_back(ToInterval(extent));
+    }
+    EXPECT_FALSE(builder->CompactPartition(vendor));
+    EXPECT_EQ(vendor->size(), 8_MiB);
+    ASSERT_EQ(vendor->extents().size(), old_intervals.size());
+    for (size_t i = 0; i < old_intervals.size(); i++) {
+        EXPECT_EQ(ToInterval(vendor->extents()[i]), old_intervals[i]);
+    }
+    ExpectSameFreeRegions(builder.get());
+
+    builder->RemovePartition("product");
+    ASSERT_TRUE(builder->CompactPartition(system));
+    EXPECT_EQ(system->size(), 16_MiB);
+    EXPECT_EQ(system->extents().size(), 1);
+    EXPECT_EQ(vendor->extents().size(), 4);
+    ExpectSameFreeRegions(builder.get());
+
+    ASSERT_TRUE(builder->CompactPartition(vendor));
+    EXPECT_EQ(vendor->size(), 8_MiB);
+    EXPECT_EQ(vendor->extents().size(), 1);
+    ExpectSameFreeRegions(builder.get());
+
+    // Nothing overlaps, so the result is still valid metadata.
+    EXPECT_NE(builder->Export(), nullptr);
+}
+
 TEST_F(BuilderTest, LinearExtentOverlap) {
     LinearExtent extent(20, 0, 10);
 
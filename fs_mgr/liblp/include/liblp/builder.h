@@ -161,6 +161,11 @@ class Partition final {
     std::vector<std::unique_ptr<Extent>> extents_;
     uint32_t attributes_;
     uint64_t size_;
+
+    // Changes whenever the extent list changes, so MetadataBuilder can tell
+    // whether its record of allocated space is still accurate. Numbers are
+    // never reused across partitions.
+    uint64_t generation_;
 };
 
 // An interval in the metadata. This is similar to a LinearExtent with one difference.
@@ -317,6 +322,17 @@ class MetadataBuilder {
     bool ResizePartition(Partition* partition, uint64_t requested_size,
                          const std::vector<Interval>& free_region_hint = {});
 
+    // Re-allocates |partition| at the same size, in a single extent if any
+    // free region can hold all of it. This undoes fragmentation left behind by
+    // repeated resizes, so the partition maps to fewer dm-linear targets.
+    //
+    // The partition's contents are NOT moved: only use this on a partition
+    // that is about to be rewritten, such as a target slot partition after
+    // NewForUpdate(). Partitions with zero extents are left alone. Returns
+    // false if the partition could not be re-allocated, in which case its
+    // extents are unchanged.
+    bool CompactPartition(Partition* partition);
+
     // Return the list of partitions belonging to a group.
     std::vector<Partition*> ListPartitionsInGroup(std::string_view group_name);
 
@@ -408,6 +424,10 @@ class MetadataBuilder {
     bool IsAnyRegionAllocated(const LinearExtent& candidate) const;
     void ExtentsToFreeList(const std::vector<Interval>& extents,
                            std::vector<Interval>* free_regions) const;
+    void SyncAllocations() const;
+    bool IsAllocationSynced(const Partition* partition) const;
+    void Allocate(const LinearExtent& extent) const;
+    void Release(uint32_t device_index, uint64_t start, uint64_t end) const;
     std::vector<Interval> PrioritizeSecondHalfOfSuper(const std::vector<Interval>& free_list);
     std::unique_ptr<LinearExtent> ExtendFinalExtent(Partition* partition,
                                                     const std::vector<Interval>& free_list,
@@ -422,6 +442,15 @@ class MetadataBuilder {
     std::vector<std::unique_ptr<PartitionGroup>> groups_;
     std::vector<LpMetadataBlockDevice> block_devices_;
     bool auto_slot_suffixing_;
+
+    // Sectors used by linear extents on each block device, as a map of start
+    // sector to end sector. This is updated in place as partitions are grown,
+    // shrunk and removed, so finding free space does not have to collect and
+    // sort every extent again. |allocated_generations_| holds the generation
+    // of each partition as of its last update; if a partition was changed
+    // directly, SyncAllocations() rebuilds the maps.
+    mutable std::vector<std::map<uint64_t, uint64_t>> allocated_;
+    mutable std::map<const Partition*, uint64_t> allocated_generations_;
 };
 
 // Read BlockDeviceInfo for a given block device. This always returns false
@@ -367,6 +367,36 @@ TEST_F(LiblpTest, ReadBackupMetadata) {
     EXPECT_EQ(ReadMetadata(opener, "super", 0), nullptr);
 }
 
+// Test that metadata which was read before is still validated if it changes.
+TEST_F(LiblpTest, ReadChangedMetadata) {
+    unique_fd fd = CreateFlashedDisk();
+    ASSERT_GE(fd, 0);
+
+    DefaultPartitionOpener opener(fd);
+
+    unique_ptr<LpMetadata> metadata = ReadMetadata(opener, "super", 0);
+    ASSERT_NE(metadata, nullptr);
+    ASSERT_NE(ReadPrimaryMetadata(fd, metadata->geometry, 0), nullptr);
+
+    // Flip a bit in the primary metadata's tables, without fixing up the
+    // checksum.
+    off_t offset = GetPrimaryMetadataOffset(metadata->geometry, 0) + metadata->header.header_size;
+    uint8_t byte;
+    ASSERT_GE(lseek(fd, offset, SEEK_SET), 0);
+    ASSERT_TRUE(android::base::ReadFully(fd, &byte, sizeof(byte)));
+    byte ^= 1;
+    ASSERT_GE(lseek(fd, offset, SEEK_SET), 0);
+    ASSERT_TRUE(android::base::WriteFully(fd, &byte, sizeof(byte)));
+
+    EXPECT_EQ(ReadPrimaryMetadata(fd, metadata->geometry, 0), nullptr);
+
+    // The backup is unchanged, and reads back the same as before.
+    unique_ptr<LpMetadata> backup = ReadMetadata(opener, "super", 0);
+    ASSERT_NE(backup, nullptr);
+    EXPECT_EQ(backup->partitions.size(), metadata->partitions.size());
+    EXPECT_EQ(backup->extents.size(), metadata->extents.size());
+}
+
 // Test that we don't attempt to write metadata if it would overflow its
 // reserved space.
 TEST_F(LiblpTest, TooManyPartitions) {
@@ -21,7 +21,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <deque>
 #include <functional>
+#include <mutex>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/unique_fd.h>
@@ -241,6 +244,47 @@ static bool ReadMetadataHeader(Reader* reader, LpMetadata* metadata) {
     return true;
 }
 
+// Metadata is read several times during boot, by different components, and
+// the tables rarely change in between. Keep the last few tables that passed
+// validation, keyed by their exact contents, so that reading the same bytes
+// again skips the table checksum and the per-entry checks. Since a match
+// requires identical geometry, header and tables, the result is exactly what
+// parsing them again would produce.
+static constexpr size_t kMaxCachedMetadata = 4;
+
+struct CachedMetadata {
+    LpMetadata metadata;
+    std::vector<uint8_t> tables;
+};
+
+static std::mutex sCachedMetadataLock;
+static std::deque<CachedMetadata> sCachedMetadata;
+
+static std::unique_ptr<LpMetadata> FindCachedMetadata(const LpMetadataGeometry& geometry,
+                                                      const LpMetadataHeader& header,
+                                                      const uint8_t* tables) {
+    std::lock_guard<std::mutex> lock(sCachedMetadataLock);
+    for (const auto& cached : sCachedMetadata) {
+        if (memcmp(&cached.metadata.geometry, &geometry, sizeof(geometry)) != 0 ||
+            memcmp(&cached.metadata.header, &header, sizeof(header)) != 0 ||
+            cached.tables.size() != header.tables_size ||
+            memcmp(cached.tables.data(), tables, header.tables_size) != 0) {
+            continue;
+        }
+        return std::make_unique<LpMetadata>(cached.metadata);
+    }
+    return nullptr;
+}
+
+static void AddCachedMetadata(const LpMetadata& metadata, const uint8_t* tables) {
+    std::lock_guard<std::mutex> lock(sCachedMetadataLock);
+    if (sCachedMetadata.size() >= kMaxCachedMetadata) {
+        sCachedMetadata.pop_front();
+    }
+    sCachedMetadata.push_back(
+            {metadata, std::vector<uint8_t>(tables, tables + metadata.header.tables_size)});
+}
+
 // Parse and validate all metadata at the current position in the given file
 // descriptor.
 static std::unique_ptr<LpMetadata> ParseMetadata(const LpMetadataGeometry& geometry,
@@ -273,6 +317,10 @@ static std::unique_ptr<LpMetadata> ParseMetadata(const LpMetadataGeometry& geome
         return nullptr;
     }
 
+    if (auto cached = FindCachedMetadata(geometry, header, buffer.get())) {
+        return cached;
+    }
+
     uint8_t checksum[32];
     SHA256(buffer.get(), header.tables_size, checksum);
     if (memcmp(checksum, header.tables_checksum, sizeof(checksum)) != 0) {
@@ -359,6 +407,8 @@ static std::unique_ptr<LpMetadata> ParseMetadata(const LpMetadataGeometry& geome
         LERROR << "Logical partition metadata overlaps with logical partition contents.";
         return nullptr;
     }
+
+    AddCachedMetadata(*metadata.get(), buffer.get());
     return metadata;
 }
 
@@ -20,6 +20,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <string>
 
 #include <android-base/file.h>
@@ -184,6 +185,20 @@ static bool ValidateMetadataRegion(const LpMetadata& metadata, uint64_t start, s
     return true;
 }
 
+// Each copy of the metadata must be on disk before the other copy is touched,
+// so that an interrupted update always leaves one of them intact.
+static bool FlushMetadata(int fd) {
+#if !defined(_WIN32)
+    if (fsync(fd) < 0) {
+        PERROR << __PRETTY_FUNCTION__ << " fsync failed";
+        return false;
+    }
+#else
+    (void)fd;
+#endif
+    return true;
+}
+
 static bool WritePrimaryMetadata(int fd, const LpMetadata& metadata, uint32_t slot_number,
                                  const std::string& blob,
                                  const std::function<bool(int, const std::string&)>& writer) {
@@ -199,7 +214,7 @@ static bool WritePrimaryMetadata(int fd, const LpMetadata& metadata, uint32_t sl
         PERROR << __PRETTY_FUNCTION__ << " write " << blob.size() << " bytes failed";
         return false;
     }
-    return true;
+    return FlushMetadata(fd);
 }
 
 static bool WriteBackupMetadata(int fd, const LpMetadata& metadata, uint32_t slot_number,
@@ -217,7 +232,7 @@ static bool WriteBackupMetadata(int fd, const LpMetadata& metadata, uint32_t slo
         PERROR << __PRETTY_FUNCTION__ << " backup write " << blob.size() << " bytes failed";
         return false;
     }
-    return true;
+    return FlushMetadata(fd);
 }
 
 static bool WriteMetadata(int fd, const LpMetadata& metadata, uint32_t slot_number,
@@ -241,6 +256,49 @@ static bool DefaultWriter(int fd, const std::string& blob) {
     return android::base::WriteFully(fd, blob.data(), blob.size());
 }
 
+// Only write the sectors that differ from what is already on disk. Updates
+// usually touch a single partition entry, so this leaves most of the blob
+// alone. If the old contents cannot be read, everything is written.
+static bool DeltaWriter(int fd, const std::string& blob) {
+    int64_t offset = SeekFile64(fd, 0, SEEK_CUR);
+    if (offset < 0) {
+        PERROR << __PRETTY_FUNCTION__ << " lseek failed";
+        return false;
+    }
+
+    std::string old_blob(blob.size(), '\0');
+    if (!android::base::ReadFullyAtOffset(fd, old_blob.data(), old_blob.size(), offset)) {
+        return DefaultWriter(fd, blob);
+    }
+
+    for (size_t start = 0; start < blob.size();) {
+        size_t size = std::min<size_t>(LP_SECTOR_SIZE, blob.size() - start);
+        if (!memcmp(blob.data() + start, old_blob.data() + start, size)) {
+            start += size;
+            continue;
+        }
+
+        // Coalesce consecutive dirty sectors into one write.
+        size_t end = start + size;
+        while (end < blob.size()) {
+            size = std::min<size_t>(LP_SECTOR_SIZE, blob.size() - end);
+            if (!memcmp(blob.data() + end, old_blob.data() + end, size)) {
+                break;
+            }
+            end += size;
+        }
+        if (SeekFile64(fd, offset + start, SEEK_SET) < 0) {
+            PERROR << __PRETTY_FUNCTION__ << " lseek failed: offset " << offset + start;
+            return false;
+        }
+        if (!android::base::WriteFully(fd, blob.data() + start, end - start)) {
+            return false;
+        }
+        start = end;
+    }
+    return true;
+}
+
 #if defined(_WIN32)
 static const int O_SYNC = 0;
 #endif
@@ -323,7 +381,9 @@ static bool CompareMetadata(const LpMetadata& a, const LpMetadata& b) {
 bool UpdatePartitionTable(const IPartitionOpener& opener, const std::string& super_partition,
                           const LpMetadata& metadata, uint32_t slot_number,
                           const std::function<bool(int, const std::string&)>& writer) {
-    android::base::unique_fd fd = opener.Open(super_partition, O_RDWR | O_SYNC);
+    // Writes are not synchronous here; each copy of the metadata is flushed
+    // once it has been written instead.
+    android::base::unique_fd fd = opener.Open(super_partition, O_RDWR);
     if (fd < 0) {
         PERROR << __PRETTY_FUNCTION__ << " open failed: " << super_partition;
         return false;
@@ -401,13 +461,13 @@ bool UpdatePartitionTable(const IPartitionOpener& opener, const std::string& sup
 
 bool UpdatePartitionTable(const IPartitionOpener& opener, const std::string& super_partition,
                           const LpMetadata& metadata, uint32_t slot_number) {
-    return UpdatePartitionTable(opener, super_partition, metadata, slot_number, DefaultWriter);
+    return UpdatePartitionTable(opener, super_partition, metadata, slot_number, DeltaWriter);
 }
 
 bool UpdatePartitionTable(const std::string& super_partition, const LpMetadata& metadata,
                           uint32_t slot_number) {
     PartitionOpener opener;
-    return UpdatePartitionTable(opener, super_partition, metadata, slot_number, DefaultWriter);
+    return UpdatePartitionTable(opener, super_partition, metadata, slot_number, DeltaWriter);
 }
 
 }  // namespace fs_mgr
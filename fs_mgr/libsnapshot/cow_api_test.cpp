@@ -16,6 +16,8 @@
 
 #include <cstdio>
 #include <iostream>
+#include <map>
+#include <random>
 #include <memory>
 #include <string_view>
 
@@ -392,7 +394,329 @@ TEST_P(CompressionTest, HorribleSink) {
     ASSERT_EQ(sink.stream(), data);
 }
 
-INSTANTIATE_TEST_SUITE_P(CowApi, CompressionTest, testing::Values("none", "gz", "brotli"));
+TEST_P(CompressionTest, ThreadedBatchWrites) {
+    CowOptions options;
+    options.compression = GetParam();
+    options.num_compress_threads = 2;
+
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string xor_data = "This is test data-1. Testing xor";
+    xor_data.resize(options.block_size, '\0');
+    ASSERT_TRUE(writer.AddXorBlocks(50, xor_data.data(), xor_data.size(), 24, 10));
+
+    std::string data = "This is test data-2. Testing replace ops";
+    data.resize(options.block_size * 2048, '\0');
+    for (size_t i = 0; i < data.size(); i += options.block_size) {
+        data[i] = static_cast<char>(i / options.block_size);
+    }
+    ASSERT_TRUE(writer.AddRawBlocks(100, data.data(), data.size()));
+
+    std::string data2 = "This is test data-3. Testing replace ops";
+    data2.resize(options.block_size * 259, '\0');
+    ASSERT_TRUE(writer.AddRawBlocks(6000, data2.data(), data2.size()));
+
+    ASSERT_TRUE(writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    auto iter = reader.GetOpIter();
+    ASSERT_NE(iter, nullptr);
+
+    size_t total_blocks = 0;
+    while (!iter->Done()) {
+        auto op = &iter->Get();
+
+        if (op->type == kCowXorOp) {
+            total_blocks += 1;
+            StringSink sink;
+            ASSERT_EQ(op->new_block, 50);
+            ASSERT_EQ(op->source, 98314);  // 4096 * 24 + 10
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            ASSERT_EQ(sink.stream(), xor_data);
+        }
+
+        if (op->type == kCowReplaceOp) {
+            total_blocks += 1;
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            if (op->new_block >= 6000) {
+                size_t offset = (op->new_block - 6000) * options.block_size;
+                ASSERT_EQ(sink.stream(), data2.substr(offset, options.block_size));
+            } else {
+                size_t offset = (op->new_block - 100) * options.block_size;
+                ASSERT_EQ(sink.stream(), data.substr(offset, options.block_size));
+            }
+        }
+
+        iter->Next();
+    }
+
+    ASSERT_EQ(total_blocks, 1 + 2048 + 259);
+}
+
+TEST_P(CompressionTest, DedupReplaceBlocks) {
+    CowOptions options;
+    options.compression = GetParam();
+    options.cluster_ops = 4;
+    options.dedup_replace_blocks = true;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    // Blocks a, b, a, a, then b and c in a second call.
+    std::string a(options.block_size, 'a');
+    std::string b(options.block_size, 'b');
+    std::string c = "This is block c";
+    c.resize(options.block_size, '\0');
+    std::string data = a + b + a + a;
+    ASSERT_TRUE(writer.AddRawBlocks(10, data.data(), data.size()));
+    std::string data2 = b + c;
+    ASSERT_TRUE(writer.AddRawBlocks(20, data2.data(), data2.size()));
+    ASSERT_TRUE(writer.Finalize());
+
+    const auto& stats = writer.GetOpStats();
+    ASSERT_EQ(stats.by_type[kCowReplaceOp].num_ops, 6);
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    CowHeader header;
+    ASSERT_TRUE(reader.GetHeader(&header));
+    ASSERT_EQ(header.minor_version, kCowVersionMinorSharedData);
+
+    std::map<uint64_t, std::string> expected = {{10, a}, {11, b}, {12, a},
+                                                {13, a}, {20, b}, {21, c}};
+    size_t shared_ops = 0;
+    uint64_t data_bytes = 0;
+    auto iter = reader.GetOpIter();
+    while (!iter->Done()) {
+        const auto& op = iter->Get();
+        if (op.type == kCowReplaceOp) {
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(op, &sink));
+            ASSERT_EQ(sink.stream(), expected[op.new_block]) << "block " << op.new_block;
+            if (IsCowOpDataShared(op)) {
+                shared_ops++;
+            } else {
+                data_bytes += GetCowOpDataLength(op);
+            }
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(shared_ops, 3);
+    ASSERT_EQ(stats.by_type[kCowReplaceOp].data_bytes, data_bytes);
+}
+
+INSTANTIATE_TEST_SUITE_P(CowApi, CompressionTest, testing::Values("none", "gz", "brotli", "lz4", "zstd"));
+
+class ExtentTest : public CowTest, public testing::WithParamInterface<const char*> {};
+
+static std::string MakeExtentTestData(size_t num_blocks, size_t block_size) {
+    std::string data;
+    data.resize(num_blocks * block_size, '\0');
+    for (size_t i = 0; i < num_blocks; i++) {
+        std::string text = "This is block " + std::to_string(i);
+        memcpy(data.data() + i * block_size, text.data(), text.size());
+    }
+    return data;
+}
+
+TEST_P(ExtentTest, ReadWrite) {
+    CowOptions options;
+    options.compression = GetParam();
+    options.compression_factor = 16;
+    options.num_compress_threads = 2;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    // 40 blocks: two full extents and one partial extent.
+    std::string data = MakeExtentTestData(40, options.block_size);
+    ASSERT_TRUE(writer.AddRawBlocks(100, data.data(), data.size()));
+    ASSERT_TRUE(writer.AddZeroBlocks(200, 2));
+    ASSERT_TRUE(writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    CowHeader header;
+    CowFooter footer;
+    ASSERT_TRUE(reader.GetHeader(&header));
+    ASSERT_TRUE(reader.GetFooter(&footer));
+    ASSERT_EQ(header.minor_version, kCowVersionMinorExtents);
+
+    size_t replace_ops = 0;
+    auto iter = reader.GetOpIter();
+    while (!iter->Done()) {
+        const auto& op = iter->Get();
+        if (op.type == kCowReplaceOp) {
+            ASSERT_EQ(op.new_block, 100 + replace_ops);
+            ASSERT_EQ(GetCowOpExtentIndex(op), replace_ops % 16);
+            ASSERT_EQ(GetCowOpExtentBlocks(op), replace_ops < 32 ? 16 : 8);
+
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(op, &sink));
+            ASSERT_EQ(sink.stream(),
+                      data.substr(replace_ops * options.block_size, options.block_size));
+            replace_ops++;
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(replace_ops, 40);
+
+    // Every block, including zeroed ones, is visible to merge.
+    auto merge_iter = reader.GetMergeOpIter();
+    size_t merge_ops = 0;
+    while (!merge_iter->Done()) {
+        merge_ops++;
+        merge_iter->Next();
+    }
+    ASSERT_EQ(merge_ops, 42);
+
+    // Only three extent ops, two zero ops and the final cluster op are stored
+    // in the COW.
+    ASSERT_EQ(footer.op.num_ops, 6);
+}
+
+TEST_P(ExtentTest, HorribleSink) {
+    CowOptions options;
+    options.compression = GetParam();
+    options.compression_factor = 4;
+    options.cluster_ops = 0;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string data = MakeExtentTestData(4, options.block_size);
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    auto iter = reader.GetOpIter();
+    for (size_t i = 0; i < 4; i++) {
+        ASSERT_FALSE(iter->Done());
+        HorribleStringSink sink;
+        ASSERT_TRUE(reader.ReadData(iter->Get(), &sink));
+        ASSERT_EQ(sink.stream(), data.substr(i * options.block_size, options.block_size));
+        iter->Next();
+    }
+    ASSERT_TRUE(iter->Done());
+}
+
+TEST_P(ExtentTest, Append) {
+    CowOptions options;
+    options.compression = GetParam();
+    options.compression_factor = 8;
+    auto writer = std::make_unique<CowWriter>(options);
+
+    ASSERT_TRUE(writer->Initialize(cow_->fd));
+
+    std::string data = MakeExtentTestData(20, options.block_size);
+    ASSERT_TRUE(writer->AddRawBlocks(0, data.data(), data.size()));
+    ASSERT_TRUE(writer->AddLabel(1));
+    ASSERT_TRUE(writer->AddRawBlocks(20, data.data(), data.size()));
+    ASSERT_TRUE(writer->AddLabel(2));
+    ASSERT_TRUE(writer->Finalize());
+
+    // Drop everything after label 1 and resume.
+    writer = std::make_unique<CowWriter>(options);
+    ASSERT_TRUE(writer->InitializeAppend(cow_->fd, 1));
+    ASSERT_TRUE(writer->AddRawBlocks(40, data.data(), data.size()));
+    ASSERT_TRUE(writer->Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    std::vector<uint64_t> blocks;
+    auto iter = reader.GetOpIter();
+    while (!iter->Done()) {
+        const auto& op = iter->Get();
+        if (op.type == kCowReplaceOp) {
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(op, &sink));
+            size_t index = op.new_block % 20;
+            ASSERT_EQ(sink.stream(), data.substr(index * options.block_size, options.block_size));
+            blocks.push_back(op.new_block);
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(blocks.size(), 40);
+    ASSERT_EQ(blocks.front(), 0);
+    ASSERT_EQ(blocks[19], 19);
+    ASSERT_EQ(blocks[20], 40);
+    ASSERT_EQ(blocks.back(), 59);
+}
+
+TEST_P(ExtentTest, DedupAppend) {
+    CowOptions options;
+    options.compression = GetParam();
+    options.compression_factor = 8;
+    options.dedup_replace_blocks = true;
+    auto writer = std::make_unique<CowWriter>(options);
+
+    ASSERT_TRUE(writer->Initialize(cow_->fd));
+
+    // Two full extents and a partial one, written twice: the second copy only
+    // refers to the first one's data.
+    std::string data = MakeExtentTestData(20, options.block_size);
+    ASSERT_TRUE(writer->AddRawBlocks(0, data.data(), data.size()));
+    uint64_t first_size = writer->GetOpStats().by_type[kCowReplaceOp].data_bytes;
+    ASSERT_TRUE(writer->AddRawBlocks(20, data.data(), data.size()));
+    ASSERT_EQ(writer->GetOpStats().by_type[kCowReplaceOp].data_bytes, first_size);
+    ASSERT_TRUE(writer->AddLabel(1));
+    ASSERT_TRUE(writer->Finalize());
+
+    // Resume after the shared ops. The data written before isn't known to the
+    // new writer, so it's stored again, and then shared within the append.
+    writer = std::make_unique<CowWriter>(options);
+    ASSERT_TRUE(writer->InitializeAppend(cow_->fd, 1));
+    ASSERT_TRUE(writer->AddRawBlocks(40, data.data(), data.size()));
+    ASSERT_TRUE(writer->AddRawBlocks(60, data.data(), data.size()));
+    ASSERT_TRUE(writer->Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    size_t replace_ops = 0;
+    size_t shared_ops = 0;
+    auto iter = reader.GetOpIter();
+    while (!iter->Done()) {
+        const auto& op = iter->Get();
+        if (op.type == kCowReplaceOp) {
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(op, &sink));
+            size_t index = op.new_block % 20;
+            ASSERT_EQ(sink.stream(), data.substr(index * options.block_size, options.block_size))
+                    << "block " << op.new_block;
+            ASSERT_EQ(IsCowOpDataShared(op), (op.new_block / 20) % 2 == 1);
+            replace_ops++;
+            shared_ops += IsCowOpDataShared(op);
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(replace_ops, 80);
+    ASSERT_EQ(shared_ops, 40);
+}
+
+INSTANTIATE_TEST_SUITE_P(CowApi, ExtentTest, testing::Values("gz", "brotli", "lz4", "zstd"));
 
 TEST_F(CowTest, GetSize) {
     CowOptions options;
@@ -779,6 +1103,276 @@ TEST_F(CowTest, ClusterTest) {
     ASSERT_TRUE(iter->Done());
 }
 
+TEST_F(CowTest, BatchOps) {
+    CowOptions options;
+    options.cluster_ops = 4;
+    auto writer = std::make_unique<CowWriter>(options);
+    ASSERT_TRUE(writer->Initialize(cow_->fd));
+
+    std::vector<std::pair<uint64_t, uint64_t>> copies;
+    for (uint64_t i = 0; i < 7; i++) {
+        copies.emplace_back(100 + i, 200 + i);
+    }
+    ASSERT_TRUE(writer->AddCopies(copies.size(), copies.data()));
+
+    std::string data1(options.block_size * 2, 'a');
+    std::string data2(options.block_size, 'b');
+    struct iovec iov[] = {
+            {data1.data(), data1.size()},
+            {nullptr, 0},
+            {data2.data(), data2.size()},
+    };
+    ASSERT_TRUE(writer->AddRawBlocks(50, iov, std::size(iov)));
+
+    struct iovec bad_iov = {data2.data(), data2.size() - 1};
+    ASSERT_FALSE(writer->AddRawBlocks(60, &bad_iov, 1));
+
+    ASSERT_TRUE(writer->Finalize());
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    auto iter = reader.GetOpIter();
+    ASSERT_NE(iter, nullptr);
+
+    // Copies are split into clusters of 3 ops plus a cluster op.
+    size_t num_copies = 0, num_clusters = 0;
+    std::string raw;
+    while (!iter->Done()) {
+        const auto& op = iter->Get();
+        if (op.type == kCowCopyOp) {
+            ASSERT_EQ(op.new_block, 100 + num_copies);
+            ASSERT_EQ(op.source, 200 + num_copies);
+            num_copies++;
+        } else if (op.type == kCowClusterOp) {
+            num_clusters++;
+        } else if (op.type == kCowReplaceOp) {
+            ASSERT_EQ(op.new_block, 50 + raw.size() / options.block_size);
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(op, &sink));
+            raw += sink.stream();
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(num_copies, 7);
+    ASSERT_GE(num_clusters, 2);
+    ASSERT_EQ(raw, data1 + data2);
+}
+
+TEST_F(CowTest, SizeEstimate) {
+    CowOptions options;
+    options.compression = "gz";
+    options.cluster_ops = 4;
+
+    std::string data;
+    for (size_t i = 0; i < 6; i++) {
+        data.append(options.block_size, static_cast<char>('a' + i));
+    }
+
+    auto write_ops = [&](CowWriter* writer) -> void {
+        ASSERT_TRUE(writer->AddRawBlocks(50, data.data(), data.size()));
+        ASSERT_TRUE(writer->AddCopy(10, 20));
+        ASSERT_TRUE(writer->AddZeroBlocks(70, 3));
+        ASSERT_TRUE(writer->AddLabel(1));
+        ASSERT_TRUE(writer->Finalize());
+    };
+
+    CowWriter writer(options);
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+    ASSERT_NO_FATAL_FAILURE(write_ops(&writer));
+
+    CowWriter estimator(options);
+    ASSERT_TRUE(estimator.Initialize(android::base::borrowed_fd{-1}));
+    ASSERT_NO_FATAL_FAILURE(write_ops(&estimator));
+
+    struct stat s;
+    ASSERT_EQ(fstat(cow_->fd, &s), 0);
+    ASSERT_EQ(estimator.GetCowSize(), s.st_size);
+    ASSERT_EQ(writer.GetCowSize(), s.st_size);
+
+    const auto& stats = estimator.GetOpStats();
+    ASSERT_EQ(stats.by_type[kCowReplaceOp].num_ops, 6);
+    ASSERT_GT(stats.by_type[kCowReplaceOp].data_bytes, 0);
+    ASSERT_LT(stats.by_type[kCowReplaceOp].data_bytes, data.size());
+    ASSERT_EQ(stats.by_type[kCowCopyOp].num_ops, 1);
+    ASSERT_EQ(stats.by_type[kCowZeroOp].num_ops, 3);
+    ASSERT_EQ(stats.by_type[kCowLabelOp].num_ops, 1);
+    ASSERT_EQ(stats.by_type[kCowReplaceOp].data_bytes,
+              writer.GetOpStats().by_type[kCowReplaceOp].data_bytes);
+}
+
+TEST_F(CowTest, StoreIncompressibleUncompressed) {
+    std::string text = "This is a block of text that compresses well.";
+    text.resize(4096, '\0');
+
+    std::mt19937 rng(1234);
+    std::string random(4096, '\0');
+    for (auto& c : random) {
+        c = static_cast<char>(rng());
+    }
+
+    // Saves about half the block.
+    std::string half = random.substr(0, 2048);
+    half.resize(4096, '\0');
+
+    ASSERT_TRUE(CompressWorker::LooksIncompressible(random.data(), random.size()));
+    ASSERT_FALSE(CompressWorker::LooksIncompressible(text.data(), text.size()));
+    ASSERT_FALSE(CompressWorker::LooksIncompressible(half.data(), half.size()));
+
+    std::string data = text + random + half;
+    for (uint32_t threads : {0, 2}) {
+        SCOPED_TRACE(threads);
+        CowOptions options;
+        options.compression = "gz";
+        options.num_compress_threads = threads;
+        options.compression_min_savings = 60;
+
+        cow_ = std::make_unique<TemporaryFile>();
+        CowWriter writer(options);
+        ASSERT_TRUE(writer.Initialize(cow_->fd));
+        ASSERT_TRUE(writer.AddRawBlocks(10, data.data(), data.size()));
+        ASSERT_TRUE(writer.Finalize());
+
+        const auto& stats = writer.GetOpStats();
+        ASSERT_EQ(stats.num_stored_uncompressed, 2);
+        ASSERT_EQ(stats.num_skipped_incompressible, 1);
+
+        ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+        CowReader reader;
+        ASSERT_TRUE(reader.Parse(cow_->fd));
+
+        std::vector<uint8_t> compression;
+        auto iter = reader.GetOpIter();
+        while (!iter->Done()) {
+            const auto& op = iter->Get();
+            if (op.type == kCowReplaceOp) {
+                StringSink sink;
+                ASSERT_TRUE(reader.ReadData(op, &sink));
+                ASSERT_EQ(sink.stream(), data.substr((op.new_block - 10) * 4096, 4096));
+                compression.push_back(op.compression);
+            }
+            iter->Next();
+        }
+        ASSERT_EQ(compression, std::vector<uint8_t>({kCowCompressGz, kCowCompressNone,
+                                                     kCowCompressNone}));
+    }
+}
+
+TEST_F(CowTest, ScratchSpaceSize) {
+    CowOptions options;
+    options.scratch_space_size = 4 * BUFFER_REGION_DEFAULT_SIZE;
+    CowWriter writer(options);
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string data(options.block_size, 'x');
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.Finalize());
+
+    CowReader reader;
+    CowHeader header;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+    ASSERT_TRUE(reader.GetHeader(&header));
+    ASSERT_EQ(header.buffer_size, options.scratch_space_size);
+
+    auto iter = reader.GetOpIter();
+    ASSERT_FALSE(iter->Done());
+    StringSink sink;
+    ASSERT_TRUE(reader.ReadData(iter->Get(), &sink));
+    ASSERT_EQ(sink.stream(), data);
+
+    options.scratch_space_size = options.block_size + 1;
+    CowWriter bad_writer(options);
+    ASSERT_FALSE(bad_writer.Initialize(cow_->fd));
+}
+
+TEST_F(CowTest, CloneSharesParsedOps) {
+    CowOptions options;
+    CowWriter writer(options);
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string data(options.block_size * 2, 'x');
+    std::string xor_data(options.block_size, 'y');
+    ASSERT_TRUE(writer.AddCopy(10, 20));
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.AddXorBlocks(60, xor_data.data(), xor_data.size(), 24, 10));
+    ASSERT_TRUE(writer.Finalize());
+
+    CowReader reader(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+    auto clone = reader.CloneCowReader();
+    ASSERT_TRUE(clone->InitForMerge(android::base::unique_fd(dup(cow_->fd))));
+    ASSERT_EQ(clone->get_num_total_data_ops(), reader.get_num_total_data_ops());
+
+    // A failed re-parse of the original must not disturb the clone.
+    ASSERT_FALSE(reader.Parse(cow_->fd, {5}));
+
+    size_t merge_ops = 0;
+    auto iter = clone->GetMergeOpIter();
+    while (!iter->Done()) {
+        const auto& op = iter->Get();
+        if (op.type == kCowXorOp) {
+            StringSink sink;
+            ASSERT_TRUE(clone->ReadData(op, &sink));
+            ASSERT_EQ(sink.stream(), xor_data);
+        }
+        merge_ops++;
+        iter->Next();
+    }
+    ASSERT_EQ(merge_ops, 4);
+
+    // Merge progress is tracked per reader.
+    clone->UpdateMergeOpsCompleted(2);
+    CowHeader header;
+    ASSERT_TRUE(reader.GetHeader(&header));
+    ASSERT_EQ(header.num_merge_ops, 0);
+}
+
+TEST_F(CowTest, AsyncWrites) {
+    CowOptions options;
+    options.cluster_ops = 4;
+    options.async_write_depth = 4;
+    auto writer = std::make_unique<CowWriter>(options);
+    ASSERT_TRUE(writer->Initialize(cow_->fd));
+
+    std::string data;
+    for (size_t i = 0; i < 8; i++) {
+        data.append(options.block_size, static_cast<char>('a' + i));
+    }
+    ASSERT_TRUE(writer->AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer->AddLabel(1));
+    ASSERT_TRUE(writer->AddCopy(10, 20));
+    ASSERT_TRUE(writer->AddZeroBlocks(70, 5));
+    ASSERT_TRUE(writer->Finalize());
+    // Writing after Finalize overwrites the footer area.
+    ASSERT_TRUE(writer->AddCopy(11, 21));
+    ASSERT_TRUE(writer->Finalize());
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    auto iter = reader.GetOpIter();
+    ASSERT_NE(iter, nullptr);
+
+    std::string raw;
+    size_t num_copies = 0, num_zeroes = 0;
+    while (!iter->Done()) {
+        const auto& op = iter->Get();
+        if (op.type == kCowReplaceOp) {
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(op, &sink));
+            raw += sink.stream();
+        } else if (op.type == kCowCopyOp) {
+            num_copies++;
+        } else if (op.type == kCowZeroOp) {
+            num_zeroes++;
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(raw, data);
+    ASSERT_EQ(num_copies, 2);
+    ASSERT_EQ(num_zeroes, 5);
+}
+
 TEST_F(CowTest, ClusterAppendTest) {
     CowOptions options;
     options.cluster_ops = 3;
@@ -1260,6 +1854,99 @@ TEST_F(CowTest, LegacyRevMergeOpItrTest) {
     ASSERT_TRUE(iter->Done());
 }
 
+// Sink that takes data in place when the reader offers it.
+class MappedSink : public StringSink {
+  public:
+    bool AcceptMappedData(const void* data, size_t length) override {
+        mapped_ = true;
+        stream().assign(reinterpret_cast<const char*>(data), length);
+        return true;
+    }
+    bool mapped() const { return mapped_; }
+
+  private:
+    bool mapped_ = false;
+};
+
+class MmapTest : public CowTest, public testing::WithParamInterface<const char*> {};
+
+TEST_P(MmapTest, ReadWrite) {
+    CowOptions options;
+    options.compression = GetParam();
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    std::string data = "This is some data, believe it";
+    data.resize(options.block_size * 3, '\0');
+    data[options.block_size] = 'x';
+    std::string xor_data = "This is some xor data";
+    xor_data.resize(options.block_size, '\0');
+
+    ASSERT_TRUE(writer.AddCopy(10, 20));
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.AddXorBlocks(60, xor_data.data(), xor_data.size(), 24, 10));
+    ASSERT_TRUE(writer.AddZeroBlocks(70, 2));
+    ASSERT_TRUE(writer.Finalize());
+
+    CowReader reader(CowReader::ReaderFlags::USERSPACE_MERGE | CowReader::ReaderFlags::MMAP);
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    // A clone shares the mapping, even after the original is gone.
+    auto clone = reader.CloneCowReader();
+    ASSERT_TRUE(clone->InitForMerge(android::base::unique_fd(dup(cow_->fd))));
+
+    bool uncompressed = std::string(GetParam()) == "none";
+    size_t data_ops = 0;
+    auto iter = clone->GetOpIter();
+    while (!iter->Done()) {
+        const auto& op = iter->Get();
+        if (op.type == kCowReplaceOp) {
+            MappedSink sink;
+            ASSERT_TRUE(clone->ReadData(op, &sink));
+            ASSERT_EQ(sink.mapped(), uncompressed);
+            size_t offset = (op.new_block - 50) * options.block_size;
+            ASSERT_EQ(sink.stream(), data.substr(offset, options.block_size));
+            data_ops++;
+        } else if (op.type == kCowXorOp) {
+            HorribleStringSink sink;
+            ASSERT_TRUE(clone->ReadData(op, &sink));
+            ASSERT_EQ(sink.stream(), xor_data);
+            data_ops++;
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(data_ops, 4);
+
+    size_t merge_ops = 0;
+    auto merge_iter = clone->GetMergeOpIter();
+    while (!merge_iter->Done()) {
+        merge_ops++;
+        merge_iter->Next();
+    }
+    ASSERT_EQ(merge_ops, 7);
+}
+
+INSTANTIATE_TEST_SUITE_P(CowApi, MmapTest, testing::Values("none", "gz", "lz4"));
+
+TEST(SortedBlockMapTest, FirstValueWins) {
+    SortedBlockMap<uint32_t, uint32_t> map;
+    map.Add(30, 1);
+    map.Add(10, 2);
+    map.Add(20, 3);
+    map.Add(10, 4);
+    map.Finalize();
+
+    ASSERT_EQ(map.size(), 3);
+    ASSERT_NE(map.Find(10), nullptr);
+    ASSERT_EQ(*map.Find(10), 2);
+    ASSERT_EQ(*map.Find(20), 3);
+    ASSERT_EQ(*map.Find(30), 1);
+    ASSERT_EQ(map.Find(0), nullptr);
+    ASSERT_EQ(map.Find(15), nullptr);
+    ASSERT_EQ(map.Find(40), nullptr);
+}
+
 TEST_F(CowTest, InvalidMergeOrderTest) {
     CowOptions options;
     options.cluster_ops = 5;
@@ -0,0 +1,211 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+#include <libsnapshot/cow_reader.h>
+#include <libsnapshot/cow_writer.h>
+
+namespace android {
+namespace snapshot {
+
+using android::base::borrowed_fd;
+
+static constexpr uint32_t kBlockSize = 4096;
+static constexpr size_t kCorpusBlocks = 2048;
+static const char* const kCompressions[] = {"none", "gz", "brotli", "lz4", "zstd"};
+static constexpr int kNumCompressions = sizeof(kCompressions) / sizeof(kCompressions[0]);
+
+// A mix of block types, in roughly the proportions a system image has:
+// incompressible data, text, mostly empty metadata and low-entropy code.
+static std::string MakeSyntheticCorpus() {
+    static const char* const kWords[] = {"android", "system", "vendor", "partition",
+                                         "snapshot", "update", "merge", "block"};
+    std::mt19937 rng(0);
+    std::string corpus(kCorpusBlocks * kBlockSize, '\0');
+    for (size_t i = 0; i < kCorpusBlocks; i++) {
+        char* block = corpus.data() + i * kBlockSize;
+        switch (i % 4) {
+            case 0:
+                for (size_t j = 0; j < kBlockSize; j++) block[j] = rng();
+                break;
+            case 1: {
+                std::string text;
+                while (text.size() < kBlockSize) {
+                    text += kWords[rng() % 8];
+                    text += ' ';
+                }
+                memcpy(block, text.data(), kBlockSize);
+                break;
+            }
+            case 2:
+                for (size_t j = 0; j < 64; j++) block[rng() % kBlockSize] = rng();
+                break;
+            case 3:
+                for (size_t j = 0; j < kBlockSize; j++) block[j] = rng() % 16;
+                break;
+        }
+    }
+    return corpus;
+}
+
+// The blocks every benchmark writes. Set COW_BENCHMARK_IMAGE to the path of
+// a partition image to use its first blocks instead of synthetic data.
+static const std::string& Corpus() {
+    static const std::string corpus = [] {
+        const char* path = getenv("COW_BENCHMARK_IMAGE");
+        if (path) {
+            std::string image;
+            if (android::base::ReadFileToString(path, &image) && image.size() >= kBlockSize) {
+                image.resize(std::min<size_t>(image.size(), kCorpusBlocks * kBlockSize) /
+                             kBlockSize * kBlockSize);
+                return image;
+            }
+            fprintf(stderr, "Could not read %s, using synthetic data\n", path);
+        }
+        return MakeSyntheticCorpus();
+    }();
+    return corpus;
+}
+
+static bool WriteCorpus(const CowOptions& options, borrowed_fd fd) {
+    const auto& corpus = Corpus();
+    CowWriter writer(options);
+    return writer.Initialize(fd) && writer.AddRawBlocks(0, corpus.data(), corpus.size()) &&
+           writer.Finalize();
+}
+
+// Sink that decompresses into the same block buffer over and over.
+class BlockSink : public IByteSink {
+  public:
+    void* GetBuffer(size_t requested, size_t* actual) override {
+        if (requested > buffer_.size()) {
+            buffer_.resize(requested);
+        }
+        *actual = requested;
+        return buffer_.data();
+    }
+    bool ReturnData(void*, size_t) override { return true; }
+
+  private:
+    std::vector<uint8_t> buffer_ = std::vector<uint8_t>(kBlockSize);
+};
+
+// Args: compression, cluster_ops.
+static void BM_CowWriter(benchmark::State& state) {
+    CowOptions options;
+    options.compression = kCompressions[state.range(0)];
+    options.cluster_ops = state.range(1);
+    state.SetLabel(options.compression);
+
+    TemporaryFile cow;
+    for (auto _ : state) {
+        if (ftruncate(cow.fd, 0) < 0 || !WriteCorpus(options, cow.fd)) {
+            state.SkipWithError("Could not write COW");
+            return;
+        }
+    }
+
+    struct stat st;
+    if (fstat(cow.fd, &st) == 0) {
+        state.counters["ratio"] = double(st.st_size) / Corpus().size();
+    }
+    state.SetBytesProcessed(state.iterations() * Corpus().size());
+}
+BENCHMARK(BM_CowWriter)->ArgsProduct({benchmark::CreateDenseRange(0, kNumCompressions - 1, 1),
+                                      {0, 200, 1024}});
+
+// Args: number of ops.
+static void BM_CowParse(benchmark::State& state) {
+    const uint64_t num_ops = state.range(0);
+
+    TemporaryFile cow;
+    {
+        CowOptions options;
+        CowWriter writer(options);
+        if (!writer.Initialize(borrowed_fd(cow.fd))) {
+            state.SkipWithError("Could not create COW");
+            return;
+        }
+        for (uint64_t i = 0; i < num_ops; i++) {
+            if (!writer.AddCopy(i, num_ops + i)) {
+                state.SkipWithError("Could not add copy op");
+                return;
+            }
+        }
+        if (!writer.Finalize()) {
+            state.SkipWithError("Could not finalize COW");
+            return;
+        }
+    }
+
+    for (auto _ : state) {
+        CowReader reader;
+        if (!reader.Parse(borrowed_fd(cow.fd))) {
+            state.SkipWithError("Could not parse COW");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * num_ops);
+}
+BENCHMARK(BM_CowParse)->RangeMultiplier(8)->Range(1 << 10, 1 << 19)->Unit(benchmark::kMillisecond);
+
+// Args: compression.
+static void BM_CowReadData(benchmark::State& state) {
+    CowOptions options;
+    options.compression = kCompressions[state.range(0)];
+    state.SetLabel(options.compression);
+
+    TemporaryFile cow;
+    CowReader reader;
+    if (!WriteCorpus(options, cow.fd) || !reader.Parse(borrowed_fd(cow.fd))) {
+        state.SkipWithError("Could not create COW");
+        return;
+    }
+
+    std::vector<const CowOperation*> ops;
+    for (auto iter = reader.GetOpIter(); !iter->Done(); iter->Next()) {
+        if (iter->Get().type == kCowReplaceOp) {
+            ops.emplace_back(&iter->Get());
+        }
+    }
+
+    BlockSink sink;
+    for (auto _ : state) {
+        for (const auto op : ops) {
+            if (!reader.ReadData(*op, &sink)) {
+                state.SkipWithError("Could not read data");
+                return;
+            }
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * ops.size() * kBlockSize);
+}
+BENCHMARK(BM_CowReadData)->DenseRange(0, kNumCompressions - 1, 1);
+
+}  // namespace snapshot
+}  // namespace android
+
+BENCHMARK_MAIN();
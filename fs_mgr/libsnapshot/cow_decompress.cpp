@@ -16,11 +16,16 @@
 
 #include "cow_decompress.h"
 
+#include <string.h>
+
+#include <string>
 #include <utility>
 
 #include <android-base/logging.h>
 #include <brotli/decode.h>
+#include <lz4.h>
 #include <zlib.h>
+#include <zstd.h>
 
 namespace android {
 namespace snapshot {
@@ -260,5 +265,178 @@ std::unique_ptr<IDecompressor> IDecompressor::Brotli() {
     return std::unique_ptr<IDecompressor>(new BrotliDecompressor());
 }
 
+class ZstdDecompressor final : public StreamDecompressor {
+  public:
+    ~ZstdDecompressor();
+
+    bool Init() override;
+    bool DecompressInput(const uint8_t* data, size_t length) override;
+    bool Done() override { return ended_; }
+
+  private:
+    ZSTD_DStream* dstream_ = nullptr;
+    size_t output_produced_ = 0;
+    bool ended_ = false;
+};
+
+bool ZstdDecompressor::Init() {
+    dstream_ = ZSTD_createDStream();
+    if (!dstream_) {
+        LOG(ERROR) << "ZSTD_createDStream failed";
+        return false;
+    }
+    if (auto rv = ZSTD_initDStream(dstream_); ZSTD_isError(rv)) {
+        LOG(ERROR) << "ZSTD_initDStream failed: " << ZSTD_getErrorName(rv);
+        return false;
+    }
+    return true;
+}
+
+ZstdDecompressor::~ZstdDecompressor() {
+    if (dstream_) {
+        ZSTD_freeDStream(dstream_);
+    }
+}
+
+bool ZstdDecompressor::DecompressInput(const uint8_t* data, size_t length) {
+    ZSTD_inBuffer in = {data, length, 0};
+
+    bool needs_more_output = false;
+    while (in.pos < in.size || needs_more_output) {
+        // Only ask the sink for more space while output is still expected, so
+        // that a frame epilogue does not grow the sink past |output_bytes_|.
+        if (!output_buffer_remaining_ && output_produced_ < output_bytes_ && !GetFreshBuffer()) {
+            return false;
+        }
+
+        ZSTD_outBuffer out = {output_buffer_, output_buffer_remaining_, 0};
+        size_t in_pos = in.pos;
+        auto rv = ZSTD_decompressStream(dstream_, &out, &in);
+        if (ZSTD_isError(rv)) {
+            LOG(ERROR) << "zstd decode failed: " << ZSTD_getErrorName(rv);
+            return false;
+        }
+        if (!out.size && in.pos == in_pos && rv != 0) {
+            LOG(ERROR) << "zstd stream has more data than expected";
+            return false;
+        }
+        if (!sink_->ReturnData(output_buffer_, out.pos)) {
+            LOG(ERROR) << "Could not return buffer to sink";
+            return false;
+        }
+        output_buffer_ += out.pos;
+        output_buffer_remaining_ -= out.pos;
+        output_produced_ += out.pos;
+
+        if (rv == 0) {
+            if (in.pos < in.size) {
+                LOG(ERROR) << "zstd stream ended prematurely";
+                return false;
+            }
+            ended_ = true;
+            return true;
+        }
+        // A full output buffer may hold back data that is still buffered
+        // inside the decoder.
+        needs_more_output = (out.size && out.pos == out.size);
+    }
+    return true;
+}
+
+std::unique_ptr<IDecompressor> IDecompressor::Zstd() {
+    return std::unique_ptr<IDecompressor>(new ZstdDecompressor());
+}
+
+// LZ4 block format has no streaming decoder, so the whole compressed block is
+// read in and decoded in a single call.
+class Lz4Decompressor final : public IDecompressor {
+  public:
+    bool Decompress(size_t output_bytes) override;
+
+  private:
+    bool ReadInput(std::string* input);
+};
+
+bool Lz4Decompressor::ReadInput(std::string* input) {
+    input->resize(stream_->Size());
+
+    size_t offset = 0;
+    while (offset < input->size()) {
+        size_t read;
+        if (!stream_->Read(input->data() + offset, input->size() - offset, &read)) {
+            return false;
+        }
+        if (!read) {
+            LOG(ERROR) << "Stream ended prematurely";
+            return false;
+        }
+        offset += read;
+    }
+    return true;
+}
+
+bool Lz4Decompressor::Decompress(size_t output_bytes) {
+    std::string input;
+    if (!ReadInput(&input)) {
+        return false;
+    }
+
+    size_t buffer_size = 0;
+    auto buffer = reinterpret_cast<char*>(sink_->GetBuffer(output_bytes, &buffer_size));
+    if (!buffer) {
+        LOG(ERROR) << "Could not acquire buffer from sink";
+        return false;
+    }
+
+    // Decode straight into the sink when it can hold the whole block;
+    // otherwise decode to a temporary buffer and hand it out piecemeal.
+    std::string decoded;
+    char* output = buffer;
+    if (buffer_size < output_bytes) {
+        decoded.resize(output_bytes);
+        output = decoded.data();
+    }
+
+    int rv = LZ4_decompress_safe(input.data(), output, input.size(), output_bytes);
+    if (rv < 0 || static_cast<size_t>(rv) != output_bytes) {
+        LOG(ERROR) << "LZ4_decompress_safe failed, expected " << output_bytes
+                   << " bytes, returned " << rv;
+        return false;
+    }
+
+    if (decoded.empty()) {
+        if (!sink_->ReturnData(buffer, output_bytes)) {
+            LOG(ERROR) << "Could not return buffer to sink";
+            return false;
+        }
+        return true;
+    }
+
+    size_t offset = 0;
+    while (true) {
+        size_t to_copy = std::min(buffer_size, output_bytes - offset);
+        memcpy(buffer, decoded.data() + offset, to_copy);
+        if (!sink_->ReturnData(buffer, to_copy)) {
+            LOG(ERROR) << "Could not return buffer to sink";
+            return false;
+        }
+        offset += to_copy;
+        if (offset == output_bytes) {
+            break;
+        }
+
+        buffer = reinterpret_cast<char*>(sink_->GetBuffer(output_bytes - offset, &buffer_size));
+        if (!buffer || !buffer_size) {
+            LOG(ERROR) << "Could not acquire buffer from sink";
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unique_ptr<IDecompressor> IDecompressor::Lz4() {
+    return std::unique_ptr<IDecompressor>(new Lz4Decompressor());
+}
+
 }  // namespace snapshot
 }  // namespace android
@@ -52,6 +52,10 @@ std::ostream& operator<<(std::ostream& os, CowOperation const& op) {
         os << "kCowCompressGz,     ";
     else if (op.compression == kCowCompressBrotli)
         os << "kCowCompressBrotli, ";
+    else if (op.compression == kCowCompressLz4)
+        os << "kCowCompressLz4,    ";
+    else if (op.compression == kCowCompressZstd)
+        os << "kCowCompressZstd,   ";
     else
         os << (int)op.compression << "?, ";
     os << "data_length:" << op.data_length << ",\t";
@@ -59,15 +63,70 @@ std::ostream& operator<<(std::ostream& os, CowOperation const& op) {
     os << "source:" << op.source;
     if (op.type == kCowXorOp)
         os << " (block:" << op.source / BLOCK_SZ << " offset:" << op.source % BLOCK_SZ << ")";
+    if (op.type == kCowReplaceOp && GetCowOpExtentBlocks(op) > 1)
+        os << " (offset:" << GetCowOpSourceOffset(op) << " length:" << GetCowOpDataLength(op)
+           << " extent:" << GetCowOpExtentIndex(op) << "/" << GetCowOpExtentBlocks(op) << ")";
+    if (IsCowOpDataShared(op)) os << " (shared)";
     os << ")";
     return os;
 }
 
+uint64_t GetCowOpSourceOffset(const CowOperation& op) {
+    if (op.type != kCowReplaceOp) {
+        return op.source;
+    }
+    return op.source & kCowOpSourceOffsetMask;
+}
+
+uint32_t GetCowOpDataLength(const CowOperation& op) {
+    if (op.type != kCowReplaceOp) {
+        return op.data_length;
+    }
+    uint32_t high = (op.source >> kCowExtentLengthShift) & kCowExtentLengthMask;
+    return (high << 16) | op.data_length;
+}
+
+uint32_t GetCowOpExtentBlocks(const CowOperation& op) {
+    if (op.type != kCowReplaceOp) {
+        return 1;
+    }
+    return ((op.source >> kCowExtentBlocksShift) & kCowExtentCountMask) + 1;
+}
+
+uint32_t GetCowOpExtentIndex(const CowOperation& op) {
+    if (op.type != kCowReplaceOp) {
+        return 0;
+    }
+    return (op.source >> kCowExtentIndexShift) & kCowExtentCountMask;
+}
+
+bool IsCowOpDataShared(const CowOperation& op) {
+    return op.type == kCowReplaceOp && (op.source & kCowOpSharedDataFlag);
+}
+
+uint32_t GetCowOpStoredDataLength(const CowOperation& op) {
+    return IsCowOpDataShared(op) ? 0 : GetCowOpDataLength(op);
+}
+
+void SetCowOpExtent(CowOperation* op, uint64_t data_pos, uint32_t data_length, uint32_t num_blocks,
+                    uint32_t index) {
+    CHECK(data_pos <= kCowOpSourceOffsetMask);
+    CHECK(data_length <= kCowMaxExtentDataLength);
+    CHECK(num_blocks >= 1 && num_blocks <= kCowMaxExtentBlocks);
+    CHECK(index < num_blocks);
+
+    op->data_length = static_cast<uint16_t>(data_length & 0xffff);
+    op->source = data_pos;
+    op->source |= static_cast<uint64_t>(data_length >> 16) << kCowExtentLengthShift;
+    op->source |= static_cast<uint64_t>(num_blocks - 1) << kCowExtentBlocksShift;
+    op->source |= static_cast<uint64_t>(index) << kCowExtentIndexShift;
+}
+
 int64_t GetNextOpOffset(const CowOperation& op, uint32_t cluster_ops) {
     if (op.type == kCowClusterOp) {
         return op.source;
     } else if ((op.type == kCowReplaceOp || op.type == kCowXorOp) && cluster_ops == 0) {
-        return op.data_length;
+        return GetCowOpStoredDataLength(op);
     } else {
         return 0;
     }
@@ -14,6 +14,8 @@
 // limitations under the License.
 //
 
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -38,36 +40,44 @@ CowReader::CowReader(ReaderFlags reader_flag)
     : fd_(-1),
       header_(),
       fd_size_(0),
-      merge_op_blocks_(std::make_shared<std::vector<uint32_t>>()),
+      image_(std::make_shared<CowImage>()),
       reader_flag_(reader_flag) {}
 
-static void SHA256(const void*, size_t, uint8_t[]) {
-#if 0
-    SHA256_CTX c;
-    SHA256_Init(&c);
-    SHA256_Update(&c, data, length);
-    SHA256_Final(out, &c);
-#endif
-}
-
 std::unique_ptr<CowReader> CowReader::CloneCowReader() {
-    auto cow = std::make_unique<CowReader>();
+    auto cow = std::make_unique<CowReader>(reader_flag_);
     cow->owned_fd_.reset();
     cow->header_ = header_;
-    cow->footer_ = footer_;
     cow->fd_size_ = fd_size_;
-    cow->last_label_ = last_label_;
-    cow->ops_ = ops_;
-    cow->merge_op_blocks_ = merge_op_blocks_;
+    cow->image_ = image_;
     cow->merge_op_start_ = merge_op_start_;
-    cow->block_map_ = block_map_;
-    cow->num_total_data_ops_ = num_total_data_ops_;
-    cow->num_ordered_ops_to_merge_ = num_ordered_ops_to_merge_;
-    cow->has_seq_ops_ = has_seq_ops_;
-    cow->data_loc_ = data_loc_;
+    cow->mapped_cow_ = mapped_cow_;
     return cow;
 }
 
+bool CowReader::MapCow() {
+    if (!HasFlag(ReaderFlags::MMAP) || mapped_cow_) {
+        return true;
+    }
+    mapped_cow_ = android::base::MappedFile::FromFd(fd_, 0, fd_size_, PROT_READ);
+    if (!mapped_cow_) {
+        PLOG(ERROR) << "Failed to mmap COW of size " << fd_size_;
+        return false;
+    }
+    return true;
+}
+
+bool CowReader::ReadAt(uint64_t offset, void* buffer, size_t len) {
+    if (!mapped_cow_) {
+        return android::base::ReadFullyAtOffset(fd_, buffer, len, offset);
+    }
+    if (offset > mapped_cow_->size() || len > mapped_cow_->size() - offset) {
+        LOG(ERROR) << "Read of " << len << " bytes at " << offset << " is past the end of the COW";
+        return false;
+    }
+    memcpy(buffer, mapped_cow_->data() + offset, len);
+    return true;
+}
+
 bool CowReader::InitForMerge(android::base::unique_fd&& fd) {
     owned_fd_ = std::move(fd);
     fd_ = owned_fd_.get();
@@ -88,7 +98,7 @@ bool CowReader::InitForMerge(android::base::unique_fd&& fd) {
         return false;
     }
 
-    return true;
+    return MapCow();
 }
 
 bool CowReader::Parse(android::base::unique_fd&& fd, std::optional<uint64_t> label) {
@@ -115,6 +125,10 @@ bool CowReader::Parse(android::base::borrowed_fd fd, std::optional<uint64_t> lab
         return false;
     }
 
+    if (!MapCow()) {
+        return false;
+    }
+
     if (header_.magic != kCowMagicNumber) {
         LOG(ERROR) << "Header Magic corrupted. Magic: " << header_.magic
                    << "Expected: " << kCowMagicNumber;
@@ -144,26 +158,30 @@ bool CowReader::Parse(android::base::borrowed_fd fd, std::optional<uint64_t> lab
         return false;
     }
 
-    if ((header_.major_version > kCowVersionMajor) || (header_.minor_version != kCowVersionMinor)) {
+    if ((header_.major_version > kCowVersionMajor) ||
+        (header_.minor_version > kCowVersionMinorSharedData)) {
         LOG(ERROR) << "Header version mismatch";
         LOG(ERROR) << "Major version: " << header_.major_version
                    << "Expected: " << kCowVersionMajor;
         LOG(ERROR) << "Minor version: " << header_.minor_version
-                   << "Expected: " << kCowVersionMinor;
+                   << "Expected: " << kCowVersionMinorSharedData;
         return false;
     }
 
-    if (!ParseOps(label)) {
+    auto image = std::make_shared<CowImage>();
+    if (!ParseOps(image.get(), label)) {
         return false;
     }
     // If we're resuming a write, we're not ready to merge
-    if (label.has_value()) return true;
-    return PrepMergeOps();
+    if (!label.has_value() && !PrepMergeOps(image.get())) {
+        return false;
+    }
+    image_ = std::move(image);
+    return true;
 }
 
-bool CowReader::ParseOps(std::optional<uint64_t> label) {
+bool CowReader::ParseOps(CowImage* image, std::optional<uint64_t> label) {
     uint64_t pos;
-    auto data_loc = std::make_shared<std::unordered_map<uint64_t, uint64_t>>();
 
     // Skip the scratch space
     if (header_.major_version >= 2 && (header_.buffer_size > 0)) {
@@ -191,6 +209,17 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
         data_pos = pos + sizeof(CowOperation);
     }
 
+    // Resuming a write has to walk every cluster up to the label, and each
+    // cluster read depends on the one before it. Without a footer there is no
+    // index to jump to, so ask the kernel to read ahead aggressively rather
+    // than stalling on one small read per cluster.
+    if (label && !mapped_cow_) {
+        int rv = posix_fadvise(fd_.get(), pos, 0, POSIX_FADV_SEQUENTIAL);
+        if (rv) {
+            LOG(WARNING) << "posix_fadvise failed: " << strerror(rv);
+        }
+    }
+
     auto ops_buffer = std::make_shared<std::vector<CowOperation>>();
     uint64_t current_op_num = 0;
     uint64_t cluster_ops = header_.cluster_ops ?: 1;
@@ -201,8 +230,7 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
         uint64_t to_add = std::min(cluster_ops, (fd_size_ - pos) / sizeof(CowOperation));
         if (to_add == 0) break;
         ops_buffer->resize(current_op_num + to_add);
-        if (!android::base::ReadFully(fd_, &ops_buffer->data()[current_op_num],
-                                      to_add * sizeof(CowOperation))) {
+        if (!ReadAt(pos, &ops_buffer->data()[current_op_num], to_add * sizeof(CowOperation))) {
             PLOG(ERROR) << "read op failed";
             return false;
         }
@@ -211,15 +239,16 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
             auto& current_op = ops_buffer->data()[current_op_num];
             current_op_num++;
             if (current_op.type == kCowXorOp) {
-                data_loc->insert({current_op.new_block, data_pos});
+                image->data_loc.Add(current_op.new_block, data_pos);
             }
             pos += sizeof(CowOperation) + GetNextOpOffset(current_op, header_.cluster_ops);
-            data_pos += current_op.data_length + GetNextDataOffset(current_op, header_.cluster_ops);
+            data_pos += GetCowOpStoredDataLength(current_op) +
+                        GetNextDataOffset(current_op, header_.cluster_ops);
 
             if (current_op.type == kCowClusterOp) {
                 break;
             } else if (current_op.type == kCowLabelOp) {
-                last_label_ = {current_op.source};
+                image->last_label = {current_op.source};
 
                 // If we reach the requested label, stop reading.
                 if (label && label.value() == current_op.source) {
@@ -227,15 +256,15 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
                     break;
                 }
             } else if (current_op.type == kCowFooterOp) {
-                footer_.emplace();
-                CowFooter* footer = &footer_.value();
-                memcpy(&footer_->op, &current_op, sizeof(footer->op));
+                image->footer.emplace();
+                CowFooter* footer = &image->footer.value();
+                memcpy(&footer->op, &current_op, sizeof(footer->op));
                 off_t offs = lseek(fd_.get(), pos, SEEK_SET);
                 if (offs < 0 || pos != static_cast<uint64_t>(offs)) {
                     PLOG(ERROR) << "lseek next op failed " << offs;
                     return false;
                 }
-                if (!android::base::ReadFully(fd_, &footer->data, sizeof(footer->data))) {
+                if (!ReadAt(pos, &footer->data, sizeof(footer->data))) {
                     LOG(ERROR) << "Could not read COW footer";
                     return false;
                 }
@@ -245,7 +274,7 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
                 done = true;
                 break;
             } else if (current_op.type == kCowSequenceOp) {
-                has_seq_ops_ = true;
+                image->has_seq_ops = true;
             }
         }
 
@@ -263,53 +292,87 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
     //  (1) a label to read up to, and for that label to be found, or
     //  (2) a valid footer.
     if (label) {
-        if (!last_label_) {
+        if (!image->last_label) {
             LOG(ERROR) << "Did not find label " << label.value()
                        << " while reading COW (no labels found)";
             return false;
         }
-        if (last_label_.value() != label.value()) {
+        if (image->last_label.value() != label.value()) {
             LOG(ERROR) << "Did not find label " << label.value()
-                       << ", last label=" << last_label_.value();
+                       << ", last label=" << image->last_label.value();
             return false;
         }
-    } else if (!footer_) {
+    } else if (!image->footer) {
         LOG(ERROR) << "No COW footer found";
         return false;
     }
 
-    uint8_t csum[32];
-    memset(csum, 0, sizeof(uint8_t) * 32);
-
-    if (footer_) {
-        if (ops_buffer->size() != footer_->op.num_ops) {
-            LOG(ERROR) << "num ops does not match, expected " << footer_->op.num_ops << ", found "
+    if (image->footer) {
+        if (ops_buffer->size() != image->footer->op.num_ops) {
+            LOG(ERROR) << "num ops does not match, expected " << image->footer->op.num_ops << ", found "
                        << ops_buffer->size();
             return false;
         }
-        if (ops_buffer->size() * sizeof(CowOperation) != footer_->op.ops_size) {
+        if (ops_buffer->size() * sizeof(CowOperation) != image->footer->op.ops_size) {
             LOG(ERROR) << "ops size does not match ";
             return false;
         }
-        SHA256(&footer_->op, sizeof(footer_->op), footer_->data.footer_checksum);
-        if (memcmp(csum, footer_->data.ops_checksum, sizeof(csum)) != 0) {
-            LOG(ERROR) << "ops checksum does not match";
-            return false;
-        }
-        SHA256(ops_buffer->data(), footer_->op.ops_size, csum);
-        if (memcmp(csum, footer_->data.ops_checksum, sizeof(csum)) != 0) {
+        // The writer no longer computes an ops checksum and leaves the field
+        // zeroed, so there is nothing to hash here; the op count and size
+        // checks above are what guard the ops region. Reject footers with a
+        // non-zero checksum since they were not produced by this writer.
+        static constexpr uint8_t kZeroChecksum[sizeof(CowFooterData::ops_checksum)] = {};
+        if (memcmp(kZeroChecksum, image->footer->data.ops_checksum, sizeof(kZeroChecksum)) != 0) {
             LOG(ERROR) << "ops checksum does not match";
             return false;
         }
     }
 
-    ops_ = ops_buffer;
-    ops_->shrink_to_fit();
-    data_loc_ = data_loc;
+    if (header_.minor_version >= kCowVersionMinorExtents) {
+        ExpandExtentOps(&ops_buffer);
+    }
+
+    ops_buffer->shrink_to_fit();
+    image->ops = ops_buffer;
+    image->data_loc.Finalize();
 
     return true;
 }
 
+// Replace one op per multi-block extent with one op per block, so that the
+// rest of the stack (merge ordering, snapuserd) keeps working on blocks.
+void CowReader::ExpandExtentOps(std::shared_ptr<std::vector<CowOperation>>* ops) {
+    size_t extra_ops = 0;
+    for (const auto& op : **ops) {
+        if (op.type == kCowReplaceOp) {
+            extra_ops += GetCowOpExtentBlocks(op) - 1;
+        }
+    }
+    if (!extra_ops) {
+        return;
+    }
+
+    auto expanded = std::make_shared<std::vector<CowOperation>>();
+    expanded->reserve((*ops)->size() + extra_ops);
+    for (const auto& op : **ops) {
+        uint32_t num_blocks = GetCowOpExtentBlocks(op);
+        if (op.type != kCowReplaceOp || num_blocks == 1) {
+            expanded->emplace_back(op);
+            continue;
+        }
+        for (uint32_t i = 0; i < num_blocks; i++) {
+            CowOperation block_op = op;
+            block_op.new_block = op.new_block + i;
+            SetCowOpExtent(&block_op, GetCowOpSourceOffset(op), GetCowOpDataLength(op), num_blocks,
+                           i);
+            block_op.source |= op.source & kCowOpSharedDataFlag;
+            expanded->emplace_back(block_op);
+        }
+    }
+    LOG(DEBUG) << "Expanded " << (*ops)->size() << " ops into " << expanded->size() << " ops";
+    *ops = std::move(expanded);
+}
+
 //
 // This sets up the data needed for MergeOpIter. MergeOpIter presents
 // data in the order we intend to merge in.
@@ -414,16 +477,18 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
 // Merge-2 - Batch-merge {Replace-op-7, Replace-op-6, Zero-op-8,
 //                        Replace-op-4, Zero-op-9, Replace-op-5 }
 //==============================================================
-bool CowReader::PrepMergeOps() {
+bool CowReader::PrepMergeOps(CowImage* image) {
     auto merge_op_blocks = std::make_shared<std::vector<uint32_t>>();
     std::vector<int> other_ops;
     auto seq_ops_set = std::unordered_set<uint32_t>();
-    auto block_map = std::make_shared<std::unordered_map<uint32_t, int>>();
+    // Only needed to resolve blocks to ops; dropped once merge order is known.
+    SortedBlockMap<uint32_t, uint32_t> block_map;
+    block_map.Reserve(image->ops->size());
     size_t num_seqs = 0;
     size_t read;
 
-    for (size_t i = 0; i < ops_->size(); i++) {
-        auto& current_op = ops_->data()[i];
+    for (size_t i = 0; i < image->ops->size(); i++) {
+        auto& current_op = image->ops->data()[i];
 
         if (current_op.type == kCowSequenceOp) {
             size_t seq_len = current_op.data_length / sizeof(uint32_t);
@@ -444,24 +509,26 @@ bool CowReader::PrepMergeOps() {
             continue;
         }
 
-        if (!has_seq_ops_ && IsOrderedOp(current_op)) {
+        if (!image->has_seq_ops && IsOrderedOp(current_op)) {
             merge_op_blocks->emplace_back(current_op.new_block);
         } else if (seq_ops_set.count(current_op.new_block) == 0) {
             other_ops.push_back(current_op.new_block);
         }
-        block_map->insert({current_op.new_block, i});
+        block_map.Add(current_op.new_block, i);
     }
+    block_map.Finalize();
+
     for (auto block : *merge_op_blocks) {
-        if (block_map->count(block) == 0) {
+        if (!block_map.Find(block)) {
             LOG(ERROR) << "Invalid Sequence Ops. Could not find Cow Op for new block " << block;
             return false;
         }
     }
 
     if (merge_op_blocks->size() > header_.num_merge_ops) {
-        num_ordered_ops_to_merge_ = merge_op_blocks->size() - header_.num_merge_ops;
+        image->num_ordered_ops_to_merge = merge_op_blocks->size() - header_.num_merge_ops;
     } else {
-        num_ordered_ops_to_merge_ = 0;
+        image->num_ordered_ops_to_merge = 0;
     }
 
     // Sort the vector in increasing order if merging in user-space as
@@ -469,7 +536,7 @@ bool CowReader::PrepMergeOps() {
     //
     // dm-snapshot-merge requires decreasing order as we iterate the blocks
     // in reverse order.
-    if (reader_flag_ == ReaderFlags::USERSPACE_MERGE) {
+    if (HasFlag(ReaderFlags::USERSPACE_MERGE)) {
         std::sort(other_ops.begin(), other_ops.end());
     } else {
         std::sort(other_ops.begin(), other_ops.end(), std::greater<int>());
@@ -477,13 +544,19 @@ bool CowReader::PrepMergeOps() {
 
     merge_op_blocks->insert(merge_op_blocks->end(), other_ops.begin(), other_ops.end());
 
-    num_total_data_ops_ = merge_op_blocks->size();
+    // Resolve each block to its op in place, so the merge iterators can index
+    // ops directly.
+    for (auto& entry : *merge_op_blocks) {
+        entry = *block_map.Find(entry);
+    }
+    merge_op_blocks->shrink_to_fit();
+
+    image->num_total_data_ops = merge_op_blocks->size();
     if (header_.num_merge_ops > 0) {
         merge_op_start_ = header_.num_merge_ops;
     }
 
-    block_map_ = block_map;
-    merge_op_blocks_ = merge_op_blocks;
+    image->merge_op_indices = merge_op_blocks;
     return true;
 }
 
@@ -531,20 +604,20 @@ bool CowReader::GetHeader(CowHeader* header) {
 }
 
 bool CowReader::GetFooter(CowFooter* footer) {
-    if (!footer_) return false;
-    *footer = footer_.value();
+    if (!image_->footer) return false;
+    *footer = image_->footer.value();
     return true;
 }
 
 bool CowReader::GetLastLabel(uint64_t* label) {
-    if (!last_label_) return false;
-    *label = last_label_.value();
+    if (!image_->last_label) return false;
+    *label = image_->last_label.value();
     return true;
 }
 
 class CowOpIter final : public ICowOpIter {
   public:
-    CowOpIter(std::shared_ptr<std::vector<CowOperation>>& ops);
+    CowOpIter(const std::shared_ptr<std::vector<CowOperation>>& ops);
 
     bool Done() override;
     const CowOperation& Get() override;
@@ -558,7 +631,7 @@ class CowOpIter final : public ICowOpIter {
     std::vector<CowOperation>::iterator op_iter_;
 };
 
-CowOpIter::CowOpIter(std::shared_ptr<std::vector<CowOperation>>& ops) {
+CowOpIter::CowOpIter(const std::shared_ptr<std::vector<CowOperation>>& ops) {
     ops_ = ops;
     op_iter_ = ops_->begin();
 }
@@ -589,8 +662,7 @@ const CowOperation& CowOpIter::Get() {
 class CowRevMergeOpIter final : public ICowOpIter {
   public:
     explicit CowRevMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
-                               std::shared_ptr<std::vector<uint32_t>> merge_op_blocks,
-                               std::shared_ptr<std::unordered_map<uint32_t, int>> map,
+                               std::shared_ptr<std::vector<uint32_t>> merge_op_indices,
                                uint64_t start);
 
     bool Done() override;
@@ -602,17 +674,16 @@ class CowRevMergeOpIter final : public ICowOpIter {
 
   private:
     std::shared_ptr<std::vector<CowOperation>> ops_;
-    std::shared_ptr<std::vector<uint32_t>> merge_op_blocks_;
-    std::shared_ptr<std::unordered_map<uint32_t, int>> map_;
-    std::vector<uint32_t>::reverse_iterator block_riter_;
+    std::shared_ptr<std::vector<uint32_t>> merge_op_indices_;
+    std::vector<uint32_t>::reverse_iterator index_riter_;
     uint64_t start_;
 };
 
 class CowMergeOpIter final : public ICowOpIter {
   public:
     explicit CowMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
-                            std::shared_ptr<std::vector<uint32_t>> merge_op_blocks,
-                            std::shared_ptr<std::unordered_map<uint32_t, int>> map, uint64_t start);
+                            std::shared_ptr<std::vector<uint32_t>> merge_op_indices,
+                            uint64_t start);
 
     bool Done() override;
     const CowOperation& Get() override;
@@ -623,93 +694,88 @@ class CowMergeOpIter final : public ICowOpIter {
 
   private:
     std::shared_ptr<std::vector<CowOperation>> ops_;
-    std::shared_ptr<std::vector<uint32_t>> merge_op_blocks_;
-    std::shared_ptr<std::unordered_map<uint32_t, int>> map_;
-    std::vector<uint32_t>::iterator block_iter_;
+    std::shared_ptr<std::vector<uint32_t>> merge_op_indices_;
+    std::vector<uint32_t>::iterator index_iter_;
     uint64_t start_;
 };
 
 CowMergeOpIter::CowMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
-                               std::shared_ptr<std::vector<uint32_t>> merge_op_blocks,
-                               std::shared_ptr<std::unordered_map<uint32_t, int>> map,
+                               std::shared_ptr<std::vector<uint32_t>> merge_op_indices,
                                uint64_t start) {
     ops_ = ops;
-    merge_op_blocks_ = merge_op_blocks;
-    map_ = map;
+    merge_op_indices_ = merge_op_indices;
     start_ = start;
 
-    block_iter_ = merge_op_blocks->begin() + start;
+    index_iter_ = merge_op_indices->begin() + start;
 }
 
 bool CowMergeOpIter::RDone() {
-    return block_iter_ == merge_op_blocks_->begin();
+    return index_iter_ == merge_op_indices_->begin();
 }
 
 void CowMergeOpIter::Prev() {
     CHECK(!RDone());
-    block_iter_--;
+    index_iter_--;
 }
 
 bool CowMergeOpIter::Done() {
-    return block_iter_ == merge_op_blocks_->end();
+    return index_iter_ == merge_op_indices_->end();
 }
 
 void CowMergeOpIter::Next() {
     CHECK(!Done());
-    block_iter_++;
+    index_iter_++;
 }
 
 const CowOperation& CowMergeOpIter::Get() {
     CHECK(!Done());
-    return ops_->data()[map_->at(*block_iter_)];
+    return ops_->data()[*index_iter_];
 }
 
 CowRevMergeOpIter::CowRevMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
-                                     std::shared_ptr<std::vector<uint32_t>> merge_op_blocks,
-                                     std::shared_ptr<std::unordered_map<uint32_t, int>> map,
+                                     std::shared_ptr<std::vector<uint32_t>> merge_op_indices,
                                      uint64_t start) {
     ops_ = ops;
-    merge_op_blocks_ = merge_op_blocks;
-    map_ = map;
+    merge_op_indices_ = merge_op_indices;
     start_ = start;
 
-    block_riter_ = merge_op_blocks->rbegin();
+    index_riter_ = merge_op_indices->rbegin();
 }
 
 bool CowRevMergeOpIter::RDone() {
-    return block_riter_ == merge_op_blocks_->rbegin();
+    return index_riter_ == merge_op_indices_->rbegin();
 }
 
 void CowRevMergeOpIter::Prev() {
     CHECK(!RDone());
-    block_riter_--;
+    index_riter_--;
 }
 
 bool CowRevMergeOpIter::Done() {
-    return block_riter_ == merge_op_blocks_->rend() - start_;
+    return index_riter_ == merge_op_indices_->rend() - start_;
 }
 
 void CowRevMergeOpIter::Next() {
     CHECK(!Done());
-    block_riter_++;
+    index_riter_++;
 }
 
 const CowOperation& CowRevMergeOpIter::Get() {
     CHECK(!Done());
-    return ops_->data()[map_->at(*block_riter_)];
+    return ops_->data()[*index_riter_];
 }
 
 std::unique_ptr<ICowOpIter> CowReader::GetOpIter() {
-    return std::make_unique<CowOpIter>(ops_);
+    return std::make_unique<CowOpIter>(image_->ops);
 }
 
 std::unique_ptr<ICowOpIter> CowReader::GetRevMergeOpIter(bool ignore_progress) {
-    return std::make_unique<CowRevMergeOpIter>(ops_, merge_op_blocks_, block_map_,
+    return std::make_unique<CowRevMergeOpIter>(image_->ops, image_->merge_op_indices,
                                                ignore_progress ? 0 : merge_op_start_);
 }
 
 std::unique_ptr<ICowOpIter> CowReader::GetMergeOpIter(bool ignore_progress) {
-    return std::make_unique<CowMergeOpIter>(ops_, merge_op_blocks_, block_map_,
+    return std::make_unique<CowMergeOpIter>(image_->ops, image_->merge_op_indices,
                                             ignore_progress ? 0 : merge_op_start_);
 }
 
@@ -720,6 +786,11 @@ bool CowReader::GetRawBytes(uint64_t offset, void* buffer, size_t len, size_t* r
         LOG(ERROR) << "invalid data offset: " << offset << ", " << len << " bytes";
         return false;
     }
+    if (mapped_cow_) {
+        memcpy(buffer, mapped_cow_->data() + offset, len);
+        *read = len;
+        return true;
+    }
     if (lseek(fd_.get(), offset, SEEK_SET) < 0) {
         PLOG(ERROR) << "lseek to read raw bytes failed";
         return false;
@@ -763,34 +834,131 @@ class CowDataStream final : public IByteStream {
     size_t remaining_;
 };
 
-bool CowReader::ReadData(const CowOperation& op, IByteSink* sink) {
-    std::unique_ptr<IDecompressor> decompressor;
-    switch (op.compression) {
+static std::unique_ptr<IDecompressor> GetDecompressor(uint8_t compression) {
+    switch (compression) {
         case kCowCompressNone:
-            decompressor = IDecompressor::Uncompressed();
-            break;
+            return IDecompressor::Uncompressed();
         case kCowCompressGz:
-            decompressor = IDecompressor::Gz();
-            break;
+            return IDecompressor::Gz();
         case kCowCompressBrotli:
-            decompressor = IDecompressor::Brotli();
-            break;
+            return IDecompressor::Brotli();
+        case kCowCompressLz4:
+            return IDecompressor::Lz4();
+        case kCowCompressZstd:
+            return IDecompressor::Zstd();
         default:
-            LOG(ERROR) << "Unknown compression type: " << op.compression;
-            return false;
+            LOG(ERROR) << "Unknown compression type: " << compression;
+            return nullptr;
+    }
+}
+
+// Sink over a fixed, caller-owned buffer.
+class FixedBufferSink final : public IByteSink {
+  public:
+    FixedBufferSink(uint8_t* buffer, size_t size) : buffer_(buffer), size_(size) {}
+
+    void* GetBuffer(size_t requested, size_t* actual) override {
+        *actual = std::min(requested, size_ - pos_);
+        if (!*actual) {
+            return nullptr;
+        }
+        void* ptr = buffer_ + pos_;
+        pos_ += *actual;
+        return ptr;
+    }
+    bool ReturnData(void*, size_t) override { return true; }
+
+    size_t pos() const { return pos_; }
+
+  private:
+    uint8_t* buffer_;
+    size_t size_;
+    size_t pos_ = 0;
+};
+
+bool CowReader::ReadData(const CowOperation& op, IByteSink* sink) {
+    if (op.type == kCowReplaceOp && GetCowOpExtentBlocks(op) > 1) {
+        return ReadExtentData(op, sink);
+    }
+
+    std::unique_ptr<IDecompressor> decompressor = GetDecompressor(op.compression);
+    if (!decompressor) {
+        return false;
     }
 
     uint64_t offset;
     if (op.type == kCowXorOp) {
-        offset = data_loc_->at(op.new_block);
+        const uint64_t* data_pos = image_->data_loc.Find(op.new_block);
+        if (!data_pos) {
+            LOG(ERROR) << "No data location for xor op at block " << op.new_block;
+            return false;
+        }
+        offset = *data_pos;
     } else {
-        offset = op.source;
+        offset = GetCowOpSourceOffset(op);
+    }
+
+    size_t data_length = GetCowOpDataLength(op);
+    if (mapped_cow_ && op.compression == kCowCompressNone &&
+        offset + data_length <= mapped_cow_->size() &&
+        sink->AcceptMappedData(mapped_cow_->data() + offset, data_length)) {
+        return true;
     }
-    CowDataStream stream(this, offset, op.data_length);
+
+    CowDataStream stream(this, offset, data_length);
     decompressor->set_stream(&stream);
     decompressor->set_sink(sink);
     return decompressor->Decompress(header_.block_size);
 }
 
+bool CowReader::ReadExtentData(const CowOperation& op, IByteSink* sink) {
+    uint64_t offset = GetCowOpSourceOffset(op);
+    size_t extent_size = GetCowOpExtentBlocks(op) * header_.block_size;
+
+    if (extent_buffer_offset_ != offset) {
+        std::unique_ptr<IDecompressor> decompressor = GetDecompressor(op.compression);
+        if (!decompressor) {
+            return false;
+        }
+
+        extent_buffer_offset_.reset();
+        extent_buffer_.resize(extent_size);
+
+        CowDataStream stream(this, offset, GetCowOpDataLength(op));
+        FixedBufferSink extent_sink(extent_buffer_.data(), extent_buffer_.size());
+        decompressor->set_stream(&stream);
+        decompressor->set_sink(&extent_sink);
+        if (!decompressor->Decompress(extent_size)) {
+            return false;
+        }
+        if (extent_sink.pos() != extent_size) {
+            LOG(ERROR) << "Extent at " << offset << " decompressed to " << extent_sink.pos()
+                       << " bytes, expected " << extent_size;
+            return false;
+        }
+        extent_buffer_offset_ = offset;
+    }
+
+    const uint8_t* block = extent_buffer_.data() + GetCowOpExtentIndex(op) * header_.block_size;
+    size_t remaining = header_.block_size;
+    while (remaining) {
+        size_t actual;
+        void* buffer = sink->GetBuffer(remaining, &actual);
+        if (!buffer || !actual) {
+            LOG(ERROR) << "Could not acquire buffer from sink";
+            return false;
+        }
+        actual = std::min(actual, remaining);
+        memcpy(buffer, block, actual);
+        if (!sink->ReturnData(buffer, actual)) {
+            LOG(ERROR) << "Could not return buffer to sink";
+            return false;
+        }
+        block += actual;
+        remaining -= actual;
+    }
+    return true;
+}
+
 }  // namespace snapshot
 }  // namespace android
@@ -14,19 +14,21 @@
 // limitations under the License.
 //
 
+#include <errno.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <limits>
 #include <queue>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
-#include <brotli/encode.h>
 #include <libsnapshot/cow_reader.h>
 #include <libsnapshot/cow_writer.h>
-#include <zlib.h>
+#include <liburing.h>
 
 namespace android {
 namespace snapshot {
@@ -36,6 +38,86 @@ static_assert(sizeof(off_t) == sizeof(uint64_t));
 using android::base::borrowed_fd;
 using android::base::unique_fd;
 
+static inline uint64_t Rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3, x64 128-bit variant. Replace blocks are deduplicated on their
+// hash alone, so it has to be wide enough that two distinct blocks never
+// collide in practice. libcrypto is not an option, see SHA256() below.
+static void Hash128(const void* data, size_t size, uint64_t out[2]) {
+    static constexpr uint64_t c1 = 0x87c37b91114253d5ULL;
+    static constexpr uint64_t c2 = 0x4cf5ad432745937fULL;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+
+    size_t remaining = size;
+    for (; remaining >= 16; remaining -= 16, p += 16) {
+        uint64_t k1, k2;
+        memcpy(&k1, p, sizeof(k1));
+        memcpy(&k2, p + 8, sizeof(k2));
+
+        k1 *= c1;
+        k1 = Rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = Rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2 = Rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        h2 = Rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    for (size_t i = 0; i < remaining; i++) {
+        if (i < 8) {
+            k1 |= static_cast<uint64_t>(p[i]) << (i * 8);
+        } else {
+            k2 |= static_cast<uint64_t>(p[i]) << ((i - 8) * 8);
+        }
+    }
+    if (remaining > 8) {
+        k2 *= c2;
+        k2 = Rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+    }
+    if (remaining > 0) {
+        k1 *= c1;
+        k1 = Rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= size;
+    h2 ^= size;
+    h1 += h2;
+    h2 += h1;
+    h1 = Fmix64(h1);
+    h2 = Fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
 bool ICowWriter::AddCopy(uint64_t new_block, uint64_t old_block) {
     if (!ValidateNewBlock(new_block)) {
         return false;
@@ -43,6 +125,20 @@ bool ICowWriter::AddCopy(uint64_t new_block, uint64_t old_block) {
     return EmitCopy(new_block, old_block);
 }
 
+bool ICowWriter::AddCopies(size_t num_copies, const std::pair<uint64_t, uint64_t>* copies) {
+    if (!num_copies) {
+        return true;
+    }
+    uint64_t max_block = 0;
+    for (size_t i = 0; i < num_copies; i++) {
+        max_block = std::max(max_block, copies[i].first);
+    }
+    if (!ValidateNewBlock(max_block)) {
+        return false;
+    }
+    return EmitCopies(num_copies, copies);
+}
+
 bool ICowWriter::AddRawBlocks(uint64_t new_block_start, const void* data, size_t size) {
     if (size % options_.block_size != 0) {
         LOG(ERROR) << "AddRawBlocks: size " << size << " is not a multiple of "
@@ -58,6 +154,27 @@ bool ICowWriter::AddRawBlocks(uint64_t new_block_start, const void* data, size_t
     return EmitRawBlocks(new_block_start, data, size);
 }
 
+bool ICowWriter::AddRawBlocks(uint64_t new_block_start, const struct iovec* iov, size_t iovcnt) {
+    uint64_t num_blocks = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len % options_.block_size != 0) {
+            LOG(ERROR) << "AddRawBlocks: iov " << i << " size " << iov[i].iov_len
+                       << " is not a multiple of " << options_.block_size;
+            return false;
+        }
+        num_blocks += iov[i].iov_len / options_.block_size;
+    }
+    if (!num_blocks) {
+        return true;
+    }
+
+    uint64_t last_block = new_block_start + num_blocks - 1;
+    if (!ValidateNewBlock(last_block)) {
+        return false;
+    }
+    return EmitVectoredRawBlocks(new_block_start, iov, iovcnt);
+}
+
 bool ICowWriter::AddXorBlocks(uint32_t new_block_start, const void* data, size_t size,
                               uint32_t old_block, uint16_t offset) {
     if (size % options_.block_size != 0) {
@@ -94,6 +211,29 @@ bool ICowWriter::AddSequenceData(size_t num_ops, const uint32_t* data) {
     return EmitSequenceData(num_ops, data);
 }
 
+bool ICowWriter::EmitCopies(size_t num_copies, const std::pair<uint64_t, uint64_t>* copies) {
+    for (size_t i = 0; i < num_copies; i++) {
+        if (!EmitCopy(copies[i].first, copies[i].second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ICowWriter::EmitVectoredRawBlocks(uint64_t new_block_start, const struct iovec* iov,
+                                       size_t iovcnt) {
+    for (size_t i = 0; i < iovcnt; i++) {
+        if (!iov[i].iov_len) {
+            continue;
+        }
+        if (!EmitRawBlocks(new_block_start, iov[i].iov_base, iov[i].iov_len)) {
+            return false;
+        }
+        new_block_start += iov[i].iov_len / options_.block_size;
+    }
+    return true;
+}
+
 bool ICowWriter::ValidateNewBlock(uint64_t new_block) {
     if (options_.max_blocks && new_block >= options_.max_blocks.value()) {
         LOG(ERROR) << "New block " << new_block << " exceeds maximum block count "
@@ -107,6 +247,66 @@ CowWriter::CowWriter(const CowOptions& options) : ICowWriter(options), fd_(-1) {
     SetupHeaders();
 }
 
+CowWriter::~CowWriter() {
+    for (size_t i = 0; i < compress_threads_.size(); i++) {
+        CompressWorker* worker = compress_threads_[i].get();
+        if (worker) {
+            worker->Finalize();
+        }
+    }
+
+    bool ret = true;
+    for (auto& t : threads_) {
+        ret = t.get() && ret;
+    }
+
+    if (!ret) {
+        LOG(ERROR) << "Compression failed";
+    }
+    compress_threads_.clear();
+
+    if (ring_) {
+        if (!ReapWrites(0)) {
+            LOG(ERROR) << "Pending COW writes failed";
+        }
+        io_uring_queue_exit(ring_.get());
+    }
+}
+
+void CowWriter::InitWorkers() {
+    if (!compression_ || options_.num_compress_threads <= 1 || !compress_threads_.empty()) {
+        return;
+    }
+    for (uint32_t i = 0; i < options_.num_compress_threads; i++) {
+        auto wt = std::make_unique<CompressWorker>(compression_, options_.skip_incompressible);
+        threads_.emplace_back(std::async(std::launch::async, &CompressWorker::RunThread, wt.get()));
+        compress_threads_.push_back(std::move(wt));
+    }
+
+    LOG(INFO) << compress_threads_.size() << " threads used for compression";
+}
+
+void CowWriter::InitAsyncWrites() {
+    if (!options_.async_write_depth || is_dev_null_ || ring_) {
+        return;
+    }
+
+    ring_ = std::make_unique<struct io_uring>();
+    int ret = io_uring_queue_init(options_.async_write_depth, ring_.get(), 0);
+    if (ret) {
+        LOG(ERROR) << "io_uring_queue_init failed with ret: " << ret
+                   << ", falling back to synchronous writes";
+        ring_ = nullptr;
+        return;
+    }
+
+    async_writes_.resize(options_.async_write_depth);
+    for (size_t i = 0; i < async_writes_.size(); i++) {
+        free_async_writes_.push_back(i);
+    }
+    LOG(INFO) << "COW writes queued through io_uring with depth: " << options_.async_write_depth;
+}
+
 void CowWriter::SetupHeaders() {
     header_ = {};
     header_.magic = kCowMagicNumber;
@@ -129,6 +329,10 @@ bool CowWriter::ParseOptions() {
         compression_ = kCowCompressGz;
     } else if (options_.compression == "brotli") {
         compression_ = kCowCompressBrotli;
+    } else if (options_.compression == "lz4") {
+        compression_ = kCowCompressLz4;
+    } else if (options_.compression == "zstd") {
+        compression_ = kCowCompressZstd;
     } else if (options_.compression == "none") {
         compression_ = kCowCompressNone;
     } else if (!options_.compression.empty()) {
@@ -139,6 +343,22 @@ bool CowWriter::ParseOptions() {
         LOG(ERROR) << "Clusters must contain at least two operations to function.";
         return false;
     }
+    if (options_.compression_factor > kCowMaxExtentBlocks) {
+        LOG(ERROR) << "Compression factor " << options_.compression_factor
+                   << " exceeds the maximum of " << kCowMaxExtentBlocks << " blocks";
+        return false;
+    }
+    if (options_.compression_min_savings >= 100) {
+        LOG(ERROR) << "Minimum compression savings must be below 100%, got "
+                   << options_.compression_min_savings;
+        return false;
+    }
+    if (options_.scratch_space &&
+        (!options_.scratch_space_size || options_.scratch_space_size % options_.block_size)) {
+        LOG(ERROR) << "Scratch space size " << options_.scratch_space_size
+                   << " is not a multiple of the block size";
+        return false;
+    }
     return true;
 }
 
@@ -174,7 +394,13 @@ bool CowWriter::Initialize(borrowed_fd fd) {
         return false;
     }
 
-    return OpenForWrite();
+    if (!OpenForWrite()) {
+        return false;
+    }
+
+    InitWorkers();
+    InitAsyncWrites();
+    return true;
 }
 
 bool CowWriter::InitializeAppend(android::base::unique_fd&& fd, uint64_t label) {
@@ -187,7 +413,13 @@ bool CowWriter::InitializeAppend(android::base::borrowed_fd fd, uint64_t label)
         return false;
     }
 
-    return OpenForAppend(label);
+    if (!OpenForAppend(label)) {
+        return false;
+    }
+
+    InitWorkers();
+    InitAsyncWrites();
+    return true;
 }
 
 void CowWriter::InitPos() {
@@ -199,8 +431,10 @@ void CowWriter::InitPos() {
         next_data_pos_ = next_op_pos_ + sizeof(CowOperation);
     }
     ops_.clear();
+    op_stats_ = {};
     current_cluster_size_ = 0;
     current_data_size_ = 0;
+    dedup_table_.clear();
 }
 
 bool CowWriter::OpenForWrite() {
@@ -216,7 +450,17 @@ bool CowWriter::OpenForWrite() {
     }
 
     if (options_.scratch_space) {
-        header_.buffer_size = BUFFER_REGION_DEFAULT_SIZE;
+        header_.buffer_size = options_.scratch_space_size;
+    }
+
+    if (compression_ && options_.compression_factor > 1) {
+        header_.minor_version = kCowVersionMinorExtents;
+        extent_blocks_ = options_.compression_factor;
+    }
+
+    if (options_.dedup_replace_blocks) {
+        header_.minor_version = kCowVersionMinorSharedData;
+        dedup_ = true;
     }
 
     // Headers are not complete, but this ensures the file is at the right
@@ -261,6 +505,16 @@ bool CowWriter::OpenForAppend(uint64_t label) {
     options_.block_size = header_.block_size;
     options_.cluster_ops = header_.cluster_ops;
 
+    // Extents can only be appended to a COW whose header already allows them.
+    if (compression_ && options_.compression_factor > 1 &&
+        header_.minor_version >= kCowVersionMinorExtents) {
+        extent_blocks_ = options_.compression_factor;
+    }
+    // Likewise for shared data. Only data written from here on is known to
+    // the table, since the COW doesn't record content hashes.
+    dedup_ = options_.dedup_replace_blocks &&
+             header_.minor_version >= kCowVersionMinorSharedData;
+
     // Reset this, since we're going to reimport all operations.
     footer_.op.num_ops = 0;
     InitPos();
@@ -268,7 +522,12 @@ bool CowWriter::OpenForAppend(uint64_t label) {
     auto iter = reader->GetOpIter();
 
     while (!iter->Done()) {
-        AddOperation(iter->Get());
+        // The reader expands extents into one op per block. Only the first
+        // block of each extent matches what is on disk.
+        const auto& op = iter->Get();
+        if (GetCowOpExtentIndex(op) == 0) {
+            AddOperation(op);
+        }
         iter->Next();
     }
 
@@ -300,11 +559,157 @@ bool CowWriter::EmitXorBlocks(uint32_t new_block_start, const void* data, size_t
     return EmitBlocks(new_block_start, data, size, old_block, offset, kCowXorOp);
 }
 
+bool CowWriter::CompressBlocks(size_t num_blocks, const void* data, size_t block_size,
+                               std::vector<std::basic_string<uint8_t>>* compressed_data) {
+    size_t num_threads = std::min(num_blocks, compress_threads_.size());
+    size_t num_blocks_per_thread = num_blocks / num_threads;
+    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
+    compressed_data->clear();
+
+    // Submit the blocks per thread. The retrieval of
+    // compressed buffers has to be done in the same order.
+    // We should not poll for completed buffers in a different order as the
+    // buffers are tightly coupled with block ordering.
+    for (size_t i = 0; i < num_threads; i++) {
+        CompressWorker* worker = compress_threads_[i].get();
+        if (i == num_threads - 1) {
+            num_blocks_per_thread = num_blocks;
+        }
+        worker->EnqueueCompressBlocks(iter, block_size, num_blocks_per_thread);
+        iter += (num_blocks_per_thread * block_size);
+        num_blocks -= num_blocks_per_thread;
+    }
+
+    bool ret = true;
+    for (size_t i = 0; i < num_threads; i++) {
+        CompressWorker* worker = compress_threads_[i].get();
+        // Always drain every worker that was handed work, so that a failure
+        // does not leave stale buffers queued for the next call.
+        ret = worker->GetCompressedBuffers(compressed_data) && ret;
+    }
+    return ret;
+}
+
 bool CowWriter::EmitBlocks(uint64_t new_block_start, const void* data, size_t size,
                            uint64_t old_block, uint16_t offset, uint8_t type) {
-    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
     CHECK(!merge_in_progress_);
-    for (size_t i = 0; i < size / header_.block_size; i++) {
+    if (type == kCowReplaceOp && extent_blocks_ > 1) {
+        return EmitExtents(new_block_start, data, size);
+    }
+    return EmitSingleBlocks(new_block_start, data, size, old_block, offset, type);
+}
+
+bool CowWriter::EmitExtents(uint64_t new_block_start, const void* data, size_t size) {
+    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
+    size_t num_blocks = size / header_.block_size;
+    size_t extent_size = extent_blocks_ * header_.block_size;
+
+    // Full extents can be handed to the compression threads; a trailing
+    // partial extent is compressed below.
+    std::vector<std::basic_string<uint8_t>> compressed_extents;
+    size_t num_full_extents = num_blocks / extent_blocks_;
+    if (!compress_threads_.empty() && num_full_extents > 0) {
+        if (!CompressBlocks(num_full_extents, data, extent_size, &compressed_extents)) {
+            LOG(ERROR) << "AddRawBlocks: compression failed";
+            return false;
+        }
+        CHECK(compressed_extents.size() == num_full_extents);
+    }
+
+    for (size_t i = 0; i < num_blocks;) {
+        uint32_t extent_blocks = std::min<size_t>(extent_blocks_, num_blocks - i);
+        size_t extent = i / extent_blocks_;
+
+        DedupKey key = {};
+        if (dedup_) {
+            key = MakeDedupKey(iter, extent_blocks);
+            auto it = dedup_table_.find(key);
+            if (it != dedup_table_.end()) {
+                if (!EmitSharedData(new_block_start + i, extent_blocks, it->second)) {
+                    PLOG(ERROR) << "AddRawBlocks: write failed";
+                    return false;
+                }
+                i += extent_blocks;
+                iter += extent_blocks * header_.block_size;
+                continue;
+            }
+        }
+
+        size_t extent_size = extent_blocks * header_.block_size;
+        bool precompressed = extent < compressed_extents.size();
+        std::basic_string<uint8_t> compressed;
+        if (precompressed) {
+            compressed = std::move(compressed_extents[extent]);
+        }
+        bool skipped;
+        if (!CompressData(iter, extent_size, precompressed, &compressed, &skipped)) {
+            PLOG(ERROR) << "AddRawBlocks: compression failed";
+            return false;
+        }
+        const uint8_t* payload = compressed.empty() ? iter : compressed.data();
+        size_t payload_size = compressed.empty() ? extent_size : compressed.size();
+
+        if (payload_size > kCowMaxExtentDataLength) {
+            // Too large to describe as one extent; fall back to one op per block.
+            if (!EmitSingleBlocks(new_block_start + i, iter, extent_size, 0, 0, kCowReplaceOp)) {
+                return false;
+            }
+        } else {
+            CowOperation op = {};
+            op.type = kCowReplaceOp;
+            op.compression = compressed.empty() ? kCowCompressNone : compression_;
+            op.new_block = new_block_start + i;
+            SetCowOpExtent(&op, next_data_pos_, payload_size, extent_blocks, 0);
+
+            if (!WriteOperation(op, payload, payload_size)) {
+                PLOG(ERROR) << "AddRawBlocks: write failed";
+                return false;
+            }
+            if (compressed.empty()) {
+                NoteStoredUncompressed(skipped);
+            }
+            if (dedup_) {
+                dedup_table_.emplace(key, DedupEntry{GetCowOpSourceOffset(op),
+                                                     static_cast<uint32_t>(payload_size),
+                                                     op.compression});
+            }
+        }
+
+        i += extent_blocks;
+        iter += extent_blocks * header_.block_size;
+    }
+    return true;
+}
+
+bool CowWriter::EmitSingleBlocks(uint64_t new_block_start, const void* data, size_t size,
+                                 uint64_t old_block, uint16_t offset, uint8_t type) {
+    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
+    size_t num_blocks = size / header_.block_size;
+
+    std::vector<std::basic_string<uint8_t>> compressed_blocks;
+    if (compression_ && !compress_threads_.empty() && num_blocks > 0) {
+        if (!CompressBlocks(num_blocks, data, header_.block_size, &compressed_blocks)) {
+            LOG(ERROR) << "AddRawBlocks: compression failed";
+            return false;
+        }
+        CHECK(compressed_blocks.size() == num_blocks);
+    }
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        DedupKey key = {};
+        if (dedup_ && type == kCowReplaceOp) {
+            key = MakeDedupKey(iter, 1);
+            auto it = dedup_table_.find(key);
+            if (it != dedup_table_.end()) {
+                if (!EmitSharedData(new_block_start + i, 1, it->second)) {
+                    PLOG(ERROR) << "AddRawBlocks: write failed";
+                    return false;
+                }
+                iter += header_.block_size;
+                continue;
+            }
+        }
+
         CowOperation op = {};
         op.new_block = new_block_start + i;
         op.type = type;
@@ -314,29 +719,43 @@ bool CowWriter::EmitBlocks(uint64_t new_block_start, const void* data, size_t si
             op.source = next_data_pos_;
         }
 
+        std::basic_string<uint8_t> compressed;
+        bool skipped = false;
         if (compression_) {
-            auto data = Compress(iter, header_.block_size);
-            if (data.empty()) {
+            bool precompressed = !compressed_blocks.empty();
+            if (precompressed) {
+                compressed = std::move(compressed_blocks[i]);
+            }
+            if (!CompressData(iter, header_.block_size, precompressed, &compressed, &skipped)) {
                 PLOG(ERROR) << "AddRawBlocks: compression failed";
                 return false;
             }
-            if (data.size() > std::numeric_limits<uint16_t>::max()) {
-                LOG(ERROR) << "Compressed block is too large: " << data.size() << " bytes";
+            if (compressed.size() > std::numeric_limits<uint16_t>::max()) {
+                LOG(ERROR) << "Compressed block is too large: " << compressed.size() << " bytes";
                 return false;
             }
-            op.compression = compression_;
-            op.data_length = static_cast<uint16_t>(data.size());
+        }
 
-            if (!WriteOperation(op, data.data(), data.size())) {
+        if (!compressed.empty()) {
+            op.compression = compression_;
+            op.data_length = static_cast<uint16_t>(compressed.size());
+            if (!WriteOperation(op, compressed.data(), compressed.size())) {
                 PLOG(ERROR) << "AddRawBlocks: write failed";
                 return false;
             }
         } else {
+            op.compression = kCowCompressNone;
             op.data_length = static_cast<uint16_t>(header_.block_size);
             if (!WriteOperation(op, iter, header_.block_size)) {
                 PLOG(ERROR) << "AddRawBlocks: write failed";
                 return false;
             }
+            if (compression_) {
+                NoteStoredUncompressed(skipped);
+            }
+        }
+        if (dedup_ && type == kCowReplaceOp) {
+            dedup_table_.emplace(key, DedupEntry{op.source, op.data_length, op.compression});
         }
 
         iter += header_.block_size;
@@ -344,16 +763,75 @@ bool CowWriter::EmitBlocks(uint64_t new_block_start, const void* data, size_t si
     return true;
 }
 
+// Compress |length| bytes at |data| into |*compressed|, unless they are better
+// stored as they are, in which case |*compressed| is left empty. If
+// |precompressed|, |*compressed| already holds the output of a compression
+// thread, which is empty when the thread skipped the data.
+bool CowWriter::CompressData(const void* data, size_t length, bool precompressed,
+                             std::basic_string<uint8_t>* compressed, bool* skipped) {
+    if (precompressed) {
+        *skipped = compressed->empty();
+    } else {
+        *skipped = options_.skip_incompressible &&
+                   CompressWorker::LooksIncompressible(data, length);
+        if (!*skipped) {
+            *compressed = CompressWorker::Compress(compression_, data, length);
+            if (compressed->empty()) {
+                return false;
+            }
+        }
+    }
+    if (compressed->size() * 100 >= length * (100 - options_.compression_min_savings)) {
+        compressed->clear();
+    }
+    return true;
+}
+
+void CowWriter::NoteStoredUncompressed(bool skipped) {
+    op_stats_.num_stored_uncompressed++;
+    if (skipped) {
+        op_stats_.num_skipped_incompressible++;
+    }
+}
+
+CowWriter::DedupKey CowWriter::MakeDedupKey(const void* data, uint32_t num_blocks) const {
+    DedupKey key;
+    Hash128(data, num_blocks * header_.block_size, key.hash);
+    key.num_blocks = num_blocks;
+    return key;
+}
+
+// Write a replace op for |num_blocks| blocks whose data is already in the COW.
+bool CowWriter::EmitSharedData(uint64_t new_block, uint32_t num_blocks, const DedupEntry& entry) {
+    CowOperation op = {};
+    op.type = kCowReplaceOp;
+    op.compression = entry.compression;
+    op.new_block = new_block;
+    SetCowOpExtent(&op, entry.data_pos, entry.data_length, num_blocks, 0);
+    op.source |= kCowOpSharedDataFlag;
+    return WriteOperation(op);
+}
+
+bool CowWriter::EmitCopies(size_t num_copies, const std::pair<uint64_t, uint64_t>* copies) {
+    CHECK(!merge_in_progress_);
+    std::vector<CowOperation> ops(num_copies);
+    for (size_t i = 0; i < num_copies; i++) {
+        ops[i].type = kCowCopyOp;
+        ops[i].new_block = copies[i].first;
+        ops[i].source = copies[i].second;
+    }
+    return WriteOperations(ops);
+}
+
 bool CowWriter::EmitZeroBlocks(uint64_t new_block_start, uint64_t num_blocks) {
     CHECK(!merge_in_progress_);
+    std::vector<CowOperation> ops(num_blocks);
     for (uint64_t i = 0; i < num_blocks; i++) {
-        CowOperation op = {};
-        op.type = kCowZeroOp;
-        op.new_block = new_block_start + i;
-        op.source = 0;
-        WriteOperation(op);
+        ops[i].type = kCowZeroOp;
+        ops[i].new_block = new_block_start + i;
+        ops[i].source = 0;
     }
-    return true;
+    return WriteOperations(ops);
 }
 
 bool CowWriter::EmitLabel(uint64_t label) {
@@ -392,52 +870,16 @@ bool CowWriter::EmitCluster() {
     return WriteOperation(op);
 }
 
-bool CowWriter::EmitClusterIfNeeded() {
+bool CowWriter::NeedsCluster() const {
     // If there isn't room for another op and the cluster end op, end the current cluster
-    if (cluster_size_ && cluster_size_ < current_cluster_size_ + 2 * sizeof(CowOperation)) {
-        if (!EmitCluster()) return false;
-    }
-    return true;
+    return cluster_size_ && cluster_size_ < current_cluster_size_ + 2 * sizeof(CowOperation);
 }
 
-std::basic_string<uint8_t> CowWriter::Compress(const void* data, size_t length) {
-    switch (compression_) {
-        case kCowCompressGz: {
-            auto bound = compressBound(length);
-            auto buffer = std::make_unique<uint8_t[]>(bound);
-
-            uLongf dest_len = bound;
-            auto rv = compress2(buffer.get(), &dest_len, reinterpret_cast<const Bytef*>(data),
-                                length, Z_BEST_COMPRESSION);
-            if (rv != Z_OK) {
-                LOG(ERROR) << "compress2 returned: " << rv;
-                return {};
-            }
-            return std::basic_string<uint8_t>(buffer.get(), dest_len);
-        }
-        case kCowCompressBrotli: {
-            auto bound = BrotliEncoderMaxCompressedSize(length);
-            if (!bound) {
-                LOG(ERROR) << "BrotliEncoderMaxCompressedSize returned 0";
-                return {};
-            }
-            auto buffer = std::make_unique<uint8_t[]>(bound);
-
-            size_t encoded_size = bound;
-            auto rv = BrotliEncoderCompress(
-                    BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE, length,
-                    reinterpret_cast<const uint8_t*>(data), &encoded_size, buffer.get());
-            if (!rv) {
-                LOG(ERROR) << "BrotliEncoderCompress failed";
-                return {};
-            }
-            return std::basic_string<uint8_t>(buffer.get(), encoded_size);
-        }
-        default:
-            LOG(ERROR) << "unhandled compression type: " << compression_;
-            break;
+bool CowWriter::EmitClusterIfNeeded() {
+    if (NeedsCluster()) {
+        if (!EmitCluster()) return false;
     }
-    return {};
+    return true;
 }
 
 // TODO: Fix compilation issues when linking libcrypto library
@@ -452,12 +894,19 @@ static void SHA256(const void*, size_t, uint8_t[]) {
 }
 
 bool CowWriter::Finalize() {
+    // The footer and the cleared cluster tail below are written synchronously
+    // and may overlap queued writes, so let those land first.
+    if (ring_ && !ReapWrites(0)) {
+        return false;
+    }
+
     auto continue_cluster_size = current_cluster_size_;
     auto continue_data_size = current_data_size_;
     auto continue_data_pos = next_data_pos_;
     auto continue_op_pos = next_op_pos_;
     auto continue_size = ops_.size();
     auto continue_num_ops = footer_.op.num_ops;
+    auto continue_op_stats = op_stats_;
     bool extra_cluster = false;
 
     // Blank out extra ops, in case we're in append mode and dropped ops.
@@ -517,6 +966,7 @@ bool CowWriter::Finalize() {
         next_data_pos_ = continue_data_pos;
         next_op_pos_ = continue_op_pos;
         footer_.op.num_ops = continue_num_ops;
+        op_stats_ = continue_op_stats;
         ops_.resize(continue_size);
     }
     return Sync();
@@ -541,12 +991,20 @@ bool CowWriter::GetDataPos(uint64_t* pos) {
 }
 
 bool CowWriter::WriteOperation(const CowOperation& op, const void* data, size_t size) {
-    if (lseek(fd_.get(), next_op_pos_, SEEK_SET) < 0) {
-        PLOG(ERROR) << "lseek failed for writing operation.";
-        return false;
-    }
-    if (!android::base::WriteFully(fd_, reinterpret_cast<const uint8_t*>(&op), sizeof(op))) {
-        return false;
+    if (is_dev_null_) {
+        // Nothing to write; only track the layout.
+    } else if (ring_) {
+        if (!QueueWrite(&op, sizeof(op), next_op_pos_)) {
+            return false;
+        }
+    } else {
+        if (lseek(fd_.get(), next_op_pos_, SEEK_SET) < 0) {
+            PLOG(ERROR) << "lseek failed for writing operation.";
+            return false;
+        }
+        if (!android::base::WriteFully(fd_, reinterpret_cast<const uint8_t*>(&op), sizeof(op))) {
+            return false;
+        }
     }
     if (data != nullptr && size > 0) {
         if (!WriteRawData(data, size)) return false;
@@ -555,23 +1013,75 @@ bool CowWriter::WriteOperation(const CowOperation& op, const void* data, size_t
     return EmitClusterIfNeeded();
 }
 
+// Write a run of ops that carry no data. Ops that land in the same cluster are
+// contiguous in the file, so they go out in a single write per cluster rather
+// than one seek and write per op.
+bool CowWriter::WriteOperations(const std::vector<CowOperation>& ops) {
+    ops_.reserve(ops_.size() + ops.size() * sizeof(CowOperation));
+
+    size_t batch_start = 0;
+    uint64_t batch_pos = next_op_pos_;
+    for (size_t i = 0; i < ops.size(); i++) {
+        CHECK(!GetCowOpDataLength(ops[i]));
+        AddOperation(ops[i]);
+        if (i + 1 < ops.size() && !NeedsCluster()) {
+            continue;
+        }
+
+        size_t batch_size = (i + 1 - batch_start) * sizeof(CowOperation);
+        if (is_dev_null_) {
+            // Nothing to write; only track the layout.
+        } else if (ring_) {
+            if (!QueueWrite(&ops[batch_start], batch_size, batch_pos)) {
+                return false;
+            }
+        } else {
+            if (lseek(fd_.get(), batch_pos, SEEK_SET) < 0) {
+                PLOG(ERROR) << "lseek failed for writing operations.";
+                return false;
+            }
+            if (!android::base::WriteFully(fd_, &ops[batch_start], batch_size)) {
+                PLOG(ERROR) << "write of " << batch_size << " bytes of operations failed";
+                return false;
+            }
+        }
+        if (!EmitClusterIfNeeded()) {
+            return false;
+        }
+        batch_start = i + 1;
+        batch_pos = next_op_pos_;
+    }
+    return true;
+}
+
 void CowWriter::AddOperation(const CowOperation& op) {
     footer_.op.num_ops++;
 
+    if (op.type < op_stats_.by_type.size()) {
+        op_stats_.by_type[op.type].num_ops++;
+        op_stats_.by_type[op.type].data_bytes += GetCowOpStoredDataLength(op);
+    }
+
     if (op.type == kCowClusterOp) {
         current_cluster_size_ = 0;
         current_data_size_ = 0;
     } else if (header_.cluster_ops) {
         current_cluster_size_ += sizeof(op);
-        current_data_size_ += op.data_length;
+        current_data_size_ += GetCowOpStoredDataLength(op);
     }
 
-    next_data_pos_ += op.data_length + GetNextDataOffset(op, header_.cluster_ops);
+    next_data_pos_ += GetCowOpStoredDataLength(op) + GetNextDataOffset(op, header_.cluster_ops);
     next_op_pos_ += sizeof(CowOperation) + GetNextOpOffset(op, header_.cluster_ops);
     ops_.insert(ops_.size(), reinterpret_cast<const uint8_t*>(&op), sizeof(op));
 }
 
 bool CowWriter::WriteRawData(const void* data, size_t size) {
+    if (is_dev_null_) {
+        return true;
+    }
+    if (ring_) {
+        return QueueWrite(data, size, next_data_pos_);
+    }
     if (lseek(fd_.get(), next_data_pos_, SEEK_SET) < 0) {
         PLOG(ERROR) << "lseek failed for writing data.";
         return false;
@@ -583,10 +1093,84 @@ bool CowWriter::WriteRawData(const void* data, size_t size) {
     return true;
 }
 
+// Copy |data| into a free async buffer and submit it. If every buffer is in
+// flight, wait for one to complete first.
+bool CowWriter::QueueWrite(const void* data, size_t size, uint64_t offset) {
+    if (free_async_writes_.empty() && !ReapWrites(async_writes_.size() - 1)) {
+        return false;
+    }
+    if (async_write_failed_) {
+        return false;
+    }
+
+    size_t index = free_async_writes_.back();
+    auto& write = async_writes_[index];
+    write.buffer.assign(reinterpret_cast<const uint8_t*>(data), size);
+    write.offset = offset;
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+    if (!sqe) {
+        LOG(ERROR) << "io_uring_get_sqe failed for COW write";
+        return false;
+    }
+    io_uring_prep_write(sqe, fd_.get(), write.buffer.data(), write.buffer.size(), write.offset);
+    sqe->user_data = index;
+
+    int ret = io_uring_submit(ring_.get());
+    if (ret != 1) {
+        LOG(ERROR) << "io_uring_submit failed for COW write: " << ret;
+        return false;
+    }
+    free_async_writes_.pop_back();
+    inflight_writes_++;
+    return true;
+}
+
+// Wait until at most |max_inflight| writes are outstanding. Short writes are
+// completed synchronously.
+bool CowWriter::ReapWrites(size_t max_inflight) {
+    while (inflight_writes_ > max_inflight) {
+        struct io_uring_cqe* cqe;
+        int ret = io_uring_wait_cqe(ring_.get(), &cqe);
+        if (ret == -EINTR || ret == -EAGAIN) {
+            continue;
+        }
+        if (ret) {
+            LOG(ERROR) << "io_uring_wait_cqe failed for COW write: " << ret;
+            async_write_failed_ = true;
+            return false;
+        }
+
+        size_t index = cqe->user_data;
+        int res = cqe->res;
+        io_uring_cqe_seen(ring_.get(), cqe);
+        inflight_writes_--;
+
+        const auto& write = async_writes_[index];
+        if (res < 0) {
+            LOG(ERROR) << "COW write of " << write.buffer.size() << " bytes at offset "
+                       << write.offset << " failed: " << strerror(-res);
+            async_write_failed_ = true;
+        } else if (static_cast<size_t>(res) < write.buffer.size()) {
+            if (!android::base::WriteFullyAtOffset(fd_, write.buffer.data() + res,
+                                                   write.buffer.size() - res,
+                                                   write.offset + res)) {
+                PLOG(ERROR) << "COW write at offset " << write.offset + res << " failed";
+                async_write_failed_ = true;
+            }
+        }
+        free_async_writes_.push_back(index);
+    }
+    return !async_write_failed_;
+}
+
 bool CowWriter::Sync() {
     if (is_dev_null_) {
         return true;
     }
+    if (ring_ && !ReapWrites(0)) {
+        return false;
+    }
     if (fsync(fd_.get()) < 0) {
         PLOG(ERROR) << "fsync failed";
         return false;
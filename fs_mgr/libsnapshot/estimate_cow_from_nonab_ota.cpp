@@ -36,7 +36,7 @@
 
 DEFINE_string(source_tf, "", "Source target files (dir or zip file)");
 DEFINE_string(ota_tf, "", "Target files of the build for an OTA");
-DEFINE_string(compression, "gz", "Compression (options: none, gz, brotli)");
+DEFINE_string(compression, "gz", "Compression (options: none, gz, brotli, lz4, zstd)");
 
 namespace android {
 namespace snapshot {
@@ -223,6 +223,7 @@ class NonAbEstimator final {
     std::unique_ptr<TargetFilesPackage> ota_tf_;
     std::unique_ptr<TargetFilesPackage> source_tf_;
     uint64_t size_ = 0;
+    CowOpStats op_stats_;
 };
 
 bool NonAbEstimator::Run() {
@@ -244,6 +245,24 @@ bool NonAbEstimator::Run() {
     int64_t size_in_mb = int64_t(double(size_) / 1024.0 / 1024.0);
 
     std::cout << "Estimated COW size: " << size_ << " (" << size_in_mb << "MiB)\n";
+
+    static constexpr std::pair<uint8_t, const char*> kOpNames[] = {
+            {kCowCopyOp, "copy"},       {kCowReplaceOp, "replace"}, {kCowZeroOp, "zero"},
+            {kCowLabelOp, "label"},     {kCowClusterOp, "cluster"}, {kCowXorOp, "xor"},
+            {kCowSequenceOp, "sequence"},
+    };
+    for (const auto& [type, name] : kOpNames) {
+        const auto& entry = op_stats_.by_type[type];
+        if (!entry.num_ops) {
+            continue;
+        }
+        std::cout << "  " << name << " ops: " << entry.num_ops << ", data bytes: "
+                  << entry.data_bytes << "\n";
+    }
+    if (op_stats_.num_stored_uncompressed) {
+        std::cout << "  stored uncompressed: " << op_stats_.num_stored_uncompressed << " ("
+                  << op_stats_.num_skipped_incompressible << " without trying)\n";
+    }
     return true;
 }
 
@@ -308,18 +327,13 @@ bool NonAbEstimator::AnalyzePartition(const std::string& partition_name) {
         }
     }
 
-    TemporaryFile cow;
-    if (cow.fd < 0) {
-        PLOG(ERROR) << "mkstemp failed";
-        return false;
-    }
-
     CowOptions options;
     options.block_size = kBlockSize;
     options.compression = FLAGS_compression;
 
     auto writer = std::make_unique<CowWriter>(options);
-    if (!writer->Initialize(borrowed_fd{cow.fd})) {
+    // Nothing is written: the writer only tracks the size of the COW.
+    if (!writer->Initialize(borrowed_fd{-1})) {
         LOG(ERROR) << "Could not initialize COW writer";
         return false;
     }
@@ -379,13 +393,15 @@ bool NonAbEstimator::AnalyzePartition(const std::string& partition_name) {
         return false;
     }
 
-    struct stat s;
-    if (fstat(cow.fd, &s) < 0) {
-        PLOG(ERROR) << "fstat failed";
-        return false;
-    }
+    size_ += writer->GetCowSize();
 
-    size_ += s.st_size;
+    const auto& stats = writer->GetOpStats();
+    for (size_t i = 0; i < stats.by_type.size(); i++) {
+        op_stats_.by_type[i].num_ops += stats.by_type[i].num_ops;
+        op_stats_.by_type[i].data_bytes += stats.by_type[i].data_bytes;
+    }
+    op_stats_.num_stored_uncompressed += stats.num_stored_uncompressed;
+    op_stats_.num_skipped_incompressible += stats.num_skipped_incompressible;
     return true;
 }
 
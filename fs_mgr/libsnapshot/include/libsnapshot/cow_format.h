@@ -24,6 +24,14 @@ static constexpr uint64_t kCowMagicNumber = 0x436f77634f572121ULL;
 static constexpr uint32_t kCowVersionMajor = 2;
 static constexpr uint32_t kCowVersionMinor = 0;
 
+// Minor version 1 allows replace operations to cover a run of blocks that
+// were compressed as a single frame. See "Extent operations" below.
+static constexpr uint32_t kCowVersionMinorExtents = 1;
+
+// Minor version 2 allows replace operations to share the data of an earlier
+// replace operation. See "Shared data" below.
+static constexpr uint32_t kCowVersionMinorSharedData = 2;
+
 static constexpr uint32_t kCowVersionManifest = 2;
 
 static constexpr size_t BLOCK_SZ = 4096;
@@ -130,7 +138,8 @@ struct CowOperation {
     //
     // For replace operations, this is a byte offset within the COW's data
     // sections (eg, not landing within the header or metadata). It is an
-    // absolute position within the image.
+    // absolute position within the image. In COW minor version 1, the upper
+    // bits also describe the extent the block belongs to (see below).
     //
     // For zero operations (replace with all zeroes), this is unused and must
     // be zero.
@@ -145,6 +154,39 @@ struct CowOperation {
 
 static_assert(sizeof(CowOperation) == sizeof(CowFooterOperation));
 
+// Extent operations (COW minor version 1).
+//
+// A replace operation may cover up to kCowMaxExtentBlocks contiguous blocks,
+// starting at |new_block|, that were compressed together as one frame. Since
+// such a frame can exceed 64KiB, |source| is split into:
+//
+//      bits  0-47: byte offset of the compressed frame in the COW
+//      bits 48-50: bits 16-18 of the compressed length (bits 0-15 are in
+//                  |data_length|)
+//      bits 51-56: number of blocks in the extent, minus one
+//      bits 57-62: index of this block within the extent
+//
+// On disk the block index is always zero. CowReader expands each extent into
+// one replace operation per block, so consumers keep seeing a single
+// operation per block and CowReader::ReadData returns the block at that
+// operation's index. Operations written by older versions have all upper
+// bits clear, which decodes as a single-block extent.
+static constexpr uint32_t kCowMaxExtentBlocks = 64;
+static constexpr uint64_t kCowOpSourceOffsetMask = (1ULL << 48) - 1;
+static constexpr uint32_t kCowExtentLengthShift = 48;
+static constexpr uint64_t kCowExtentLengthMask = 0x7;
+static constexpr uint32_t kCowExtentBlocksShift = 51;
+static constexpr uint32_t kCowExtentIndexShift = 57;
+static constexpr uint64_t kCowExtentCountMask = 0x3f;
+static constexpr uint32_t kCowMaxExtentDataLength = (1U << 19) - 1;
+
+// Shared data (COW minor version 2).
+//
+// A replace operation with bit 63 of |source| set describes the same data as
+// an earlier replace operation: the offset, length and extent fields point at
+// that operation's data, and no data of its own follows it in the COW.
+static constexpr uint64_t kCowOpSharedDataFlag = 1ULL << 63;
+
 static constexpr uint8_t kCowCopyOp = 1;
 static constexpr uint8_t kCowReplaceOp = 2;
 static constexpr uint8_t kCowZeroOp = 3;
@@ -157,6 +199,8 @@ static constexpr uint8_t kCowFooterOp = -1;
 static constexpr uint8_t kCowCompressNone = 0;
 static constexpr uint8_t kCowCompressGz = 1;
 static constexpr uint8_t kCowCompressBrotli = 2;
+static constexpr uint8_t kCowCompressLz4 = 3;
+static constexpr uint8_t kCowCompressZstd = 4;
 
 static constexpr uint8_t kCowReadAheadNotStarted = 0;
 static constexpr uint8_t kCowReadAheadInProgress = 1;
@@ -185,6 +229,17 @@ static constexpr uint64_t BUFFER_REGION_DEFAULT_SIZE = (1ULL << 21);
 
 std::ostream& operator<<(std::ostream& os, CowOperation const& arg);
 
+// Accessors for replace operation fields which may be packed as an extent.
+uint64_t GetCowOpSourceOffset(const CowOperation& op);
+uint32_t GetCowOpDataLength(const CowOperation& op);
+uint32_t GetCowOpExtentBlocks(const CowOperation& op);
+uint32_t GetCowOpExtentIndex(const CowOperation& op);
+bool IsCowOpDataShared(const CowOperation& op);
+// Bytes of data stored after |op| itself, which is zero for shared data.
+uint32_t GetCowOpStoredDataLength(const CowOperation& op);
+void SetCowOpExtent(CowOperation* op, uint64_t data_pos, uint32_t data_length, uint32_t num_blocks,
+                    uint32_t index);
+
 int64_t GetNextOpOffset(const CowOperation& op, uint32_t cluster_size);
 int64_t GetNextDataOffset(const CowOperation& op, uint32_t cluster_size);
 
@@ -16,11 +16,14 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <functional>
 #include <memory>
 #include <optional>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include <android-base/mapped_file.h>
 #include <android-base/unique_fd.h>
 #include <libsnapshot/cow_format.h>
 
@@ -56,6 +59,12 @@ class IByteSink {
 
     // Called when a section returned by |GetBuffer| has been filled with data.
     virtual bool ReturnData(void* buffer, size_t length) = 0;
+
+    // Called when the reader can expose uncompressed data in place, for
+    // example from a memory-mapped COW. |data| remains valid for as long as
+    // the reader (or any of its clones) is alive. Return false to instead
+    // receive a copy through GetBuffer() and ReturnData().
+    virtual bool AcceptMappedData(const void* /* data */, size_t /* length */) { return false; }
 };
 
 // Interface for reading from a snapuserd COW.
@@ -83,7 +92,8 @@ class ICowReader {
     virtual std::unique_ptr<ICowOpIter> GetMergeOpIter(bool ignore_progress) = 0;
 
     // Get decoded bytes from the data section, handling any decompression.
-    // All retrieved data is passed to the sink.
+    // All retrieved data is passed to the sink. For a block that is part of a
+    // multi-block extent, only that block's data is passed to the sink.
     virtual bool ReadData(const CowOperation& op, IByteSink* sink) = 0;
 };
 
@@ -108,11 +118,58 @@ class ICowOpIter {
     virtual bool RDone() = 0;
 };
 
+// An immutable map from block numbers to values, stored as a sorted array.
+// Entries are added up front and Finalize() must be called before any lookup.
+// If a key is added more than once, the first value wins. This costs a
+// fraction of the memory of a hash map, which matters for COWs with millions
+// of operations.
+template <typename Key, typename Value>
+class SortedBlockMap {
+  public:
+    void Reserve(size_t count) { entries_.reserve(count); }
+    void Add(Key key, Value value) { entries_.push_back({key, value}); }
+
+    void Finalize() {
+        std::stable_sort(entries_.begin(), entries_.end(),
+                         [](const Entry& a, const Entry& b) { return a.key < b.key; });
+        auto last = std::unique(entries_.begin(), entries_.end(),
+                                [](const Entry& a, const Entry& b) { return a.key == b.key; });
+        entries_.erase(last, entries_.end());
+        entries_.shrink_to_fit();
+    }
+
+    const Value* Find(Key key) const {
+        auto iter = std::lower_bound(
+                entries_.begin(), entries_.end(), key,
+                [](const Entry& entry, const Key& key) { return entry.key < key; });
+        if (iter == entries_.end() || iter->key != key) {
+            return nullptr;
+        }
+        return &iter->value;
+    }
+
+    size_t size() const { return entries_.size(); }
+
+  private:
+    struct Entry {
+        Key key;
+        Value value;
+    };
+    std::vector<Entry> entries_;
+};
+
 class CowReader final : public ICowReader {
   public:
+    // Flags may be combined with operator|.
     enum class ReaderFlags {
         DEFAULT = 0,
         USERSPACE_MERGE = 1,
+        // Memory-map the COW rather than reading it through the descriptor.
+        // Ops are parsed straight out of the mapping, data reads become
+        // memory copies, and uncompressed data can be handed to sinks in
+        // place. The mapping is shared with cloned readers. The COW must not
+        // be truncated while the reader is alive.
+        MMAP = 2,
     };
 
     CowReader(ReaderFlags reader_flag = ReaderFlags::DEFAULT);
@@ -147,38 +204,66 @@ class CowReader final : public ICowReader {
     // count of the merge sequence before removing already-merged operations.
     // It may be different than the actual data op count, for example, if there
     // are duplicate ops in the stream.
-    uint64_t get_num_total_data_ops() { return num_total_data_ops_; }
+    uint64_t get_num_total_data_ops() { return image_->num_total_data_ops; }
 
-    uint64_t get_num_ordered_ops_to_merge() { return num_ordered_ops_to_merge_; }
+    uint64_t get_num_ordered_ops_to_merge() { return image_->num_ordered_ops_to_merge; }
 
     void CloseCowFd() { owned_fd_ = {}; }
 
-    // Creates a clone of the current CowReader without the file handlers
+    // Creates a clone of the current CowReader without the file handlers. The
+    // parsed ops and merge order are shared with the clone, not copied.
     std::unique_ptr<CowReader> CloneCowReader();
 
     void UpdateMergeOpsCompleted(int num_merge_ops) { header_.num_merge_ops += num_merge_ops; }
 
   private:
-    bool ParseOps(std::optional<uint64_t> label);
-    bool PrepMergeOps();
+    // Everything parsed out of the COW. Parse() builds a new image and
+    // publishes it once complete; from then on it is never modified, so it is
+    // shared by the reader and all of its clones without locking.
+    struct CowImage {
+        std::optional<CowFooter> footer;
+        std::optional<uint64_t> last_label;
+        std::shared_ptr<std::vector<CowOperation>> ops;
+        // Indices into |ops|, in merge order.
+        std::shared_ptr<std::vector<uint32_t>> merge_op_indices =
+                std::make_shared<std::vector<uint32_t>>();
+        uint64_t num_total_data_ops{};
+        uint64_t num_ordered_ops_to_merge{};
+        bool has_seq_ops{};
+        // Data location of each xor op, keyed by new_block.
+        SortedBlockMap<uint64_t, uint64_t> data_loc;
+    };
+
+    bool HasFlag(ReaderFlags flag) const {
+        return (static_cast<int>(reader_flag_) & static_cast<int>(flag)) != 0;
+    }
+    bool MapCow();
+    bool ReadAt(uint64_t offset, void* buffer, size_t len);
+    bool ParseOps(CowImage* image, std::optional<uint64_t> label);
+    void ExpandExtentOps(std::shared_ptr<std::vector<CowOperation>>* ops);
+    bool PrepMergeOps(CowImage* image);
     uint64_t FindNumCopyops();
+    bool ReadExtentData(const CowOperation& op, IByteSink* sink);
 
     android::base::unique_fd owned_fd_;
     android::base::borrowed_fd fd_;
     CowHeader header_;
-    std::optional<CowFooter> footer_;
     uint64_t fd_size_;
-    std::optional<uint64_t> last_label_;
-    std::shared_ptr<std::vector<CowOperation>> ops_;
-    std::shared_ptr<std::vector<uint32_t>> merge_op_blocks_;
+    std::shared_ptr<const CowImage> image_;
     uint64_t merge_op_start_{};
-    std::shared_ptr<std::unordered_map<uint32_t, int>> block_map_;
-    uint64_t num_total_data_ops_{};
-    uint64_t num_ordered_ops_to_merge_{};
-    bool has_seq_ops_{};
-    std::shared_ptr<std::unordered_map<uint64_t, uint64_t>> data_loc_;
     ReaderFlags reader_flag_;
+    std::shared_ptr<android::base::MappedFile> mapped_cow_;
+
+    // The most recently decompressed extent. Consecutive blocks of an extent
+    // are usually read back to back, so this avoids decompressing the whole
+    // frame once per block.
+    std::vector<uint8_t> extent_buffer_;
+    std::optional<uint64_t> extent_buffer_offset_;
 };
 
+inline CowReader::ReaderFlags operator|(CowReader::ReaderFlags a, CowReader::ReaderFlags b) {
+    return static_cast<CowReader::ReaderFlags>(static_cast<int>(a) | static_cast<int>(b));
+}
+
 }  // namespace snapshot
 }  // namespace android
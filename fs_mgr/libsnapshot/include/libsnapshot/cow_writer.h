@@ -15,15 +15,26 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/uio.h>
 
+#include <array>
+#include <condition_variable>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <queue>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 #include <libsnapshot/cow_format.h>
 #include <libsnapshot/cow_reader.h>
 
+struct io_uring;
+
 namespace android {
 namespace snapshot {
 
@@ -39,8 +50,62 @@ struct CowOptions {
 
     bool scratch_space = true;
 
+    // Size of the scratch space, in bytes, a multiple of block_size. The
+    // user-space merge stages copy ops through it, so a larger region means
+    // bigger merge windows and fewer flushes.
+    uint32_t scratch_space_size = BUFFER_REGION_DEFAULT_SIZE;
+
     // Preset the number of merged ops. Only useful for testing.
     uint64_t num_merge_ops = 0;
+
+    // Number of threads used to compress blocks. 0 or 1 compresses on the
+    // calling thread. Ops and data are always written in order.
+    uint32_t num_compress_threads = 0;
+
+    // Number of contiguous replace blocks compressed together as one frame,
+    // up to kCowMaxExtentBlocks. Values above 1 only take effect when
+    // compression is enabled, and produce a COW with minor version
+    // kCowVersionMinorExtents.
+    uint32_t compression_factor = 1;
+
+    // Maximum number of COW writes kept in flight through io_uring, so that
+    // storage writes overlap with compression. Intended for block device
+    // targets. 0 keeps all writes synchronous.
+    uint32_t async_write_depth = 0;
+
+    // Store each distinct replace block, or extent, only once. Repeats refer
+    // to the data already in the COW, which produces a COW with minor version
+    // kCowVersionMinorSharedData. The writer keeps a table entry for every
+    // distinct block it writes. When appending, only COWs that already have
+    // that version are deduplicated, and only against data written since.
+    bool dedup_replace_blocks = false;
+
+    // Blocks, or extents, are stored uncompressed unless compressing them
+    // saves at least this percentage of their size. With 0, they are only
+    // stored uncompressed when compression gains nothing.
+    uint32_t compression_min_savings = 0;
+
+    // Store blocks whose bytes look uniformly distributed, like already
+    // compressed or encrypted data, without running the compressor on them.
+    bool skip_incompressible = true;
+};
+
+// Running totals of the operations in a COW, by op type.
+struct CowOpStats {
+    struct Entry {
+        uint64_t num_ops = 0;
+        // Bytes of data following the ops, after compression.
+        uint64_t data_bytes = 0;
+    };
+
+    // Indexed by CowOperation::type.
+    std::array<Entry, kCowSequenceOp + 1> by_type;
+
+    // Ops written uncompressed to a compressed COW, because compression
+    // wouldn't have saved enough (see CowOptions::compression_min_savings),
+    // and how many of those skipped the compressor entirely.
+    uint64_t num_stored_uncompressed = 0;
+    uint64_t num_skipped_incompressible = 0;
 };
 
 // Interface for writing to a snapuserd COW. All operations are ordered; merges
@@ -55,9 +120,18 @@ class ICowWriter {
     // location of |new_block|.
     bool AddCopy(uint64_t new_block, uint64_t old_block);
 
+    // Encode a batch of copy operations, each given as a (new_block, old_block)
+    // pair. Equivalent to calling AddCopy() for every entry in order.
+    bool AddCopies(size_t num_copies, const std::pair<uint64_t, uint64_t>* copies);
+
     // Encode a sequence of raw blocks. |size| must be a multiple of the block size.
     bool AddRawBlocks(uint64_t new_block_start, const void* data, size_t size);
 
+    // Encode a sequence of raw blocks gathered from |iovcnt| buffers, which
+    // describe consecutive blocks starting at |new_block_start|. Each buffer's
+    // length must be a multiple of the block size.
+    bool AddRawBlocks(uint64_t new_block_start, const struct iovec* iov, size_t iovcnt);
+
     // Add a sequence of xor'd blocks. |size| must be a multiple of the block size.
     bool AddXorBlocks(uint32_t new_block_start, const void* data, size_t size, uint32_t old_block,
                       uint16_t offset);
@@ -92,21 +166,67 @@ class ICowWriter {
     virtual bool EmitLabel(uint64_t label) = 0;
     virtual bool EmitSequenceData(size_t num_ops, const uint32_t* data) = 0;
 
+    // Batch variants. The defaults fall back to the single-op Emit calls.
+    virtual bool EmitCopies(size_t num_copies, const std::pair<uint64_t, uint64_t>* copies);
+    virtual bool EmitVectoredRawBlocks(uint64_t new_block_start, const struct iovec* iov,
+                                       size_t iovcnt);
+
     bool ValidateNewBlock(uint64_t new_block);
 
   protected:
     CowOptions options_;
 };
 
+class CompressWorker {
+  public:
+    explicit CompressWorker(uint8_t compression, bool skip_incompressible = false);
+    bool RunThread();
+    // Compress |num_blocks| units of |block_size| bytes each, starting at |buffer|.
+    void EnqueueCompressBlocks(const void* buffer, size_t block_size, size_t num_blocks);
+    // Units that LooksIncompressible() are returned empty, when skipping them
+    // was requested.
+    bool GetCompressedBuffers(std::vector<std::basic_string<uint8_t>>* compressed_buf);
+    void Finalize();
+    static std::basic_string<uint8_t> Compress(uint8_t compression, const void* data,
+                                               size_t length);
+    // Cheap check for data that no compressor would do anything with.
+    static bool LooksIncompressible(const void* data, size_t length);
+
+  private:
+    struct CompressWork {
+        const void* buffer;
+        size_t block_size;
+        size_t num_blocks;
+        bool compression_status = false;
+        std::vector<std::basic_string<uint8_t>> compressed_data;
+    };
+
+    uint8_t compression_;
+    bool skip_incompressible_;
+
+    std::queue<CompressWork> work_queue_;
+    std::queue<CompressWork> compressed_queue_;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    bool stopped_ = false;
+
+    std::basic_string<uint8_t> Compress(const void* data, size_t length);
+    bool CompressBlocks(const void* buffer, size_t block_size, size_t num_blocks,
+                        std::vector<std::basic_string<uint8_t>>* compressed_data);
+};
+
 class CowWriter : public ICowWriter {
   public:
     explicit CowWriter(const CowOptions& options);
+    ~CowWriter();
 
     // Set up the writer.
     // The file starts from the beginning.
     //
     // If fd is < 0, the CowWriter will be opened against /dev/null. This is for
-    // computing COW sizes without using storage space.
+    // computing COW sizes without using storage space: data still goes through
+    // the compressor, but nothing is written, and GetCowSize() and
+    // GetOpStats() report what the COW would contain.
     bool Initialize(android::base::unique_fd&& fd);
     bool Initialize(android::base::borrowed_fd fd);
     // Set up a writer, assuming that the given label is the last valid label.
@@ -121,6 +241,8 @@ class CowWriter : public ICowWriter {
 
     uint32_t GetCowVersion() { return header_.major_version; }
 
+    const CowOpStats& GetOpStats() const { return op_stats_; }
+
   protected:
     virtual bool EmitCopy(uint64_t new_block, uint64_t old_block) override;
     virtual bool EmitRawBlocks(uint64_t new_block_start, const void* data, size_t size) override;
@@ -129,10 +251,13 @@ class CowWriter : public ICowWriter {
     virtual bool EmitZeroBlocks(uint64_t new_block_start, uint64_t num_blocks) override;
     virtual bool EmitLabel(uint64_t label) override;
     virtual bool EmitSequenceData(size_t num_ops, const uint32_t* data) override;
+    virtual bool EmitCopies(size_t num_copies,
+                            const std::pair<uint64_t, uint64_t>* copies) override;
 
   private:
     bool EmitCluster();
     bool EmitClusterIfNeeded();
+    bool NeedsCluster() const;
     bool EmitBlocks(uint64_t new_block_start, const void* data, size_t size, uint64_t old_block,
                     uint16_t offset, uint8_t type);
     void SetupHeaders();
@@ -142,9 +267,42 @@ class CowWriter : public ICowWriter {
     bool GetDataPos(uint64_t* pos);
     bool WriteRawData(const void* data, size_t size);
     bool WriteOperation(const CowOperation& op, const void* data = nullptr, size_t size = 0);
+    bool WriteOperations(const std::vector<CowOperation>& ops);
     void AddOperation(const CowOperation& op);
-    std::basic_string<uint8_t> Compress(const void* data, size_t length);
     void InitPos();
+    void InitWorkers();
+    void InitAsyncWrites();
+    bool QueueWrite(const void* data, size_t size, uint64_t offset);
+    bool ReapWrites(size_t max_inflight);
+    bool CompressBlocks(size_t num_blocks, const void* data, size_t block_size,
+                        std::vector<std::basic_string<uint8_t>>* compressed_data);
+    bool EmitSingleBlocks(uint64_t new_block_start, const void* data, size_t size,
+                          uint64_t old_block, uint16_t offset, uint8_t type);
+    bool EmitExtents(uint64_t new_block_start, const void* data, size_t size);
+
+    // Content hash of a replace block or extent, see CowOptions::dedup_replace_blocks.
+    struct DedupKey {
+        uint64_t hash[2];
+        uint32_t num_blocks;
+        bool operator==(const DedupKey& other) const {
+            return hash[0] == other.hash[0] && hash[1] == other.hash[1] &&
+                   num_blocks == other.num_blocks;
+        }
+    };
+    struct DedupKeyHash {
+        size_t operator()(const DedupKey& key) const { return key.hash[0]; }
+    };
+    // Where the data of the first op with a given key was written.
+    struct DedupEntry {
+        uint64_t data_pos;
+        uint32_t data_length;
+        uint8_t compression;
+    };
+    bool CompressData(const void* data, size_t length, bool precompressed,
+                      std::basic_string<uint8_t>* compressed, bool* skipped);
+    void NoteStoredUncompressed(bool skipped);
+    DedupKey MakeDedupKey(const void* data, uint32_t num_blocks) const;
+    bool EmitSharedData(uint64_t new_block, uint32_t num_blocks, const DedupEntry& entry);
 
     bool SetFd(android::base::borrowed_fd fd);
     bool Sync();
@@ -164,6 +322,24 @@ class CowWriter : public ICowWriter {
     bool is_dev_null_ = false;
     bool merge_in_progress_ = false;
     bool is_block_device_ = false;
+    uint32_t extent_blocks_ = 1;
+    bool dedup_ = false;
+    std::unordered_map<DedupKey, DedupEntry, DedupKeyHash> dedup_table_;
+    CowOpStats op_stats_;
+
+    std::vector<std::unique_ptr<CompressWorker>> compress_threads_;
+    std::vector<std::future<bool>> threads_;
+
+    // Asynchronous write state, see CowOptions::async_write_depth.
+    struct AsyncWrite {
+        std::basic_string<uint8_t> buffer;
+        uint64_t offset = 0;
+    };
+    std::unique_ptr<struct io_uring> ring_;
+    std::vector<AsyncWrite> async_writes_;
+    std::vector<size_t> free_async_writes_;
+    size_t inflight_writes_ = 0;
+    bool async_write_failed_ = false;
 
     // :TODO: this is not efficient, but stringstream ubsan aborts because some
     // bytes overflow a signed char.
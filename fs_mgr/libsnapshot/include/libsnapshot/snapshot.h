@@ -589,6 +589,14 @@ class SnapshotManager final : public ISnapshotManager {
     // Helpers for merging.
     MergeFailureCode MergeSecondPhaseSnapshots(LockedFile* lock);
     MergeFailureCode SwitchSnapshotToMerge(LockedFile* lock, const std::string& name);
+    // Switches the first |count| of |snapshots| to merge targets, after putting
+    // them in merge order.
+    MergeFailureCode StartQueuedMerges(LockedFile* lock, std::vector<std::string>* snapshots,
+                                       size_t count);
+    // Puts the partitions in ro.virtual_ab.merge_order first, then the rest by
+    // how much they have been read since boot.
+    void OrderSnapshotsForMerge(std::vector<std::string>* snapshots);
+    uint64_t GetSnapshotSectorsRead(const std::string& name);
     MergeFailureCode RewriteSnapshotDeviceTable(const std::string& dm_name);
     bool MarkSnapshotMergeCompleted(LockedFile* snapshot_lock, const std::string& snapshot_name);
     void AcknowledgeMergeSuccess(LockedFile* lock);
@@ -81,6 +81,9 @@ class CompressedSnapshotWriter final : public ISnapshotWriter {
     bool EmitZeroBlocks(uint64_t new_block_start, uint64_t num_blocks) override;
     bool EmitLabel(uint64_t label) override;
     bool EmitSequenceData(size_t num_ops, const uint32_t* data) override;
+    bool EmitCopies(size_t num_copies, const std::pair<uint64_t, uint64_t>* copies) override;
+    bool EmitVectoredRawBlocks(uint64_t new_block_start, const struct iovec* iov,
+                               size_t iovcnt) override;
 
   private:
     std::unique_ptr<CowReader> OpenCowReader() const;
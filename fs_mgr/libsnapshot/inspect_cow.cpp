@@ -13,15 +13,21 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 //
+#include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
 
+#include <array>
+#include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/unique_fd.h>
 #include <libsnapshot/cow_reader.h>
 
@@ -38,9 +44,10 @@ void MyLogger(android::base::LogId, android::base::LogSeverity severity, const c
 }
 
 static void usage(void) {
-    LOG(ERROR) << "Usage: inspect_cow [-sd] <COW_FILE>";
+    LOG(ERROR) << "Usage: inspect_cow [-sd] [-j N] <COW_FILE>";
     LOG(ERROR) << "\t -s Run Silent";
-    LOG(ERROR) << "\t -d Attempt to decompress";
+    LOG(ERROR) << "\t -d Attempt to decompress, and report decompression statistics";
+    LOG(ERROR) << "\t -j Decompress with N threads (default 1)";
     LOG(ERROR) << "\t -b Show data for failed decompress";
     LOG(ERROR) << "\t -l Show ops";
     LOG(ERROR) << "\t -m Show ops in reverse merge order";
@@ -61,6 +68,7 @@ struct Options {
     bool verify_sequence;
     OpIter iter_type;
     bool include_merged;
+    unsigned int jobs;
 };
 
 // Sink that always appends to the end of a string.
@@ -83,22 +91,173 @@ class StringSink : public IByteSink {
 
 static void ShowBad(CowReader& reader, const struct CowOperation& op) {
     size_t count;
-    auto buffer = std::make_unique<uint8_t[]>(op.data_length);
+    uint32_t data_length = GetCowOpDataLength(op);
+    auto buffer = std::make_unique<uint8_t[]>(data_length);
 
-    if (!reader.GetRawBytes(op.source, buffer.get(), op.data_length, &count)) {
+    if (!reader.GetRawBytes(GetCowOpSourceOffset(op), buffer.get(), data_length, &count)) {
         std::cerr << "Failed to read at all!\n";
     } else {
         std::cout << "The Block data is:\n";
-        for (int i = 0; i < op.data_length; i++) {
+        for (uint32_t i = 0; i < data_length; i++) {
             std::cout << std::hex << (int)buffer[i];
         }
         std::cout << std::dec << "\n\n";
-        if (op.data_length >= sizeof(CowOperation)) {
+        if (data_length >= sizeof(CowOperation)) {
             std::cout << "The start, as an op, would be " << *(CowOperation*)buffer.get() << "\n";
         }
     }
 }
 
+// Stored size as a percentage of the uncompressed size, in steps of 10%.
+// The last bucket is for data that didn't compress at all.
+static constexpr size_t kRatioBuckets = 11;
+
+struct DecompressStats {
+    uint64_t ops = 0;
+    uint64_t stored_bytes = 0;
+    uint64_t output_bytes = 0;
+    std::chrono::nanoseconds time{0};
+};
+
+struct DecompressResult {
+    std::map<uint8_t, DecompressStats> by_type;
+    std::array<uint64_t, kRatioBuckets> ratios{};
+    std::vector<const CowOperation*> failed;
+};
+
+static void DecompressOps(CowReader* reader, const std::vector<const CowOperation*>& ops,
+                          size_t begin, size_t end, DecompressResult* result) {
+    StringSink sink;
+    for (size_t i = begin; i < end; i++) {
+        const CowOperation& op = *ops[i];
+        auto start = std::chrono::steady_clock::now();
+        bool ok = reader->ReadData(op, &sink);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        if (!ok) {
+            result->failed.emplace_back(&op);
+            sink.Reset();
+            continue;
+        }
+
+        auto& stats = result->by_type[op.type];
+        stats.ops++;
+        stats.stored_bytes += GetCowOpDataLength(op);
+        stats.output_bytes += sink.stream().size();
+        stats.time += elapsed;
+
+        size_t bucket = kRatioBuckets - 1;
+        if (!sink.stream().empty()) {
+            bucket = std::min<size_t>(GetCowOpDataLength(op) * 10 / sink.stream().size(),
+                                      kRatioBuckets - 1);
+        }
+        result->ratios[bucket]++;
+        sink.Reset();
+    }
+}
+
+static double MiBPerSecond(uint64_t bytes, std::chrono::nanoseconds time) {
+    double seconds = std::chrono::duration<double>(time).count();
+    if (seconds == 0) {
+        return 0;
+    }
+    return bytes / seconds / (1024 * 1024);
+}
+
+// Decompresses |ops| across opt.jobs threads, each with its own clone of
+// |reader|. The ops are split into contiguous ranges, so that every thread
+// reads its part of the COW sequentially.
+static bool Decompress(const std::string& path, CowReader& reader,
+                       const std::vector<const CowOperation*>& ops, const Options& opt) {
+    size_t jobs = std::max<size_t>(1, std::min<size_t>(opt.jobs, ops.size()));
+
+    std::vector<std::unique_ptr<CowReader>> clones;
+    for (size_t i = 1; i < jobs; i++) {
+        android::base::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (fd < 0) {
+            PLOG(ERROR) << "open failed: " << path;
+            return false;
+        }
+        auto clone = reader.CloneCowReader();
+        if (!clone->InitForMerge(std::move(fd))) {
+            LOG(ERROR) << "could not clone reader: " << path;
+            return false;
+        }
+        clones.emplace_back(std::move(clone));
+    }
+
+    std::vector<DecompressResult> results(jobs);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < jobs; i++) {
+        CowReader* worker_reader = i == 0 ? &reader : clones[i - 1].get();
+        size_t begin = ops.size() * i / jobs;
+        size_t end = ops.size() * (i + 1) / jobs;
+        threads.emplace_back(DecompressOps, worker_reader, std::cref(ops), begin, end,
+                             &results[i]);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto wall_time = std::chrono::steady_clock::now() - start;
+
+    DecompressResult total;
+    for (const auto& result : results) {
+        for (const auto& [type, stats] : result.by_type) {
+            auto& sum = total.by_type[type];
+            sum.ops += stats.ops;
+            sum.stored_bytes += stats.stored_bytes;
+            sum.output_bytes += stats.output_bytes;
+            sum.time += stats.time;
+        }
+        for (size_t i = 0; i < kRatioBuckets; i++) {
+            total.ratios[i] += result.ratios[i];
+        }
+        total.failed.insert(total.failed.end(), result.failed.begin(), result.failed.end());
+    }
+
+    for (const auto op : total.failed) {
+        std::cerr << "Failed to decompress for :" << *op << "\n";
+        if (opt.show_bad) ShowBad(reader, *op);
+    }
+
+    if (!opt.silent) {
+        DecompressStats all;
+        std::cout << "\nDecompression with " << jobs << " thread(s):\n";
+        for (const auto& [type, stats] : total.by_type) {
+            const char* name = type == kCowXorOp ? "Xor" : "Replace";
+            std::cout << std::setw(8) << name << ": " << stats.ops << " ops, "
+                      << stats.stored_bytes << " bytes stored, " << stats.output_bytes
+                      << " bytes out, "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(stats.time).count()
+                      << " ms, " << std::fixed << std::setprecision(1)
+                      << MiBPerSecond(stats.output_bytes, stats.time) << " MiB/s per thread\n"
+                      << std::defaultfloat;
+            all.ops += stats.ops;
+            all.stored_bytes += stats.stored_bytes;
+            all.output_bytes += stats.output_bytes;
+        }
+        auto wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(wall_time);
+        std::cout << "Total: " << all.ops << " ops, " << all.output_bytes << " bytes in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(wall_ns).count()
+                  << " ms, " << std::fixed << std::setprecision(1)
+                  << MiBPerSecond(all.output_bytes, wall_ns) << " MiB/s output, "
+                  << MiBPerSecond(all.stored_bytes, wall_ns) << " MiB/s input\n"
+                  << std::defaultfloat;
+
+        std::cout << "Compression ratio (stored / uncompressed):\n";
+        for (size_t i = 0; i < kRatioBuckets; i++) {
+            if (i + 1 < kRatioBuckets) {
+                std::cout << std::setw(4) << i * 10 << "-" << std::setw(3) << (i + 1) * 10
+                          << "%: ";
+            } else {
+                std::cout << "   >=100%: ";
+            }
+            std::cout << total.ratios[i] << "\n";
+        }
+    }
+    return total.failed.empty();
+}
+
 static bool Inspect(const std::string& path, Options opt) {
     android::base::unique_fd fd(open(path.c_str(), O_RDONLY));
     if (fd < 0) {
@@ -153,21 +312,16 @@ static bool Inspect(const std::string& path, Options opt) {
     } else if (opt.iter_type == Merge) {
         iter = reader.GetMergeOpIter(opt.include_merged);
     }
-    StringSink sink;
     bool success = true;
     uint64_t xor_ops = 0, copy_ops = 0, replace_ops = 0, zero_ops = 0;
+    std::vector<const CowOperation*> data_ops;
     while (!iter->Done()) {
         const CowOperation& op = iter->Get();
 
         if (!opt.silent && opt.show_ops) std::cout << op << "\n";
 
-        if (opt.decompress && op.type == kCowReplaceOp && op.compression != kCowCompressNone) {
-            if (!reader.ReadData(op, &sink)) {
-                std::cerr << "Failed to decompress for :" << op << "\n";
-                success = false;
-                if (opt.show_bad) ShowBad(reader, op);
-            }
-            sink.Reset();
+        if (opt.decompress && (op.type == kCowReplaceOp || op.type == kCowXorOp)) {
+            data_ops.emplace_back(&op);
         }
 
         if (op.type == kCowSequenceOp && opt.show_seq) {
@@ -208,6 +362,9 @@ static bool Inspect(const std::string& path, Options opt) {
                   << " Xor_ops: " << xor_ops << std::endl;
     }
 
+    if (opt.decompress && !Decompress(path, reader, data_ops, opt)) {
+        success = false;
+    }
     return success;
 }
 
@@ -223,7 +380,8 @@ int main(int argc, char** argv) {
     opt.iter_type = android::snapshot::Normal;
     opt.verify_sequence = false;
     opt.include_merged = false;
-    while ((ch = getopt(argc, argv, "sdbmnolva")) != -1) {
+    opt.jobs = 1;
+    while ((ch = getopt(argc, argv, "sdbmnolvaj:")) != -1) {
         switch (ch) {
             case 's':
                 opt.silent = true;
@@ -252,6 +410,12 @@ int main(int argc, char** argv) {
             case 'a':
                 opt.include_merged = true;
                 break;
+            case 'j':
+                if (!android::base::ParseUint(optarg, &opt.jobs) || opt.jobs == 0) {
+                    android::snapshot::usage();
+                    return 1;
+                }
+                break;
             default:
                 android::snapshot::usage();
         }
@@ -16,12 +16,15 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <math.h>
 #include <sys/file.h>
 #include <sys/types.h>
 #include <sys/unistd.h>
 
+#include <algorithm>
 #include <filesystem>
+#include <future>
 #include <optional>
 #include <thread>
 #include <unordered_set>
@@ -591,8 +594,11 @@ bool SnapshotManager::MapSnapshot(LockedFile* lock, const std::string& name,
         case UpdateState::Merging:
         case UpdateState::MergeFailed:
             // Note: MergeFailed indicates that a merge is in progress, but
-            // is possibly stalled. We still have to honor the merge.
-            if (DecideMergePhase(status) == update_status.merge_phase()) {
+            // is possibly stalled. We still have to honor the merge, unless
+            // this snapshot is still queued behind the concurrency limit.
+            if (DecideMergePhase(status) == update_status.merge_phase() &&
+                !(update_status.merge_concurrency() > 0 &&
+                  status.state() == SnapshotState::CREATED)) {
                 mode = SnapshotStorageMode::Merge;
             } else {
                 mode = SnapshotStorageMode::Persistent;
@@ -828,23 +834,35 @@ bool SnapshotManager::InitiateMerge() {
     // If any partitions shrunk, we need to merge them before we merge any other
     // partitions (see b/177935716). Otherwise, a merge from another partition
     // may overwrite the source block of a copy operation.
-    const std::vector<std::string>* merge_group;
+    std::vector<std::string> merge_group;
     if (first_merge_group.empty()) {
-        merge_group = &snapshots;
+        merge_group = snapshots;
         initial_status.set_merge_phase(MergePhase::SECOND_PHASE);
     } else {
-        merge_group = &first_merge_group;
+        merge_group = std::move(first_merge_group);
         initial_status.set_merge_phase(MergePhase::FIRST_PHASE);
     }
 
+    // Merge the partitions that are read the most first, so that they stop
+    // paying for the snapshot sooner. If the number of concurrent merges is
+    // limited, the rest are queued, and CheckMergeState() starts them as
+    // earlier ones complete.
+    OrderSnapshotsForMerge(&merge_group);
+    initial_status.set_merge_concurrency(GetMergeConcurrency());
+    size_t num_to_start = merge_group.size();
+    if (initial_status.merge_concurrency() > 0) {
+        num_to_start = std::min<size_t>(num_to_start, initial_status.merge_concurrency());
+    }
+
     // Point of no return - mark that we're starting a merge. From now on every
-    // eligible snapshot must be a merge target.
+    // eligible snapshot must be a merge target, or queued to become one.
     if (!WriteSnapshotUpdateStatus(lock.get(), initial_status)) {
         return false;
     }
 
     auto reported_code = MergeFailureCode::Ok;
-    for (const auto& snapshot : *merge_group) {
+    for (size_t i = 0; i < num_to_start; i++) {
+        const auto& snapshot = merge_group[i];
         // If this fails, we have no choice but to continue. Everything must
         // be merged. This is not an ideal state to be in, but it is safe,
         // because we the next boot will try again.
@@ -1100,6 +1118,8 @@ auto SnapshotManager::CheckMergeState(LockedFile* lock, const std::function<bool
     bool merging = false;
     bool needs_reboot = false;
     bool wrong_phase = false;
+    size_t num_merging = 0;
+    std::vector<std::string> queued;
     MergeFailureCode failure_code = MergeFailureCode::Ok;
     for (const auto& snapshot : snapshots) {
         if (android::base::EndsWith(snapshot, other_suffix)) {
@@ -1108,6 +1128,21 @@ auto SnapshotManager::CheckMergeState(LockedFile* lock, const std::function<bool
             continue;
         }
 
+        if (update_status.merge_concurrency() > 0 && IsSnapshotDevice(snapshot)) {
+            // Snapshots of the current phase that haven't been switched to a
+            // merge target yet are waiting for a free merge slot.
+            SnapshotStatus snapshot_status;
+            if (!ReadSnapshotStatus(lock, snapshot, &snapshot_status)) {
+                return MergeResult(UpdateState::MergeFailed, MergeFailureCode::ReadStatus);
+            }
+            if (snapshot_status.state() == SnapshotState::CREATED &&
+                DecideMergePhase(snapshot_status) == update_status.merge_phase()) {
+                LOG(INFO) << "Snapshot " << snapshot << " is queued for merge";
+                queued.emplace_back(snapshot);
+                continue;
+            }
+        }
+
         auto result = CheckTargetMergeState(lock, snapshot, update_status);
         LOG(INFO) << "CheckTargetMergeState for " << snapshot << " returned: " << result.state;
 
@@ -1120,6 +1155,7 @@ auto SnapshotManager::CheckMergeState(LockedFile* lock, const std::function<bool
                 break;
             case UpdateState::Merging:
                 merging = true;
+                num_merging++;
                 break;
             case UpdateState::MergeNeedsReboot:
                 needs_reboot = true;
@@ -1142,6 +1178,20 @@ auto SnapshotManager::CheckMergeState(LockedFile* lock, const std::function<bool
         }
     }
 
+    if (!queued.empty()) {
+        // Don't start anything new once something has failed; the queued
+        // snapshots will be picked up again when the merge is retried.
+        if (failure_code == MergeFailureCode::Ok &&
+            num_merging < update_status.merge_concurrency()) {
+            auto code = StartQueuedMerges(lock, &queued,
+                                          update_status.merge_concurrency() - num_merging);
+            if (code != MergeFailureCode::Ok) {
+                failure_code = code;
+            }
+        }
+        merging = true;
+    }
+
     if (merging) {
         // Note that we handle "Merging" before we handle anything else. We
         // want to poll until *nothing* is merging if we can, so everything has
@@ -1423,7 +1473,7 @@ MergeFailureCode SnapshotManager::MergeSecondPhaseSnapshots(LockedFile* lock) {
         return MergeFailureCode::WriteStatus;
     }
 
-    MergeFailureCode result = MergeFailureCode::Ok;
+    std::vector<std::string> second_phase;
     for (const auto& snapshot : snapshots) {
         SnapshotStatus snapshot_status;
         if (!ReadSnapshotStatus(lock, snapshot, &snapshot_status)) {
@@ -1432,9 +1482,28 @@ MergeFailureCode SnapshotManager::MergeSecondPhaseSnapshots(LockedFile* lock) {
         if (DecideMergePhase(snapshot_status) != MergePhase::SECOND_PHASE) {
             continue;
         }
+        second_phase.emplace_back(snapshot);
+    }
+
+    size_t num_to_start = second_phase.size();
+    if (update_status.merge_concurrency() > 0) {
+        num_to_start = std::min<size_t>(num_to_start, update_status.merge_concurrency());
+    }
+    return StartQueuedMerges(lock, &second_phase, num_to_start);
+}
+
+MergeFailureCode SnapshotManager::StartQueuedMerges(LockedFile* lock,
+                                                    std::vector<std::string>* snapshots,
+                                                    size_t count) {
+    OrderSnapshotsForMerge(snapshots);
+    count = std::min(count, snapshots->size());
+
+    MergeFailureCode result = MergeFailureCode::Ok;
+    for (size_t i = 0; i < count; i++) {
+        const auto& snapshot = (*snapshots)[i];
         auto code = SwitchSnapshotToMerge(lock, snapshot);
         if (code != MergeFailureCode::Ok) {
-            LOG(ERROR) << "Failed to switch snapshot to a second-phase merge target: " << snapshot;
+            LOG(ERROR) << "Failed to switch snapshot to a merge target: " << snapshot;
             if (result == MergeFailureCode::Ok) {
                 result = code;
             }
@@ -1443,6 +1512,59 @@ MergeFailureCode SnapshotManager::MergeSecondPhaseSnapshots(LockedFile* lock) {
     return result;
 }
 
+void SnapshotManager::OrderSnapshotsForMerge(std::vector<std::string>* snapshots) {
+    auto priority_list = GetMergePriorityList();
+    auto slot_suffix = device_->GetSlotSuffix();
+
+    struct MergeOrder {
+        size_t priority;
+        uint64_t sectors_read;
+    };
+    std::map<std::string, MergeOrder> order;
+    for (const auto& snapshot : *snapshots) {
+        // Partitions missing from the priority list go after all the ones
+        // in it.
+        size_t priority = priority_list.size();
+        for (size_t i = 0; i < priority_list.size(); i++) {
+            if (priority_list[i] + slot_suffix == snapshot) {
+                priority = i;
+                break;
+            }
+        }
+        order[snapshot] = {priority, GetSnapshotSectorsRead(snapshot)};
+    }
+
+    std::stable_sort(snapshots->begin(), snapshots->end(),
+                     [&order](const std::string& a, const std::string& b) {
+                         const auto& x = order[a];
+                         const auto& y = order[b];
+                         if (x.priority != y.priority) {
+                             return x.priority < y.priority;
+                         }
+                         return x.sectors_read > y.sectors_read;
+                     });
+}
+
+uint64_t SnapshotManager::GetSnapshotSectorsRead(const std::string& name) {
+    std::string dm_path;
+    if (!dm_.GetDmDevicePathByName(name, &dm_path)) {
+        return 0;
+    }
+
+    // See Documentation/block/stat.rst: the third field is the number of
+    // sectors read since the device was created.
+    std::string stat_path = "/sys/block/" + android::base::Basename(dm_path) + "/stat";
+    std::string stat;
+    if (!android::base::ReadFileToString(stat_path, &stat)) {
+        return 0;
+    }
+    uint64_t sectors_read;
+    if (sscanf(stat.c_str(), "%*u %*u %" SCNu64, &sectors_read) != 1) {
+        return 0;
+    }
+    return sectors_read;
+}
+
 std::string SnapshotManager::GetSnapshotBootIndicatorPath() {
     return metadata_dir_ + "/" + android::base::Basename(kBootIndicatorPath);
 }
@@ -2916,6 +3038,7 @@ bool SnapshotManager::WriteUpdateState(LockedFile* lock, UpdateState state,
         status.set_merge_phase(old_status.merge_phase());
         status.set_userspace_snapshots(old_status.userspace_snapshots());
         status.set_io_uring_enabled(old_status.io_uring_enabled());
+        status.set_merge_concurrency(old_status.merge_concurrency());
     }
     return WriteSnapshotUpdateStatus(lock, status);
 }
@@ -3440,15 +3563,33 @@ Return SnapshotManager::CreateUpdateSnapshotsInternal(
 
     LOG(INFO) << "Allocating CoW images.";
 
+    // Allocating an image is dominated by filesystem allocation and pinning
+    // of its blocks, which is independent for each image, so allocate all of
+    // them at once. The lock is held by this thread throughout.
+    if (!EnsureImageManager()) return Return::Error();
+
+    std::vector<std::pair<std::string, std::future<Return>>> allocations;
     for (auto&& [name, snapshot_status] : *all_snapshot_status) {
         // Create the backing COW image if necessary.
         if (snapshot_status.cow_file_size() > 0) {
-            auto ret = CreateCowImage(lock, name);
-            if (!ret.is_ok()) return AddRequiredSpace(ret, *all_snapshot_status);
+            allocations.emplace_back(name, std::async(std::launch::async,
+                                                      [this, lock, name = name]() -> Return {
+                                                          return CreateCowImage(lock, name);
+                                                      }));
         }
+    }
 
+    Return ret = Return::Ok();
+    for (auto& [name, allocation] : allocations) {
+        auto allocation_ret = allocation.get();
+        if (!allocation_ret.is_ok()) {
+            LOG(ERROR) << "Could not create COW image for " << name;
+            if (ret.is_ok()) ret = allocation_ret;
+            continue;
+        }
         LOG(INFO) << "Successfully created snapshot for " << name;
     }
+    if (!ret.is_ok()) return AddRequiredSpace(ret, *all_snapshot_status);
 
     return Return::Ok();
 }
@@ -16,6 +16,9 @@
 
 #include "snapshot_reader.h"
 
+#include <algorithm>
+#include <limits>
+
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <ext4_utils/ext4_utils.h>
@@ -25,6 +28,9 @@ namespace snapshot {
 
 using android::base::borrowed_fd;
 
+static constexpr uint64_t kNoChunk = std::numeric_limits<uint64_t>::max();
+static constexpr size_t kMinReadaheadBlocks = 8;
+
 // Not supported.
 bool ReadOnlyFileDescriptor::Open(const char*, int, mode_t) {
     errno = EINVAL;
@@ -79,6 +85,7 @@ bool ReadFdFileDescriptor::Flush() {
 
 bool CompressedSnapshotReader::SetCow(std::unique_ptr<CowReader>&& cow) {
     cow_ = std::move(cow);
+    InvalidateCache();
 
     CowHeader header;
     if (!cow_->GetHeader(&header)) {
@@ -160,6 +167,16 @@ class MemoryByteSink : public IByteSink {
 };
 
 ssize_t CompressedSnapshotReader::Read(void* buf, size_t count) {
+    if (count == 0) {
+        errno = 0;
+        return 0;
+    }
+    if (cache_.empty()) {
+        cache_.resize(kCacheBlocks * block_size_);
+        cache_chunks_.assign(kCacheBlocks, kNoChunk);
+        readahead_buffer_.resize(kMaxReadaheadBlocks * block_size_);
+    }
+
     // Find the start and end chunks, inclusive.
     uint64_t start_chunk = offset_ / block_size_;
     uint64_t end_chunk = (offset_ + count - 1) / block_size_;
@@ -167,147 +184,197 @@ ssize_t CompressedSnapshotReader::Read(void* buf, size_t count) {
     // Chop off the first N bytes if the position is not block-aligned.
     size_t start_offset = offset_ % block_size_;
 
-    MemoryByteSink sink(buf, count);
-
-    size_t initial_bytes = std::min(block_size_ - start_offset, sink.remaining());
-    ssize_t rv = ReadBlock(start_chunk, &sink, start_offset, initial_bytes);
-    if (rv < 0) {
-        return -1;
+    // Grow the readahead window while the reads are sequential, and drop it
+    // as soon as they aren't.
+    if (offset_ == last_read_end_) {
+        readahead_blocks_ = std::clamp<size_t>(readahead_blocks_ * 2, kMinReadaheadBlocks,
+                                               kMaxReadaheadBlocks);
+    } else {
+        readahead_blocks_ = 0;
     }
-    offset_ += rv;
-
-    for (uint64_t chunk = start_chunk + 1; chunk < end_chunk; chunk++) {
-        ssize_t rv = ReadBlock(chunk, &sink, 0);
-        if (rv < 0) {
-            return -1;
-        }
-        offset_ += rv;
+    uint64_t num_chunks = kNoChunk;
+    if (block_device_size_) {
+        num_chunks = (block_device_size_ + block_size_ - 1) / block_size_;
     }
 
-    if (sink.remaining()) {
-        ssize_t rv = ReadBlock(end_chunk, &sink, 0, {sink.remaining()});
-        if (rv < 0) {
-            return -1;
+    uint8_t* out = reinterpret_cast<uint8_t*>(buf);
+    size_t remaining = count;
+    for (uint64_t chunk = start_chunk; chunk <= end_chunk; chunk++) {
+        const uint8_t* block = FindCachedBlock(chunk);
+        if (!block) {
+            uint64_t required = std::min<uint64_t>(end_chunk - chunk + 1, kMaxReadaheadBlocks);
+            uint64_t window = readahead_blocks_;
+            if (chunk < num_chunks) {
+                window = std::min(window, num_chunks - chunk);
+            }
+            if (!FillCache(chunk, required, std::max(required, window))) {
+                return -1;
+            }
+            block = FindCachedBlock(chunk);
+            CHECK(block);
         }
-        offset_ += rv;
+
+        size_t bytes = std::min<size_t>(block_size_ - start_offset, remaining);
+        memcpy(out, block + start_offset, bytes);
+        out += bytes;
+        remaining -= bytes;
+        start_offset = 0;
     }
 
+    offset_ += count;
+    last_read_end_ = offset_;
     errno = 0;
-
-    DCHECK(sink.pos() - sink.buf() == count);
     return count;
 }
 
-// Discard the first N bytes of a sink request, or any excess bytes.
-class PartialSink : public MemoryByteSink {
-  public:
-    PartialSink(void* buffer, size_t size, size_t ignore_start)
-        : MemoryByteSink(buffer, size), ignore_start_(ignore_start) {}
+const CowOperation* CompressedSnapshotReader::GetOp(uint64_t chunk) const {
+    if (chunk < ops_.size()) {
+        return ops_[chunk];
+    }
+    return nullptr;
+}
 
-    void* GetBuffer(size_t requested, size_t* actual) override {
-        // Throw away the first N bytes if needed.
-        if (ignore_start_) {
-            *actual = std::min({requested, ignore_start_, sizeof(discard_)});
-            ignore_start_ -= *actual;
-            return discard_;
+bool CompressedSnapshotReader::FillCache(uint64_t chunk, uint64_t required, uint64_t count) {
+    CHECK(count <= kMaxReadaheadBlocks);
+
+    uint64_t i = 0;
+    while (i < count) {
+        uint64_t current = chunk + i;
+        if (FindCachedBlock(current)) {
+            i++;
+            continue;
         }
-        // Throw away any excess bytes if needed.
-        if (remaining() == 0) {
-            *actual = std::min(requested, sizeof(discard_));
-            return discard_;
+
+        const CowOperation* op = GetOp(current);
+        if (op && op->type != kCowCopyOp) {
+            if (!ReadCowBlock(op, readahead_buffer_.data())) {
+                // ReadCowBlock logs and sets errno.
+                return i >= required;
+            }
+            InsertCachedBlock(current, readahead_buffer_.data());
+            i++;
+            continue;
         }
-        return MemoryByteSink::GetBuffer(requested, actual);
-    }
 
-  private:
-    size_t ignore_start_;
-    char discard_[BLOCK_SZ];
-};
+        // Unchanged and copied blocks both come from the base device; read
+        // as many of them as are contiguous there at once.
+        uint64_t source = op ? op->source : current;
+        uint64_t run = 1;
+        while (i + run < count && !FindCachedBlock(current + run)) {
+            const CowOperation* next = GetOp(current + run);
+            if (next && next->type != kCowCopyOp) {
+                break;
+            }
+            if ((next ? next->source : current + run) != source + run) {
+                break;
+            }
+            run++;
+        }
 
-ssize_t CompressedSnapshotReader::ReadBlock(uint64_t chunk, IByteSink* sink, size_t start_offset,
-                                            const std::optional<uint64_t>& max_bytes) {
-    size_t bytes_to_read = block_size_;
-    if (max_bytes) {
-        bytes_to_read = *max_bytes;
+        if (!ReadSourceBlocks(source, run, readahead_buffer_.data())) {
+            if (i >= required) {
+                // Readahead past the end of the base device, most likely.
+                return true;
+            }
+            if (i + run > required) {
+                // Try again without the speculative part.
+                count = required;
+                continue;
+            }
+            PLOG(ERROR) << "read " << source_device_.value_or("");
+            return false;
+        }
+        for (uint64_t j = 0; j < run; j++) {
+            InsertCachedBlock(current + j, readahead_buffer_.data() + j * block_size_);
+        }
+        i += run;
     }
+    return true;
+}
 
-    // The offset is relative to the chunk; we should be reading no more than
-    // one chunk.
-    CHECK(start_offset + bytes_to_read <= block_size_);
-
-    const CowOperation* op = nullptr;
-    if (chunk < ops_.size()) {
-        op = ops_[chunk];
+bool CompressedSnapshotReader::ReadSourceBlocks(uint64_t source, uint64_t count,
+                                                uint8_t* buffer) {
+    borrowed_fd fd = GetSourceFd();
+    if (fd < 0) {
+        // GetSourceFd sets errno.
+        return false;
     }
+    // ReadFullyAtOffset sets errno.
+    return android::base::ReadFullyAtOffset(fd, buffer, count * block_size_,
+                                            source * block_size_);
+}
 
-    size_t actual;
-    void* buffer = sink->GetBuffer(bytes_to_read, &actual);
-    if (!buffer || actual < bytes_to_read) {
-        // This should never happen unless we calculated the read size wrong
-        // somewhere. MemoryByteSink always fulfills the entire requested
-        // region unless there's not enough buffer remaining.
-        LOG(ERROR) << "Asked for buffer of size " << bytes_to_read << ", got " << actual;
-        errno = EINVAL;
-        return -1;
+bool CompressedSnapshotReader::ReadCowBlock(const CowOperation* op, uint8_t* buffer) {
+    if (op->type == kCowZeroOp) {
+        memset(buffer, 0, block_size_);
+        return true;
     }
-
-    if (!op || op->type == kCowCopyOp) {
-        borrowed_fd fd = GetSourceFd();
-        if (fd < 0) {
-            // GetSourceFd sets errno.
-            return -1;
-        }
-
-        if (op) {
-            chunk = op->source;
-        }
-
-        off64_t offset = (chunk * block_size_) + start_offset;
-        if (!android::base::ReadFullyAtOffset(fd, buffer, bytes_to_read, offset)) {
-            PLOG(ERROR) << "read " << *source_device_;
-            // ReadFullyAtOffset sets errno.
-            return -1;
-        }
-    } else if (op->type == kCowZeroOp) {
-        memset(buffer, 0, bytes_to_read);
-    } else if (op->type == kCowReplaceOp) {
-        PartialSink partial_sink(buffer, bytes_to_read, start_offset);
-        if (!cow_->ReadData(*op, &partial_sink)) {
+    if (op->type == kCowReplaceOp) {
+        MemoryByteSink sink(buffer, block_size_);
+        if (!cow_->ReadData(*op, &sink)) {
             LOG(ERROR) << "CompressedSnapshotReader failed to read replace op";
             errno = EIO;
-            return -1;
+            return false;
         }
-    } else if (op->type == kCowXorOp) {
+        return true;
+    }
+    if (op->type == kCowXorOp) {
         borrowed_fd fd = GetSourceFd();
         if (fd < 0) {
             // GetSourceFd sets errno.
-            return -1;
+            return false;
         }
 
-        off64_t offset = op->source + start_offset;
+        // The source of an xor op is a byte offset, not a block.
         char data[BLOCK_SZ];
-        if (!android::base::ReadFullyAtOffset(fd, &data, bytes_to_read, offset)) {
+        if (!android::base::ReadFullyAtOffset(fd, &data, block_size_, op->source)) {
             PLOG(ERROR) << "read " << *source_device_;
             // ReadFullyAtOffset sets errno.
-            return -1;
+            return false;
         }
-        PartialSink partial_sink(buffer, bytes_to_read, start_offset);
-        if (!cow_->ReadData(*op, &partial_sink)) {
+        MemoryByteSink sink(buffer, block_size_);
+        if (!cow_->ReadData(*op, &sink)) {
             LOG(ERROR) << "CompressedSnapshotReader failed to read xor op";
             errno = EIO;
-            return -1;
+            return false;
         }
-        for (size_t i = 0; i < bytes_to_read; i++) {
-            ((char*)buffer)[i] ^= data[i];
+        for (size_t i = 0; i < block_size_; i++) {
+            buffer[i] ^= data[i];
         }
-    } else {
-        LOG(ERROR) << "CompressedSnapshotReader unknown op type: " << uint32_t(op->type);
-        errno = EINVAL;
-        return -1;
+        return true;
     }
+    LOG(ERROR) << "CompressedSnapshotReader unknown op type: " << uint32_t(op->type);
+    errno = EINVAL;
+    return false;
+}
+
+void CompressedSnapshotReader::InvalidateCache() {
+    cache_ = {};
+    cache_chunks_ = {};
+    cache_index_ = {};
+    cache_next_ = 0;
+    readahead_buffer_ = {};
+    last_read_end_ = -1;
+    readahead_blocks_ = 0;
+}
 
-    // MemoryByteSink doesn't do anything in ReturnBuffer, so don't bother calling it.
-    return bytes_to_read;
+const uint8_t* CompressedSnapshotReader::FindCachedBlock(uint64_t chunk) const {
+    auto iter = cache_index_.find(chunk);
+    if (iter == cache_index_.end()) {
+        return nullptr;
+    }
+    return cache_.data() + iter->second * block_size_;
+}
+
+void CompressedSnapshotReader::InsertCachedBlock(uint64_t chunk, const uint8_t* data) {
+    size_t slot = cache_next_;
+    cache_next_ = (cache_next_ + 1) % kCacheBlocks;
+    if (cache_chunks_[slot] != kNoChunk) {
+        cache_index_.erase(cache_chunks_[slot]);
+    }
+    cache_chunks_[slot] = chunk;
+    cache_index_[chunk] = slot;
+    memcpy(cache_.data() + slot * block_size_, data, block_size_);
 }
 
 off64_t CompressedSnapshotReader::Seek(off64_t offset, int whence) {
@@ -336,6 +403,7 @@ uint64_t CompressedSnapshotReader::BlockDevSize() {
 bool CompressedSnapshotReader::Close() {
     cow_ = nullptr;
     source_fd_ = {};
+    InvalidateCache();
     return true;
 }
 
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <optional>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/file.h>
@@ -65,8 +66,24 @@ class CompressedSnapshotReader : public ReadOnlyFileDescriptor {
     bool Flush() override;
 
   private:
-    ssize_t ReadBlock(uint64_t chunk, IByteSink* sink, size_t start_offset,
-                      const std::optional<uint64_t>& max_bytes = {});
+    // Decompressed blocks are kept in a small cache, so that overlapping and
+    // unaligned reads don't decode the same op twice. Sequential readers get
+    // a readahead window that doubles up to kMaxReadaheadBlocks; the window
+    // is filled in one pass, with runs of contiguous source blocks read from
+    // the base device in a single read.
+    static constexpr size_t kMaxReadaheadBlocks = 128;
+    static constexpr size_t kCacheBlocks = kMaxReadaheadBlocks * 2;
+
+    const CowOperation* GetOp(uint64_t chunk) const;
+    // Fills the uncached blocks of [chunk, chunk + count). Only the first
+    // |required| blocks must be readable; the rest are speculative, and are
+    // given up on at the first error.
+    bool FillCache(uint64_t chunk, uint64_t required, uint64_t count);
+    bool ReadSourceBlocks(uint64_t source, uint64_t count, uint8_t* buffer);
+    bool ReadCowBlock(const CowOperation* op, uint8_t* buffer);
+    const uint8_t* FindCachedBlock(uint64_t chunk) const;
+    void InsertCachedBlock(uint64_t chunk, const uint8_t* data);
+    void InvalidateCache();
     android::base::borrowed_fd GetSourceFd();
 
     std::unique_ptr<CowReader> cow_;
@@ -79,6 +96,17 @@ class CompressedSnapshotReader : public ReadOnlyFileDescriptor {
     off64_t offset_ = 0;
 
     std::vector<const CowOperation*> ops_;
+
+    // Where the last read ended, and how far ahead sequential reads fetch.
+    off64_t last_read_end_ = -1;
+    size_t readahead_blocks_ = 0;
+
+    // A ring of kCacheBlocks blocks, replaced oldest first.
+    std::vector<uint8_t> cache_;
+    std::vector<uint64_t> cache_chunks_;
+    std::unordered_map<uint64_t, size_t> cache_index_;
+    size_t cache_next_ = 0;
+    std::vector<uint8_t> readahead_buffer_;
 };
 
 }  // namespace snapshot
@@ -142,9 +142,38 @@ class OfflineSnapshotTest : public ::testing::Test {
         ASSERT_EQ(value, MakeNewBlockString()[1000]);
     }
 
+    void TestSequentialReads(ISnapshotWriter* writer) {
+        auto reader = writer->OpenReader();
+        ASSERT_NE(reader, nullptr);
+
+        std::string expected;
+        for (size_t i = 0; i < kBlockCount; i++) {
+            std::string block(kBlockSize, 0);
+            ASSERT_EQ(reader->Seek(i * kBlockSize, SEEK_SET), i * kBlockSize);
+            ASSERT_EQ(reader->Read(block.data(), block.size()), kBlockSize);
+            expected += block;
+        }
+
+        // Reads that don't line up with blocks, so that the readahead window
+        // grows and blocks are served from the cache across reads.
+        reader = writer->OpenReader();
+        ASSERT_NE(reader, nullptr);
+
+        static constexpr size_t kChunkSize = 1000;
+        std::string data;
+        ASSERT_EQ(reader->Seek(0, SEEK_SET), 0);
+        while (data.size() < expected.size()) {
+            std::string chunk(std::min(kChunkSize, expected.size() - data.size()), 0);
+            ASSERT_EQ(reader->Read(chunk.data(), chunk.size()), chunk.size());
+            data += chunk;
+        }
+        ASSERT_EQ(data, expected);
+    }
+
     void TestReads(ISnapshotWriter* writer) {
         ASSERT_NO_FATAL_FAILURE(TestBlockReads(writer));
         ASSERT_NO_FATAL_FAILURE(TestByteReads(writer));
+        ASSERT_NO_FATAL_FAILURE(TestSequentialReads(writer));
     }
 
     std::string MakeNewBlockString() {
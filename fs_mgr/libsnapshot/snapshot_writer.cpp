@@ -137,6 +137,16 @@ bool CompressedSnapshotWriter::EmitSequenceData(size_t num_ops, const uint32_t*
     return cow_->AddSequenceData(num_ops, data);
 }
 
+bool CompressedSnapshotWriter::EmitCopies(size_t num_copies,
+                                          const std::pair<uint64_t, uint64_t>* copies) {
+    return cow_->AddCopies(num_copies, copies);
+}
+
+bool CompressedSnapshotWriter::EmitVectoredRawBlocks(uint64_t new_block_start,
+                                                     const struct iovec* iov, size_t iovcnt) {
+    return cow_->AddRawBlocks(new_block_start, iov, iovcnt);
+}
+
 bool CompressedSnapshotWriter::Initialize() {
     return cow_->Initialize(cow_device_);
 }
@@ -17,6 +17,7 @@
 #include <sysexits.h>
 
 #include <chrono>
+#include <filesystem>
 #include <iostream>
 #include <map>
 #include <sstream>
@@ -26,6 +27,7 @@
 #include <android-base/unique_fd.h>
 
 #include <libsnapshot/snapshot.h>
+#include <snapuserd/snapuserd_client.h>
 
 using namespace std::string_literals;
 
@@ -38,7 +40,10 @@ int Usage() {
                  "  merge\n"
                  "    Deprecated.\n"
                  "  map\n"
-                 "    Map all partitions at /dev/block/mapper\n";
+                 "    Map all partitions at /dev/block/mapper\n"
+                 "  snapuserd-stats [misc_name...]\n"
+                 "    Print snapuserd I/O latency statistics of the given, or all,\n"
+                 "    dm-user devices.\n";
     return EX_USAGE;
 }
 
@@ -67,12 +72,45 @@ bool MergeCmdHandler(int /*argc*/, char** argv) {
     return false;
 }
 
+bool SnapuserdStatsCmdHandler(int argc, char** argv) {
+    android::base::InitLogging(argv, &android::base::StderrLogger);
+    using namespace std::chrono_literals;
+
+    std::vector<std::string> misc_names(argv + 2, argv + argc);
+    if (misc_names.empty()) {
+        // Each dm-user device has a control device named after it.
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator("/dev/dm-user", ec)) {
+            misc_names.emplace_back(entry.path().filename());
+        }
+    }
+
+    auto client = SnapuserdClient::Connect(kSnapuserdSocket, 5s);
+    if (!client) {
+        LOG(ERROR) << "Unable to connect to snapuserd";
+        return false;
+    }
+
+    bool ok = true;
+    for (const auto& misc_name : misc_names) {
+        std::string stats = client->QuerySnapshotStats(misc_name);
+        if (stats.empty()) {
+            LOG(ERROR) << "Failed to query stats of " << misc_name;
+            ok = false;
+            continue;
+        }
+        std::cout << misc_name << " " << stats << "\n";
+    }
+    return ok;
+}
+
 static std::map<std::string, std::function<bool(int, char**)>> kCmdMap = {
         // clang-format off
         {"dump", DumpCmdHandler},
         {"merge", MergeCmdHandler},
         {"map", MapCmdHandler},
         {"unmap", UnmapCmdHandler},
+        {"snapuserd-stats", SnapuserdStatsCmdHandler},
         // clang-format on
 };
 
@@ -25,6 +25,7 @@
 #include <iostream>
 #include <memory>
 #include <string_view>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/unique_fd.h>
@@ -1181,6 +1182,28 @@ TEST(Snapuserd_Test, xor_buffer) {
     ASSERT_EQ(answer, result);
 }
 
+TEST(Snapuserd_Test, xor_buffer_unaligned) {
+    std::vector<uint8_t> data(BLOCK_SZ + 64);
+    std::vector<uint8_t> xor_data(BLOCK_SZ + 64);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = i * 7;
+        xor_data[i] = i * 13 + 1;
+    }
+
+    const size_t lengths[] = {0, 1, 7, 63, 64, 65, BLOCK_SZ};
+    for (size_t offset : {0, 1, 3, 8}) {
+        for (size_t len : lengths) {
+            std::vector<uint8_t> expected = data;
+            for (size_t i = 0; i < len; i++) {
+                expected[offset + i] ^= xor_data[i + 1];
+            }
+            std::vector<uint8_t> result = data;
+            XorBuffer(result.data() + offset, xor_data.data() + 1, len);
+            ASSERT_EQ(result, expected) << "offset " << offset << " len " << len;
+        }
+    }
+}
+
 TEST(Snapuserd_Test, Snapshot_Metadata) {
     CowSnapuserdMetadataTest harness;
     harness.Setup();
@@ -646,7 +646,7 @@ bool Snapuserd::MmapMetadata() {
     reader_->GetHeader(&header);
 
     if (header.major_version >= 2 && header.buffer_size > 0) {
-        total_mapped_addr_length_ = header.header_size + BUFFER_REGION_DEFAULT_SIZE;
+        total_mapped_addr_length_ = header.header_size + header.buffer_size;
         read_ahead_feature_ = true;
     } else {
         // mmap the first 4k page - older COW format
@@ -25,6 +25,10 @@
 namespace android {
 namespace snapshot {
 
+// XORs |len| bytes of |src| into |dst|, a word or a vector at a time. The
+// buffers needn't be aligned, but mustn't overlap.
+void XorBuffer(void* dst, const void* src, size_t len);
+
 class BufferSink : public IByteSink {
   public:
     void Initialize(size_t size);
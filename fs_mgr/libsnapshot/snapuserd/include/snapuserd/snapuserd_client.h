@@ -89,6 +89,20 @@ class SnapuserdClient {
 
     // Return the status of the snapshot
     std::string QuerySnapshotStatus(const std::string& misc_name);
+
+    // Pace merges against foreground I/O on all snapshot devices. Merges back
+    // off, by up to |max_delay_ms| per merge batch, while dm-user serves more
+    // than |high_watermark| requests per second or their average latency
+    // exceeds |max_latency_us|, and run at full speed again once the request
+    // rate falls to |low_watermark|. Passing zero for |high_watermark| and
+    // |max_latency_us| disables throttling.
+    bool SetMergePolicy(uint32_t high_watermark, uint32_t low_watermark, uint32_t max_latency_us,
+                        uint32_t max_delay_ms);
+
+    // Return the latency statistics of a snapshot device, one
+    // "<stage>:<count>,<mean_us>,<p50_us>,<p99_us>" entry per I/O stage
+    // followed by "merge:<blocks>,<elapsed_ms>". Empty on failure.
+    std::string QuerySnapshotStats(const std::string& misc_name);
 };
 
 }  // namespace snapshot
@@ -269,5 +269,32 @@ std::string SnapuserdClient::QuerySnapshotStatus(const std::string& misc_name) {
     return Receivemsg();
 }
 
+bool SnapuserdClient::SetMergePolicy(uint32_t high_watermark, uint32_t low_watermark,
+                                     uint32_t max_latency_us, uint32_t max_delay_ms) {
+    std::vector<std::string> parts = {"merge_policy", std::to_string(high_watermark),
+                                      std::to_string(low_watermark), std::to_string(max_latency_us),
+                                      std::to_string(max_delay_ms)};
+    std::string msg = android::base::Join(parts, ",");
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return false;
+    }
+    std::string response = Receivemsg();
+    return response == "success";
+}
+
+std::string SnapuserdClient::QuerySnapshotStats(const std::string& misc_name) {
+    std::string msg = "stats," + misc_name;
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return {};
+    }
+    std::string response = Receivemsg();
+    if (response == "fail") {
+        return {};
+    }
+    return response;
+}
+
 }  // namespace snapshot
 }  // namespace android
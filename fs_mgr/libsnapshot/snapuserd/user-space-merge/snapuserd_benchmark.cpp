@@ -0,0 +1,417 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Drives reads through a dm-user device served by an in-process
+// SnapshotHandler, and reports throughput, latency percentiles and CPU time
+// per MiB, optionally while a merge is running. The handler runs in this
+// process so that its CPU time is part of the measurement.
+
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+#include <fs_mgr/file_wait.h>
+#include <gflags/gflags.h>
+#include <libdm/dm.h>
+#include <libdm/loop_control.h>
+#include <libsnapshot/cow_writer.h>
+#include <storage_literals/storage_literals.h>
+
+#include "snapuserd_core.h"
+
+DEFINE_int32(size_mb, 256, "Size of the snapshot device, in MiB");
+DEFINE_string(compression, "lz4", "Compression of the replace and xor ops in the COW");
+DEFINE_string(patterns, "seq,rand", "Comma-separated read patterns to run: seq, rand");
+DEFINE_int32(io_size_kb, 64, "Size of each read, in KiB");
+DEFINE_int32(random_ios, 20000, "Number of reads in the rand pattern");
+DEFINE_int32(jobs, 1, "Number of threads reading the device at once");
+DEFINE_int32(worker_threads, 0, "Number of snapuserd worker threads, or 0 for the default");
+DEFINE_int32(cache_blocks, 0, "Minimum capacity of the block cache, or 0 for the default");
+DEFINE_bool(io_uring, false, "Let snapuserd use io_uring");
+DEFINE_bool(merge, false, "Run the patterns again while a merge is in progress");
+DEFINE_string(backing_dir, "",
+              "Directory for the base device and COW files. By default the base device is "
+              "kept in memory, which leaves storage out of the measurement");
+
+namespace android {
+namespace snapshot {
+
+using namespace android::storage_literals;
+using namespace std::chrono_literals;
+using android::base::unique_fd;
+using android::dm::DeviceMapper;
+using android::dm::DmTable;
+using android::dm::DmTargetUser;
+using android::dm::LoopDevice;
+
+struct PatternResult {
+    uint64_t bytes = 0;
+    std::chrono::nanoseconds elapsed{0};
+    std::chrono::microseconds cpu_time{0};
+    // Latency of every read, sorted.
+    std::vector<std::chrono::nanoseconds> latencies;
+};
+
+static std::chrono::microseconds GetCpuTime() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+class SnapuserdBenchmark final {
+  public:
+    ~SnapuserdBenchmark();
+
+    bool Setup();
+    bool Run(const std::string& pattern, PatternResult* result);
+    void StartMerge() { handler_->InitiateMerge(); }
+    double GetMergePercentage() { return handler_->GetMergePercentage(); }
+    void PrintHandlerStats();
+
+  private:
+    bool CreateBaseDevice();
+    bool CreateCowDevice();
+    bool CreateDmUserDevice();
+    bool StartHandler();
+    void ReadRange(int fd, uint64_t start, uint64_t end, std::vector<std::chrono::nanoseconds>*);
+    void ReadRandom(int fd, uint32_t seed, int count, std::vector<std::chrono::nanoseconds>*);
+
+    uint64_t size_ = 0;
+    size_t io_size_ = 0;
+    std::string dir_;
+
+    unique_fd base_fd_;
+    std::unique_ptr<TemporaryFile> base_file_;
+    std::unique_ptr<LoopDevice> base_loop_;
+    std::unique_ptr<TemporaryFile> cow_file_;
+
+    std::string dm_name_;
+    std::string ctrl_name_;
+    std::string dm_path_;
+    std::shared_ptr<SnapshotHandler> handler_;
+    std::thread handler_thread_;
+};
+
+SnapuserdBenchmark::~SnapuserdBenchmark() {
+    if (!dm_path_.empty()) {
+        // Deleting the device makes the workers, and then the handler, exit.
+        DeviceMapper::Instance().DeleteDevice(dm_name_);
+    }
+    if (handler_thread_.joinable()) {
+        handler_thread_.join();
+        handler_->CloseFds();
+        handler_->UnmapBufferRegion();
+    }
+}
+
+bool SnapuserdBenchmark::Setup() {
+    size_ = uint64_t(FLAGS_size_mb) * 1_MiB;
+    io_size_ = size_t(FLAGS_io_size_kb) * 1_KiB;
+    if (size_ == 0 || io_size_ == 0 || io_size_ % BLOCK_SZ || size_ < 4 * io_size_) {
+        LOG(ERROR) << "Invalid device or read size";
+        return false;
+    }
+    dir_ = FLAGS_backing_dir.empty() ? android::base::GetExecutableDirectory()
+                                     : FLAGS_backing_dir;
+
+    return CreateBaseDevice() && CreateCowDevice() && CreateDmUserDevice() && StartHandler();
+}
+
+bool SnapuserdBenchmark::CreateBaseDevice() {
+    int fd;
+    if (FLAGS_backing_dir.empty()) {
+        base_fd_.reset(syscall(__NR_memfd_create, "base_device", 0));
+        fd = base_fd_.get();
+    } else {
+        base_file_ = std::make_unique<TemporaryFile>(dir_);
+        fd = base_file_->fd;
+    }
+    if (fd < 0) {
+        PLOG(ERROR) << "Could not create base device";
+        return false;
+    }
+
+    std::mt19937_64 rng(0);
+    std::vector<uint64_t> buffer(1_MiB / sizeof(uint64_t));
+    for (uint64_t offset = 0; offset < size_; offset += 1_MiB) {
+        std::generate(buffer.begin(), buffer.end(), std::ref(rng));
+        size_t len = std::min<uint64_t>(1_MiB, size_ - offset);
+        if (!android::base::WriteFully(fd, buffer.data(), len)) {
+            PLOG(ERROR) << "Could not write base device";
+            return false;
+        }
+    }
+
+    base_loop_ = std::make_unique<LoopDevice>(fd, 10s);
+    if (!base_loop_->valid()) {
+        LOG(ERROR) << "Could not create loop device";
+        return false;
+    }
+    return true;
+}
+
+// The device is split in four: copies, replaced blocks, xor blocks, and
+// blocks the COW doesn't touch, which the copies and xor ops read from.
+bool SnapuserdBenchmark::CreateCowDevice() {
+    cow_file_ = std::make_unique<TemporaryFile>(dir_);
+
+    CowOptions options;
+    options.compression = FLAGS_compression;
+    CowWriter writer(options);
+    if (!writer.Initialize(cow_file_->fd)) {
+        LOG(ERROR) << "Could not initialize COW";
+        return false;
+    }
+
+    uint64_t quarter = size_ / BLOCK_SZ / 4;
+    for (uint64_t i = 0; i < quarter; i++) {
+        if (!writer.AddCopy(i, 3 * quarter + i)) {
+            LOG(ERROR) << "Could not add copy op";
+            return false;
+        }
+    }
+
+    // Replace data compresses somewhat, like most of a system image; xor
+    // data is mostly zeroes, like the difference between two builds.
+    std::mt19937 rng(1);
+    std::string block(BLOCK_SZ, '\0');
+    for (uint64_t i = 0; i < quarter; i++) {
+        for (auto& c : block) c = rng() % 16;
+        if (!writer.AddRawBlocks(quarter + i, block.data(), block.size())) {
+            LOG(ERROR) << "Could not add replace op";
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i + 1 < quarter; i++) {
+        block.assign(BLOCK_SZ, '\0');
+        for (int j = 0; j < 16; j++) block[rng() % BLOCK_SZ] = rng();
+        if (!writer.AddXorBlocks(2 * quarter + i, block.data(), block.size(), 3 * quarter + i,
+                                 BLOCK_SZ / 2)) {
+            LOG(ERROR) << "Could not add xor op";
+            return false;
+        }
+    }
+
+    if (!writer.Finalize()) {
+        LOG(ERROR) << "Could not finalize COW";
+        return false;
+    }
+    return true;
+}
+
+bool SnapuserdBenchmark::CreateDmUserDevice() {
+    dm_name_ = android::base::Basename(cow_file_->path);
+    ctrl_name_ = dm_name_ + "-ctrl";
+
+    DmTable table;
+    if (!table.AddTarget(std::make_unique<DmTargetUser>(0, size_ >> SECTOR_SHIFT, ctrl_name_))) {
+        return false;
+    }
+    if (!DeviceMapper::Instance().CreateDevice(dm_name_, table, &dm_path_, 10s)) {
+        LOG(ERROR) << "Could not create dm-user device";
+        return false;
+    }
+    return android::fs_mgr::WaitForFile("/dev/dm-user/" + ctrl_name_, 10s);
+}
+
+bool SnapuserdBenchmark::StartHandler() {
+    handler_ = std::make_shared<SnapshotHandler>(ctrl_name_, cow_file_->path,
+                                                 base_loop_->device(), base_loop_->device());
+    if (!handler_->InitCowDevice()) {
+        LOG(ERROR) << "Could not initialize handler";
+        return false;
+    }
+    handler_->SetSocketPresent(false);
+    handler_->SetIouringEnabled(FLAGS_io_uring);
+    handler_->SetNumWorkerThreads(FLAGS_worker_threads);
+    if (FLAGS_cache_blocks > 0) {
+        handler_->GetBlockCache()->Reserve(FLAGS_cache_blocks);
+    }
+    if (!handler_->InitializeWorkers()) {
+        LOG(ERROR) << "Could not initialize workers";
+        return false;
+    }
+    handler_->AttachControlDevice();
+    handler_thread_ = std::thread([handler = handler_]() { handler->Start(); });
+    return true;
+}
+
+void SnapuserdBenchmark::ReadRange(int fd, uint64_t start, uint64_t end,
+                                   std::vector<std::chrono::nanoseconds>* latencies) {
+    void* buffer;
+    if (posix_memalign(&buffer, BLOCK_SZ, io_size_)) {
+        return;
+    }
+    for (uint64_t offset = start; offset + io_size_ <= end; offset += io_size_) {
+        auto begin = std::chrono::steady_clock::now();
+        if (!android::base::ReadFullyAtOffset(fd, buffer, io_size_, offset)) {
+            PLOG(ERROR) << "read at " << offset;
+            break;
+        }
+        latencies->emplace_back(std::chrono::steady_clock::now() - begin);
+    }
+    free(buffer);
+}
+
+void SnapuserdBenchmark::ReadRandom(int fd, uint32_t seed, int count,
+                                    std::vector<std::chrono::nanoseconds>* latencies) {
+    void* buffer;
+    if (posix_memalign(&buffer, BLOCK_SZ, io_size_)) {
+        return;
+    }
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<uint64_t> blocks(0, (size_ - io_size_) / BLOCK_SZ);
+    for (int i = 0; i < count; i++) {
+        uint64_t offset = blocks(rng) * BLOCK_SZ;
+        auto begin = std::chrono::steady_clock::now();
+        if (!android::base::ReadFullyAtOffset(fd, buffer, io_size_, offset)) {
+            PLOG(ERROR) << "read at " << offset;
+            break;
+        }
+        latencies->emplace_back(std::chrono::steady_clock::now() - begin);
+    }
+    free(buffer);
+}
+
+bool SnapuserdBenchmark::Run(const std::string& pattern, PatternResult* result) {
+    if (pattern != "seq" && pattern != "rand") {
+        LOG(ERROR) << "Unknown pattern: " << pattern;
+        return false;
+    }
+
+    // O_DIRECT keeps the page cache of the dm-user device out of the way, so
+    // that every read reaches snapuserd.
+    unique_fd fd(open(dm_path_.c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC));
+    if (fd < 0) {
+        PLOG(ERROR) << "open " << dm_path_;
+        return false;
+    }
+
+    size_t jobs = std::max(FLAGS_jobs, 1);
+    std::vector<std::vector<std::chrono::nanoseconds>> latencies(jobs);
+    std::vector<std::thread> threads;
+
+    auto cpu_start = GetCpuTime();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < jobs; i++) {
+        if (pattern == "seq") {
+            // Every job reads its own contiguous part of the device.
+            uint64_t chunk = size_ / jobs / io_size_ * io_size_;
+            threads.emplace_back(&SnapuserdBenchmark::ReadRange, this, fd.get(), i * chunk,
+                                 (i + 1) * chunk, &latencies[i]);
+        } else {
+            threads.emplace_back(&SnapuserdBenchmark::ReadRandom, this, fd.get(), i,
+                                 FLAGS_random_ios / jobs, &latencies[i]);
+        }
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    result->elapsed = std::chrono::steady_clock::now() - start;
+    result->cpu_time = GetCpuTime() - cpu_start;
+
+    for (const auto& job : latencies) {
+        result->latencies.insert(result->latencies.end(), job.begin(), job.end());
+    }
+    std::sort(result->latencies.begin(), result->latencies.end());
+    result->bytes = result->latencies.size() * io_size_;
+    return !result->latencies.empty();
+}
+
+void SnapuserdBenchmark::PrintHandlerStats() {
+    BlockCache* cache = handler_->GetBlockCache();
+    std::cout << "Block cache hits: " << cache->GetHits() << " misses: " << cache->GetMisses()
+              << "\n";
+    std::cout << "Handler stats: " << handler_->GetStats()->ToString() << "\n";
+}
+
+static void PrintResult(const std::string& name, const PatternResult& result) {
+    auto percentile = [&](double p) -> double {
+        size_t index = std::min(result.latencies.size() - 1,
+                                static_cast<size_t>(p / 100 * result.latencies.size()));
+        return result.latencies[index].count() / 1000.0;
+    };
+    double mib = double(result.bytes) / 1_MiB;
+    double seconds = std::chrono::duration<double>(result.elapsed).count();
+
+    std::cout << std::fixed << std::setprecision(1) << name << ": " << result.latencies.size()
+              << " reads, " << mib << " MiB in " << seconds << " s, " << mib / seconds
+              << " MiB/s\n"
+              << "  latency (us): p50 " << percentile(50) << " p90 " << percentile(90)
+              << " p99 " << percentile(99) << " p99.9 " << percentile(99.9) << " max "
+              << result.latencies.back().count() / 1000.0 << "\n"
+              << "  CPU: " << std::setprecision(2) << result.cpu_time.count() / 1000.0 / mib
+              << " ms/MiB\n"
+              << std::defaultfloat;
+}
+
+static int Main() {
+    SnapuserdBenchmark benchmark;
+    if (!benchmark.Setup()) {
+        return 1;
+    }
+
+    auto patterns = android::base::Split(FLAGS_patterns, ",");
+    for (const auto& pattern : patterns) {
+        PatternResult result;
+        if (!benchmark.Run(pattern, &result)) {
+            return 1;
+        }
+        PrintResult(pattern, result);
+    }
+
+    if (FLAGS_merge) {
+        benchmark.StartMerge();
+        for (const auto& pattern : patterns) {
+            double merge_start = benchmark.GetMergePercentage();
+            PatternResult result;
+            if (!benchmark.Run(pattern, &result)) {
+                return 1;
+            }
+            PrintResult(pattern + " (merging)", result);
+            std::cout << "  merge progress: " << merge_start << "% -> "
+                      << benchmark.GetMergePercentage() << "%\n";
+        }
+    }
+
+    benchmark.PrintHandlerStats();
+    return 0;
+}
+
+}  // namespace snapshot
+}  // namespace android
+
+int main(int argc, char** argv) {
+    android::base::InitLogging(argv, &android::base::StderrLogger);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    return android::snapshot::Main();
+}
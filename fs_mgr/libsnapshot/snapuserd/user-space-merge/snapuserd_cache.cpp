@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "snapuserd_core.h"
+
+namespace android {
+namespace snapshot {
+
+BlockCache::BlockCache(size_t capacity)
+    : shard_capacity_(std::max<size_t>(1, (capacity + kNumShards - 1) / kNumShards)) {}
+
+bool BlockCache::Get(uint64_t new_block, void* buffer) {
+    Shard& shard = GetShard(new_block);
+    {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        auto iter = shard.blocks.find(new_block);
+        if (iter != shard.blocks.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+            memcpy(buffer, iter->second->second.get(), BLOCK_SZ);
+            hits_++;
+            return true;
+        }
+    }
+    misses_++;
+    return false;
+}
+
+void BlockCache::Put(uint64_t new_block, const void* buffer) {
+    Shard& shard = GetShard(new_block);
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    // Another worker may have raced us to the same block.
+    auto iter = shard.blocks.find(new_block);
+    if (iter != shard.blocks.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+        return;
+    }
+
+    std::unique_ptr<uint8_t[]> data;
+    if (shard.lru.size() >= shard_capacity_) {
+        // Recycle the least recently used block's buffer.
+        auto& victim = shard.lru.back();
+        shard.blocks.erase(victim.first);
+        data = std::move(victim.second);
+        shard.lru.pop_back();
+    } else {
+        data = std::make_unique<uint8_t[]>(BLOCK_SZ);
+    }
+
+    memcpy(data.get(), buffer, BLOCK_SZ);
+    shard.lru.emplace_front(new_block, std::move(data));
+    shard.blocks[new_block] = shard.lru.begin();
+}
+
+void BlockCache::Reserve(size_t capacity) {
+    size_t shard_capacity = (capacity + kNumShards - 1) / kNumShards;
+    size_t current = shard_capacity_;
+    while (current < shard_capacity &&
+           !shard_capacity_.compare_exchange_weak(current, shard_capacity)) {
+    }
+}
+
+}  // namespace snapshot
+}  // namespace android
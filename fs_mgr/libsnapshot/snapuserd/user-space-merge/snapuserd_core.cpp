@@ -18,6 +18,8 @@
 
 #include <sys/utsname.h>
 
+#include <algorithm>
+
 #include <android-base/properties.h>
 #include <android-base/scopeguard.h>
 #include <android-base/strings.h>
@@ -36,10 +38,27 @@ SnapshotHandler::SnapshotHandler(std::string misc_name, std::string cow_device,
     backing_store_device_ = std::move(backing_device);
     control_device_ = "/dev/dm-user/" + misc_name_;
     base_path_merge_ = std::move(base_path_merge);
+    block_cache_ = std::make_unique<BlockCache>(kBlockCacheBlocks);
+}
+
+// Each worker holds its own dm-user payload buffer and descriptors, so a fixed
+// pool per device leaves small partitions with idle threads while the large
+// ones, which see most of the boot I/O, are short of workers.
+int SnapshotHandler::GetNumWorkerThreads() {
+    if (num_worker_threads_override_ > 0) {
+        return num_worker_threads_override_;
+    }
+
+    uint64_t dev_size = num_sectors_ << SECTOR_SHIFT;
+    uint64_t num_threads = (dev_size + kBytesPerWorkerThread - 1) / kBytesPerWorkerThread;
+
+    unsigned int max_threads = std::min(std::thread::hardware_concurrency(), kMaxWorkerThreads);
+    max_threads = std::max(max_threads, 1u);
+    return static_cast<int>(std::clamp<uint64_t>(num_threads, 1, max_threads));
 }
 
 bool SnapshotHandler::InitializeWorkers() {
-    int num_worker_threads = kNumWorkerThreads;
+    int num_worker_threads = GetNumWorkerThreads();
 
     // We will need multiple worker threads only during
     // device boot after OTA. For all other purposes,
@@ -64,6 +83,7 @@ bool SnapshotHandler::InitializeWorkers() {
 
         worker_threads_.push_back(std::move(wt));
     }
+    SNAP_LOG(INFO) << "Initialized " << num_worker_threads << " worker threads";
 
     merge_thread_ = std::make_unique<Worker>(cow_device_, backing_store_device_, control_device_,
                                              misc_name_, base_path_merge_, GetSharedPtr());
@@ -89,6 +109,7 @@ void SnapshotHandler::UpdateMergeCompletionPercentage() {
 bool SnapshotHandler::CommitMerge(int num_merge_ops) {
     struct CowHeader* ch = reinterpret_cast<struct CowHeader*>(mapped_addr_);
     ch->num_merge_ops += num_merge_ops;
+    stats_.merged_blocks += num_merge_ops;
 
     if (scratch_space_) {
         if (ra_thread_) {
@@ -157,7 +178,8 @@ void SnapshotHandler::CheckMergeCompletionStatus() {
 }
 
 bool SnapshotHandler::ReadMetadata() {
-    reader_ = std::make_unique<CowReader>(CowReader::ReaderFlags::USERSPACE_MERGE);
+    reader_ = std::make_unique<CowReader>(CowReader::ReaderFlags::USERSPACE_MERGE |
+                                          CowReader::ReaderFlags::MMAP);
     CowHeader header;
     CowOptions options;
 
@@ -251,12 +273,14 @@ bool SnapshotHandler::MmapMetadata() {
     CowHeader header;
     reader_->GetHeader(&header);
 
-    total_mapped_addr_length_ = header.header_size + BUFFER_REGION_DEFAULT_SIZE;
-
+    size_t buffer_size = BUFFER_REGION_DEFAULT_SIZE;
     if (header.major_version >= 2 && header.buffer_size > 0) {
         scratch_space_ = true;
+        buffer_size = header.buffer_size;
     }
 
+    total_mapped_addr_length_ = header.header_size + buffer_size;
+
     if (scratch_space_) {
         mapped_addr_ = mmap(NULL, total_mapped_addr_length_, PROT_READ | PROT_WRITE, MAP_SHARED,
                             cow_fd_.get(), 0);
@@ -520,6 +544,18 @@ bool SnapshotHandler::Start() {
         SNAP_LOG(INFO) << "Read-ahead thread started...";
     }
 
+    std::future<bool> save_profile_status;
+    if (StartBootProfile()) {
+        save_profile_status =
+                std::async(std::launch::async, &SnapshotHandler::SaveBootProfile, this);
+    }
+
+    std::future<bool> prefetch_status;
+    if (!is_socket_present_) {
+        prefetch_status =
+                std::async(std::launch::async, &SnapshotHandler::PrefetchBootProfile, this);
+    }
+
     // Launch worker threads
     for (int i = 0; i < worker_threads_.size(); i++) {
         threads.emplace_back(
@@ -583,6 +619,14 @@ bool SnapshotHandler::Start() {
 
     NotifyIOTerminated();
 
+    StopBootProfile();
+    if (save_profile_status.valid()) {
+        save_profile_status.get();
+    }
+    if (prefetch_status.valid()) {
+        prefetch_status.get();
+    }
+
     bool read_ahead_retval = false;
 
     SNAP_LOG(INFO) << "Snapshot I/O terminated. Waiting for merge thread....";
@@ -661,6 +705,12 @@ struct BufferState* SnapshotHandler::GetBufferState() {
     return ra_state;
 }
 
+uint32_t SnapshotHandler::GetMergeCommitBlocks() {
+    uint32_t commit_blocks = android::base::GetUintProperty<uint32_t>(
+            "ro.virtual_ab.merge.commit_blocks", kMergeCommitBlocks);
+    return std::max(commit_blocks, 1u);
+}
+
 bool SnapshotHandler::IsIouringSupported() {
     struct utsname uts;
     unsigned int major, minor;
@@ -19,11 +19,16 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstring>
 #include <future>
 #include <iostream>
 #include <limits>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -52,7 +57,47 @@ using namespace std::chrono_literals;
 static constexpr size_t PAYLOAD_BUFFER_SZ = (1UL << 20);
 static_assert(PAYLOAD_BUFFER_SZ >= BLOCK_SZ);
 
-static constexpr int kNumWorkerThreads = 4;
+// I/O worker threads per snapshot device scale with the size of the device,
+// one per kBytesPerWorkerThread, up to the number of CPUs or
+// kMaxWorkerThreads, whichever is lower.
+static constexpr uint64_t kBytesPerWorkerThread = 512ULL * 1024 * 1024;
+static constexpr unsigned int kMaxWorkerThreads = 8;
+
+// Number of decompressed blocks cached per snapshot device.
+static constexpr size_t kBlockCacheBlocks = 512;
+
+// Reads of a snapshot device in the first kBootProfileWindow after the kernel
+// boots are recorded in a boot profile under kBootProfileDir. On the next
+// boot, up to kMaxPrefetchBlocks of the profiled blocks are decompressed into
+// the block cache by kNumPrefetchThreads threads.
+static constexpr auto kBootProfileWindow = 60s;
+static constexpr char kBootProfileDir[] = "/metadata/ota/snapuserd";
+static constexpr size_t kMaxPrefetchBlocks = 16384;
+static constexpr int kNumPrefetchThreads = 2;
+
+// Contiguous replace and zero blocks are merged with writes of up to
+// kMergeBufferSize.
+static constexpr size_t kMergeBufferSize = 4 * PAYLOAD_BUFFER_SZ;
+
+// Default number of replace and zero blocks merged between commits of the
+// merge progress, overridden by ro.virtual_ab.merge.commit_blocks.
+static constexpr uint32_t kMergeCommitBlocks = 8192;
+
+// Foreground I/O is sampled at most this often to pace the merge.
+static constexpr auto kMergeThrottleInterval = 50ms;
+
+// Pacing of the merge thread against foreground dm-user I/O. The merge backs
+// off, doubling the delay before each merge batch up to max_delay_ms, while
+// foreground I/O is above high_watermark requests per second or its average
+// latency is above max_latency_us. It runs unthrottled again once the rate
+// drops to low_watermark. With no high_watermark and no max_latency_us the
+// merge is not throttled.
+struct MergePolicy {
+    uint32_t high_watermark = 0;
+    uint32_t low_watermark = 0;
+    uint32_t max_latency_us = 0;
+    uint32_t max_delay_ms = 0;
+};
 
 #define SNAP_LOG(level) LOG(level) << misc_name_ << ": "
 #define SNAP_PLOG(level) PLOG(level) << misc_name_ << ": "
@@ -89,6 +134,126 @@ struct MergeGroupState {
         : merge_state_(state), num_ios_in_progress(n_ios) {}
 };
 
+// Cache of decompressed COW blocks, keyed by new block number. It is shared by
+// all worker threads of a snapshot, and split into shards with their own lock
+// and LRU list so that workers rarely contend.
+class BlockCache {
+  public:
+    explicit BlockCache(size_t capacity);
+
+    // Copy |new_block| into |buffer| if it is cached.
+    bool Get(uint64_t new_block, void* buffer);
+    void Put(uint64_t new_block, const void* buffer);
+    // Raise the capacity to at least |capacity| blocks.
+    void Reserve(size_t capacity);
+
+    uint64_t GetHits() const { return hits_; }
+    uint64_t GetMisses() const { return misses_; }
+
+  private:
+    static constexpr size_t kNumShards = 16;
+
+    struct Shard {
+        std::mutex lock;
+        // Most recently used first.
+        std::list<std::pair<uint64_t, std::unique_ptr<uint8_t[]>>> lru;
+        std::unordered_map<uint64_t, decltype(lru)::iterator> blocks;
+    };
+
+    Shard& GetShard(uint64_t new_block) { return shards_[new_block % kNumShards]; }
+
+    std::atomic<size_t> shard_capacity_;
+    std::array<Shard, kNumShards> shards_;
+    std::atomic<uint64_t> hits_ = 0;
+    std::atomic<uint64_t> misses_ = 0;
+};
+
+// Latency histogram with power-of-two buckets: bucket i counts samples below
+// 2^i microseconds, the last bucket everything slower. Safe to update from
+// several threads.
+class LatencyHistogram {
+  public:
+    static constexpr size_t kNumBuckets = 24;
+
+    void Record(std::chrono::nanoseconds latency);
+
+    uint64_t GetCount() const { return count_; }
+    std::chrono::microseconds GetMean() const;
+    // Upper bound of the bucket holding the given percentile.
+    std::chrono::microseconds GetPercentile(unsigned int percentile) const;
+
+  private:
+    std::array<std::atomic<uint64_t>, kNumBuckets> buckets_ = {};
+    std::atomic<uint64_t> count_ = 0;
+    std::atomic<uint64_t> total_ns_ = 0;
+};
+
+// Where a snapshot device spends its time, reported by the "stats" daemon
+// command.
+struct SnapuserdStats {
+    // dm-user read requests, end to end.
+    LatencyHistogram request;
+    // Finding the COW op of a block.
+    LatencyHistogram cow_lookup;
+    // Reading and decompressing replace ops.
+    LatencyHistogram decompress;
+    // Waiting for base device reads of a payload.
+    LatencyHistogram base_read;
+    // Writing a payload back to dm-user.
+    LatencyHistogram reply;
+    // Merge thread waiting for the next read-ahead window.
+    LatencyHistogram ra_stall;
+
+    std::atomic<uint64_t> merged_blocks = 0;
+    std::atomic<int64_t> merge_start_ns = 0;
+    std::atomic<int64_t> merge_end_ns = 0;
+
+    static int64_t NowNs();
+    std::string ToString() const;
+};
+
+// Blocks of a snapshot device read during boot, kept as a bitmap while
+// recording and stored as sorted block ranges. A profile file is a
+// BootProfileHeader followed by num_ranges BootProfileRange entries.
+class BootProfile {
+  public:
+    static constexpr uint32_t kMagic = 0x50425553;  // "SUBP"
+    static constexpr uint32_t kVersion = 1;
+
+    struct BootProfileHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t num_ranges;
+        uint32_t reserved;
+        // /proc/sys/kernel/random/boot_id of the boot that was recorded.
+        char boot_id[40];
+    } __attribute__((packed));
+
+    struct BootProfileRange {
+        uint32_t block;
+        uint32_t num_blocks;
+    } __attribute__((packed));
+
+    using Ranges = std::vector<BootProfileRange>;
+
+    explicit BootProfile(uint64_t num_blocks);
+
+    // Mark the blocks covering |len| bytes at |sector| as read. Safe to call
+    // from several threads.
+    void Record(sector_t sector, size_t len);
+    Ranges GetRanges() const;
+
+    static bool Load(const std::string& path, std::string* boot_id, Ranges* ranges);
+    static bool Save(const std::string& path, const std::string& boot_id, const Ranges& ranges);
+    // Union of two sets of sorted ranges.
+    static Ranges Merge(const Ranges& a, const Ranges& b);
+    static std::string GetBootId();
+
+  private:
+    uint64_t num_blocks_;
+    std::unique_ptr<std::atomic<uint64_t>[]> bitmap_;
+};
+
 class ReadAhead {
   public:
     ReadAhead(const std::string& cow_device, const std::string& backing_device,
@@ -197,6 +362,15 @@ class Worker {
     bool ReadDataFromBaseDevice(sector_t sector, size_t read_size);
     bool ReadFromSourceDevice(const CowOperation* cow_op);
 
+    // Reads of unchanged blocks within one dm-user payload. Adjacent blocks
+    // are coalesced into a single read; with io_uring the reads are issued
+    // asynchronously and reaped before the payload is sent back.
+    bool QueueBaseDeviceRead(sector_t sector, size_t read_size);
+    bool SubmitBaseDeviceRead();
+    bool ReapBaseDeviceReads(size_t max_inflight);
+    bool CompleteBaseDeviceReads();
+    void AbortBaseDeviceReads();
+
     bool ReadAlignedSector(sector_t sector, size_t sz, bool header_response);
     bool ReadUnalignedSector(sector_t sector, size_t size);
     int ReadUnalignedSector(sector_t sector, size_t size,
@@ -228,10 +402,13 @@ class Worker {
 
     bool InitializeIouring();
     void FinalizeIouring();
+    bool InitializeReadIouring();
+    void FinalizeReadIouring();
 
     std::unique_ptr<CowReader> reader_;
     BufferSink bufsink_;
     XorSink xorsink_;
+    size_t payload_buffer_size_ = PAYLOAD_BUFFER_SZ;
 
     std::string cow_device_;
     std::string backing_store_device_;
@@ -258,6 +435,21 @@ class Worker {
     int queue_depth_ = 8;
     std::unique_ptr<struct io_uring> ring_;
 
+    struct BaseDeviceRead {
+        sector_t sector;
+        void* buffer;
+        size_t size;
+    };
+    // Run of unchanged blocks not yet issued to the base device.
+    BaseDeviceRead pending_read_ = {};
+    // Reads issued for the current payload; the index is the io_uring
+    // user_data of the request.
+    std::vector<BaseDeviceRead> issued_reads_;
+    size_t inflight_reads_ = 0;
+    bool read_async_ = false;
+    // Time spent on base device reads of the current payload.
+    std::chrono::nanoseconds base_read_time_ = 0ns;
+
     std::shared_ptr<SnapshotHandler> snapuserd_;
 };
 
@@ -285,6 +477,7 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     }
 
     bool InitializeWorkers();
+    int GetNumWorkerThreads();
     std::unique_ptr<CowReader> CloneReaderForWorker();
     std::shared_ptr<SnapshotHandler> GetSharedPtr() { return shared_from_this(); }
 
@@ -301,7 +494,18 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     // Read-ahead related functions
     void* GetMappedAddr() { return mapped_addr_; }
     void PrepareReadAhead();
-    std::unordered_map<uint64_t, void*>& GetReadAheadMap() { return read_ahead_buffer_map_; }
+
+    // Index of the blocks held in the read-ahead buffer for the current merge
+    // window. The read-ahead thread builds a fresh index for every window and
+    // publishes it atomically, so I/O threads never look at a map that is
+    // being modified.
+    using ReadAheadIndex = SortedBlockMap<uint64_t, void*>;
+    void PublishReadAheadIndex(std::shared_ptr<const ReadAheadIndex> index) {
+        std::atomic_store(&read_ahead_index_, std::move(index));
+    }
+    std::shared_ptr<const ReadAheadIndex> GetReadAheadIndex() const {
+        return std::atomic_load(&read_ahead_index_);
+    }
 
     // State transitions for merge
     void InitiateMerge();
@@ -332,6 +536,9 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     int GetTotalBlocksToMerge() { return total_ra_blocks_merged_; }
     void SetSocketPresent(bool socket) { is_socket_present_ = socket; }
     void SetIouringEnabled(bool io_uring_enabled) { is_io_uring_enabled_ = io_uring_enabled; }
+    // Use |count| worker threads instead of sizing the pool by device size.
+    // 0 restores the default. Only used for benchmarking.
+    void SetNumWorkerThreads(int count) { num_worker_threads_override_ = count; }
     bool MergeInitiated() { return merge_initiated_; }
     double GetMergePercentage() { return merge_completion_percentage_; }
 
@@ -344,6 +551,23 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     MERGE_GROUP_STATE ProcessMergingBlock(uint64_t new_block, void* buffer);
 
     bool IsIouringSupported();
+    uint32_t GetMergeCommitBlocks();
+
+    BlockCache* GetBlockCache() { return block_cache_.get(); }
+    SnapuserdStats* GetStats() { return &stats_; }
+
+    // Boot profile
+    void RecordBootRead(sector_t sector, size_t len) {
+        if (recording_boot_profile_) {
+            boot_profile_->Record(sector, len);
+        }
+    }
+    std::string GetBootProfilePath();
+
+    // Merge throttling
+    void SetMergePolicy(const MergePolicy& policy);
+    void TrackIORequest(std::chrono::nanoseconds latency);
+    std::chrono::milliseconds ThrottleMerge();
 
   private:
     bool ReadMetadata();
@@ -362,6 +586,12 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     bool ReadBlocksAsync(const std::string& dm_block_device, const std::string& partition_name,
                          size_t size);
 
+    bool StartBootProfile();
+    void StopBootProfile();
+    bool SaveBootProfile();
+    bool PrefetchBootProfile();
+    bool PrefetchBlocks(std::vector<const CowOperation*> ops);
+
     // COW device
     std::string cow_device_;
     // Source device
@@ -395,7 +625,7 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     int total_ra_blocks_merged_ = 0;
     MERGE_IO_TRANSITION io_state_;
     std::unique_ptr<ReadAhead> read_ahead_thread_;
-    std::unordered_map<uint64_t, void*> read_ahead_buffer_map_;
+    std::shared_ptr<const ReadAheadIndex> read_ahead_index_;
 
     // user-space-merging
     std::unordered_map<uint64_t, int> block_to_ra_index_;
@@ -410,9 +640,30 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     bool attached_ = false;
     bool is_socket_present_;
     bool is_io_uring_enabled_ = false;
+    int num_worker_threads_override_ = 0;
     bool scratch_space_ = false;
 
     std::unique_ptr<struct io_uring> ring_;
+    std::unique_ptr<BlockCache> block_cache_;
+    SnapuserdStats stats_;
+
+    std::unique_ptr<BootProfile> boot_profile_;
+    std::atomic<bool> recording_boot_profile_ = false;
+    std::mutex boot_profile_lock_;
+    std::condition_variable boot_profile_cv_;
+    bool stop_boot_profile_ = false;
+
+    std::mutex merge_policy_lock_;
+    MergePolicy merge_policy_;
+    // Foreground requests served and their total latency, updated by the
+    // worker threads.
+    std::atomic<uint64_t> io_requests_{0};
+    std::atomic<uint64_t> io_latency_ns_{0};
+    // Throttle state, only touched by the merge thread.
+    std::chrono::steady_clock::time_point throttle_sample_time_;
+    uint64_t throttle_requests_ = 0;
+    uint64_t throttle_latency_ns_ = 0;
+    std::chrono::milliseconds merge_delay_ = 0ms;
 };
 
 }  // namespace snapshot
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <android-base/scopeguard.h>
+
 #include "snapuserd_core.h"
 
 namespace android {
@@ -76,11 +78,28 @@ bool Worker::InitReader() {
 // internal COW format and if the block is compressed,
 // it will be de-compressed.
 bool Worker::ProcessReplaceOp(const CowOperation* cow_op) {
+    // Uncompressed blocks are a plain copy out of the COW, so only cache
+    // blocks that would otherwise be decompressed again.
+    BlockCache* cache = nullptr;
+    if (cow_op->compression != kCowCompressNone) {
+        cache = snapuserd_->GetBlockCache();
+    }
+
+    void* buffer = bufsink_.GetPayloadBuffer(BLOCK_SZ);
+    if (cache && buffer && cache->Get(cow_op->new_block, buffer)) {
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
     if (!reader_->ReadData(*cow_op, &bufsink_)) {
         SNAP_LOG(ERROR) << "ProcessReplaceOp failed for block " << cow_op->new_block;
         return false;
     }
+    snapuserd_->GetStats()->decompress.Record(std::chrono::steady_clock::now() - start);
 
+    if (cache && buffer) {
+        cache->Put(cow_op->new_block, buffer);
+    }
     return true;
 }
 
@@ -231,8 +250,8 @@ void Worker::InitializeBufsink() {
     // Allocate the buffer which is used to communicate between
     // daemon and dm-user. The buffer comprises of header and a fixed payload.
     // If the dm-user requests a big IO, the IO will be broken into chunks
-    // of PAYLOAD_BUFFER_SZ.
-    size_t buf_size = sizeof(struct dm_user_header) + PAYLOAD_BUFFER_SZ;
+    // of PAYLOAD_BUFFER_SZ. The merge thread uses a larger payload.
+    size_t buf_size = sizeof(struct dm_user_header) + payload_buffer_size_;
     bufsink_.Initialize(buf_size);
 }
 
@@ -251,8 +270,37 @@ bool Worker::Init() {
     return true;
 }
 
+bool Worker::InitializeReadIouring() {
+    if (!snapuserd_->IsIouringSupported()) {
+        return false;
+    }
+
+    ring_ = std::make_unique<struct io_uring>();
+
+    int ret = io_uring_queue_init(queue_depth_, ring_.get(), 0);
+    if (ret) {
+        SNAP_LOG(ERROR) << "I/O: io_uring_queue_init failed with ret: " << ret;
+        ring_ = nullptr;
+        return false;
+    }
+
+    read_async_ = true;
+
+    SNAP_LOG(DEBUG) << "I/O: io_uring initialized with queue depth: " << queue_depth_;
+    return true;
+}
+
+void Worker::FinalizeReadIouring() {
+    if (read_async_) {
+        io_uring_queue_exit(ring_.get());
+        read_async_ = false;
+    }
+}
+
 bool Worker::RunThread() {
     SNAP_LOG(INFO) << "Processing snapshot I/O requests....";
+    InitializeReadIouring();
+
     // Start serving IO
     while (true) {
         if (!ProcessIORequest()) {
@@ -260,6 +308,7 @@ bool Worker::RunThread() {
         }
     }
 
+    FinalizeReadIouring();
     CloseFds();
     reader_->CloseCowFd();
 
@@ -290,10 +339,12 @@ bool Worker::WriteDmUserPayload(size_t size, bool header_response) {
         buf = bufsink_.GetBufPtr();
     }
 
+    auto start = std::chrono::steady_clock::now();
     if (!android::base::WriteFully(ctrl_fd_, buf, payload_size)) {
         SNAP_PLOG(ERROR) << "Write to dm-user failed size: " << payload_size;
         return false;
     }
+    snapuserd_->GetStats()->reply.Record(std::chrono::steady_clock::now() - start);
 
     return true;
 }
@@ -317,10 +368,166 @@ bool Worker::ReadDataFromBaseDevice(sector_t sector, size_t read_size) {
     return true;
 }
 
+bool Worker::QueueBaseDeviceRead(sector_t sector, size_t read_size) {
+    CHECK(read_size <= BLOCK_SZ);
+
+    void* buffer = bufsink_.GetPayloadBuffer(BLOCK_SZ);
+    if (buffer == nullptr) {
+        SNAP_LOG(ERROR) << "QueueBaseDeviceRead: Failed to get payload buffer";
+        return false;
+    }
+
+    // Extend the pending run if this block follows it both on the base
+    // device and in the payload buffer.
+    if (pending_read_.size &&
+        pending_read_.sector + (pending_read_.size >> SECTOR_SHIFT) == sector &&
+        static_cast<char*>(pending_read_.buffer) + pending_read_.size == buffer) {
+        pending_read_.size += read_size;
+        return true;
+    }
+
+    if (!SubmitBaseDeviceRead()) {
+        return false;
+    }
+
+    pending_read_ = {sector, buffer, read_size};
+    return true;
+}
+
+bool Worker::SubmitBaseDeviceRead() {
+    if (!pending_read_.size) {
+        return true;
+    }
+
+    BaseDeviceRead read = pending_read_;
+    pending_read_ = {};
+
+    if (read_async_) {
+        if (inflight_reads_ >= static_cast<size_t>(queue_depth_) &&
+            !ReapBaseDeviceReads(queue_depth_ - 1)) {
+            return false;
+        }
+
+        struct io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+        if (sqe) {
+            io_uring_prep_read(sqe, base_path_merge_fd_.get(), read.buffer, read.size,
+                               read.sector << SECTOR_SHIFT);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(issued_reads_.size()));
+            issued_reads_.push_back(read);
+
+            int ret = io_uring_submit(ring_.get());
+            if (ret == 1) {
+                inflight_reads_ += 1;
+                return true;
+            }
+            SNAP_LOG(ERROR) << "I/O: io_uring_submit failed for base device read: " << ret;
+            issued_reads_.pop_back();
+        } else {
+            SNAP_LOG(ERROR) << "I/O: io_uring_get_sqe failed for base device read";
+        }
+
+        // Don't leave a half-populated ring behind; drain what is in flight
+        // and serve the rest of this worker's I/O synchronously.
+        if (!ReapBaseDeviceReads(0)) {
+            return false;
+        }
+        FinalizeReadIouring();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!android::base::ReadFullyAtOffset(base_path_merge_fd_, read.buffer, read.size,
+                                          read.sector << SECTOR_SHIFT)) {
+        SNAP_PLOG(ERROR) << "SubmitBaseDeviceRead failed. fd: " << base_path_merge_fd_
+                         << " at sector: " << read.sector << " size: " << read.size;
+        return false;
+    }
+    base_read_time_ += std::chrono::steady_clock::now() - start;
+
+    return true;
+}
+
+bool Worker::ReapBaseDeviceReads(size_t max_inflight) {
+    bool status = true;
+    auto start = std::chrono::steady_clock::now();
+    auto scope_guard = android::base::make_scope_guard(
+            [&]() { base_read_time_ += std::chrono::steady_clock::now() - start; });
+
+    while (inflight_reads_ > max_inflight) {
+        struct io_uring_cqe* cqe;
+
+        int ret = io_uring_wait_cqe(ring_.get(), &cqe);
+        if (ret == -EINTR || ret == -EAGAIN) {
+            continue;
+        }
+        if (ret) {
+            SNAP_LOG(ERROR) << "I/O: io_uring_wait_cqe failed: " << ret;
+            return false;
+        }
+
+        size_t index = reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe));
+        int res = cqe->res;
+        io_uring_cqe_seen(ring_.get(), cqe);
+        inflight_reads_ -= 1;
+
+        const BaseDeviceRead& read = issued_reads_[index];
+        if (res < 0) {
+            SNAP_LOG(ERROR) << "I/O: base device read failed with res: " << res
+                            << " at sector: " << read.sector << " size: " << read.size;
+            status = false;
+            continue;
+        }
+
+        // Finish a short read synchronously.
+        size_t done = res;
+        if (done < read.size &&
+            !android::base::ReadFullyAtOffset(base_path_merge_fd_,
+                                              static_cast<char*>(read.buffer) + done,
+                                              read.size - done,
+                                              (read.sector << SECTOR_SHIFT) + done)) {
+            SNAP_PLOG(ERROR) << "I/O: base device read failed at sector: " << read.sector
+                             << " size: " << read.size;
+            status = false;
+        }
+    }
+
+    return status;
+}
+
+// Issue the last pending run and wait for every read of the payload.
+bool Worker::CompleteBaseDeviceReads() {
+    bool status = SubmitBaseDeviceRead() && ReapBaseDeviceReads(0);
+    if (!status) {
+        AbortBaseDeviceReads();
+    }
+
+    if (base_read_time_ > 0ns) {
+        snapuserd_->GetStats()->base_read.Record(base_read_time_);
+        base_read_time_ = 0ns;
+    }
+
+    issued_reads_.clear();
+    return status;
+}
+
+// Make sure nothing is still being read into the payload buffer before it is
+// reused for another request.
+void Worker::AbortBaseDeviceReads() {
+    pending_read_ = {};
+
+    if (inflight_reads_ && !ReapBaseDeviceReads(0) && inflight_reads_) {
+        SNAP_LOG(ERROR) << "I/O: io_uring unusable, falling back to synchronous reads";
+        FinalizeReadIouring();
+        inflight_reads_ = 0;
+    }
+
+    issued_reads_.clear();
+}
+
 bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response) {
     struct dm_user_header* header = bufsink_.GetHeaderPtr();
     size_t remaining_size = sz;
     std::vector<std::pair<sector_t, const CowOperation*>>& chunk_vec = snapuserd_->GetChunkVec();
+    SnapuserdStats* stats = snapuserd_->GetStats();
     bool io_error = false;
     int ret = 0;
 
@@ -338,16 +545,19 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
             // present in the mapping.
             size_t size = std::min(BLOCK_SZ, read_size);
 
+            auto lookup_start = std::chrono::steady_clock::now();
             auto it = std::lower_bound(chunk_vec.begin(), chunk_vec.end(),
                                        std::make_pair(sector, nullptr), SnapshotHandler::compare);
             bool not_found = (it == chunk_vec.end() || it->first != sector);
+            stats->cow_lookup.Record(std::chrono::steady_clock::now() - lookup_start);
 
             if (not_found) {
                 // Block not found in map - which means this block was not
                 // changed as per the OTA. Just route the I/O to the base
-                // device.
-                if (!ReadDataFromBaseDevice(sector, size)) {
-                    SNAP_LOG(ERROR) << "ReadDataFromBaseDevice failed";
+                // device. Neighbouring unchanged blocks are read together
+                // once the run ends.
+                if (!QueueBaseDeviceRead(sector, size)) {
+                    SNAP_LOG(ERROR) << "QueueBaseDeviceRead failed";
                     header->type = DM_USER_RESP_ERROR;
                 }
 
@@ -365,6 +575,7 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
 
             // Just return the header if it is an error
             if (header->type == DM_USER_RESP_ERROR) {
+                AbortBaseDeviceReads();
                 if (!RespondIOError(header_response)) {
                     return false;
                 }
@@ -379,6 +590,15 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
             bufsink_.UpdateBufferOffset(ret);
         }
 
+        if (!io_error && !CompleteBaseDeviceReads()) {
+            SNAP_LOG(ERROR) << "CompleteBaseDeviceReads failed";
+            header->type = DM_USER_RESP_ERROR;
+            if (!RespondIOError(header_response)) {
+                return false;
+            }
+            io_error = true;
+        }
+
         if (!io_error) {
             if (!WriteDmUserPayload(total_bytes_read, header_response)) {
                 return false;
@@ -623,9 +843,12 @@ bool Worker::ProcessIORequest() {
 
     switch (header->type) {
         case DM_USER_REQ_MAP_READ: {
+            snapuserd_->RecordBootRead(header->sector, header->len);
+            auto start = std::chrono::steady_clock::now();
             if (!DmuserReadRequest()) {
                 return false;
             }
+            snapuserd_->TrackIORequest(std::chrono::steady_clock::now() - start);
             break;
         }
 
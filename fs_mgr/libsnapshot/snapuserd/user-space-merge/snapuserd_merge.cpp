@@ -71,22 +71,25 @@ int Worker::PrepareMerge(uint64_t* source_offset, int* pending_ops,
 }
 
 bool Worker::MergeReplaceZeroOps() {
-    // Flush every 8192 ops. Since all ops are independent and there is no
-    // dependency between COW ops, we will flush the data and the number
+    // Flush every 8192 ops by default. Since all ops are independent and there
+    // is no dependency between COW ops, we will flush the data and the number
     // of ops merged in COW file for every 8192 ops. If there is a crash,
     // we will end up replaying some of the COW ops which were already merged.
     // That is ok.
     //
     // Why 8192 ops ? Increasing this may improve merge time 3-4 seconds but
     // we need to make sure that we checkpoint; 8k ops seems optimal. In-case
-    // if there is a crash merge should always make forward progress.
-    int total_ops_merged_per_commit = (PAYLOAD_BUFFER_SZ / BLOCK_SZ) * 32;
+    // if there is a crash merge should always make forward progress. Devices
+    // with slow flushes can raise it with ro.virtual_ab.merge.commit_blocks.
+    int total_ops_merged_per_commit = snapuserd_->GetMergeCommitBlocks();
     int num_ops_merged = 0;
 
     SNAP_LOG(INFO) << "MergeReplaceZeroOps started....";
 
     while (!cowop_iter_->Done()) {
-        int num_ops = PAYLOAD_BUFFER_SZ / BLOCK_SZ;
+        snapuserd_->ThrottleMerge();
+
+        int num_ops = payload_buffer_size_ / BLOCK_SZ;
         std::vector<const CowOperation*> replace_zero_vec;
         uint64_t source_offset;
 
@@ -186,10 +189,15 @@ bool Worker::MergeOrderedOpsAsync() {
             break;
         }
 
+        snapuserd_->ThrottleMerge();
+
         SNAP_LOG(DEBUG) << "Waiting for merge begin...";
         // Wait for RA thread to notify that the merge window
         // is ready for merging.
-        if (!snapuserd_->WaitForMergeBegin()) {
+        auto wait_start = std::chrono::steady_clock::now();
+        bool merge_begin = snapuserd_->WaitForMergeBegin();
+        snapuserd_->GetStats()->ra_stall.Record(std::chrono::steady_clock::now() - wait_start);
+        if (!merge_begin) {
             return false;
         }
 
@@ -367,10 +375,15 @@ bool Worker::MergeOrderedOps() {
             break;
         }
 
+        snapuserd_->ThrottleMerge();
+
         SNAP_LOG(DEBUG) << "Waiting for merge begin...";
         // Wait for RA thread to notify that the merge window
         // is ready for merging.
-        if (!snapuserd_->WaitForMergeBegin()) {
+        auto wait_start = std::chrono::steady_clock::now();
+        bool merge_begin = snapuserd_->WaitForMergeBegin();
+        snapuserd_->GetStats()->ra_stall.Record(std::chrono::steady_clock::now() - wait_start);
+        if (!merge_begin) {
             snapuserd_->SetMergeFailed(ra_block_index_);
             return false;
         }
@@ -544,7 +557,9 @@ bool Worker::RunMergeThread() {
     }
 
     SNAP_LOG(INFO) << "Merge starting..";
+    snapuserd_->GetStats()->merge_start_ns = SnapuserdStats::NowNs();
 
+    payload_buffer_size_ = kMergeBufferSize;
     if (!Init()) {
         SNAP_LOG(ERROR) << "Merge thread initialization failed...";
         snapuserd_->MergeFailed();
@@ -556,6 +571,7 @@ bool Worker::RunMergeThread() {
     if (!Merge()) {
         return false;
     }
+    snapuserd_->GetStats()->merge_end_ns = SnapuserdStats::NowNs();
 
     FinalizeIouring();
     CloseFds();
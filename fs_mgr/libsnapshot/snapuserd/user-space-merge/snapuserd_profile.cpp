@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+
+#include "snapuserd_core.h"
+
+namespace android {
+namespace snapshot {
+
+static std::chrono::nanoseconds GetBootTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+BootProfile::BootProfile(uint64_t num_blocks)
+    : num_blocks_(std::min<uint64_t>(num_blocks, std::numeric_limits<uint32_t>::max())),
+      bitmap_(new std::atomic<uint64_t>[(num_blocks_ + 63) / 64]()) {}
+
+void BootProfile::Record(sector_t sector, size_t len) {
+    uint64_t offset = sector << SECTOR_SHIFT;
+    uint64_t end = std::min<uint64_t>((offset + len + BLOCK_SZ - 1) / BLOCK_SZ, num_blocks_);
+
+    for (uint64_t block = offset / BLOCK_SZ; block < end; block++) {
+        std::atomic<uint64_t>& word = bitmap_[block / 64];
+        uint64_t bit = 1ULL << (block % 64);
+        // Most reads during boot hit blocks that were already recorded; avoid
+        // bouncing the cache line between workers for those.
+        if (!(word.load(std::memory_order_relaxed) & bit)) {
+            word.fetch_or(bit, std::memory_order_relaxed);
+        }
+    }
+}
+
+BootProfile::Ranges BootProfile::GetRanges() const {
+    Ranges ranges;
+    for (uint64_t block = 0; block < num_blocks_; block++) {
+        uint64_t word = bitmap_[block / 64].load(std::memory_order_relaxed);
+        if (!word && (block % 64) == 0) {
+            block += 63;
+            continue;
+        }
+        if (!(word & (1ULL << (block % 64)))) {
+            continue;
+        }
+        if (!ranges.empty() && ranges.back().block + ranges.back().num_blocks == block) {
+            ranges.back().num_blocks++;
+        } else {
+            ranges.push_back({static_cast<uint32_t>(block), 1});
+        }
+    }
+    return ranges;
+}
+
+BootProfile::Ranges BootProfile::Merge(const Ranges& a, const Ranges& b) {
+    Ranges all = a;
+    all.insert(all.end(), b.begin(), b.end());
+    std::sort(all.begin(), all.end(), [](const BootProfileRange& x, const BootProfileRange& y) {
+        return x.block < y.block;
+    });
+
+    Ranges merged;
+    for (const auto& range : all) {
+        if (!merged.empty()) {
+            auto& last = merged.back();
+            uint64_t last_end = static_cast<uint64_t>(last.block) + last.num_blocks;
+            if (range.block <= last_end) {
+                uint64_t end = std::max(last_end, static_cast<uint64_t>(range.block) +
+                                                          range.num_blocks);
+                last.num_blocks = static_cast<uint32_t>(end - last.block);
+                continue;
+            }
+        }
+        merged.push_back(range);
+    }
+    return merged;
+}
+
+bool BootProfile::Load(const std::string& path, std::string* boot_id, Ranges* ranges) {
+    std::string contents;
+    if (!android::base::ReadFileToString(path, &contents)) {
+        if (errno != ENOENT) {
+            PLOG(ERROR) << "Failed to read boot profile: " << path;
+        }
+        return false;
+    }
+
+    BootProfileHeader header;
+    if (contents.size() < sizeof(header)) {
+        LOG(ERROR) << "Boot profile too small: " << path << " size: " << contents.size();
+        return false;
+    }
+    memcpy(&header, contents.data(), sizeof(header));
+
+    if (header.magic != kMagic || header.version != kVersion) {
+        LOG(ERROR) << "Invalid boot profile: " << path << " magic: " << header.magic
+                   << " version: " << header.version;
+        return false;
+    }
+    if (contents.size() != sizeof(header) + header.num_ranges * sizeof(BootProfileRange)) {
+        LOG(ERROR) << "Boot profile size mismatch: " << path << " size: " << contents.size()
+                   << " ranges: " << header.num_ranges;
+        return false;
+    }
+
+    ranges->resize(header.num_ranges);
+    memcpy(ranges->data(), contents.data() + sizeof(header),
+           header.num_ranges * sizeof(BootProfileRange));
+    boot_id->assign(header.boot_id, strnlen(header.boot_id, sizeof(header.boot_id)));
+    return true;
+}
+
+bool BootProfile::Save(const std::string& path, const std::string& boot_id,
+                       const Ranges& ranges) {
+    BootProfileHeader header = {};
+    header.magic = kMagic;
+    header.version = kVersion;
+    header.num_ranges = ranges.size();
+    strncpy(header.boot_id, boot_id.c_str(), sizeof(header.boot_id) - 1);
+
+    std::string contents(reinterpret_cast<const char*>(&header), sizeof(header));
+    contents.append(reinterpret_cast<const char*>(ranges.data()),
+                    ranges.size() * sizeof(BootProfileRange));
+
+    // Write a new file and rename it over the old one, so a crash never
+    // leaves a torn profile behind.
+    std::string tmp_path = path + ".tmp";
+    unique_fd fd(TEMP_FAILURE_RETRY(
+            open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)));
+    if (fd < 0) {
+        PLOG(ERROR) << "Failed to create boot profile: " << tmp_path;
+        return false;
+    }
+    if (!android::base::WriteStringToFd(contents, fd) || fsync(fd.get()) < 0) {
+        PLOG(ERROR) << "Failed to write boot profile: " << tmp_path;
+        return false;
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+        PLOG(ERROR) << "Failed to rename boot profile: " << tmp_path << " to " << path;
+        return false;
+    }
+    return true;
+}
+
+std::string BootProfile::GetBootId() {
+    std::string boot_id;
+    if (!android::base::ReadFileToString("/proc/sys/kernel/random/boot_id", &boot_id)) {
+        PLOG(ERROR) << "Failed to read boot_id";
+        return {};
+    }
+    return android::base::Trim(boot_id);
+}
+
+// The first-stage and second-stage handlers of a device share one profile.
+std::string SnapshotHandler::GetBootProfilePath() {
+    std::string name = misc_name_;
+    if (android::base::EndsWith(name, "-init")) {
+        name.resize(name.size() - strlen("-init"));
+    }
+    return std::string(kBootProfileDir) + "/" + name + ".profile";
+}
+
+// Only record during boot. Devices created later, e.g. while an update is
+// being installed, see I/O that says nothing about the next boot.
+bool SnapshotHandler::StartBootProfile() {
+    if (is_socket_present_ || GetBootTime() >= kBootProfileWindow) {
+        return false;
+    }
+
+    boot_profile_ = std::make_unique<BootProfile>((num_sectors_ << SECTOR_SHIFT) / BLOCK_SZ);
+    recording_boot_profile_ = true;
+    return true;
+}
+
+void SnapshotHandler::StopBootProfile() {
+    {
+        std::lock_guard<std::mutex> lock(boot_profile_lock_);
+        stop_boot_profile_ = true;
+    }
+    boot_profile_cv_.notify_all();
+}
+
+// Runs until the end of the profiling window, or until I/O terminates, and
+// then writes out the profile.
+bool SnapshotHandler::SaveBootProfile() {
+    {
+        std::unique_lock<std::mutex> lock(boot_profile_lock_);
+        boot_profile_cv_.wait_for(lock, kBootProfileWindow - GetBootTime(),
+                                  [this]() -> bool { return stop_boot_profile_; });
+    }
+    recording_boot_profile_ = false;
+
+    auto ranges = boot_profile_->GetRanges();
+    if (ranges.empty()) {
+        return true;
+    }
+
+    std::string path = GetBootProfilePath();
+    std::string boot_id = BootProfile::GetBootId();
+
+    // The first-stage daemon hands its devices over to the second-stage one
+    // in the middle of the window; keep what it recorded for this boot.
+    std::string saved_boot_id;
+    BootProfile::Ranges saved_ranges;
+    if (!boot_id.empty() && BootProfile::Load(path, &saved_boot_id, &saved_ranges) &&
+        saved_boot_id == boot_id) {
+        ranges = BootProfile::Merge(ranges, saved_ranges);
+    }
+
+    if (mkdir(kBootProfileDir, 0700) < 0 && errno != EEXIST) {
+        SNAP_PLOG(ERROR) << "Failed to create " << kBootProfileDir;
+        return false;
+    }
+    if (!BootProfile::Save(path, boot_id, ranges)) {
+        return false;
+    }
+
+    SNAP_LOG(INFO) << "Saved boot profile: " << path << " ranges: " << ranges.size();
+    return true;
+}
+
+// Decompress the replace ops read during the last boot into the block cache,
+// so that those reads hit the cache when they arrive again. Other ops are
+// plain reads of the COW or base device and gain nothing from this.
+bool SnapshotHandler::PrefetchBootProfile() {
+    std::string path = GetBootProfilePath();
+    std::string boot_id;
+    BootProfile::Ranges ranges;
+    if (!BootProfile::Load(path, &boot_id, &ranges)) {
+        return false;
+    }
+
+    std::vector<const CowOperation*> ops;
+    for (const auto& range : ranges) {
+        sector_t start = ChunkToSector(range.block);
+        sector_t end = ChunkToSector(static_cast<uint64_t>(range.block) + range.num_blocks);
+
+        auto it = std::lower_bound(chunk_vec_.begin(), chunk_vec_.end(),
+                                   std::make_pair(start, nullptr), SnapshotHandler::compare);
+        for (; it != chunk_vec_.end() && it->first < end; it++) {
+            const CowOperation* cow_op = it->second;
+            if (cow_op->type == kCowReplaceOp && cow_op->compression != kCowCompressNone) {
+                ops.push_back(cow_op);
+            }
+        }
+        if (ops.size() >= kMaxPrefetchBlocks) {
+            ops.resize(kMaxPrefetchBlocks);
+            break;
+        }
+    }
+    if (ops.empty()) {
+        return true;
+    }
+
+    block_cache_->Reserve(ops.size());
+
+    std::vector<std::future<bool>> threads;
+    size_t ops_per_thread = (ops.size() + kNumPrefetchThreads - 1) / kNumPrefetchThreads;
+    for (size_t i = 0; i < ops.size(); i += ops_per_thread) {
+        std::vector<const CowOperation*> thread_ops(
+                ops.begin() + i, ops.begin() + std::min(ops.size(), i + ops_per_thread));
+        threads.emplace_back(std::async(std::launch::async, &SnapshotHandler::PrefetchBlocks,
+                                        this, std::move(thread_ops)));
+    }
+
+    bool ret = true;
+    for (auto& t : threads) {
+        ret = t.get() && ret;
+    }
+
+    SNAP_LOG(INFO) << "Prefetched " << ops.size() << " blocks from boot profile: " << path
+                   << " ret: " << ret;
+    return ret;
+}
+
+bool SnapshotHandler::PrefetchBlocks(std::vector<const CowOperation*> ops) {
+    unique_fd cow_fd(TEMP_FAILURE_RETRY(open(cow_device_.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (cow_fd < 0) {
+        SNAP_PLOG(ERROR) << "Failed to open " << cow_device_;
+        return false;
+    }
+
+    std::unique_ptr<CowReader> reader = CloneReaderForWorker();
+    if (!reader->InitForMerge(std::move(cow_fd))) {
+        return false;
+    }
+
+    BufferSink bufsink;
+    bufsink.Initialize(sizeof(struct dm_user_header) + BLOCK_SZ);
+
+    for (const CowOperation* cow_op : ops) {
+        bufsink.ResetBufferOffset();
+        if (!reader->ReadData(*cow_op, &bufsink)) {
+            SNAP_LOG(ERROR) << "Failed to prefetch block " << cow_op->new_block;
+            return false;
+        }
+        block_cache_->Put(cow_op->new_block, bufsink.GetPayloadBufPtr());
+    }
+    return true;
+}
+
+}  // namespace snapshot
+}  // namespace android
@@ -115,7 +115,7 @@ int ReadAhead::PrepareNextReadAhead(uint64_t* source_offset, int* pending_ops,
 }
 
 bool ReadAhead::ReconstructDataFromCow() {
-    std::unordered_map<uint64_t, void*>& read_ahead_buffer_map = snapuserd_->GetReadAheadMap();
+    auto read_ahead_index = std::make_shared<SnapshotHandler::ReadAheadIndex>();
     loff_t metadata_offset = 0;
     loff_t start_data_offset = snapuserd_->GetBufferDataOffset();
     int num_ops = 0;
@@ -138,19 +138,22 @@ bool ReadAhead::ReconstructDataFromCow() {
 
         loff_t buffer_offset = bm->file_offset - start_data_offset;
         void* bufptr = static_cast<void*>((char*)read_ahead_buffer_ + buffer_offset);
-        read_ahead_buffer_map[bm->new_block] = bufptr;
+        read_ahead_index->Add(bm->new_block, bufptr);
         num_ops += 1;
         total_blocks_merged += 1;
 
         metadata_offset += sizeof(struct ScratchMetadata);
     }
 
+    read_ahead_index->Finalize();
+    snapuserd_->PublishReadAheadIndex(read_ahead_index);
+
     // We are done re-constructing the mapping; however, we need to make sure
     // all the COW operations to-be merged are present in the re-constructed
     // mapping.
     while (!RAIterDone()) {
         const CowOperation* op = GetRAOpIter();
-        if (read_ahead_buffer_map.find(op->new_block) != read_ahead_buffer_map.end()) {
+        if (read_ahead_index->Find(op->new_block)) {
             num_ops -= 1;
             RAIterNext();
             continue;
@@ -440,9 +443,7 @@ void ReadAhead::ProcessXorData(size_t& block_xor_index, size_t& xor_index,
                 uint8_t* xor_data = reinterpret_cast<uint8_t*>((char*)bufsink_.GetPayloadBufPtr() +
                                                                xor_buf_offset);
 
-                for (size_t byte_offset = 0; byte_offset < BLOCK_SZ; byte_offset++) {
-                    buffer[byte_offset] ^= xor_data[byte_offset];
-                }
+                XorBuffer(buffer, xor_data, BLOCK_SZ);
 
                 // Move to next XOR op
                 xor_index += 1;
@@ -572,9 +573,7 @@ bool ReadAhead::ReadAheadSyncIO() {
                 uint8_t* xor_data = reinterpret_cast<uint8_t*>(bufsink.GetPayloadBufPtr());
 
                 // Retrieve the original data
-                for (size_t byte_offset = 0; byte_offset < BLOCK_SZ; byte_offset++) {
-                    buffer[byte_offset] ^= xor_data[byte_offset];
-                }
+                XorBuffer(buffer, xor_data, BLOCK_SZ);
 
                 // Move to next XOR op
                 xor_index += 1;
@@ -660,16 +659,18 @@ bool ReadAhead::ReadAheadIOStart() {
     memcpy(read_ahead_buffer_, ra_temp_buffer_.get(), total_blocks_merged_ * BLOCK_SZ);
 
     loff_t offset = 0;
-    std::unordered_map<uint64_t, void*>& read_ahead_buffer_map = snapuserd_->GetReadAheadMap();
-    read_ahead_buffer_map.clear();
+    auto read_ahead_index = std::make_shared<SnapshotHandler::ReadAheadIndex>();
+    read_ahead_index->Reserve(blocks_.size());
 
     for (size_t block_index = 0; block_index < blocks_.size(); block_index++) {
         void* bufptr = static_cast<void*>((char*)read_ahead_buffer_ + offset);
         uint64_t new_block = blocks_[block_index];
 
-        read_ahead_buffer_map[new_block] = bufptr;
+        read_ahead_index->Add(new_block, bufptr);
         offset += BLOCK_SZ;
     }
+    read_ahead_index->Finalize();
+    snapuserd_->PublishReadAheadIndex(std::move(read_ahead_index));
 
     total_ra_blocks_completed_ += total_blocks_merged_;
     snapuserd_->SetMergedBlockCountForNextCommit(total_blocks_merged_);
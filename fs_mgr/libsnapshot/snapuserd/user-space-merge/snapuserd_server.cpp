@@ -27,6 +27,7 @@
 
 #include <android-base/cmsg.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/scopeguard.h>
 #include <fs_mgr/file_wait.h>
@@ -55,6 +56,9 @@ DaemonOps UserSnapshotServer::Resolveop(std::string& input) {
     if (input == "initiate_merge") return DaemonOps::INITIATE;
     if (input == "merge_percent") return DaemonOps::PERCENTAGE;
     if (input == "getstatus") return DaemonOps::GETSTATUS;
+    if (input == "cache_stats") return DaemonOps::CACHE_STATS;
+    if (input == "merge_policy") return DaemonOps::MERGE_POLICY;
+    if (input == "stats") return DaemonOps::STATS;
 
     return DaemonOps::INVALID;
 }
@@ -282,6 +286,81 @@ bool UserSnapshotServer::Receivemsg(android::base::borrowed_fd fd, const std::st
                 return Sendmsg(fd, merge_status);
             }
         }
+        case DaemonOps::CACHE_STATS: {
+            // Message format:
+            // cache_stats,<misc_name>
+            //
+            // Reply: <hits>,<misses>
+            if (out.size() != 2) {
+                LOG(ERROR) << "Malformed cache_stats message, " << out.size() << " parts";
+                return Sendmsg(fd, "fail");
+            }
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                auto iter = FindHandler(&lock, out[1]);
+                if (iter == dm_users_.end() || !(*iter)->snapuserd()) {
+                    LOG(ERROR) << "Could not find handler: " << out[1];
+                    return Sendmsg(fd, "fail");
+                }
+
+                BlockCache* cache = (*iter)->snapuserd()->GetBlockCache();
+                return Sendmsg(fd, std::to_string(cache->GetHits()) + "," +
+                                           std::to_string(cache->GetMisses()));
+            }
+        }
+        case DaemonOps::MERGE_POLICY: {
+            // Message format:
+            // merge_policy,<high_watermark>,<low_watermark>,<max_latency_us>,<max_delay_ms>
+            //
+            // Applies to all current and future handlers.
+            if (out.size() != 5) {
+                LOG(ERROR) << "Malformed merge_policy message, " << out.size() << " parts";
+                return Sendmsg(fd, "fail");
+            }
+            MergePolicy policy;
+            if (!android::base::ParseUint(out[1], &policy.high_watermark) ||
+                !android::base::ParseUint(out[2], &policy.low_watermark) ||
+                !android::base::ParseUint(out[3], &policy.max_latency_us) ||
+                !android::base::ParseUint(out[4], &policy.max_delay_ms)) {
+                LOG(ERROR) << "Failed to parse merge_policy message: " << str;
+                return Sendmsg(fd, "fail");
+            }
+            if (policy.high_watermark && policy.low_watermark > policy.high_watermark) {
+                LOG(ERROR) << "Invalid merge policy, low watermark: " << policy.low_watermark
+                           << " above high watermark: " << policy.high_watermark;
+                return Sendmsg(fd, "fail");
+            }
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                merge_policy_ = policy;
+                for (auto& handler : dm_users_) {
+                    if (handler->snapuserd()) {
+                        handler->snapuserd()->SetMergePolicy(policy);
+                    }
+                }
+            }
+            return Sendmsg(fd, "success");
+        }
+        case DaemonOps::STATS: {
+            // Message format:
+            // stats,<misc_name>
+            //
+            // Reply: see SnapuserdStats::ToString()
+            if (out.size() != 2) {
+                LOG(ERROR) << "Malformed stats message, " << out.size() << " parts";
+                return Sendmsg(fd, "fail");
+            }
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                auto iter = FindHandler(&lock, out[1]);
+                if (iter == dm_users_.end() || !(*iter)->snapuserd()) {
+                    LOG(ERROR) << "Could not find handler: " << out[1];
+                    return Sendmsg(fd, "fail");
+                }
+
+                return Sendmsg(fd, (*iter)->snapuserd()->GetStats()->ToString());
+            }
+        }
         default: {
             LOG(ERROR) << "Received unknown message type from client";
             Sendmsg(fd, "fail");
@@ -302,7 +381,11 @@ void UserSnapshotServer::RunThread(std::shared_ptr<UserSnapshotDmUserHandler> ha
     handler->snapuserd()->UnmapBufferRegion();
 
     auto misc_name = handler->misc_name();
-    LOG(INFO) << "Handler thread about to exit: " << misc_name;
+    BlockCache* cache = handler->snapuserd()->GetBlockCache();
+    LOG(INFO) << "Handler thread about to exit: " << misc_name
+              << " block cache hits: " << cache->GetHits() << " misses: " << cache->GetMisses();
+    LOG(INFO) << "Handler stats: " << misc_name << " "
+              << handler->snapuserd()->GetStats()->ToString();
 
     {
         std::lock_guard<std::mutex> lock(lock_);
@@ -472,6 +555,7 @@ std::shared_ptr<UserSnapshotDmUserHandler> UserSnapshotServer::AddHandler(
 
     snapuserd->SetSocketPresent(is_socket_present_);
     snapuserd->SetIouringEnabled(io_uring_enabled_);
+    snapuserd->SetMergePolicy(merge_policy_);
 
     if (!snapuserd->InitializeWorkers()) {
         LOG(ERROR) << "Failed to initialize workers";
@@ -46,6 +46,9 @@ enum class DaemonOps {
     INITIATE,
     PERCENTAGE,
     GETSTATUS,
+    CACHE_STATS,
+    MERGE_POLICY,
+    STATS,
     INVALID,
 };
 
@@ -86,6 +89,7 @@ class UserSnapshotServer {
     int num_partitions_merge_complete_ = 0;
     bool is_server_running_ = false;
     bool io_uring_enabled_ = false;
+    MergePolicy merge_policy_;
 
     std::mutex lock_;
 
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sstream>
+
+#include "snapuserd_core.h"
+
+namespace android {
+namespace snapshot {
+
+void LatencyHistogram::Record(std::chrono::nanoseconds latency) {
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+
+    size_t bucket = 0;
+    while (us && bucket < kNumBuckets - 1) {
+        us >>= 1;
+        bucket++;
+    }
+
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_ns_.fetch_add(latency.count(), std::memory_order_relaxed);
+}
+
+std::chrono::microseconds LatencyHistogram::GetMean() const {
+    uint64_t count = count_;
+    if (!count) {
+        return 0us;
+    }
+    return std::chrono::microseconds(total_ns_ / count / 1000);
+}
+
+std::chrono::microseconds LatencyHistogram::GetPercentile(unsigned int percentile) const {
+    uint64_t count = count_;
+    if (!count) {
+        return 0us;
+    }
+
+    uint64_t target = (count * percentile + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        seen += buckets_[i];
+        if (seen >= target) {
+            return std::chrono::microseconds(1ULL << i);
+        }
+    }
+    return std::chrono::microseconds(1ULL << (kNumBuckets - 1));
+}
+
+int64_t SnapuserdStats::NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+// Reply format, one entry per stage:
+//
+//   <stage>:<count>,<mean_us>,<p50_us>,<p99_us> ... merge:<blocks>,<elapsed_ms>
+//
+// Percentiles are bucket upper bounds.
+std::string SnapuserdStats::ToString() const {
+    std::ostringstream os;
+
+    auto add = [&](const char* name, const LatencyHistogram& histogram) -> void {
+        os << name << ":" << histogram.GetCount() << "," << histogram.GetMean().count() << ","
+           << histogram.GetPercentile(50).count() << "," << histogram.GetPercentile(99).count()
+           << " ";
+    };
+    add("request", request);
+    add("cow_lookup", cow_lookup);
+    add("decompress", decompress);
+    add("base_read", base_read);
+    add("reply", reply);
+    add("ra_stall", ra_stall);
+
+    int64_t elapsed_ns = 0;
+    if (merge_start_ns) {
+        int64_t end_ns = merge_end_ns;
+        if (!end_ns) {
+            end_ns = NowNs();
+        }
+        elapsed_ns = end_ns - merge_start_ns;
+    }
+    os << "merge:" << merged_blocks << "," << elapsed_ns / 1000000;
+    return os.str();
+}
+
+}  // namespace snapshot
+}  // namespace android
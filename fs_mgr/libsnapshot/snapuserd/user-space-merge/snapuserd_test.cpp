@@ -758,6 +758,116 @@ void SnapuserTest::MergeInterrupt() {
     ASSERT_TRUE(Merge());
 }
 
+TEST(Snapuserd_Test, BlockCache) {
+    BlockCache cache(64);
+    std::string block(BLOCK_SZ, 'a');
+    std::string out(BLOCK_SZ, '\0');
+
+    ASSERT_FALSE(cache.Get(1, out.data()));
+    cache.Put(1, block.data());
+    ASSERT_TRUE(cache.Get(1, out.data()));
+    ASSERT_EQ(out, block);
+
+    // Filling a shard evicts its least recently used block.
+    for (uint64_t i = 1; i < 64; i++) {
+        block[0] = static_cast<char>(i);
+        cache.Put(1 + i * 16, block.data());
+    }
+    ASSERT_FALSE(cache.Get(1, out.data()));
+    ASSERT_TRUE(cache.Get(1 + 63 * 16, out.data()));
+    ASSERT_EQ(out[0], 63);
+
+    ASSERT_EQ(cache.GetHits(), 2);
+    ASSERT_EQ(cache.GetMisses(), 2);
+}
+
+TEST(Snapuserd_Test, LatencyHistogram) {
+    LatencyHistogram histogram;
+    ASSERT_EQ(histogram.GetPercentile(50), 0us);
+
+    for (int i = 0; i < 98; i++) {
+        histogram.Record(3us);
+    }
+    histogram.Record(100us);
+    histogram.Record(5ms);
+
+    ASSERT_EQ(histogram.GetCount(), 100);
+    ASSERT_EQ(histogram.GetMean(), 53us);
+    ASSERT_EQ(histogram.GetPercentile(50), 4us);
+    ASSERT_EQ(histogram.GetPercentile(99), 128us);
+    ASSERT_EQ(histogram.GetPercentile(100), 8192us);
+}
+
+TEST(Snapuserd_Test, MergeThrottle) {
+    auto handler = std::make_shared<SnapshotHandler>("throttle", "", "", "");
+
+    // No policy - the merge is never throttled.
+    ASSERT_EQ(handler->ThrottleMerge(), 0ms);
+
+    MergePolicy policy;
+    policy.high_watermark = 100;
+    policy.low_watermark = 10;
+    policy.max_delay_ms = 4;
+    handler->SetMergePolicy(policy);
+    ASSERT_EQ(handler->ThrottleMerge(), 0ms);
+
+    // Busy foreground I/O - the delay doubles up to the maximum.
+    for (auto expected : {1ms, 2ms, 4ms, 4ms}) {
+        for (int i = 0; i < 1000; i++) {
+            handler->TrackIORequest(10us);
+        }
+        std::this_thread::sleep_for(kMergeThrottleInterval);
+        ASSERT_EQ(handler->ThrottleMerge(), expected);
+    }
+
+    // Idle - back to full speed.
+    std::this_thread::sleep_for(kMergeThrottleInterval);
+    ASSERT_EQ(handler->ThrottleMerge(), 0ms);
+}
+
+TEST(Snapuserd_Test, BootProfile) {
+    BootProfile profile(1024);
+    // Block 1, blocks 2-3 from an unaligned read, and the last block.
+    profile.Record(8, BLOCK_SZ);
+    profile.Record(17, BLOCK_SZ);
+    profile.Record(100, 2 * BLOCK_SZ);
+    profile.Record(1023 * 8, BLOCK_SZ);
+    // Past the end of the device.
+    profile.Record(1024 * 8, BLOCK_SZ);
+
+    auto ranges = profile.GetRanges();
+    ASSERT_EQ(ranges.size(), 3);
+    ASSERT_EQ(ranges[0].block, 1);
+    ASSERT_EQ(ranges[0].num_blocks, 3);
+    ASSERT_EQ(ranges[1].block, 12);
+    ASSERT_EQ(ranges[1].num_blocks, 3);
+    ASSERT_EQ(ranges[2].block, 1023);
+    ASSERT_EQ(ranges[2].num_blocks, 1);
+
+    TemporaryDir dir;
+    std::string path = std::string(dir.path) + "/system.profile";
+    ASSERT_TRUE(BootProfile::Save(path, "boot-1", ranges));
+
+    std::string boot_id;
+    BootProfile::Ranges loaded;
+    ASSERT_TRUE(BootProfile::Load(path, &boot_id, &loaded));
+    ASSERT_EQ(boot_id, "boot-1");
+    ASSERT_EQ(loaded.size(), ranges.size());
+
+    BootProfile::Ranges other = {{0, 2}, {14, 4}, {500, 1}};
+    auto merged = BootProfile::Merge(loaded, other);
+    ASSERT_EQ(merged.size(), 4);
+    ASSERT_EQ(merged[0].block, 0);
+    ASSERT_EQ(merged[0].num_blocks, 4);
+    ASSERT_EQ(merged[1].block, 12);
+    ASSERT_EQ(merged[1].num_blocks, 6);
+    ASSERT_EQ(merged[2].block, 500);
+    ASSERT_EQ(merged[3].block, 1023);
+
+    ASSERT_TRUE(android::base::WriteStringToFile("garbage", path));
+    ASSERT_FALSE(BootProfile::Load(path, &boot_id, &loaded));
+}
+
 TEST(Snapuserd_Test, Snapshot_IO_TEST) {
     SnapuserTest harness;
     ASSERT_TRUE(harness.Setup());
@@ -596,14 +596,17 @@ bool SnapshotHandler::GetRABuffer(std::unique_lock<std::mutex>* lock, uint64_t b
         SNAP_LOG(ERROR) << "GetRABuffer - Lock not held";
         return false;
     }
-    std::unordered_map<uint64_t, void*>::iterator it = read_ahead_buffer_map_.find(block);
-
-    if (it == read_ahead_buffer_map_.end()) {
+    // The index is looked up without any lock. The group lock is still
+    // needed: it stops the merge thread from retiring this window, and the
+    // read-ahead thread from reusing the buffer, while the block is copied.
+    auto index = GetReadAheadIndex();
+    void* const* bufptr = index ? index->Find(block) : nullptr;
+    if (!bufptr) {
         SNAP_LOG(ERROR) << "Block: " << block << " not found in RA buffer";
         return false;
     }
 
-    memcpy(buffer, it->second, BLOCK_SZ);
+    memcpy(buffer, *bufptr, BLOCK_SZ);
     return true;
 }
 
@@ -649,5 +652,66 @@ MERGE_GROUP_STATE SnapshotHandler::ProcessMergingBlock(uint64_t new_block, void*
     }
 }
 
+void SnapshotHandler::SetMergePolicy(const MergePolicy& policy) {
+    std::lock_guard<std::mutex> lock(merge_policy_lock_);
+    merge_policy_ = policy;
+}
+
+void SnapshotHandler::TrackIORequest(std::chrono::nanoseconds latency) {
+    io_requests_.fetch_add(1, std::memory_order_relaxed);
+    io_latency_ns_.fetch_add(latency.count(), std::memory_order_relaxed);
+    stats_.request.Record(latency);
+}
+
+// Called by the merge thread before each merge batch. Returns the delay that
+// was applied.
+std::chrono::milliseconds SnapshotHandler::ThrottleMerge() {
+    MergePolicy policy;
+    {
+        std::lock_guard<std::mutex> lock(merge_policy_lock_);
+        policy = merge_policy_;
+    }
+
+    if (!policy.high_watermark && !policy.max_latency_us) {
+        merge_delay_ = 0ms;
+        return merge_delay_;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed =
+            std::chrono::duration_cast<std::chrono::milliseconds>(now - throttle_sample_time_);
+    if (elapsed >= kMergeThrottleInterval) {
+        uint64_t requests = io_requests_.load(std::memory_order_relaxed);
+        uint64_t latency_ns = io_latency_ns_.load(std::memory_order_relaxed);
+        uint64_t num_requests = requests - throttle_requests_;
+
+        uint64_t rate = num_requests * 1000 / elapsed.count();
+        uint64_t avg_latency_us =
+                num_requests ? (latency_ns - throttle_latency_ns_) / num_requests / 1000 : 0;
+
+        bool busy = (policy.high_watermark && rate >= policy.high_watermark) ||
+                    (policy.max_latency_us && avg_latency_us >= policy.max_latency_us);
+        if (busy) {
+            auto max_delay = std::chrono::milliseconds(policy.max_delay_ms);
+            merge_delay_ = std::min(std::max(merge_delay_ * 2, 1ms), max_delay);
+        } else if (rate <= policy.low_watermark) {
+            merge_delay_ = 0ms;
+        }
+
+        SNAP_LOG(DEBUG) << "Merge throttle: requests/s: " << rate
+                        << " avg latency(us): " << avg_latency_us
+                        << " delay(ms): " << merge_delay_.count();
+
+        throttle_sample_time_ = now;
+        throttle_requests_ = requests;
+        throttle_latency_ns_ = latency_ns;
+    }
+
+    if (merge_delay_ > 0ms) {
+        std::this_thread::sleep_for(merge_delay_);
+    }
+    return merge_delay_;
+}
+
 }  // namespace snapshot
 }  // namespace android
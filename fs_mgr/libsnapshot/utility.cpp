@@ -196,6 +196,22 @@ bool IsIouringEnabled() {
     return android::base::GetBoolProperty("ro.virtual_ab.io_uring.enabled", false);
 }
 
+std::vector<std::string> GetMergePriorityList() {
+    auto value = android::base::GetProperty("ro.virtual_ab.merge_order", "");
+    std::vector<std::string> names;
+    for (auto& name : android::base::Split(value, ",")) {
+        name = android::base::Trim(name);
+        if (!name.empty()) {
+            names.emplace_back(std::move(name));
+        }
+    }
+    return names;
+}
+
+uint32_t GetMergeConcurrency() {
+    return android::base::GetUintProperty<uint32_t>("ro.virtual_ab.merge_concurrency", 0);
+}
+
 std::string GetOtherPartitionName(const std::string& name) {
     auto suffix = android::fs_mgr::GetPartitionSlotSuffix(name);
     CHECK(suffix == "_a" || suffix == "_b");
@@ -17,6 +17,7 @@
 #include <functional>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <android-base/macros.h>
 #include <fstab/fstab.h>
@@ -137,6 +138,12 @@ bool IsDmSnapshotTestingEnabled();
 
 bool IsIouringEnabled();
 
+// Partitions to merge first, without slot suffixes, from ro.virtual_ab.merge_order.
+std::vector<std::string> GetMergePriorityList();
+
+// How many partitions may merge at once, or 0 for no limit.
+uint32_t GetMergeConcurrency();
+
 // Swap the suffix of a partition name.
 std::string GetOtherPartitionName(const std::string& name);
 }  // namespace snapshot
@@ -25,6 +25,7 @@ using namespace std::literals;
 using android::base::unique_fd;
 using android::fs_mgr::WaitForFile;
 using android::fs_mgr::WaitForFileDeleted;
+using android::fs_mgr::WaitForFiles;
 
 class FileWaitTest : public ::testing::Test {
   protected:
@@ -85,6 +86,49 @@ TEST_F(FileWaitTest, DeleteAsync) {
     thread.join();
 }
 
+TEST_F(FileWaitTest, CreateManyAsync) {
+    std::vector<std::string> files = {test_file_ + ".0", test_file_ + ".1", test_file_ + ".2"};
+    std::thread thread([&] {
+        for (const auto& file : files) {
+            std::this_thread::sleep_for(200ms);
+            unique_fd fd(open(file.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0700));
+        }
+    });
+    EXPECT_TRUE(WaitForFiles(files, 3s));
+    thread.join();
+
+    for (const auto& file : files) {
+        unlink(file.c_str());
+    }
+}
+
+TEST_F(FileWaitTest, CreateSomeAsync) {
+    std::vector<std::string> files = {test_file_, test_file_ + ".wontexist"};
+    std::thread thread([this] {
+        std::this_thread::sleep_for(200ms);
+        unique_fd fd(open(test_file_.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0700));
+    });
+    EXPECT_FALSE(WaitForFiles(files, 1s));
+    thread.join();
+}
+
+TEST_F(FileWaitTest, CreateInNewDirectoryAsync) {
+    std::string dir = test_file_ + ".dir";
+    std::string file = dir + "/file";
+    std::thread thread([&] {
+        std::this_thread::sleep_for(200ms);
+        mkdir(dir.c_str(), 0700);
+        unique_fd fd(open(file.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0700));
+    });
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(WaitForFile(file, 3s));
+    EXPECT_LT(std::chrono::steady_clock::now() - start, 1s);
+    thread.join();
+
+    unlink(file.c_str());
+    rmdir(dir.c_str());
+}
+
 TEST_F(FileWaitTest, BadPath) {
     ASSERT_FALSE(WaitForFile("/this/path/does/not/exist", 5ms));
     EXPECT_EQ(errno, ENOENT);
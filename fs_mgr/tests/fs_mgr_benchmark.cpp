@@ -0,0 +1,224 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for the steps of first-stage mount, one benchmark per phase:
+// reading the fstab, reading LP metadata, creating a device-mapper device and
+// mounting a filesystem. The device-mapper and mount phases need root, and are
+// skipped otherwise. They run against loop devices backed by files in a
+// temporary directory, so they don't touch any real partition.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <fs_mgr.h>
+#include <fstab/fstab.h>
+#include <libdm/dm.h>
+#include <libdm/loop_control.h>
+#include <liblp/builder.h>
+#include <liblp/liblp.h>
+
+using namespace std::chrono_literals;
+using namespace android::fs_mgr;
+using android::dm::DeviceMapper;
+using android::dm::DmTable;
+using android::dm::DmTargetLinear;
+using android::dm::LoopDevice;
+
+static constexpr uint64_t kImageSize = 64 * 1024 * 1024;
+
+// Writes an fstab with |num_entries| entries, similar to a device fstab.
+static std::string MakeFstab(int num_entries) {
+    std::string contents;
+    for (int i = 0; i < num_entries; i++) {
+        contents += android::base::StringPrintf(
+                "system%d /mnt/bench%d ext4 noatime,ro,errors=panic "
+                "wait,slotselect,avb=vbmeta_system,logical,first_stage_mount\n",
+                i, i);
+    }
+    return contents;
+}
+
+static void BM_ReadFstabFromFile(benchmark::State& state) {
+    TemporaryFile tf;
+    if (!android::base::WriteStringToFile(MakeFstab(state.range(0)), tf.path)) {
+        state.SkipWithError("failed to write fstab");
+        return;
+    }
+
+    for (auto _ : state) {
+        // Bump the mtime so that each iteration parses the file again, rather
+        // than hitting the parse cache.
+        state.PauseTiming();
+        utimensat(AT_FDCWD, tf.path, nullptr, 0);
+        state.ResumeTiming();
+
+        Fstab fstab;
+        benchmark::DoNotOptimize(ReadFstabFromFile(tf.path, &fstab));
+    }
+}
+BENCHMARK(BM_ReadFstabFromFile)->Arg(8)->Arg(32);
+
+static void BM_ReadFstabFromFile_Cached(benchmark::State& state) {
+    TemporaryFile tf;
+    if (!android::base::WriteStringToFile(MakeFstab(state.range(0)), tf.path)) {
+        state.SkipWithError("failed to write fstab");
+        return;
+    }
+
+    for (auto _ : state) {
+        Fstab fstab;
+        benchmark::DoNotOptimize(ReadFstabFromFile(tf.path, &fstab));
+    }
+}
+BENCHMARK(BM_ReadFstabFromFile_Cached)->Arg(8)->Arg(32);
+
+static void BM_ReadDefaultFstab(benchmark::State& state) {
+    for (auto _ : state) {
+        Fstab fstab;
+        benchmark::DoNotOptimize(ReadDefaultFstab(&fstab));
+    }
+}
+BENCHMARK(BM_ReadDefaultFstab);
+
+// Reads metadata from a file laid out like a super partition, with
+// as many partitions as the benchmark argument.
+static void BM_ReadMetadata(benchmark::State& state) {
+    TemporaryFile tf;
+    if (ftruncate(tf.fd, kImageSize) < 0) {
+        state.SkipWithError("failed to size super image");
+        return;
+    }
+
+    auto builder = MetadataBuilder::New(kImageSize, 64 * 1024, 2);
+    if (!builder) {
+        state.SkipWithError("failed to create metadata builder");
+        return;
+    }
+    for (int i = 0; i < state.range(0); i++) {
+        auto partition = builder->AddPartition("system" + std::to_string(i),
+                                               LP_PARTITION_ATTR_READONLY);
+        if (!partition || !builder->ResizePartition(partition, 512 * 1024)) {
+            state.SkipWithError("failed to add partition");
+            return;
+        }
+    }
+    auto metadata = builder->Export();
+    if (!metadata || !FlashPartitionTable(PartitionOpener(), tf.path, *metadata.get())) {
+        state.SkipWithError("failed to write metadata");
+        return;
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ReadMetadata(tf.path, 0));
+    }
+}
+BENCHMARK(BM_ReadMetadata)->Arg(8)->Arg(64);
+
+// A loop device over a sparse file of kImageSize bytes.
+class LoopFixture {
+  public:
+    bool Init(benchmark::State& state) {
+        if (getuid() != 0) {
+            state.SkipWithError("requires root");
+            return false;
+        }
+        if (ftruncate(file_.fd, kImageSize) < 0) {
+            state.SkipWithError("failed to size backing file");
+            return false;
+        }
+        loop_ = std::make_unique<LoopDevice>(file_.fd, 10s);
+        if (!loop_->valid()) {
+            state.SkipWithError("failed to create loop device");
+            return false;
+        }
+        return true;
+    }
+
+    const std::string& device() const { return loop_->device(); }
+
+  private:
+    TemporaryFile file_;
+    std::unique_ptr<LoopDevice> loop_;
+};
+
+// Times creating a dm-linear device and waiting for its node to appear.
+static void BM_CreateDmDevice(benchmark::State& state) {
+    LoopFixture loop;
+    if (!loop.Init(state)) return;
+
+    auto& dm = DeviceMapper::Instance();
+    const std::string name = "fs_mgr_benchmark";
+    dm.DeleteDeviceIfExists(name);
+
+    for (auto _ : state) {
+        DmTable table;
+        table.Emplace<DmTargetLinear>(0, kImageSize / 512, loop.device(), 0);
+
+        std::string path;
+        if (!dm.CreateDevice(name, table, &path, 10s)) {
+            state.SkipWithError("failed to create dm device");
+            return;
+        }
+
+        state.PauseTiming();
+        dm.DeleteDevice(name, 10s);
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_CreateDmDevice)->Unit(benchmark::kMillisecond);
+
+// Times fs_mgr_do_mount_one() of an ext4 filesystem, as first-stage mount
+// does for each entry.
+static void BM_MountExt4(benchmark::State& state) {
+    LoopFixture loop;
+    if (!loop.Init(state)) return;
+
+    std::string command = "/system/bin/mke2fs -q -F -t ext4 -b 4096 " + loop.device() +
+                          " >/dev/null 2>&1 </dev/null";
+    if (system(command.c_str())) {
+        state.SkipWithError("failed to format loop device");
+        return;
+    }
+
+    TemporaryDir mount_point;
+    FstabEntry entry;
+    entry.blk_device = loop.device();
+    entry.mount_point = mount_point.path;
+    entry.fs_type = "ext4";
+    entry.flags = MS_RDONLY | MS_NOATIME;
+
+    for (auto _ : state) {
+        if (fs_mgr_do_mount_one(entry) != 0) {
+            state.SkipWithError("failed to mount");
+            return;
+        }
+
+        state.PauseTiming();
+        umount(mount_point.path);
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_MountExt4)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
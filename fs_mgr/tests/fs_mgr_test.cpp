@@ -206,7 +206,9 @@ bool CompareFlags(FstabEntry::FsMgrFlags& lhs, FstabEntry::FsMgrFlags& rhs) {
            lhs.checkpoint_fs == rhs.checkpoint_fs &&
            lhs.first_stage_mount == rhs.first_stage_mount &&
            lhs.slot_select_other == rhs.slot_select_other &&
-           lhs.fs_verity == rhs.fs_verity;
+           lhs.fs_verity == rhs.fs_verity &&
+           lhs.parallel_mount == rhs.parallel_mount &&
+           lhs.prefetch_hashtree == rhs.prefetch_hashtree;
     // clang-format on
 }
 
@@ -410,8 +412,8 @@ TEST(fs_mgr, ReadFstabFromFile_FsMgrFlags) {
 source none0       swap   defaults      wait,check,nonremovable,recoveryonly
 source none1       swap   defaults      avb,noemulatedsd,notrim,formattable,nofail
 source none2       swap   defaults      first_stage_mount,latemount,quota,logical
-source none3       swap   defaults      checkpoint=block
-source none4       swap   defaults      checkpoint=fs
+source none3       swap   defaults      checkpoint=block,prefetch_hashtree
+source none4       swap   defaults      checkpoint=fs,parallelmount
 source none5       swap   defaults      defaults
 )fs";
     ASSERT_TRUE(android::base::WriteStringToFile(fstab_contents, tf.path));
@@ -459,6 +461,7 @@ source none5       swap   defaults      defaults
     {
         FstabEntry::FsMgrFlags flags = {};
         flags.checkpoint_blk = true;
+        flags.prefetch_hashtree = true;
         EXPECT_TRUE(CompareFlags(flags, entry->fs_mgr_flags));
     }
 
@@ -467,6 +470,7 @@ source none5       swap   defaults      defaults
     {
         FstabEntry::FsMgrFlags flags = {};
         flags.checkpoint_fs = true;
+        flags.parallel_mount = true;
         EXPECT_TRUE(CompareFlags(flags, entry->fs_mgr_flags));
     }
 
@@ -997,6 +1001,7 @@ source none1       swap   defaults      zram_backingdev_size=blah
 source none2       swap   defaults      zram_backingdev_size=2
 source none3       swap   defaults      zram_backingdev_size=1K
 source none4       swap   defaults      zram_backingdev_size=2m
+source none5       swap   defaults      zram_comp_algorithm=lz4,zram_recomp_algorithm=zstd:deflate
 
 )fs";
 
@@ -1004,7 +1009,7 @@ source none4       swap   defaults      zram_backingdev_size=2m
 
     Fstab fstab;
     EXPECT_TRUE(ReadFstabFromFile(tf.path, &fstab));
-    ASSERT_LE(4U, fstab.size());
+    ASSERT_LE(5U, fstab.size());
 
     auto entry = fstab.begin();
 
@@ -1023,6 +1028,12 @@ source none4       swap   defaults      zram_backingdev_size=2m
     EXPECT_EQ("none4", entry->mount_point);
     EXPECT_EQ(2U * 1024U * 1024U, entry->zram_backingdev_size);
     entry++;
+
+    EXPECT_EQ("none5", entry->mount_point);
+    EXPECT_EQ("lz4", entry->zram_comp_algorithm);
+    EXPECT_EQ("zstd:deflate", entry->zram_recomp_algorithm);
+    EXPECT_EQ(0U, entry->zram_backingdev_size);
+    entry++;
 }
 
 TEST(fs_mgr, DefaultFstabContainsUserdata) {
@@ -1105,6 +1116,38 @@ source none6       swap   defaults      readahead_size_kb=0
     EXPECT_EQ(0, entry->readahead_size_kb);
 }
 
+TEST(fs_mgr, ReadFstabFromFile_Reparse) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    ASSERT_TRUE(android::base::WriteStringToFile(R"fs(
+source /system      ext4    ro      wait
+)fs",
+                                                 tf.path));
+
+    Fstab fstab;
+    ASSERT_TRUE(ReadFstabFromFile(tf.path, &fstab));
+    ASSERT_EQ(1U, fstab.size());
+    EXPECT_EQ("/system", fstab[0].mount_point);
+
+    // Reading again must not hand back entries from the first parse.
+    ASSERT_TRUE(android::base::WriteStringToFile(R"fs(
+source /system      ext4    ro      wait
+source /vendor      ext4    ro      wait
+)fs",
+                                                 tf.path));
+
+    ASSERT_TRUE(ReadFstabFromFile(tf.path, &fstab));
+    ASSERT_EQ(2U, fstab.size());
+    EXPECT_EQ("/system", fstab[0].mount_point);
+    EXPECT_EQ("/vendor", fstab[1].mount_point);
+
+    // Callers may modify what they are given without affecting later reads.
+    fstab[0].mount_point = "/modified";
+    ASSERT_TRUE(ReadFstabFromFile(tf.path, &fstab));
+    ASSERT_EQ(2U, fstab.size());
+    EXPECT_EQ("/system", fstab[0].mount_point);
+}
+
 TEST(fs_mgr, TransformFstabForDsu) {
     TemporaryFile tf;
     ASSERT_TRUE(tf.fd != -1);
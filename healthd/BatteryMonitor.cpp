@@ -29,12 +29,16 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <string>
+#include <unordered_map>
 
 #include <aidl/android/hardware/health/HealthInfo.h>
 #include <android-base/file.h>
 #include <android-base/parseint.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <android/hardware/health/2.1/types.h>
 #include <android/hardware/health/translate-ndk.h>
 #include <batteryservice/BatteryService.h>
@@ -227,9 +231,44 @@ BatteryHealth getBatteryHealth(const char* status) {
     return *ret;
 }
 
+// The power supply attributes, kept open across updates so that each update
+// only has to pread(2) them again.
+class SysfsFiles {
+  public:
+    static SysfsFiles& get() {
+        static auto files = new SysfsFiles;
+        return *files;
+    }
+
+    bool read(const char* path, std::string* buf) {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto it = mFiles.find(path);
+        if (it == mFiles.end()) {
+            android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC)));
+            if (fd == -1) return false;
+            it = mFiles.emplace(path, std::move(fd)).first;
+        }
+        // sysfs regenerates the attribute on every read from offset 0.
+        ssize_t len = TEMP_FAILURE_RETRY(pread(it->second.get(), mBuffer, sizeof(mBuffer), 0));
+        if (len < 0) {
+            // The supply may have gone away, open it again next time.
+            mFiles.erase(it);
+            return false;
+        }
+        buf->assign(mBuffer, len);
+        return true;
+    }
+
+  private:
+    std::mutex mLock;
+    std::unordered_map<std::string, android::base::unique_fd> mFiles;
+    // sysfs attributes are at most a page.
+    char mBuffer[4096];
+};
+
 static int readFromFile(const String8& path, std::string* buf) {
     buf->clear();
-    if (android::base::ReadFileToString(path.c_str(), buf)) {
+    if (SysfsFiles::get().read(path.c_str(), buf)) {
         *buf = android::base::Trim(*buf);
     }
     return buf->length();
@@ -356,15 +395,9 @@ void BatteryMonitor::updateValues(void) {
 
     double MaxPower = 0;
 
-    for (size_t i = 0; i < mChargerNames.size(); i++) {
-        String8 path;
-        path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH,
-                          mChargerNames[i].string());
-        if (getIntField(path)) {
-            path.clear();
-            path.appendFormat("%s/%s/type", POWER_SUPPLY_SYSFS_PATH,
-                              mChargerNames[i].string());
-            switch(readPowerSupplyType(path)) {
+    for (const auto& charger : mChargerPaths) {
+        if (getIntField(charger.online)) {
+            switch (readPowerSupplyType(charger.type)) {
             case ANDROID_POWER_SUPPLY_TYPE_AC:
                 mHealthInfo->chargerAcOnline = true;
                 break;
@@ -378,28 +411,21 @@ void BatteryMonitor::updateValues(void) {
                 mHealthInfo->chargerDockOnline = true;
                 break;
             default:
-                path.clear();
-                path.appendFormat("%s/%s/is_dock", POWER_SUPPLY_SYSFS_PATH,
-                                  mChargerNames[i].string());
-                if (access(path.string(), R_OK) == 0)
+                if (access(charger.isDock.string(), R_OK) == 0)
                     mHealthInfo->chargerDockOnline = true;
                 else
                     KLOG_WARNING(LOG_TAG, "%s: Unknown power supply type\n",
-                                 mChargerNames[i].string());
+                                 charger.name.string());
+            }
+            // A missing attribute reads as empty.
+            int ChargingCurrent = getIntField(charger.currentMax);
+
+            int ChargingVoltage = DEFAULT_VBUS_VOLTAGE;
+            std::string voltage;
+            if (readFromFile(charger.voltageMax, &voltage) > 0) {
+                ChargingVoltage = 0;
+                android::base::ParseInt(voltage, &ChargingVoltage);
             }
-            path.clear();
-            path.appendFormat("%s/%s/current_max", POWER_SUPPLY_SYSFS_PATH,
-                              mChargerNames[i].string());
-            int ChargingCurrent =
-                    (access(path.string(), R_OK) == 0) ? getIntField(path) : 0;
-
-            path.clear();
-            path.appendFormat("%s/%s/voltage_max", POWER_SUPPLY_SYSFS_PATH,
-                              mChargerNames[i].string());
-
-            int ChargingVoltage =
-                (access(path.string(), R_OK) == 0) ? getIntField(path) :
-                DEFAULT_VBUS_VOLTAGE;
 
             double power = ((double)ChargingCurrent / MILLION) *
                            ((double)ChargingVoltage / MILLION);
@@ -777,6 +803,19 @@ void BatteryMonitor::init(struct healthd_config *hc) {
         }
     }
 
+    mChargerPaths.clear();
+    for (size_t i = 0; i < mChargerNames.size(); i++) {
+        const char* name = mChargerNames[i].string();
+        ChargerPaths charger;
+        charger.name = mChargerNames[i];
+        charger.online.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH, name);
+        charger.type.appendFormat("%s/%s/type", POWER_SUPPLY_SYSFS_PATH, name);
+        charger.isDock.appendFormat("%s/%s/is_dock", POWER_SUPPLY_SYSFS_PATH, name);
+        charger.currentMax.appendFormat("%s/%s/current_max", POWER_SUPPLY_SYSFS_PATH, name);
+        charger.voltageMax.appendFormat("%s/%s/voltage_max", POWER_SUPPLY_SYSFS_PATH, name);
+        mChargerPaths.push_back(std::move(charger));
+    }
+
     // Typically the case for devices which do not have a battery and
     // and are always plugged into AC mains.
     if (!mBatteryDevicePresent) {
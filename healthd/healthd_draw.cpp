@@ -81,13 +81,36 @@ HealthdDraw::HealthdDraw(animation* anim)
 
 HealthdDraw::~HealthdDraw() {}
 
+static bool is_level_unknown(const animation* batt_anim) {
+    return batt_anim->cur_status == BATTERY_STATUS_UNKNOWN || batt_anim->cur_level < 0 ||
+           batt_anim->num_frames == 0;
+}
+
+HealthdDraw::drawn_frame HealthdDraw::get_drawn_frame(const animation* batt_anim,
+                                                      GRSurface* surf_unknown) const {
+    if (is_level_unknown(batt_anim)) return {surf_unknown, -1, 0};
+
+    int level = batt_anim->cur_status == BATTERY_STATUS_FULL ? 100 : batt_anim->cur_level;
+    // The clock only shows hours and minutes.
+    time_t clock_minute = 0;
+    if (batt_anim->text_clock.font != nullptr) clock_minute = time(nullptr) / 60;
+    return {batt_anim->frames[batt_anim->cur_frame].surface, level, clock_minute};
+}
+
 void HealthdDraw::redraw_screen(const animation* batt_anim, GRSurface* surf_unknown) {
     if (!graphics_available) return;
+
+    drawn_frame frame = get_drawn_frame(batt_anim, surf_unknown);
+    if (last_frame_ && *last_frame_ == frame) {
+        LOGV("frame unchanged, skipping redraw\n");
+        return;
+    }
+    last_frame_ = frame;
+
     clear_screen();
 
     /* try to display *something* */
-    if (batt_anim->cur_status == BATTERY_STATUS_UNKNOWN || batt_anim->cur_level < 0 ||
-        batt_anim->num_frames == 0)
+    if (is_level_unknown(batt_anim))
         draw_unknown(surf_unknown);
     else
         draw_battery(batt_anim);
@@ -96,12 +119,14 @@ void HealthdDraw::redraw_screen(const animation* batt_anim, GRSurface* surf_unkn
 
 void HealthdDraw::blank_screen(bool blank, int drm) {
     if (!graphics_available) return;
+    last_frame_.reset();
     gr_fb_blank(blank, drm);
 }
 
 /* support screen rotation for foldable phone */
 void HealthdDraw::rotate_screen(int drm) {
     if (!graphics_available) return;
+    last_frame_.reset();
     if (drm == 0)
         gr_rotate(GRRotation::RIGHT /* landscape mode */);
     else
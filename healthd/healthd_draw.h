@@ -19,6 +19,9 @@
 
 #include <linux/input.h>
 #include <minui/minui.h>
+#include <time.h>
+
+#include <optional>
 
 #include "animation.h"
 
@@ -84,6 +87,24 @@ class HealthdDraw {
  private:
   // Configures font using given animation.
   HealthdDraw(animation* anim);
+
+  // What a redraw shows. A redraw that would show the same as the last one
+  // is skipped instead of being drawn and flipped again.
+  struct drawn_frame {
+    const GRSurface* surface;
+    int level;
+    time_t clock_minute;
+
+    bool operator==(const drawn_frame& other) const {
+      return surface == other.surface && level == other.level &&
+             clock_minute == other.clock_minute;
+    }
+  };
+  drawn_frame get_drawn_frame(const animation* batt_anim, GRSurface* surf_unknown) const;
+
+  // Unset until the first redraw, and again after the screen was blanked or
+  // rotated.
+  std::optional<drawn_frame> last_frame_;
 };
 
 #endif  // HEALTHD_DRAW_H
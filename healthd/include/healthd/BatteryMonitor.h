@@ -18,6 +18,7 @@
 #define HEALTHD_BATTERYMONITOR_H
 
 #include <memory>
+#include <vector>
 
 #include <batteryservice/BatteryService.h>
 #include <utils/String8.h>
@@ -78,6 +79,16 @@ class BatteryMonitor {
   private:
     struct healthd_config *mHealthdConfig;
     Vector<String8> mChargerNames;
+    // The attributes of each of mChargerNames that updateValues reads.
+    struct ChargerPaths {
+        String8 name;
+        String8 online;
+        String8 type;
+        String8 isDock;
+        String8 currentMax;
+        String8 voltageMax;
+    };
+    std::vector<ChargerPaths> mChargerPaths;
     bool mBatteryDevicePresent;
     int mBatteryFixedCapacity;
     int mBatteryFixedTemperature;
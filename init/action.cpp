@@ -143,24 +143,52 @@ size_t Action::CheckAllCommands() const {
     return failures;
 }
 
-void Action::ExecuteOneCommand(std::size_t command) const {
+std::size_t Action::ExecuteCommandBatch(std::size_t command) const {
     // We need a copy here since some Command execution may result in
     // changing commands_ vector by importing .rc files through parser
-    Command cmd = commands_[command];
-    ExecuteCommand(cmd);
+    std::vector<Command> batch;
+    for (std::size_t i = command; i < commands_.size(); ++i) {
+        if (!subcontext_ || !commands_[i].execute_in_subcontext()) break;
+        batch.emplace_back(commands_[i]);
+    }
+
+    if (batch.size() <= 1) {
+        Command cmd = commands_[command];
+        ExecuteCommand(cmd);
+        return 1;
+    }
+
+    std::vector<std::vector<std::string>> args;
+    for (const auto& cmd : batch) {
+        args.emplace_back(cmd.args());
+    }
+
+    android::base::Timer t;
+    auto results = subcontext_->ExecuteBatch(args);
+    if (!results.ok()) {
+        LogCommandResult(batch[0], results.error(), t.duration());
+        return 1;
+    }
+    for (std::size_t i = 0; i < results->size(); ++i) {
+        LogCommandResult(batch[i], (*results)[i].result, (*results)[i].duration);
+    }
+    return results->size();
 }
 
 void Action::ExecuteAllCommands() const {
-    for (const auto& c : commands_) {
-        ExecuteCommand(c);
+    for (std::size_t i = 0; i < commands_.size();) {
+        i += ExecuteCommandBatch(i);
     }
 }
 
 void Action::ExecuteCommand(const Command& command) const {
     android::base::Timer t;
     auto result = command.InvokeFunc(subcontext_);
-    auto duration = t.duration();
+    LogCommandResult(command, result, t.duration());
+}
 
+void Action::LogCommandResult(const Command& command, const Result<void>& result,
+                              std::chrono::milliseconds duration) const {
     // Any action longer than 50ms will be warned to user as slow operation
     if (!result.has_value() || duration > 50ms ||
         android::base::GetMinimumLogSeverity() <= android::base::DEBUG) {
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <map>
 #include <queue>
 #include <string>
@@ -42,6 +43,8 @@ class Command {
     std::string BuildCommandString() const;
     Result<void> CheckCommand() const;
 
+    bool execute_in_subcontext() const { return execute_in_subcontext_; }
+    const std::vector<std::string>& args() const { return args_; }
     int line() const { return line_; }
 
   private:
@@ -64,7 +67,9 @@ class Action {
     Result<void> AddCommand(std::vector<std::string>&& args, int line);
     void AddCommand(BuiltinFunction f, std::vector<std::string>&& args, int line);
     size_t NumCommands() const;
-    void ExecuteOneCommand(std::size_t command) const;
+    // Executes the command at |command|, along with any following commands that can be sent to
+    // the subcontext in the same round trip. Returns the number of commands executed.
+    std::size_t ExecuteCommandBatch(std::size_t command) const;
     void ExecuteAllCommands() const;
     bool CheckEvent(const EventTrigger& event_trigger) const;
     bool CheckEvent(const PropertyChange& property_change) const;
@@ -74,6 +79,10 @@ class Action {
     size_t CheckAllCommands() const;
 
     bool oneshot() const { return oneshot_; }
+    const std::string& event_trigger() const { return event_trigger_; }
+    const std::map<std::string, std::string>& property_triggers() const {
+        return property_triggers_;
+    }
     const std::string& filename() const { return filename_; }
     int line() const { return line_; }
     static void set_function_map(const BuiltinFunctionMap* function_map) {
@@ -82,6 +91,8 @@ class Action {
 
   private:
     void ExecuteCommand(const Command& command) const;
+    void LogCommandResult(const Command& command, const Result<void>& result,
+                          std::chrono::milliseconds duration) const;
     bool CheckPropertyTriggers(const std::string& name = "",
                                const std::string& value = "") const;
 
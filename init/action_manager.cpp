@@ -16,6 +16,9 @@
 
 #include "action_manager.h"
 
+#include <algorithm>
+#include <iterator>
+
 #include <android-base/logging.h>
 
 namespace android {
@@ -37,9 +40,93 @@ ActionManager& ActionManager::GetInstance() {
 }
 
 void ActionManager::AddAction(std::unique_ptr<Action> action) {
+    AddToIndex(action.get());
     actions_.emplace_back(std::move(action));
 }
 
+void ActionManager::AddToIndex(const Action* action) {
+    action_order_[action] = next_action_order_++;
+
+    if (!action->event_trigger().empty()) {
+        event_trigger_index_[action->event_trigger()].emplace_back(action);
+        return;
+    }
+    property_actions_.emplace_back(action);
+    if (action->property_triggers().empty()) {
+        untriggered_actions_.emplace_back(action);
+    }
+    for (const auto& [name, value] : action->property_triggers()) {
+        property_trigger_index_[name].emplace_back(action);
+    }
+}
+
+void ActionManager::RemoveFromIndex(const Action* action) {
+    auto erase_from = [action](std::vector<const Action*>* actions) {
+        actions->erase(std::remove(actions->begin(), actions->end(), action), actions->end());
+    };
+    auto erase_from_index = [&](std::map<std::string, std::vector<const Action*>>* index,
+                                const std::string& key) {
+        auto it = index->find(key);
+        if (it == index->end()) return;
+        erase_from(&it->second);
+        if (it->second.empty()) index->erase(it);
+    };
+
+    if (!action->event_trigger().empty()) {
+        erase_from_index(&event_trigger_index_, action->event_trigger());
+    } else {
+        erase_from(&property_actions_);
+        erase_from(&untriggered_actions_);
+        for (const auto& [name, value] : action->property_triggers()) {
+            erase_from_index(&property_trigger_index_, name);
+        }
+    }
+    action_order_.erase(action);
+}
+
+void ActionManager::QueueMatchingActions(const EventTrigger& trigger) {
+    auto it = event_trigger_index_.find(trigger);
+    if (it == event_trigger_index_.end()) return;
+    for (const auto& action : it->second) {
+        if (action->CheckEvent(trigger)) {
+            current_executing_actions_.emplace(action);
+        }
+    }
+}
+
+void ActionManager::QueueMatchingActions(const PropertyChange& property_change) {
+    const auto& name = property_change.first;
+    std::vector<const Action*> merged;
+    const std::vector<const Action*>* candidates = &merged;
+    if (name.empty()) {
+        candidates = &property_actions_;
+    } else if (auto it = property_trigger_index_.find(name); it != property_trigger_index_.end()) {
+        if (untriggered_actions_.empty()) {
+            candidates = &it->second;
+        } else {
+            std::merge(it->second.begin(), it->second.end(), untriggered_actions_.begin(),
+                       untriggered_actions_.end(), std::back_inserter(merged),
+                       [this](const Action* a, const Action* b) {
+                           return action_order_[a] < action_order_[b];
+                       });
+        }
+    } else {
+        candidates = &untriggered_actions_;
+    }
+
+    for (const auto& action : *candidates) {
+        if (action->CheckEvent(property_change)) {
+            current_executing_actions_.emplace(action);
+        }
+    }
+}
+
+void ActionManager::QueueMatchingActions(const BuiltinAction& builtin_action) {
+    // Builtin actions are added to |actions_| when they are queued, and only
+    // removed once they have run.
+    current_executing_actions_.emplace(builtin_action);
+}
+
 void ActionManager::QueueEventTrigger(const std::string& trigger) {
     auto lock = std::lock_guard{event_queue_lock_};
     event_queue_.emplace(trigger);
@@ -61,6 +148,7 @@ void ActionManager::QueueBuiltinAction(BuiltinFunction func, const std::string&
     action->AddCommand(std::move(func), {name}, 0);
 
     event_queue_.emplace(action.get());
+    AddToIndex(action.get());
     actions_.emplace_back(std::move(action));
 }
 
@@ -69,12 +157,8 @@ void ActionManager::ExecuteOneCommand() {
         auto lock = std::lock_guard{event_queue_lock_};
         // Loop through the event queue until we have an action to execute
         while (current_executing_actions_.empty() && !event_queue_.empty()) {
-            for (const auto& action : actions_) {
-                if (std::visit([&action](const auto& event) { return action->CheckEvent(event); },
-                               event_queue_.front())) {
-                    current_executing_actions_.emplace(action.get());
-                }
-            }
+            std::visit([this](const auto& event) { QueueMatchingActions(event); },
+                       event_queue_.front());
             event_queue_.pop();
         }
     }
@@ -91,16 +175,16 @@ void ActionManager::ExecuteOneCommand() {
                   << ":" << action->line() << ")";
     }
 
-    action->ExecuteOneCommand(current_command_);
+    current_command_ += action->ExecuteCommandBatch(current_command_);
 
     // If this was the last command in the current action, then remove
     // the action from the executing list.
     // If this action was oneshot, then also remove it from actions_.
-    ++current_command_;
-    if (current_command_ == action->NumCommands()) {
+    if (current_command_ >= action->NumCommands()) {
         current_executing_actions_.pop();
         current_command_ = 0;
         if (action->oneshot()) {
+            RemoveFromIndex(action);
             auto eraser = [&action](std::unique_ptr<Action>& a) { return a.get() == action; };
             actions_.erase(std::remove_if(actions_.begin(), actions_.end(), eraser),
                            actions_.end());
@@ -16,8 +16,10 @@
 
 #pragma once
 
+#include <map>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/thread_annotations.h>
@@ -50,7 +52,26 @@ class ActionManager {
     ActionManager(ActionManager const&) = delete;
     void operator=(ActionManager const&) = delete;
 
+    void AddToIndex(const Action* action);
+    void RemoveFromIndex(const Action* action);
+    void QueueMatchingActions(const EventTrigger& trigger);
+    void QueueMatchingActions(const PropertyChange& property_change);
+    void QueueMatchingActions(const BuiltinAction& builtin_action);
+
     std::vector<std::unique_ptr<Action>> actions_;
+    // Each action in |actions_|, indexed by the events that it can match, so
+    // that an event only needs to be checked against its candidates. Every
+    // list is in the same order as |actions_|, which is the order in which
+    // matching actions run.
+    std::map<std::string, std::vector<const Action*>> event_trigger_index_;
+    std::map<std::string, std::vector<const Action*>> property_trigger_index_;
+    // Actions without an event trigger, which all match QueueAllPropertyActions().
+    std::vector<const Action*> property_actions_;
+    // Actions without any trigger, which match every property change.
+    std::vector<const Action*> untriggered_actions_;
+    // Position of each action in |actions_|, used to merge candidate lists.
+    std::unordered_map<const Action*, size_t> action_order_;
+    size_t next_action_order_ = 0;
     std::queue<std::variant<EventTrigger, PropertyChange, BuiltinAction>> event_queue_
             GUARDED_BY(event_queue_lock_);
     mutable std::mutex event_queue_lock_;
@@ -30,16 +30,20 @@
 #include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <unordered_map>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
 
 using android::base::StringPrintf;
 using android::base::boot_clock;
+using android::base::unique_fd;
 using namespace std::chrono_literals;
 
 namespace android {
@@ -103,37 +107,88 @@ static void log_file(FILE* log, const char* procfile) {
   }
 }
 
-static void log_processes(FILE* log) {
+struct CachedCmdline {
+  // The "<pid> (<comm>)" prefix of /proc/<pid>/stat followed by the process start time; if
+  // either changes, the pid was reused or the process exec()ed or renamed itself.
+  std::string identity;
+  std::string cmdline;
+};
+
+// Maps pids to their cmdline, so that it isn't read again at each sample.
+using CmdlineCache = std::unordered_map<int, CachedCmdline>;
+
+static bool read_proc_file(int proc_fd, const std::string& path, std::string* content) {
+  unique_fd fd(openat(proc_fd, path.c_str(), O_RDONLY | O_CLOEXEC));
+  return fd != -1 && android::base::ReadFdToString(fd, content);
+}
+
+static std::string get_stat_identity(const std::string& stat, size_t close) {
+  // The start time is the 22nd field, and the fields after the comm start at the 3rd.
+  size_t start = close + 1;
+  for (int field = 3; field < 22 && start != std::string::npos; ++field) {
+    start = stat.find(' ', start + 1);
+  }
+  if (start == std::string::npos) return stat.substr(0, close + 1);
+  return stat.substr(0, close + 1) + stat.substr(start, stat.find(' ', start + 1) - start);
+}
+
+static void log_processes(FILE* log, int proc_fd, CmdlineCache* cache) {
   log_uptime(log);
 
-  std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir("/proc"), closedir);
+  unique_fd dir_fd(dup(proc_fd));
+  std::unique_ptr<DIR, int(*)(DIR*)> dir(dir_fd != -1 ? fdopendir(dir_fd.get()) : nullptr,
+                                         closedir);
+  if (!dir) {
+    PLOG(ERROR) << "bootchart: failed to open /proc";
+    return;
+  }
+  dir_fd.release();
+  // A dup()ed fd shares the directory offset with the original.
+  rewinddir(dir.get());
+
+  CmdlineCache seen;
   struct dirent* entry;
   while ((entry = readdir(dir.get())) != NULL) {
     // Only match numeric values.
     int pid = atoi(entry->d_name);
     if (pid == 0) continue;
 
-    // /proc/<pid>/stat only has truncated task names, so get the full
-    // name from /proc/<pid>/cmdline.
-    std::string cmdline;
-    android::base::ReadFileToString(StringPrintf("/proc/%d/cmdline", pid), &cmdline);
-    const char* full_name = cmdline.c_str(); // So we stop at the first NUL.
-
     // Read process stat line.
     std::string stat;
-    if (android::base::ReadFileToString(StringPrintf("/proc/%d/stat", pid), &stat)) {
-      if (!cmdline.empty()) {
-        // Substitute the process name with its real name.
-        size_t open = stat.find('(');
-        size_t close = stat.find_last_of(')');
-        if (open != std::string::npos && close != std::string::npos) {
-          stat.replace(open + 1, close - open - 1, full_name);
-        }
-      }
+    if (!read_proc_file(proc_fd, StringPrintf("%d/stat", pid), &stat)) continue;
+
+    size_t open = stat.find('(');
+    size_t close = stat.find_last_of(')');
+    if (open == std::string::npos || close == std::string::npos) {
       fputs(stat.c_str(), log);
+      continue;
+    }
+
+    // /proc/<pid>/stat only has truncated task names, so get the full
+    // name from /proc/<pid>/cmdline.
+    std::string identity = get_stat_identity(stat, close);
+    auto it = cache->find(pid);
+    if (it == cache->end() || it->second.identity != identity) {
+      std::string cmdline;
+      read_proc_file(proc_fd, StringPrintf("%d/cmdline", pid), &cmdline);
+      // So we stop at the first NUL.
+      cmdline.resize(strlen(cmdline.c_str()));
+      it = cache->insert_or_assign(pid, CachedCmdline{std::move(identity), std::move(cmdline)})
+                   .first;
     }
+    const std::string& full_name = it->second.cmdline;
+
+    if (!full_name.empty()) {
+      // Substitute the process name with its real name.
+      stat.replace(open + 1, close - open - 1, full_name);
+    }
+    fputs(stat.c_str(), log);
+    seen.insert(cache->extract(it));
   }
 
+  // Forget processes that have exited.
+  cache->swap(seen);
+
   fputc('\n', log);
 }
 
@@ -164,6 +219,14 @@ static void bootchart_thread_main() {
 
   log_header();
 
+  // Keep /proc open rather than resolving it at each sample.
+  unique_fd proc_fd(open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  if (proc_fd == -1) {
+    PLOG(ERROR) << "bootchart: failed to open /proc";
+    return;
+  }
+  CmdlineCache cmdline_cache;
+
   while (true) {
     {
       std::unique_lock<std::mutex> lock(g_bootcharting_finished_mutex);
@@ -173,7 +236,7 @@ static void bootchart_thread_main() {
 
     log_file(&*stat_log, "/proc/stat");
     log_file(&*disk_log, "/proc/diskstats");
-    log_processes(&*proc_log);
+    log_processes(&*proc_log, proc_fd.get(), &cmdline_cache);
   }
 
   LOG(INFO) << "Bootcharting finished";
@@ -1074,6 +1074,103 @@ static Result<void> do_restorecon_recursive(const BuiltinArguments& args) {
     return do_restorecon({std::move(non_const_args), args.context});
 }
 
+static constexpr size_t kRestoreconAsyncWorkers = 4;
+
+// Restores |path| and, if it is a directory, the trees below it, split by top-level entry across
+// kRestoreconAsyncWorkers processes. Returns false if any part of it failed.
+static bool RestoreconInParallel(const std::string& path, int flag) {
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) == -1 || !S_ISDIR(sb.st_mode)) {
+        return selinux_android_restorecon(path.c_str(), flag) == 0;
+    }
+
+    std::vector<std::string> entries;
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(path.c_str()), closedir);
+    if (!dir) {
+        return selinux_android_restorecon(path.c_str(), flag) == 0;
+    }
+    while (dirent* entry = readdir(dir.get())) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        entries.emplace_back(path + "/" + entry->d_name);
+    }
+    dir.reset();
+
+    auto restore_entries = [&](size_t worker) {
+        bool success = true;
+        for (size_t i = worker; i < entries.size(); i += kRestoreconAsyncWorkers) {
+            // Like a single recursive restorecon, don't descend into other filesystems unless
+            // asked to.
+            int entry_flag = flag;
+            struct stat entry_sb;
+            if (!(flag & SELINUX_ANDROID_RESTORECON_CROSS_FILESYSTEMS) &&
+                lstat(entries[i].c_str(), &entry_sb) == 0 && entry_sb.st_dev != sb.st_dev) {
+                entry_flag &= ~SELINUX_ANDROID_RESTORECON_RECURSE;
+            }
+            if (selinux_android_restorecon(entries[i].c_str(), entry_flag) != 0) {
+                success = false;
+            }
+        }
+        return success;
+    };
+
+    bool success = selinux_android_restorecon(path.c_str(),
+                                              flag & ~SELINUX_ANDROID_RESTORECON_RECURSE) == 0;
+    std::vector<pid_t> workers;
+    for (size_t worker = 0; worker < kRestoreconAsyncWorkers && worker < entries.size();
+         ++worker) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            _exit(restore_entries(worker) ? EXIT_SUCCESS : EXIT_FAILURE);
+        } else if (pid < 0) {
+            // Do this share here instead.
+            PLOG(WARNING) << "Fork failed";
+            success = restore_entries(worker) && success;
+        } else {
+            workers.emplace_back(pid);
+        }
+    }
+
+    for (pid_t pid : workers) {
+        int status;
+        if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) != pid || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != EXIT_SUCCESS) {
+            success = false;
+        }
+    }
+    return success;
+}
+
+// Like restorecon_recursive, but runs in the background so that init can carry on with the
+// following commands, and sets restorecon.done to each path once it has been restored.
+static Result<void> do_restorecon_recursive_async(const BuiltinArguments& args) {
+    std::vector<std::string> non_const_args(args.args);
+    non_const_args.insert(std::next(non_const_args.begin()), "--recursive");
+    auto restorecon_info = ParseRestorecon(non_const_args);
+    if (!restorecon_info.ok()) {
+        return restorecon_info.error();
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        const auto& [flag, paths] = *restorecon_info;
+        android::base::Timer t;
+        int ret = EXIT_SUCCESS;
+        for (const auto& path : paths) {
+            if (!RestoreconInParallel(path, flag)) {
+                LOG(ERROR) << "restorecon_recursive_async of " << path << " failed";
+                ret = EXIT_FAILURE;
+            }
+            SetProperty("restorecon.done", path);
+        }
+        LOG(INFO) << "restorecon_recursive_async of " << android::base::Join(paths, ' ')
+                  << " took " << t;
+        _exit(ret);
+    } else if (pid < 0) {
+        return ErrnoError() << "Fork failed";
+    }
+    return {};
+}
+
 static Result<void> do_loglevel(const BuiltinArguments& args) {
     // TODO: support names instead/as well?
     int log_level = -1;
@@ -1308,10 +1405,10 @@ static Result<void> parse_apex_configs() {
 
     int active_sdk = android::base::GetIntProperty("ro.build.version.sdk", INT_MAX);
 
-    bool success = true;
-    for (const auto& c : parser.FilterVersionedConfigs(configs, active_sdk)) {
-        success &= parser.ParseConfigFile(c);
-    }
+    // APEX configs are only parsed once the APEXes are activated, which is on the critical path
+    // of boot, so read and tokenize them in parallel, as the other configs are.
+    parser.set_parallel(true);
+    bool success = parser.ParseConfigFiles(parser.FilterVersionedConfigs(configs, active_sdk));
     ServiceList::GetInstance().MarkServicesUpdate();
     if (success) {
         return {};
@@ -1423,6 +1520,7 @@ const BuiltinFunctionMap& GetBuiltinFunctionMap() {
         {"restart",                 {1,     2,    {false,  do_restart}}},
         {"restorecon",              {1,     kMax, {true,   do_restorecon}}},
         {"restorecon_recursive",    {1,     kMax, {true,   do_restorecon_recursive}}},
+        {"restorecon_recursive_async", {1,     kMax, {true,   do_restorecon_recursive_async}}},
         {"rm",                      {1,     1,    {true,   do_rm}}},
         {"rmdir",                   {1,     1,    {true,   do_rmdir}}},
         {"setprop",                 {2,     2,    {true,   do_setprop}}},
@@ -154,6 +154,10 @@ Result<void> check_restorecon_recursive(const BuiltinArguments& args) {
     return check_restorecon(std::move(args));
 }
 
+Result<void> check_restorecon_recursive_async(const BuiltinArguments& args) {
+    return check_restorecon(std::move(args));
+}
+
 Result<void> check_setprop(const BuiltinArguments& args) {
     const std::string& name = args[1];
     if (name.empty()) {
@@ -162,6 +162,39 @@ bool Permissions::Match(const std::string& path) const {
     return path == name_;
 }
 
+std::string_view Permissions::LiteralPrefix() const {
+    std::string_view name = name_;
+    if (wildcard_) name = name.substr(0, name.find_first_of("*?[\\"));
+    return name;
+}
+
+void PermissionsIndex::Insert(std::string_view prefix, size_t index) {
+    size_t node = 0;
+    for (char c : prefix) {
+        auto it = nodes_[node].children.find(c);
+        if (it == nodes_[node].children.end()) {
+            it = nodes_[node].children.emplace(c, nodes_.size()).first;
+            nodes_.emplace_back();
+        }
+        node = it->second;
+    }
+    nodes_[node].entries.emplace_back(index);
+}
+
+void PermissionsIndex::FindCandidates(const std::string& path,
+                                      std::vector<size_t>* candidates) const {
+    size_t node = 0;
+    for (size_t i = 0;; ++i) {
+        const auto& entries = nodes_[node].entries;
+        candidates->insert(candidates->end(), entries.begin(), entries.end());
+        if (i == path.size()) break;
+
+        auto it = nodes_[node].children.find(path[i]);
+        if (it == nodes_[node].children.end()) break;
+        node = it->second;
+    }
+}
+
 bool SysfsPermissions::MatchWithSubsystem(const std::string& path,
                                           const std::string& subsystem) const {
     std::string path_basename = Basename(path);
@@ -256,7 +289,20 @@ void DeviceHandler::FixupSysPermissions(const std::string& upath,
     // contain, so we prepend it...
     std::string path = "/sys" + upath;
 
-    for (const auto& s : sysfs_permissions_) {
+    // MatchWithSubsystem() may also match the /sys/class and /sys/bus paths for the device, so
+    // collect candidates for those too, then apply them in the order they were listed.
+    std::vector<size_t> candidates;
+    std::string path_basename = Basename(path);
+    sysfs_permissions_index_.FindCandidates(path, &candidates);
+    sysfs_permissions_index_.FindCandidates("/sys/class/" + subsystem + "/" + path_basename,
+                                            &candidates);
+    sysfs_permissions_index_.FindCandidates(
+            "/sys/bus/" + subsystem + "/devices/" + path_basename, &candidates);
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    for (size_t i : candidates) {
+        const auto& s = sysfs_permissions_[i];
         if (s.MatchWithSubsystem(path, subsystem)) s.SetPermissions(path);
     }
 
@@ -270,11 +316,20 @@ void DeviceHandler::FixupSysPermissions(const std::string& upath,
 
 std::tuple<mode_t, uid_t, gid_t> DeviceHandler::GetDevicePermissions(
     const std::string& path, const std::vector<std::string>& links) const {
+    std::vector<size_t> candidates;
+    dev_permissions_index_.FindCandidates(path, &candidates);
+    for (const auto& link : links) {
+        dev_permissions_index_.FindCandidates(link, &candidates);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
     // Search the perms list in reverse so that ueventd.$hardware can override ueventd.rc.
-    for (auto it = dev_permissions_.crbegin(); it != dev_permissions_.crend(); ++it) {
-        if (it->Match(path) || std::any_of(links.cbegin(), links.cend(),
-                                           [it](const auto& link) { return it->Match(link); })) {
-            return {it->perm(), it->uid(), it->gid()};
+    for (auto it = candidates.crbegin(); it != candidates.crend(); ++it) {
+        const auto& permissions = dev_permissions_[*it];
+        if (permissions.Match(path) ||
+            std::any_of(links.cbegin(), links.cend(),
+                        [&permissions](const auto& link) { return permissions.Match(link); })) {
+            return {permissions.perm(), permissions.uid(), permissions.gid()};
         }
     }
     /* Default if nothing found. */
@@ -578,6 +633,8 @@ DeviceHandler::DeviceHandler(std::vector<Permissions> dev_permissions,
                              bool skip_restorecon)
     : dev_permissions_(std::move(dev_permissions)),
       sysfs_permissions_(std::move(sysfs_permissions)),
+      dev_permissions_index_(dev_permissions_),
+      sysfs_permissions_index_(sysfs_permissions_),
       subsystems_(std::move(subsystems)),
       boot_devices_(std::move(boot_devices)),
       skip_restorecon_(skip_restorecon),
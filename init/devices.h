@@ -21,8 +21,10 @@
 #include <sys/types.h>
 
 #include <algorithm>
+#include <map>
 #include <set>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <android-base/file.h>
@@ -42,6 +44,9 @@ class Permissions {
 
     bool Match(const std::string& path) const;
 
+    // Returns the part of 'name' that any path matching it must start with.
+    std::string_view LiteralPrefix() const;
+
     mode_t perm() const { return perm_; }
     uid_t uid() const { return uid_; }
     gid_t gid() const { return gid_; }
@@ -74,6 +79,33 @@ class SysfsPermissions : public Permissions {
     const std::string attribute_;
 };
 
+// Indexes a list of permissions by their literal prefixes, so that finding the entries that may
+// match a path is a single walk down a trie rather than a Match() call for every entry.
+// Candidates still need to be checked with Match() or MatchWithSubsystem().
+class PermissionsIndex {
+  public:
+    PermissionsIndex() : nodes_(1) {}
+    template <typename T>
+    explicit PermissionsIndex(const std::vector<T>& permissions) : PermissionsIndex() {
+        for (size_t i = 0; i < permissions.size(); ++i) {
+            Insert(permissions[i].LiteralPrefix(), i);
+        }
+    }
+
+    // Appends the indices of the entries whose literal prefix is a prefix of 'path'.
+    void FindCandidates(const std::string& path, std::vector<size_t>* candidates) const;
+
+  private:
+    struct Node {
+        std::map<char, size_t> children;
+        std::vector<size_t> entries;
+    };
+
+    void Insert(std::string_view prefix, size_t index);
+
+    std::vector<Node> nodes_;
+};
+
 class Subsystem {
   public:
     friend class SubsystemParser;
@@ -141,6 +173,8 @@ class DeviceHandler : public UeventHandler {
 
     std::vector<Permissions> dev_permissions_;
     std::vector<SysfsPermissions> sysfs_permissions_;
+    PermissionsIndex dev_permissions_index_;
+    PermissionsIndex sysfs_permissions_index_;
     std::vector<Subsystem> subsystems_;
     std::set<std::string> boot_devices_;
     bool skip_restorecon_;
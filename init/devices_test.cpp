@@ -328,5 +328,40 @@ TEST(device_handler, SysfsPermissionsMatchWithSubsystemBus) {
     EXPECT_EQ(1001U, permissions.gid());
 }
 
+TEST(device_handler, PermissionsIndexFindCandidates) {
+    std::vector<Permissions> permissions = {
+            {"/dev/null", 0666, 0, 0, false},
+            {"/dev/dri/*", 0666, 0, 1000, false},
+            {"/dev/device*name", 0666, 0, 1000, false},
+            {"/dev/*", 0600, 0, 0, false},
+            {"/dev/null", 0660, 0, 1000, false},
+            {"/dev/dev?ce*name", 0600, 0, 0, false},
+    };
+    PermissionsIndex index(permissions);
+
+    auto find = [&index](const std::string& path) {
+        std::vector<size_t> candidates;
+        index.FindCandidates(path, &candidates);
+        std::sort(candidates.begin(), candidates.end());
+        return candidates;
+    };
+    EXPECT_EQ((std::vector<size_t>{0, 3, 4}), find("/dev/null"));
+    EXPECT_EQ((std::vector<size_t>{1, 3}), find("/dev/dri/card0"));
+    EXPECT_EQ((std::vector<size_t>{2, 3, 5}), find("/dev/device0name"));
+    EXPECT_EQ((std::vector<size_t>{3}), find("/dev/nul"));
+    EXPECT_EQ((std::vector<size_t>{}), find("/sys/devices"));
+
+    // Every entry that matches a path must be among its candidates.
+    for (const auto& path : {"/dev/null", "/dev/dri/card0", "/dev/device0name", "/dev/deviceX"}) {
+        auto candidates = find(path);
+        for (size_t i = 0; i < permissions.size(); ++i) {
+            if (permissions[i].Match(path)) {
+                EXPECT_NE(candidates.end(), std::find(candidates.begin(), candidates.end(), i))
+                        << path << " " << i;
+            }
+        }
+    }
+}
+
 }  // namespace init
 }  // namespace android
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <sys/epoll.h>
 
+#include <algorithm>
 #include <chrono>
 #include <functional>
 #include <map>
@@ -40,13 +41,14 @@ Result<void> Epoll::Open() {
     return {};
 }
 
-Result<void> Epoll::RegisterHandler(int fd, Handler handler, uint32_t events) {
+Result<void> Epoll::RegisterHandler(int fd, Handler handler, uint32_t events, Priority priority) {
     if (!events) {
         return Error() << "Must specify events";
     }
 
     Info info;
     info.events = events;
+    info.priority = priority;
     info.handler = std::make_shared<decltype(handler)>(std::move(handler));
     auto [it, inserted] = epoll_handlers_.emplace(fd, std::move(info));
     if (!inserted) {
@@ -87,6 +89,10 @@ Result<std::vector<std::shared_ptr<Epoll::Handler>>> Epoll::Wait(
     if (num_events == -1) {
         return ErrnoError() << "epoll_wait failed";
     }
+    std::stable_sort(ev, ev + num_events, [](const epoll_event& a, const epoll_event& b) {
+        return reinterpret_cast<Info*>(a.data.ptr)->priority <
+               reinterpret_cast<Info*>(b.data.ptr)->priority;
+    });
     std::vector<std::shared_ptr<Handler>> pending_functions;
     for (int i = 0; i < num_events; ++i) {
         auto& info = *reinterpret_cast<Info*>(ev[i].data.ptr);
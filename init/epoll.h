@@ -39,8 +39,16 @@ class Epoll {
 
     typedef std::function<void()> Handler;
 
+    // When several fds are ready at once, Wait() returns the handlers of higher priority first.
+    enum class Priority {
+        kHigh,
+        kNormal,
+        kLow,
+    };
+
     Result<void> Open();
-    Result<void> RegisterHandler(int fd, Handler handler, uint32_t events = EPOLLIN);
+    Result<void> RegisterHandler(int fd, Handler handler, uint32_t events = EPOLLIN,
+                                 Priority priority = Priority::kNormal);
     Result<void> UnregisterHandler(int fd);
     Result<std::vector<std::shared_ptr<Handler>>> Wait(
             std::optional<std::chrono::milliseconds> timeout);
@@ -49,6 +57,7 @@ class Epoll {
     struct Info {
         std::shared_ptr<Handler> handler;
         uint32_t events;
+        Priority priority;
     };
 
     android::base::unique_fd epoll_fd_;
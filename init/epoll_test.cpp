@@ -72,5 +72,37 @@ TEST(epoll, UnregisterHandler) {
     ASSERT_TRUE(handler_invoked);
 }
 
+TEST(epoll, Priority) {
+    Epoll epoll;
+    ASSERT_RESULT_OK(epoll.Open());
+
+    std::vector<Epoll::Priority> priorities = {Epoll::Priority::kLow, Epoll::Priority::kNormal,
+                                               Epoll::Priority::kHigh};
+    std::vector<android::base::unique_fd> fds;
+    std::vector<Epoll::Priority> invoked;
+    for (auto priority : priorities) {
+        int pipe_fds[2];
+        ASSERT_EQ(pipe(pipe_fds), 0);
+        fds.emplace_back(pipe_fds[0]);
+        fds.emplace_back(pipe_fds[1]);
+
+        auto handler = [&invoked, priority]() { invoked.emplace_back(priority); };
+        ASSERT_RESULT_OK(epoll.RegisterHandler(pipe_fds[0], handler, EPOLLIN, priority));
+
+        uint8_t byte = 0xee;
+        ASSERT_TRUE(android::base::WriteFully(pipe_fds[1], &byte, sizeof(byte)));
+    }
+
+    auto results = epoll.Wait({});
+    ASSERT_RESULT_OK(results);
+    ASSERT_EQ(results->size(), priorities.size());
+    for (const auto& function : *results) {
+        (*function)();
+    }
+    EXPECT_EQ(invoked, (std::vector<Epoll::Priority>{Epoll::Priority::kHigh,
+                                                      Epoll::Priority::kNormal,
+                                                      Epoll::Priority::kLow}));
+}
+
 }  // namespace init
 }  // namespace android
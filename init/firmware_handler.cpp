@@ -67,14 +67,25 @@ static void LoadFirmware(const std::string& firmware, const std::string& root, i
     // Start transfer.
     WriteFully(loading_fd, "1", 1);
 
-    // Copy the firmware.
-    int rc = sendfile(data_fd, fw_fd, nullptr, fw_size);
-    if (rc == -1) {
-        PLOG(ERROR) << "firmware: sendfile failed { '" << root << "', '" << firmware << "' }";
+    // Copy the firmware. sendfile() may copy less than asked for, notably for blobs larger than
+    // the 0x7ffff000 bytes it handles per call, so keep going until all of it is in.
+    bool copied = true;
+    size_t offset = 0;
+    while (offset < fw_size) {
+        ssize_t rc = sendfile(data_fd, fw_fd, nullptr, fw_size - offset);
+        if (rc == -1 && errno == EINTR) continue;
+        if (rc <= 0) {
+            if (rc == 0) errno = EIO;
+            PLOG(ERROR) << "firmware: sendfile failed after " << offset << " of " << fw_size
+                        << " bytes { '" << root << "', '" << firmware << "' }";
+            copied = false;
+            break;
+        }
+        offset += rc;
     }
 
     // Tell the firmware whether to abort or commit.
-    const char* response = (rc != -1) ? "0" : "-1";
+    const char* response = copied ? "0" : "-1";
     WriteFully(loading_fd, response, strlen(response));
 }
 
@@ -27,6 +27,7 @@
 #include <sys/utsname.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <string>
@@ -35,6 +36,7 @@
 #include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <cutils/boot_events.h>
 #include <modprobe/modprobe.h>
 #include <private/android_filesystem_config.h>
 
@@ -156,6 +158,20 @@ std::string GetModuleLoadList(bool recovery, const std::string& dir_path) {
     return module_load_file;
 }
 
+// Logs the modules that took longest to load in parallel, as they hold up the
+// modules that depend on them.
+static void LogSlowestModules(
+        std::vector<std::pair<std::string, std::chrono::milliseconds>> load_times) {
+    constexpr size_t kSlowestModules = 10;
+    auto count = std::min(load_times.size(), kSlowestModules);
+    std::partial_sort(load_times.begin(), load_times.begin() + count, load_times.end(),
+                      [](const auto& a, const auto& b) { return a.second > b.second; });
+    for (size_t i = 0; i < count; i++) {
+        LOG(INFO) << "Loading module " << load_times[i].first << " took "
+                  << load_times[i].second.count() << " ms";
+    }
+}
+
 #define MODULE_BASE_DIR "/lib/modules"
 bool LoadKernelModules(bool recovery, bool want_console, bool want_parallel, int& modules_loaded) {
     struct utsname uts;
@@ -208,6 +224,7 @@ bool LoadKernelModules(bool recovery, bool want_console, bool want_parallel, int
     Modprobe m({MODULE_BASE_DIR}, GetModuleLoadList(recovery, MODULE_BASE_DIR));
     bool retval = (want_parallel) ? m.LoadModulesParallel(std::thread::hardware_concurrency())
                                   : m.LoadListedModules(!want_console);
+    if (want_parallel) LogSlowestModules(m.GetModuleLoadTimes());
     modules_loaded = m.GetModuleCount();
     if (modules_loaded > 0) {
         return retval;
@@ -234,6 +251,10 @@ int FirstStageMain(int argc, char** argv) {
     // Get the basic filesystem setup we need put together in the initramdisk
     // on / and then we'll let the rc file figure out the rest.
     CHECKCALL(mount("tmpfs", "/dev", "tmpfs", MS_NOSUID, "mode=0755"));
+    // Losing the boot timeline isn't worth failing boot over.
+    boot_events_create(BOOT_EVENTS_FILE);
+    boot_event_record_at(BOOT_EVENT_BEGIN, "init", "first_stage",
+                         start_time.time_since_epoch().count());
     CHECKCALL(mkdir("/dev/pts", 0755));
     CHECKCALL(mkdir("/dev/socket", 0755));
     CHECKCALL(mkdir("/dev/dm-user", 0755));
@@ -325,6 +346,7 @@ int FirstStageMain(int argc, char** argv) {
 
     boot_clock::time_point module_start_time = boot_clock::now();
     int module_count = 0;
+    boot_event_begin("init", "load_modules");
     if (!LoadKernelModules(IsRecoveryMode() && !ForceNormalBoot(cmdline, bootconfig), want_console,
                            want_parallel, module_count)) {
         if (want_console != FirstStageConsoleParam::DISABLED) {
@@ -333,6 +355,7 @@ int FirstStageMain(int argc, char** argv) {
             LOG(FATAL) << "Failed to load kernel modules";
         }
     }
+    boot_event_end("init", "load_modules");
     if (module_count > 0) {
         auto module_elapse_time = std::chrono::duration_cast<std::chrono::milliseconds>(
                 boot_clock::now() - module_start_time);
@@ -397,9 +420,11 @@ int FirstStageMain(int argc, char** argv) {
         SwitchRoot("/first_stage_ramdisk");
     }
 
+    boot_event_begin("init", "first_stage_mount");
     if (!DoFirstStageMount(!created_devices)) {
         LOG(FATAL) << "Failed to mount required partitions early ...";
     }
+    boot_event_end("init", "first_stage_mount");
 
     struct stat new_root_info;
     if (stat("/", &new_root_info) != 0) {
@@ -422,6 +447,7 @@ int FirstStageMain(int argc, char** argv) {
     dup2(fd, STDOUT_FILENO);
     dup2(fd, STDERR_FILENO);
     close(fd);
+    boot_event_end("init", "first_stage");
     execv(path, const_cast<char**>(args));
 
     // execv() only returns if an error happened, in which case we
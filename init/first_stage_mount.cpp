@@ -21,11 +21,15 @@
 #include <unistd.h>
 
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/chrono_utils.h>
@@ -93,6 +97,15 @@ class FirstStageMount {
     bool CreateSnapshotPartitions(android::snapshot::SnapshotManager* sm);
     bool MountPartition(const Fstab::iterator& begin, bool erase_same_mounts,
                         Fstab::iterator* end = nullptr);
+    // The two halves of MountPartition(). PreparePartition() creates the
+    // block device nodes and sets up dm-verity, and must run on the main
+    // thread; MountPreparedPartition() only mounts.
+    bool PreparePartition(const Fstab::iterator& begin);
+    bool MountPreparedPartition(const Fstab::iterator& begin, bool erase_same_mounts,
+                                Fstab::iterator* end = nullptr);
+    // Logs a failure to mount |entry|, and returns true if it must abort
+    // first-stage mount.
+    bool IsMountFailureFatal(const FstabEntry& entry);
 
     bool MountPartitions();
     bool TrySwitchSystemAsRoot();
@@ -407,10 +420,13 @@ bool FirstStageMount::MountPartition(const Fstab::iterator& begin, bool erase_sa
         *end = begin + 1;
     }
 
-    if (!fs_mgr_create_canonical_mount_point(begin->mount_point)) {
+    if (!PreparePartition(begin)) {
         return false;
     }
+    return MountPreparedPartition(begin, erase_same_mounts, end);
+}
 
+bool FirstStageMount::PreparePartition(const Fstab::iterator& begin) {
     if (begin->fs_mgr_flags.logical) {
         if (!fs_mgr_update_logical_partition(&(*begin))) {
             return false;
@@ -423,6 +439,20 @@ bool FirstStageMount::MountPartition(const Fstab::iterator& begin, bool erase_sa
         PLOG(ERROR) << "Failed to setup verity for '" << begin->mount_point << "'";
         return false;
     }
+    return true;
+}
+
+bool FirstStageMount::MountPreparedPartition(const Fstab::iterator& begin, bool erase_same_mounts,
+                                             Fstab::iterator* end) {
+    if (end) {
+        *end = begin + 1;
+    }
+
+    // Created here rather than in PreparePartition(), since the parent of a
+    // nested mount point may not be mounted until now.
+    if (!fs_mgr_create_canonical_mount_point(begin->mount_point)) {
+        return false;
+    }
 
     bool mounted = (fs_mgr_do_mount_one(*begin) == 0);
 
@@ -521,11 +551,58 @@ bool FirstStageMount::TrySwitchSystemAsRoot() {
     return true;
 }
 
+bool FirstStageMount::IsMountFailureFatal(const FstabEntry& entry) {
+    if (entry.fs_mgr_flags.no_fail) {
+        LOG(INFO) << "Failed to mount " << entry.mount_point
+                  << ", ignoring mount for no_fail partition";
+        return false;
+    }
+    if (entry.fs_mgr_flags.formattable) {
+        LOG(INFO) << "Failed to mount " << entry.mount_point
+                  << ", ignoring mount for formattable partition";
+        return false;
+    }
+    PLOG(ERROR) << "Failed to mount " << entry.mount_point;
+    return true;
+}
+
 bool FirstStageMount::MountPartitions() {
     if (!TrySwitchSystemAsRoot()) return false;
 
     if (!SkipMountingPartitions(&fstab_, true /* verbose */)) return false;
 
+    // Partitions are set up and mounted as a two-stage pipeline: while one
+    // partition is being mounted on |mounter|, the device-mapper and verity
+    // devices of the next ones are created here. Mounts still happen one at a
+    // time and in fstab order, so nested mount points keep working. Creating
+    // device nodes stays on this thread, since BlockDevInitializer is not
+    // thread-safe.
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<Fstab::iterator> prepared;
+    bool prepare_done = false;
+    bool mount_failed = false;
+
+    std::thread mounter([&]() -> void {
+        while (true) {
+            Fstab::iterator current;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                cv.wait(guard, [&]() -> bool { return !prepared.empty() || prepare_done; });
+                if (prepared.empty()) return;
+                current = prepared.front();
+                prepared.pop_front();
+            }
+            if (!MountPreparedPartition(current, false /* erase_same_mounts */) &&
+                IsMountFailureFatal(*current)) {
+                std::lock_guard<std::mutex> guard(lock);
+                mount_failed = true;
+                return;
+            }
+        }
+    });
+
+    bool ok = true;
     for (auto current = fstab_.begin(); current != fstab_.end();) {
         // We've already mounted /system above.
         if (current->mount_point == "/system") {
@@ -547,22 +624,39 @@ bool FirstStageMount::MountPartitions() {
             continue;
         }
 
-        Fstab::iterator end;
-        if (!MountPartition(current, false /* erase_same_mounts */, &end)) {
-            if (current->fs_mgr_flags.no_fail) {
-                LOG(INFO) << "Failed to mount " << current->mount_point
-                          << ", ignoring mount for no_fail partition";
-            } else if (current->fs_mgr_flags.formattable) {
-                LOG(INFO) << "Failed to mount " << current->mount_point
-                          << ", ignoring mount for formattable partition";
-            } else {
-                PLOG(ERROR) << "Failed to mount " << current->mount_point;
-                return false;
-            }
+        // Skip the other entries for the same mount point; they are tried as
+        // alternatives by MountPreparedPartition().
+        auto end = current + 1;
+        while (end != fstab_.end() && end->mount_point == current->mount_point) {
+            ++end;
+        }
+
+        bool prepared_ok = PreparePartition(current);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (mount_failed) break;
+            if (prepared_ok) prepared.emplace_back(current);
+        }
+        if (prepared_ok) {
+            cv.notify_one();
+        } else if (IsMountFailureFatal(*current)) {
+            ok = false;
+            break;
         }
         current = end;
     }
 
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        prepare_done = true;
+    }
+    cv.notify_one();
+    mounter.join();
+
+    if (!ok || mount_failed) {
+        return false;
+    }
+
     for (const auto& entry : fstab_) {
         if (entry.fs_type == "overlay") {
             fs_mgr_mount_overlayfs_fstab_entry(entry);
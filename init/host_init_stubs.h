@@ -40,6 +40,10 @@ namespace init {
 inline bool CanReadProperty(const std::string&, const std::string&) {
     return true;
 }
+inline uint32_t InitPropertySet(const std::string& name, const std::string& value) {
+    android::base::SetProperty(name, value);
+    return 0;
+}
 
 // reboot_utils.h
 inline void SetFatalRebootTarget(const std::optional<std::string>& = std::nullopt) {}
@@ -136,7 +136,9 @@ static void InstallInitNotifier(Epoll* epoll) {
         TEMP_FAILURE_RETRY(read(wake_main_thread_fd, &counter, sizeof(counter)));
     };
 
-    if (auto result = epoll->RegisterHandler(wake_main_thread_fd, clear_eventfd); !result.ok()) {
+    if (auto result = epoll->RegisterHandler(wake_main_thread_fd, clear_eventfd, EPOLLIN,
+                                             Epoll::Priority::kHigh);
+        !result.ok()) {
         LOG(FATAL) << result.error();
     }
 }
@@ -278,9 +280,28 @@ void DebugRebootLogging() {
     }
 }
 
+// How long the main loop spends handling each wakeup, not counting the time it waits in epoll.
+static struct {
+    uint64_t wakeups = 0;
+    std::chrono::nanoseconds busy_time = 0ns;
+    std::chrono::nanoseconds max_busy_time = 0ns;
+} main_loop_stats;
+
+static void RecordMainLoopWakeup(std::chrono::nanoseconds busy_time) {
+    main_loop_stats.wakeups++;
+    main_loop_stats.busy_time += busy_time;
+    main_loop_stats.max_busy_time = std::max(main_loop_stats.max_busy_time, busy_time);
+}
+
 void DumpState() {
     ServiceList::GetInstance().DumpState();
     ActionManager::GetInstance().DumpState();
+    DumpPropertyServiceState();
+
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    LOG(INFO) << "Main loop: " << main_loop_stats.wakeups << " wakeups, busy for "
+              << Milliseconds(main_loop_stats.busy_time).count() << "ms, longest wakeup "
+              << Milliseconds(main_loop_stats.max_busy_time).count() << "ms";
 }
 
 Parser CreateParser(ActionManager& action_manager, ServiceList& service_list) {
@@ -306,6 +327,7 @@ Parser CreateServiceOnlyParser(ServiceList& service_list, bool from_apex) {
 
 static void LoadBootScripts(ActionManager& action_manager, ServiceList& service_list) {
     Parser parser = CreateParser(action_manager, service_list);
+    parser.set_parallel(true);
 
     std::string bootscript = GetProperty("ro.boot.init_rc", "");
     if (bootscript.empty()) {
@@ -583,6 +605,10 @@ static void HandleSigtermSignal(const signalfd_siginfo& siginfo) {
 
 static constexpr std::chrono::milliseconds kDiagnosticTimeout = 10s;
 
+// How long the main loop keeps executing action commands before it goes back to epoll.  Returning
+// to epoll after every command costs a wakeup per command during boot.
+static constexpr std::chrono::milliseconds kCommandTimeSlice = 5ms;
+
 static void HandleSignalFd(bool one_off) {
     signalfd_siginfo siginfo;
     auto started = std::chrono::steady_clock::now();
@@ -666,7 +692,8 @@ static void InstallSignalFdHandler(Epoll* epoll) {
 
     constexpr int flags = EPOLLIN | EPOLLPRI;
     auto handler = std::bind(HandleSignalFd, false);
-    if (auto result = epoll->RegisterHandler(signal_fd, handler, flags); !result.ok()) {
+    if (auto result = epoll->RegisterHandler(signal_fd, handler, flags, Epoll::Priority::kHigh);
+        !result.ok()) {
         LOG(FATAL) << result.error();
     }
 }
@@ -987,6 +1014,7 @@ int SecondStageMain(int argc, char** argv) {
 
     // Restore prio before main loop
     setpriority(PRIO_PROCESS, 0, 0);
+    auto wakeup_time = boot_clock::now();
     while (true) {
         // By default, sleep until something happens.
         auto epoll_timeout = std::optional<std::chrono::milliseconds>{kDiagnosticTimeout};
@@ -1000,7 +1028,14 @@ int SecondStageMain(int argc, char** argv) {
         }
 
         if (!(prop_waiter_state.MightBeWaiting() || Service::is_exec_service_running())) {
-            am.ExecuteOneCommand();
+            // Stop early if a command needs the rest of the loop to run first: a shutdown was
+            // triggered, or init now waits for a property or an exec service.
+            Timer t;
+            do {
+                am.ExecuteOneCommand();
+            } while (t.duration() < kCommandTimeSlice && am.HasMoreCommands() &&
+                     !shutdown_state.CheckShutdown() && !prop_waiter_state.MightBeWaiting() &&
+                     !Service::is_exec_service_running());
         }
         if (!IsShuttingDown()) {
             auto next_process_action_time = HandleProcessActions();
@@ -1018,7 +1053,9 @@ int SecondStageMain(int argc, char** argv) {
             if (am.HasMoreCommands()) epoll_timeout = 0ms;
         }
 
+        RecordMainLoopWakeup(boot_clock::now() - wakeup_time);
         auto pending_functions = epoll.Wait(epoll_timeout);
+        wakeup_time = boot_clock::now();
         if (!pending_functions.ok()) {
             LOG(ERROR) << pending_functions.error();
         } else if (!pending_functions->empty()) {
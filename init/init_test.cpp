@@ -19,6 +19,7 @@
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <gtest/gtest.h>
 
 #include "action.h"
@@ -35,6 +36,7 @@
 #include "util.h"
 
 using android::base::GetIntProperty;
+using android::base::StringPrintf;
 
 namespace android {
 namespace init {
@@ -158,6 +160,53 @@ execute_third
     TestInitText(init_script, test_function_map, commands, &service_list);
 }
 
+TEST(init, PropertyTriggerOrder) {
+    std::string init_script =
+            R"init(
+on property:init_test.a=1
+execute_first
+
+on property:init_test.b=1
+execute_never
+
+on boot && property:init_test.a=1
+execute_never
+
+on property:init_test.a=*
+execute_second
+
+)init";
+
+    int num_executed = 0;
+    auto do_execute_first = [&num_executed](const BuiltinArguments&) {
+        EXPECT_EQ(0, num_executed++);
+        return Result<void>{};
+    };
+    auto do_execute_second = [&num_executed](const BuiltinArguments&) {
+        EXPECT_EQ(1, num_executed++);
+        return Result<void>{};
+    };
+    auto do_execute_never = [](const BuiltinArguments&) {
+        ADD_FAILURE() << "action should not have run";
+        return Result<void>{};
+    };
+
+    BuiltinFunctionMap test_function_map = {
+            {"execute_first", {0, 0, {false, do_execute_first}}},
+            {"execute_second", {0, 0, {false, do_execute_second}}},
+            {"execute_never", {0, 0, {false, do_execute_never}}},
+    };
+
+    ActionManagerCommand change_a = [](ActionManager& am) {
+        am.QueuePropertyChange("init_test.a", "1");
+    };
+    std::vector<ActionManagerCommand> commands{change_a};
+
+    ServiceList service_list;
+    TestInitText(init_script, test_function_map, commands, &service_list);
+    EXPECT_EQ(2, num_executed);
+}
+
 TEST(init, OverrideService) {
     std::string init_script = R"init(
 service A something
@@ -243,6 +292,81 @@ TEST(init, EventTriggerOrderMultipleFiles) {
     EXPECT_EQ(6, num_executed);
 }
 
+TEST(init, EventTriggerOrderParallelDir) {
+    TemporaryDir dir;
+    constexpr int kNumFiles = 16;
+    for (int i = 1; i <= kNumFiles; i++) {
+        // Zero-pad the names so that they sort in the order the triggers should execute in.
+        auto path = StringPrintf("%s/%02d.rc", dir.path, i);
+        ASSERT_RESULT_OK(WriteFile(path, StringPrintf("on boot\nexecute %d", i)));
+    }
+
+    int num_executed = 0;
+    auto execute_command = [&num_executed](const BuiltinArguments& args) {
+        EXPECT_EQ(2U, args.size());
+        EXPECT_EQ(++num_executed, std::stoi(args[1]));
+        return Result<void>{};
+    };
+
+    BuiltinFunctionMap test_function_map = {
+            {"execute", {1, 1, {false, execute_command}}},
+    };
+    Action::set_function_map(&test_function_map);
+
+    ActionManager am;
+    Parser parser;
+    parser.AddSectionParser("on", std::make_unique<ActionParser>(&am, nullptr));
+    parser.set_parallel(true);
+    ASSERT_TRUE(parser.ParseConfig(dir.path));
+    EXPECT_EQ(0U, parser.parse_error_count());
+
+    am.QueueEventTrigger("boot");
+    while (am.HasMoreCommands()) {
+        am.ExecuteOneCommand();
+    }
+
+    EXPECT_EQ(kNumFiles, num_executed);
+}
+
+TEST(init, ParseConfigFilesParallel) {
+    TemporaryDir dir;
+    constexpr int kNumFiles = 8;
+    std::vector<std::string> files;
+    // Listed in reverse, to check that the given order is kept rather than the sorted one.
+    for (int i = kNumFiles; i >= 1; i--) {
+        auto path = StringPrintf("%s/%02d.rc", dir.path, i);
+        ASSERT_RESULT_OK(WriteFile(path, StringPrintf("on boot\nexecute %d", kNumFiles + 1 - i)));
+        files.emplace_back(path);
+    }
+
+    int num_executed = 0;
+    auto execute_command = [&num_executed](const BuiltinArguments& args) {
+        EXPECT_EQ(2U, args.size());
+        EXPECT_EQ(++num_executed, std::stoi(args[1]));
+        return Result<void>{};
+    };
+
+    BuiltinFunctionMap test_function_map = {
+            {"execute", {1, 1, {false, execute_command}}},
+    };
+    Action::set_function_map(&test_function_map);
+
+    ActionManager am;
+    Parser parser;
+    parser.AddSectionParser("on", std::make_unique<ActionParser>(&am, nullptr));
+    parser.set_parallel(true);
+    EXPECT_TRUE(parser.ParseConfigFiles(files));
+    EXPECT_FALSE(parser.ParseConfigFiles({std::string(dir.path) + "/missing.rc"}));
+    EXPECT_EQ(0U, parser.parse_error_count());
+
+    am.QueueEventTrigger("boot");
+    while (am.HasMoreCommands()) {
+        am.ExecuteOneCommand();
+    }
+
+    EXPECT_EQ(kNumFiles, num_executed);
+}
+
 TEST(init, RejectsCriticalAndOneshotService) {
     if (GetIntProperty("ro.product.first_api_level", 10000) < 30) {
         GTEST_SKIP() << "Test only valid for devices launching with R or later";
@@ -186,7 +186,8 @@ bool Keychords::GeteventEnable(int fd) {
         current_ |= mask & available & set;
         LambdaCheck();
     }
-    if (auto result = epoll_->RegisterHandler(fd, [this, fd]() { this->LambdaHandler(fd); });
+    if (auto result = epoll_->RegisterHandler(
+                fd, [this, fd]() { this->LambdaHandler(fd); }, EPOLLIN, Epoll::Priority::kLow);
         !result.ok()) {
         LOG(WARNING) << "Could not register keychord epoll handler: " << result.error();
         return false;
@@ -270,8 +271,9 @@ void Keychords::GeteventOpenDevice() {
     }
 
     if (inotify_fd_ >= 0) {
-        if (auto result =
-                    epoll_->RegisterHandler(inotify_fd_, [this]() { this->InotifyHandler(); });
+        if (auto result = epoll_->RegisterHandler(
+                    inotify_fd_, [this]() { this->InotifyHandler(); }, EPOLLIN,
+                    Epoll::Priority::kLow);
             !result.ok()) {
             LOG(WARNING) << "Could not register keychord epoll handler: " << result.error();
         }
@@ -29,6 +29,7 @@ ModaliasHandler::ModaliasHandler(const std::vector<std::string>& base_paths)
 
 void ModaliasHandler::HandleUevent(const Uevent& uevent) {
     if (uevent.modalias.empty()) return;
+    auto lock = std::lock_guard{modprobe_lock_};
     modprobe_.LoadWithAliases(uevent.modalias, true);
 }
 
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -35,6 +36,8 @@ class ModaliasHandler : public UeventHandler {
     void HandleUevent(const Uevent& uevent) override;
 
   private:
+    // Modprobe isn't thread safe, and uevents may be handled on several threads.
+    std::mutex modprobe_lock_;
     Modprobe modprobe_;
 };
 
@@ -18,7 +18,10 @@
 
 #include <dirent.h>
 
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <thread>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/file.h>
@@ -42,7 +45,7 @@ void Parser::AddSingleLineParser(const std::string& prefix, LineCallback callbac
     line_callbacks_.emplace_back(prefix, std::move(callback));
 }
 
-void Parser::ParseData(const std::string& filename, std::string* data) {
+std::vector<Parser::Line> Parser::Tokenize(std::string* data) {
     data->push_back('\n');
     data->push_back('\0');
 
@@ -51,9 +54,32 @@ void Parser::ParseData(const std::string& filename, std::string* data) {
     state.ptr = data->data();
     state.nexttoken = 0;
 
+    std::vector<Line> lines;
+    std::vector<std::string> args;
+    for (;;) {
+        switch (next_token(&state)) {
+            case T_EOF:
+                return lines;
+            case T_NEWLINE:
+                state.line++;
+                if (args.empty()) break;
+                lines.push_back({state.line, std::move(args)});
+                args.clear();
+                break;
+            case T_TEXT:
+                args.emplace_back(state.text);
+                break;
+        }
+    }
+}
+
+void Parser::ParseData(const std::string& filename, std::string* data) {
+    ParseLines(filename, Tokenize(data));
+}
+
+void Parser::ParseLines(const std::string& filename, std::vector<Line>&& lines) {
     SectionParser* section_parser = nullptr;
     int section_start_line = -1;
-    std::vector<std::string> args;
 
     // If we encounter a bad section start, there is no valid parser object to parse the subsequent
     // sections, so we must suppress errors until the next valid section is found.
@@ -72,63 +98,50 @@ void Parser::ParseData(const std::string& filename, std::string* data) {
         section_start_line = -1;
     };
 
-    for (;;) {
-        switch (next_token(&state)) {
-            case T_EOF:
-                end_section();
-
-                for (const auto& [section_name, section_parser] : section_parsers_) {
-                    section_parser->EndFile();
-                }
-
-                return;
-            case T_NEWLINE: {
-                state.line++;
-                if (args.empty()) break;
-                // If we have a line matching a prefix we recognize, call its callback and unset any
-                // current section parsers.  This is meant for /sys/ and /dev/ line entries for
-                // uevent.
-                auto line_callback = std::find_if(
-                    line_callbacks_.begin(), line_callbacks_.end(),
-                    [&args](const auto& c) { return android::base::StartsWith(args[0], c.first); });
-                if (line_callback != line_callbacks_.end()) {
-                    end_section();
-
-                    if (auto result = line_callback->second(std::move(args)); !result.ok()) {
-                        parse_error_count_++;
-                        LOG(ERROR) << filename << ": " << state.line << ": " << result.error();
-                    }
-                } else if (section_parsers_.count(args[0])) {
-                    end_section();
-                    section_parser = section_parsers_[args[0]].get();
-                    section_start_line = state.line;
-                    if (auto result =
-                                section_parser->ParseSection(std::move(args), filename, state.line);
-                        !result.ok()) {
-                        parse_error_count_++;
-                        LOG(ERROR) << filename << ": " << state.line << ": " << result.error();
-                        section_parser = nullptr;
-                        bad_section_found = true;
-                    }
-                } else if (section_parser) {
-                    if (auto result = section_parser->ParseLineSection(std::move(args), state.line);
-                        !result.ok()) {
-                        parse_error_count_++;
-                        LOG(ERROR) << filename << ": " << state.line << ": " << result.error();
-                    }
-                } else if (!bad_section_found) {
-                    parse_error_count_++;
-                    LOG(ERROR) << filename << ": " << state.line
-                               << ": Invalid section keyword found";
-                }
-                args.clear();
-                break;
+    for (auto& parsed_line : lines) {
+        int line = parsed_line.line;
+        auto& args = parsed_line.args;
+        // If we have a line matching a prefix we recognize, call its callback and unset any
+        // current section parsers.  This is meant for /sys/ and /dev/ line entries for
+        // uevent.
+        auto line_callback = std::find_if(
+            line_callbacks_.begin(), line_callbacks_.end(),
+            [&args](const auto& c) { return android::base::StartsWith(args[0], c.first); });
+        if (line_callback != line_callbacks_.end()) {
+            end_section();
+
+            if (auto result = line_callback->second(std::move(args)); !result.ok()) {
+                parse_error_count_++;
+                LOG(ERROR) << filename << ": " << line << ": " << result.error();
             }
-            case T_TEXT:
-                args.emplace_back(state.text);
-                break;
+        } else if (section_parsers_.count(args[0])) {
+            end_section();
+            section_parser = section_parsers_[args[0]].get();
+            section_start_line = line;
+            if (auto result = section_parser->ParseSection(std::move(args), filename, line);
+                !result.ok()) {
+                parse_error_count_++;
+                LOG(ERROR) << filename << ": " << line << ": " << result.error();
+                section_parser = nullptr;
+                bad_section_found = true;
+            }
+        } else if (section_parser) {
+            if (auto result = section_parser->ParseLineSection(std::move(args), line);
+                !result.ok()) {
+                parse_error_count_++;
+                LOG(ERROR) << filename << ": " << line << ": " << result.error();
+            }
+        } else if (!bad_section_found) {
+            parse_error_count_++;
+            LOG(ERROR) << filename << ": " << line << ": Invalid section keyword found";
         }
     }
+
+    end_section();
+
+    for (const auto& [section_name, section_parser] : section_parsers_) {
+        section_parser->EndFile();
+    }
 }
 
 bool Parser::ParseConfigFileInsecure(const std::string& path) {
@@ -227,6 +240,10 @@ bool Parser::ParseConfigDir(const std::string& path) {
     }
     // Sort first so we load files in a consistent order (bug 31996208)
     std::sort(files.begin(), files.end());
+    if (parallel_) {
+        ParseConfigFilesInParallel(files);
+        return true;
+    }
     for (const auto& file : files) {
         if (!ParseConfigFile(file)) {
             LOG(ERROR) << "could not import file '" << file << "'";
@@ -235,6 +252,67 @@ bool Parser::ParseConfigDir(const std::string& path) {
     return true;
 }
 
+// Reading and tokenizing a file doesn't depend on any other file, so it is done on a few threads.
+// The section parsers do depend on the order of the files, so the results are then parsed one
+// file at a time, in order, on this thread; the outcome is the same as parsing the files serially.
+bool Parser::ParseConfigFilesInParallel(const std::vector<std::string>& files) {
+    static constexpr size_t kMaxTokenizerThreads = 4;
+
+    struct TokenizedFile {
+        std::optional<std::vector<Line>> lines;
+        std::string error;
+    };
+    std::vector<TokenizedFile> tokenized_files(files.size());
+
+    std::atomic<size_t> next_file = 0;
+    auto tokenize_files = [&] {
+        for (size_t i; (i = next_file++) < files.size();) {
+            auto config_contents = ReadFile(files[i]);
+            if (!config_contents.ok()) {
+                tokenized_files[i].error = config_contents.error().message();
+                continue;
+            }
+            tokenized_files[i].lines = Tokenize(&config_contents.value());
+        }
+    };
+
+    size_t num_threads = std::min<size_t>(
+            {files.size(), kMaxTokenizerThreads, std::max(1u, std::thread::hardware_concurrency())});
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(tokenize_files);
+    }
+    tokenize_files();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    bool success = true;
+    for (size_t i = 0; i < files.size(); i++) {
+        LOG(INFO) << "Parsing file " << files[i] << "...";
+        if (!tokenized_files[i].lines) {
+            LOG(INFO) << "Unable to read config file '" << files[i]
+                      << "': " << tokenized_files[i].error;
+            LOG(ERROR) << "could not import file '" << files[i] << "'";
+            success = false;
+            continue;
+        }
+        ParseLines(files[i], std::move(*tokenized_files[i].lines));
+    }
+    return success;
+}
+
+bool Parser::ParseConfigFiles(const std::vector<std::string>& files) {
+    if (parallel_) {
+        return ParseConfigFilesInParallel(files);
+    }
+    bool success = true;
+    for (const auto& file : files) {
+        success &= ParseConfigFile(file);
+    }
+    return success;
+}
+
 bool Parser::ParseConfig(const std::string& path) {
     if (is_dir(path.c_str())) {
         return ParseConfigDir(path);
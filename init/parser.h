@@ -19,6 +19,7 @@
 
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -73,6 +74,9 @@ class Parser {
 
     bool ParseConfig(const std::string& path);
     bool ParseConfigFile(const std::string& path);
+    // Parses |files| in the given order, in parallel if set_parallel() was called. Returns false
+    // if any of them could not be read.
+    bool ParseConfigFiles(const std::vector<std::string>& files);
     void AddSectionParser(const std::string& name, std::unique_ptr<SectionParser> parser);
     void AddSingleLineParser(const std::string& prefix, LineCallback callback);
 
@@ -87,13 +91,27 @@ class Parser {
 
     size_t parse_error_count() const { return parse_error_count_; }
 
+    // If set, the files in a directory are read and tokenized on worker threads. They are still
+    // parsed in the same order, with the same results and errors, as they otherwise would be.
+    void set_parallel(bool parallel) { parallel_ = parallel; }
+
   private:
+    // The arguments of a non-empty line, and its line number.
+    struct Line {
+        int line;
+        std::vector<std::string> args;
+    };
+
+    static std::vector<Line> Tokenize(std::string* data);
     void ParseData(const std::string& filename, std::string* data);
+    void ParseLines(const std::string& filename, std::vector<Line>&& lines);
     bool ParseConfigDir(const std::string& path);
+    bool ParseConfigFilesInParallel(const std::vector<std::string>& files);
 
     std::map<std::string, std::unique_ptr<SectionParser>> section_parsers_;
     std::vector<std::pair<std::string, LineCallback>> line_callbacks_;
     size_t parse_error_count_ = 0;
+    bool parallel_ = false;
 };
 
 }  // namespace init
@@ -22,16 +22,27 @@
 #include <sys/system_properties.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <optional>
+#include <unordered_map>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/properties.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
+#include <google/protobuf/io/coded_stream.h>
 
 #include "util.h"
 
+using namespace std::literals;
+
+using android::base::boot_clock;
 using android::base::Dirname;
+using android::base::GetUintProperty;
 using android::base::ReadFdToString;
 using android::base::StartsWith;
 using android::base::unique_fd;
@@ -155,19 +166,177 @@ Result<std::string> ReadPersistentPropertyFile() {
     return *file_contents;
 }
 
-}  // namespace
 
-Result<PersistentProperties> LoadPersistentPropertyFile() {
+// Records are appended to the file as serialized PersistentProperties messages holding a single
+// record. Concatenated messages parse as one message with all of their records, so the file stays
+// a valid PersistentProperties message, in which the last record for a name is the current one.
+// If init is killed in the middle of an append, the file ends with a partial record, which fails
+// to parse as a whole; this recovers the complete records in front of it.
+bool ParsePersistentPropertyRecords(const std::string& contents,
+                                    PersistentProperties* persistent_properties) {
+    // Field 1, length delimited.
+    constexpr uint32_t kRecordTag = (PersistentProperties::kPropertiesFieldNumber << 3) | 2;
+
+    google::protobuf::io::CodedInputStream input(
+            reinterpret_cast<const uint8_t*>(contents.data()), contents.size());
+    while (uint32_t tag = input.ReadTag()) {
+        uint32_t length;
+        std::string serialized_record;
+        if (tag != kRecordTag || !input.ReadVarint32(&length) ||
+            !input.ReadString(&serialized_record, length)) {
+            break;
+        }
+        if (!persistent_properties->add_properties()->ParseFromString(serialized_record)) {
+            persistent_properties->mutable_properties()->RemoveLast();
+            break;
+        }
+    }
+    return persistent_properties->properties_size() > 0;
+}
+
+// Keeps a single record for each name, with the value of its last record, in the order in which
+// the names first appear. Returns the number of records that were dropped.
+size_t RemoveOverriddenRecords(PersistentProperties* persistent_properties) {
+    std::unordered_map<std::string, int> index;
+    PersistentProperties result;
+    for (auto& record : *persistent_properties->mutable_properties()) {
+        auto [it, inserted] = index.emplace(record.name(), result.properties_size());
+        if (inserted) {
+            *result.add_properties() = std::move(record);
+        } else {
+            result.mutable_properties(it->second)->set_value(record.value());
+        }
+    }
+    size_t dropped = persistent_properties->properties_size() - result.properties_size();
+    *persistent_properties = std::move(result);
+    return dropped;
+}
+
+struct PersistentPropertyJournal {
+    PersistentProperties persistent_properties;
+    // The number of records in the file that are overridden by a later record.
+    size_t stale_records = 0;
+    // The file ends with a partial record, so it has to be rewritten before appending to it.
+    bool torn = false;
+};
+
+Result<PersistentPropertyJournal> LoadPersistentPropertyJournal() {
     auto file_contents = ReadPersistentPropertyFile();
     if (!file_contents.ok()) return file_contents.error();
 
+    PersistentPropertyJournal journal;
+    if (!journal.persistent_properties.ParseFromString(*file_contents)) {
+        journal.persistent_properties.Clear();
+        if (!ParsePersistentPropertyRecords(*file_contents, &journal.persistent_properties)) {
+            // If the file cannot be parsed in either format, then we don't have any recovery
+            // mechanisms, so we delete it to allow for future writes to take place successfully.
+            unlink(persistent_property_filename.c_str());
+            return Error() << "Unable to parse persistent property file: Could not parse protobuf";
+        }
+        LOG(WARNING) << "Persistent property file ends with a partial record, recovered "
+                     << journal.persistent_properties.properties_size() << " records";
+        journal.torn = true;
+    }
+    journal.stale_records = RemoveOverriddenRecords(&journal.persistent_properties);
+    return journal;
+}
+
+// The file is rewritten once this many of its records are overridden by later ones, or once as
+// many records are stale as there are properties, whichever is larger.
+constexpr size_t kMinStaleRecordsToCompact = 128;
+
+// The authoritative copy of the persistent properties, and the state of the file that backs it.
+// Callers of the functions below serialize access to it; the property service does so with the
+// lock that it holds while setting properties.
+struct PersistentPropertyStore {
+    // The file that |persistent_properties| is stored in, empty until it has been loaded.
+    std::string filename;
     PersistentProperties persistent_properties;
-    if (persistent_properties.ParseFromString(*file_contents)) return persistent_properties;
+    // Maps from a property name to its index in |persistent_properties|.
+    std::unordered_map<std::string, int> index;
+    size_t stale_records = 0;
+    bool needs_compaction = false;
+    // Opened for appending records, and closed when the file is rewritten.
+    unique_fd fd;
+    // Set while appended records have yet to be synced.
+    std::optional<boot_clock::time_point> sync_deadline;
+};
+
+PersistentPropertyStore persistent_property_store;
+
+// How long appended records may stay unsynced, so that a burst of writes costs a single sync. By
+// default every write is synced before the property is reported as set.
+std::chrono::milliseconds persistent_property_sync_delay = 0ms;
+
+void ResetPersistentPropertyStore(PersistentProperties persistent_properties, size_t stale_records,
+                                  bool needs_compaction) {
+    auto& store = persistent_property_store;
+    if (store.sync_deadline) {
+        fdatasync(store.fd);
+    }
+
+    store.filename = persistent_property_filename;
+    store.persistent_properties = std::move(persistent_properties);
+    store.index.clear();
+    for (int i = 0; i < store.persistent_properties.properties_size(); i++) {
+        store.index.emplace(store.persistent_properties.properties(i).name(), i);
+    }
+    store.stale_records = stale_records;
+    store.needs_compaction = needs_compaction;
+    store.fd.reset();
+    store.sync_deadline.reset();
+}
+
+Result<void> CompactPersistentPropertyStore() {
+    auto& store = persistent_property_store;
+    if (auto result = WritePersistentPropertyFile(store.persistent_properties); !result.ok()) {
+        store.needs_compaction = true;
+        return result.error();
+    }
+    // The new file has been synced, and the records that were pending a sync are part of it.
+    store.stale_records = 0;
+    store.needs_compaction = false;
+    store.fd.reset();
+    store.sync_deadline.reset();
+    return {};
+}
+
+Result<void> AppendPersistentPropertyRecord(const std::string& name, const std::string& value) {
+    auto& store = persistent_property_store;
+    if (store.fd == -1) {
+        store.fd.reset(TEMP_FAILURE_RETRY(
+                open(store.filename.c_str(), O_WRONLY | O_APPEND | O_NOFOLLOW | O_CLOEXEC)));
+        if (store.fd == -1) {
+            return ErrnoError() << "Unable to open persistent property file";
+        }
+    }
+
+    PersistentProperties record;
+    AddPersistentProperty(name, value, &record);
+    std::string serialized_string;
+    if (!record.SerializeToString(&serialized_string)) {
+        return Error() << "Unable to serialize property";
+    }
+    if (!WriteStringToFd(serialized_string, store.fd)) {
+        // Part of the record may have been written, and nothing can be appended after it.
+        store.needs_compaction = true;
+        return ErrnoError() << "Unable to append to persistent property file";
+    }
+
+    if (persistent_property_sync_delay == 0ms) {
+        fdatasync(store.fd);
+    } else if (!store.sync_deadline) {
+        store.sync_deadline = boot_clock::now() + persistent_property_sync_delay;
+    }
+    return {};
+}
+
+}  // namespace
 
-    // If the file cannot be parsed in either format, then we don't have any recovery
-    // mechanisms, so we delete it to allow for future writes to take place successfully.
-    unlink(persistent_property_filename.c_str());
-    return Error() << "Unable to parse persistent property file: Could not parse protobuf";
+Result<PersistentProperties> LoadPersistentPropertyFile() {
+    auto journal = LoadPersistentPropertyJournal();
+    if (!journal.ok()) return journal.error();
+    return std::move(journal->persistent_properties);
 }
 
 Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_properties) {
@@ -207,49 +376,92 @@ Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_
     return {};
 }
 
-// Persistent properties are not written often, so we rather not keep any data in memory and read
-// then rewrite the persistent property file for each update.
+// Persistent properties can be written often, so rather than rewriting the whole file for each
+// update, we keep them in memory and append a record for the update to the file. The file is
+// rewritten when enough of its records are stale.
 void WritePersistentProperty(const std::string& name, const std::string& value) {
-    auto persistent_properties = LoadPersistentPropertyFile();
-
-    if (!persistent_properties.ok()) {
-        LOG(ERROR) << "Recovering persistent properties from memory: "
-                   << persistent_properties.error();
-        persistent_properties = LoadPersistentPropertiesFromMemory();
+    auto& store = persistent_property_store;
+    if (store.filename != persistent_property_filename) {
+        auto journal = LoadPersistentPropertyJournal();
+        if (journal.ok()) {
+            ResetPersistentPropertyStore(std::move(journal->persistent_properties),
+                                         journal->stale_records, journal->torn);
+        } else {
+            LOG(ERROR) << "Recovering persistent properties from memory: " << journal.error();
+            ResetPersistentPropertyStore(LoadPersistentPropertiesFromMemory(), 0, true);
+        }
     }
-    auto it = std::find_if(persistent_properties->mutable_properties()->begin(),
-                           persistent_properties->mutable_properties()->end(),
-                           [&name](const auto& record) { return record.name() == name; });
-    if (it != persistent_properties->mutable_properties()->end()) {
-        it->set_name(name);
-        it->set_value(value);
+
+    if (auto it = store.index.find(name); it != store.index.end()) {
+        auto record = store.persistent_properties.mutable_properties(it->second);
+        if (record->value() == value && !store.needs_compaction) {
+            return;
+        }
+        record->set_value(value);
+        store.stale_records++;
     } else {
-        AddPersistentProperty(name, value, &persistent_properties.value());
+        store.index.emplace(name, store.persistent_properties.properties_size());
+        AddPersistentProperty(name, value, &store.persistent_properties);
+    }
+
+    if (!store.needs_compaction &&
+        store.stale_records < std::max(kMinStaleRecordsToCompact,
+                                       size_t(store.persistent_properties.properties_size()))) {
+        auto result = AppendPersistentPropertyRecord(name, value);
+        if (result.ok()) return;
+        LOG(ERROR) << "Could not append persistent property, rewriting file: " << result.error();
     }
 
-    if (auto result = WritePersistentPropertyFile(*persistent_properties); !result.ok()) {
+    if (auto result = CompactPersistentPropertyStore(); !result.ok()) {
         LOG(ERROR) << "Could not store persistent property: " << result.error();
     }
 }
 
+std::optional<std::chrono::milliseconds> PersistentPropertiesSyncTimeout() {
+    const auto& sync_deadline = persistent_property_store.sync_deadline;
+    if (!sync_deadline) return std::nullopt;
+
+    auto now = boot_clock::now();
+    if (now >= *sync_deadline) return 0ms;
+    return std::chrono::ceil<std::chrono::milliseconds>(*sync_deadline - now);
+}
+
+void SyncPersistentProperties() {
+    auto& store = persistent_property_store;
+    if (!store.sync_deadline || boot_clock::now() < *store.sync_deadline) return;
+
+    if (fdatasync(store.fd) != 0) {
+        PLOG(ERROR) << "Unable to sync persistent property file";
+    }
+    store.sync_deadline.reset();
+}
+
 PersistentProperties LoadPersistentProperties() {
-    auto persistent_properties = LoadPersistentPropertyFile();
+    persistent_property_sync_delay = std::chrono::milliseconds(
+            GetUintProperty<uint64_t>("ro.persistent_properties.sync_delay_ms", 0));
+
+    auto journal = LoadPersistentPropertyJournal();
+    if (journal.ok()) {
+        ResetPersistentPropertyStore(journal->persistent_properties, journal->stale_records,
+                                     journal->torn);
+        return std::move(journal->persistent_properties);
+    }
 
+    LOG(ERROR) << "Could not load single persistent property file, trying legacy directory: "
+               << journal.error();
+    auto persistent_properties = LoadLegacyPersistentProperties();
     if (!persistent_properties.ok()) {
-        LOG(ERROR) << "Could not load single persistent property file, trying legacy directory: "
+        LOG(ERROR) << "Unable to load legacy persistent properties: "
                    << persistent_properties.error();
-        persistent_properties = LoadLegacyPersistentProperties();
-        if (!persistent_properties.ok()) {
-            LOG(ERROR) << "Unable to load legacy persistent properties: "
-                       << persistent_properties.error();
-            return {};
-        }
-        if (auto result = WritePersistentPropertyFile(*persistent_properties); result.ok()) {
-            RemoveLegacyPersistentPropertyFiles();
-        } else {
-            LOG(ERROR) << "Unable to write single persistent property file: " << result.error();
-            // Fall through so that we still set the properties that we've read.
-        }
+        return {};
+    }
+    if (auto result = WritePersistentPropertyFile(*persistent_properties); result.ok()) {
+        RemoveLegacyPersistentPropertyFiles();
+        ResetPersistentPropertyStore(*persistent_properties, 0, false);
+    } else {
+        LOG(ERROR) << "Unable to write single persistent property file: " << result.error();
+        // Fall through so that we still set the properties that we've read.
+        ResetPersistentPropertyStore(*persistent_properties, 0, true);
     }
 
     return *persistent_properties;
@@ -17,6 +17,8 @@
 #ifndef _INIT_PERSISTENT_PROPERTIES_H
 #define _INIT_PERSISTENT_PROPERTIES_H
 
+#include <chrono>
+#include <optional>
 #include <string>
 
 #include "result.h"
@@ -28,6 +30,13 @@ namespace init {
 PersistentProperties LoadPersistentProperties();
 void WritePersistentProperty(const std::string& name, const std::string& value);
 
+// If ro.persistent_properties.sync_delay_ms is set, writes are synced in groups, at most that long
+// after they happen. The property service waits for at most the returned timeout before calling
+// SyncPersistentProperties(), which syncs the writes that are due. The timeout is std::nullopt if
+// no writes are pending.
+std::optional<std::chrono::milliseconds> PersistentPropertiesSyncTimeout();
+void SyncPersistentProperties();
+
 // Exposed only for testing
 Result<PersistentProperties> LoadPersistentPropertyFile();
 Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_properties);
@@ -155,5 +155,80 @@ TEST(persistent_properties, UpdatePropertyBadParse) {
     EXPECT_FALSE(it == read_back_properties.properties().end());
 }
 
+TEST(persistent_properties, UpdatePropertyManyTimes) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    persistent_property_filename = tf.path;
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties = {
+        {"persist.sys.locale", "en-US"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+    };
+    ASSERT_RESULT_OK(
+            WritePersistentPropertyFile(VectorToPersistentProperties(persistent_properties)));
+
+    for (int i = 0; i < 1000; i++) {
+        WritePersistentProperty("persist.test.counter", std::to_string(i));
+    }
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties_expected = {
+        {"persist.sys.locale", "en-US"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+        {"persist.test.counter", "999"},
+    };
+
+    auto read_back_properties = LoadPersistentProperties();
+    CheckPropertiesEqual(persistent_properties_expected, read_back_properties);
+
+    // Stale records are compacted away rather than accumulating in the file.
+    auto file_contents = ReadFile(tf.path);
+    ASSERT_RESULT_OK(file_contents);
+    EXPECT_LT(file_contents->size(), 500 * sizeof("persist.test.counter"));
+}
+
+TEST(persistent_properties, PartialRecord) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    persistent_property_filename = tf.path;
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties = {
+        {"persist.sys.locale", "en-US"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+    };
+    ASSERT_RESULT_OK(
+            WritePersistentPropertyFile(VectorToPersistentProperties(persistent_properties)));
+
+    WritePersistentProperty("persist.sys.locale", "pt-BR");
+
+    // Simulate init being killed in the middle of appending a record.
+    std::string serialized_record;
+    ASSERT_TRUE(VectorToPersistentProperties({{"persist.sys.timezone", "Europe/Lisbon"}})
+                        .SerializeToString(&serialized_record));
+    serialized_record.resize(serialized_record.size() / 2);
+    auto file_contents = ReadFile(tf.path);
+    ASSERT_RESULT_OK(file_contents);
+    ASSERT_RESULT_OK(WriteFile(tf.path, *file_contents + serialized_record));
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties_expected = {
+        {"persist.sys.locale", "pt-BR"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+    };
+
+    auto read_back_properties = LoadPersistentProperties();
+    CheckPropertiesEqual(persistent_properties_expected, read_back_properties);
+
+    // The partial record is dropped when the file is next written.
+    WritePersistentProperty("persist.sys.timezone", "Europe/Lisbon");
+
+    persistent_properties_expected = {
+        {"persist.sys.locale", "pt-BR"},
+        {"persist.sys.timezone", "Europe/Lisbon"},
+    };
+
+    auto persistent_property_file = LoadPersistentPropertyFile();
+    ASSERT_RESULT_OK(persistent_property_file);
+    CheckPropertiesEqual(persistent_properties_expected, *persistent_property_file);
+}
+
 }  // namespace init
 }  // namespace android
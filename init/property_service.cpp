@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/poll.h>
 #include <sys/select.h>
@@ -39,6 +40,8 @@
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
 
+#include <condition_variable>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -46,6 +49,7 @@
 #include <queue>
 #include <string_view>
 #include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include <InitProperties.sysprop.h>
@@ -109,10 +113,40 @@ static int from_init_socket = -1;
 static int init_socket = -1;
 static bool accept_messages = false;
 static std::mutex accept_messages_lock;
+// Serializes changes to the property area, and the persistent property writes that go with them.
+static std::mutex property_set_lock;
+// The AVC in libselinux is only thread safe with locking callbacks, which init doesn't set.
+// This also guards the access cache below.
+static std::mutex selinux_check_access_lock;
 static std::thread property_service_thread;
 
 static PropertyInfoAreaFile property_info_area;
 
+static int wake_property_service_fd = -1;
+static void InstallPropertyServiceNotifier(Epoll* epoll) {
+    wake_property_service_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_property_service_fd == -1) {
+        PLOG(FATAL) << "Failed to create eventfd for waking the property service";
+    }
+    auto clear_eventfd = [] {
+        uint64_t counter;
+        TEMP_FAILURE_RETRY(read(wake_property_service_fd, &counter, sizeof(counter)));
+    };
+
+    if (auto result = epoll->RegisterHandler(wake_property_service_fd, clear_eventfd);
+        !result.ok()) {
+        LOG(FATAL) << result.error();
+    }
+}
+
+static void WakePropertyServiceThread() {
+    if (wake_property_service_fd == -1) {
+        return;
+    }
+    uint64_t counter = 1;
+    TEMP_FAILURE_RETRY(write(wake_property_service_fd, &counter, sizeof(counter)));
+}
+
 struct PropertyAuditData {
     const ucred* cr;
     const char* name;
@@ -141,6 +175,101 @@ void StopSendingMessages() {
     accept_messages = false;
 }
 
+// Caches the selinux_check_access() decisions that allowed access, as most requests repeat a
+// (source context, target context) pair that was checked before. Denials aren't cached, so that
+// each of them is still audited. The cache is dropped whenever the policy is reloaded or the
+// enforcing mode changes.
+class SelinuxAccessCache {
+  public:
+    // Returns true if access is known to be allowed.
+    bool Lookup(const std::string& key) {
+        Revalidate();
+        if (allowed_.count(key)) {
+            hits_++;
+            return true;
+        }
+        misses_++;
+        return false;
+    }
+
+    void Insert(std::string key) {
+        if (!valid_) return;
+        if (allowed_.size() >= kMaxEntries) {
+            allowed_.clear();
+        }
+        allowed_.emplace(std::move(key));
+    }
+
+    void DumpState() const {
+        LOG(INFO) << "SELinux access cache: " << allowed_.size() << " entries, " << hits_
+                  << " hits, " << misses_ << " misses, " << invalidations_ << " invalidations";
+    }
+
+  private:
+    static constexpr size_t kMaxEntries = 4096;
+
+    void Revalidate() {
+        if (!status_opened_) {
+            status_opened_ = true;
+            // Fall back to netlink if the kernel doesn't provide the status page.
+            if (selinux_status_open(1) < 0) {
+                PLOG(ERROR) << "Unable to open SELinux status, not caching access decisions";
+                return;
+            }
+            valid_ = true;
+        }
+        if (!valid_) return;
+
+        int policyload = selinux_status_policyload();
+        int enforcing = selinux_status_getenforce();
+        if (policyload != policyload_ || enforcing != enforcing_) {
+            if (!allowed_.empty()) {
+                invalidations_++;
+            }
+            allowed_.clear();
+            policyload_ = policyload;
+            enforcing_ = enforcing;
+        }
+    }
+
+    std::unordered_set<std::string> allowed_;
+    bool status_opened_ = false;
+    bool valid_ = false;
+    int policyload_ = -1;
+    int enforcing_ = -1;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t invalidations_ = 0;
+};
+
+static SelinuxAccessCache selinux_access_cache;
+
+static int SelinuxCheckAccess(const char* source_context, const char* target_context,
+                              const char* tclass, const char* perm, void* audit_data) {
+    auto lock = std::lock_guard{selinux_check_access_lock};
+    if (!source_context || !target_context) {
+        return selinux_check_access(source_context, target_context, tclass, perm, audit_data);
+    }
+
+    // Contexts can't contain NUL, so it separates the fields unambiguously.
+    std::string key = std::string(source_context) + '\0' + target_context + '\0' + tclass + '\0' +
+                      perm;
+    if (selinux_access_cache.Lookup(key)) {
+        return 0;
+    }
+
+    int result = selinux_check_access(source_context, target_context, tclass, perm, audit_data);
+    if (result == 0) {
+        selinux_access_cache.Insert(std::move(key));
+    }
+    return result;
+}
+
+void DumpPropertyServiceState() {
+    auto lock = std::lock_guard{selinux_check_access_lock};
+    selinux_access_cache.DumpState();
+}
+
 bool CanReadProperty(const std::string& source_context, const std::string& name) {
     const char* target_context = nullptr;
     property_info_area->GetPropertyInfo(name.c_str(), &target_context, nullptr);
@@ -152,8 +281,8 @@ bool CanReadProperty(const std::string& source_context, const std::string& name)
     ucred cr = {.pid = 0, .uid = 0, .gid = 0};
     audit_data.cr = &cr;
 
-    return selinux_check_access(source_context.c_str(), target_context, "file", "read",
-                                &audit_data) == 0;
+    return SelinuxCheckAccess(source_context.c_str(), target_context, "file", "read",
+                              &audit_data) == 0;
 }
 
 static bool CheckMacPerms(const std::string& name, const char* target_context,
@@ -167,13 +296,14 @@ static bool CheckMacPerms(const std::string& name, const char* target_context,
     audit_data.name = name.c_str();
     audit_data.cr = &cr;
 
-    bool has_access = (selinux_check_access(source_context, target_context, "property_service",
-                                            "set", &audit_data) == 0);
+    bool has_access = (SelinuxCheckAccess(source_context, target_context, "property_service",
+                                          "set", &audit_data) == 0);
 
     return has_access;
 }
 
 static uint32_t PropertySet(const std::string& name, const std::string& value, std::string* error) {
+    auto property_set_guard = std::lock_guard{property_set_lock};
     size_t valuelen = value.size();
 
     if (!IsLegalPropertyName(name)) {
@@ -206,7 +336,12 @@ static uint32_t PropertySet(const std::string& name, const std::string& value, s
     // Don't write properties to disk until after we have read all default
     // properties to prevent them from being overwritten by default values.
     if (persistent_properties_loaded && StartsWith(name, "persist.")) {
+        bool sync_pending = PersistentPropertiesSyncTimeout().has_value();
         WritePersistentProperty(name, value);
+        // The property service thread may be waiting without a timeout.
+        if (!sync_pending && PersistentPropertiesSyncTimeout().has_value()) {
+            WakePropertyServiceThread();
+        }
     }
     // If init hasn't started its main loop, then it won't be handling property changed messages
     // anyway, so there's no need to try to send them.
@@ -477,14 +612,11 @@ uint32_t CheckPermissions(const std::string& name, const std::string& value,
     return PROP_SUCCESS;
 }
 
+// Handles a request that CheckPermissions() allowed.
 // This returns one of the enum of PROP_SUCCESS or PROP_ERROR*.
-uint32_t HandlePropertySet(const std::string& name, const std::string& value,
-                           const std::string& source_context, const ucred& cr,
-                           SocketConnection* socket, std::string* error) {
-    if (auto ret = CheckPermissions(name, value, source_context, cr, error); ret != PROP_SUCCESS) {
-        return ret;
-    }
-
+static uint32_t HandleCheckedPropertySet(const std::string& name, const std::string& value,
+                                         const ucred& cr, SocketConnection* socket,
+                                         std::string* error) {
     if (StartsWith(name, "ctl.")) {
         return SendControlMessage(name.c_str() + 4, value, cr.pid, socket, error);
     }
@@ -524,29 +656,29 @@ uint32_t HandlePropertySet(const std::string& name, const std::string& value,
     return PropertySet(name, value, error);
 }
 
-static void handle_property_set_fd() {
-    static constexpr uint32_t kDefaultSocketTimeout = 2000; /* ms */
-
-    int s = accept4(property_set_fd, nullptr, nullptr, SOCK_CLOEXEC);
-    if (s == -1) {
-        return;
+// This returns one of the enum of PROP_SUCCESS or PROP_ERROR*.
+uint32_t HandlePropertySet(const std::string& name, const std::string& value,
+                           const std::string& source_context, const ucred& cr,
+                           SocketConnection* socket, std::string* error) {
+    if (auto ret = CheckPermissions(name, value, source_context, cr, error); ret != PROP_SUCCESS) {
+        return ret;
     }
 
-    ucred cr;
-    socklen_t cr_size = sizeof(cr);
-    if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
-        close(s);
-        PLOG(ERROR) << "sys_prop: unable to get SO_PEERCRED";
-        return;
-    }
+    return HandleCheckedPropertySet(name, value, cr, socket, error);
+}
+
+// Receives and handles one request from |socket|. |wait_for_turn| is called with the name of the
+// property once the request has passed its permission checks, right before it is applied.
+static void HandlePropertySetConnection(
+        SocketConnection* socket, const std::function<void(const std::string&)>& wait_for_turn) {
+    static constexpr uint32_t kDefaultSocketTimeout = 2000; /* ms */
 
-    SocketConnection socket(s, cr);
     uint32_t timeout_ms = kDefaultSocketTimeout;
 
     uint32_t cmd = 0;
-    if (!socket.RecvUint32(&cmd, &timeout_ms)) {
+    if (!socket->RecvUint32(&cmd, &timeout_ms)) {
         PLOG(ERROR) << "sys_prop: error while reading command from the socket";
-        socket.SendUint32(PROP_ERROR_READ_CMD);
+        socket->SendUint32(PROP_ERROR_READ_CMD);
         return;
     }
 
@@ -555,8 +687,8 @@ static void handle_property_set_fd() {
         char prop_name[PROP_NAME_MAX];
         char prop_value[PROP_VALUE_MAX];
 
-        if (!socket.RecvChars(prop_name, PROP_NAME_MAX, &timeout_ms) ||
-            !socket.RecvChars(prop_value, PROP_VALUE_MAX, &timeout_ms)) {
+        if (!socket->RecvChars(prop_name, PROP_NAME_MAX, &timeout_ms) ||
+            !socket->RecvChars(prop_value, PROP_VALUE_MAX, &timeout_ms)) {
           PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP): error while reading name/value from the socket";
           return;
         }
@@ -565,15 +697,18 @@ static void handle_property_set_fd() {
         prop_value[PROP_VALUE_MAX-1] = 0;
 
         std::string source_context;
-        if (!socket.GetSourceContext(&source_context)) {
+        if (!socket->GetSourceContext(&source_context)) {
             PLOG(ERROR) << "Unable to set property '" << prop_name << "': getpeercon() failed";
             return;
         }
 
-        const auto& cr = socket.cred();
+        const auto& cr = socket->cred();
         std::string error;
-        uint32_t result =
-                HandlePropertySet(prop_name, prop_value, source_context, cr, nullptr, &error);
+        uint32_t result = CheckPermissions(prop_name, prop_value, source_context, cr, &error);
+        if (result == PROP_SUCCESS) {
+            wait_for_turn(prop_name);
+            result = HandleCheckedPropertySet(prop_name, prop_value, cr, nullptr, &error);
+        }
         if (result != PROP_SUCCESS) {
             LOG(ERROR) << "Unable to set property '" << prop_name << "' from uid:" << cr.uid
                        << " gid:" << cr.gid << " pid:" << cr.pid << ": " << error;
@@ -585,38 +720,142 @@ static void handle_property_set_fd() {
     case PROP_MSG_SETPROP2: {
         std::string name;
         std::string value;
-        if (!socket.RecvString(&name, &timeout_ms) ||
-            !socket.RecvString(&value, &timeout_ms)) {
+        if (!socket->RecvString(&name, &timeout_ms) ||
+            !socket->RecvString(&value, &timeout_ms)) {
           PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP2): error while reading name/value from the socket";
-          socket.SendUint32(PROP_ERROR_READ_DATA);
+          socket->SendUint32(PROP_ERROR_READ_DATA);
           return;
         }
 
         std::string source_context;
-        if (!socket.GetSourceContext(&source_context)) {
+        if (!socket->GetSourceContext(&source_context)) {
             PLOG(ERROR) << "Unable to set property '" << name << "': getpeercon() failed";
-            socket.SendUint32(PROP_ERROR_PERMISSION_DENIED);
+            socket->SendUint32(PROP_ERROR_PERMISSION_DENIED);
             return;
         }
 
-        const auto& cr = socket.cred();
+        const auto& cr = socket->cred();
         std::string error;
-        uint32_t result = HandlePropertySet(name, value, source_context, cr, &socket, &error);
+        uint32_t result = CheckPermissions(name, value, source_context, cr, &error);
+        if (result == PROP_SUCCESS) {
+            wait_for_turn(name);
+            result = HandleCheckedPropertySet(name, value, cr, socket, &error);
+        }
         if (result != PROP_SUCCESS) {
             LOG(ERROR) << "Unable to set property '" << name << "' from uid:" << cr.uid
                        << " gid:" << cr.gid << " pid:" << cr.pid << ": " << error;
         }
-        socket.SendUint32(result);
+        socket->SendUint32(result);
         break;
       }
 
     default:
         LOG(ERROR) << "sys_prop: invalid command " << cmd;
-        socket.SendUint32(PROP_ERROR_INVALID_CMD);
+        socket->SendUint32(PROP_ERROR_INVALID_CMD);
         break;
     }
 }
 
+// Handles setprop connections on a pool of threads, so that a slow client or a burst of requests
+// doesn't hold up every other client. Requests from the same process are applied in the order in
+// which their connections were accepted, and so are requests for the same property once their
+// names have been received. A request that is still being received only holds up later requests
+// from its own process: a client can't rely on the order of its request relative to another
+// process's before it has been replied to, so this doesn't change what clients can observe.
+class PropertySetWorkers {
+  public:
+    void Queue(int socket, const ucred& cr) {
+        auto guard = std::lock_guard{mutex_};
+        uint64_t id = next_id_++;
+        pending_.emplace(id, Pending{cr.pid, std::nullopt});
+        requests_.push({socket, cr, id});
+
+        if (idle_threads_ == 0 && num_threads_ < kMaxThreads) {
+            num_threads_++;
+            std::thread{&PropertySetWorkers::ThreadFunction, this}.detach();
+        }
+        requests_cv_.notify_one();
+    }
+
+  private:
+    static constexpr size_t kMaxThreads = 4;
+
+    struct Request {
+        int socket;
+        ucred cr;
+        uint64_t id;
+    };
+
+    // A request that has been accepted but not yet handled. |name| is set once it is known.
+    struct Pending {
+        pid_t pid;
+        std::optional<std::string> name;
+    };
+
+    void ThreadFunction() {
+        auto lock = std::unique_lock{mutex_};
+        while (true) {
+            idle_threads_++;
+            requests_cv_.wait(lock, [this] { return !requests_.empty(); });
+            idle_threads_--;
+
+            auto request = requests_.front();
+            requests_.pop();
+            lock.unlock();
+
+            {
+                SocketConnection socket(request.socket, request.cr);
+                HandlePropertySetConnection(&socket, [&](const std::string& name) {
+                    WaitForTurn(request.id, request.cr.pid, name);
+                });
+            }
+
+            lock.lock();
+            pending_.erase(request.id);
+            turn_cv_.notify_all();
+        }
+    }
+
+    void WaitForTurn(uint64_t id, pid_t pid, const std::string& name) {
+        auto lock = std::unique_lock{mutex_};
+        pending_[id].name = name;
+        turn_cv_.wait(lock, [&] {
+            for (const auto& [other_id, other] : pending_) {
+                if (other_id >= id) break;
+                if (other.pid == pid || other.name == name) return false;
+            }
+            return true;
+        });
+    }
+
+    std::mutex mutex_;
+    std::condition_variable requests_cv_;
+    std::condition_variable turn_cv_;
+    std::queue<Request> requests_;
+    std::map<uint64_t, Pending> pending_;
+    uint64_t next_id_ = 0;
+    size_t num_threads_ = 0;
+    size_t idle_threads_ = 0;
+};
+
+static void handle_property_set_fd() {
+    int s = accept4(property_set_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (s == -1) {
+        return;
+    }
+
+    ucred cr;
+    socklen_t cr_size = sizeof(cr);
+    if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
+        close(s);
+        PLOG(ERROR) << "sys_prop: unable to get SO_PEERCRED";
+        return;
+    }
+
+    static PropertySetWorkers property_set_workers;
+    property_set_workers.Queue(s, cr);
+}
+
 uint32_t InitPropertySet(const std::string& name, const std::string& value) {
     uint32_t result = 0;
     ucred cr = {.pid = 1, .uid = 0, .gid = 0};
@@ -1203,8 +1442,9 @@ void CreateSerializedPropertyInfo() {
 
     auto serialized_contexts = std::string();
     auto error = std::string();
+    // Every process looks properties up in this, so lay it out for few cache misses.
     if (!BuildTrie(property_infos, "u:object_r:default_prop:s0", "string", &serialized_contexts,
-                   &error)) {
+                   &error, android::properties::TrieLayout::kBreadthFirst)) {
         LOG(ERROR) << "Unable to serialize property contexts: " << error;
         return;
     }
@@ -1332,6 +1572,7 @@ static void HandleInitSocket() {
                                 persistent_property_record.value());
             }
             InitPropertySet("ro.persistent_properties.ready", "true");
+            auto property_set_guard = std::lock_guard{property_set_lock};
             persistent_properties_loaded = true;
             break;
         }
@@ -1355,8 +1596,15 @@ static void PropertyServiceThread() {
         LOG(FATAL) << result.error();
     }
 
+    InstallPropertyServiceNotifier(&epoll);
+
     while (true) {
-        auto pending_functions = epoll.Wait(std::nullopt);
+        std::optional<std::chrono::milliseconds> timeout;
+        {
+            auto property_set_guard = std::lock_guard{property_set_lock};
+            timeout = PersistentPropertiesSyncTimeout();
+        }
+        auto pending_functions = epoll.Wait(timeout);
         if (!pending_functions.ok()) {
             LOG(ERROR) << pending_functions.error();
         } else {
@@ -1364,6 +1612,10 @@ static void PropertyServiceThread() {
                 (*function)();
             }
         }
+        {
+            auto property_set_guard = std::lock_guard{property_set_lock};
+            SyncPersistentProperties();
+        }
     }
 }
 
@@ -29,11 +29,16 @@ static constexpr const char kRestoreconProperty[] = "selinux.restorecon_recursiv
 
 bool CanReadProperty(const std::string& source_context, const std::string& name);
 
+// Sets a property from within init without going through the property service socket.
+uint32_t InitPropertySet(const std::string& name, const std::string& value);
+
 void PropertyInit();
 void StartPropertyService(int* epoll_socket);
 
 void StartSendingMessages();
 void StopSendingMessages();
 
+void DumpPropertyServiceState();
+
 }  // namespace init
 }  // namespace android
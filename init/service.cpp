@@ -32,6 +32,7 @@
 #include <android-base/scopeguard.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <cutils/boot_events.h>
 #include <cutils/sockets.h>
 #include <processgroup/processgroup.h>
 #include <selinux/selinux.h>
@@ -45,6 +46,7 @@
 #include <android/api-level.h>
 
 #include "mount_namespace.h"
+#include "property_service.h"
 #include "reboot_utils.h"
 #include "selinux.h"
 #else
@@ -159,6 +161,16 @@ Service::Service(const std::string& name, unsigned flags, uid_t uid, gid_t gid,
       args_(args),
       from_apex_(from_apex) {}
 
+// Services change state in bursts, e.g. when many of them exit together, so in init itself, set
+// their properties directly rather than with a round trip through the property service socket.
+static void SetStateProperty(const std::string& name, const std::string& value) {
+    if (getpid() == 1) {
+        InitPropertySet(name, value);
+    } else {
+        SetProperty(name, value);
+    }
+}
+
 void Service::NotifyStateChange(const std::string& new_state) const {
     if ((flags_ & SVC_TEMPORARY) != 0) {
         // Services created by 'exec' are temporary and don't have properties tracking their state.
@@ -166,13 +178,13 @@ void Service::NotifyStateChange(const std::string& new_state) const {
     }
 
     std::string prop_name = "init.svc." + name_;
-    SetProperty(prop_name, new_state);
+    SetStateProperty(prop_name, new_state);
 
     if (new_state == "running") {
         uint64_t start_ns = time_started_.time_since_epoch().count();
         std::string boottime_property = "ro.boottime." + name_;
         if (GetProperty(boottime_property, "").empty()) {
-            SetProperty(boottime_property, std::to_string(start_ns));
+            SetStateProperty(boottime_property, std::to_string(start_ns));
         }
     }
 
@@ -180,9 +192,9 @@ void Service::NotifyStateChange(const std::string& new_state) const {
     // on device for security checks.
     std::string pid_property = "init.svc_debug_pid." + name_;
     if (new_state == "running") {
-        SetProperty(pid_property, std::to_string(pid_));
+        SetStateProperty(pid_property, std::to_string(pid_));
     } else if (new_state == "stopped") {
-        SetProperty(pid_property, "");
+        SetStateProperty(pid_property, "");
     }
 }
 
@@ -477,9 +489,11 @@ void Service::ConfigureMemcg() {
 
 // Enters namespaces, sets environment variables, writes PID files and runs the service executable.
 void Service::RunService(const std::optional<MountNamespace>& override_mount_namespace,
-                         const std::vector<Descriptor>& descriptors,
+                         int mount_namespace_template, const std::vector<Descriptor>& descriptors,
                          std::unique_ptr<std::array<int, 2>, decltype(&ClosePipe)> pipefd) {
-    if (auto result = EnterNamespaces(namespaces_, name_, override_mount_namespace); !result.ok()) {
+    if (auto result = EnterNamespaces(namespaces_, name_, override_mount_namespace,
+                                      mount_namespace_template);
+        !result.ok()) {
         LOG(FATAL) << "Service '" << name_ << "' failed to set up namespaces: " << result.error();
     }
 
@@ -626,6 +640,13 @@ Result<void> Service::Start() {
         }
     }
 
+    // Set up once per namespace configuration, so that restarting a service doesn't remount /sys.
+    int mount_namespace_template = GetMountNamespaceTemplate(namespaces_, override_mount_namespace);
+
+    // A full fork() is still used here: the child blocks on 'pipefd' until the cgroups below have
+    // been created, and it calls setenv(), logs, etc. before exec, all of which rule out
+    // vfork()-style sharing of init's address space.
+    auto spawn_start = boot_clock::now();
     pid_t pid = -1;
     if (namespaces_.flags) {
         pid = clone(nullptr, nullptr, namespaces_.flags | SIGCHLD, nullptr);
@@ -635,7 +656,8 @@ Result<void> Service::Start() {
 
     if (pid == 0) {
         umask(077);
-        RunService(override_mount_namespace, descriptors, std::move(pipefd));
+        RunService(override_mount_namespace, mount_namespace_template, descriptors,
+                   std::move(pipefd));
         _exit(127);
     }
 
@@ -643,6 +665,7 @@ Result<void> Service::Start() {
         pid_ = 0;
         return ErrnoError() << "Failed to fork";
     }
+    auto fork_duration = boot_clock::now() - spawn_start;
 
     if (oom_score_adjust_ != DEFAULT_OOM_SCORE_ADJUST) {
         std::string oom_str = std::to_string(oom_score_adjust_);
@@ -654,6 +677,7 @@ Result<void> Service::Start() {
 
     time_started_ = boot_clock::now();
     pid_ = pid;
+    boot_event_instant("service", name_.c_str());
     flags_ |= SVC_RUNNING;
     start_order_ = next_start_order_++;
     process_cgroup_empty_ = false;
@@ -681,6 +705,11 @@ Result<void> Service::Start() {
         return ErrnoError() << "sending notification failed";
     }
 
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    LOG(VERBOSE) << "service '" << name_ << "' (pid " << pid_ << ") forked in "
+                 << Milliseconds(fork_duration).count() << "ms, started in "
+                 << Milliseconds(boot_clock::now() - spawn_start).count() << "ms";
+
     NotifyStateChange("running");
     reboot_on_failure.Disable();
     return {};
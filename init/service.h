@@ -153,7 +153,7 @@ class Service {
     void ConfigureMemcg();
     void RunService(
             const std::optional<MountNamespace>& override_mount_namespace,
-            const std::vector<Descriptor>& descriptors,
+            int mount_namespace_template, const std::vector<Descriptor>& descriptors,
             std::unique_ptr<std::array<int, 2>, void (*)(const std::array<int, 2>* pipe)> pipefd);
 
     static unsigned long next_start_order_;
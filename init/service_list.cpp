@@ -60,6 +60,28 @@ void ServiceList::RemoveService(const Service& svc) {
     }
 
     services_.erase(svc_it);
+    services_by_pid_.clear();
+}
+
+Service* ServiceList::FindServiceByPid(pid_t pid) {
+    if (pid <= 0) {
+        return nullptr;
+    }
+
+    auto it = services_by_pid_.find(pid);
+    if (it == services_by_pid_.end() || it->second->pid() != pid) {
+        services_by_pid_.clear();
+        for (const auto& service : services_) {
+            if (service->pid() > 0) {
+                services_by_pid_.emplace(service->pid(), service.get());
+            }
+        }
+        it = services_by_pid_.find(pid);
+        if (it == services_by_pid_.end()) {
+            return nullptr;
+        }
+    }
+    return it->second;
 }
 
 void ServiceList::DumpState() const {
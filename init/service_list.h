@@ -17,6 +17,7 @@
 #pragma once
 
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "service.h"
@@ -38,6 +39,7 @@ class ServiceList {
     void RemoveServiceIf(UnaryPredicate predicate) {
         services_.erase(std::remove_if(services_.begin(), services_.end(), predicate),
                         services_.end());
+        services_by_pid_.clear();
     }
 
     template <typename T, typename F = decltype(&Service::name)>
@@ -52,6 +54,10 @@ class ServiceList {
         return nullptr;
     }
 
+    // Like FindService(pid, &Service::pid), but with an index, since this is done each time a
+    // child process is reaped.
+    Service* FindServiceByPid(pid_t pid);
+
     Service* FindInterface(const std::string& interface_name) {
         for (const auto& svc : services_) {
             if (svc->interfaces().count(interface_name) > 0) {
@@ -81,6 +87,8 @@ class ServiceList {
 
   private:
     std::vector<std::unique_ptr<Service>> services_;
+    // Rebuilt on a miss, since services change their pids without telling the list.
+    std::unordered_map<pid_t, Service*> services_by_pid_;
 
     bool post_data_ = false;
     bool services_update_finished_ = false;
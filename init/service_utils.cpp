@@ -21,6 +21,7 @@
 #include <map>
 #include <sys/mount.h>
 #include <sys/prctl.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -92,6 +93,113 @@ Result<void> SetUpMountNamespace(bool remount_proc, bool remount_sys) {
     return {};
 }
 
+// A mount namespace can only be shared between services if it doesn't depend on the service
+// itself. /proc has to be mounted from within the service's own PID namespace, so only mount
+// namespaces that merely remount /sys for a network namespace are shared.
+bool CanUseMountNamespaceTemplate(const NamespaceInfo& info) {
+    if (!(info.flags & CLONE_NEWNS) || (info.flags & CLONE_NEWPID)) {
+        return false;
+    }
+    bool enters_net_namespace = false;
+    for (const auto& [nstype, path] : info.namespaces_to_enter) {
+        if (nstype == CLONE_NEWNS) return false;
+        if (nstype == CLONE_NEWNET) enters_net_namespace = true;
+    }
+    return enters_net_namespace;
+}
+
+// Identifies the namespaces a template is created from, so that a template isn't reused once
+// init has switched mount namespaces or a namespace path has been replaced.
+Result<std::string> GetMountNamespaceTemplateKey(
+        const NamespaceInfo& info, std::optional<MountNamespace> override_mount_namespace) {
+    struct stat sb;
+    if (stat("/proc/self/ns/mnt", &sb) == -1) {
+        return ErrnoError() << "Could not stat /proc/self/ns/mnt";
+    }
+    std::string key = StringPrintf("mnt:%llu", static_cast<unsigned long long>(sb.st_ino));
+    if (override_mount_namespace.has_value()) {
+        key += StringPrintf(" override:%d", override_mount_namespace.value());
+    }
+    for (const auto& [nstype, path] : info.namespaces_to_enter) {
+        if (stat(path.c_str(), &sb) == -1) {
+            return ErrnoError() << "Could not stat namespace at " << path;
+        }
+        key += StringPrintf(" %d:%s:%llu", nstype, path.c_str(),
+                            static_cast<unsigned long long>(sb.st_ino));
+    }
+    return key;
+}
+
+// Forks a process that sets up a mount namespace the way EnterNamespaces() does, and keeps a
+// reference to that namespace once it is set up.
+Result<unique_fd> CreateMountNamespaceTemplate(
+        const NamespaceInfo& info, std::optional<MountNamespace> override_mount_namespace) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        return ErrnoError() << "Could not create pipe";
+    }
+    unique_fd read_fd(pipe_fds[0]);
+    unique_fd write_fd(pipe_fds[1]);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        return ErrnoError() << "Could not fork";
+    }
+
+    if (pid == 0) {
+        read_fd.reset();
+        auto result = [&]() -> Result<void> {
+            for (const auto& [nstype, path] : info.namespaces_to_enter) {
+                if (auto result = EnterNamespace(nstype, path.c_str()); !result.ok()) {
+                    return result;
+                }
+            }
+#if defined(__ANDROID__)
+            if (override_mount_namespace.has_value()) {
+                if (auto result = SwitchToMountNamespaceIfNeeded(override_mount_namespace.value());
+                    !result.ok()) {
+                    return result;
+                }
+            }
+#endif
+            if (unshare(CLONE_NEWNS) == -1) {
+                return ErrnoError() << "Could not unshare mount namespace";
+            }
+            return SetUpMountNamespace(false, true);
+        }();
+        if (!result.ok()) {
+            LOG(ERROR) << "Could not set up mount namespace template: " << result.error();
+        }
+        char status = result.ok();
+        if (TEMP_FAILURE_RETRY(write(write_fd, &status, 1)) != 1 || !status) {
+            _exit(EXIT_FAILURE);
+        }
+        // Stay alive until the parent has opened the namespace and kills us.
+        while (true) pause();
+    }
+
+    write_fd.reset();
+    auto path = StringPrintf("/proc/%d/ns/mnt", pid);
+    char status = 0;
+    unique_fd fd;
+    int saved_errno = 0;
+    if (TEMP_FAILURE_RETRY(read(read_fd, &status, 1)) == 1 && status) {
+        fd.reset(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        saved_errno = errno;
+    }
+    kill(pid, SIGKILL);
+    TEMP_FAILURE_RETRY(waitpid(pid, nullptr, 0));
+
+    if (!status) {
+        return Error() << "Could not set up mount namespace";
+    }
+    if (fd == -1) {
+        errno = saved_errno;
+        return ErrnoError() << "Could not open " << path;
+    }
+    return std::move(fd);
+}
+
 Result<void> SetUpPidNamespace(const char* name) {
     if (prctl(PR_SET_NAME, name) == -1) {
         return ErrnoError() << "Could not set name";
@@ -194,8 +302,34 @@ Result<Descriptor> FileDescriptor::Create() const {
     return Descriptor(ANDROID_FILE_ENV_PREFIX + name, std::move(fd));
 }
 
+int GetMountNamespaceTemplate(const NamespaceInfo& info,
+                              std::optional<MountNamespace> override_mount_namespace) {
+    static std::map<std::string, unique_fd> templates;
+
+    if (!CanUseMountNamespaceTemplate(info)) {
+        return -1;
+    }
+
+    auto key = GetMountNamespaceTemplateKey(info, override_mount_namespace);
+    if (!key.ok()) {
+        LOG(WARNING) << "Not using a mount namespace template: " << key.error();
+        return -1;
+    }
+    if (auto it = templates.find(*key); it != templates.end()) {
+        return it->second.get();
+    }
+
+    auto fd = CreateMountNamespaceTemplate(info, override_mount_namespace);
+    if (!fd.ok()) {
+        LOG(WARNING) << "Not using a mount namespace template: " << fd.error();
+        return -1;
+    }
+    return templates.emplace(*key, std::move(*fd)).first->second.get();
+}
+
 Result<void> EnterNamespaces(const NamespaceInfo& info, const std::string& name,
-                             std::optional<MountNamespace> override_mount_namespace) {
+                             std::optional<MountNamespace> override_mount_namespace,
+                             int mount_namespace_template) {
     for (const auto& [nstype, path] : info.namespaces_to_enter) {
         if (auto result = EnterNamespace(nstype, path.c_str()); !result.ok()) {
             return result;
@@ -211,7 +345,16 @@ Result<void> EnterNamespaces(const NamespaceInfo& info, const std::string& name,
     }
 #endif
 
-    if (info.flags & CLONE_NEWNS) {
+    if ((info.flags & CLONE_NEWNS) && mount_namespace_template != -1) {
+        // Copy the template rather than joining it, so that the service still gets a mount
+        // namespace of its own. The copy keeps the template's MS_SLAVE propagation.
+        if (setns(mount_namespace_template, CLONE_NEWNS) == -1) {
+            return ErrnoError() << "Could not setns() mount namespace template";
+        }
+        if (unshare(CLONE_NEWNS) == -1) {
+            return ErrnoError() << "Could not unshare mount namespace template";
+        }
+    } else if (info.flags & CLONE_NEWNS) {
         bool remount_proc = info.flags & CLONE_NEWPID;
         bool remount_sys =
                 std::any_of(info.namespaces_to_enter.begin(), info.namespaces_to_enter.end(),
@@ -74,8 +74,15 @@ struct NamespaceInfo {
     // Pair of namespace type, path to name.
     std::vector<std::pair<int, std::string>> namespaces_to_enter;
 };
+// Returns a mount namespace already set up the way EnterNamespaces() would for |info|, which
+// services with the same configuration copy when they start instead of remounting /sys again.
+// Returns -1 if |info| can't share a mount namespace, or the template couldn't be created.
+// Templates are created on first use and owned by init; this must only be called from init.
+int GetMountNamespaceTemplate(const NamespaceInfo& info,
+                              std::optional<MountNamespace> override_mount_namespace);
 Result<void> EnterNamespaces(const NamespaceInfo& info, const std::string& name,
-                             std::optional<MountNamespace> override_mount_namespace);
+                             std::optional<MountNamespace> override_mount_namespace,
+                             int mount_namespace_template = -1);
 
 struct ProcessAttributes {
     std::string console;
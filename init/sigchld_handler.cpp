@@ -16,9 +16,11 @@
 
 #include "sigchld_handler.h"
 
+#include <poll.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -27,7 +29,9 @@
 #include <android-base/logging.h>
 #include <android-base/scopeguard.h>
 #include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
 
+#include <map>
 #include <thread>
 
 #include "init.h"
@@ -38,6 +42,7 @@ using android::base::boot_clock;
 using android::base::make_scope_guard;
 using android::base::StringPrintf;
 using android::base::Timer;
+using android::base::unique_fd;
 
 namespace android {
 namespace init {
@@ -67,7 +72,7 @@ static pid_t ReapOneProcess() {
     if (SubcontextChildReap(pid)) {
         name = "Subcontext";
     } else {
-        service = ServiceList::GetInstance().FindService(pid, &Service::pid);
+        service = ServiceList::GetInstance().FindServiceByPid(pid);
 
         if (service) {
             name = StringPrintf("Service '%s' (pid %d)", service->name().c_str(), pid);
@@ -116,19 +121,34 @@ void ReapAnyOutstandingChildren() {
 
 void WaitToBeReaped(const std::vector<pid_t>& pids, std::chrono::milliseconds timeout) {
     Timer t;
-    std::vector<pid_t> alive_pids(pids.begin(), pids.end());
+    std::map<pid_t, unique_fd> alive_pids;
+    for (pid_t pid : pids) {
+        alive_pids.emplace(pid, unique_fd(syscall(__NR_pidfd_open, pid, 0)));
+    }
     while (!alive_pids.empty() && t.duration() < timeout) {
         pid_t pid;
         while ((pid = ReapOneProcess()) != 0) {
-            auto it = std::find(alive_pids.begin(), alive_pids.end(), pid);
-            if (it != alive_pids.end()) {
-                alive_pids.erase(it);
-            }
+            alive_pids.erase(pid);
         }
         if (alive_pids.empty()) {
             break;
         }
-        std::this_thread::sleep_for(50ms);
+
+        // A pidfd becomes readable as soon as its process exits, so wait on those rather than
+        // polling. Fall back to polling if there is any pid that we couldn't open a pidfd for,
+        // e.g. on kernels older than 5.3.
+        std::vector<pollfd> pidfds;
+        auto wait_time = timeout - t.duration();
+        for (const auto& [alive_pid, pidfd] : alive_pids) {
+            if (pidfd == -1) {
+                wait_time = std::min<std::chrono::milliseconds>(wait_time, 50ms);
+                continue;
+            }
+            pidfds.push_back({.fd = pidfd.get(), .events = POLLIN});
+        }
+        if (wait_time > 0ms) {
+            TEMP_FAILURE_RETRY(poll(pidfds.data(), pidfds.size(), wait_time.count()));
+        }
     }
     LOG(INFO) << "Waiting for " << pids.size() << " pids to be reaped took " << t << " with "
               << alive_pids.size() << " of them still running";
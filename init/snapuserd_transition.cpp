@@ -32,6 +32,7 @@
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
+#include <cutils/boot_events.h>
 #include <cutils/sockets.h>
 #include <fs_avb/fs_avb.h>
 #include <libsnapshot/snapshot.h>
@@ -77,6 +78,7 @@ void LaunchFirstStageSnapuserd(SnapshotDriver driver) {
         LOG(FATAL) << "Could not create snapuserd socket: " << socket.error();
     }
 
+    boot_event_begin("init", "snapuserd_launch");
     pid_t pid = fork();
     if (pid < 0) {
         PLOG(FATAL) << "Cannot launch snapuserd; fork failed";
@@ -106,6 +108,7 @@ void LaunchFirstStageSnapuserd(SnapshotDriver driver) {
     if (!client) {
         LOG(FATAL) << "Could not connect to first-stage snapuserd";
     }
+    boot_event_end("init", "snapuserd_launch");
     if (client->SupportsSecondStageSocketHandoff()) {
         setenv(kSnapuserdFirstStageInfoVar, "socket", 1);
     }
@@ -22,6 +22,7 @@
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
@@ -49,6 +50,7 @@ using android::base::Join;
 using android::base::Socketpair;
 using android::base::Split;
 using android::base::StartsWith;
+using android::base::Timer;
 using android::base::unique_fd;
 
 namespace android {
@@ -59,6 +61,21 @@ std::string shutdown_command;
 static bool subcontext_terminated_by_shutdown;
 static std::unique_ptr<Subcontext> subcontext;
 
+// A batch returns to init once it has run for this long, so that init's main loop isn't held up
+// for longer than it would be by a single slow command.
+constexpr std::chrono::milliseconds kMaxBatchDuration = 50ms;
+
+template <typename T>
+void SetCommandResult(const Result<void>& result, T* reply) {
+    if (result.ok()) {
+        reply->set_success(true);
+    } else {
+        auto* failure = reply->mutable_failure();
+        failure->set_error_string(result.error().message());
+        failure->set_error_errno(result.error().code());
+    }
+}
+
 class SubcontextProcess {
   public:
     SubcontextProcess(const BuiltinFunctionMap* function_map, std::string context, int init_fd)
@@ -66,8 +83,9 @@ class SubcontextProcess {
     void MainLoop();
 
   private:
-    void RunCommand(const SubcontextCommand::ExecuteCommand& execute_command,
-                    SubcontextReply* reply) const;
+    Result<void> RunCommand(const SubcontextCommand::ExecuteCommand& execute_command) const;
+    void RunCommands(const SubcontextCommand::ExecuteBatchCommand& execute_batch_command,
+                     SubcontextReply* reply) const;
     void ExpandArgs(const SubcontextCommand::ExpandArgsCommand& expand_args_command,
                     SubcontextReply* reply) const;
 
@@ -76,8 +94,8 @@ class SubcontextProcess {
     const int init_fd_;
 };
 
-void SubcontextProcess::RunCommand(const SubcontextCommand::ExecuteCommand& execute_command,
-                                   SubcontextReply* reply) const {
+Result<void> SubcontextProcess::RunCommand(
+        const SubcontextCommand::ExecuteCommand& execute_command) const {
     // Need to use ArraySplice instead of this code.
     auto args = std::vector<std::string>();
     for (const auto& string : execute_command.args()) {
@@ -85,19 +103,31 @@ void SubcontextProcess::RunCommand(const SubcontextCommand::ExecuteCommand& exec
     }
 
     auto map_result = function_map_->Find(args);
-    Result<void> result;
     if (!map_result.ok()) {
-        result = Error() << "Cannot find command: " << map_result.error();
-    } else {
-        result = RunBuiltinFunction(map_result->function, args, context_);
+        return Error() << "Cannot find command: " << map_result.error();
     }
+    return RunBuiltinFunction(map_result->function, args, context_);
+}
 
-    if (result.ok()) {
-        reply->set_success(true);
-    } else {
-        auto* failure = reply->mutable_failure();
-        failure->set_error_string(result.error().message());
-        failure->set_error_errno(result.error().code());
+void SubcontextProcess::RunCommands(
+        const SubcontextCommand::ExecuteBatchCommand& execute_batch_command,
+        SubcontextReply* reply) const {
+    Timer t;
+    auto* execute_batch_reply = reply->mutable_execute_batch_reply();
+    for (const auto& execute_command : execute_batch_command.commands()) {
+        Timer command_timer;
+        auto result = RunCommand(execute_command);
+
+        auto* command_result = execute_batch_reply->add_results();
+        SetCommandResult(result, command_result);
+        command_result->set_duration_ms(command_timer.duration().count());
+
+        // Let init handle a shutdown before running anything else, as it would between separate
+        // commands, and leave room in the reply for another result.
+        if (!shutdown_command.empty() || t.duration() >= kMaxBatchDuration ||
+            reply->ByteSizeLong() > kBufferSize / 2) {
+            break;
+        }
     }
 }
 
@@ -149,7 +179,11 @@ void SubcontextProcess::MainLoop() {
         auto reply = SubcontextReply();
         switch (subcontext_command.command_case()) {
             case SubcontextCommand::kExecuteCommand: {
-                RunCommand(subcontext_command.execute_command(), &reply);
+                SetCommandResult(RunCommand(subcontext_command.execute_command()), &reply);
+                break;
+            }
+            case SubcontextCommand::kExecuteBatchCommand: {
+                RunCommands(subcontext_command.execute_batch_command(), &reply);
                 break;
             }
             case SubcontextCommand::kExpandArgsCommand: {
@@ -308,6 +342,52 @@ Result<void> Subcontext::Execute(const std::vector<std::string>& args) {
     return {};
 }
 
+Result<std::vector<SubcontextCommandResult>> Subcontext::ExecuteBatch(
+        const std::vector<std::vector<std::string>>& commands) {
+    auto subcontext_command = SubcontextCommand();
+    auto* execute_batch_command = subcontext_command.mutable_execute_batch_command();
+    for (const auto& args : commands) {
+        auto* execute_command = execute_batch_command->add_commands();
+        std::copy(args.begin(), args.end(),
+                  RepeatedPtrFieldBackInserter(execute_command->mutable_args()));
+        // Leave the commands that don't fit in one message for the next batch.
+        if (execute_batch_command->commands_size() > 1 &&
+            subcontext_command.ByteSizeLong() > kBufferSize) {
+            execute_batch_command->mutable_commands()->RemoveLast();
+            break;
+        }
+    }
+
+    auto subcontext_reply = TransmitMessage(subcontext_command);
+    if (!subcontext_reply.ok()) {
+        return subcontext_reply.error();
+    }
+
+    if (subcontext_reply->reply_case() != SubcontextReply::kExecuteBatchReply) {
+        return Error() << "Unexpected message type from subcontext: "
+                       << subcontext_reply->reply_case();
+    }
+
+    auto& reply = subcontext_reply->execute_batch_reply();
+    if (reply.results_size() == 0 || reply.results_size() > execute_batch_command->commands_size()) {
+        return Error() << "Unexpected number of results from subcontext: " << reply.results_size();
+    }
+
+    using CommandResult = SubcontextReply::ExecuteBatchReply::CommandResult;
+    auto results = std::vector<SubcontextCommandResult>{};
+    for (const auto& command_result : reply.results()) {
+        auto duration = std::chrono::milliseconds(command_result.duration_ms());
+        if (command_result.result_case() == CommandResult::kFailure) {
+            auto& failure = command_result.failure();
+            results.push_back({ResultError<>(failure.error_string(), failure.error_errno()),
+                               duration});
+        } else {
+            results.push_back({{}, duration});
+        }
+    }
+    return results;
+}
+
 Result<std::vector<std::string>> Subcontext::ExpandArgs(const std::vector<std::string>& args) {
     auto subcontext_command = SubcontextCommand{};
     std::copy(args.begin(), args.end(),
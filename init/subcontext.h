@@ -18,6 +18,7 @@
 
 #include <signal.h>
 
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -34,6 +35,11 @@ static constexpr const char kInitContext[] = "u:r:init:s0";
 static constexpr const char kVendorContext[] = "u:r:vendor_init:s0";
 static constexpr const char kTestContext[] = "test-test-test";
 
+struct SubcontextCommandResult {
+    Result<void> result;
+    std::chrono::milliseconds duration;
+};
+
 class Subcontext {
   public:
     Subcontext(std::vector<std::string> path_prefixes, std::string context, bool host = false)
@@ -44,6 +50,11 @@ class Subcontext {
     }
 
     Result<void> Execute(const std::vector<std::string>& args);
+    // Executes several commands in a single round trip. The subcontext may stop before the end of
+    // |commands|, e.g. once a command triggers a shutdown, so this returns the results of only the
+    // commands that were run, in order; it always runs at least one.
+    Result<std::vector<SubcontextCommandResult>> ExecuteBatch(
+            const std::vector<std::vector<std::string>>& commands);
     Result<std::vector<std::string>> ExpandArgs(const std::vector<std::string>& args);
     void Restart();
     bool PathMatchesSubcontext(const std::string& path);
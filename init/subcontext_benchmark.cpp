@@ -48,6 +48,44 @@ static void BenchmarkSuccess(benchmark::State& state) {
 
 BENCHMARK(BenchmarkSuccess);
 
+// Runs state.range(0) commands per iteration in a single round trip, to compare against running
+// them with BenchmarkSuccess one at a time.
+static void BenchmarkBatch(benchmark::State& state) {
+    if (getuid() != 0) {
+        state.SkipWithError("Skipping benchmark, must be run as root.");
+        return;
+    }
+    char* context;
+    if (getcon(&context) != 0) {
+        state.SkipWithError("getcon() failed");
+        return;
+    }
+
+    auto subcontext = Subcontext({"path"}, context);
+    free(context);
+
+    auto commands = std::vector<std::vector<std::string>>(state.range(0), {"return_success"});
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < commands.size();) {
+            auto results = subcontext.ExecuteBatch(
+                    std::vector<std::vector<std::string>>(commands.begin() + i, commands.end()));
+            if (!results.ok()) {
+                state.SkipWithError("ExecuteBatch() failed");
+                break;
+            }
+            i += results->size();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+
+    if (subcontext.pid() > 0) {
+        kill(subcontext.pid(), SIGTERM);
+        kill(subcontext.pid(), SIGKILL);
+    }
+}
+
+BENCHMARK(BenchmarkBatch)->Arg(1)->Arg(8)->Arg(32);
+
 BuiltinFunctionMap BuildTestFunctionMap() {
     auto function = [](const BuiltinArguments& args) { return Result<void>{}; };
     BuiltinFunctionMap test_function_map = {
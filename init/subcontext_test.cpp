@@ -148,6 +148,46 @@ TEST(subcontext, TriggerShutdown) {
     EXPECT_EQ(kTestShutdownCommand, trigger_shutdown_command);
 }
 
+TEST(subcontext, ExecuteBatch) {
+    RunTest([](auto& subcontext) {
+        auto first_pid = subcontext.pid();
+
+        auto commands = std::vector<std::vector<std::string>>{
+                {"add_word", "batched"},
+                {"generate_sane_error"},
+                {"add_word", "words"},
+                {"return_words_as_error"},
+        };
+        auto results = subcontext.ExecuteBatch(commands);
+        ASSERT_RESULT_OK(results);
+        ASSERT_EQ(4U, results->size());
+        ASSERT_RESULT_OK((*results)[0].result);
+        ASSERT_FALSE((*results)[1].result.ok());
+        EXPECT_EQ("Sane error!", (*results)[1].result.error().message());
+        ASSERT_RESULT_OK((*results)[2].result);
+        ASSERT_FALSE((*results)[3].result.ok());
+        EXPECT_EQ("batched words", (*results)[3].result.error().message());
+        EXPECT_EQ(first_pid, subcontext.pid());
+    });
+}
+
+TEST(subcontext, ExecuteBatchStopsAtShutdown) {
+    static constexpr const char kTestShutdownCommand[] = "reboot,test-shutdown-command";
+    static std::string trigger_shutdown_command;
+    trigger_shutdown = [](const std::string& command) { trigger_shutdown_command = command; };
+    RunTest([](auto& subcontext) {
+        auto commands = std::vector<std::vector<std::string>>{
+                {"trigger_shutdown", kTestShutdownCommand},
+                {"generate_sane_error"},
+        };
+        auto results = subcontext.ExecuteBatch(commands);
+        ASSERT_RESULT_OK(results);
+        ASSERT_EQ(1U, results->size());
+        ASSERT_RESULT_OK((*results)[0].result);
+    });
+    EXPECT_EQ(kTestShutdownCommand, trigger_shutdown_command);
+}
+
 TEST(subcontext, ExpandArgs) {
     RunTest([](auto& subcontext) {
         auto args = std::vector<std::string>{
@@ -28,12 +28,18 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
 #include <set>
 #include <thread>
+#include <vector>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <cutils/boot_events.h>
 #include <fstab/fstab.h>
 #include <selinux/android.h>
 #include <selinux/selinux.h>
@@ -100,7 +106,11 @@
 //    subprocess handlers to complete and exit.  Once this happens, it marks coldboot as having
 //    completed.
 //
-// At this point, ueventd is single threaded, poll()'s and then handles any future uevents.
+// At this point, ueventd poll()'s and then handles any future uevents.  By default it does so on a
+// single thread.  With `parallel_uevent_handling enabled`, the uevents are instead sharded by
+// devpath onto a set of worker threads (see UeventDispatcher below), so that uevents for one
+// device are still handled in order, but a slow uevent, such as one that triggers a recursive
+// restorecon or a module load, doesn't hold up uevents for unrelated devices.
 
 // Lastly, it should be noted that uevents that occur during the coldboot process are handled
 // without issue after the coldboot process completes.  This is because the uevent listener is
@@ -268,6 +278,7 @@ void ColdBoot::WaitForSubProcesses() {
 
 void ColdBoot::Run() {
     android::base::Timer cold_boot_timer;
+    boot_event_begin("ueventd", "coldboot");
 
     RegenerateUevents();
 
@@ -292,10 +303,61 @@ void ColdBoot::Run() {
 
     WaitForSubProcesses();
 
+    boot_event_end("ueventd", "coldboot");
     android::base::SetProperty(kColdBootDoneProp, "true");
     LOG(INFO) << "Coldboot took " << cold_boot_timer.duration().count() / 1000.0f << " seconds";
 }
 
+// Handles uevents after coldboot on a fixed set of threads. Each uevent goes to the thread picked
+// by a hash of its devpath, so uevents for the same device are handled in the order they arrived.
+class UeventDispatcher {
+  public:
+    UeventDispatcher(std::vector<std::unique_ptr<UeventHandler>>& uevent_handlers,
+                     unsigned int num_threads)
+        : uevent_handlers_(uevent_handlers), workers_(num_threads) {
+        for (auto& worker : workers_) {
+            std::thread{&UeventDispatcher::WorkerMain, this, &worker}.detach();
+        }
+    }
+
+    void Dispatch(const Uevent& uevent) {
+        auto& worker = workers_[std::hash<std::string>{}(uevent.path) % workers_.size()];
+        {
+            auto lock = std::lock_guard{worker.mutex};
+            worker.queue.emplace(uevent);
+        }
+        worker.cv.notify_one();
+    }
+
+  private:
+    struct Worker {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::queue<Uevent> queue;
+    };
+
+    void WorkerMain(Worker* worker) {
+        auto lock = std::unique_lock{worker->mutex};
+        while (true) {
+            worker->cv.wait(lock, [worker] { return !worker->queue.empty(); });
+            auto uevent = std::move(worker->queue.front());
+            worker->queue.pop();
+            lock.unlock();
+
+            for (auto& uevent_handler : uevent_handlers_) {
+                uevent_handler->HandleUevent(uevent);
+            }
+
+            lock.lock();
+        }
+    }
+
+    std::vector<std::unique_ptr<UeventHandler>>& uevent_handlers_;
+    // The threads are detached and run for the lifetime of ueventd, so this is never destroyed
+    // while they use it.
+    std::vector<Worker> workers_;
+};
+
 static UeventdConfiguration GetConfiguration() {
     auto hardware = android::base::GetProperty("ro.hardware", "");
     std::vector<std::string> legacy_paths{"/vendor/ueventd.rc", "/odm/ueventd.rc",
@@ -373,12 +435,20 @@ int ueventd_main(int argc, char** argv) {
 
     // Restore prio before main loop
     setpriority(PRIO_PROCESS, 0, 0);
-    uevent_listener.Poll([&uevent_handlers](const Uevent& uevent) {
-        for (auto& uevent_handler : uevent_handlers) {
-            uevent_handler->HandleUevent(uevent);
-        }
-        return ListenerAction::kContinue;
-    });
+    if (ueventd_configuration.enable_parallel_uevent_handling) {
+        UeventDispatcher dispatcher(uevent_handlers, std::thread::hardware_concurrency() ?: 4);
+        uevent_listener.Poll([&dispatcher](const Uevent& uevent) {
+            dispatcher.Dispatch(uevent);
+            return ListenerAction::kContinue;
+        });
+    } else {
+        uevent_listener.Poll([&uevent_handlers](const Uevent& uevent) {
+            for (auto& uevent_handler : uevent_handlers) {
+                uevent_handler->HandleUevent(uevent);
+            }
+            return ListenerAction::kContinue;
+        });
+    }
 
     return 0;
 }
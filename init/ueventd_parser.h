@@ -35,6 +35,7 @@ struct UeventdConfiguration {
     bool enable_modalias_handling = false;
     size_t uevent_socket_rcvbuf_size = 0;
     bool enable_parallel_restorecon = false;
+    bool enable_parallel_uevent_handling = false;
 };
 
 UeventdConfiguration ParseConfig(const std::vector<std::string>& configs);
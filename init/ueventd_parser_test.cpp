@@ -78,6 +78,10 @@ void TestUeventdFile(const std::string& content, const UeventdConfiguration& exp
     TestVector(expected.external_firmware_handlers, result.external_firmware_handlers,
                TestExternalFirmwareHandler);
     EXPECT_EQ(expected.parallel_restorecon_dirs, result.parallel_restorecon_dirs);
+    EXPECT_EQ(expected.enable_modalias_handling, result.enable_modalias_handling);
+    EXPECT_EQ(expected.uevent_socket_rcvbuf_size, result.uevent_socket_rcvbuf_size);
+    EXPECT_EQ(expected.enable_parallel_restorecon, result.enable_parallel_restorecon);
+    EXPECT_EQ(expected.enable_parallel_uevent_handling, result.enable_parallel_uevent_handling);
 }
 
 TEST(ueventd_parser, EmptyFile) {
@@ -271,9 +275,10 @@ modalias_handling disabled
 parallel_restorecon enabled
 modalias_handling enabled
 parallel_restorecon disabled
+parallel_uevent_handling enabled
 )";
 
-    TestUeventdFile(ueventd_file2, {{}, {}, {}, {}, {}, {}, true, 0, false});
+    TestUeventdFile(ueventd_file2, {{}, {}, {}, {}, {}, {}, true, 0, false, true});
 }
 
 TEST(ueventd_parser, AllTogether) {
@@ -312,6 +317,7 @@ external_firmware_handler /devices/path/firmware/firmware001.bin root /vendor/bi
 uevent_socket_rcvbuf_size 6M
 modalias_handling enabled
 parallel_restorecon enabled
+parallel_uevent_handling enabled
 
 parallel_restorecon_dir /sys
 parallel_restorecon_dir /sys/devices
@@ -358,7 +364,7 @@ parallel_restorecon_dir /sys/devices
     TestUeventdFile(ueventd_file,
                     {subsystems, sysfs_permissions, permissions, firmware_directories,
                      external_firmware_handlers, parallel_restorecon_dirs, true,
-                     uevent_socket_rcvbuf_size, true});
+                     uevent_socket_rcvbuf_size, true, true});
 }
 
 // All of these lines are ill-formed, so test that there is 0 output.
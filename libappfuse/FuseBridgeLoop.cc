@@ -30,7 +30,10 @@ namespace android {
 namespace fuse {
 namespace {
 
-enum class FuseBridgeState { kWaitToReadEither, kWaitToReadProxy, kWaitToWriteProxy, kClosing };
+// While a request is waiting to be written to the proxy, the bridge stops
+// reading the device but keeps passing the proxy's replies on, so that neither
+// side can end up blocked on the other.
+enum class FuseBridgeState { kWaitToReadEither, kWaitToWriteProxy, kClosing };
 
 struct FuseBridgeEntryEvent {
     FuseBridgeEntry* entry;
@@ -43,13 +46,9 @@ void GetObservedEvents(FuseBridgeState state, int* device_events, int* proxy_eve
             *device_events = EPOLLIN;
             *proxy_events = EPOLLIN;
             return;
-        case FuseBridgeState::kWaitToReadProxy:
-            *device_events = 0;
-            *proxy_events = EPOLLIN;
-            return;
         case FuseBridgeState::kWaitToWriteProxy:
             *device_events = 0;
-            *proxy_events = EPOLLOUT;
+            *proxy_events = EPOLLIN | EPOLLOUT;
             return;
         case FuseBridgeState::kClosing:
             *device_events = 0;
@@ -109,14 +108,13 @@ class FuseBridgeEntry {
                 }
                 return;
 
-            case FuseBridgeState::kWaitToReadProxy:
-                CHECK(proxy_read_ready);
-                state_ = ReadFromProxy();
-                return;
-
             case FuseBridgeState::kWaitToWriteProxy:
-                CHECK(proxy_write_ready);
-                state_ = WriteToProxy();
+                if (proxy_read_ready) {
+                    state_ = ReadFromProxy();
+                }
+                if (state_ == FuseBridgeState::kWaitToWriteProxy && proxy_write_ready) {
+                    state_ = WriteToProxy();
+                }
                 return;
 
             case FuseBridgeState::kClosing:
@@ -131,46 +129,52 @@ class FuseBridgeEntry {
   private:
     friend class BridgeEpollController;
 
+    // Passes a reply from the proxy on to the device. Replies may come in any
+    // order; they are matched to their requests by |unique|.
     FuseBridgeState ReadFromProxy() {
-        switch (buffer_.response.ReadOrAgain(proxy_fd_)) {
+        switch (response_.ReadOrAgain(proxy_fd_)) {
             case ResultOrAgain::kSuccess:
                 break;
             case ResultOrAgain::kFailure:
                 return FuseBridgeState::kClosing;
             case ResultOrAgain::kAgain:
-                return FuseBridgeState::kWaitToReadProxy;
+                return state_;
         }
 
-        if (!buffer_.response.Write(device_fd_)) {
-            LogResponseError("Failed to write a reply from proxy to device", buffer_.response);
+        auto it = opcode_map_.find(response_.header.unique);
+        if (it == opcode_map_.end()) {
+            LogResponseError("Dropped a reply from proxy to no outstanding request", response_);
+            return state_;
+        }
+        const uint32_t opcode = it->second;
+        opcode_map_.erase(it);
+
+        if (!response_.Write(device_fd_)) {
+            LogResponseError("Failed to write a reply from proxy to device", response_);
             return FuseBridgeState::kClosing;
         }
 
-        auto it = opcode_map_.find(buffer_.response.header.unique);
-        if (it != opcode_map_.end()) {
-            switch (it->second) {
-                case FUSE_OPEN:
-                    if (buffer_.response.header.error == fuse::kFuseSuccess) {
-                        open_count_++;
-                    }
-                    break;
+        switch (opcode) {
+            case FUSE_OPEN:
+                if (response_.header.error == fuse::kFuseSuccess) {
+                    open_count_++;
+                }
+                break;
 
-                case FUSE_RELEASE:
-                    if (open_count_ > 0) {
-                        open_count_--;
-                    } else {
-                        LOG(WARNING) << "Unexpected FUSE_RELEASE before opening a file.";
-                        break;
-                    }
-                    if (open_count_ == 0) {
-                        return FuseBridgeState::kClosing;
-                    }
+            case FUSE_RELEASE:
+                if (open_count_ > 0) {
+                    open_count_--;
+                } else {
+                    LOG(WARNING) << "Unexpected FUSE_RELEASE before opening a file.";
                     break;
-            }
-            opcode_map_.erase(it);
+                }
+                if (open_count_ == 0) {
+                    return FuseBridgeState::kClosing;
+                }
+                break;
         }
 
-        return FuseBridgeState::kWaitToReadEither;
+        return state_;
     }
 
     FuseBridgeState ReadFromDevice(FuseBridgeLoopCallback* callback) {
@@ -197,9 +201,7 @@ class FuseBridgeEntry {
             case FUSE_WRITE:
             case FUSE_RELEASE:
             case FUSE_FSYNC:
-                if (opcode == FUSE_OPEN || opcode == FUSE_RELEASE) {
-                    opcode_map_.emplace(buffer_.request.header.unique, opcode);
-                }
+                opcode_map_.emplace(unique, opcode);
                 return WriteToProxy();
 
             case FUSE_INIT:
@@ -242,14 +244,18 @@ class FuseBridgeEntry {
     const int mount_id_;
     base::unique_fd device_fd_;
     base::unique_fd proxy_fd_;
+    // Requests from the device, and the replies the bridge makes itself.
     FuseBuffer buffer_;
+    // Replies from the proxy, kept apart so that they can be passed on while
+    // a request in |buffer_| waits for the proxy to become writable.
+    FuseResponse response_;
     FuseBridgeState state_;
     FuseBridgeState last_state_;
     FuseBridgeEntryEvent last_device_events_;
     FuseBridgeEntryEvent last_proxy_events_;
 
-    // Remember map between unique and opcode in fuse_in_header so that we can
-    // refer the opcode later.
+    // Map between unique and opcode in fuse_in_header of the requests sent to
+    // the proxy and not answered yet.
     std::unordered_map<uint64_t, uint32_t> opcode_map_;
 
     int open_count_;
@@ -16,6 +16,7 @@
 
 #include "libappfuse/FuseBridgeLoop.h"
 
+#include <poll.h>
 #include <sys/socket.h>
 
 #include <sstream>
@@ -101,6 +102,29 @@ class FuseBridgeLoopTest : public ::testing::Test {
     EXPECT_EQ(kFuseSuccess, response_.header.error);
   }
 
+  void SendProxyRequest(uint32_t opcode, uint64_t unique, uint32_t data_length) {
+    memset(&request_, 0, sizeof(FuseRequest));
+    request_.header.opcode = opcode;
+    request_.header.unique = unique;
+    request_.header.len = sizeof(fuse_in_header) + data_length;
+    ASSERT_TRUE(request_.Write(dev_sockets_[0]));
+  }
+
+  void SendProxyReply(uint64_t unique) {
+    memset(&response_, 0, sizeof(FuseResponse));
+    response_.header.len = sizeof(fuse_out_header);
+    response_.header.unique = unique;
+    response_.header.error = kFuseSuccess;
+    ASSERT_TRUE(response_.Write(proxy_sockets_[1]));
+  }
+
+  void CheckReply(uint64_t unique) {
+    memset(&response_, 0, sizeof(FuseResponse));
+    ASSERT_TRUE(response_.Read(dev_sockets_[0]));
+    EXPECT_EQ(unique, response_.header.unique);
+    EXPECT_EQ(kFuseSuccess, response_.header.error);
+  }
+
   void SendInitRequest(uint64_t unique) {
     memset(&request_, 0, sizeof(FuseRequest));
     request_.header.opcode = FUSE_INIT;
@@ -210,5 +234,51 @@ TEST_F(FuseBridgeLoopTest, Proxy) {
   Close();
 }
 
+TEST_F(FuseBridgeLoopTest, ProxyOutOfOrder) {
+  SendProxyRequest(FUSE_READ, 1u, sizeof(fuse_read_in));
+  SendProxyRequest(FUSE_READ, 2u, sizeof(fuse_read_in));
+  ASSERT_TRUE(request_.Read(proxy_sockets_[1]));
+  EXPECT_EQ(1u, request_.header.unique);
+  ASSERT_TRUE(request_.Read(proxy_sockets_[1]));
+  EXPECT_EQ(2u, request_.header.unique);
+
+  SendProxyReply(2u);
+  CheckReply(2u);
+  SendProxyReply(1u);
+  CheckReply(1u);
+}
+
+TEST_F(FuseBridgeLoopTest, ProxyRepliesWhileRequestsAreQueued) {
+  SendProxyRequest(FUSE_READ, 1u, sizeof(fuse_read_in));
+
+  // Write requests until neither the proxy socket nor the device socket takes
+  // any more, so that the loop is left waiting for the proxy to read.
+  SendProxyRequest(FUSE_WRITE, 2u, sizeof(fuse_write_in) + kFuseMaxWrite);
+  for (int again = 0; again < 2;) {
+    switch (request_.WriteOrAgain(dev_sockets_[0])) {
+      case ResultOrAgain::kSuccess:
+        request_.header.unique++;
+        break;
+      case ResultOrAgain::kFailure:
+        FAIL();
+      case ResultOrAgain::kAgain:
+        again++;
+        usleep(100000);
+        break;
+    }
+  }
+
+  // The reply must get through without the proxy reading any requests.
+  SendProxyReply(1u);
+  pollfd fds = {.fd = dev_sockets_[0], .events = POLLIN};
+  ASSERT_EQ(1, poll(&fds, 1, 5000));
+  CheckReply(1u);
+}
+
+TEST_F(FuseBridgeLoopTest, ProxyUnknownReply) {
+  SendProxyReply(1u);
+  CheckProxy(FUSE_GETATTR);
+}
+
 }  // namespace fuse
 }  // namespace android
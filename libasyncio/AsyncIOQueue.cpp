@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asyncio/AsyncIOQueue.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace asyncio {
+
+std::unique_ptr<AsyncIOQueue> AsyncIOQueue::Create(unsigned depth, size_t buffer_count,
+                                                   size_t buffer_size) {
+    if (depth == 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    std::unique_ptr<AsyncIOQueue> queue(new AsyncIOQueue);
+    if (io_setup(depth, &queue->ctx_)) {
+        return nullptr;
+    }
+
+    queue->slots_.resize(depth);
+    queue->free_slots_.reserve(depth);
+    for (auto& slot : queue->slots_) {
+        queue->free_slots_.push_back(&slot);
+    }
+    queue->queued_.reserve(depth);
+    queue->events_.resize(depth);
+
+    if (buffer_count > 0 && buffer_size > 0) {
+        // Keep every buffer page aligned, as O_DIRECT and FunctionFS want.
+        const size_t page_size = getpagesize();
+        const size_t stride = (buffer_size + page_size - 1) & ~(page_size - 1);
+        void* buffers;
+        int rc = posix_memalign(&buffers, page_size, stride * buffer_count);
+        if (rc != 0) {
+            errno = rc;
+            return nullptr;
+        }
+        queue->buffers_ = static_cast<char*>(buffers);
+        queue->buffer_size_ = buffer_size;
+        queue->free_buffers_.reserve(buffer_count);
+        for (size_t i = buffer_count; i > 0; i--) {
+            queue->free_buffers_.push_back(queue->buffers_ + (i - 1) * stride);
+        }
+    }
+    return queue;
+}
+
+AsyncIOQueue::~AsyncIOQueue() {
+    // Destroying the context waits for whatever is still in flight, so the
+    // buffers can go after it.
+    if (ctx_ != 0) {
+        io_destroy(ctx_);
+    }
+    free(buffers_);
+}
+
+void* AsyncIOQueue::GetBuffer() {
+    if (free_buffers_.empty()) {
+        return nullptr;
+    }
+    void* buffer = free_buffers_.back();
+    free_buffers_.pop_back();
+    return buffer;
+}
+
+void AsyncIOQueue::PutBuffer(void* buffer) {
+    free_buffers_.push_back(buffer);
+}
+
+bool AsyncIOQueue::Read(int fd, void* buf, size_t count, int64_t offset, Callback callback) {
+    return Queue(fd, buf, count, offset, true, std::move(callback));
+}
+
+bool AsyncIOQueue::Write(int fd, const void* buf, size_t count, int64_t offset,
+                         Callback callback) {
+    return Queue(fd, buf, count, offset, false, std::move(callback));
+}
+
+bool AsyncIOQueue::Queue(int fd, const void* buf, size_t count, int64_t offset, bool read,
+                         Callback callback) {
+    if (free_slots_.empty()) {
+        errno = EAGAIN;
+        return false;
+    }
+    Slot* slot = free_slots_.back();
+    free_slots_.pop_back();
+
+    io_prep(&slot->iocb, fd, buf, count, offset, read);
+    slot->iocb.aio_data = reinterpret_cast<uint64_t>(slot);
+    slot->callback = std::move(callback);
+    queued_.push_back(&slot->iocb);
+    return true;
+}
+
+int AsyncIOQueue::Submit() {
+    if (queued_.empty()) {
+        return 0;
+    }
+    int submitted = TEMP_FAILURE_RETRY(io_submit(ctx_, queued_.size(), queued_.data()));
+    if (submitted < 0) {
+        return -1;
+    }
+    // Whatever the kernel didn't take stays queued for the next Submit().
+    queued_.erase(queued_.begin(), queued_.begin() + submitted);
+    return submitted;
+}
+
+int AsyncIOQueue::Reap(unsigned min, struct timespec* timeout) {
+    const long in_flight = pending() - queued_.size();
+    if (in_flight == 0) {
+        return 0;
+    }
+    const int count = TEMP_FAILURE_RETRY(io_getevents(
+            ctx_, std::min<long>(min, in_flight), events_.size(), events_.data(), timeout));
+    if (count < 0) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        Slot* slot = reinterpret_cast<Slot*>(events_[i].data);
+        // Free the slot first, so that the callback can queue the next
+        // operation in it.
+        Callback callback = std::move(slot->callback);
+        slot->callback = nullptr;
+        free_slots_.push_back(slot);
+        if (callback) {
+            callback(events_[i].res);
+        }
+    }
+    return count;
+}
+
+}  // namespace asyncio
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ASYNCIO_QUEUE_H
+#define _ASYNCIO_QUEUE_H
+
+#include <asyncio/AsyncIO.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace asyncio {
+
+/**
+ * A queue of kernel aio operations on top of io_setup()/io_submit()/
+ * io_getevents(), with a pool of page-aligned buffers to do them from.
+ *
+ * Operations are queued with Read() and Write(), go to the kernel together
+ * on Submit(), and have their callbacks run by Reap() on the thread that
+ * calls it, with the number of bytes transferred or a negative errno. A
+ * callback may queue more operations, but mustn't call Reap() itself. Not
+ * thread safe.
+ */
+class AsyncIOQueue {
+  public:
+    using Callback = std::function<void(int64_t result)>;
+
+    /**
+     * Creates a queue of up to |depth| operations in flight, and a pool of
+     * |buffer_count| buffers of |buffer_size| bytes each. Returns nullptr with
+     * errno set on failure.
+     */
+    static std::unique_ptr<AsyncIOQueue> Create(unsigned depth, size_t buffer_count = 0,
+                                                size_t buffer_size = 0);
+    ~AsyncIOQueue();
+
+    /**
+     * Takes a buffer from the pool, or returns nullptr if all of them are in
+     * use. Buffers go back with PutBuffer().
+     */
+    void* GetBuffer();
+    void PutBuffer(void* buffer);
+    size_t buffer_size() const { return buffer_size_; }
+
+    /**
+     * Queues a read or write of |count| bytes at |offset|. Returns false with
+     * errno set to EAGAIN if |depth| operations are already queued or in
+     * flight.
+     */
+    bool Read(int fd, void* buf, size_t count, int64_t offset, Callback callback);
+    bool Write(int fd, const void* buf, size_t count, int64_t offset, Callback callback);
+
+    /**
+     * Hands all the queued operations to the kernel in one io_submit().
+     * Returns the number submitted, or -1 with errno set if none could be.
+     */
+    int Submit();
+
+    /**
+     * Waits for at least |min| operations to complete, or until |timeout|
+     * passes, and runs the callbacks of all the completed ones. Returns the
+     * number of callbacks run, or -1 with errno set.
+     */
+    int Reap(unsigned min, struct timespec* timeout = nullptr);
+
+    /** Operations queued or in flight. */
+    size_t pending() const { return slots_.size() - free_slots_.size(); }
+
+  private:
+    struct Slot {
+        struct iocb iocb;
+        Callback callback;
+    };
+
+    AsyncIOQueue() = default;
+    bool Queue(int fd, const void* buf, size_t count, int64_t offset, bool read,
+               Callback callback);
+
+    aio_context_t ctx_ = 0;
+    // Sized once, so that the iocbs handed to the kernel never move.
+    std::vector<Slot> slots_;
+    std::vector<Slot*> free_slots_;
+    std::vector<struct iocb*> queued_;
+    std::vector<struct io_event> events_;
+
+    char* buffers_ = nullptr;
+    size_t buffer_size_ = 0;
+    std::vector<void*> free_buffers_;
+};
+
+}  // namespace asyncio
+
+#endif  // _ASYNCIO_QUEUE_H
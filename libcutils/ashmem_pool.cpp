@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/ashmem.h>
+
+#define LOG_TAG "ashmem"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <log/log.h>
+
+#ifndef F_SEAL_SHRINK
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+static constexpr size_t kDefaultChunkSize = 1024 * 1024;
+
+namespace {
+
+// One of the shared regions the pool hands out ranges of. Ranges are kept by
+// offset, so that neighbouring free ranges can be merged.
+struct Chunk {
+    int fd;
+    size_t size;
+    size_t used;
+    std::map<size_t, size_t> free;
+    std::map<size_t, size_t> allocated;
+};
+
+}  // namespace
+
+struct ashmem_pool {
+    std::mutex lock;
+    std::string name;
+    size_t chunk_size;
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    // The sizes of the regions with an fd of their own, by fd.
+    std::map<int, size_t> separate;
+    ashmem_pool_stats stats;
+};
+
+static size_t round_to_pages(size_t size) {
+    size_t page_size = getpagesize();
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+// Gives a recycled range back its zeroes, preferably by dropping its pages.
+static bool zero_range(int fd, size_t offset, size_t size) {
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size) == 0) {
+        return true;
+    }
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    memset(addr, 0, size);
+    munmap(addr, size);
+    return true;
+}
+
+static Chunk* create_chunk(ashmem_pool* pool) {
+    int fd = ashmem_create_region(pool->name.c_str(), pool->chunk_size);
+    if (fd < 0) {
+        return nullptr;
+    }
+    // Ranges are handed out by offset, so the chunk must keep its size. This
+    // only works for memfds; ashmem regions can't be resized once mapped.
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+
+    auto chunk = new (std::nothrow) Chunk{fd, pool->chunk_size, 0, {}, {}};
+    if (chunk == nullptr) {
+        close(fd);
+        return nullptr;
+    }
+    chunk->free.emplace(0, pool->chunk_size);
+    pool->chunks.emplace_back(chunk);
+    pool->stats.chunks++;
+    pool->stats.chunk_bytes += pool->chunk_size;
+    pool->stats.chunks_created++;
+    return chunk;
+}
+
+// Takes the first free range of chunk big enough for size bytes.
+static bool alloc_from_chunk(Chunk* chunk, size_t size, size_t* offset) {
+    for (auto it = chunk->free.begin(); it != chunk->free.end(); ++it) {
+        if (it->second < size) continue;
+        *offset = it->first;
+        size_t remaining = it->second - size;
+        chunk->free.erase(it);
+        if (remaining > 0) {
+            chunk->free.emplace(*offset + size, remaining);
+        }
+        chunk->allocated.emplace(*offset, size);
+        chunk->used += size;
+        return true;
+    }
+    return false;
+}
+
+static void free_to_chunk(Chunk* chunk, size_t offset, size_t size) {
+    chunk->used -= size;
+    auto next = chunk->free.lower_bound(offset);
+    if (next != chunk->free.end() && offset + size == next->first) {
+        size += next->second;
+        next = chunk->free.erase(next);
+    }
+    if (next != chunk->free.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+    chunk->free.emplace(offset, size);
+}
+
+static void destroy_chunk(ashmem_pool* pool, size_t index) {
+    close(pool->chunks[index]->fd);
+    pool->stats.chunks--;
+    pool->stats.chunk_bytes -= pool->chunks[index]->size;
+    pool->chunks.erase(pool->chunks.begin() + index);
+}
+
+ashmem_pool* ashmem_pool_create(const char* name, size_t chunk_size) {
+    auto pool = new (std::nothrow) ashmem_pool;
+    if (pool == nullptr) {
+        return nullptr;
+    }
+    pool->name = name ? name : "ashmem_pool";
+    pool->chunk_size = round_to_pages(chunk_size ? chunk_size : kDefaultChunkSize);
+    pool->stats = {};
+    return pool;
+}
+
+void ashmem_pool_destroy(ashmem_pool* pool) {
+    for (auto& chunk : pool->chunks) {
+        close(chunk->fd);
+    }
+    for (auto& [fd, size] : pool->separate) {
+        close(fd);
+    }
+    delete pool;
+}
+
+int ashmem_pool_alloc(ashmem_pool* pool, size_t size, int flags, ashmem_pool_region* region) {
+    if (size == 0) {
+        return -EINVAL;
+    }
+    size = round_to_pages(size);
+    std::lock_guard<std::mutex> guard(pool->lock);
+
+    if ((flags & ASHMEM_POOL_SEPARATE) || size > pool->chunk_size / 2) {
+        int fd = ashmem_create_region(pool->name.c_str(), size);
+        if (fd < 0) {
+            return -errno;
+        }
+        pool->separate.emplace(fd, size);
+        *region = {fd, 0, size};
+        pool->stats.separate_regions++;
+    } else {
+        Chunk* chunk = nullptr;
+        size_t offset;
+        for (auto& c : pool->chunks) {
+            if (c->size - c->used >= size && alloc_from_chunk(c.get(), size, &offset)) {
+                chunk = c.get();
+                break;
+            }
+        }
+        if (chunk == nullptr) {
+            chunk = create_chunk(pool);
+            if (chunk == nullptr) {
+                return errno ? -errno : -ENOMEM;
+            }
+            alloc_from_chunk(chunk, size, &offset);
+        }
+        *region = {chunk->fd, offset, size};
+    }
+
+    pool->stats.allocated_bytes += size;
+    pool->stats.regions++;
+    pool->stats.allocs++;
+    return 0;
+}
+
+int ashmem_pool_free(ashmem_pool* pool, const ashmem_pool_region* region) {
+    std::lock_guard<std::mutex> guard(pool->lock);
+
+    auto separate = pool->separate.find(region->fd);
+    if (separate != pool->separate.end()) {
+        if (region->offset != 0 || region->size != separate->second) {
+            ALOGE("ashmem_pool_free(%d, %zu, %zu): not a region of the pool", region->fd,
+                  region->offset, region->size);
+            return -EINVAL;
+        }
+        close(region->fd);
+        pool->stats.allocated_bytes -= separate->second;
+        pool->stats.separate_regions--;
+        pool->separate.erase(separate);
+    } else {
+        size_t index;
+        for (index = 0; index < pool->chunks.size(); index++) {
+            if (pool->chunks[index]->fd == region->fd) break;
+        }
+        if (index == pool->chunks.size()) {
+            ALOGE("ashmem_pool_free(%d, %zu, %zu): not a region of the pool", region->fd,
+                  region->offset, region->size);
+            return -EINVAL;
+        }
+        Chunk* chunk = pool->chunks[index].get();
+        auto allocated = chunk->allocated.find(region->offset);
+        if (allocated == chunk->allocated.end() || allocated->second != region->size) {
+            ALOGE("ashmem_pool_free(%d, %zu, %zu): not a region of the pool", region->fd,
+                  region->offset, region->size);
+            return -EINVAL;
+        }
+        chunk->allocated.erase(allocated);
+        pool->stats.allocated_bytes -= region->size;
+
+        // Keep one empty chunk around for the next allocations, and let the
+        // others go.
+        if (chunk->used == region->size) {
+            for (size_t i = 0; i < pool->chunks.size(); i++) {
+                if (i != index && pool->chunks[i]->used == 0) {
+                    destroy_chunk(pool, index);
+                    chunk = nullptr;
+                    break;
+                }
+            }
+        }
+        if (chunk != nullptr) {
+            if (!zero_range(chunk->fd, region->offset, region->size)) {
+                // Don't hand out a range that still holds the old contents.
+                ALOGE("ashmem_pool_free(%d, %zu, %zu): can't clear region: %s", region->fd,
+                      region->offset, region->size, strerror(errno));
+                chunk->used -= region->size;
+                chunk->size -= region->size;
+                pool->stats.chunk_bytes -= region->size;
+            } else {
+                free_to_chunk(chunk, region->offset, region->size);
+            }
+        }
+    }
+
+    pool->stats.regions--;
+    pool->stats.frees++;
+    return 0;
+}
+
+void ashmem_pool_get_stats(ashmem_pool* pool, ashmem_pool_stats* stats) {
+    std::lock_guard<std::mutex> guard(pool->lock);
+    *stats = pool->stats;
+}
@@ -280,3 +280,70 @@ TEST(AshmemTest, ForkMultiRegionTest) {
         EXPECT_EQ(0, munmap(region, size));
     }
 }
+
+TEST(AshmemTest, PoolTest) {
+    const size_t pageSize = getpagesize();
+    ashmem_pool* pool = ashmem_pool_create("pool_test", 16 * pageSize);
+    ASSERT_NE(nullptr, pool);
+
+    // Small regions share a chunk, without overlapping.
+    ashmem_pool_region a, b;
+    ASSERT_EQ(0, ashmem_pool_alloc(pool, 1, 0, &a));
+    ASSERT_EQ(0, ashmem_pool_alloc(pool, 2 * pageSize, 0, &b));
+    EXPECT_EQ(pageSize, a.size);
+    EXPECT_EQ(2 * pageSize, b.size);
+    EXPECT_EQ(a.fd, b.fd);
+    EXPECT_TRUE(a.offset + a.size <= b.offset || b.offset + b.size <= a.offset);
+
+    void* regionA;
+    void* regionB;
+    ASSERT_NO_FATAL_FAILURE(
+            TestMmap(unique_fd(dup(a.fd)), a.size, PROT_READ | PROT_WRITE, &regionA, a.offset));
+    ASSERT_NO_FATAL_FAILURE(
+            TestMmap(unique_fd(dup(b.fd)), b.size, PROT_READ | PROT_WRITE, &regionB, b.offset));
+    memset(regionA, 0xAA, a.size);
+    memset(regionB, 0x55, b.size);
+    EXPECT_EQ(0xAA, static_cast<uint8_t*>(regionA)[a.size - 1]);
+    EXPECT_EQ(0x55, static_cast<uint8_t*>(regionB)[0]);
+    EXPECT_EQ(0, munmap(regionB, b.size));
+
+    // A freed range is handed out again, and comes back cleared.
+    ashmem_pool_region c;
+    ASSERT_EQ(0, ashmem_pool_free(pool, &a));
+    EXPECT_EQ(-EINVAL, ashmem_pool_free(pool, &a));
+    ASSERT_EQ(0, ashmem_pool_alloc(pool, pageSize, 0, &c));
+    EXPECT_EQ(a.fd, c.fd);
+    EXPECT_EQ(a.offset, c.offset);
+    EXPECT_EQ(0, static_cast<uint8_t*>(regionA)[0]);
+    EXPECT_EQ(0, munmap(regionA, a.size));
+
+    // Separate and large regions get an fd of their own.
+    ashmem_pool_region d, e;
+    ASSERT_EQ(0, ashmem_pool_alloc(pool, pageSize, ASHMEM_POOL_SEPARATE, &d));
+    ASSERT_EQ(0, ashmem_pool_alloc(pool, 12 * pageSize, 0, &e));
+    EXPECT_NE(b.fd, d.fd);
+    EXPECT_NE(b.fd, e.fd);
+    EXPECT_EQ(0U, d.offset);
+    EXPECT_EQ(0U, e.offset);
+    ASSERT_EQ(pageSize, static_cast<size_t>(ashmem_get_size_region(d.fd)));
+
+    ashmem_pool_stats stats;
+    ashmem_pool_get_stats(pool, &stats);
+    EXPECT_EQ(1U, stats.chunks);
+    EXPECT_EQ(16 * pageSize, stats.chunk_bytes);
+    EXPECT_EQ(16 * pageSize, stats.allocated_bytes);
+    EXPECT_EQ(4U, stats.regions);
+    EXPECT_EQ(2U, stats.separate_regions);
+    EXPECT_EQ(5U, stats.allocs);
+    EXPECT_EQ(1U, stats.frees);
+
+    ASSERT_EQ(0, ashmem_pool_free(pool, &b));
+    ASSERT_EQ(0, ashmem_pool_free(pool, &c));
+    ASSERT_EQ(0, ashmem_pool_free(pool, &d));
+    ashmem_pool_get_stats(pool, &stats);
+    EXPECT_EQ(1U, stats.chunks);
+    EXPECT_EQ(12 * pageSize, stats.allocated_bytes);
+    EXPECT_EQ(1U, stats.regions);
+
+    ashmem_pool_destroy(pool);
+}
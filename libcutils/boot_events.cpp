@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/boot_events.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+
+#include <cutils/threads.h>
+
+static constexpr uint32_t kBootEventsMagic = 0x544e5645;  // "EVNT"
+static constexpr uint32_t kBootEventsVersion = 1;
+static constexpr uint32_t kBootEventsCapacity = BOOT_EVENTS_MAX;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "boot events are shared between processes");
+
+namespace {
+
+struct BootEventsHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t slot_size;
+    // Index of the next event to be written. Event i goes in slot i % capacity.
+    std::atomic<uint64_t> next;
+};
+
+// |seq| is i + 1 once event i is completely written, and 0 while any event is
+// being written, so that readers can tell when they raced with a writer.
+struct BootEventSlot {
+    std::atomic<uint64_t> seq;
+    boot_event event;
+};
+
+}  // namespace
+
+static std::atomic<BootEventsHeader*> g_header;
+
+static size_t boot_events_size(uint32_t capacity) {
+    return sizeof(BootEventsHeader) + capacity * sizeof(BootEventSlot);
+}
+
+static BootEventSlot* boot_events_slots(const BootEventsHeader* header) {
+    return reinterpret_cast<BootEventSlot*>(const_cast<BootEventsHeader*>(header) + 1);
+}
+
+static BootEventsHeader* boot_events_map(int fd, int prot, size_t* size) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) return nullptr;
+    if (static_cast<size_t>(st.st_size) < sizeof(BootEventsHeader)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    void* addr = mmap(nullptr, st.st_size, prot, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) return nullptr;
+
+    auto header = static_cast<BootEventsHeader*>(addr);
+    if (header->magic != kBootEventsMagic || header->version != kBootEventsVersion ||
+        header->slot_size != sizeof(BootEventSlot) || header->capacity == 0 ||
+        boot_events_size(header->capacity) > static_cast<size_t>(st.st_size)) {
+        munmap(addr, st.st_size);
+        errno = EINVAL;
+        return nullptr;
+    }
+    *size = st.st_size;
+    return header;
+}
+
+int boot_events_create(const char* path) {
+    // Make a new file rather than truncating the old one, which would fault
+    // any process that still has it mapped.
+    if (unlink(path) == -1 && errno != ENOENT) return -1;
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) return -1;
+
+    const size_t size = boot_events_size(kBootEventsCapacity);
+    if (ftruncate(fd, size) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        unlink(path);
+        errno = saved_errno;
+        return -1;
+    }
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        int saved_errno = errno;
+        unlink(path);
+        errno = saved_errno;
+        return -1;
+    }
+
+    auto header = static_cast<BootEventsHeader*>(addr);
+    header->capacity = kBootEventsCapacity;
+    header->slot_size = sizeof(BootEventSlot);
+    header->version = kBootEventsVersion;
+    header->next.store(0, std::memory_order_relaxed);
+    // Published last, so that a reader never sees a valid but unset header.
+    __atomic_store_n(&header->magic, kBootEventsMagic, __ATOMIC_RELEASE);
+
+    // Any previous mapping is left in place, in case another thread of this
+    // process is still writing to it.
+    g_header.store(header, std::memory_order_release);
+    return 0;
+}
+
+static BootEventsHeader* boot_events_get() {
+    BootEventsHeader* header = g_header.load(std::memory_order_acquire);
+    if (header != nullptr) return header;
+
+    static std::once_flag once;
+    std::call_once(once, [] {
+        // Callers record events around system calls whose errno they check.
+        int saved_errno = errno;
+        auto restore_errno = [saved_errno] { errno = saved_errno; };
+        int fd = open(BOOT_EVENTS_FILE, O_RDWR | O_CLOEXEC);
+        if (fd == -1) return restore_errno();
+        size_t size;
+        BootEventsHeader* mapped = boot_events_map(fd, PROT_READ | PROT_WRITE, &size);
+        close(fd);
+        BootEventsHeader* expected = nullptr;
+        if (mapped != nullptr && !g_header.compare_exchange_strong(expected, mapped)) {
+            munmap(mapped, size);
+        }
+        restore_errno();
+    });
+    return g_header.load(std::memory_order_acquire);
+}
+
+static void copy_truncated(char* dst, const char* src, size_t size) {
+    size_t len = src ? strnlen(src, size - 1) : 0;
+    if (len > 0) memcpy(dst, src, len);
+    memset(dst + len, 0, size - len);
+}
+
+static uint64_t boot_events_now() {
+    struct timespec ts;
+#if defined(CLOCK_BOOTTIME)
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void boot_event_record_at(char phase, const char* category, const char* name,
+                          uint64_t timestamp_ns) {
+    BootEventsHeader* header = boot_events_get();
+    if (header == nullptr) return;
+
+    uint64_t i = header->next.fetch_add(1, std::memory_order_relaxed);
+    BootEventSlot* slot = &boot_events_slots(header)[i % header->capacity];
+    slot->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    boot_event* event = &slot->event;
+    event->timestamp_ns = timestamp_ns;
+    event->pid = getpid();
+    event->tid = gettid();
+    event->phase = phase;
+    copy_truncated(event->category, category, sizeof(event->category));
+    copy_truncated(event->name, name, sizeof(event->name));
+
+    slot->seq.store(i + 1, std::memory_order_release);
+}
+
+void boot_event_record(char phase, const char* category, const char* name) {
+    // Checked first, so that processes without the buffer don't read the clock.
+    if (boot_events_get() == nullptr) return;
+    boot_event_record_at(phase, category, name, boot_events_now());
+}
+
+ssize_t boot_events_read(const char* path, struct boot_event* events, size_t max_events) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    size_t size;
+    BootEventsHeader* header = boot_events_map(fd, PROT_READ, &size);
+    close(fd);
+    if (header == nullptr) return -1;
+
+    const uint64_t capacity = header->capacity;
+    const uint64_t next = header->next.load(std::memory_order_acquire);
+    uint64_t i = next > capacity ? next - capacity : 0;
+    size_t count = 0;
+    for (; i < next && count < max_events; i++) {
+        const BootEventSlot* slot = &boot_events_slots(header)[i % capacity];
+        if (slot->seq.load(std::memory_order_acquire) != i + 1) continue;
+        boot_event event;
+        memcpy(&event, &slot->event, sizeof(event));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->seq.load(std::memory_order_relaxed) != i + 1) continue;
+        events[count++] = event;
+    }
+
+    munmap(header, size);
+    return count;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/boot_events.h>
+
+#include <errno.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+class BootEventsTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        path_ = std::string(dir_.path) + "/boot_events";
+        ASSERT_EQ(0, boot_events_create(path_.c_str())) << strerror(errno);
+    }
+
+    std::vector<boot_event> Read(size_t max_events = 8192) {
+        std::vector<boot_event> events(max_events);
+        ssize_t n = boot_events_read(path_.c_str(), events.data(), events.size());
+        EXPECT_GE(n, 0) << strerror(errno);
+        events.resize(n < 0 ? 0 : n);
+        return events;
+    }
+
+    TemporaryDir dir_;
+    std::string path_;
+};
+
+TEST_F(BootEventsTest, RecordAndRead) {
+    boot_event_begin("init", "first_stage");
+    boot_event_instant("service", "a_service_with_a_name_too_long_to_fit_in_an_event");
+    boot_event_record_at(BOOT_EVENT_END, "init", "first_stage", 12345);
+
+    auto events = Read();
+    ASSERT_EQ(3U, events.size());
+    EXPECT_EQ(BOOT_EVENT_BEGIN, events[0].phase);
+    EXPECT_STREQ("init", events[0].category);
+    EXPECT_STREQ("first_stage", events[0].name);
+    EXPECT_EQ(getpid(), events[0].pid);
+    EXPECT_GT(events[0].timestamp_ns, 0U);
+
+    EXPECT_EQ(BOOT_EVENT_INSTANT, events[1].phase);
+    EXPECT_EQ(std::string("a_service_with_a_name_too_long_to_fit_in_an_event")
+                      .substr(0, BOOT_EVENT_NAME_MAX - 1),
+              events[1].name);
+
+    EXPECT_EQ(BOOT_EVENT_END, events[2].phase);
+    EXPECT_EQ(12345U, events[2].timestamp_ns);
+}
+
+TEST_F(BootEventsTest, KeepsNewestWhenFull) {
+    for (int i = 0; i < 5000; i++) {
+        boot_event_instant("test", std::to_string(i).c_str());
+    }
+    auto events = Read();
+    ASSERT_FALSE(events.empty());
+    ASSERT_LT(events.size(), 5000U);
+    EXPECT_STREQ("4999", events.back().name);
+    int first = std::stoi(events.front().name);
+    for (size_t i = 0; i < events.size(); i++) {
+        EXPECT_EQ(std::to_string(first + i), events[i].name);
+    }
+
+    auto oldest = Read(2);
+    ASSERT_EQ(2U, oldest.size());
+    EXPECT_STREQ(events[0].name, oldest[0].name);
+}
+
+TEST_F(BootEventsTest, Threads) {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([] {
+            for (int i = 0; i < 100; i++) boot_event_instant("test", "thread");
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    EXPECT_EQ(400U, Read().size());
+}
+
+TEST_F(BootEventsTest, SharedWithChildren) {
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        boot_event_instant("test", "child");
+        _exit(0);
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+
+    auto events = Read();
+    ASSERT_EQ(1U, events.size());
+    EXPECT_EQ(pid, events[0].pid);
+}
+
+TEST_F(BootEventsTest, ReadInvalid) {
+    boot_event events[1];
+    std::string missing = std::string(dir_.path) + "/missing";
+    EXPECT_EQ(-1, boot_events_read(missing.c_str(), events, 1));
+    EXPECT_EQ(ENOENT, errno);
+
+    std::string garbage = std::string(dir_.path) + "/garbage";
+    ASSERT_TRUE(android::base::WriteStringToFile(std::string(4096, 'x'), garbage));
+    EXPECT_EQ(-1, boot_events_read(garbage.c_str(), events, 1));
+    EXPECT_EQ(EINVAL, errno);
+}
@@ -21,59 +21,98 @@
 #include <android-base/strings.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#include <algorithm>
-#include <fstream>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 using android::base::ConsumePrefix;
-using android::base::StartsWith;
-using android::base::Tokenize;
 
 struct Entry {
-    std::string path;
     unsigned uid;
     unsigned gid;
     unsigned mode;
     uint64_t capabilities;
 };
 
-static std::vector<Entry> canned_data;
+// Keyed by path, which points into the mapped canned file. The files stay
+// mapped for the life of the process, as the entries are used until it exits.
+static std::unordered_map<std::string_view, Entry> canned_data;
+
+// Splits line at runs of spaces, like android::base::Tokenize(), without
+// copying.
+static void tokenize(std::string_view line, std::vector<std::string_view>* tokens) {
+    tokens->clear();
+    while (true) {
+        size_t start = line.find_first_not_of(' ');
+        if (start == std::string_view::npos) break;
+        line.remove_prefix(start);
+        size_t end = line.find(' ');
+        tokens->push_back(line.substr(0, end));
+        if (end == std::string_view::npos) break;
+        line.remove_prefix(end);
+    }
+}
 
 int load_canned_fs_config(const char* fn) {
-    std::ifstream input(fn);
-    for (std::string line; std::getline(input, line);) {
+    std::string_view data;
+    int fd = TEMP_FAILURE_RETRY(open(fn, O_RDONLY | O_CLOEXEC));
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                std::cerr << "failed to map " << fn << ": " << strerror(errno) << std::endl;
+                close(fd);
+                return -1;
+            }
+            data = std::string_view(static_cast<const char*>(map), st.st_size);
+        }
+        close(fd);
+    }
+
+    std::vector<std::string_view> tokens;
+    size_t loaded = 0;
+    while (!data.empty()) {
+        size_t eol = data.find('\n');
+        std::string_view line = data.substr(0, eol);
+        data.remove_prefix(eol == std::string_view::npos ? data.size() : eol + 1);
+
+        tokenize(line, &tokens);
         // Historical: the root dir can be represented as a space character.
         // e.g. " 1000 1000 0755" is parsed as
         // path = " ", uid = 1000, gid = 1000, mode = 0755.
         // But at the same time, we also have accepted
         // "/ 1000 1000 0755".
-        if (StartsWith(line, " ")) {
-            line.insert(line.begin(), '/');
+        if (!line.empty() && line.front() == ' ') {
+            tokens.insert(tokens.begin(), "/");
         }
-
-        std::vector<std::string> tokens = Tokenize(line, " ");
         if (tokens.size() < 4) {
             std::cerr << "Ill-formed line: " << line << " in " << fn << std::endl;
             return -1;
         }
 
         // Historical: remove the leading '/' if exists.
-        std::string path(tokens[0].front() == '/' ? std::string(tokens[0], 1) : tokens[0]);
+        std::string_view path = tokens[0];
+        if (path.front() == '/') path.remove_prefix(1);
 
         Entry e{
-                .path = std::move(path),
-                .uid = static_cast<unsigned int>(atoi(tokens[1].c_str())),
-                .gid = static_cast<unsigned int>(atoi(tokens[2].c_str())),
+                .uid = static_cast<unsigned int>(atoi(std::string(tokens[1]).c_str())),
+                .gid = static_cast<unsigned int>(atoi(std::string(tokens[2]).c_str())),
                 // mode is in octal
-                .mode = static_cast<unsigned int>(strtol(tokens[3].c_str(), nullptr, 8)),
+                .mode = static_cast<unsigned int>(
+                        strtol(std::string(tokens[3]).c_str(), nullptr, 8)),
                 .capabilities = 0,
         };
 
@@ -89,20 +128,14 @@ int load_canned_fs_config(const char* fn) {
             std::cerr << "info: ignored token \"" << sv << "\" in " << fn << std::endl;
         }
 
-        canned_data.emplace_back(std::move(e));
+        // There can be multiple entries for the same path. Then the one that comes the last
+        // wins. This is to allow overriding platform provided fs_config with a user provided
+        // fs_config by appending the latter to the former.
+        canned_data.insert_or_assign(path, e);
+        loaded++;
     }
 
-    // Note: we used to sort the entries by path names. This was to improve the lookup performance
-    // by doing binary search. However, this is no longer the case. The lookup performance is not
-    // critical because this tool runs on the host, not on the device. Now, there can be multiple
-    // entries for the same path. Then the one that comes the last wins. This is to allow overriding
-    // platform provided fs_config with a user provided fs_config by appending the latter to the
-    // former.
-    //
-    // To implement the strategy, reverse the entries order, and search from the top.
-    std::reverse(canned_data.begin(), canned_data.end());
-
-    std::cout << "loaded " << canned_data.size() << " fs_config entries" << std::endl;
+    std::cout << "loaded " << loaded << " fs_config entries" << std::endl;
     return 0;
 }
 
@@ -111,23 +144,14 @@ void canned_fs_config(const char* path, [[maybe_unused]] int dir,
                       unsigned* mode, uint64_t* capabilities) {
     if (path != nullptr && path[0] == '/') path++;  // canned paths lack the leading '/'
 
-    const Entry* found = nullptr;
-    // canned_data is already reversed. First match wins.
-    for (const auto& entry : canned_data) {
-        if (path == entry.path) {
-            found = &entry;
-            break;
-        }
-        continue;
-    }
-
-    if (found == nullptr) {
+    auto found = canned_data.find(path);
+    if (found == canned_data.end()) {
         std::cerr << "failed to find " << path << " in canned fs_config" << std::endl;
         exit(1);
     }
 
-    *uid = found->uid;
-    *gid = found->gid;
-    *mode = found->mode;
-    *capabilities = found->capabilities;
+    *uid = found->second.uid;
+    *gid = found->second.gid;
+    *mode = found->second.mode;
+    *capabilities = found->second.capabilities;
 }
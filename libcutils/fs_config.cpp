@@ -32,7 +32,12 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <new>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <android-base/strings.h>
 #include <cutils/fs.h>
@@ -272,51 +277,93 @@ static bool is_partition(const std::string& path) {
     return false;
 }
 
-// alias prefixes of "<partition>/<stuff>" to "system/<partition>/<stuff>" or
-// "system/<partition>/<stuff>" to "<partition>/<stuff>"
-static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char* path, size_t plen) {
+// Massage pattern and input so that they can be used by fnmatch where
+// directories have to end with /.
+static std::string fs_config_pattern(bool dir, const char* prefix, size_t len) {
     std::string pattern(prefix, len);
-    std::string input(path, plen);
-
-    // Massage pattern and input so that they can be used by fnmatch where
-    // directories have to end with /.
-    if (dir) {
-        if (!EndsWith(input, "/")) {
-            input.append("/");
-        }
-
-        if (!EndsWith(pattern, "/*")) {
-            if (EndsWith(pattern, "/")) {
-                pattern.append("*");
-            } else {
-                pattern.append("/*");
-            }
+    if (dir && !EndsWith(pattern, "/*")) {
+        if (EndsWith(pattern, "/")) {
+            pattern.append("*");
+        } else {
+            pattern.append("/*");
         }
     }
+    return pattern;
+}
 
-    // no FNM_PATHNAME is set in order to match a/b/c/d with a/*
-    // FNM_ESCAPE is set in order to prevent using \\? and \\* and maintenance issues.
-    const int fnm_flags = FNM_NOESCAPE;
-    if (fnmatch(pattern.c_str(), input.c_str(), fnm_flags) == 0) return true;
+static std::string fs_config_input(bool dir, const char* path, size_t plen) {
+    std::string input(path, plen);
+    if (dir && !EndsWith(input, "/")) {
+        input.append("/");
+    }
+    return input;
+}
 
-    // Check match between logical partition's files and patterns.
+// If input is a logical partition's "system/<partition>/<stuff>" or
+// "vendor/odm/<stuff>", sets input_in_partition to the "<partition>/<stuff>"
+// that patterns for the partition are also matched against.
+static bool fs_config_partition_input(const std::string& input, std::string* input_in_partition) {
     static constexpr const char* kLogicalPartitions[] = {"system/product/", "system/system_ext/",
                                                          "system/vendor/", "vendor/odm/"};
     for (auto& logical_partition : kLogicalPartitions) {
         if (StartsWith(input, logical_partition)) {
-            std::string input_in_partition = input.substr(input.find('/') + 1);
-            if (!is_partition(input_in_partition)) continue;
-            if (fnmatch(pattern.c_str(), input_in_partition.c_str(), fnm_flags) == 0) {
-                return true;
-            }
+            *input_in_partition = input.substr(input.find('/') + 1);
+            if (is_partition(*input_in_partition)) return true;
         }
     }
     return false;
 }
+
+// no FNM_PATHNAME is set in order to match a/b/c/d with a/*
+// FNM_ESCAPE is set in order to prevent using \\? and \\* and maintenance issues.
+static constexpr int kFnmFlags = FNM_NOESCAPE;
+
+// alias prefixes of "<partition>/<stuff>" to "system/<partition>/<stuff>" or
+// "system/<partition>/<stuff>" to "<partition>/<stuff>"
+static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char* path, size_t plen) {
+    std::string pattern = fs_config_pattern(dir, prefix, len);
+    std::string input = fs_config_input(dir, path, plen);
+
+    if (fnmatch(pattern.c_str(), input.c_str(), kFnmFlags) == 0) return true;
+
+    // Check match between logical partition's files and patterns.
+    std::string input_in_partition;
+    if (fs_config_partition_input(input, &input_in_partition)) {
+        return fnmatch(pattern.c_str(), input_in_partition.c_str(), kFnmFlags) == 0;
+    }
+    return false;
+}
 #ifndef __ANDROID_VNDK__
 auto __for_testing_only__fs_config_cmp = fs_config_cmp;
 #endif
 
+// Reads the next entry of an fs_config_(dirs|files) file, returning false at
+// the end of the file or if the entry is corrupt.
+static bool fs_config_read_entry(int fd, const char* name, struct fs_path_config_from_file* header,
+                                 std::string* prefix) {
+    if (TEMP_FAILURE_RETRY(read(fd, header, sizeof(*header))) != sizeof(*header)) {
+        return false;
+    }
+    uint16_t host_len = header->len;
+    ssize_t len, remainder = host_len - sizeof(*header);
+    if (remainder <= 0) {
+        ALOGE("%s len is corrupted", name);
+        return false;
+    }
+    prefix->resize(remainder);
+    if (TEMP_FAILURE_RETRY(read(fd, prefix->data(), remainder)) != remainder) {
+        ALOGE("%s prefix is truncated", name);
+        return false;
+    }
+    len = strnlen(prefix->data(), remainder);
+    if (len >= remainder) {  // missing a terminating null
+        ALOGE("%s is corrupted", name);
+        return false;
+    }
+    prefix->resize(len);
+    return true;
+}
+
 void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
                unsigned* mode, uint64_t* capabilities) {
     const struct fs_path_config* pc;
@@ -330,36 +377,13 @@ void fs_config(const char* path, int dir, const char* target_out_path, unsigned*
 
     for (which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
         struct fs_path_config_from_file header;
+        std::string prefix;
 
         int fd = fs_config_open(dir, which, target_out_path);
         if (fd < 0) continue;
 
-        while (TEMP_FAILURE_RETRY(read(fd, &header, sizeof(header))) == sizeof(header)) {
-            char* prefix;
-            uint16_t host_len = header.len;
-            ssize_t len, remainder = host_len - sizeof(header);
-            if (remainder <= 0) {
-                ALOGE("%s len is corrupted", conf[which][dir]);
-                break;
-            }
-            prefix = static_cast<char*>(calloc(1, remainder));
-            if (!prefix) {
-                ALOGE("%s out of memory", conf[which][dir]);
-                break;
-            }
-            if (TEMP_FAILURE_RETRY(read(fd, prefix, remainder)) != remainder) {
-                free(prefix);
-                ALOGE("%s prefix is truncated", conf[which][dir]);
-                break;
-            }
-            len = strnlen(prefix, remainder);
-            if (len >= remainder) {  // missing a terminating null
-                free(prefix);
-                ALOGE("%s is corrupted", conf[which][dir]);
-                break;
-            }
-            if (fs_config_cmp(dir, prefix, len, path, plen)) {
-                free(prefix);
+        while (fs_config_read_entry(fd, conf[which][dir], &header, &prefix)) {
+            if (fs_config_cmp(dir, prefix.c_str(), prefix.size(), path, plen)) {
                 close(fd);
                 *uid = header.uid;
                 *gid = header.gid;
@@ -367,7 +391,6 @@ void fs_config(const char* path, int dir, const char* target_out_path, unsigned*
                 *capabilities = header.capabilities;
                 return;
             }
-            free(prefix);
         }
         close(fd);
     }
@@ -382,3 +405,140 @@ void fs_config(const char* path, int dir, const char* target_out_path, unsigned*
     *mode = (*mode & (~07777)) | pc->mode;
     *capabilities = pc->capabilities;
 }
+
+namespace {
+
+// The rules for either directories or files, in the order fs_config() tries
+// them, indexed by the shape of their pattern so that a lookup doesn't have to
+// fnmatch() every one: a literal pattern can only match the same path, and a
+// literal followed by a single trailing * can only match paths starting with
+// the literal. Whichever matching rule comes first wins, as in fs_config().
+class FsConfigRules {
+  public:
+    void Add(bool dir, unsigned mode, unsigned uid, unsigned gid, uint64_t capabilities,
+             const char* prefix, size_t len) {
+        rules_.push_back({mode, uid, gid, capabilities, fs_config_pattern(dir, prefix, len)});
+    }
+
+    void SetDefault(const struct fs_path_config& pc) {
+        default_ = {pc.mode, pc.uid, pc.gid, pc.capabilities, ""};
+    }
+
+    // Builds the indexes, which point into rules_, once all rules are added.
+    void Build() {
+        for (size_t i = 0; i < rules_.size(); ++i) {
+            std::string_view pattern = rules_[i].pattern;
+            size_t wildcard = pattern.find_first_of("*?[");
+            if (wildcard == std::string_view::npos) {
+                exact_.emplace(pattern, i);
+            } else if (wildcard == pattern.size() - 1 && pattern[wildcard] == '*') {
+                if (prefixes_.emplace(pattern.substr(0, wildcard), i).second) {
+                    prefix_lengths_.push_back(wildcard);
+                }
+            } else {
+                globs_.push_back(i);
+            }
+        }
+        std::sort(prefix_lengths_.begin(), prefix_lengths_.end());
+        prefix_lengths_.erase(std::unique(prefix_lengths_.begin(), prefix_lengths_.end()),
+                              prefix_lengths_.end());
+    }
+
+    const struct fs_path_config& Find(bool dir, const char* path, size_t plen) const {
+        std::string inputs[2] = {fs_config_input(dir, path, plen)};
+        size_t input_count = fs_config_partition_input(inputs[0], &inputs[1]) ? 2 : 1;
+
+        size_t best = rules_.size();
+        for (size_t i = 0; i < input_count; ++i) {
+            std::string_view input = inputs[i];
+            auto exact = exact_.find(input);
+            if (exact != exact_.end()) best = std::min(best, exact->second);
+            for (size_t len : prefix_lengths_) {
+                if (len > input.size()) break;
+                auto prefix = prefixes_.find(input.substr(0, len));
+                if (prefix != prefixes_.end()) best = std::min(best, prefix->second);
+            }
+        }
+        for (size_t i : globs_) {
+            if (i >= best) break;
+            for (size_t j = 0; j < input_count; ++j) {
+                if (fnmatch(rules_[i].pattern.c_str(), inputs[j].c_str(), kFnmFlags) == 0) {
+                    best = i;
+                    break;
+                }
+            }
+        }
+        return best < rules_.size() ? rules_[best].config : default_;
+    }
+
+  private:
+    struct Rule {
+        struct fs_path_config config;
+        std::string pattern;
+
+        Rule(unsigned mode, unsigned uid, unsigned gid, uint64_t capabilities, std::string pattern)
+            : config{mode, uid, gid, capabilities, nullptr}, pattern(std::move(pattern)) {}
+    };
+
+    std::vector<Rule> rules_;
+    struct fs_path_config default_;
+    std::unordered_map<std::string_view, size_t> exact_;
+    std::unordered_map<std::string_view, size_t> prefixes_;
+    std::vector<size_t> prefix_lengths_;
+    std::vector<size_t> globs_;
+};
+
+}  // namespace
+
+struct fs_config_matcher {
+    FsConfigRules rules[2];  // indexed by dir
+};
+
+struct fs_config_matcher* fs_config_matcher_create(const char* target_out_path) {
+    auto matcher = new (std::nothrow) fs_config_matcher;
+    if (matcher == nullptr) return nullptr;
+
+    for (int dir = 0; dir < 2; ++dir) {
+        FsConfigRules& rules = matcher->rules[dir];
+        for (size_t which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
+            struct fs_path_config_from_file header;
+            std::string prefix;
+
+            int fd = fs_config_open(dir, which, target_out_path);
+            if (fd < 0) continue;
+
+            while (fs_config_read_entry(fd, conf[which][dir], &header, &prefix)) {
+                rules.Add(dir, header.mode, header.uid, header.gid, header.capabilities,
+                          prefix.c_str(), prefix.size());
+            }
+            close(fd);
+        }
+
+        const struct fs_path_config* pc;
+        for (pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
+            rules.Add(dir, pc->mode, pc->uid, pc->gid, pc->capabilities, pc->prefix,
+                      strlen(pc->prefix));
+        }
+        rules.SetDefault(*pc);
+        rules.Build();
+    }
+    return matcher;
+}
+
+void fs_config_matcher_lookup(const struct fs_config_matcher* matcher, const char* path, int dir,
+                              unsigned* uid, unsigned* gid, unsigned* mode,
+                              uint64_t* capabilities) {
+    if (path[0] == '/') {
+        path++;
+    }
+
+    const struct fs_path_config& pc = matcher->rules[dir ? 1 : 0].Find(dir, path, strlen(path));
+    *uid = pc.uid;
+    *gid = pc.gid;
+    *mode = (*mode & (~07777)) | pc.mode;
+    *capabilities = pc.capabilities;
+}
+
+void fs_config_matcher_free(struct fs_config_matcher* matcher) {
+    delete matcher;
+}
@@ -15,8 +15,11 @@
  */
 
 #include <inttypes.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -25,6 +28,7 @@
 #include <android-base/strings.h>
 
 #include <private/android_filesystem_config.h>
+#include <private/fs_config.h>
 
 #include "fs_config.h"
 
@@ -258,3 +262,108 @@ TEST(fs_config, odm_files_alias) {
 TEST(fs_config, system_alias) {
     EXPECT_FALSE(check_fs_config_cmp(fs_config_cmp_tests));
 }
+
+// Paths to look up: each rule's pattern with its wildcards filled in, with a
+// path component added or removed, and with the system/ alias of a partition
+// added or removed.
+static std::vector<std::string> matcher_test_paths() {
+    std::vector<std::string> patterns;
+    for (const fs_path_config* paths :
+         {__for_testing_only__android_dirs, __for_testing_only__android_files}) {
+        for (size_t idx = 0; paths[idx].prefix; ++idx) {
+            patterns.push_back(paths[idx].prefix);
+        }
+    }
+    for (size_t idx = 0; fs_config_cmp_tests[idx].prefix; ++idx) {
+        patterns.push_back(fs_config_cmp_tests[idx].prefix);
+        patterns.push_back(fs_config_cmp_tests[idx].path);
+    }
+
+    std::vector<std::string> paths;
+    for (std::string path : patterns) {
+        for (size_t pos; (pos = path.find_first_of("*?")) != std::string::npos;) {
+            path.replace(pos, 1, "x");
+        }
+        for (const std::string& base : {path, "system/" + path, "vendor/" + path, path + "2"}) {
+            paths.push_back(base);
+            paths.push_back("/" + base);
+            paths.push_back(base + "/");
+            paths.push_back(base + "/lib/hw");
+            paths.push_back(base.substr(0, base.rfind('/')));
+        }
+        if (android::base::StartsWith(path, "system/")) {
+            paths.push_back(path.substr(strlen("system/")));
+        }
+    }
+    paths.push_back("");
+    paths.push_back("/");
+    return paths;
+}
+
+static void check_matcher(const char* target_out_path) {
+    fs_config_matcher* matcher = fs_config_matcher_create(target_out_path);
+    ASSERT_NE(nullptr, matcher);
+    for (const std::string& path : matcher_test_paths()) {
+        for (int dir : {0, 1}) {
+            unsigned uid = 0, gid = 0, mode = 0170000;
+            uint64_t capabilities = 0;
+            fs_config(path.c_str(), dir, target_out_path, &uid, &gid, &mode, &capabilities);
+            unsigned matcher_uid = 0, matcher_gid = 0, matcher_mode = 0170000;
+            uint64_t matcher_capabilities = 0;
+            fs_config_matcher_lookup(matcher, path.c_str(), dir, &matcher_uid, &matcher_gid,
+                                     &matcher_mode, &matcher_capabilities);
+            EXPECT_EQ(uid, matcher_uid) << path << " dir=" << dir;
+            EXPECT_EQ(gid, matcher_gid) << path << " dir=" << dir;
+            EXPECT_EQ(mode, matcher_mode) << path << " dir=" << dir;
+            EXPECT_EQ(capabilities, matcher_capabilities) << path << " dir=" << dir;
+        }
+    }
+    fs_config_matcher_free(matcher);
+}
+
+TEST(fs_config, matcher_matches_fs_config) {
+    check_matcher(nullptr);
+}
+
+static void write_config_entry(std::string* data, unsigned mode, unsigned uid, const char* prefix) {
+    size_t len = sizeof(fs_path_config_from_file) + strlen(prefix) + 1;
+    len = (len + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    std::string entry(len, '\0');
+    auto pc = reinterpret_cast<fs_path_config_from_file*>(entry.data());
+    pc->len = len;
+    pc->mode = mode;
+    pc->uid = uid;
+    pc->gid = uid;
+    pc->capabilities = uid;
+    strcpy(pc->prefix, prefix);
+    *data += entry;
+}
+
+TEST(fs_config, matcher_matches_fs_config_with_overrides) {
+    TemporaryDir out;
+    std::string etc = std::string(out.path) + "/system/etc";
+    ASSERT_EQ(0, mkdir((std::string(out.path) + "/system").c_str(), 0755));
+    ASSERT_EQ(0, mkdir(etc.c_str(), 0755));
+
+    // Rules that shadow the built in ones, in each shape, and are shadowed in
+    // turn by earlier ones.
+    std::string dirs, files;
+    write_config_entry(&dirs, 0700, 1, "system/bin");
+    write_config_entry(&dirs, 0710, 2, "vendor/*/hw");
+    write_config_entry(&dirs, 0720, 3, "data/");
+    write_config_entry(&files, 0600, 4, "system/bin/sh");
+    write_config_entry(&files, 0610, 5, "system/bin/s*");
+    write_config_entry(&files, 0620, 6, "vendor/lib*/hw/*.so");
+    write_config_entry(&files, 0630, 7, "system/bin/*");
+    write_config_entry(&files, 0640, 8, "odm/bin/wifi");
+    ASSERT_TRUE(android::base::WriteStringToFile(dirs, etc + "/fs_config_dirs"));
+    ASSERT_TRUE(android::base::WriteStringToFile(files, etc + "/fs_config_files"));
+
+    std::string target_out_path = std::string(out.path) + "/system";
+    check_matcher(target_out_path.c_str());
+
+    unlink((etc + "/fs_config_dirs").c_str());
+    unlink((etc + "/fs_config_files").c_str());
+    rmdir(etc.c_str());
+    rmdir((std::string(out.path) + "/system").c_str());
+}
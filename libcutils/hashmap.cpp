@@ -19,27 +19,84 @@
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
+// An open-addressing table with linear probing. Next to the array of entries
+// is an array with a control byte for each, which says whether the entry is
+// empty, used, or removed, and for used entries holds 7 bits of the key's hash.
+// Probing reads the control bytes, which are compact enough to stay in cache,
+// and only looks at an entry when its bits match.
+//
+// Removed entries leave a tombstone where needed rather than moving later
+// entries up, so that a hashmapForEach() callback may remove the entry it was
+// called for, as callers have always been able to.
 typedef struct Entry Entry;
 struct Entry {
     void* key;
-    int hash;
     void* value;
-    Entry* next;
+    int hash;
+};
+
+enum : uint8_t {
+    CONTROL_EMPTY = 0,
+    CONTROL_REMOVED,
+    // Only while dropTombstones() runs: used, but not yet moved into place.
+    CONTROL_PENDING,
+    // Used entries have this bit set, and 7 bits of their hash below it.
+    CONTROL_USED = 0x80,
 };
 
 struct Hashmap {
-    Entry** buckets;
-    size_t bucketCount;
+    Entry* entries;
+    uint8_t* control;
+    size_t capacity;
     int (*hash)(void* key);
     bool (*equals)(void* keyA, void* keyB);
     pthread_mutex_t lock;
     size_t size;
+    // Entries that are CONTROL_REMOVED, which are probed past like used ones.
+    size_t removed;
 };
 
+// The table is grown, or rebuilt without tombstones, before more than 3/4 of
+// its entries are used or removed, which keeps probe sequences short.
+static inline bool overLoaded(size_t capacity, size_t count) {
+    return count > capacity * 3 / 4;
+}
+
+static size_t capacityFor(size_t size) {
+    size_t capacity = 8;
+    while (overLoaded(capacity, size)) {
+        // Capacity must be power of 2.
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+static inline bool isUsed(uint8_t control) {
+    return (control & CONTROL_USED) != 0;
+}
+
+// The index comes from the low bits of the hash, so take these from the top.
+static inline uint8_t usedControl(int hash) {
+    return CONTROL_USED | (((unsigned int) hash) >> 25);
+}
+
+// Allocates the entries and their control bytes together, with every entry
+// empty.
+static bool allocateTable(size_t capacity, Entry** entries, uint8_t** control) {
+    char* table = static_cast<char*>(calloc(capacity, sizeof(Entry) + 1));
+    if (table == NULL) {
+        return false;
+    }
+    *entries = reinterpret_cast<Entry*>(table);
+    *control = reinterpret_cast<uint8_t*>(table + capacity * sizeof(Entry));
+    return true;
+}
+
 Hashmap* hashmapCreate(size_t initialCapacity,
         int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
     assert(hash != NULL);
@@ -50,21 +107,14 @@ Hashmap* hashmapCreate(size_t initialCapacity,
         return NULL;
     }
 
-    // 0.75 load factor.
-    size_t minimumBucketCount = initialCapacity * 4 / 3;
-    map->bucketCount = 1;
-    while (map->bucketCount <= minimumBucketCount) {
-        // Bucket count must be power of 2.
-        map->bucketCount <<= 1;
-    }
-
-    map->buckets = static_cast<Entry**>(calloc(map->bucketCount, sizeof(Entry*)));
-    if (map->buckets == NULL) {
+    map->capacity = capacityFor(initialCapacity);
+    if (!allocateTable(map->capacity, &map->entries, &map->control)) {
         free(map);
         return NULL;
     }
 
     map->size = 0;
+    map->removed = 0;
 
     map->hash = hash;
     map->equals = equals;
@@ -93,39 +143,74 @@ static inline int hashKey(Hashmap* map, void* key) {
     return h;
 }
 
-static inline size_t calculateIndex(size_t bucketCount, int hash) {
-    return ((size_t) hash) & (bucketCount - 1);
+static inline size_t calculateIndex(size_t capacity, int hash) {
+    return ((size_t) hash) & (capacity - 1);
 }
 
-static void expandIfNecessary(Hashmap* map) {
-    // If the load factor exceeds 0.75...
-    if (map->size > (map->bucketCount * 3 / 4)) {
-        // Start off with a 0.33 load factor.
-        size_t newBucketCount = map->bucketCount << 1;
-        Entry** newBuckets = static_cast<Entry**>(calloc(newBucketCount, sizeof(Entry*)));
-        if (newBuckets == NULL) {
-            // Abort expansion.
-            return;
+// Returns the index of the first entry that isn't used on the probe sequence
+// for hash.
+static inline size_t findUnused(const uint8_t* control, size_t capacity, int hash) {
+    size_t index = calculateIndex(capacity, hash);
+    while (isUsed(control[index])) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return index;
+}
+
+// Moves the used entries to a larger table of the given capacity, dropping the
+// tombstones. Returns false, leaving the map as it was, if out of memory.
+static bool rehash(Hashmap* map, size_t newCapacity) {
+    Entry* newEntries;
+    uint8_t* newControl;
+    if (!allocateTable(newCapacity, &newEntries, &newControl)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (!isUsed(map->control[i])) {
+            continue;
         }
+        size_t index = findUnused(newControl, newCapacity, map->entries[i].hash);
+        newEntries[index] = map->entries[i];
+        newControl[index] = map->control[i];
+    }
+
+    free(map->entries);
+    map->entries = newEntries;
+    map->control = newControl;
+    map->capacity = newCapacity;
+    map->removed = 0;
+    return true;
+}
 
-        // Move over existing entries.
-        size_t i;
-        for (i = 0; i < map->bucketCount; i++) {
-            Entry* entry = map->buckets[i];
-            while (entry != NULL) {
-                Entry* next = entry->next;
-                size_t index = calculateIndex(newBucketCount, entry->hash);
-                entry->next = newBuckets[index];
-                newBuckets[index] = entry;
-                entry = next;
+// Rebuilds the table in place without its tombstones, for a table that has
+// plenty of room but has seen many removes: each used entry is taken out in
+// turn and put back in the first free entry it probes, displacing any entry
+// not yet moved into place, which is then put back in the same way.
+static void dropTombstones(Hashmap* map) {
+    for (size_t i = 0; i < map->capacity; i++) {
+        map->control[i] = isUsed(map->control[i]) ? CONTROL_PENDING : CONTROL_EMPTY;
+    }
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->control[i] != CONTROL_PENDING) {
+            continue;
+        }
+        Entry moving = map->entries[i];
+        map->control[i] = CONTROL_EMPTY;
+        while (true) {
+            size_t index = findUnused(map->control, map->capacity, moving.hash);
+            Entry displaced = map->entries[index];
+            bool pending = map->control[index] == CONTROL_PENDING;
+            map->entries[index] = moving;
+            map->control[index] = usedControl(moving.hash);
+            if (!pending) {
+                break;
             }
+            moving = displaced;
         }
-
-        // Copy over internals.
-        free(map->buckets);
-        map->buckets = newBuckets;
-        map->bucketCount = newBucketCount;
     }
+    map->removed = 0;
 }
 
 void hashmapLock(Hashmap* map) {
@@ -137,16 +222,7 @@ void hashmapUnlock(Hashmap* map) {
 }
 
 void hashmapFree(Hashmap* map) {
-    size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry* next = entry->next;
-            free(entry);
-            entry = next;
-        }
-    }
-    free(map->buckets);
+    free(map->entries);
     pthread_mutex_destroy(&map->lock);
     free(map);
 }
@@ -166,18 +242,6 @@ int hashmapHash(void* key, size_t keySize) {
     return h;
 }
 
-static Entry* createEntry(void* key, int hash, void* value) {
-    Entry* entry = static_cast<Entry*>(malloc(sizeof(Entry)));
-    if (entry == NULL) {
-        return NULL;
-    }
-    entry->key = key;
-    entry->hash = hash;
-    entry->value = value;
-    entry->next = NULL;
-    return entry;
-}
-
 static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
         bool (*equals)(void*, void*)) {
     if (keyA == keyB) {
@@ -189,86 +253,113 @@ static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
     return equals(keyA, keyB);
 }
 
-void* hashmapPut(Hashmap* map, void* key, void* value) {
-    int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, value);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
+// Returns the index of the used entry for key, or -1. If there is none and
+// unused isn't NULL, sets it to the index a new entry for key would go in.
+// Every probe sequence ends at an empty entry, since the table is never full.
+static inline ssize_t findEntry(Hashmap* map, void* key, int hash, size_t* unused) {
+    uint8_t wanted = usedControl(hash);
+    size_t mask = map->capacity - 1;
+    size_t firstRemoved = SIZE_MAX;
+    for (size_t index = calculateIndex(map->capacity, hash);; index = (index + 1) & mask) {
+        uint8_t control = map->control[index];
+        if (control == CONTROL_EMPTY) {
+            if (unused != NULL) {
+                *unused = firstRemoved != SIZE_MAX ? firstRemoved : index;
             }
-            map->size++;
-            expandIfNecessary(map);
-            return NULL;
+            return -1;
         }
-
-        // Replace existing entry.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* oldValue = current->value;
-            current->value = value;
-            return oldValue;
+        if (control == wanted) {
+            Entry* entry = &map->entries[index];
+            if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
+                return index;
+            }
+        } else if (control == CONTROL_REMOVED && firstRemoved == SIZE_MAX) {
+            firstRemoved = index;
         }
-
-        // Move to next entry.
-        p = &current->next;
     }
 }
 
-void* hashmapGet(Hashmap* map, void* key) {
+void* hashmapPut(Hashmap* map, void* key, void* value) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
 
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return entry->value;
+    // Replace existing entry.
+    size_t index;
+    ssize_t found = findEntry(map, key, hash, &index);
+    if (found >= 0) {
+        void* oldValue = map->entries[found].value;
+        map->entries[found].value = value;
+        return oldValue;
+    }
+
+    // Make room for a new entry, leaving the table at most 3/8 used so that
+    // the cost of rebuilding it is spread over many more puts and removes:
+    // that means clearing out the tombstones if that is enough, otherwise
+    // growing. If growing fails, carry on while there is still an empty entry
+    // left to end probe sequences.
+    if (overLoaded(map->capacity, map->size + map->removed + 1)) {
+        if (!overLoaded(map->capacity, 2 * map->size)) {
+            dropTombstones(map);
+        } else if (!rehash(map, capacityFor(2 * map->size)) &&
+                   map->size + map->removed + 1 >= map->capacity) {
+            errno = ENOMEM;
+            return NULL;
         }
-        entry = entry->next;
+        index = findUnused(map->control, map->capacity, hash);
     }
 
+    // Add a new entry, reusing the first tombstone on the way.
+    if (map->control[index] == CONTROL_REMOVED) {
+        map->removed--;
+    }
+    map->entries[index].key = key;
+    map->entries[index].value = value;
+    map->entries[index].hash = hash;
+    map->control[index] = usedControl(hash);
+    map->size++;
     return NULL;
 }
 
-void* hashmapRemove(Hashmap* map, void* key) {
-    int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    // Pointer to the current entry.
-    Entry** p = &(map->buckets[index]);
-    Entry* current;
-    while ((current = *p) != NULL) {
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* value = current->value;
-            *p = current->next;
-            free(current);
-            map->size--;
-            return value;
-        }
+void* hashmapGet(Hashmap* map, void* key) {
+    ssize_t found = findEntry(map, key, hashKey(map, key), NULL);
+    return found >= 0 ? map->entries[found].value : NULL;
+}
 
-        p = &current->next;
+void* hashmapRemove(Hashmap* map, void* key) {
+    ssize_t found = findEntry(map, key, hashKey(map, key), NULL);
+    if (found < 0) {
+        return NULL;
     }
 
-    return NULL;
+    void* value = map->entries[found].value;
+    map->size--;
+
+    // A tombstone is only needed if later entries may have probed past this
+    // one. If the next entry is empty they haven't, and the tombstones just
+    // before this one can go too, which keeps misses from probing through
+    // runs of them.
+    size_t mask = map->capacity - 1;
+    size_t index = found;
+    if (map->control[(index + 1) & mask] != CONTROL_EMPTY) {
+        map->control[index] = CONTROL_REMOVED;
+        map->removed++;
+        return value;
+    }
+    map->control[index] = CONTROL_EMPTY;
+    while (map->control[index = (index - 1) & mask] == CONTROL_REMOVED) {
+        map->control[index] = CONTROL_EMPTY;
+        map->removed--;
+    }
+    return value;
 }
 
 void hashmapForEach(Hashmap* map, bool (*callback)(void* key, void* value, void* context),
                     void* context) {
-    size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry *next = entry->next;
-            if (!callback(entry->key, entry->value, context)) {
-                return;
-            }
-            entry = next;
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (!isUsed(map->control[i])) {
+            continue;
+        }
+        if (!callback(map->entries[i].key, map->entries[i].value, context)) {
+            return;
         }
     }
 }
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <cutils/hashmap.h>
+
+static int str_hash(void* key) {
+    return hashmapHash(key, strlen(static_cast<char*>(key)));
+}
+
+static bool str_equals(void* a, void* b) {
+    return strcmp(static_cast<char*>(a), static_cast<char*>(b)) == 0;
+}
+
+static std::vector<std::string> makeKeys(size_t count) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < count; i++) {
+        keys.push_back("routing_key_" + std::to_string(i));
+    }
+    return keys;
+}
+
+// The way a set of audio parameters used it: a small map of string keys,
+// created, filled, queried, walked and freed for every set_parameters() call.
+static void BM_hashmap_small_string_map(benchmark::State& state) {
+    std::vector<std::string> keys = makeKeys(state.range(0));
+    for (auto _ : state) {
+        Hashmap* map = hashmapCreate(5, str_hash, str_equals);
+        for (auto& key : keys) {
+            hashmapPut(map, key.data(), key.data());
+        }
+        for (auto& key : keys) {
+            benchmark::DoNotOptimize(hashmapGet(map, key.data()));
+        }
+        hashmapForEach(
+                map, [](void*, void* value, void*) {
+                    benchmark::DoNotOptimize(value);
+                    return true;
+                },
+                nullptr);
+        hashmapFree(map);
+    }
+}
+BENCHMARK(BM_hashmap_small_string_map)->Arg(4)->Arg(16);
+
+static int int_hash(void* key) {
+    return static_cast<int>(reinterpret_cast<intptr_t>(key));
+}
+
+static bool int_equals(void* a, void* b) {
+    return a == b;
+}
+
+static void BM_hashmap_get(benchmark::State& state) {
+    Hashmap* map = hashmapCreate(0, int_hash, int_equals);
+    intptr_t count = state.range(0);
+    for (intptr_t i = 0; i < count; i++) {
+        hashmapPut(map, reinterpret_cast<void*>(i), reinterpret_cast<void*>(i));
+    }
+    intptr_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hashmapGet(map, reinterpret_cast<void*>(i)));
+        i = (i + 7) % (2 * count);  // half of them miss
+    }
+    hashmapFree(map);
+}
+BENCHMARK(BM_hashmap_get)->Arg(16)->Arg(1024)->Arg(65536);
+
+static void BM_hashmap_put_remove(benchmark::State& state) {
+    Hashmap* map = hashmapCreate(0, int_hash, int_equals);
+    intptr_t count = state.range(0);
+    for (intptr_t i = 0; i < count; i++) {
+        hashmapPut(map, reinterpret_cast<void*>(i), reinterpret_cast<void*>(i));
+    }
+    intptr_t i = 0;
+    for (auto _ : state) {
+        hashmapRemove(map, reinterpret_cast<void*>(i));
+        hashmapPut(map, reinterpret_cast<void*>(i + count), reinterpret_cast<void*>(i));
+        i++;
+    }
+    hashmapFree(map);
+}
+BENCHMARK(BM_hashmap_put_remove)->Arg(16)->Arg(1024);
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap.h>
+
+#include <stdint.h>
+
+#include <map>
+
+#include <gtest/gtest.h>
+
+// Keys are small integers cast to pointers.
+static void* key(intptr_t i) {
+    return reinterpret_cast<void*>(i);
+}
+
+static int int_hash(void* k) {
+    return static_cast<int>(reinterpret_cast<intptr_t>(k));
+}
+
+// Puts every key in the same place, so that every lookup probes past all of
+// the others.
+static int colliding_hash(void*) {
+    return 42;
+}
+
+static bool int_equals(void* a, void* b) {
+    return a == b;
+}
+
+static void check_against_map(int (*hash)(void*), int count) {
+    Hashmap* map = hashmapCreate(0, hash, int_equals);
+    ASSERT_NE(nullptr, map);
+    std::map<intptr_t, intptr_t> expected;
+
+    for (intptr_t i = 1; i <= count; i++) {
+        ASSERT_EQ(nullptr, hashmapPut(map, key(i), key(i * 2)));
+        expected[i] = i * 2;
+    }
+    // Remove every third key and replace the values of the others, leaving
+    // tombstones for later puts to reuse.
+    for (intptr_t i = 1; i <= count; i++) {
+        if (i % 3 == 0) {
+            ASSERT_EQ(key(i * 2), hashmapRemove(map, key(i)));
+            ASSERT_EQ(nullptr, hashmapRemove(map, key(i)));
+            expected.erase(i);
+        } else {
+            ASSERT_EQ(key(i * 2), hashmapPut(map, key(i), key(i * 3)));
+            expected[i] = i * 3;
+        }
+    }
+    for (intptr_t i = count + 1; i <= count * 2; i++) {
+        ASSERT_EQ(nullptr, hashmapPut(map, key(i), key(i * 2)));
+        expected[i] = i * 2;
+    }
+
+    for (intptr_t i = 1; i <= count * 2 + 1; i++) {
+        auto it = expected.find(i);
+        EXPECT_EQ(it != expected.end() ? key(it->second) : nullptr, hashmapGet(map, key(i))) << i;
+    }
+
+    std::map<intptr_t, intptr_t> actual;
+    hashmapForEach(
+            map,
+            [](void* k, void* v, void* context) {
+                auto actual = static_cast<std::map<intptr_t, intptr_t>*>(context);
+                EXPECT_TRUE(actual->emplace(int_hash(k), int_hash(v)).second);
+                return true;
+            },
+            &actual);
+    EXPECT_EQ(expected, actual);
+
+    hashmapFree(map);
+}
+
+TEST(hashmap, matches_std_map) {
+    check_against_map(int_hash, 1000);
+}
+
+TEST(hashmap, colliding_keys) {
+    check_against_map(colliding_hash, 100);
+}
+
+TEST(hashmap, remove_while_iterating) {
+    Hashmap* map = hashmapCreate(4, int_hash, int_equals);
+    ASSERT_NE(nullptr, map);
+    for (intptr_t i = 1; i <= 100; i++) {
+        ASSERT_EQ(nullptr, hashmapPut(map, key(i), key(i)));
+    }
+
+    // Removing the entry the callback is called for mustn't skip any others.
+    struct Context {
+        Hashmap* map;
+        int removed;
+    } context = {map, 0};
+    hashmapForEach(
+            map,
+            [](void* k, void*, void* context) {
+                auto c = static_cast<Context*>(context);
+                EXPECT_EQ(k, hashmapRemove(c->map, k));
+                c->removed++;
+                return true;
+            },
+            &context);
+    EXPECT_EQ(100, context.removed);
+    for (intptr_t i = 1; i <= 100; i++) {
+        EXPECT_EQ(nullptr, hashmapGet(map, key(i)));
+    }
+
+    hashmapFree(map);
+}
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
 #if defined(__BIONIC__)
 #include <linux/ashmem.h>
@@ -33,6 +34,54 @@ int ashmem_pin_region(int fd, size_t offset, size_t len);
 int ashmem_unpin_region(int fd, size_t offset, size_t len);
 int ashmem_get_size_region(int fd);
 
+/*
+ * A pool of shared memory regions for clients that allocate many short-lived
+ * ones, which hands out page-aligned ranges of a few large regions (sealed
+ * memfds where supported) instead of creating a region, and a file
+ * descriptor, for each.
+ *
+ * A pooled region is the range [offset, offset + size) of fd, which is shared
+ * with the pool's other regions and owned by the pool: map the range, and
+ * don't close fd. Since anyone holding fd can map all the regions it holds,
+ * a region that will be sent to another process, or write-protected with
+ * ashmem_set_prot_region(), must be allocated with ASHMEM_POOL_SEPARATE to
+ * get an fd of its own, at offset 0. Requests of more than half the pool's
+ * chunk size get one anyway.
+ *
+ * Regions are zero-filled when allocated, including recycled ones. The pool
+ * is thread-safe. Destroying it closes the fds of all its regions.
+ */
+struct ashmem_pool;
+
+struct ashmem_pool_region {
+    int fd;
+    size_t offset;
+    size_t size;
+};
+
+struct ashmem_pool_stats {
+    size_t chunks;            /* shared regions the pool currently holds */
+    size_t chunk_bytes;       /* their total size */
+    size_t allocated_bytes;   /* bytes in regions handed out, of chunks or separate */
+    size_t regions;           /* regions handed out, including separate ones */
+    size_t separate_regions;  /* regions with an fd of their own */
+    uint64_t allocs;          /* successful ashmem_pool_alloc() calls */
+    uint64_t frees;           /* successful ashmem_pool_free() calls */
+    uint64_t chunks_created;  /* times the pool created a shared region */
+};
+
+#define ASHMEM_POOL_SEPARATE 0x1  /* give the region an fd of its own */
+
+/* chunk_size is the size of the shared regions, or 0 for a default. */
+struct ashmem_pool* ashmem_pool_create(const char* name, size_t chunk_size);
+void ashmem_pool_destroy(struct ashmem_pool* pool);
+/* Returns 0, or a negative errno if out of memory or fds. */
+int ashmem_pool_alloc(struct ashmem_pool* pool, size_t size, int flags,
+                      struct ashmem_pool_region* region);
+/* Returns 0, or -EINVAL if region isn't one allocated from pool. */
+int ashmem_pool_free(struct ashmem_pool* pool, const struct ashmem_pool_region* region);
+void ashmem_pool_get_stats(struct ashmem_pool* pool, struct ashmem_pool_stats* stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CUTILS_BOOT_EVENTS_H_
+#define _CUTILS_BOOT_EVENTS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*
+ * A timeline of boot phases, shared by every process that takes part in boot.
+ *
+ * First stage init creates the buffer on /dev's tmpfs, and the processes that
+ * follow (second stage init, ueventd, fs_mgr, snapuserd...) add to it. Adding
+ * an event takes no locks and makes no system calls beyond reading the clock,
+ * except for mapping the buffer on a process's first event. Processes that
+ * can't map the buffer drop their events.
+ *
+ * The buffer is a ring: once it is full, the oldest events are overwritten.
+ */
+
+__BEGIN_DECLS
+
+#define BOOT_EVENTS_FILE "/dev/.boot_events"
+
+/* The number of events the buffer holds before it starts overwriting. */
+#define BOOT_EVENTS_MAX 4096
+
+/* Event phases, the same letters as the Trace Event Format uses. */
+#define BOOT_EVENT_BEGIN 'B'
+#define BOOT_EVENT_END 'E'
+#define BOOT_EVENT_INSTANT 'i'
+
+#define BOOT_EVENT_CATEGORY_MAX 16
+#define BOOT_EVENT_NAME_MAX 48
+
+struct boot_event {
+    /* CLOCK_BOOTTIME, the clock of the ro.boottime.* properties. */
+    uint64_t timestamp_ns;
+    int32_t pid;
+    int32_t tid;
+    char phase;
+    /* NUL-terminated, and truncated if necessary. */
+    char category[BOOT_EVENT_CATEGORY_MAX];
+    char name[BOOT_EVENT_NAME_MAX];
+};
+
+/*
+ * Creates an empty buffer at |path|, replacing any existing one, and maps it
+ * for this process's events. Returns 0 on success or -1 and sets errno.
+ */
+int boot_events_create(const char* path);
+
+/*
+ * Records an event with the current time, or |timestamp_ns|. The first call
+ * in a process maps BOOT_EVENTS_FILE unless boot_events_create() was called.
+ * Neither changes errno.
+ */
+void boot_event_record(char phase, const char* category, const char* name);
+void boot_event_record_at(char phase, const char* category, const char* name,
+                          uint64_t timestamp_ns);
+
+static inline void boot_event_begin(const char* category, const char* name) {
+    boot_event_record(BOOT_EVENT_BEGIN, category, name);
+}
+
+static inline void boot_event_end(const char* category, const char* name) {
+    boot_event_record(BOOT_EVENT_END, category, name);
+}
+
+static inline void boot_event_instant(const char* category, const char* name) {
+    boot_event_record(BOOT_EVENT_INSTANT, category, name);
+}
+
+/*
+ * Copies up to |max_events| of the events in the buffer at |path| into
+ * |events|, oldest first. Events still being written are skipped. Returns the
+ * number of events copied, or -1 and sets errno.
+ */
+ssize_t boot_events_read(const char* path, struct boot_event* events, size_t max_events);
+
+__END_DECLS
+
+#endif /* _CUTILS_BOOT_EVENTS_H_ */
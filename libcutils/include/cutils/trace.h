@@ -89,6 +89,17 @@ __BEGIN_DECLS
 #error ATRACE_TAG must be defined to be one of the tags defined in cutils/trace.h
 #endif
 
+/**
+ * The tags that trace calls in this translation unit may be enabled for.
+ * Calls for any other tag compile to nothing, without reading the enabled
+ * tags, so a module can define this (for instance to ATRACE_TAG_NEVER in a
+ * release build of a HAL) to take tracing out of its hot paths altogether.
+ * ATRACE_TAG_ALWAYS is always compiled in. By default all tags are.
+ */
+#ifndef ATRACE_TAGS_COMPILED_IN
+#define ATRACE_TAGS_COMPILED_IN ATRACE_TAG_VALID_MASK
+#endif
+
 /**
  * Opens the trace file for writing and reads the property for initial tags.
  * The atrace.tags.enableflags property sets the tags to trace.
@@ -109,6 +120,29 @@ void atrace_update_tags();
  */
 void atrace_set_tracing_enabled(bool enabled);
 
+/**
+ * Buffer the trace markers of the calling thread, so that several are written
+ * to the trace buffer at once instead of with a write each. Up to
+ * ATRACE_MESSAGE_LENGTH bytes of markers, each followed by a newline, are
+ * kept, and they are written when that would overflow, when a marker is made
+ * max_delay_ns or more after the oldest one kept, on atrace_flush(), or when
+ * the thread exits.
+ *
+ * The kernel timestamps markers when they are written, so buffered events may
+ * show as shorter than they were, by up to max_delay_ns. The markers of the
+ * thread stay in order, but may be interleaved differently with those of other
+ * threads.
+ *
+ * Passing a max_delay_ns of 0 writes out the buffered markers, and stops
+ * buffering.
+ */
+void atrace_set_thread_buffering(uint64_t max_delay_ns);
+
+/**
+ * Write out any trace markers buffered by the calling thread.
+ */
+void atrace_flush();
+
 /**
  * This is always set to false. This forces code that uses an old version
  * of this header to always call into atrace_setup, in which we call
@@ -148,6 +182,12 @@ uint64_t atrace_get_enabled_tags();
 #define ATRACE_ENABLED() atrace_is_tag_enabled(ATRACE_TAG)
 static inline uint64_t atrace_is_tag_enabled(uint64_t tag)
 {
+    // When tag is a constant, as it is for the ATRACE_* macros, this folds away
+    // for tags that aren't compiled in.
+    tag &= (uint64_t)(ATRACE_TAGS_COMPILED_IN) | ATRACE_TAG_ALWAYS;
+    if (tag == 0) {
+        return 0;
+    }
     return atrace_get_enabled_tags() & tag;
 }
 
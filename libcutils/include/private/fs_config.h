@@ -47,4 +47,21 @@ __BEGIN_DECLS
 void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
                unsigned* mode, uint64_t* capabilities);
 
+/*
+ * For callers that look up many paths, such as the image builders: the rules
+ * fs_config() uses, read from the fs_config_(dirs|files) files once and
+ * indexed so that most paths are looked up without trying every rule.
+ * fs_config_matcher_lookup() gives the same results as fs_config() with the
+ * same target_out_path, as long as the files don't change.
+ *
+ * fs_config_matcher_create() returns NULL if it runs out of memory.
+ */
+struct fs_config_matcher;
+
+struct fs_config_matcher* fs_config_matcher_create(const char* target_out_path);
+void fs_config_matcher_lookup(const struct fs_config_matcher* matcher, const char* path, int dir,
+                              unsigned* uid, unsigned* gid, unsigned* mode,
+                              uint64_t* capabilities);
+void fs_config_matcher_free(struct fs_config_matcher* matcher);
+
 __END_DECLS
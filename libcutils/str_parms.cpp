@@ -26,120 +26,210 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <cutils/hashmap.h>
 #include <cutils/memory.h>
 #include <log/log.h>
 
-/* When an object is allocated but not freed in a function,
- * because its ownership is released to other object like a hashmap,
- * call RELEASE_OWNERSHIP to tell the clang analyzer and avoid
- * false warnings about potential memory leak.
- * For now, a "temporary" assignment to global variables
- * is enough to confuse the clang static analyzer.
+/* The keys and values are kept as "key\0value\0" strings in one growable
+ * arena, and found by comparing hashes along a flat array of entries, kept
+ * in the order the keys were added. The first few entries are stored in the
+ * str_parms itself. A typical set of parameters has only a handful of keys,
+ * so this beats a Hashmap and needs no allocation per key or value:
+ * str_parms_create_str() copies the string into the arena and splits it in
+ * place.
  */
-#ifdef __clang_analyzer__
-static void *released_pointer;
-#define RELEASE_OWNERSHIP(x) { released_pointer = x; released_pointer = 0; }
-#else
-#define RELEASE_OWNERSHIP(x)
-#endif
+#define STR_PARMS_INLINE_ENTRIES 16
 
-struct str_parms {
-    Hashmap *map;
+struct str_parms_entry {
+    uint32_t hash;
+    // Offsets of the key and value in the arena.
+    uint32_t key;
+    uint32_t value;
 };
 
-
-static bool str_eq(void *key_a, void *key_b)
-{
-    return !strcmp((const char *)key_a, (const char *)key_b);
-}
+struct str_parms {
+    char *arena;
+    size_t arena_len;
+    size_t arena_size;
+    // Bytes of the arena no longer used by any entry.
+    size_t arena_unused;
+
+    struct str_parms_entry *entries;
+    size_t count;
+    size_t capacity;
+    struct str_parms_entry inline_entries[STR_PARMS_INLINE_ENTRIES];
+};
 
 /* use djb hash unless we find it inadequate */
 #ifdef __clang__
 __attribute__((no_sanitize("integer")))
 #endif
-static int str_hash_fn(void *str)
+static uint32_t str_hash_fn(const char *str, size_t *len)
 {
     uint32_t hash = 5381;
+    const char *p;
 
-    for (char* p = static_cast<char*>(str); p && *p; p++)
+    for (p = str; *p; p++)
         hash = ((hash << 5) + hash) + *p;
-    return (int)hash;
+    *len = p - str;
+    return hash;
 }
 
-struct str_parms *str_parms_create(void)
+static const char *entry_key(const struct str_parms *str_parms,
+                             const struct str_parms_entry *entry)
 {
-    str_parms* s = static_cast<str_parms*>(calloc(1, sizeof(str_parms)));
-    if (!s) return NULL;
+    return str_parms->arena + entry->key;
+}
 
-    s->map = hashmapCreate(5, str_hash_fn, str_eq);
-    if (!s->map) {
-        free(s);
-        return NULL;
+static const char *entry_value(const struct str_parms *str_parms,
+                               const struct str_parms_entry *entry)
+{
+    return str_parms->arena + entry->value;
+}
+
+static struct str_parms_entry *find_entry(const struct str_parms *str_parms,
+                                          const char *key, uint32_t hash)
+{
+    for (size_t i = 0; i < str_parms->count; i++) {
+        struct str_parms_entry *entry = &str_parms->entries[i];
+        if (entry->hash == hash && !strcmp(entry_key(str_parms, entry), key))
+            return entry;
     }
+    return NULL;
+}
 
-    return s;
+static const char *get_value(const struct str_parms *str_parms, const char *key)
+{
+    size_t len;
+    const struct str_parms_entry *entry = find_entry(str_parms, key, str_hash_fn(key, &len));
+    return entry ? entry_value(str_parms, entry) : NULL;
 }
 
-struct remove_ctxt {
-    struct str_parms *str_parms;
-    const char *key;
-};
+/* Makes room for len more bytes at the end of the arena, returning false
+ * if it can't. */
+static bool reserve_arena(struct str_parms *str_parms, size_t len)
+{
+    if (str_parms->arena_len + len <= str_parms->arena_size)
+        return true;
+    if (str_parms->arena_len + len > UINT32_MAX)
+        return false;
+
+    size_t size = str_parms->arena_size ? str_parms->arena_size : 64;
+    while (size < str_parms->arena_len + len)
+        size *= 2;
+    char *arena = static_cast<char *>(realloc(str_parms->arena, size));
+    if (!arena)
+        return false;
+    str_parms->arena = arena;
+    str_parms->arena_size = size;
+    return true;
+}
 
-static bool remove_pair(void *key, void *value, void *context)
+static uint32_t append_string(struct str_parms *str_parms, const char *str, size_t len)
 {
-    remove_ctxt* ctxt = static_cast<remove_ctxt*>(context);
-    bool should_continue;
-
-    /*
-     * - if key is not supplied, then we are removing all entries,
-     *   so remove key and continue (i.e. return true)
-     * - if key is supplied and matches, then remove it and don't
-     *   continue (return false). Otherwise, return true and keep searching
-     *   for key.
-     *
-     */
-    if (!ctxt->key) {
-        should_continue = true;
-        goto do_remove;
-    } else if (!strcmp(ctxt->key, static_cast<const char*>(key))) {
-        should_continue = false;
-        goto do_remove;
+    uint32_t offset = str_parms->arena_len;
+    memcpy(str_parms->arena + offset, str, len + 1);
+    str_parms->arena_len += len + 1;
+    return offset;
+}
+
+static struct str_parms_entry *add_entry(struct str_parms *str_parms)
+{
+    if (str_parms->count == str_parms->capacity) {
+        size_t capacity = str_parms->capacity * 2;
+        struct str_parms_entry *entries;
+        if (str_parms->entries == str_parms->inline_entries) {
+            entries = static_cast<str_parms_entry *>(malloc(capacity * sizeof(*entries)));
+            if (entries)
+                memcpy(entries, str_parms->entries, str_parms->count * sizeof(*entries));
+        } else {
+            entries = static_cast<str_parms_entry *>(
+                    realloc(str_parms->entries, capacity * sizeof(*entries)));
+        }
+        if (!entries)
+            return NULL;
+        str_parms->entries = entries;
+        str_parms->capacity = capacity;
     }
+    return &str_parms->entries[str_parms->count++];
+}
 
-    return true;
+/* Bytes of the arena used by entry, which are unused once it is removed. */
+static size_t entry_size(const struct str_parms *str_parms, const struct str_parms_entry *entry)
+{
+    size_t key_size = strlen(entry_key(str_parms, entry)) + 1;
+    if (entry->value == entry->key + key_size - 1)
+        return key_size;
+    return key_size + strlen(entry_value(str_parms, entry)) + 1;
+}
 
-do_remove:
-    hashmapRemove(ctxt->str_parms->map, key);
-    free(key);
-    free(value);
-    return should_continue;
+/* Copies the strings still in use to a new arena once most of it is unused,
+ * so that a long-lived str_parms that is often changed doesn't keep growing. */
+static void compact_arena(struct str_parms *str_parms)
+{
+    if (str_parms->arena_unused < 256 || str_parms->arena_unused < str_parms->arena_len / 2)
+        return;
+
+    size_t size = 0;
+    for (size_t i = 0; i < str_parms->count; i++)
+        size += entry_size(str_parms, &str_parms->entries[i]);
+    char *arena = static_cast<char *>(malloc(size ? size : 1));
+    if (!arena)
+        return;
+    char *old_arena = str_parms->arena;
+    str_parms->arena = arena;
+    str_parms->arena_size = size ? size : 1;
+    str_parms->arena_len = 0;
+    str_parms->arena_unused = 0;
+    for (size_t i = 0; i < str_parms->count; i++) {
+        struct str_parms_entry *entry = &str_parms->entries[i];
+        const char *key = old_arena + entry->key;
+        const char *value = old_arena + entry->value;
+        size_t key_len = strlen(key);
+        entry->key = append_string(str_parms, key, key_len);
+        if (value == key + key_len) {
+            entry->value = entry->key + key_len;
+        } else {
+            entry->value = append_string(str_parms, value, strlen(value));
+        }
+    }
+    free(old_arena);
+}
+
+struct str_parms *str_parms_create(void)
+{
+    str_parms* s = static_cast<str_parms*>(calloc(1, sizeof(str_parms)));
+    if (!s) return NULL;
+
+    s->entries = s->inline_entries;
+    s->capacity = STR_PARMS_INLINE_ENTRIES;
+    return s;
 }
 
 void str_parms_del(struct str_parms *str_parms, const char *key)
 {
-    struct remove_ctxt ctxt = {
-        .str_parms = str_parms,
-        .key = key,
-    };
-    hashmapForEach(str_parms->map, remove_pair, &ctxt);
+    size_t len;
+    struct str_parms_entry *entry = find_entry(str_parms, key, str_hash_fn(key, &len));
+    if (!entry)
+        return;
+
+    str_parms->arena_unused += entry_size(str_parms, entry);
+    size_t index = entry - str_parms->entries;
+    memmove(entry, entry + 1, (str_parms->count - index - 1) * sizeof(*entry));
+    str_parms->count--;
+    compact_arena(str_parms);
 }
 
 void str_parms_destroy(struct str_parms *str_parms)
 {
-    struct remove_ctxt ctxt = {
-        .str_parms = str_parms,
-    };
-
-    hashmapForEach(str_parms->map, remove_pair, &ctxt);
-    hashmapFree(str_parms->map);
+    if (str_parms->entries != str_parms->inline_entries)
+        free(str_parms->entries);
+    free(str_parms->arena);
     free(str_parms);
 }
 
 struct str_parms *str_parms_create_str(const char *_string)
 {
     struct str_parms *str_parms;
-    char *str;
     char *kvpair;
     char *tmpstr;
     int items = 0;
@@ -148,42 +238,49 @@ struct str_parms *str_parms_create_str(const char *_string)
     if (!str_parms)
         goto err_create_str_parms;
 
-    str = strdup(_string);
-    if (!str)
-        goto err_strdup;
+    if (!reserve_arena(str_parms, strlen(_string) + 1))
+        goto err_reserve;
+    append_string(str_parms, _string, strlen(_string));
 
     ALOGV("%s: source string == '%s'\n", __func__, _string);
 
-    kvpair = strtok_r(str, ";", &tmpstr);
+    /* Split the copy in place: the ';' and '=' become the terminators of the
+     * keys and values. */
+    kvpair = strtok_r(str_parms->arena, ";", &tmpstr);
     while (kvpair && *kvpair) {
         char *eq = strchr(kvpair, '='); /* would love strchrnul */
-        char *value;
-        char *key;
-        void *old_val;
+        struct str_parms_entry *entry;
+        const char *value;
+        size_t key_len;
+        uint32_t hash;
 
         if (eq == kvpair)
             goto next_pair;
 
         if (eq) {
-            key = strndup(kvpair, eq - kvpair);
-            if (*(++eq))
-                value = strdup(eq);
-            else
-                value = strdup("");
+            *eq = '\0';
+            value = eq + 1;
         } else {
-            key = strdup(kvpair);
-            value = strdup("");
+            /* An empty value: the key's terminator. */
+            value = kvpair + strlen(kvpair);
         }
 
-        /* if we replaced a value, free it */
-        old_val = hashmapPut(str_parms->map, key, value);
-        RELEASE_OWNERSHIP(value);
-        if (old_val) {
-            free(old_val);
-            free(key);
+        hash = str_hash_fn(kvpair, &key_len);
+        entry = find_entry(str_parms, kvpair, hash);
+        if (entry) {
+            /* The new value replaces the old, and this copy of the key is unused. */
+            str_parms->arena_unused += entry_size(str_parms, entry) - (key_len + 1);
+            str_parms->arena_unused += key_len + 1;
+            if (!eq)
+                value = entry_key(str_parms, entry) + key_len;
         } else {
-            RELEASE_OWNERSHIP(key);
+            entry = add_entry(str_parms);
+            if (!entry)
+                goto err_reserve;
+            entry->hash = hash;
+            entry->key = kvpair - str_parms->arena;
         }
+        entry->value = value - str_parms->arena;
 
         items++;
 next_pair:
@@ -193,60 +290,56 @@ next_pair:
     if (!items)
         ALOGV("%s: no items found in string\n", __func__);
 
-    free(str);
-
     return str_parms;
 
-err_strdup:
+err_reserve:
     str_parms_destroy(str_parms);
 err_create_str_parms:
     return NULL;
 }
 
-int str_parms_add_str(struct str_parms *str_parms, const char *key,
-                      const char *value)
+static int add_str(struct str_parms *str_parms, const char *key, const char *value)
 {
-    void *tmp_key = NULL;
-    void *tmp_val = NULL;
-    void *old_val = NULL;
-
-    // strdup and hashmapPut both set errno on failure.
-    // Set errno to 0 so we can recognize whether anything went wrong.
-    int saved_errno = errno;
-    errno = 0;
-
-    tmp_key = strdup(key);
-    if (tmp_key == NULL) {
-        goto clean_up;
-    }
-
-    tmp_val = strdup(value);
-    if (tmp_val == NULL) {
-        goto clean_up;
-    }
-
-    old_val = hashmapPut(str_parms->map, tmp_key, tmp_val);
-    if (old_val == NULL) {
-        // Did hashmapPut fail?
-        if (errno == ENOMEM) {
-            goto clean_up;
+    size_t key_len, value_len = strlen(value);
+    uint32_t hash = str_hash_fn(key, &key_len);
+    struct str_parms_entry *entry = find_entry(str_parms, key, hash);
+
+    if (entry) {
+        char *old_value = str_parms->arena + entry->value;
+        size_t old_len = strlen(old_value);
+        /* Overwrite the old value if the new one fits, unless the old value
+         * is the key's terminator. */
+        if (value_len <= old_len && entry->value != entry->key + key_len) {
+            memcpy(old_value, value, value_len + 1);
+            str_parms->arena_unused += old_len - value_len;
+            return 0;
         }
-        // For new keys, hashmap takes ownership of tmp_key and tmp_val.
-        RELEASE_OWNERSHIP(tmp_key);
-        RELEASE_OWNERSHIP(tmp_val);
-        tmp_key = tmp_val = NULL;
-    } else {
-        // For existing keys, hashmap takes ownership of tmp_val.
-        // (It also gives up ownership of old_val.)
-        RELEASE_OWNERSHIP(tmp_val);
-        tmp_val = NULL;
+        if (!reserve_arena(str_parms, value_len + 1))
+            return -ENOMEM;
+        if (entry->value != entry->key + key_len)
+            str_parms->arena_unused += old_len + 1;
+        entry->value = append_string(str_parms, value, value_len);
+        compact_arena(str_parms);
+        return 0;
     }
 
-clean_up:
-    free(tmp_key);
-    free(tmp_val);
-    free(old_val);
-    int result = -errno;
+    if (!reserve_arena(str_parms, key_len + 1 + value_len + 1))
+        return -ENOMEM;
+    entry = add_entry(str_parms);
+    if (!entry)
+        return -ENOMEM;
+    entry->hash = hash;
+    entry->key = append_string(str_parms, key, key_len);
+    entry->value = append_string(str_parms, value, value_len);
+    return 0;
+}
+
+int str_parms_add_str(struct str_parms *str_parms, const char *key,
+                      const char *value)
+{
+    // Leave errno as it was, even if an allocation fails.
+    int saved_errno = errno;
+    int result = add_str(str_parms, key, value);
     errno = saved_errno;
     return result;
 }
@@ -279,14 +372,13 @@ int str_parms_add_float(struct str_parms *str_parms, const char *key,
 }
 
 int str_parms_has_key(struct str_parms *str_parms, const char *key) {
-    return hashmapGet(str_parms->map, (void *)key) != NULL;
+    return get_value(str_parms, key) != NULL;
 }
 
 int str_parms_get_str(struct str_parms *str_parms, const char *key, char *val,
                       int len)
 {
-    // TODO: hashmapGet should take a const* key.
-    char* value = static_cast<char*>(hashmapGet(str_parms->map, (void*)key));
+    const char* value = get_value(str_parms, key);
     if (value)
         return strlcpy(val, value, len);
 
@@ -297,8 +389,7 @@ int str_parms_get_int(struct str_parms *str_parms, const char *key, int *val)
 {
     char *end;
 
-    // TODO: hashmapGet should take a const* key.
-    char* value = static_cast<char*>(hashmapGet(str_parms->map, (void*)key));
+    const char* value = get_value(str_parms, key);
     if (!value)
         return -ENOENT;
 
@@ -315,8 +406,7 @@ int str_parms_get_float(struct str_parms *str_parms, const char *key,
     float out;
     char *end;
 
-    // TODO: hashmapGet should take a const* key.
-    char* value = static_cast<char*>(hashmapGet(str_parms->map, (void*)(key)));
+    const char* value = get_value(str_parms, key);
     if (!value)
         return -ENOENT;
 
@@ -328,42 +418,35 @@ int str_parms_get_float(struct str_parms *str_parms, const char *key,
     return 0;
 }
 
-static bool combine_strings(void *key, void *value, void *context)
-{
-    char** old_str = static_cast<char**>(context);
-    char *new_str;
-    int ret;
-
-    ret = asprintf(&new_str, "%s%s%s=%s",
-                   *old_str ? *old_str : "",
-                   *old_str ? ";" : "",
-                   (char *)key,
-                   (char *)value);
-    if (*old_str)
-        free(*old_str);
-
-    if (ret >= 0) {
-        *old_str = new_str;
-        return true;
-    }
-
-    *old_str = NULL;
-    return false;
-}
-
 char *str_parms_to_str(struct str_parms *str_parms)
 {
-    char *str = NULL;
-    hashmapForEach(str_parms->map, combine_strings, &str);
-    return (str != NULL) ? str : strdup("");
-}
+    size_t len = 0;
+    for (size_t i = 0; i < str_parms->count; i++) {
+        const struct str_parms_entry *entry = &str_parms->entries[i];
+        len += strlen(entry_key(str_parms, entry)) + 1 + strlen(entry_value(str_parms, entry)) + 1;
+    }
 
-static bool dump_entry(void* key, void* value, void* /*context*/) {
-    ALOGI("key: '%s' value: '%s'\n", (char *)key, (char *)value);
-    return true;
+    char *str = static_cast<char *>(malloc(len ? len : 1));
+    if (!str)
+        return NULL;
+    char *p = str;
+    for (size_t i = 0; i < str_parms->count; i++) {
+        const struct str_parms_entry *entry = &str_parms->entries[i];
+        if (i > 0)
+            *p++ = ';';
+        p = stpcpy(p, entry_key(str_parms, entry));
+        *p++ = '=';
+        p = stpcpy(p, entry_value(str_parms, entry));
+    }
+    *p = '\0';
+    return str;
 }
 
 void str_parms_dump(struct str_parms *str_parms)
 {
-    hashmapForEach(str_parms->map, dump_entry, str_parms);
+    for (size_t i = 0; i < str_parms->count; i++) {
+        const struct str_parms_entry *entry = &str_parms->entries[i];
+        ALOGI("key: '%s' value: '%s'\n", entry_key(str_parms, entry),
+              entry_value(str_parms, entry));
+    }
 }
@@ -17,6 +17,8 @@
 #include <cutils/str_parms.h>
 #include <gtest/gtest.h>
 
+#include <string>
+
 static void test_str_parms_str(const char* str, const char* expected) {
     str_parms* str_parms = str_parms_create_str(str);
     str_parms_add_str(str_parms, "dude", "woah");
@@ -55,3 +57,57 @@ TEST(str_parms, put_ENOMEM) {
     ASSERT_EQ(ENOMEM, errno);
     test_str_parms_str("foo=bar;baz=", "foo=bar;baz=");
 }
+
+TEST(str_parms, get) {
+    str_parms* str_parms = str_parms_create_str("int=42;float=1.5;str=hello;bad=4x;empty");
+    ASSERT_NE(nullptr, str_parms);
+
+    int i;
+    ASSERT_EQ(0, str_parms_get_int(str_parms, "int", &i));
+    ASSERT_EQ(42, i);
+    ASSERT_EQ(-EINVAL, str_parms_get_int(str_parms, "bad", &i));
+    ASSERT_EQ(-EINVAL, str_parms_get_int(str_parms, "empty", &i));
+    ASSERT_EQ(-ENOENT, str_parms_get_int(str_parms, "missing", &i));
+
+    float f;
+    ASSERT_EQ(0, str_parms_get_float(str_parms, "float", &f));
+    ASSERT_EQ(1.5f, f);
+
+    char value[4];
+    ASSERT_EQ(5, str_parms_get_str(str_parms, "str", value, sizeof(value)));
+    ASSERT_STREQ("hel", value);
+    ASSERT_EQ(0, str_parms_get_str(str_parms, "empty", value, sizeof(value)));
+    ASSERT_STREQ("", value);
+    ASSERT_TRUE(str_parms_has_key(str_parms, "empty"));
+    ASSERT_FALSE(str_parms_has_key(str_parms, "missing"));
+
+    str_parms_destroy(str_parms);
+}
+
+TEST(str_parms, many_keys) {
+    // More keys than fit in the str_parms itself, changed often enough that
+    // the space used by old values is reclaimed.
+    str_parms* str_parms = str_parms_create();
+    ASSERT_NE(nullptr, str_parms);
+    std::string expected;
+    for (int i = 0; i < 100; i++) {
+        std::string key = "key" + std::to_string(i);
+        for (int j = 0; j < 10; j++) {
+            ASSERT_EQ(0, str_parms_add_int(str_parms, key.c_str(), i * 10 + j));
+        }
+        ASSERT_EQ(0, str_parms_add_str(str_parms, "deleted", "value"));
+        str_parms_del(str_parms, "deleted");
+        expected += (i ? ";" : "") + key + "=" + std::to_string(i * 10 + 9);
+    }
+    for (int i = 0; i < 100; i++) {
+        int value;
+        ASSERT_EQ(0, str_parms_get_int(str_parms, ("key" + std::to_string(i)).c_str(), &value));
+        ASSERT_EQ(i * 10 + 9, value);
+    }
+    ASSERT_FALSE(str_parms_has_key(str_parms, "deleted"));
+
+    char* out_str = str_parms_to_str(str_parms);
+    ASSERT_EQ(expected, out_str);
+    free(out_str);
+    str_parms_destroy(str_parms);
+}
@@ -14,11 +14,13 @@
  * limitations under the License.
  */
 
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <memory>
 #include <string>
+#include <thread>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
@@ -669,3 +671,86 @@ TEST_F(TraceDevTest, atrace_int64_body_truncated) {
   expected += android::base::StringPrintf("%.*s|17179869183", expected_len, name.c_str());
   ASSERT_STREQ(expected.c_str(), actual.c_str());
 }
+
+TEST_F(TraceDevTest, atrace_buffered_markers_wait_for_flush) {
+  atrace_set_thread_buffering(60000000000ULL);
+  atrace_begin_body("outer");
+  atrace_int_body("counter", 5);
+  atrace_end_body();
+  EXPECT_EQ(0, lseek(atrace_marker_fd, 0, SEEK_CUR));
+
+  atrace_flush();
+  atrace_set_thread_buffering(0);
+
+  ASSERT_EQ(0, lseek(atrace_marker_fd, 0, SEEK_SET));
+  std::string actual;
+  ASSERT_TRUE(android::base::ReadFdToString(atrace_marker_fd, &actual));
+  std::string expected = android::base::StringPrintf("B|%d|outer\nC|%d|counter|5\nE|%d\n",
+                                                     getpid(), getpid(), getpid());
+  ASSERT_EQ(expected, actual);
+}
+
+TEST_F(TraceDevTest, atrace_buffered_markers_stay_in_order) {
+  // A socket that keeps the boundaries of writes, to see how they were batched.
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+  atrace_marker_fd = fds[0];
+
+  atrace_set_thread_buffering(60000000000ULL);
+  std::string expected;
+  for (int i = 0; i < 100; i++) {
+    std::string name = MakeName(i);
+    atrace_begin_body(name.c_str());
+    atrace_end_body();
+    expected += android::base::StringPrintf("B|%d|%s\nE|%d\n", getpid(), name.c_str(), getpid());
+  }
+  // Stopping buffering writes out the rest, before any later marker.
+  atrace_set_thread_buffering(0);
+  atrace_instant_body("unbuffered");
+  expected += android::base::StringPrintf("I|%d|unbuffered", getpid());
+
+  std::string actual;
+  size_t writes = 0;
+  char buf[2 * ATRACE_MESSAGE_LENGTH];
+  ssize_t len;
+  while ((len = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+    EXPECT_LE(len, ATRACE_MESSAGE_LENGTH);
+    actual.append(buf, len);
+    writes++;
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  ASSERT_EQ(expected, actual);
+  // Full buffers, rather than a write per marker.
+  EXPECT_LE(writes, expected.size() / (ATRACE_MESSAGE_LENGTH / 2) + 2);
+}
+
+TEST_F(TraceDevTest, atrace_buffered_markers_written_after_delay) {
+  atrace_set_thread_buffering(1000000);
+  atrace_begin_body("slow");
+  EXPECT_EQ(0, lseek(atrace_marker_fd, 0, SEEK_CUR));
+  usleep(2000);
+  // The delay has passed by this marker, which goes out with the first.
+  atrace_end_body();
+  atrace_set_thread_buffering(0);
+
+  ASSERT_EQ(0, lseek(atrace_marker_fd, 0, SEEK_SET));
+  std::string actual;
+  ASSERT_TRUE(android::base::ReadFdToString(atrace_marker_fd, &actual));
+  ASSERT_EQ(android::base::StringPrintf("B|%d|slow\nE|%d\n", getpid(), getpid()), actual);
+}
+
+TEST_F(TraceDevTest, atrace_buffered_markers_written_at_thread_exit) {
+  std::thread thread([] {
+    atrace_set_thread_buffering(60000000000ULL);
+    atrace_begin_body("thread");
+    atrace_end_body();
+  });
+  thread.join();
+
+  ASSERT_EQ(0, lseek(atrace_marker_fd, 0, SEEK_SET));
+  std::string actual;
+  ASSERT_TRUE(android::base::ReadFdToString(atrace_marker_fd, &actual));
+  ASSERT_EQ(android::base::StringPrintf("B|%d|thread\nE|%d\n", getpid(), getpid()), actual);
+}
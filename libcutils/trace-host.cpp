@@ -22,6 +22,8 @@ uint64_t                atrace_enabled_tags  = 0;
 
 void atrace_set_debuggable(bool /*debuggable*/) {}
 void atrace_set_tracing_enabled(bool /*enabled*/) {}
+void atrace_set_thread_buffering(uint64_t /*max_delay_ns*/) {}
+void atrace_flush() {}
 void atrace_update_tags() { }
 void atrace_setup() { }
 void atrace_begin_body(const char* /*name*/) {}
@@ -16,11 +16,13 @@
 
 #pragma once
 
+#include <chrono>
 #include <mutex>
 #include <set>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <android-base/thread_annotations.h>
@@ -41,6 +43,11 @@ class Modprobe {
                             std::vector<std::string>* post_dependencies);
     void ResetModuleCount() { module_count_ = 0; }
     int GetModuleCount() { return module_count_; }
+    // How long each module took to load, in the order LoadModulesParallel
+    // finished them.
+    const std::vector<std::pair<std::string, std::chrono::milliseconds>>& GetModuleLoadTimes() {
+        return module_load_times_;
+    }
 
   private:
     std::string MakeCanonical(const std::string& module_path);
@@ -63,7 +70,13 @@ class Modprobe {
     void ParseKernelCmdlineOptions();
     void ParseCfg(const std::string& cfg, std::function<bool(const std::vector<std::string>&)> f);
 
-    std::vector<std::pair<std::string, std::string>> module_aliases_;
+    // Aliases without wildcards, by alias. The others are kept by the text
+    // before their first wildcard, so that LoadWithAliases only has to
+    // fnmatch the few whose prefix the name starts with.
+    std::unordered_map<std::string, std::vector<std::string>> module_aliases_;
+    std::unordered_map<std::string, std::vector<std::pair<std::string, std::string>>>
+            module_alias_patterns_;
+    std::set<size_t> module_alias_prefix_lengths_;
     std::unordered_map<std::string, std::vector<std::string>> module_deps_;
     std::vector<std::pair<std::string, std::string>> module_pre_softdep_;
     std::vector<std::pair<std::string, std::string>> module_post_softdep_;
@@ -74,5 +87,6 @@ class Modprobe {
     std::unordered_set<std::string> module_loaded_;
     std::unordered_set<std::string> module_loaded_paths_;
     int module_count_ = 0;
+    std::vector<std::pair<std::string, std::chrono::milliseconds>> module_load_times_;
     bool blocklist_enabled = false;
 };
@@ -17,10 +17,13 @@
 #include <modprobe/modprobe.h>
 
 #include <fnmatch.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <set>
 #include <string>
@@ -41,8 +44,12 @@ std::string Modprobe::MakeCanonical(const std::string& module_path) {
         start += 1;
     }
     auto end = module_path.size();
-    if (android::base::EndsWith(module_path, ".ko")) {
-        end -= 3;
+    // Modules may also be stored compressed, for the kernel to decompress.
+    for (const char* suffix : {".ko", ".ko.gz", ".ko.xz", ".ko.zst"}) {
+        if (android::base::EndsWith(module_path, suffix)) {
+            end -= strlen(suffix);
+            break;
+        }
     }
     if ((end - start) <= 1) {
         LOG(ERROR) << "malformed module name: " << module_path;
@@ -106,7 +113,14 @@ bool Modprobe::ParseAliasCallback(const std::vector<std::string>& args) {
 
     const std::string& alias = *it++;
     const std::string& module_name = *it++;
-    this->module_aliases_.emplace_back(alias, module_name);
+    // Anything up to the first wildcard has to match as is.
+    auto literal = alias.find_first_of("*?[\\");
+    if (literal == std::string::npos) {
+        this->module_aliases_[alias].emplace_back(module_name);
+    } else {
+        this->module_alias_patterns_[alias.substr(0, literal)].emplace_back(alias, module_name);
+        this->module_alias_prefix_lengths_.emplace(literal);
+    }
 
     return true;
 }
@@ -230,7 +244,7 @@ void Modprobe::ParseCfg(const std::string& cfg,
     }
 
     std::vector<std::string> lines = android::base::Split(cfg_contents, "\n");
-    for (const std::string line : lines) {
+    for (const auto& line : lines) {
         if (line.empty() || line[0] == '#') {
             continue;
         }
@@ -407,11 +421,24 @@ bool Modprobe::LoadWithAliases(const std::string& module_name, bool strict,
 
     // use aliases to expand list of modules to load (multiple modules
     // may alias themselves to the requested name)
-    for (const auto& [alias, aliased_module] : module_aliases_) {
-        if (fnmatch(alias.c_str(), module_name.c_str(), 0) != 0) continue;
+    auto add_alias = [&](const std::string& aliased_module) {
         LOG(VERBOSE) << "Found alias for '" << module_name << "': '" << aliased_module;
-        if (module_loaded_.count(MakeCanonical(aliased_module))) continue;
+        if (module_loaded_.count(MakeCanonical(aliased_module))) return;
         modules_to_load.emplace(aliased_module);
+    };
+    auto exact = module_aliases_.find(module_name);
+    if (exact != module_aliases_.end()) {
+        for (const auto& aliased_module : exact->second) add_alias(aliased_module);
+    }
+    // Only the patterns that start with a prefix of the name can match.
+    for (auto length : module_alias_prefix_lengths_) {
+        if (length > module_name.size()) break;
+        auto patterns = module_alias_patterns_.find(module_name.substr(0, length));
+        if (patterns == module_alias_patterns_.end()) continue;
+        for (const auto& [alias, aliased_module] : patterns->second) {
+            if (fnmatch(alias.c_str(), module_name.c_str(), 0) != 0) continue;
+            add_alias(aliased_module);
+        }
     }
 
     // attempt to load all modules aliased to this name
@@ -443,87 +470,115 @@ bool Modprobe::IsBlocklisted(const std::string& module_name) {
 // and then load modules which only have soft dependency, third update dependency list of other
 // remaining modules, repeat these steps until all modules are loaded.
 bool Modprobe::LoadModulesParallel(int num_threads) {
-    bool ret = true;
-    std::map<std::string, std::set<std::string>> mod_with_deps;
-    std::map<std::string, std::set<std::string>> mod_with_softdeps;
+    // Each module to load waits on those of its dependencies that are loaded
+    // here too, and is started by whichever thread finishes the last of them.
+    struct Module {
+        std::string name;
+        std::string path;
+        // Has soft dependencies, or dependencies that are not loaded here, so
+        // goes through LoadWithAliases.
+        bool with_deps = false;
+        // A dependency failed to load.
+        bool failed = false;
+        size_t waiting = 0;
+        std::vector<size_t> dependents;
+    };
+    std::vector<Module> modules;
+    std::map<std::string, size_t> module_by_path;
 
-    // Get dependencies
     for (const auto& module : module_load_) {
-        auto dependencies = GetDependencies(MakeCanonical(module));
-
-        for (auto dep = dependencies.rbegin(); dep != dependencies.rend(); dep++) {
-            mod_with_deps[module].emplace(*dep);
-        }
+        auto dependencies = GetDependencies(module);
+        if (dependencies.empty() || module_by_path.count(dependencies[0])) continue;
+        module_by_path.emplace(dependencies[0], modules.size());
+        modules.push_back({module, dependencies[0]});
     }
 
-    // Get soft dependencies
+    std::set<std::string> mod_with_softdeps;
     for (const auto& [it_mod, it_softdep] : module_pre_softdep_) {
-        mod_with_softdeps[MakeCanonical(it_mod)].emplace(it_softdep);
+        mod_with_softdeps.emplace(MakeCanonical(it_mod));
     }
-
-    // Get soft post dependencies
     for (const auto& [it_mod, it_softdep] : module_post_softdep_) {
-        mod_with_softdeps[MakeCanonical(it_mod)].emplace(it_softdep);
-    }
-
-    while (!mod_with_deps.empty()) {
-        std::vector<std::thread> threads;
-        std::vector<std::string> mods_path_to_load;
-        std::vector<std::string> mods_with_softdep_to_load;
-        std::mutex vector_lock;
-
-        // Find independent modules and modules only having soft dependencies
-        for (const auto& [it_mod, it_dep] : mod_with_deps) {
-            if (it_dep.size() == 1 && mod_with_softdeps[it_mod].empty()) {
-                mods_path_to_load.emplace_back(*(it_dep.begin()));
-            } else if (it_dep.size() == 1) {
-                mods_with_softdep_to_load.emplace_back(it_mod);
+        mod_with_softdeps.emplace(MakeCanonical(it_mod));
+    }
+
+    std::deque<size_t> ready;
+    for (size_t i = 0; i < modules.size(); i++) {
+        auto& module = modules[i];
+        module.with_deps = mod_with_softdeps.count(module.name);
+        auto dependencies = GetDependencies(module.name);
+        std::set<size_t> waiting_on;
+        for (auto dep = dependencies.begin() + 1; dep != dependencies.end(); dep++) {
+            auto it = module_by_path.find(*dep);
+            if (it == module_by_path.end()) {
+                module.with_deps = true;
+            } else if (it->second != i) {
+                waiting_on.emplace(it->second);
             }
         }
-
-        // Load independent modules in parallel
-        auto thread_function = [&] {
-            std::unique_lock lk(vector_lock);
-            while (!mods_path_to_load.empty()) {
-                auto mod_path_to_load = std::move(mods_path_to_load.back());
-                mods_path_to_load.pop_back();
-
-                lk.unlock();
-                ret &= Insmod(mod_path_to_load, "");
-                lk.lock();
-            }
-        };
-
-        std::generate_n(std::back_inserter(threads), num_threads,
-                        [&] { return std::thread(thread_function); });
-
-        // Wait for the threads.
-        for (auto& thread : threads) {
-            thread.join();
+        for (auto dep : waiting_on) {
+            modules[dep].dependents.emplace_back(i);
         }
+        module.waiting = waiting_on.size();
+        if (module.waiting == 0) ready.emplace_back(i);
+    }
 
-        // Since we cannot assure if these soft dependencies tree are overlap,
-        // we loaded these modules one by one.
-        for (auto dep = mods_with_softdep_to_load.rbegin(); dep != mods_with_softdep_to_load.rend();
-             dep++) {
-            ret &= LoadWithAliases(*dep, true);
+    bool ret = true;
+    std::mutex lock;
+    std::condition_variable cv;
+    size_t running = 0;
+    // Since we cannot assure if these soft dependencies tree are overlap,
+    // we load these modules one by one.
+    std::mutex with_deps_lock;
+
+    auto thread_function = [&] {
+        std::unique_lock lk(lock);
+        while (true) {
+            cv.wait(lk, [&] { return !ready.empty() || running == 0; });
+            if (ready.empty()) break;
+            auto& module = modules[ready.front()];
+            ready.pop_front();
+            running++;
+            lk.unlock();
+
+            bool loaded = false;
+            android::base::Timer t;
+            if (module.failed) {
+                LOG(ERROR) << "Not loading " << module.name << ", a dependency failed to load";
+            } else if (module.with_deps) {
+                std::lock_guard guard(with_deps_lock);
+                loaded = LoadWithAliases(module.name, true);
+            } else {
+                loaded = Insmod(module.path, "");
+            }
+            auto duration = t.duration();
+
+            lk.lock();
+            running--;
+            ret &= loaded;
+            if (!module.failed) module_load_times_.emplace_back(module.name, duration);
+            for (auto dependent : module.dependents) {
+                if (!loaded) modules[dependent].failed = true;
+                if (--modules[dependent].waiting == 0) ready.emplace_back(dependent);
+            }
+            cv.notify_all();
         }
+    };
 
-        std::lock_guard guard(module_loaded_lock_);
-        // Remove loaded module form mod_with_deps and soft dependencies of other modules
-        for (const auto& module_loaded : module_loaded_) {
-            mod_with_deps.erase(module_loaded);
+    num_threads = std::clamp(num_threads, 1, std::max(1, static_cast<int>(modules.size())));
+    std::vector<std::thread> threads;
+    std::generate_n(std::back_inserter(threads), num_threads,
+                    [&] { return std::thread(thread_function); });
 
-            for (auto& [mod, softdeps] : mod_with_softdeps) {
-                softdeps.erase(module_loaded);
-            }
-        }
+    // Wait for the threads.
+    for (auto& thread : threads) {
+        thread.join();
+    }
 
-        // Remove loaded module form dependencies of other modules which are not loaded yet
-        for (const auto& module_loaded_path : module_loaded_paths_) {
-            for (auto& [mod, deps] : mod_with_deps) {
-                deps.erase(module_loaded_path);
-            }
+    // Only a dependency cycle leaves modules waiting.
+    for (const auto& module : modules) {
+        if (module.waiting != 0) {
+            LOG(ERROR) << "Not loading " << module.name << ", its dependencies form a cycle";
+            ret = false;
         }
     }
 
@@ -14,15 +14,22 @@
  * limitations under the License.
  */
 
+#include <linux/module.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/strings.h>
 #include <android-base/unique_fd.h>
+#include <cutils/boot_events.h>
 
 #include <modprobe/modprobe.h>
 
+#ifndef MODULE_INIT_COMPRESSED_FILE
+#define MODULE_INIT_COMPRESSED_FILE 4
+#endif
+
 std::string Modprobe::GetKernelCmdline(void) {
     std::string cmdline;
     if (!android::base::ReadFileToString("/proc/cmdline", &cmdline)) {
@@ -49,9 +56,23 @@ bool Modprobe::Insmod(const std::string& path_name, const std::string& parameter
         options = options + " " + parameters;
     }
 
+    // Compressed modules are decompressed by the kernel, which spares
+    // reading the whole uncompressed module from storage.
+    int flags = 0;
+    if (!android::base::EndsWith(path_name, ".ko")) {
+        flags |= MODULE_INIT_COMPRESSED_FILE;
+    }
+
     LOG(INFO) << "Loading module " << path_name << " with args '" << options << "'";
-    int ret = syscall(__NR_finit_module, fd.get(), options.c_str(), 0);
+    boot_event_begin("modprobe", canonical_name.c_str());
+    int ret = syscall(__NR_finit_module, fd.get(), options.c_str(), flags);
+    boot_event_end("modprobe", canonical_name.c_str());
     if (ret != 0) {
+        if (errno == EINVAL && (flags & MODULE_INIT_COMPRESSED_FILE)) {
+            PLOG(ERROR) << "Failed to insmod compressed module '" << path_name
+                        << "', is CONFIG_MODULE_DECOMPRESS enabled?";
+            return false;
+        }
         if (errno == EEXIST) {
             // Module already loaded
             std::lock_guard guard(module_loaded_lock_);
@@ -17,6 +17,7 @@
 #include <sys/stat.h>
 #include <sys/syscall.h>
 
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -34,6 +35,10 @@ std::string Modprobe::GetKernelCmdline(void) {
 }
 
 bool Modprobe::Insmod(const std::string& path_name, const std::string& parameters) {
+    // LoadModulesParallel calls in from several threads.
+    static std::mutex modules_loaded_lock;
+    std::lock_guard guard(modules_loaded_lock);
+
     auto deps = GetDependencies(MakeCanonical(path_name));
     if (deps.empty()) {
         return false;
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <functional>
 
 #include <android-base/file.h>
@@ -219,3 +220,100 @@ TEST(libmodprobe, ModuleDepLineWithoutColonIsSkipped) {
     Modprobe m({dir.path});
     EXPECT_FALSE(m.LoadWithAliases("no_colon", true));
 }
+
+TEST(libmodprobe, LoadModulesParallel) {
+    TemporaryDir dir;
+    auto dir_path = std::string(dir.path);
+    ASSERT_TRUE(android::base::WriteStringToFile("moda.ko: modb.ko modc.ko\n"
+                                                 "modb.ko: modc.ko\n"
+                                                 "modc.ko:\n"
+                                                 "modd.ko:\n"
+                                                 "mode.ko: modf.ko\n"
+                                                 "modf.ko:\n"
+                                                 "modg.ko: mode.ko modf.ko\n",
+                                                 dir_path + "/modules.dep", 0600, getuid(),
+                                                 getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile("modg.ko\n"
+                                                 "moda.ko\n"
+                                                 "modb.ko\n"
+                                                 "modc.ko\n"
+                                                 "modd.ko\n"
+                                                 "mode.ko\n"
+                                                 "modf.ko\n",
+                                                 dir_path + "/modules.load", 0600, getuid(),
+                                                 getgid()));
+
+    kernel_cmdline = "";
+    modules_loaded.clear();
+    // modf.ko is missing, so it fails to load and so do mode.ko and modg.ko after it.
+    test_modules = {dir_path + "/moda.ko", dir_path + "/modb.ko", dir_path + "/modc.ko",
+                    dir_path + "/modd.ko", dir_path + "/mode.ko", dir_path + "/modg.ko"};
+
+    Modprobe m({dir.path});
+    EXPECT_FALSE(m.LoadModulesParallel(4));
+
+    auto position = [&](const std::string& module) {
+        return std::find(modules_loaded.begin(), modules_loaded.end(), dir_path + "/" + module) -
+               modules_loaded.begin();
+    };
+    EXPECT_EQ(4U, modules_loaded.size());
+    EXPECT_LT(position("modc.ko"), position("modb.ko"));
+    EXPECT_LT(position("modb.ko"), position("moda.ko"));
+    EXPECT_LT(position("moda.ko"), 4);
+    EXPECT_LT(position("modd.ko"), 4);
+
+    // mode.ko and modg.ko are not even tried.
+    EXPECT_EQ(5U, m.GetModuleLoadTimes().size());
+}
+
+TEST(libmodprobe, LoadWithWildcardAliases) {
+    TemporaryDir dir;
+    auto dir_path = std::string(dir.path);
+    ASSERT_TRUE(android::base::WriteStringToFile("alias of:N*Tqcom,foo* modfoo\n"
+                                                 "alias of:N*Tqcom,bar* modbar\n"
+                                                 "alias pci:v00001234d* modpci\n"
+                                                 "alias pci:v0000123?d00005678 modpci2\n",
+                                                 dir_path + "/modules.alias", 0600, getuid(),
+                                                 getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile("modfoo.ko:\n"
+                                                 "modbar.ko:\n"
+                                                 "modpci.ko:\n"
+                                                 "modpci2.ko:\n",
+                                                 dir_path + "/modules.dep", 0600, getuid(),
+                                                 getgid()));
+
+    kernel_cmdline = "";
+    modules_loaded.clear();
+    test_modules = {dir_path + "/modfoo.ko", dir_path + "/modbar.ko", dir_path + "/modpci.ko",
+                    dir_path + "/modpci2.ko"};
+
+    Modprobe m({dir.path});
+    EXPECT_TRUE(m.LoadWithAliases("of:NfooTqcom,foo-v2", true));
+    EXPECT_TRUE(m.LoadWithAliases("pci:v00001234d00005678", true));
+    EXPECT_FALSE(m.LoadWithAliases("of:NfooTqcom,baz", true));
+
+    std::sort(modules_loaded.begin(), modules_loaded.end());
+    std::vector<std::string> expected_modules_loaded = {
+            dir_path + "/modfoo.ko", dir_path + "/modpci.ko", dir_path + "/modpci2.ko"};
+    EXPECT_EQ(expected_modules_loaded, modules_loaded);
+}
+
+TEST(libmodprobe, CompressedModules) {
+    TemporaryDir dir;
+    auto dir_path = std::string(dir.path);
+    ASSERT_TRUE(android::base::WriteStringToFile("modzst.ko.zst: modxz.ko.xz\n"
+                                                 "modxz.ko.xz:\n",
+                                                 dir_path + "/modules.dep", 0600, getuid(),
+                                                 getgid()));
+
+    kernel_cmdline = "";
+    modules_loaded.clear();
+    test_modules = {dir_path + "/modzst.ko.zst", dir_path + "/modxz.ko.xz"};
+
+    Modprobe m({dir.path});
+    EXPECT_TRUE(m.LoadWithAliases("modzst", true));
+
+    std::vector<std::string> expected_modules_loaded = {dir_path + "/modxz.ko.xz",
+                                                        dir_path + "/modzst.ko.zst"};
+    EXPECT_EQ(expected_modules_loaded, modules_loaded);
+}
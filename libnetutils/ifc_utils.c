@@ -248,32 +248,185 @@ int ifc_set_addr(const char *name, in_addr_t addr)
     return ret;
 }
 
+// Persistent rtnetlink socket shared by all netlink requests, so that bursts
+// of address and route changes don't each open and close a socket. Reopened
+// after fork(), as the acknowledgements could otherwise go to either process.
+static int ifc_nl_sock = -1;
+static pid_t ifc_nl_sock_pid;
+static uint32_t ifc_nl_seq;
+static pthread_mutex_t ifc_nl_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Requests sent in one sendmsg(). Bounded so that their acknowledgements fit
+// in the socket's receive buffer.
+#define IFC_NL_MAX_SEND 64
+
+struct ifc_addr_req {
+    struct nlmsghdr n;
+    struct ifaddrmsg r;
+    // Allow for IPv4 or IPv6 address, headers, IPv4 broadcast address and padding.
+    char attrbuf[NLMSG_ALIGN(sizeof(struct rtattr)) + NLMSG_ALIGN(INET6_ADDRLEN) +
+                 NLMSG_ALIGN(sizeof(struct rtattr)) + NLMSG_ALIGN(INET_ADDRLEN)];
+};
+
+struct ifc_route_req {
+    struct nlmsghdr n;
+    struct rtmsg r;
+    // Allow for destination, gateway and output interface.
+    char attrbuf[3 * (NLMSG_ALIGN(sizeof(struct rtattr)) + NLMSG_ALIGN(sizeof(uint32_t)))];
+};
+
+struct ifc_batch {
+    char *buf;
+    size_t len;
+    size_t capacity;
+    size_t count;
+};
+
+static void ifc_nl_add_attr(struct nlmsghdr *n, unsigned short type, const void *data,
+                            size_t len) {
+    struct rtattr *rta = (struct rtattr *) (((char *) n) + NLMSG_ALIGN(n->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_LENGTH(len);
+}
+
+static int ifc_nl_open_locked(void) {
+    if (ifc_nl_sock != -1 && ifc_nl_sock_pid == getpid()) {
+        return 0;
+    }
+    if (ifc_nl_sock != -1) {
+        close(ifc_nl_sock);
+    }
+
+    ifc_nl_sock = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (ifc_nl_sock < 0) {
+        return -errno;
+    }
+    ifc_nl_sock_pid = getpid();
+#ifdef NETLINK_CAP_ACK
+    // Acknowledge errors without echoing the whole request back.
+    int on = 1;
+    setsockopt(ifc_nl_sock, SOL_NETLINK, NETLINK_CAP_ACK, &on, sizeof(on));
+#endif
+    return 0;
+}
+
+static void ifc_nl_close_locked(void) {
+    close(ifc_nl_sock);
+    ifc_nl_sock = -1;
+}
+
 /*
- * Adds or deletes an IP address on an interface.
+ * Sends |count| requests from |buf| in a single sendmsg() and waits for all of
+ * their acknowledgements. Stores each request's result, zero or negative
+ * errno, in |results|.
  *
- * Action is one of:
- * - RTM_NEWADDR (to add a new address)
- * - RTM_DELADDR (to delete an existing address)
+ * Returns zero if every acknowledgement was received, or negative errno.
+ */
+static int ifc_nl_send_locked(char *buf, size_t len, size_t count, int *results) {
+    struct nlmsghdr *nh;
+    uint32_t first_seq = ifc_nl_seq + 1;
+    size_t i, pending = count;
+
+    for (nh = (struct nlmsghdr *) buf, i = 0; i < count; i++) {
+        nh->nlmsg_seq = ++ifc_nl_seq;
+        nh->nlmsg_pid = 0;
+        nh->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+        results[i] = -EINVAL;
+        nh = (struct nlmsghdr *) (((char *) nh) + NLMSG_ALIGN(nh->nlmsg_len));
+    }
+
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    struct msghdr msg = {
+        .msg_name = &kernel,
+        .msg_namelen = sizeof(kernel),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+    if (sendmsg(ifc_nl_sock, &msg, 0) < 0) {
+        return -errno;
+    }
+
+    // Acknowledgements for requests from an earlier, failed call are skipped
+    // by their sequence numbers.
+    char ackbuf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+    while (pending > 0) {
+        ssize_t ret = recv(ifc_nl_sock, ackbuf, sizeof(ackbuf), 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        size_t received = ret;
+        for (nh = (struct nlmsghdr *) ackbuf; NLMSG_OK(nh, received);
+             nh = NLMSG_NEXT(nh, received)) {
+            if (nh->nlmsg_type != NLMSG_ERROR ||
+                nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+                continue;
+            }
+            uint32_t index = nh->nlmsg_seq - first_seq;
+            if (index >= count) {
+                continue;
+            }
+            struct nlmsgerr *err = NLMSG_DATA(nh);
+            results[index] = err->error;
+            pending--;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Sends |count| requests from |buf| over the shared socket, IFC_NL_MAX_SEND at
+ * a time, and stores each request's result in |results|.
  *
- * Returns zero on success and negative errno on failure.
+ * Returns zero if every request succeeded, or the last failure's negative
+ * errno.
  */
-int ifc_act_on_address(int action, const char* name, const char* address, int prefixlen,
-                       bool nodad) {
-    int ifindex, s, len, ret;
+static int ifc_nl_transact(char *buf, size_t count, int *results) {
+    int ret, lasterror = 0;
+    size_t i, sent = 0;
+
+    pthread_mutex_lock(&ifc_nl_mutex);
+    ret = ifc_nl_open_locked();
+    while (ret == 0 && sent < count) {
+        size_t n = count - sent < IFC_NL_MAX_SEND ? count - sent : IFC_NL_MAX_SEND;
+        size_t chunk_len = 0;
+        for (i = 0; i < n; i++) {
+            struct nlmsghdr *nh = (struct nlmsghdr *) (buf + chunk_len);
+            chunk_len += NLMSG_ALIGN(nh->nlmsg_len);
+        }
+
+        ret = ifc_nl_send_locked(buf, chunk_len, n, results + sent);
+        if (ret != 0) {
+            // The socket may now hold a partial set of acknowledgements.
+            ifc_nl_close_locked();
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (results[sent + i] != 0) lasterror = results[sent + i];
+        }
+        buf += chunk_len;
+        sent += n;
+    }
+    pthread_mutex_unlock(&ifc_nl_mutex);
+
+    if (ret != 0) {
+        for (i = sent; i < count; i++) {
+            results[i] = ret;
+        }
+        lasterror = ret;
+    }
+    return lasterror;
+}
+
+static int ifc_fill_address_req(struct ifc_addr_req *req, int action, const char *name,
+                                const char *address, int prefixlen, bool nodad) {
+    int ifindex, ret;
     struct sockaddr_storage ss;
-    int saved_errno;
     void *addr;
     size_t addrlen;
-    struct {
-        struct nlmsghdr n;
-        struct ifaddrmsg r;
-        // Allow for IPv4 or IPv6 address, headers, IPv4 broadcast address and padding.
-        char attrbuf[NLMSG_ALIGN(sizeof(struct rtattr)) + NLMSG_ALIGN(INET6_ADDRLEN) +
-                     NLMSG_ALIGN(sizeof(struct rtattr)) + NLMSG_ALIGN(INET_ADDRLEN)];
-    } req;
-    struct rtattr *rta;
-    struct nlmsghdr *nh;
-    struct nlmsgerr *err;
 
     // Get interface ID.
     ifindex = if_nametoindex(name);
@@ -301,65 +454,174 @@ int ifc_act_on_address(int action, const char* name, const char* address, int pr
     }
 
     // Fill in netlink structures.
-    memset(&req, 0, sizeof(req));
+    memset(req, 0, sizeof(*req));
 
     // Netlink message header.
-    req.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.r));
-    req.n.nlmsg_type = action;
-    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-    req.n.nlmsg_pid = getpid();
+    req->n.nlmsg_len = NLMSG_LENGTH(sizeof(req->r));
+    req->n.nlmsg_type = action;
+    req->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
 
     // Interface address message header.
-    req.r.ifa_family = ss.ss_family;
-    req.r.ifa_flags = nodad ? IFA_F_NODAD : 0;
-    req.r.ifa_prefixlen = prefixlen;
-    req.r.ifa_index = ifindex;
+    req->r.ifa_family = ss.ss_family;
+    req->r.ifa_flags = nodad ? IFA_F_NODAD : 0;
+    req->r.ifa_prefixlen = prefixlen;
+    req->r.ifa_index = ifindex;
 
     // Routing attribute. Contains the actual IP address.
-    rta = (struct rtattr *) (((char *) &req) + NLMSG_ALIGN(req.n.nlmsg_len));
-    rta->rta_type = IFA_LOCAL;
-    rta->rta_len = RTA_LENGTH(addrlen);
-    req.n.nlmsg_len = NLMSG_ALIGN(req.n.nlmsg_len) + RTA_LENGTH(addrlen);
-    memcpy(RTA_DATA(rta), addr, addrlen);
+    ifc_nl_add_attr(&req->n, IFA_LOCAL, addr, addrlen);
 
     // Add an explicit IFA_BROADCAST for IPv4 RTM_NEWADDRs.
     if (ss.ss_family == AF_INET && action == RTM_NEWADDR) {
-        rta = (struct rtattr *) (((char *) &req) + NLMSG_ALIGN(req.n.nlmsg_len));
-        rta->rta_type = IFA_BROADCAST;
-        rta->rta_len = RTA_LENGTH(addrlen);
-        req.n.nlmsg_len = NLMSG_ALIGN(req.n.nlmsg_len) + RTA_LENGTH(addrlen);
         ((struct in_addr *)addr)->s_addr |= htonl((1<<(32-prefixlen))-1);
-        memcpy(RTA_DATA(rta), addr, addrlen);
+        ifc_nl_add_attr(&req->n, IFA_BROADCAST, addr, addrlen);
     }
 
-    s = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
-    if (s < 0) {
+    return 0;
+}
+
+static int ifc_fill_ipv4_route_req(struct ifc_route_req *req, int action, const char *ifname,
+                                   struct in_addr dst, int prefix_length, struct in_addr gw) {
+    int ifindex;
+    uint32_t oif;
+
+    if ((action != RTM_NEWROUTE && action != RTM_DELROUTE) || prefix_length < 0 ||
+        prefix_length > 32) {
+        return -EINVAL;
+    }
+
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) {
         return -errno;
     }
 
-    if (send(s, &req, req.n.nlmsg_len, 0) < 0) {
-        saved_errno = errno;
-        close(s);
-        return -saved_errno;
+    memset(req, 0, sizeof(*req));
+
+    req->n.nlmsg_len = NLMSG_LENGTH(sizeof(req->r));
+    req->n.nlmsg_type = action;
+    req->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    // Like SIOCADDRT, adding a route that already exists succeeds.
+    if (action == RTM_NEWROUTE) {
+        req->n.nlmsg_flags |= NLM_F_CREATE | NLM_F_REPLACE;
     }
 
-    char buf[NLMSG_ALIGN(sizeof(struct nlmsgerr)) + sizeof(req)];
-    len = recv(s, buf, sizeof(buf), 0);
-    saved_errno = errno;
-    close(s);
-    if (len < 0) {
-        return -saved_errno;
+    req->r.rtm_family = AF_INET;
+    req->r.rtm_dst_len = prefix_length;
+    req->r.rtm_table = RT_TABLE_MAIN;
+    req->r.rtm_type = RTN_UNICAST;
+    if (action == RTM_NEWROUTE) {
+        req->r.rtm_protocol = RTPROT_BOOT;
+        req->r.rtm_scope = gw.s_addr != 0 ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+    } else {
+        req->r.rtm_scope = RT_SCOPE_NOWHERE;
     }
 
-    // Parse the acknowledgement to find the return code.
-    nh = (struct nlmsghdr *) buf;
-    if (!NLMSG_OK(nh, (unsigned) len) || nh->nlmsg_type != NLMSG_ERROR) {
-        return -EINVAL;
+    dst.s_addr &= prefixLengthToIpv4Netmask(prefix_length);
+    ifc_nl_add_attr(&req->n, RTA_DST, &dst, INET_ADDRLEN);
+    if (gw.s_addr != 0) {
+        ifc_nl_add_attr(&req->n, RTA_GATEWAY, &gw, INET_ADDRLEN);
+    }
+    oif = ifindex;
+    ifc_nl_add_attr(&req->n, RTA_OIF, &oif, sizeof(oif));
+
+    return 0;
+}
+
+/*
+ * Adds or deletes an IP address on an interface.
+ *
+ * Action is one of:
+ * - RTM_NEWADDR (to add a new address)
+ * - RTM_DELADDR (to delete an existing address)
+ *
+ * Returns zero on success and negative errno on failure.
+ */
+int ifc_act_on_address(int action, const char* name, const char* address, int prefixlen,
+                       bool nodad) {
+    struct ifc_addr_req req;
+    int ret, result;
+
+    ret = ifc_fill_address_req(&req, action, name, address, prefixlen, nodad);
+    if (ret) {
+        return ret;
+    }
+
+    ret = ifc_nl_transact((char *) &req, 1, &result);
+    return ret ? ret : result;
+}
+
+struct ifc_batch *ifc_batch_new(void) {
+    return calloc(1, sizeof(struct ifc_batch));
+}
+
+void ifc_batch_free(struct ifc_batch *batch) {
+    if (batch == NULL) {
+        return;
+    }
+    free(batch->buf);
+    free(batch);
+}
+
+size_t ifc_batch_count(const struct ifc_batch *batch) {
+    return batch->count;
+}
+
+static int ifc_batch_append(struct ifc_batch *batch, const struct nlmsghdr *n) {
+    size_t len = NLMSG_ALIGN(n->nlmsg_len);
+    if (batch->len + len > batch->capacity) {
+        size_t capacity = batch->capacity ? batch->capacity * 2 : 1024;
+        while (capacity < batch->len + len) {
+            capacity *= 2;
+        }
+        char *buf = realloc(batch->buf, capacity);
+        if (buf == NULL) {
+            return -ENOMEM;
+        }
+        batch->buf = buf;
+        batch->capacity = capacity;
     }
-    err = NLMSG_DATA(nh);
+    memset(batch->buf + batch->len, 0, len);
+    memcpy(batch->buf + batch->len, n, n->nlmsg_len);
+    batch->len += len;
+    batch->count++;
+    return 0;
+}
 
-    // Return code is negative errno.
-    return err->error;
+int ifc_batch_add_address(struct ifc_batch *batch, int action, const char *name,
+                          const char *address, int prefixlen, bool nodad) {
+    struct ifc_addr_req req;
+    int ret = ifc_fill_address_req(&req, action, name, address, prefixlen, nodad);
+    return ret ? ret : ifc_batch_append(batch, &req.n);
+}
+
+int ifc_batch_add_ipv4_route(struct ifc_batch *batch, int action, const char *ifname,
+                             struct in_addr dst, int prefix_length, struct in_addr gw) {
+    struct ifc_route_req req;
+    int ret = ifc_fill_ipv4_route_req(&req, action, ifname, dst, prefix_length, gw);
+    return ret ? ret : ifc_batch_append(batch, &req.n);
+}
+
+int ifc_batch_commit(struct ifc_batch *batch, int *results) {
+    int *all_results = results;
+    int ret;
+
+    if (batch->count == 0) {
+        return 0;
+    }
+    if (all_results == NULL) {
+        all_results = malloc(batch->count * sizeof(int));
+        if (all_results == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    ret = ifc_nl_transact(batch->buf, batch->count, all_results);
+
+    if (all_results != results) {
+        free(all_results);
+    }
+    batch->len = 0;
+    batch->count = 0;
+    return ret;
 }
 
 // Returns zero on success and negative errno on failure.
@@ -374,16 +636,29 @@ int ifc_del_address(const char *name, const char * address, int prefixlen) {
 
 /*
  * Clears IPv6 addresses on the specified interface.
+ *
+ * The deletions are sent as one batch.
  */
 int ifc_clear_ipv6_addresses(const char *name) {
     char rawaddrstr[INET6_ADDRSTRLEN], addrstr[INET6_ADDRSTRLEN];
     unsigned int prefixlen;
     int lasterror = 0, i, j, ret;
     char ifname[64];  // Currently, IFNAMSIZ = 16.
+    struct ifc_batch *batch;
+    // The queued addresses and prefix lengths, for reporting which deletions failed.
+    char (*addrs)[INET6_ADDRSTRLEN + 4] = NULL;
+    int *results = NULL;
+    size_t count, capacity = 0;
+
     FILE *f = fopen("/proc/net/if_inet6", "r");
     if (!f) {
         return -errno;
     }
+    batch = ifc_batch_new();
+    if (!batch) {
+        fclose(f);
+        return -ENOMEM;
+    }
 
     // Format:
     // 20010db8000a0001fc446aa4b5b347ed 03 40 00 01    wlan0
@@ -409,15 +684,48 @@ int ifc_clear_ipv6_addresses(const char *name) {
             continue;
         }
 
-        ret = ifc_del_address(ifname, addrstr, prefixlen);
+        count = ifc_batch_count(batch);
+        if (count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 8;
+            void *new_addrs = realloc(addrs, new_capacity * sizeof(*addrs));
+            if (!new_addrs) {
+                lasterror = -ENOMEM;
+                break;
+            }
+            addrs = new_addrs;
+            capacity = new_capacity;
+        }
+
+        ret = ifc_batch_add_address(batch, RTM_DELADDR, ifname, addrstr, prefixlen,
+                                    /*nodad*/ false);
         if (ret) {
             ALOGE("Deleting address %s/%d on %s: %s", addrstr, prefixlen, ifname,
                  strerror(-ret));
             lasterror = ret;
+            continue;
         }
+        snprintf(addrs[count], sizeof(addrs[count]), "%s/%d", addrstr, prefixlen);
     }
-
     fclose(f);
+
+    count = ifc_batch_count(batch);
+    if (count > 0) {
+        results = malloc(count * sizeof(*results));
+        if (!results) {
+            lasterror = -ENOMEM;
+        } else if (ifc_batch_commit(batch, results)) {
+            for (size_t k = 0; k < count; k++) {
+                if (results[k]) {
+                    ALOGE("Deleting address %s on %s: %s", addrs[k], name, strerror(-results[k]));
+                    lasterror = results[k];
+                }
+            }
+        }
+    }
+
+    free(results);
+    free(addrs);
+    ifc_batch_free(batch);
     return lasterror;
 }
 
@@ -19,6 +19,7 @@
 
 #include <arpa/inet.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <sys/cdefs.h>
 
 __BEGIN_DECLS
@@ -53,6 +54,32 @@ extern int ifc_set_prefixLength(const char *name, int prefixLength);
 extern int ifc_set_hwaddr(const char *name, const void *ptr);
 extern int ifc_clear_addresses(const char *name);
 
+/*
+ * Batches of rtnetlink address and route changes. Each ifc_batch_add_*() call
+ * queues one change, and ifc_batch_commit() sends the queued changes with as
+ * few sendmsg() calls as possible over a netlink socket that is kept open
+ * between calls, and waits for all of their acknowledgements.
+ *
+ * The ifc_batch_add_*() functions return zero, or negative errno if the change
+ * couldn't be queued. |action| is RTM_NEWADDR or RTM_DELADDR for addresses, and
+ * RTM_NEWROUTE or RTM_DELROUTE for routes.
+ *
+ * ifc_batch_commit() stores each change's result, zero or negative errno, in
+ * |results| if it isn't NULL, in the order they were queued. |results| must
+ * have room for ifc_batch_count() entries. It returns zero if every change
+ * succeeded, or the negative errno of the last failure. The batch is empty
+ * afterwards, and can be reused.
+ */
+struct ifc_batch;
+extern struct ifc_batch *ifc_batch_new(void);
+extern void ifc_batch_free(struct ifc_batch *batch);
+extern size_t ifc_batch_count(const struct ifc_batch *batch);
+extern int ifc_batch_add_address(struct ifc_batch *batch, int action, const char *name,
+                                 const char *address, int prefixlen, bool nodad);
+extern int ifc_batch_add_ipv4_route(struct ifc_batch *batch, int action, const char *ifname,
+                                    struct in_addr dst, int prefix_length, struct in_addr gw);
+extern int ifc_batch_commit(struct ifc_batch *batch, int *results);
+
 extern int ifc_create_default_route(const char *name, in_addr_t addr);
 extern int ifc_remove_default_route(const char *ifname);
 extern int ifc_get_info(const char *name, in_addr_t *addr, int *prefixLength,
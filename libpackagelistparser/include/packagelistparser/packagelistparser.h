@@ -78,4 +78,30 @@ bool packagelist_parse_file(const char* path, bool (*callback)(pkg_info* info, v
 /** Frees the given `pkg_info`. */
 void packagelist_free(pkg_info* info);
 
+/**
+ * An index of a package list, for looking up single packages without parsing
+ * the whole list each time.
+ */
+typedef struct packagelist_index packagelist_index;
+
+/**
+ * Maps and indexes the given package list, or the system's default one if
+ * `path` is NULL. Returns NULL on failure.
+ * The index should be freed with packagelist_index_close().
+ */
+packagelist_index* packagelist_index_open(const char* path);
+
+/** Frees the given `packagelist_index`. */
+void packagelist_index_close(packagelist_index* index);
+
+/**
+ * Looks up a package by name, or the first package with the given uid.
+ * Returns NULL if there is none, or if the list can't be read.
+ * The index is rebuilt first if the list has changed since it was built.
+ * The `pkg_info` belongs to the index, and stays valid until the next lookup
+ * or packagelist_index_close().
+ */
+const pkg_info* packagelist_index_find_name(packagelist_index* index, const char* name);
+const pkg_info* packagelist_index_find_uid(packagelist_index* index, uid_t uid);
+
 __END_DECLS
@@ -19,12 +19,20 @@
 #include <packagelistparser/packagelistparser.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <log/log.h>
 
@@ -138,3 +146,229 @@ void packagelist_free(pkg_info* info) {
   delete[] info->gids.gids;
   free(info);
 }
+
+struct packagelist_index {
+  std::string path;
+  // The identity of the file the index was built from.
+  struct stat st;
+
+  // A private mapping of the file, which the parsed lines are terminated in
+  // place in. The last line lives in `tail` if the file doesn't end in a
+  // newline, as there may be no room to terminate it in the mapping.
+  void* map = MAP_FAILED;
+  size_t map_size = 0;
+  std::string tail;
+
+  std::vector<pkg_info> packages;
+  // The gids of all the packages, which their gid_lists point into.
+  std::vector<gid_t> gids;
+  // Indexes into `packages`, sorted by name and by uid.
+  std::vector<size_t> by_name;
+  std::vector<size_t> by_uid;
+};
+
+// Splits a NUL-terminated line at whitespace, terminating the fields in place
+// like the sscanf() in parse_line() would read them.
+static size_t split_fields(char* line, char** fields, size_t max_fields) {
+  size_t count = 0;
+  char* save;
+  for (char* field = strtok_r(line, " \t\r", &save); field && count < max_fields;
+       field = strtok_r(nullptr, " \t\r", &save)) {
+    fields[count++] = field;
+  }
+  return count;
+}
+
+static bool parse_number(const char* s, unsigned long max, unsigned long* value) {
+  char* end;
+  errno = 0;
+  *value = strtoul(s, &end, 10);
+  return errno == 0 && end != s && *end == '\0' && *value <= max;
+}
+
+// The allocation-free counterpart of parse_line(): the strings point into
+// `line`, and the gids are appended to `gids`, with the gid_list left pointing
+// at their offset until the index is complete.
+static bool parse_line_in_place(const char* path, size_t line_number, char* line, pkg_info* info,
+                                std::vector<gid_t>* gids) {
+  char* fields[8];
+  size_t count = split_fields(line, fields, 8);
+  if (count < 6) {
+    ALOGE("%s:%zu: too few fields in line", path, line_number);
+    return false;
+  }
+
+  unsigned long uid;
+  if (!parse_number(fields[1], ULONG_MAX, &uid)) {
+    ALOGE("%s:%zu: too few fields in line", path, line_number);
+    return false;
+  }
+  if (uid > UID_MAX) {
+    ALOGE("%s:%zu: uid %lu > UID_MAX", path, line_number, uid);
+    return false;
+  }
+
+  *info = {};
+  info->name = fields[0];
+  info->uid = uid;
+  info->debuggable = atoi(fields[2]);
+  info->data_dir = fields[3];
+  info->seinfo = fields[4];
+  if (count > 6) info->profileable_from_shell = atoi(fields[6]);
+  if (count > 7) info->version_code = strtol(fields[7], nullptr, 10);
+
+  info->gids.gids = reinterpret_cast<gid_t*>(gids->size());
+  if (strcmp(fields[5], "none") != 0) {
+    const char* p = fields[5];
+    while (true) {
+      char* end;
+      unsigned long gid = strtoul(p, &end, 10);
+      if (gid > GID_MAX) {
+        ALOGE("%s:%zu: gid %lu > GID_MAX", path, line_number, gid);
+        return false;
+      }
+      gids->push_back(gid);
+      info->gids.cnt++;
+      if (*end == '\0') break;
+      if (*end != ',') return false;
+      p = end + 1;
+    }
+  }
+  return true;
+}
+
+static void packagelist_index_clear(packagelist_index* index) {
+  if (index->map != MAP_FAILED) munmap(index->map, index->map_size);
+  index->map = MAP_FAILED;
+  index->map_size = 0;
+  index->tail.clear();
+  index->packages.clear();
+  index->gids.clear();
+  index->by_name.clear();
+  index->by_uid.clear();
+}
+
+static bool packagelist_index_build(packagelist_index* index) {
+  const char* path = index->path.c_str();
+  packagelist_index_clear(index);
+
+  int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+  if (fd == -1) {
+    ALOGE("couldn't open '%s': %s", path, strerror(errno));
+    return false;
+  }
+  if (fstat(fd, &index->st) == -1) {
+    ALOGE("couldn't stat '%s': %s", path, strerror(errno));
+    close(fd);
+    return false;
+  }
+  if (index->st.st_size > 0) {
+    index->map_size = index->st.st_size;
+    index->map = mmap(nullptr, index->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  int saved_errno = errno;
+  close(fd);
+  if (index->st.st_size > 0 && index->map == MAP_FAILED) {
+    ALOGE("couldn't map '%s': %s", path, strerror(saved_errno));
+    index->map_size = 0;
+    return false;
+  }
+
+  char* data = index->map_size > 0 ? static_cast<char*>(index->map) : nullptr;
+  char* end = data + index->map_size;
+  if (index->map_size > 0 && end[-1] != '\n') {
+    char* last = static_cast<char*>(memrchr(data, '\n', index->map_size));
+    last = last ? last + 1 : data;
+    index->tail.assign(last, end);
+    end = last;
+  }
+
+  size_t line_number = 0;
+  auto parse = [&](char* line) {
+    pkg_info info;
+    if (!parse_line_in_place(path, ++line_number, line, &info, &index->gids)) return false;
+    index->packages.push_back(info);
+    return true;
+  };
+  for (char* line = data; line < end;) {
+    char* newline = static_cast<char*>(memchr(line, '\n', end - line));
+    *newline = '\0';
+    if (!parse(line)) return false;
+    line = newline + 1;
+  }
+  if (!index->tail.empty() && !parse(&index->tail[0])) return false;
+
+  // The gids are all in now, so they won't move any more.
+  for (auto& info : index->packages) {
+    info.gids.gids = info.gids.cnt ? index->gids.data() + reinterpret_cast<size_t>(info.gids.gids)
+                                   : nullptr;
+  }
+
+  const auto& packages = index->packages;
+  index->by_name.resize(packages.size());
+  for (size_t i = 0; i < packages.size(); ++i) index->by_name[i] = i;
+  index->by_uid = index->by_name;
+  std::stable_sort(index->by_name.begin(), index->by_name.end(), [&](size_t a, size_t b) {
+    return strcmp(packages[a].name, packages[b].name) < 0;
+  });
+  std::stable_sort(index->by_uid.begin(), index->by_uid.end(),
+                   [&](size_t a, size_t b) { return packages[a].uid < packages[b].uid; });
+  return true;
+}
+
+// Rebuilds the index if the file has been replaced or modified since.
+static bool packagelist_index_refresh(packagelist_index* index) {
+  struct stat st;
+  if (stat(index->path.c_str(), &st) == -1) {
+    ALOGE("couldn't stat '%s': %s", index->path.c_str(), strerror(errno));
+    return false;
+  }
+  if (st.st_dev == index->st.st_dev && st.st_ino == index->st.st_ino &&
+      st.st_size == index->st.st_size && st.st_mtim.tv_sec == index->st.st_mtim.tv_sec &&
+      st.st_mtim.tv_nsec == index->st.st_mtim.tv_nsec) {
+    return true;
+  }
+  if (!packagelist_index_build(index)) {
+    // Don't keep what was parsed before the failure.
+    packagelist_index_clear(index);
+    index->st = {};
+    return false;
+  }
+  return true;
+}
+
+packagelist_index* packagelist_index_open(const char* path) {
+  std::unique_ptr<packagelist_index> index(new packagelist_index);
+  index->path = path ? path : "/data/system/packages.list";
+  index->st = {};
+  if (!packagelist_index_build(index.get())) {
+    packagelist_index_clear(index.get());
+    return nullptr;
+  }
+  return index.release();
+}
+
+void packagelist_index_close(packagelist_index* index) {
+  if (!index) return;
+  packagelist_index_clear(index);
+  delete index;
+}
+
+const pkg_info* packagelist_index_find_name(packagelist_index* index, const char* name) {
+  if (!packagelist_index_refresh(index)) return nullptr;
+  const auto& packages = index->packages;
+  auto it = std::lower_bound(
+      index->by_name.begin(), index->by_name.end(), name,
+      [&](size_t i, const char* name) { return strcmp(packages[i].name, name) < 0; });
+  if (it == index->by_name.end() || strcmp(packages[*it].name, name) != 0) return nullptr;
+  return &packages[*it];
+}
+
+const pkg_info* packagelist_index_find_uid(packagelist_index* index, uid_t uid) {
+  if (!packagelist_index_refresh(index)) return nullptr;
+  const auto& packages = index->packages;
+  auto it = std::lower_bound(index->by_uid.begin(), index->by_uid.end(), uid,
+                             [&](size_t i, uid_t uid) { return packages[i].uid < uid; });
+  if (it == index->by_uid.end() || packages[*it].uid != uid) return nullptr;
+  return &packages[*it];
+}
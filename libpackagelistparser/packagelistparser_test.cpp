@@ -16,6 +16,8 @@
 
 #include <packagelistparser/packagelistparser.h>
 
+#include <unistd.h>
+
 #include <memory>
 
 #include <android-base/file.h>
@@ -132,3 +134,91 @@ TEST(packagelistparser, system_package_list) {
 TEST(packagelistparser, packagelist_free_nullptr) {
   packagelist_free(nullptr);
 }
+
+TEST(packagelistparser, index_lookup) {
+  TemporaryFile tf;
+  android::base::WriteStringToFile(
+      "com.test.a0 10014 0 /data/user/0/com.test.a0 platform:privapp:targetSdkVersion=19 none\n"
+      "com.test.a2 10011 1 /data/user/0/com.test.a2 media:privapp:targetSdkVersion=30 "
+      "2001,1065,1023\n"
+      // Shares a uid with com.test.a0, and has no trailing newline.
+      "com.test.a1 10014 0 /data/user/0/com.test.a1 selabel:blah none 1 123",
+      tf.path);
+
+  std::unique_ptr<packagelist_index, decltype(&packagelist_index_close)> index(
+      packagelist_index_open(tf.path), &packagelist_index_close);
+  ASSERT_TRUE(index != nullptr);
+
+  const pkg_info* info = packagelist_index_find_name(index.get(), "com.test.a2");
+  ASSERT_TRUE(info != nullptr);
+  ASSERT_STREQ("com.test.a2", info->name);
+  ASSERT_EQ(10011, info->uid);
+  ASSERT_TRUE(info->debuggable);
+  ASSERT_STREQ("/data/user/0/com.test.a2", info->data_dir);
+  ASSERT_STREQ("media:privapp:targetSdkVersion=30", info->seinfo);
+  ASSERT_EQ(3U, info->gids.cnt);
+  ASSERT_EQ(2001U, info->gids.gids[0]);
+  ASSERT_EQ(1023U, info->gids.gids[2]);
+
+  info = packagelist_index_find_name(index.get(), "com.test.a1");
+  ASSERT_TRUE(info != nullptr);
+  ASSERT_STREQ("selabel:blah", info->seinfo);
+  ASSERT_EQ(0U, info->gids.cnt);
+  ASSERT_TRUE(info->profileable_from_shell);
+  ASSERT_EQ(123, info->version_code);
+
+  // The first package in the file wins a shared uid.
+  info = packagelist_index_find_uid(index.get(), 10014);
+  ASSERT_TRUE(info != nullptr);
+  ASSERT_STREQ("com.test.a0", info->name);
+
+  ASSERT_EQ(nullptr, packagelist_index_find_name(index.get(), "com.test.missing"));
+  ASSERT_EQ(nullptr, packagelist_index_find_uid(index.get(), 10099));
+}
+
+TEST(packagelistparser, index_rebuilt_on_change) {
+  TemporaryDir td;
+  std::string path = std::string(td.path) + "/packages.list";
+  android::base::WriteStringToFile("com.test.a0 10014 0 / a none\n", path);
+
+  std::unique_ptr<packagelist_index, decltype(&packagelist_index_close)> index(
+      packagelist_index_open(path.c_str()), &packagelist_index_close);
+  ASSERT_TRUE(index != nullptr);
+  ASSERT_TRUE(packagelist_index_find_name(index.get(), "com.test.a0") != nullptr);
+
+  // Replaced the way the package manager does it: a new file renamed over
+  // the old one.
+  std::string new_path = path + ".new";
+  android::base::WriteStringToFile("com.test.a1 10015 0 / a none\n", new_path);
+  ASSERT_EQ(0, rename(new_path.c_str(), path.c_str()));
+
+  ASSERT_EQ(nullptr, packagelist_index_find_name(index.get(), "com.test.a0"));
+  const pkg_info* info = packagelist_index_find_name(index.get(), "com.test.a1");
+  ASSERT_TRUE(info != nullptr);
+  ASSERT_EQ(10015, info->uid);
+
+  // A list that no longer parses fails lookups rather than serving stale data.
+  android::base::WriteStringToFile("com.test.a2 10016\n", new_path);
+  ASSERT_EQ(0, rename(new_path.c_str(), path.c_str()));
+  ASSERT_EQ(nullptr, packagelist_index_find_name(index.get(), "com.test.a1"));
+
+  unlink(path.c_str());
+}
+
+TEST(packagelistparser, index_bad_file) {
+  ASSERT_EQ(nullptr, packagelist_index_open("/does/not/exist"));
+
+  TemporaryFile tf;
+  android::base::WriteStringToFile("com.test.a0 99999999999 0 / a none\n", tf.path);
+  ASSERT_EQ(nullptr, packagelist_index_open(tf.path));
+
+  TemporaryFile empty;
+  std::unique_ptr<packagelist_index, decltype(&packagelist_index_close)> index(
+      packagelist_index_open(empty.path), &packagelist_index_close);
+  ASSERT_TRUE(index != nullptr);
+  ASSERT_EQ(nullptr, packagelist_index_find_uid(index.get(), 0));
+}
+
+TEST(packagelistparser, packagelist_index_close_nullptr) {
+  packagelist_index_close(nullptr);
+}
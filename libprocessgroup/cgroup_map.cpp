@@ -105,10 +105,8 @@ std::string CgroupController::GetProcsFilePath(const std::string& rel_path, uid_
 }
 
 bool CgroupController::GetTaskGroup(int tid, std::string* group) const {
-    std::string file_name = StringPrintf("/proc/%d/cgroup", tid);
     std::string content;
-    if (!android::base::ReadFileToString(file_name, &content)) {
-        PLOG(ERROR) << "Failed to read " << file_name;
+    if (!ReadTaskCgroups(tid, &content)) {
         return false;
     }
 
@@ -118,6 +116,10 @@ bool CgroupController::GetTaskGroup(int tid, std::string* group) const {
         return true;
     }
 
+    return GetTaskGroup(content, group);
+}
+
+bool CgroupController::GetTaskGroup(const std::string& task_cgroups, std::string* group) const {
     std::string cg_tag;
 
     if (version() == 2) {
@@ -125,22 +127,31 @@ bool CgroupController::GetTaskGroup(int tid, std::string* group) const {
     } else {
         cg_tag = StringPrintf(":%s:", name());
     }
-    size_t start_pos = content.find(cg_tag);
+    size_t start_pos = task_cgroups.find(cg_tag);
     if (start_pos == std::string::npos) {
         return false;
     }
 
     start_pos += cg_tag.length() + 1;  // skip '/'
-    size_t end_pos = content.find('\n', start_pos);
+    size_t end_pos = task_cgroups.find('\n', start_pos);
     if (end_pos == std::string::npos) {
-        *group = content.substr(start_pos, std::string::npos);
+        *group = task_cgroups.substr(start_pos, std::string::npos);
     } else {
-        *group = content.substr(start_pos, end_pos - start_pos);
+        *group = task_cgroups.substr(start_pos, end_pos - start_pos);
     }
 
     return true;
 }
 
+bool CgroupController::ReadTaskCgroups(int tid, std::string* task_cgroups) {
+    std::string file_name = StringPrintf("/proc/%d/cgroup", tid);
+    if (!android::base::ReadFileToString(file_name, task_cgroups)) {
+        PLOG(ERROR) << "Failed to read " << file_name;
+        return false;
+    }
+    return true;
+}
+
 CgroupMap::CgroupMap() {
     if (!LoadRcFile()) {
         LOG(ERROR) << "CgroupMap::LoadRcFile called for [" << getpid() << "] failed";
@@ -44,6 +44,12 @@ class CgroupController {
     std::string GetTasksFilePath(const std::string& path) const;
     std::string GetProcsFilePath(const std::string& path, uid_t uid, pid_t pid) const;
     bool GetTaskGroup(int tid, std::string* group) const;
+    // Same as above, but looks |group| up in the contents of /proc/<tid>/cgroup
+    // read by ReadTaskCgroups(), so that several controllers can share a read.
+    bool GetTaskGroup(const std::string& task_cgroups, std::string* group) const;
+
+    static bool ReadTaskCgroups(int tid, std::string* task_cgroups);
+
   private:
     enum ControllerState {
         UNKNOWN = 0,
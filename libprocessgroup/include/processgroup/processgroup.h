@@ -31,8 +31,19 @@ bool CgroupGetAttributePath(const std::string& attr_name, std::string* path);
 bool CgroupGetAttributePathForTask(const std::string& attr_name, int tid, std::string* path);
 
 bool SetTaskProfiles(int tid, const std::vector<std::string>& profiles, bool use_fd_cache = false);
+// Like SetTaskProfiles(), for many tasks at once. Each cgroup or file that the profiles write to is
+// opened once for the whole batch rather than once per task.
+bool SetTaskProfilesForTids(const std::vector<int>& tids, const std::vector<std::string>& profiles,
+                            bool use_fd_cache = false);
 bool SetProcessProfiles(uid_t uid, pid_t pid, const std::vector<std::string>& profiles);
 
+// Task profiles looked up once by ResolveTaskProfiles(), for callers that apply the same ones over
+// and over. The lookup is not repeated, and the set stays valid for the life of the process.
+struct TaskProfileSet;
+const TaskProfileSet* ResolveTaskProfiles(const std::vector<std::string>& profiles);
+bool SetTaskProfilesResolved(int tid, const TaskProfileSet* profiles, bool use_fd_cache = false);
+bool SetProcessProfilesResolved(uid_t uid, pid_t pid, const TaskProfileSet* profiles);
+
 #ifndef __ANDROID_VNDK__
 
 bool SetProcessProfilesCached(uid_t uid, pid_t pid, const std::vector<std::string>& profiles);
@@ -60,6 +71,12 @@ int killProcessGroupOnce(uid_t uid, int initialPid, int signal, int* max_process
 
 int createProcessGroup(uid_t uid, int initialPid, bool memControl = false);
 
+// Creates, on a background thread, the cgroups that createProcessGroup() will need for processes
+// of uid, so that less of that work is left for process start. createProcessGroup() still creates
+// whatever isn't ready in time. The thread stays around afterwards, so don't call this from
+// processes that need to stay single threaded, such as the zygote.
+void prepareProcessGroups(uid_t uid);
+
 // Set various properties of a process group. For these functions to work, the process group must
 // have been created by passing memControl=true to createProcessGroup.
 bool setProcessGroupSwappiness(uid_t uid, int initialPid, int swappiness);
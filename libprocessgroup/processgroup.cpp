@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,7 +30,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -42,6 +46,7 @@
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <cutils/android_filesystem_config.h>
 #include <processgroup/processgroup.h>
 #include <task_profiles.h>
@@ -49,11 +54,23 @@
 using android::base::GetBoolProperty;
 using android::base::StartsWith;
 using android::base::StringPrintf;
+using android::base::unique_fd;
 using android::base::WriteStringToFile;
 
 using namespace std::chrono_literals;
 
 #define PROCESSGROUP_CGROUP_PROCS_FILE "/cgroup.procs"
+#define PROCESSGROUP_CGROUP_KILL_FILE "/cgroup.kill"
+#define PROCESSGROUP_CGROUP_EVENTS_FILE "/cgroup.events"
+
+// The most threads that removeAllProcessGroups() and removeAllEmptyProcessGroups() use.
+static constexpr size_t kMaxRemoveThreads = 4;
+
+// Groups in a uid group that prepareProcessGroups() creates ahead of time, for
+// createProcessGroup() to rename into place. Only cgroup v1 can rename groups, so on v2 only the
+// uid group is prepared.
+static constexpr int kSpareProcessGroups = 4;
+static constexpr const char kSpareProcessGroupPrefix[] = ".spare_";
 
 bool CgroupGetControllerPath(const std::string& cgroup_name, std::string* path) {
     auto controller = CgroupMap::GetInstance().FindController(cgroup_name);
@@ -145,6 +162,7 @@ static bool isMemoryCgroupSupported() {
 void DropTaskProfilesResourceCaching() {
     TaskProfiles::GetInstance().DropResourceCaching(ProfileAction::RCT_TASK);
     TaskProfiles::GetInstance().DropResourceCaching(ProfileAction::RCT_PROCESS);
+    TaskProfiles::GetInstance().DropAppResourceCaching(0, -1);
 }
 
 bool SetProcessProfiles(uid_t uid, pid_t pid, const std::vector<std::string>& profiles) {
@@ -159,6 +177,23 @@ bool SetTaskProfiles(int tid, const std::vector<std::string>& profiles, bool use
     return TaskProfiles::GetInstance().SetTaskProfiles(tid, profiles, use_fd_cache);
 }
 
+bool SetTaskProfilesForTids(const std::vector<int>& tids, const std::vector<std::string>& profiles,
+                            bool use_fd_cache) {
+    return TaskProfiles::GetInstance().SetTaskProfiles(tids, profiles, use_fd_cache);
+}
+
+const TaskProfileSet* ResolveTaskProfiles(const std::vector<std::string>& profiles) {
+    return TaskProfiles::GetInstance().ResolveProfiles(profiles);
+}
+
+bool SetTaskProfilesResolved(int tid, const TaskProfileSet* profiles, bool use_fd_cache) {
+    return TaskProfiles::GetInstance().SetTaskProfiles(tid, *profiles, use_fd_cache);
+}
+
+bool SetProcessProfilesResolved(uid_t uid, pid_t pid, const TaskProfileSet* profiles) {
+    return TaskProfiles::GetInstance().SetProcessProfiles(uid, pid, *profiles, false);
+}
+
 // C wrapper for SetProcessProfiles.
 // No need to have this in the header file because this function is specifically for crosvm. Crosvm
 // which is written in Rust has its own declaration of this foreign function and doesn't rely on the
@@ -187,6 +222,9 @@ static int RemoveProcessGroup(const char* cgroup, uid_t uid, int pid, unsigned i
     auto uid_pid_path = ConvertUidPidToPath(cgroup, uid, pid);
     auto uid_path = ConvertUidToPath(cgroup, uid);
 
+    // Don't keep writing to the group through fds opened before it was removed.
+    TaskProfiles::GetInstance().DropAppResourceCaching(uid, pid);
+
     if (retries == 0) {
         retries = 1;
     }
@@ -200,6 +238,40 @@ static int RemoveProcessGroup(const char* cgroup, uid_t uid, int pid, unsigned i
     return ret;
 }
 
+// Returns 1 if the process cgroup of events_fd still has processes, 0 if it has none, and -1 on
+// error.
+static int ReadProcessGroupPopulated(int events_fd) {
+    char buf[256];
+    ssize_t len = TEMP_FAILURE_RETRY(pread(events_fd, buf, sizeof(buf) - 1, 0));
+    if (len < 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+
+    static constexpr const char kPopulated[] = "populated ";
+    const char* populated = strstr(buf, kPopulated);
+    if (populated == nullptr) {
+        return -1;
+    }
+    return populated[sizeof(kPopulated) - 1] == '1' ? 1 : 0;
+}
+
+// Returns 1 if the process cgroup at path still has processes, 0 if it has none, and -1 on error.
+static int IsProcessGroupPopulated(const std::string& path) {
+    unique_fd events_fd(TEMP_FAILURE_RETRY(
+            open((path + PROCESSGROUP_CGROUP_EVENTS_FILE).c_str(), O_RDONLY | O_CLOEXEC)));
+    if (events_fd >= 0) {
+        return ReadProcessGroupPopulated(events_fd);
+    }
+
+    // cgroup v1 has no cgroup.events, and reports a size of 0 for cgroup.procs whatever it holds.
+    std::string procs;
+    if (!android::base::ReadFileToString(path + PROCESSGROUP_CGROUP_PROCS_FILE, &procs)) {
+        return -1;
+    }
+    return procs.empty() ? 0 : 1;
+}
+
 static bool RemoveUidProcessGroups(const std::string& uid_path, bool empty_only) {
     std::unique_ptr<DIR, decltype(&closedir)> uid(opendir(uid_path.c_str()), closedir);
     bool empty = true;
@@ -210,25 +282,25 @@ static bool RemoveUidProcessGroups(const std::string& uid_path, bool empty_only)
                 continue;
             }
 
-            if (!StartsWith(dir->d_name, "pid_")) {
+            // Spare groups are always empty, and would keep the uid group from being removed.
+            if (!StartsWith(dir->d_name, "pid_") &&
+                !StartsWith(dir->d_name, kSpareProcessGroupPrefix)) {
                 continue;
             }
 
             auto path = StringPrintf("%s/%s", uid_path.c_str(), dir->d_name);
-            if (empty_only) {
-                struct stat st;
-                auto procs_file = StringPrintf("%s/%s", path.c_str(),
-                                               PROCESSGROUP_CGROUP_PROCS_FILE);
-                if (stat(procs_file.c_str(), &st) == -1) {
-                    PLOG(ERROR) << "Failed to get stats for " << procs_file;
-                    continue;
-                }
-                if (st.st_size > 0) {
-                    // skip non-empty groups
-                    LOG(VERBOSE) << "Skipping non-empty group " << path;
-                    empty = false;
-                    continue;
-                }
+            // rmdir() would fail for a group with processes anyway, but only after taking the
+            // cgroup lock that every other cgroup operation in the system needs as well.
+            int populated = IsProcessGroupPopulated(path);
+            if (populated < 0 && empty_only) {
+                PLOG(ERROR) << "Failed to check for processes in " << path;
+                continue;
+            }
+            if (populated > 0) {
+                // skip non-empty groups
+                LOG(VERBOSE) << "Skipping non-empty group " << path;
+                empty = false;
+                continue;
             }
             LOG(VERBOSE) << "Removing " << path;
             if (rmdir(path.c_str()) == -1) {
@@ -246,6 +318,8 @@ void removeAllProcessGroupsInternal(bool empty_only) {
     std::vector<std::string> cgroups;
     std::string path, memcg_apps_path;
 
+    TaskProfiles::GetInstance().DropAppResourceCaching(0, -1);
+
     if (CgroupGetControllerPath(CGROUPV2_CONTROLLER_NAME, &path)) {
         cgroups.push_back(path);
     }
@@ -253,6 +327,7 @@ void removeAllProcessGroupsInternal(bool empty_only) {
         cgroups.push_back(memcg_apps_path);
     }
 
+    std::vector<std::string> uid_paths;
     for (std::string cgroup_root_path : cgroups) {
         std::unique_ptr<DIR, decltype(&closedir)> root(opendir(cgroup_root_path.c_str()), closedir);
         if (root == NULL) {
@@ -268,18 +343,38 @@ void removeAllProcessGroupsInternal(bool empty_only) {
                     continue;
                 }
 
-                auto path = StringPrintf("%s/%s", cgroup_root_path.c_str(), dir->d_name);
-                if (!RemoveUidProcessGroups(path, empty_only)) {
-                    LOG(VERBOSE) << "Skip removing " << path;
-                    continue;
-                }
-                LOG(VERBOSE) << "Removing " << path;
-                if (rmdir(path.c_str()) == -1 && errno != EBUSY) {
-                    PLOG(WARNING) << "Failed to remove " << path;
-                }
+                uid_paths.push_back(StringPrintf("%s/%s", cgroup_root_path.c_str(), dir->d_name));
             }
         }
     }
+
+    // Most of the work is reading the state of each group, which the uid groups can share out.
+    std::atomic<size_t> next_uid_path = 0;
+    auto remove_uid_paths = [&]() {
+        size_t i;
+        while ((i = next_uid_path++) < uid_paths.size()) {
+            const std::string& path = uid_paths[i];
+            if (!RemoveUidProcessGroups(path, empty_only)) {
+                LOG(VERBOSE) << "Skip removing " << path;
+                continue;
+            }
+            LOG(VERBOSE) << "Removing " << path;
+            if (rmdir(path.c_str()) == -1 && errno != EBUSY) {
+                PLOG(WARNING) << "Failed to remove " << path;
+            }
+        }
+    };
+
+    size_t num_threads = std::min<size_t>({std::max(std::thread::hardware_concurrency(), 1U),
+                                           kMaxRemoveThreads, uid_paths.size()});
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(remove_uid_paths);
+    }
+    remove_uid_paths();
+    for (auto& thread : threads) {
+        thread.join();
+    }
 }
 
 void removeAllProcessGroups() {
@@ -415,6 +510,77 @@ static int DoKillProcessGroupOnce(const char* cgroup, uid_t uid, int initialPid,
     return feof(fd.get()) ? processes : -1;
 }
 
+// Returns the number of processes in the process cgroup, or -1 on error.
+static int CountProcessGroupProcesses(const std::string& cgroup_path) {
+    auto path = cgroup_path + PROCESSGROUP_CGROUP_PROCS_FILE;
+    std::unique_ptr<FILE, decltype(&fclose)> fd(fopen(path.c_str(), "re"), fclose);
+    if (!fd) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    pid_t pid;
+    int processes = 0;
+    while (fscanf(fd.get(), "%d\n", &pid) == 1) {
+        processes++;
+    }
+    return processes;
+}
+
+// Kills all processes in the process cgroup with a single write to cgroup.kill, which cgroup v2
+// has had since Linux 5.14, then waits for up to `timeout` for cgroup.events to report the group
+// empty. Returns false if cgroup.kill isn't available, in which case the caller signals the
+// processes itself. Otherwise sets *processes like DoKillProcessGroupOnce() does.
+static bool CgroupKillProcessGroup(const char* cgroup, uid_t uid, int initialPid,
+                                   std::chrono::milliseconds timeout, int* max_processes,
+                                   int* processes) {
+    auto path = ConvertUidPidToPath(cgroup, uid, initialPid);
+    unique_fd kill_fd(TEMP_FAILURE_RETRY(
+            open((path + PROCESSGROUP_CGROUP_KILL_FILE).c_str(), O_WRONLY | O_CLOEXEC)));
+    if (kill_fd < 0) {
+        return false;
+    }
+    unique_fd events_fd(TEMP_FAILURE_RETRY(
+            open((path + PROCESSGROUP_CGROUP_EVENTS_FILE).c_str(), O_RDONLY | O_CLOEXEC)));
+    if (events_fd < 0) {
+        return false;
+    }
+
+    if (max_processes != nullptr) {
+        *max_processes = std::max(CountProcessGroupProcesses(path), 0);
+    }
+
+    LOG(VERBOSE) << "Killing process cgroup uid " << uid << " pid " << initialPid
+                 << " through cgroup.kill";
+    if (TEMP_FAILURE_RETRY(write(kill_fd, "1", 1)) != 1) {
+        PLOG(WARNING) << "Failed to write to " << path << PROCESSGROUP_CGROUP_KILL_FILE;
+        return false;
+    }
+
+    // Changes of cgroup.events are reported to poll() as POLLPRI.
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    int populated;
+    while ((populated = ReadProcessGroupPopulated(events_fd)) == 1) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (remaining <= 0ms) {
+            break;
+        }
+        struct pollfd pfd = {.fd = events_fd, .events = POLLPRI};
+        if (TEMP_FAILURE_RETRY(poll(&pfd, 1, remaining.count())) < 0) {
+            populated = -1;
+            break;
+        }
+    }
+
+    if (populated == 1) {
+        // Make sure the group didn't empty since cgroup.events was read.
+        *processes = CountProcessGroupProcesses(path);
+    } else {
+        *processes = populated;
+    }
+    return true;
+}
+
 static int KillProcessGroup(uid_t uid, int initialPid, int signal, int retries,
                             int* max_processes) {
     std::string hierarchy_root_path;
@@ -429,7 +595,14 @@ static int KillProcessGroup(uid_t uid, int initialPid, int signal, int retries,
 
     int retry = retries;
     int processes;
-    while ((processes = DoKillProcessGroupOnce(cgroup, uid, initialPid, signal)) > 0) {
+    if (signal == SIGKILL && CgroupKillProcessGroup(cgroup, uid, initialPid, retries * 5ms,
+                                                    max_processes, &processes)) {
+        // Either the group is empty, or it didn't empty in the time the retries would have taken.
+        retry = 0;
+    } else {
+        processes = DoKillProcessGroupOnce(cgroup, uid, initialPid, signal);
+    }
+    for (; processes > 0; processes = DoKillProcessGroupOnce(cgroup, uid, initialPid, signal)) {
         if (max_processes != nullptr && processes > *max_processes) {
             *max_processes = processes;
         }
@@ -492,23 +665,50 @@ int killProcessGroupOnce(uid_t uid, int initialPid, int signal, int* max_process
     return KillProcessGroup(uid, initialPid, signal, 0 /*retries*/, max_processes);
 }
 
-static int createProcessGroupInternal(uid_t uid, int initialPid, std::string cgroup,
-                                      bool activate_controllers) {
-    auto uid_path = ConvertUidToPath(cgroup.c_str(), uid);
+static std::string ConvertUidToSparePath(const char* cgroup, uid_t uid, int index) {
+    return StringPrintf("%s/uid_%d/%s%d", cgroup, uid, kSpareProcessGroupPrefix, index);
+}
 
+static void GetProcessGroupOwner(const std::string& cgroup, mode_t* mode, uid_t* uid, gid_t* gid) {
     struct stat cgroup_stat;
-    mode_t cgroup_mode = 0750;
-    uid_t cgroup_uid = AID_SYSTEM;
-    gid_t cgroup_gid = AID_SYSTEM;
-    int ret = 0;
-
     if (stat(cgroup.c_str(), &cgroup_stat) < 0) {
         PLOG(ERROR) << "Failed to get stats for " << cgroup;
+        *mode = 0750;
+        *uid = AID_SYSTEM;
+        *gid = AID_SYSTEM;
     } else {
-        cgroup_mode = cgroup_stat.st_mode;
-        cgroup_uid = cgroup_stat.st_uid;
-        cgroup_gid = cgroup_stat.st_gid;
+        *mode = cgroup_stat.st_mode;
+        *uid = cgroup_stat.st_uid;
+        *gid = cgroup_stat.st_gid;
+    }
+}
+
+// Renames one of the spare groups of the uid into place as the group of initialPid. Spares are
+// claimed by whichever process renames them first, so this is safe across processes.
+static bool TakeSpareProcessGroup(const std::string& cgroup, uid_t uid, int initialPid) {
+    auto uid_pid_path = ConvertUidPidToPath(cgroup.c_str(), uid, initialPid);
+    for (int i = 0; i < kSpareProcessGroups; i++) {
+        auto spare_path = ConvertUidToSparePath(cgroup.c_str(), uid, i);
+        if (rename(spare_path.c_str(), uid_pid_path.c_str()) == 0) {
+            return true;
+        }
+        if (errno != ENOENT) {
+            return false;
+        }
     }
+    return false;
+}
+
+static int createProcessGroupInternal(uid_t uid, int initialPid, std::string cgroup,
+                                      bool activate_controllers) {
+    auto uid_path = ConvertUidToPath(cgroup.c_str(), uid);
+
+    mode_t cgroup_mode;
+    uid_t cgroup_uid;
+    gid_t cgroup_gid;
+    int ret = 0;
+
+    GetProcessGroupOwner(cgroup, &cgroup_mode, &cgroup_uid, &cgroup_gid);
 
     if (!MkdirAndChown(uid_path, cgroup_mode, cgroup_uid, cgroup_gid)) {
         PLOG(ERROR) << "Failed to make and chown " << uid_path;
@@ -524,7 +724,9 @@ static int createProcessGroupInternal(uid_t uid, int initialPid, std::string cgr
 
     auto uid_pid_path = ConvertUidPidToPath(cgroup.c_str(), uid, initialPid);
 
-    if (!MkdirAndChown(uid_pid_path, cgroup_mode, cgroup_uid, cgroup_gid)) {
+    // The v2 hierarchy is the one with controllers to activate, and it can't rename groups.
+    bool took_spare = !activate_controllers && TakeSpareProcessGroup(cgroup, uid, initialPid);
+    if (!took_spare && !MkdirAndChown(uid_pid_path, cgroup_mode, cgroup_uid, cgroup_gid)) {
         PLOG(ERROR) << "Failed to make and chown " << uid_pid_path;
         return -errno;
     }
@@ -562,6 +764,87 @@ int createProcessGroup(uid_t uid, int initialPid, bool memControl) {
     return createProcessGroupInternal(uid, initialPid, cgroup, true);
 }
 
+// Creates the uid group, and the spare groups if the hierarchy can rename them, the way
+// createProcessGroupInternal() would.
+static void PrepareProcessGroupsInternal(uid_t uid, const std::string& cgroup,
+                                         bool activate_controllers) {
+    auto uid_path = ConvertUidToPath(cgroup.c_str(), uid);
+
+    mode_t cgroup_mode;
+    uid_t cgroup_uid;
+    gid_t cgroup_gid;
+    GetProcessGroupOwner(cgroup, &cgroup_mode, &cgroup_uid, &cgroup_gid);
+
+    if (!MkdirAndChown(uid_path, cgroup_mode, cgroup_uid, cgroup_gid)) {
+        PLOG(ERROR) << "Failed to make and chown " << uid_path;
+        return;
+    }
+    if (activate_controllers) {
+        if (CgroupMap::GetInstance().ActivateControllers(uid_path)) {
+            LOG(ERROR) << "Failed to activate controllers in " << uid_path;
+        }
+        return;
+    }
+
+    for (int i = 0; i < kSpareProcessGroups; i++) {
+        auto spare_path = ConvertUidToSparePath(cgroup.c_str(), uid, i);
+        if (access(spare_path.c_str(), F_OK) == 0) {
+            continue;
+        }
+        // Set the group up under another name, so that nobody takes it half chowned.
+        auto new_path = spare_path + ".new";
+        if (!MkdirAndChown(new_path, cgroup_mode, cgroup_uid, cgroup_gid)) {
+            PLOG(ERROR) << "Failed to make and chown " << new_path;
+            return;
+        }
+        if (rename(new_path.c_str(), spare_path.c_str()) == -1) {
+            PLOG(ERROR) << "Failed to rename " << new_path << " to " << spare_path;
+            rmdir(new_path.c_str());
+            return;
+        }
+    }
+}
+
+static void PrepareProcessGroups(uid_t uid) {
+    if (std::string memcg_apps_path;
+        isMemoryCgroupSupported() && UsePerAppMemcg() && CgroupGetMemcgAppsPath(&memcg_apps_path)) {
+        PrepareProcessGroupsInternal(uid, memcg_apps_path, false);
+    }
+
+    std::string cgroup;
+    if (CgroupGetControllerPath(CGROUPV2_CONTROLLER_NAME, &cgroup)) {
+        PrepareProcessGroupsInternal(uid, cgroup, true);
+    }
+}
+
+void prepareProcessGroups(uid_t uid) {
+    static std::mutex mutex;
+    static std::condition_variable cv;
+    static std::set<uid_t> pending;
+    static bool started = false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.emplace(uid);
+    if (started) {
+        cv.notify_one();
+        return;
+    }
+
+    started = true;
+    std::thread([] {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [] { return !pending.empty(); });
+            uid_t uid = *pending.begin();
+            pending.erase(pending.begin());
+
+            lock.unlock();
+            PrepareProcessGroups(uid);
+            lock.lock();
+        }
+    }).detach();
+}
+
 static bool SetProcessGroupValue(int tid, const std::string& attr_name, int64_t value) {
     if (!isMemoryCgroupSupported()) {
         PLOG(ERROR) << "Memcg is not mounted.";
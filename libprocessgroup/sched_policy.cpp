@@ -45,18 +45,28 @@ int set_cpuset_policy(int tid, SchedPolicy policy) {
     policy = _policy(policy);
 
     switch (policy) {
-        case SP_BACKGROUND:
-            return SetTaskProfiles(tid, {"CPUSET_SP_BACKGROUND"}, true) ? 0 : -1;
+        case SP_BACKGROUND: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"CPUSET_SP_BACKGROUND"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
         case SP_FOREGROUND:
         case SP_AUDIO_APP:
-        case SP_AUDIO_SYS:
-            return SetTaskProfiles(tid, {"CPUSET_SP_FOREGROUND"}, true) ? 0 : -1;
-        case SP_TOP_APP:
-            return SetTaskProfiles(tid, {"CPUSET_SP_TOP_APP"}, true) ? 0 : -1;
-        case SP_SYSTEM:
-            return SetTaskProfiles(tid, {"CPUSET_SP_SYSTEM"}, true) ? 0 : -1;
-        case SP_RESTRICTED:
-            return SetTaskProfiles(tid, {"CPUSET_SP_RESTRICTED"}, true) ? 0 : -1;
+        case SP_AUDIO_SYS: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"CPUSET_SP_FOREGROUND"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
+        case SP_TOP_APP: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"CPUSET_SP_TOP_APP"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
+        case SP_SYSTEM: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"CPUSET_SP_SYSTEM"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
+        case SP_RESTRICTED: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"CPUSET_SP_RESTRICTED"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
         default:
             break;
     }
@@ -116,20 +126,32 @@ int set_sched_policy(int tid, SchedPolicy policy) {
 #endif
 
     switch (policy) {
-        case SP_BACKGROUND:
-            return SetTaskProfiles(tid, {"SCHED_SP_BACKGROUND"}, true) ? 0 : -1;
+        case SP_BACKGROUND: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"SCHED_SP_BACKGROUND"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
         case SP_FOREGROUND:
         case SP_AUDIO_APP:
-        case SP_AUDIO_SYS:
-            return SetTaskProfiles(tid, {"SCHED_SP_FOREGROUND"}, true) ? 0 : -1;
-        case SP_TOP_APP:
-            return SetTaskProfiles(tid, {"SCHED_SP_TOP_APP"}, true) ? 0 : -1;
-        case SP_SYSTEM:
-            return SetTaskProfiles(tid, {"SCHED_SP_SYSTEM"}, true) ? 0 : -1;
-        case SP_RT_APP:
-            return SetTaskProfiles(tid, {"SCHED_SP_RT_APP"}, true) ? 0 : -1;
-        default:
-            return SetTaskProfiles(tid, {"SCHED_SP_DEFAULT"}, true) ? 0 : -1;
+        case SP_AUDIO_SYS: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"SCHED_SP_FOREGROUND"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
+        case SP_TOP_APP: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"SCHED_SP_TOP_APP"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
+        case SP_SYSTEM: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"SCHED_SP_SYSTEM"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
+        case SP_RT_APP: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"SCHED_SP_RT_APP"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
+        default: {
+            static const TaskProfileSet* profiles = ResolveTaskProfiles({"SCHED_SP_DEFAULT"});
+            return SetTaskProfilesResolved(tid, profiles, true) ? 0 : -1;
+        }
     }
 
     return 0;
@@ -154,12 +176,18 @@ bool schedboost_enabled() {
     return enabled;
 }
 
-static int getCGroupSubsys(int tid, const char* subsys, std::string& subgroup) {
+// |task_cgroups| holds the contents of /proc/<tid>/cgroup. It is read on first
+// use, so that looking up several controllers only reads the file once.
+static int getCGroupSubsys(int tid, const char* subsys, std::string* task_cgroups,
+                           std::string& subgroup) {
     auto controller = CgroupMap::GetInstance().FindController(subsys);
 
     if (!controller.IsUsable()) return -1;
 
-    if (!controller.GetTaskGroup(tid, &subgroup))
+    if (task_cgroups->empty() && !CgroupController::ReadTaskCgroups(tid, task_cgroups))
+        return -1;
+
+    if (!controller.GetTaskGroup(*task_cgroups, &subgroup))
         return -1;
 
     return 0;
@@ -190,10 +218,11 @@ int get_sched_policy(int tid, SchedPolicy* policy) {
         tid = GetThreadId();
     }
 
+    std::string task_cgroups;
     std::string group;
     if (schedboost_enabled()) {
-        if ((getCGroupSubsys(tid, "schedtune", group) < 0) &&
-            (getCGroupSubsys(tid, "cpu", group) < 0)) {
+        if ((getCGroupSubsys(tid, "schedtune", &task_cgroups, group) < 0) &&
+            (getCGroupSubsys(tid, "cpu", &task_cgroups, group) < 0)) {
             LOG(ERROR) << "Failed to find cpu cgroup for tid " << tid;
             return -1;
         }
@@ -207,7 +236,7 @@ int get_sched_policy(int tid, SchedPolicy* policy) {
         }
     }
 
-    if (cpusets_enabled() && getCGroupSubsys(tid, "cpuset", group) < 0) {
+    if (cpusets_enabled() && getCGroupSubsys(tid, "cpuset", &task_cgroups, group) < 0) {
         LOG(ERROR) << "Failed to find cpuset cgroup for tid " << tid;
         return -1;
     }
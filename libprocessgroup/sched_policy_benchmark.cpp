@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <android-base/threads.h>
+#include <benchmark/benchmark.h>
+#include <cgroup_map.h>
+#include <processgroup/sched_policy.h>
+
+using android::base::GetThreadId;
+
+static void BM_get_sched_policy(benchmark::State& state) {
+    int tid = GetThreadId();
+    for (auto _ : state) {
+        SchedPolicy policy;
+        if (get_sched_policy(tid, &policy) < 0) {
+            state.SkipWithError("get_sched_policy failed");
+            return;
+        }
+        benchmark::DoNotOptimize(policy);
+    }
+}
+BENCHMARK(BM_get_sched_policy);
+
+// What get_sched_policy() used to cost: one read of /proc/<tid>/cgroup for
+// each controller it looks at.
+static void BM_GetTaskGroupPerController(benchmark::State& state) {
+    int tid = GetThreadId();
+    for (auto _ : state) {
+        for (const char* name : {"schedtune", "cpu", "cpuset"}) {
+            auto controller = CgroupMap::GetInstance().FindController(name);
+            std::string group;
+            if (controller.IsUsable() && controller.GetTaskGroup(tid, &group)) {
+                benchmark::DoNotOptimize(group);
+            }
+        }
+    }
+}
+BENCHMARK(BM_GetTaskGroupPerController);
+
+// The same lookups sharing a single read.
+static void BM_GetTaskGroupSharedRead(benchmark::State& state) {
+    int tid = GetThreadId();
+    for (auto _ : state) {
+        std::string task_cgroups;
+        if (!CgroupController::ReadTaskCgroups(tid, &task_cgroups)) {
+            state.SkipWithError("Could not read task cgroups");
+            return;
+        }
+        for (const char* name : {"schedtune", "cpu", "cpuset"}) {
+            auto controller = CgroupMap::GetInstance().FindController(name);
+            std::string group;
+            if (controller.IsUsable() && controller.GetTaskGroup(task_cgroups, &group)) {
+                benchmark::DoNotOptimize(group);
+            }
+        }
+    }
+}
+BENCHMARK(BM_GetTaskGroupSharedRead);
+
+BENCHMARK_MAIN();
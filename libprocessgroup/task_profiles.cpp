@@ -19,6 +19,8 @@
 
 #include <fcntl.h>
 #include <task_profiles.h>
+#include <algorithm>
+#include <set>
 #include <string>
 
 #include <android-base/file.h>
@@ -43,6 +45,7 @@ using android::base::GetUintProperty;
 using android::base::StringPrintf;
 using android::base::StringReplace;
 using android::base::unique_fd;
+using android::base::WriteStringToFd;
 using android::base::WriteStringToFile;
 
 static constexpr const char* TASK_PROFILE_DB_FILE = "/etc/task_profiles.json";
@@ -63,8 +66,6 @@ class FdCacheHelper {
     static void Drop(android::base::unique_fd& fd);
     static void Init(const std::string& path, android::base::unique_fd& fd);
     static bool IsCached(const android::base::unique_fd& fd) { return fd > FDS_INACCESSIBLE; }
-
-  private:
     static bool IsAppDependentPath(const std::string& path);
 };
 
@@ -112,6 +113,15 @@ bool FdCacheHelper::IsAppDependentPath(const std::string& path) {
     return path.find("<uid>", 0) != std::string::npos || path.find("<pid>", 0) != std::string::npos;
 }
 
+bool ProfileAction::ExecuteForTasks(const std::vector<int>& tids) const {
+    for (int tid : tids) {
+        if (!ExecuteForTask(tid)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 IProfileAttribute::~IProfileAttribute() = default;
 
 void ProfileAttribute::Reset(const CgroupController& controller, const std::string& file_name) {
@@ -206,6 +216,30 @@ bool SetAttributeAction::ExecuteForTask(int tid) const {
         return false;
     }
 
+    return WriteValueToPath(path);
+}
+
+bool SetAttributeAction::ExecuteForTasks(const std::vector<int>& tids) const {
+    // Tasks in the same cgroup share the attribute, so it only needs to be written once per group.
+    std::set<std::string> paths;
+    for (int tid : tids) {
+        std::string path;
+        if (!attribute_->GetPathForTask(tid, &path)) {
+            LOG(ERROR) << "Failed to find cgroup for tid " << tid;
+            return false;
+        }
+        paths.insert(std::move(path));
+    }
+
+    for (const auto& path : paths) {
+        if (!WriteValueToPath(path)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SetAttributeAction::WriteValueToPath(const std::string& path) const {
     if (!WriteStringToFile(value_, path)) {
         if (access(path.c_str(), F_OK) < 0) {
             if (optional_) {
@@ -226,7 +260,7 @@ bool SetAttributeAction::ExecuteForTask(int tid) const {
 }
 
 SetCgroupAction::SetCgroupAction(const CgroupController& c, const std::string& p)
-    : controller_(c), path_(p) {
+    : controller_(c), path_(p), app_dependent_(FdCacheHelper::IsAppDependentPath(p)) {
     FdCacheHelper::Init(controller_.GetTasksFilePath(path_), fd_[ProfileAction::RCT_TASK]);
     // uid and pid don't matter because IsAppDependentPath ensures the path doesn't use them
     FdCacheHelper::Init(controller_.GetProcsFilePath(path_, 0, 0), fd_[ProfileAction::RCT_PROCESS]);
@@ -300,6 +334,10 @@ bool SetCgroupAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
         return result == ProfileAction::SUCCESS;
     }
 
+    if (app_dependent_) {
+        return AddPidToAppCgroup(uid, pid);
+    }
+
     // fd was not cached or cached fd can't be used
     std::string procs_path = controller()->GetProcsFilePath(path_, uid, pid);
     unique_fd tmp_fd(TEMP_FAILURE_RETRY(open(procs_path.c_str(), O_WRONLY | O_CLOEXEC)));
@@ -315,6 +353,46 @@ bool SetCgroupAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
     return true;
 }
 
+// App-dependent paths can't use the fd cache, but the same apps move between groups over and over,
+// so the last few of their cgroup.procs files are kept open whether or not caching is enabled.
+bool SetCgroupAction::AddPidToAppCgroup(uid_t uid, pid_t pid) const {
+    {
+        std::lock_guard<std::mutex> lock(fd_mutex_);
+        auto it = std::find_if(app_fds_.begin(), app_fds_.end(), [uid, pid](const AppFd& app_fd) {
+            return app_fd.uid == uid && app_fd.pid == pid;
+        });
+        if (it != app_fds_.end()) {
+            std::string value = std::to_string(pid);
+            if (TEMP_FAILURE_RETRY(write(it->fd, value.c_str(), value.length())) ==
+                value.length()) {
+                app_fds_.splice(app_fds_.begin(), app_fds_, it);
+                return true;
+            }
+            // The group may have been removed, and created again, by another process. Open it anew
+            // below, which also reports any error.
+            app_fds_.erase(it);
+        }
+    }
+
+    std::string procs_path = controller()->GetProcsFilePath(path_, uid, pid);
+    unique_fd tmp_fd(TEMP_FAILURE_RETRY(open(procs_path.c_str(), O_WRONLY | O_CLOEXEC)));
+    if (tmp_fd < 0) {
+        PLOG(WARNING) << "Failed to open " << procs_path;
+        return false;
+    }
+    if (!AddTidToCgroup(pid, tmp_fd, controller()->name())) {
+        LOG(ERROR) << "Failed to add task into cgroup";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    app_fds_.push_front({uid, pid, std::move(tmp_fd)});
+    if (app_fds_.size() > kMaxAppFds) {
+        app_fds_.pop_back();
+    }
+    return true;
+}
+
 bool SetCgroupAction::ExecuteForTask(int tid) const {
     CacheUseResult result = UseCachedFd(ProfileAction::RCT_TASK, tid);
     if (result != ProfileAction::UNUSED) {
@@ -336,6 +414,45 @@ bool SetCgroupAction::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool SetCgroupAction::ExecuteForTasks(const std::vector<int>& tids) const {
+    // The kernel takes one task per write, but the file only needs to be opened once.
+    std::unique_lock<std::mutex> lock(fd_mutex_);
+    const unique_fd& cached_fd = fd_[ProfileAction::RCT_TASK];
+    unique_fd tmp_fd;
+    int fd = cached_fd;
+    if (!FdCacheHelper::IsCached(cached_fd)) {
+        if (cached_fd == FdCacheHelper::FDS_INACCESSIBLE) {
+            // no permissions to access the file, ignore
+            return true;
+        }
+        if (cached_fd == FdCacheHelper::FDS_APP_DEPENDENT) {
+            // application-dependent path can't be used with tid
+            LOG(ERROR) << "Application profile can't be applied to a thread";
+            return false;
+        }
+        lock.unlock();
+
+        std::string tasks_path = controller()->GetTasksFilePath(path_);
+        tmp_fd.reset(TEMP_FAILURE_RETRY(open(tasks_path.c_str(), O_WRONLY | O_CLOEXEC)));
+        if (tmp_fd < 0) {
+            PLOG(WARNING) << "Failed to open " << tasks_path;
+            return false;
+        }
+        fd = tmp_fd;
+    }
+
+    bool success = true;
+    for (int tid : tids) {
+        if (!AddTidToCgroup(tid, fd, controller()->name())) {
+            success = false;
+        }
+    }
+    if (!success) {
+        LOG(ERROR) << "Failed to add tasks into cgroup";
+    }
+    return success;
+}
+
 void SetCgroupAction::EnableResourceCaching(ResourceCacheType cache_type) {
     std::lock_guard<std::mutex> lock(fd_mutex_);
     // Return early to prevent unnecessary calls to controller_.Get{Tasks|Procs}FilePath() which
@@ -362,6 +479,13 @@ void SetCgroupAction::DropResourceCaching(ResourceCacheType cache_type) {
     FdCacheHelper::Drop(fd_[cache_type]);
 }
 
+void SetCgroupAction::DropAppResourceCaching(uid_t uid, pid_t pid) {
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    app_fds_.remove_if([uid, pid](const AppFd& app_fd) {
+        return pid < 0 || (app_fd.uid == uid && app_fd.pid == pid);
+    });
+}
+
 WriteFileAction::WriteFileAction(const std::string& task_path, const std::string& proc_path,
                                  const std::string& value, bool logfailures)
     : task_path_(task_path), proc_path_(proc_path), value_(value), logfailures_(logfailures) {
@@ -446,6 +570,7 @@ bool WriteFileAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
     struct dirent* de;
     char proc_path[255];
     int t_pid;
+    std::vector<int> tids;
 
     sprintf(proc_path, "/proc/%d/task", pid);
     if (!(d = opendir(proc_path))) {
@@ -463,11 +588,13 @@ bool WriteFileAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
             continue;
         }
 
-        WriteValueToFile(value_, ProfileAction::RCT_TASK, uid, t_pid, logfailures_);
+        tids.push_back(t_pid);
     }
 
     closedir(d);
 
+    WriteValueForTasks(tids, uid);
+
     return true;
 }
 
@@ -475,6 +602,55 @@ bool WriteFileAction::ExecuteForTask(int tid) const {
     return WriteValueToFile(value_, ProfileAction::RCT_TASK, getuid(), tid, logfailures_);
 }
 
+bool WriteFileAction::ExecuteForTasks(const std::vector<int>& tids) const {
+    return WriteValueForTasks(tids, getuid());
+}
+
+bool WriteFileAction::WriteValueForTasks(const std::vector<int>& tids, int uid) const {
+    std::unique_lock<std::mutex> lock(fd_mutex_);
+    const unique_fd& cached_fd = fd_[ProfileAction::RCT_TASK];
+    unique_fd tmp_fd;
+    int fd = cached_fd;
+    if (!FdCacheHelper::IsCached(cached_fd)) {
+        if (cached_fd == FdCacheHelper::FDS_INACCESSIBLE) {
+            // no permissions to access the file, ignore
+            return true;
+        }
+        if (cached_fd == FdCacheHelper::FDS_APP_DEPENDENT) {
+            // application-dependent path can't be used with tid
+            LOG(ERROR) << "Application profile can't be applied to a thread";
+            return false;
+        }
+        lock.unlock();
+
+        // Use WriteStringToFd instead of WriteStringToFile because the latter will open file with
+        // O_TRUNC which causes kernfs_mutex contention
+        tmp_fd.reset(TEMP_FAILURE_RETRY(open(task_path_.c_str(), O_WRONLY | O_CLOEXEC)));
+        if (tmp_fd < 0) {
+            if (logfailures_) PLOG(WARNING) << "Failed to open " << task_path_;
+            return false;
+        }
+        fd = tmp_fd;
+    }
+
+    // A value that doesn't name the task is the same for all of them, so it is written once.
+    std::string uid_value = StringReplace(value_, "<uid>", std::to_string(uid), true);
+    bool per_task = uid_value.find("<pid>") != std::string::npos;
+    bool success = true;
+    for (int tid : tids) {
+        std::string value =
+                per_task ? StringReplace(uid_value, "<pid>", std::to_string(tid), true) : uid_value;
+        if (!WriteStringToFd(value, fd)) {
+            if (logfailures_) PLOG(ERROR) << "Failed to write '" << value << "' to " << task_path_;
+            success = false;
+        }
+        if (!per_task) {
+            break;
+        }
+    }
+    return success;
+}
+
 void WriteFileAction::EnableResourceCaching(ResourceCacheType cache_type) {
     std::lock_guard<std::mutex> lock(fd_mutex_);
     if (fd_[cache_type] != FdCacheHelper::FDS_NOT_CACHED) {
@@ -512,6 +688,13 @@ bool ApplyProfileAction::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool ApplyProfileAction::ExecuteForTasks(const std::vector<int>& tids) const {
+    for (const auto& profile : profiles_) {
+        profile->ExecuteForTasks(tids);
+    }
+    return true;
+}
+
 void ApplyProfileAction::EnableResourceCaching(ResourceCacheType cache_type) {
     for (const auto& profile : profiles_) {
         profile->EnableResourceCaching(cache_type);
@@ -524,6 +707,12 @@ void ApplyProfileAction::DropResourceCaching(ResourceCacheType cache_type) {
     }
 }
 
+void ApplyProfileAction::DropAppResourceCaching(uid_t uid, pid_t pid) {
+    for (const auto& profile : profiles_) {
+        profile->DropAppResourceCaching(uid, pid);
+    }
+}
+
 void TaskProfile::MoveTo(TaskProfile* profile) {
     profile->elements_ = std::move(elements_);
     profile->res_cached_ = res_cached_;
@@ -552,6 +741,22 @@ bool TaskProfile::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool TaskProfile::ExecuteForTasks(const std::vector<int>& tids) const {
+    std::vector<int> resolved_tids(tids);
+    for (int& tid : resolved_tids) {
+        if (tid == 0) {
+            tid = GetThreadId();
+        }
+    }
+    for (const auto& element : elements_) {
+        if (!element->ExecuteForTasks(resolved_tids)) {
+            LOG(VERBOSE) << "Applying profile action " << element->Name() << " failed";
+            return false;
+        }
+    }
+    return true;
+}
+
 void TaskProfile::EnableResourceCaching(ProfileAction::ResourceCacheType cache_type) {
     if (res_cached_) {
         return;
@@ -576,12 +781,24 @@ void TaskProfile::DropResourceCaching(ProfileAction::ResourceCacheType cache_typ
     res_cached_ = false;
 }
 
+void TaskProfile::DropAppResourceCaching(uid_t uid, pid_t pid) {
+    for (auto& element : elements_) {
+        element->DropAppResourceCaching(uid, pid);
+    }
+}
+
 void TaskProfiles::DropResourceCaching(ProfileAction::ResourceCacheType cache_type) const {
     for (auto& iter : profiles_) {
         iter.second->DropResourceCaching(cache_type);
     }
 }
 
+void TaskProfiles::DropAppResourceCaching(uid_t uid, pid_t pid) const {
+    for (auto& iter : profiles_) {
+        iter.second->DropAppResourceCaching(uid, pid);
+    }
+}
+
 TaskProfiles& TaskProfiles::GetInstance() {
     // Deliberately leak this object to avoid a race between destruction on
     // process exit and concurrent access from another thread.
@@ -804,29 +1021,77 @@ const IProfileAttribute* TaskProfiles::GetAttribute(const std::string& name) con
     return nullptr;
 }
 
-bool TaskProfiles::SetProcessProfiles(uid_t uid, pid_t pid,
-                                      const std::vector<std::string>& profiles, bool use_fd_cache) {
-    bool success = true;
+TaskProfileSet TaskProfiles::LookUpProfiles(const std::vector<std::string>& profiles) const {
+    TaskProfileSet set;
     for (const auto& name : profiles) {
         TaskProfile* profile = GetProfile(name);
         if (profile != nullptr) {
-            if (use_fd_cache) {
-                profile->EnableResourceCaching(ProfileAction::RCT_PROCESS);
-            }
-            if (!profile->ExecuteForProcess(uid, pid)) {
-                PLOG(WARNING) << "Failed to apply " << name << " process profile";
-                success = false;
-            }
+            set.profiles.push_back(profile);
         } else {
-            PLOG(WARNING) << "Failed to find " << name << " process profile";
+            set.missing.push_back(name);
+        }
+    }
+    return set;
+}
+
+const TaskProfileSet* TaskProfiles::ResolveProfiles(const std::vector<std::string>& profiles) {
+    std::lock_guard<std::mutex> lock(resolved_profiles_mutex_);
+    auto& set = resolved_profiles_[profiles];
+    if (!set) {
+        set = std::make_unique<TaskProfileSet>(LookUpProfiles(profiles));
+    }
+    return set.get();
+}
+
+bool TaskProfiles::SetProcessProfiles(uid_t uid, pid_t pid,
+                                      const std::vector<std::string>& profiles, bool use_fd_cache) {
+    return SetProcessProfiles(uid, pid, LookUpProfiles(profiles), use_fd_cache);
+}
+
+bool TaskProfiles::SetProcessProfiles(uid_t uid, pid_t pid, const TaskProfileSet& profiles,
+                                      bool use_fd_cache) {
+    bool success = true;
+    for (TaskProfile* profile : profiles.profiles) {
+        if (use_fd_cache) {
+            profile->EnableResourceCaching(ProfileAction::RCT_PROCESS);
+        }
+        if (!profile->ExecuteForProcess(uid, pid)) {
+            PLOG(WARNING) << "Failed to apply " << profile->Name() << " process profile";
             success = false;
         }
     }
+    for (const auto& name : profiles.missing) {
+        PLOG(WARNING) << "Failed to find " << name << " process profile";
+        success = false;
+    }
     return success;
 }
 
 bool TaskProfiles::SetTaskProfiles(int tid, const std::vector<std::string>& profiles,
                                    bool use_fd_cache) {
+    return SetTaskProfiles(tid, LookUpProfiles(profiles), use_fd_cache);
+}
+
+bool TaskProfiles::SetTaskProfiles(int tid, const TaskProfileSet& profiles, bool use_fd_cache) {
+    bool success = true;
+    for (TaskProfile* profile : profiles.profiles) {
+        if (use_fd_cache) {
+            profile->EnableResourceCaching(ProfileAction::RCT_TASK);
+        }
+        if (!profile->ExecuteForTask(tid)) {
+            PLOG(WARNING) << "Failed to apply " << profile->Name() << " task profile";
+            success = false;
+        }
+    }
+    for (const auto& name : profiles.missing) {
+        PLOG(WARNING) << "Failed to find " << name << " task profile";
+        success = false;
+    }
+    return success;
+}
+
+bool TaskProfiles::SetTaskProfiles(const std::vector<int>& tids,
+                                   const std::vector<std::string>& profiles, bool use_fd_cache) {
     bool success = true;
     for (const auto& name : profiles) {
         TaskProfile* profile = GetProfile(name);
@@ -834,7 +1099,7 @@ bool TaskProfiles::SetTaskProfiles(int tid, const std::vector<std::string>& prof
             if (use_fd_cache) {
                 profile->EnableResourceCaching(ProfileAction::RCT_TASK);
             }
-            if (!profile->ExecuteForTask(tid)) {
+            if (!profile->ExecuteForTasks(tids)) {
                 PLOG(WARNING) << "Failed to apply " << name << " task profile";
                 success = false;
             }
@@ -18,6 +18,7 @@
 
 #include <sys/cdefs.h>
 #include <sys/types.h>
+#include <list>
 #include <map>
 #include <mutex>
 #include <string>
@@ -69,9 +70,13 @@ class ProfileAction {
     // Default implementations will fail
     virtual bool ExecuteForProcess(uid_t, pid_t) const { return false; };
     virtual bool ExecuteForTask(int) const { return false; };
+    // Applies the action to all of `tids` at once. The default applies it to one task at a time.
+    virtual bool ExecuteForTasks(const std::vector<int>& tids) const;
 
     virtual void EnableResourceCaching(ResourceCacheType) {}
     virtual void DropResourceCaching(ResourceCacheType) {}
+    // Drops the cached fds of the process group of `pid`, or of all process groups if `pid` < 0.
+    virtual void DropAppResourceCaching(uid_t, pid_t) {}
 
   protected:
     enum CacheUseResult { SUCCESS, FAIL, UNUSED };
@@ -113,11 +118,14 @@ class SetAttributeAction : public ProfileAction {
     const char* Name() const override { return "SetAttribute"; }
     bool ExecuteForProcess(uid_t uid, pid_t pid) const override;
     bool ExecuteForTask(int tid) const override;
+    bool ExecuteForTasks(const std::vector<int>& tids) const override;
 
   private:
     const IProfileAttribute* attribute_;
     std::string value_;
     bool optional_;
+
+    bool WriteValueToPath(const std::string& path) const;
 };
 
 // Set cgroup profile element
@@ -128,19 +136,33 @@ class SetCgroupAction : public ProfileAction {
     const char* Name() const override { return "SetCgroup"; }
     bool ExecuteForProcess(uid_t uid, pid_t pid) const override;
     bool ExecuteForTask(int tid) const override;
+    bool ExecuteForTasks(const std::vector<int>& tids) const override;
     void EnableResourceCaching(ResourceCacheType cache_type) override;
     void DropResourceCaching(ResourceCacheType cache_type) override;
+    void DropAppResourceCaching(uid_t uid, pid_t pid) override;
 
     const CgroupController* controller() const { return &controller_; }
 
   private:
+    // An opened cgroup.procs file of an app-dependent path.
+    struct AppFd {
+        uid_t uid;
+        pid_t pid;
+        android::base::unique_fd fd;
+    };
+    static constexpr size_t kMaxAppFds = 32;
+
     CgroupController controller_;
     std::string path_;
+    bool app_dependent_;
     android::base::unique_fd fd_[ProfileAction::RCT_COUNT];
+    // Most recently used first.
+    mutable std::list<AppFd> app_fds_;
     mutable std::mutex fd_mutex_;
 
     static bool AddTidToCgroup(int tid, int fd, const char* controller_name);
     CacheUseResult UseCachedFd(ResourceCacheType cache_type, int id) const;
+    bool AddPidToAppCgroup(uid_t uid, pid_t pid) const;
 };
 
 // Write to file action
@@ -152,6 +174,7 @@ class WriteFileAction : public ProfileAction {
     const char* Name() const override { return "WriteFile"; }
     bool ExecuteForProcess(uid_t uid, pid_t pid) const override;
     bool ExecuteForTask(int tid) const override;
+    bool ExecuteForTasks(const std::vector<int>& tids) const override;
     void EnableResourceCaching(ResourceCacheType cache_type) override;
     void DropResourceCaching(ResourceCacheType cache_type) override;
 
@@ -164,6 +187,7 @@ class WriteFileAction : public ProfileAction {
     bool WriteValueToFile(const std::string& value, ResourceCacheType cache_type, int uid, int pid,
                           bool logfailures) const;
     CacheUseResult UseCachedFd(ResourceCacheType cache_type, const std::string& value) const;
+    bool WriteValueForTasks(const std::vector<int>& tids, int uid) const;
 };
 
 class TaskProfile {
@@ -176,8 +200,10 @@ class TaskProfile {
 
     bool ExecuteForProcess(uid_t uid, pid_t pid) const;
     bool ExecuteForTask(int tid) const;
+    bool ExecuteForTasks(const std::vector<int>& tids) const;
     void EnableResourceCaching(ProfileAction::ResourceCacheType cache_type);
     void DropResourceCaching(ProfileAction::ResourceCacheType cache_type);
+    void DropAppResourceCaching(uid_t uid, pid_t pid);
 
   private:
     const std::string name_;
@@ -194,13 +220,23 @@ class ApplyProfileAction : public ProfileAction {
     const char* Name() const override { return "ApplyProfileAction"; }
     bool ExecuteForProcess(uid_t uid, pid_t pid) const override;
     bool ExecuteForTask(int tid) const override;
+    bool ExecuteForTasks(const std::vector<int>& tids) const override;
     void EnableResourceCaching(ProfileAction::ResourceCacheType cache_type) override;
     void DropResourceCaching(ProfileAction::ResourceCacheType cache_type) override;
+    void DropAppResourceCaching(uid_t uid, pid_t pid) override;
 
   private:
     std::vector<std::shared_ptr<TaskProfile>> profiles_;
 };
 
+// Task profiles looked up by name once, see TaskProfiles::ResolveProfiles().
+struct TaskProfileSet {
+    // The profiles that were found, in the order they were named in.
+    std::vector<TaskProfile*> profiles;
+    // The names of the ones that weren't.
+    std::vector<std::string> missing;
+};
+
 class TaskProfiles {
   public:
     // Should be used by all users
@@ -209,15 +245,29 @@ class TaskProfiles {
     TaskProfile* GetProfile(const std::string& name) const;
     const IProfileAttribute* GetAttribute(const std::string& name) const;
     void DropResourceCaching(ProfileAction::ResourceCacheType cache_type) const;
+    void DropAppResourceCaching(uid_t uid, pid_t pid) const;
     bool SetProcessProfiles(uid_t uid, pid_t pid, const std::vector<std::string>& profiles,
                             bool use_fd_cache);
     bool SetTaskProfiles(int tid, const std::vector<std::string>& profiles, bool use_fd_cache);
+    bool SetTaskProfiles(const std::vector<int>& tids, const std::vector<std::string>& profiles,
+                         bool use_fd_cache);
+
+    // Returns the profiles named in `profiles`, which are only looked up the first time they are
+    // asked for. The result stays valid for the life of the process.
+    const TaskProfileSet* ResolveProfiles(const std::vector<std::string>& profiles);
+    bool SetProcessProfiles(uid_t uid, pid_t pid, const TaskProfileSet& profiles,
+                            bool use_fd_cache);
+    bool SetTaskProfiles(int tid, const TaskProfileSet& profiles, bool use_fd_cache);
 
   private:
     std::map<std::string, std::shared_ptr<TaskProfile>> profiles_;
     std::map<std::string, std::unique_ptr<IProfileAttribute>> attributes_;
+    std::map<std::vector<std::string>, std::unique_ptr<TaskProfileSet>> resolved_profiles_;
+    std::mutex resolved_profiles_mutex_;
 
     TaskProfiles();
 
+    TaskProfileSet LookUpProfiles(const std::vector<std::string>& profiles) const;
+
     bool Load(const CgroupMap& cg_map, const std::string& file_name);
 };
@@ -15,6 +15,7 @@
  */
 
 #include "task_profiles.h"
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <gtest/gtest.h>
 #include <mntent.h>
@@ -25,6 +26,7 @@
 #include <fstream>
 
 using ::android::base::ERROR;
+using ::android::base::ReadFileToString;
 using ::android::base::LogFunction;
 using ::android::base::LogId;
 using ::android::base::LogSeverity;
@@ -206,4 +208,36 @@ INSTANTIATE_TEST_SUITE_P(
                         .log_prefix = "Failed to write",
                         .log_suffix = geteuid() == 0 ? "Invalid argument" : "Permission denied"}));
 
+// Test that a batch of tasks is written through one open file, and that a value that doesn't name
+// the task is only written once for the whole batch.
+TEST(WriteFileActionTest, ExecuteForTasks) {
+    TemporaryFile per_task_file;
+    ASSERT_NE(per_task_file.fd, -1);
+    WriteFileAction per_task(per_task_file.path, "", "<pid>,", true);
+    EXPECT_TRUE(per_task.ExecuteForTasks({1, 2, 3}));
+    std::string content;
+    ASSERT_TRUE(ReadFileToString(per_task_file.path, &content));
+    EXPECT_EQ(content, "1,2,3,");
+
+    TemporaryFile shared_file;
+    ASSERT_NE(shared_file.fd, -1);
+    WriteFileAction shared(shared_file.path, "", "1", true);
+    EXPECT_TRUE(shared.ExecuteForTasks({1, 2, 3}));
+    ASSERT_TRUE(ReadFileToString(shared_file.path, &content));
+    EXPECT_EQ(content, "1");
+}
+
+// Test that resolving the same names twice gives the same set, and that applying a set with an
+// unknown profile fails like applying the names does.
+TEST(TaskProfilesTest, ResolveProfiles) {
+    const TaskProfileSet* profiles = ResolveTaskProfiles({"no-such-profile"});
+    ASSERT_NE(profiles, nullptr);
+    EXPECT_EQ(profiles, ResolveTaskProfiles({"no-such-profile"}));
+    EXPECT_TRUE(profiles->profiles.empty());
+    ASSERT_EQ(profiles->missing.size(), 1);
+    EXPECT_EQ(profiles->missing[0], "no-such-profile");
+    EXPECT_FALSE(SetTaskProfilesResolved(0, profiles));
+    EXPECT_FALSE(SetProcessProfilesResolved(getuid(), getpid(), profiles));
+}
+
 }  // namespace
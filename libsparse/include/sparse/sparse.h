@@ -324,6 +324,59 @@ struct sparse_file *sparse_file_import_auto(int fd, bool crc, bool verbose);
 int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
 		struct sparse_file **out_s, int out_s_count);
 
+/**
+ * sparse_file_resparse_all - rechunk an existing sparse file in one pass
+ *
+ * @in_s - sparse file cookie of the existing sparse file
+ * @max_len - maximum file size
+ * @count - set to the number of sparse files returned
+ *
+ * Like sparse_file_resparse(), but allocates the output array itself, so the
+ * chunks only have to be walked once.  All chunks are moved out of in_s.
+ *
+ * Returns a NULL terminated array of sparse file cookies that must be freed
+ * with free() after destroying each cookie, or NULL on error.
+ */
+struct sparse_file **sparse_file_resparse_all(struct sparse_file *in_s, unsigned int max_len,
+		int *count);
+
+/**
+ * sparse_file_len_parallel - find the length of several sparse files
+ *
+ * @s - array of sparse file cookies
+ * @count - number of sparse file cookies in s
+ * @sparse - write in the Android sparse file format
+ * @crc - append a crc chunk
+ * @lens - array of count lengths to fill in
+ *
+ * Computes sparse_file_len() of each sparse file, spreading the files over
+ * several threads.  The sparse files must not share a cookie, but may share
+ * backing files or fds.
+ *
+ * Returns 0 on success, -1 if the length of any file could not be computed.
+ */
+int sparse_file_len_parallel(struct sparse_file **s, int count, bool sparse, bool crc,
+		int64_t *lens);
+
+/**
+ * sparse_file_read_range - read part of the expanded sparse file
+ *
+ * @s - sparse file cookie
+ * @offset - offset into the expanded file
+ * @data - buffer to read into
+ * @len - number of bytes to read
+ *
+ * Reads len bytes of the expanded file at offset without expanding the rest
+ * of it.  Gaps and "don't care" chunks read as zeros.  The first call indexes
+ * the chunks of the sparse file, so each later call only touches the chunks
+ * in the range.  Adding chunks or writing the sparse file drops the index.
+ * Together with sparse_file_import(), which only reads chunk headers, this
+ * extracts a range of a sparse image without a pass over its data.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_read_range(struct sparse_file *s, int64_t offset, void *data, size_t len);
+
 /**
  * sparse_file_verbose - set a sparse file cookie to print verbose errors
  *
@@ -333,6 +386,81 @@ int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
  */
 void sparse_file_verbose(struct sparse_file *s);
 
+struct sparse_stream_writer;
+
+/**
+ * sparse_stream_writer_open - start writing a sparse image as a stream
+ *
+ * @fd - seekable file descriptor to write to
+ * @block_size - block size of the sparse image
+ * @len - minimum size of the expanded image, or 0 if not known up front
+ * @crc - append a crc chunk
+ *
+ * Writes a sparse image chunk by chunk as data is appended, instead of
+ * collecting the whole image in a sparse file cookie first.  Memory use does
+ * not depend on the size of the image.  The sparse header is written at the
+ * current offset of fd and is filled in by sparse_stream_writer_close().
+ *
+ * Returns the stream writer, or NULL on error.
+ */
+struct sparse_stream_writer *sparse_stream_writer_open(int fd, unsigned int block_size,
+		int64_t len, bool crc);
+
+/**
+ * sparse_stream_writer_append_data - append a data chunk
+ *
+ * @w - stream writer
+ * @data - pointer to the data
+ * @len - length of the data
+ *
+ * Writes len bytes of data at the end of the image.  If len is not a multiple
+ * of the block size the data will be padded with zeros.  The data may be
+ * freed as soon as this returns.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_stream_writer_append_data(struct sparse_stream_writer *w, const void *data,
+		uint64_t len);
+
+/**
+ * sparse_stream_writer_append_fill - append a fill chunk
+ *
+ * @w - stream writer
+ * @fill_val - 32 bit fill data
+ * @len - length of the fill
+ *
+ * Appends len bytes of fill_val to the image, rounded up to a multiple of the
+ * block size.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_stream_writer_append_fill(struct sparse_stream_writer *w, uint32_t fill_val,
+		uint64_t len);
+
+/**
+ * sparse_stream_writer_append_skip - append a "don't care" chunk
+ *
+ * @w - stream writer
+ * @len - length to skip, must be a multiple of the block size
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_stream_writer_append_skip(struct sparse_stream_writer *w, uint64_t len);
+
+/**
+ * sparse_stream_writer_close - finish a streamed sparse image
+ *
+ * @w - stream writer
+ *
+ * Pads the image with a "don't care" chunk up to the len it was opened with,
+ * writes the crc chunk, and rewrites the sparse header with the final block
+ * and chunk counts.  The fd is left positioned at the end of the image and is
+ * not closed.  Frees w, even on error.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_stream_writer_close(struct sparse_stream_writer *w);
+
 /**
  * sparse_print_verbose - function called to print verbose errors
  *
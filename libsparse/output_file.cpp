@@ -18,16 +18,23 @@
 #define _LARGEFILE64_SOURCE 1
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 #include <zlib.h>
 
 #include "defs.h"
@@ -37,6 +44,11 @@
 
 #include <android-base/mapped_file.h>
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
 #ifndef _WIN32
 #define O_BINARY 0
 #else
@@ -56,6 +68,8 @@
 
 #define FILL_ZERO_BUFSIZE (2 * 1024 * 1024)
 
+#define GZ_MEMBER_SIZE ((size_t)(1024 * 1024))
+
 #define container_of(inner, outer_t, elem) ((outer_t*)((char*)(inner)-offsetof(outer_t, elem)))
 
 struct output_file_ops {
@@ -64,6 +78,7 @@ struct output_file_ops {
   int (*pad)(struct output_file*, int64_t);
   int (*write)(struct output_file*, void*, size_t);
   void (*close)(struct output_file*);
+  uint64_t (*copy_fd)(struct output_file*, int fd, int64_t offset, uint64_t len);
 };
 
 struct sparse_file_ops {
@@ -71,6 +86,7 @@ struct sparse_file_ops {
   int (*write_fill_chunk)(struct output_file* out, uint64_t len, uint32_t fill_val);
   int (*write_skip_chunk)(struct output_file* out, uint64_t len);
   int (*write_end_chunk)(struct output_file* out);
+  int (*write_fd_chunk)(struct output_file* out, uint64_t len, int fd, int64_t offset);
 };
 
 struct output_file {
@@ -87,9 +103,11 @@ struct output_file {
   char* buf;
 };
 
+struct gz_compressor;
+
 struct output_file_gz {
   struct output_file out;
-  gzFile gz_fd;
+  struct gz_compressor* gz;
 };
 
 #define to_output_file_gz(_o) container_of((_o), struct output_file_gz, out)
@@ -167,82 +185,278 @@ static void file_close(struct output_file* out) {
   free(outn);
 }
 
+#ifdef __linux__
+/*
+ * Copies up to len bytes at offset in fd to the output inside the kernel,
+ * with copy_file_range() if the file systems support it and sendfile()
+ * otherwise. Returns how many bytes were copied; the caller writes out the
+ * rest itself.
+ */
+static uint64_t file_copy_fd(struct output_file* out, int fd, int64_t offset, uint64_t len) {
+  struct output_file_normal* outn = to_output_file_normal(out);
+  bool use_copy_file_range = true;
+  uint64_t copied = 0;
+
+  while (copied < len) {
+    size_t count = std::min(len - copied, (uint64_t)(1 << 30));
+    ssize_t ret;
+
+#ifdef __NR_copy_file_range
+    if (use_copy_file_range) {
+      loff_t off_in = offset + copied;
+      ret = syscall(__NR_copy_file_range, fd, &off_in, outn->fd, nullptr, count, 0);
+      if (ret < 0 && errno != EINTR) {
+        use_copy_file_range = false;
+        continue;
+      }
+    } else
+#endif
+    {
+      off64_t off_in = offset + copied;
+      ret = sendfile64(outn->fd, fd, &off_in, count);
+    }
+
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      break;
+    }
+    copied += ret;
+  }
+
+  return copied;
+}
+#endif
+
 static struct output_file_ops file_ops = {
     .open = file_open,
     .skip = file_skip,
     .pad = file_pad,
     .write = file_write,
     .close = file_close,
+#ifdef __linux__
+    .copy_fd = file_copy_fd,
+#endif
 };
 
-static int gz_file_open(struct output_file* out, int fd) {
-  struct output_file_gz* outgz = to_output_file_gz(out);
+/*
+ * Gzip output is compressed on several threads, pigz style: the image is cut
+ * into GZ_MEMBER_SIZE pieces, each piece is deflated on its own into a
+ * complete gzip member, and the members are written out in order. gzip, zcat
+ * and zlib's gzread() all read concatenated members as one stream.
+ */
+struct gz_member {
+  std::vector<Bytef> data;
+  std::vector<Bytef> compressed;
+  bool done = false;
+  bool ok = false;
+};
 
-  outgz->gz_fd = gzdopen(fd, "wb9");
-  if (!outgz->gz_fd) {
-    error_errno("gzopen");
-    return -errno;
+struct gz_compressor {
+  int fd;
+  std::mutex lock;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  /* Members not yet written out, in file order. */
+  std::deque<std::unique_ptr<gz_member>> members;
+  /* Members no worker has picked up yet. */
+  std::deque<gz_member*> work;
+  std::vector<std::thread> threads;
+  std::unique_ptr<gz_member> cur;
+  int64_t pos = 0;
+  bool stopping = false;
+  bool failed = false;
+};
+
+static bool gz_compress_member(struct gz_member* member) {
+  z_stream zs = {};
+
+  /* Level 9 and a gzip wrapper, like gzdopen(fd, "wb9"). */
+  if (deflateInit2(&zs, 9, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
   }
 
-  return 0;
+  member->compressed.resize(deflateBound(&zs, member->data.size()));
+  zs.next_in = member->data.data();
+  zs.avail_in = member->data.size();
+  zs.next_out = member->compressed.data();
+  zs.avail_out = member->compressed.size();
+  int ret = deflate(&zs, Z_FINISH);
+  member->compressed.resize(zs.total_out);
+  deflateEnd(&zs);
+
+  std::vector<Bytef>().swap(member->data);
+  return ret == Z_STREAM_END;
 }
 
-static int gz_file_skip(struct output_file* out, int64_t cnt) {
-  off64_t ret;
-  struct output_file_gz* outgz = to_output_file_gz(out);
+static void gz_worker(struct gz_compressor* gz) {
+  std::unique_lock<std::mutex> lock(gz->lock);
+  while (true) {
+    gz->work_cv.wait(lock, [gz] { return gz->stopping || !gz->work.empty(); });
+    if (gz->work.empty()) {
+      return;
+    }
+    struct gz_member* member = gz->work.front();
+    gz->work.pop_front();
 
-  ret = gzseek(outgz->gz_fd, cnt, SEEK_CUR);
-  if (ret < 0) {
-    error_errno("gzseek");
-    return -1;
+    lock.unlock();
+    bool ok = gz_compress_member(member);
+    lock.lock();
+
+    member->ok = ok;
+    member->done = true;
+    gz->done_cv.notify_all();
   }
-  return 0;
 }
 
-static int gz_file_pad(struct output_file* out, int64_t len) {
-  off64_t ret;
-  struct output_file_gz* outgz = to_output_file_gz(out);
+static int gz_write_fd(int fd, const void* data, size_t len) {
+  while (len > 0) {
+    ssize_t ret = write(fd, data, len);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      error_errno("write");
+      return -1;
+    }
+    data = (const char*)data + ret;
+    len -= ret;
+  }
+  return 0;
+}
 
-  ret = gztell(outgz->gz_fd);
-  if (ret < 0) {
-    return -1;
+/*
+ * Writes out compressed members in order until at most max_pending members
+ * are left in flight, waiting for workers as needed.
+ */
+static int gz_drain(struct gz_compressor* gz, size_t max_pending) {
+  std::unique_lock<std::mutex> lock(gz->lock);
+  while (!gz->members.empty()) {
+    struct gz_member* member = gz->members.front().get();
+    if (!member->done) {
+      if (gz->members.size() <= max_pending) {
+        break;
+      }
+      gz->done_cv.wait(lock, [member] { return member->done; });
+    }
+    std::unique_ptr<gz_member> owned = std::move(gz->members.front());
+    gz->members.pop_front();
+
+    /* Only this thread touches a finished member, so write it unlocked. */
+    lock.unlock();
+    if (!gz->failed && (!owned->ok || gz_write_fd(gz->fd, owned->compressed.data(),
+                                                  owned->compressed.size()) < 0)) {
+      if (!owned->ok) {
+        error("deflate failed");
+      }
+      gz->failed = true;
+    }
+    lock.lock();
   }
+  return gz->failed ? -1 : 0;
+}
 
-  if (ret >= len) {
+static int gz_submit(struct gz_compressor* gz) {
+  if (!gz->cur || gz->cur->data.empty()) {
     return 0;
   }
+  {
+    std::lock_guard<std::mutex> lock(gz->lock);
+    gz->work.push_back(gz->cur.get());
+    gz->members.push_back(std::move(gz->cur));
+  }
+  gz->work_cv.notify_one();
 
-  ret = gzseek(outgz->gz_fd, len - 1, SEEK_SET);
-  if (ret < 0) {
-    return -1;
+  /* Bound memory use to a couple of members per thread. */
+  return gz_drain(gz, 2 * gz->threads.size());
+}
+
+static int gz_file_open(struct output_file* out, int fd) {
+  struct output_file_gz* outgz = to_output_file_gz(out);
+
+  outgz->gz = new (std::nothrow) gz_compressor();
+  if (!outgz->gz) {
+    error_errno("malloc gz_compressor");
+    return -ENOMEM;
   }
+  outgz->gz->fd = fd;
 
-  gzwrite(outgz->gz_fd, "", 1);
+  unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned int i = 0; i < threads; i++) {
+    outgz->gz->threads.emplace_back(gz_worker, outgz->gz);
+  }
 
   return 0;
 }
 
 static int gz_file_write(struct output_file* out, void* data, size_t len) {
-  int ret;
-  struct output_file_gz* outgz = to_output_file_gz(out);
+  struct gz_compressor* gz = to_output_file_gz(out)->gz;
+  const Bytef* ptr = reinterpret_cast<const Bytef*>(data);
 
   while (len > 0) {
-    ret = gzwrite(outgz->gz_fd, data, std::min<unsigned int>(len, (unsigned int)INT_MAX));
-    if (ret == 0) {
-      error("gzwrite %s", gzerror(outgz->gz_fd, nullptr));
+    if (!gz->cur) {
+      gz->cur = std::make_unique<gz_member>();
+      gz->cur->data.reserve(GZ_MEMBER_SIZE);
+    }
+
+    size_t write_len = std::min(len, GZ_MEMBER_SIZE - gz->cur->data.size());
+    gz->cur->data.insert(gz->cur->data.end(), ptr, ptr + write_len);
+    gz->pos += write_len;
+    ptr += write_len;
+    len -= write_len;
+
+    if (gz->cur->data.size() == GZ_MEMBER_SIZE && gz_submit(gz) < 0) {
       return -1;
     }
-    len -= ret;
-    data = (char*)data + ret;
   }
 
   return 0;
 }
 
+/* Like gzseek() on a file opened for writing, a skip compresses zeros. */
+static int gz_file_skip(struct output_file* out, int64_t cnt) {
+  while (cnt > 0) {
+    size_t write_len = std::min(cnt, (int64_t)FILL_ZERO_BUFSIZE);
+    if (gz_file_write(out, out->zero_buf, write_len) < 0) {
+      return -1;
+    }
+    cnt -= write_len;
+  }
+  return 0;
+}
+
+static int gz_file_pad(struct output_file* out, int64_t len) {
+  struct gz_compressor* gz = to_output_file_gz(out)->gz;
+
+  if (gz->pos >= len) {
+    return 0;
+  }
+
+  return gz_file_skip(out, len - gz->pos);
+}
+
 static void gz_file_close(struct output_file* out) {
   struct output_file_gz* outgz = to_output_file_gz(out);
+  struct gz_compressor* gz = outgz->gz;
 
-  gzclose(outgz->gz_fd);
+  if (gz) {
+    if (gz_submit(gz) < 0 || gz_drain(gz, 0) < 0) {
+      error("failed to finish gzip output");
+    }
+    {
+      std::lock_guard<std::mutex> lock(gz->lock);
+      gz->stopping = true;
+    }
+    gz->work_cv.notify_all();
+    for (auto& thread : gz->threads) {
+      thread.join();
+    }
+
+    /* gzclose() used to close the fd as well. */
+    close(gz->fd);
+    delete gz;
+  }
   free(outgz);
 }
 
@@ -336,6 +550,16 @@ static int write_sparse_skip_chunk(struct output_file* out, uint64_t skip_len) {
   ret = out->ops->write(out, &chunk_header, sizeof(chunk_header));
   if (ret < 0) return -1;
 
+  /* Readers treat skipped blocks as zeros when checking the crc. */
+  if (out->use_crc) {
+    uint64_t len = skip_len;
+    while (len) {
+      uint64_t crc_len = std::min(len, (uint64_t)FILL_ZERO_BUFSIZE);
+      out->crc32 = sparse_crc32(out->crc32, out->zero_buf, crc_len);
+      len -= crc_len;
+    }
+  }
+
   out->cur_out_ptr += skip_len;
   out->chunk_cnt++;
 
@@ -345,7 +569,6 @@ static int write_sparse_skip_chunk(struct output_file* out, uint64_t skip_len) {
 static int write_sparse_fill_chunk(struct output_file* out, uint64_t len, uint32_t fill_val) {
   chunk_header_t chunk_header;
   uint64_t rnd_up_len;
-  int count;
   int ret;
 
   /* Round up the fill length to a multiple of the block size */
@@ -362,9 +585,18 @@ static int write_sparse_fill_chunk(struct output_file* out, uint64_t len, uint32
   ret = out->ops->write(out, &fill_val, sizeof(fill_val));
   if (ret < 0) return -1;
 
+  /* The crc covers every block of the fill, not just the first one. */
   if (out->use_crc) {
-    count = out->block_size / sizeof(uint32_t);
-    while (count--) out->crc32 = sparse_crc32(out->crc32, &fill_val, sizeof(uint32_t));
+    for (size_t i = 0; i < FILL_ZERO_BUFSIZE / sizeof(uint32_t); i++) {
+      out->fill_buf[i] = fill_val;
+    }
+
+    uint64_t len = rnd_up_len;
+    while (len) {
+      uint64_t crc_len = std::min(len, (uint64_t)FILL_ZERO_BUFSIZE);
+      out->crc32 = sparse_crc32(out->crc32, out->fill_buf, crc_len);
+      len -= crc_len;
+    }
   }
 
   out->cur_out_ptr += rnd_up_len;
@@ -373,8 +605,68 @@ static int write_sparse_fill_chunk(struct output_file* out, uint64_t len, uint32
   return 0;
 }
 
-static int write_sparse_data_chunk(struct output_file* out, uint64_t len, void* data) {
+static int write_sparse_raw_chunk_header(struct output_file* out, uint64_t len) {
   chunk_header_t chunk_header;
+  uint64_t rnd_up_len = ALIGN(len, out->block_size);
+
+  chunk_header.chunk_type = CHUNK_TYPE_RAW;
+  chunk_header.reserved1 = 0;
+  chunk_header.chunk_sz = rnd_up_len / out->block_size;
+  chunk_header.total_sz = CHUNK_HEADER_LEN + rnd_up_len;
+  return out->ops->write(out, &chunk_header, sizeof(chunk_header));
+}
+
+/* Pads a raw chunk of len bytes of data with zeros to a multiple of the block size */
+static int write_sparse_raw_chunk_padding(struct output_file* out, uint64_t len) {
+  uint64_t zero_len = ALIGN(len, out->block_size) - len;
+  uint64_t write_len;
+  int ret;
+
+  while (zero_len) {
+    write_len = std::min(zero_len, (uint64_t)FILL_ZERO_BUFSIZE);
+    ret = out->ops->write(out, out->zero_buf, write_len);
+    if (ret < 0) {
+      return ret;
+    }
+    zero_len -= write_len;
+  }
+
+  return 0;
+}
+
+/*
+ * Writes len bytes at offset in fd to the output, inside the kernel if the
+ * output can do that, so that the data never has to be mapped.
+ */
+static int write_fd_data(struct output_file* out, uint64_t len, int fd, int64_t offset) {
+  uint64_t copied = out->ops->copy_fd(out, fd, offset, len);
+  if (copied == len) {
+    return 0;
+  }
+
+  auto m = android::base::MappedFile::FromFd(fd, offset + copied, len - copied, PROT_READ);
+  if (!m) return -errno;
+
+  return out->ops->write(out, m->data(), m->size());
+}
+
+static int write_sparse_fd_chunk(struct output_file* out, uint64_t len, int fd, int64_t offset) {
+  int ret;
+
+  ret = write_sparse_raw_chunk_header(out, len);
+  if (ret < 0) return -1;
+  ret = write_fd_data(out, len, fd, offset);
+  if (ret < 0) return ret;
+  ret = write_sparse_raw_chunk_padding(out, len);
+  if (ret < 0) return ret;
+
+  out->cur_out_ptr += ALIGN(len, out->block_size);
+  out->chunk_cnt++;
+
+  return 0;
+}
+
+static int write_sparse_data_chunk(struct output_file* out, uint64_t len, void* data) {
   uint64_t rnd_up_len, zero_len;
   int ret;
 
@@ -382,28 +674,12 @@ static int write_sparse_data_chunk(struct output_file* out, uint64_t len, void*
   rnd_up_len = ALIGN(len, out->block_size);
   zero_len = rnd_up_len - len;
 
-  /* Finally we can safely emit a chunk of data */
-  chunk_header.chunk_type = CHUNK_TYPE_RAW;
-  chunk_header.reserved1 = 0;
-  chunk_header.chunk_sz = rnd_up_len / out->block_size;
-  chunk_header.total_sz = CHUNK_HEADER_LEN + rnd_up_len;
-  ret = out->ops->write(out, &chunk_header, sizeof(chunk_header));
-
+  ret = write_sparse_raw_chunk_header(out, len);
   if (ret < 0) return -1;
   ret = out->ops->write(out, data, len);
   if (ret < 0) return -1;
-  if (zero_len) {
-    uint64_t len = zero_len;
-    uint64_t write_len;
-    while (len) {
-      write_len = std::min(len, (uint64_t)FILL_ZERO_BUFSIZE);
-      ret = out->ops->write(out, out->zero_buf, write_len);
-      if (ret < 0) {
-        return ret;
-      }
-      len -= write_len;
-    }
-  }
+  ret = write_sparse_raw_chunk_padding(out, len);
+  if (ret < 0) return ret;
 
   if (out->use_crc) {
     out->crc32 = sparse_crc32(out->crc32, data, len);
@@ -438,7 +714,7 @@ int write_sparse_end_chunk(struct output_file* out) {
     if (ret < 0) {
       return ret;
     }
-    out->ops->write(out, &out->crc32, 4);
+    ret = out->ops->write(out, &out->crc32, 4);
     if (ret < 0) {
       return ret;
     }
@@ -454,6 +730,7 @@ static struct sparse_file_ops sparse_file_ops = {
     .write_fill_chunk = write_sparse_fill_chunk,
     .write_skip_chunk = write_sparse_skip_chunk,
     .write_end_chunk = write_sparse_end_chunk,
+    .write_fd_chunk = write_sparse_fd_chunk,
 };
 
 static int write_normal_data_chunk(struct output_file* out, uint64_t len, void* data) {
@@ -472,6 +749,22 @@ static int write_normal_data_chunk(struct output_file* out, uint64_t len, void*
   return ret;
 }
 
+static int write_normal_fd_chunk(struct output_file* out, uint64_t len, int fd, int64_t offset) {
+  int ret;
+  uint64_t rnd_up_len = ALIGN(len, out->block_size);
+
+  ret = write_fd_data(out, len, fd, offset);
+  if (ret < 0) {
+    return ret;
+  }
+
+  if (rnd_up_len > len) {
+    ret = out->ops->skip(out, rnd_up_len - len);
+  }
+
+  return ret;
+}
+
 static int write_normal_fill_chunk(struct output_file* out, uint64_t len, uint32_t fill_val) {
   int ret;
   unsigned int i;
@@ -508,6 +801,7 @@ static struct sparse_file_ops normal_file_ops = {
     .write_fill_chunk = write_normal_fill_chunk,
     .write_skip_chunk = write_normal_skip_chunk,
     .write_end_chunk = write_normal_end_chunk,
+    .write_fd_chunk = write_normal_fd_chunk,
 };
 
 void output_file_close(struct output_file* out) {
@@ -519,6 +813,73 @@ void output_file_close(struct output_file* out) {
   out->ops->close(out);
 }
 
+static void sparse_header_init(sparse_header_t* sparse_header, unsigned int block_size,
+                               int64_t len, unsigned int chunks) {
+  *sparse_header = {.magic = SPARSE_HEADER_MAGIC,
+                    .major_version = SPARSE_HEADER_MAJOR_VER,
+                    .minor_version = SPARSE_HEADER_MINOR_VER,
+                    .file_hdr_sz = SPARSE_HEADER_LEN,
+                    .chunk_hdr_sz = CHUNK_HEADER_LEN,
+                    .blk_sz = block_size,
+                    .total_blks = static_cast<unsigned>(DIV_ROUND_UP(len, block_size)),
+                    .total_chunks = chunks,
+                    .image_checksum = 0};
+}
+
+/*
+ * Finishes a sparse output file whose chunk count was not known when it was
+ * opened: pads it with a don't care chunk up to the length it was opened
+ * with, writes the end chunk, and then rewrites the sparse header at
+ * header_offset with the final block and chunk counts. Only valid for sparse
+ * outputs opened with output_file_open_fd() on a seekable, uncompressed fd.
+ * Frees out like output_file_close().
+ */
+int output_file_close_seekable(struct output_file* out, int64_t header_offset) {
+  struct output_file_normal* outn = to_output_file_normal(out);
+  int64_t len = std::max(out->len, out->cur_out_ptr);
+  int64_t end_offset;
+  sparse_header_t sparse_header;
+  int ret = 0;
+
+  if (ALIGN(len, out->block_size) > out->cur_out_ptr) {
+    ret = out->sparse_ops->write_skip_chunk(out, ALIGN(len, out->block_size) - out->cur_out_ptr);
+  }
+  if (ret < 0) {
+    goto done;
+  }
+
+  ret = out->sparse_ops->write_end_chunk(out);
+  if (ret < 0) {
+    goto done;
+  }
+
+  end_offset = lseek64(outn->fd, 0, SEEK_CUR);
+  if (end_offset < 0 || lseek64(outn->fd, header_offset, SEEK_SET) < 0) {
+    ret = -errno;
+    error_errno("lseek64");
+    goto done;
+  }
+
+  sparse_header_init(&sparse_header, out->block_size, len, out->chunk_cnt);
+  ret = out->ops->write(out, &sparse_header, sizeof(sparse_header));
+  if (ret < 0) {
+    goto done;
+  }
+
+  if (lseek64(outn->fd, end_offset, SEEK_SET) < 0) {
+    ret = -errno;
+    error_errno("lseek64");
+  }
+
+done:
+  free(out->zero_buf);
+  free(out->fill_buf);
+  out->zero_buf = nullptr;
+  out->fill_buf = nullptr;
+  out->ops->close(out);
+  return ret;
+}
+
 static int output_file_init(struct output_file* out, int block_size, int64_t len, bool sparse,
                             int chunks, bool crc) {
   int ret;
@@ -552,16 +913,8 @@ static int output_file_init(struct output_file* out, int block_size, int64_t len
   }
 
   if (sparse) {
-    sparse_header_t sparse_header = {
-        .magic = SPARSE_HEADER_MAGIC,
-        .major_version = SPARSE_HEADER_MAJOR_VER,
-        .minor_version = SPARSE_HEADER_MINOR_VER,
-        .file_hdr_sz = SPARSE_HEADER_LEN,
-        .chunk_hdr_sz = CHUNK_HEADER_LEN,
-        .blk_sz = out->block_size,
-        .total_blks = static_cast<unsigned>(DIV_ROUND_UP(out->len, out->block_size)),
-        .total_chunks = static_cast<unsigned>(chunks),
-        .image_checksum = 0};
+    sparse_header_t sparse_header;
+    sparse_header_init(&sparse_header, out->block_size, out->len, chunks);
 
     if (out->use_crc) {
       sparse_header.total_chunks++;
@@ -648,11 +1001,15 @@ struct output_file* output_file_open_fd(int fd, unsigned int block_size, int64_t
     return nullptr;
   }
 
-  out->ops->open(out, fd);
+  ret = out->ops->open(out, fd);
+  if (ret < 0) {
+    out->ops->close(out);
+    return nullptr;
+  }
 
   ret = output_file_init(out, block_size, len, sparse, chunks, crc);
   if (ret < 0) {
-    free(out);
+    out->ops->close(out);
     return nullptr;
   }
 
@@ -670,6 +1027,11 @@ int write_fill_chunk(struct output_file* out, uint64_t len, uint32_t fill_val) {
 }
 
 int write_fd_chunk(struct output_file* out, uint64_t len, int fd, int64_t offset) {
+  /* The crc needs the data in user space anyway. */
+  if (out->ops->copy_fd && !out->use_crc) {
+    return out->sparse_ops->write_fd_chunk(out, len, fd, offset);
+  }
+
   auto m = android::base::MappedFile::FromFd(fd, offset, len, PROT_READ);
   if (!m) return -errno;
 
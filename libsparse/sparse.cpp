@@ -15,8 +15,17 @@
  */
 
 #include <assert.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
 #include <sparse/sparse.h>
 
 #include "defs.h"
@@ -27,6 +36,21 @@
 #include "sparse_defs.h"
 #include "sparse_format.h"
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* The chunks of a sparse file sorted by block, for sparse_file_read_range(). */
+struct sparse_index {
+  std::vector<struct backed_block*> blocks;
+};
+
+/* Must be called whenever the backed block list changes. */
+static void sparse_file_drop_index(struct sparse_file* s) {
+  delete s->index;
+  s->index = nullptr;
+}
+
 struct sparse_file* sparse_file_new(unsigned int block_size, int64_t len) {
   struct sparse_file* s = reinterpret_cast<sparse_file*>(calloc(sizeof(struct sparse_file), 1));
   if (!s) {
@@ -46,26 +70,31 @@ struct sparse_file* sparse_file_new(unsigned int block_size, int64_t len) {
 }
 
 void sparse_file_destroy(struct sparse_file* s) {
+  sparse_file_drop_index(s);
   backed_block_list_destroy(s->backed_block_list);
   free(s);
 }
 
 int sparse_file_add_data(struct sparse_file* s, void* data, uint64_t len, unsigned int block) {
+  sparse_file_drop_index(s);
   return backed_block_add_data(s->backed_block_list, data, len, block);
 }
 
 int sparse_file_add_fill(struct sparse_file* s, uint32_t fill_val, uint64_t len,
                          unsigned int block) {
+  sparse_file_drop_index(s);
   return backed_block_add_fill(s->backed_block_list, fill_val, len, block);
 }
 
 int sparse_file_add_file(struct sparse_file* s, const char* filename, int64_t file_offset,
                          uint64_t len, unsigned int block) {
+  sparse_file_drop_index(s);
   return backed_block_add_file(s->backed_block_list, filename, file_offset, len, block);
 }
 
 int sparse_file_add_fd(struct sparse_file* s, int fd, int64_t file_offset, uint64_t len,
                        unsigned int block) {
+  sparse_file_drop_index(s);
   return backed_block_add_fd(s->backed_block_list, fd, file_offset, len, block);
 }
 unsigned int sparse_count_chunks(struct sparse_file* s) {
@@ -148,6 +177,7 @@ int sparse_file_write(struct sparse_file* s, int fd, bool gz, bool sparse, bool
   int chunks;
   struct output_file* out;
 
+  sparse_file_drop_index(s);
   for (bb = backed_block_iter_new(s->backed_block_list); bb; bb = backed_block_iter_next(bb)) {
     ret = backed_block_split(s->backed_block_list, bb, MAX_BACKED_BLOCK_SIZE);
     if (ret) return ret;
@@ -260,16 +290,26 @@ unsigned int sparse_file_block_size(struct sparse_file* s) {
   return s->block_size;
 }
 
+/*
+ * Size of the chunk sparse_file_write_block() emits for bb in sparse mode,
+ * without crc. Computed rather than measured, so that splitting a file does
+ * not have to map or open the files backing it.
+ */
+static int64_t sparse_chunk_len(struct backed_block* bb, unsigned int block_size) {
+  if (backed_block_type(bb) == BACKED_BLOCK_FILL) {
+    return sizeof(chunk_header_t) + sizeof(uint32_t);
+  }
+  return sizeof(chunk_header_t) + ALIGN((uint64_t)backed_block_len(bb), block_size);
+}
+
 static struct backed_block* move_chunks_up_to_len(struct sparse_file* from, struct sparse_file* to,
                                                   unsigned int len) {
   int64_t count = 0;
-  struct output_file* out_counter;
   struct backed_block* last_bb = nullptr;
   struct backed_block* bb;
   struct backed_block* start;
   unsigned int last_block = 0;
   int64_t file_len = 0;
-  int ret;
 
   /*
    * overhead is sparse file header, the potential end skip
@@ -279,23 +319,13 @@ static struct backed_block* move_chunks_up_to_len(struct sparse_file* from, stru
   len -= overhead;
 
   start = backed_block_iter_new(from->backed_block_list);
-  out_counter = output_file_open_callback(out_counter_write, &count, to->block_size, to->len, false,
-                                          true, 0, false);
-  if (!out_counter) {
-    return nullptr;
-  }
 
   for (bb = start; bb; bb = backed_block_iter_next(bb)) {
     count = 0;
     if (backed_block_block(bb) > last_block) count += sizeof(chunk_header_t);
     last_block = backed_block_block(bb) + DIV_ROUND_UP(backed_block_len(bb), to->block_size);
 
-    /* will call out_counter_write to update count */
-    ret = sparse_file_write_block(out_counter, bb);
-    if (ret) {
-      bb = nullptr;
-      goto out;
-    }
+    count += sparse_chunk_len(bb, to->block_size);
     if (file_len + count > len) {
       /*
        * If the remaining available size is more than 1/8th of the
@@ -316,9 +346,6 @@ static struct backed_block* move_chunks_up_to_len(struct sparse_file* from, stru
 move:
   backed_block_list_move(from->backed_block_list, to->backed_block_list, start, last_bb);
 
-out:
-  output_file_close(out_counter);
-
   return bb;
 }
 
@@ -334,6 +361,8 @@ int sparse_file_resparse(struct sparse_file* in_s, unsigned int max_len, struct
     return -ENOMEM;
   }
 
+  sparse_file_drop_index(in_s);
+
   do {
     s = sparse_file_new(in_s->block_size, in_s->len);
 
@@ -355,6 +384,149 @@ int sparse_file_resparse(struct sparse_file* in_s, unsigned int max_len, struct
   return c;
 }
 
+struct sparse_file** sparse_file_resparse_all(struct sparse_file* in_s, unsigned int max_len,
+                                              int* count) {
+  std::vector<struct sparse_file*> files;
+  struct sparse_file** out_s;
+  struct backed_block* bb;
+
+  sparse_file_drop_index(in_s);
+  do {
+    struct sparse_file* s = sparse_file_new(in_s->block_size, in_s->len);
+    if (!s) {
+      goto err;
+    }
+    files.push_back(s);
+
+    bb = move_chunks_up_to_len(in_s, s, max_len);
+  } while (bb);
+
+  out_s = reinterpret_cast<sparse_file**>(calloc(files.size() + 1, sizeof(struct sparse_file*)));
+  if (!out_s) {
+    goto err;
+  }
+  std::copy(files.begin(), files.end(), out_s);
+  *count = files.size();
+
+  return out_s;
+
+err:
+  for (struct sparse_file* s : files) {
+    backed_block_list_move(s->backed_block_list, in_s->backed_block_list, nullptr, nullptr);
+    sparse_file_destroy(s);
+  }
+  return nullptr;
+}
+
+int sparse_file_len_parallel(struct sparse_file** s, int count, bool sparse, bool crc,
+                             int64_t* lens) {
+  std::atomic<int> next(0);
+  std::atomic<bool> failed(false);
+
+  auto worker = [&]() {
+    for (int i = next++; i < count; i = next++) {
+      lens[i] = sparse_file_len(s[i], sparse, crc);
+      if (lens[i] < 0) {
+        failed = true;
+      }
+    }
+  };
+
+  unsigned int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::min(num_threads, static_cast<unsigned int>(std::max(count, 1)));
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  return failed ? -1 : 0;
+}
+
+/* Copies len bytes at offset into the data of bb to buf. */
+static int read_backed_block(struct backed_block* bb, uint64_t offset, char* buf, size_t len) {
+  switch (backed_block_type(bb)) {
+    case BACKED_BLOCK_DATA:
+      memcpy(buf, (char*)backed_block_data(bb) + offset, len);
+      return 0;
+    case BACKED_BLOCK_FILL: {
+      uint32_t fill_val = backed_block_fill_val(bb);
+      const char* fill = reinterpret_cast<const char*>(&fill_val);
+      for (size_t i = 0; i < len; i++) {
+        buf[i] = fill[(offset + i) % sizeof(fill_val)];
+      }
+      return 0;
+    }
+    case BACKED_BLOCK_FD:
+      if (!android::base::ReadFullyAtOffset(backed_block_fd(bb), buf, len,
+                                            backed_block_file_offset(bb) + offset)) {
+        return -errno;
+      }
+      return 0;
+    case BACKED_BLOCK_FILE: {
+      android::base::unique_fd fd(open(backed_block_filename(bb), O_RDONLY | O_BINARY));
+      if (fd < 0 ||
+          !android::base::ReadFullyAtOffset(fd, buf, len, backed_block_file_offset(bb) + offset)) {
+        return -errno;
+      }
+      return 0;
+    }
+  }
+  return -EINVAL;
+}
+
+int sparse_file_read_range(struct sparse_file* s, int64_t offset, void* data, size_t len) {
+  if (offset < 0 || offset > s->len || (int64_t)len > s->len - offset) {
+    return -EINVAL;
+  }
+
+  if (!s->index) {
+    s->index = new sparse_index;
+    for (struct backed_block* bb = backed_block_iter_new(s->backed_block_list); bb;
+         bb = backed_block_iter_next(bb)) {
+      s->index->blocks.push_back(bb);
+    }
+  }
+
+  /* Anything not covered by a chunk reads as zeros, like a don't care chunk. */
+  char* buf = reinterpret_cast<char*>(data);
+  memset(buf, 0, len);
+
+  const auto& blocks = s->index->blocks;
+  auto it = std::upper_bound(blocks.begin(), blocks.end(), offset / s->block_size,
+                             [](int64_t block, struct backed_block* bb) {
+                               return block < backed_block_block(bb);
+                             });
+  if (it != blocks.begin()) {
+    --it;
+  }
+
+  int64_t end = offset + len;
+  for (; it != blocks.end(); ++it) {
+    int64_t bb_start = (int64_t)backed_block_block(*it) * s->block_size;
+    int64_t bb_end = bb_start + backed_block_len(*it);
+    if (bb_start >= end) {
+      break;
+    }
+    if (bb_end <= offset) {
+      continue;
+    }
+
+    int64_t start = std::max(offset, bb_start);
+    int ret = read_backed_block(*it, start - bb_start, buf + (start - offset),
+                                std::min(end, bb_end) - start);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  return 0;
+}
+
 void sparse_file_verbose(struct sparse_file* s) {
   s->verbose = true;
 }
@@ -19,6 +19,11 @@
 
 #include <stdint.h>
 
+#include <stddef.h>
+
+/* Uses the CRC32 instructions of the CPU when available. */
 uint32_t sparse_crc32(uint32_t crc, const void* buf, size_t size);
+/* Table-driven version, for comparison. */
+uint32_t sparse_crc32_portable(uint32_t crc, const void* buf, size_t size);
 
 #endif
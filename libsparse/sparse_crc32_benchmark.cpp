@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "sparse_crc32.h"
+
+static std::vector<uint8_t> make_buffer(size_t size) {
+  std::vector<uint8_t> buf(size);
+  for (size_t i = 0; i < size; i++) buf[i] = static_cast<uint8_t>(i * 31 + 7);
+  return buf;
+}
+
+static void BM_sparse_crc32(benchmark::State& state) {
+  auto buf = make_buffer(state.range(0));
+  uint32_t crc = 0;
+  for (auto _ : state) {
+    crc = sparse_crc32(crc, buf.data(), buf.size());
+    benchmark::DoNotOptimize(crc);
+  }
+  state.SetBytesProcessed(state.iterations() * buf.size());
+}
+BENCHMARK(BM_sparse_crc32)->Range(64, 4 << 20);
+
+static void BM_sparse_crc32_portable(benchmark::State& state) {
+  auto buf = make_buffer(state.range(0));
+  uint32_t crc = 0;
+  for (auto _ : state) {
+    crc = sparse_crc32_portable(crc, buf.data(), buf.size());
+    benchmark::DoNotOptimize(crc);
+  }
+  state.SetBytesProcessed(state.iterations() * buf.size());
+}
+BENCHMARK(BM_sparse_crc32_portable)->Range(64, 4 << 20);
+
+BENCHMARK_MAIN();
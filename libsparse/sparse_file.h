@@ -30,6 +30,7 @@ struct sparse_file {
 
   struct backed_block_list* backed_block_list;
   struct output_file* out;
+  struct sparse_index* index;
 };
 
 #ifdef __cplusplus
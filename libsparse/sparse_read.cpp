@@ -457,48 +457,80 @@ static int sparse_file_read_sparse(struct sparse_file* s, SparseFileSource* sour
   return 0;
 }
 
+/* Raw files are read and scanned for fill blocks this many bytes at a time. */
+static int64_t read_normal_buf_size(struct sparse_file* s) {
+  return std::max((int64_t)s->block_size, COPY_BUF_SIZE / s->block_size * s->block_size);
+}
+
+/* Returns true if the block is a single 32-bit value repeated, that is, if
+ * every word equals the next one. Comparing the block against itself shifted
+ * by one word lets memcmp, which libc vectorizes for each architecture, do the
+ * scan; data blocks usually differ within the first few bytes. */
+static bool is_fill_block(const uint32_t* buf, unsigned int words) {
+  return memcmp(buf, buf + 1, (words - 1) * sizeof(uint32_t)) == 0;
+}
+
 static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* buf, int64_t offset,
                                       int64_t remain) {
   int ret;
   unsigned int block = offset / s->block_size;
-  unsigned int to_read;
-  unsigned int i;
-  bool sparse_block;
+  unsigned int words = s->block_size / sizeof(uint32_t);
+  int64_t buf_size = read_normal_buf_size(s);
+
+  /* Consecutive data blocks, or fill blocks with the same value, are added
+   * as one run. */
+  bool run_fill = false;
+  uint32_t run_fill_val = 0;
+  unsigned int run_block = block;
+  int64_t run_offset = offset;
+  uint64_t run_len = 0;
 
   if (!buf) {
     return -ENOMEM;
   }
 
   while (remain > 0) {
-    to_read = std::min(remain, (int64_t)(s->block_size));
+    int64_t to_read = std::min(remain, buf_size);
     ret = read_all(fd, buf, to_read);
     if (ret < 0) {
       error("failed to read sparse file");
       return ret;
     }
 
-    if (to_read == s->block_size) {
-      sparse_block = true;
-      for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-        if (buf[0] != buf[i]) {
-          sparse_block = false;
-          break;
+    for (int64_t pos = 0; pos < to_read; pos += s->block_size) {
+      int64_t len = std::min(to_read - pos, (int64_t)s->block_size);
+      const uint32_t* block_buf = buf + pos / sizeof(uint32_t);
+      /* TODO: add flag to use skip instead of fill for buf[0] == 0 */
+      bool fill = len == s->block_size && is_fill_block(block_buf, words);
+
+      if (run_len && (fill != run_fill || (fill && block_buf[0] != run_fill_val))) {
+        if (run_fill) {
+          sparse_file_add_fill(s, run_fill_val, run_len, run_block);
+        } else {
+          sparse_file_add_fd(s, fd, run_offset, run_len, run_block);
         }
+        run_len = 0;
       }
-    } else {
-      sparse_block = false;
-    }
-
-    if (sparse_block) {
-      /* TODO: add flag to use skip instead of fill for buf[0] == 0 */
-      sparse_file_add_fill(s, buf[0], to_read, block);
-    } else {
-      sparse_file_add_fd(s, fd, offset, to_read, block);
+      if (!run_len) {
+        run_fill = fill;
+        run_fill_val = block_buf[0];
+        run_block = block;
+        run_offset = offset + pos;
+      }
+      run_len += len;
+      block++;
     }
 
     remain -= to_read;
     offset += to_read;
-    block++;
+  }
+
+  if (run_len) {
+    if (run_fill) {
+      sparse_file_add_fill(s, run_fill_val, run_len, run_block);
+    } else {
+      sparse_file_add_fd(s, fd, run_offset, run_len, run_block);
+    }
   }
 
   return 0;
@@ -506,7 +538,7 @@ static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* b
 
 static int sparse_file_read_normal(struct sparse_file* s, int fd) {
   int ret;
-  uint32_t* buf = (uint32_t*)malloc(s->block_size);
+  uint32_t* buf = (uint32_t*)malloc(read_normal_buf_size(s));
 
   if (!buf)
     return -ENOMEM;
@@ -519,7 +551,7 @@ static int sparse_file_read_normal(struct sparse_file* s, int fd) {
 #ifdef __linux__
 static int sparse_file_read_hole(struct sparse_file* s, int fd) {
   int ret;
-  uint32_t* buf = (uint32_t*)malloc(s->block_size);
+  uint32_t* buf = (uint32_t*)malloc(read_normal_buf_size(s));
   int64_t end = 0;
   int64_t start = 0;
 
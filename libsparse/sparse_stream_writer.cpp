@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE 1
+
+#include <algorithm>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sparse/sparse.h>
+
+#include "output_file.h"
+#include "sparse_defs.h"
+
+#if defined(__APPLE__) && defined(__MACH__)
+#define lseek64 lseek
+#endif
+
+/* Keep chunks the same size as the ones sparse_file_write() emits. */
+#define MAX_STREAM_CHUNK_SIZE ((uint64_t)(64UL << 20))
+
+struct sparse_stream_writer {
+  struct output_file* out;
+  unsigned int block_size;
+  int64_t header_offset;
+};
+
+struct sparse_stream_writer* sparse_stream_writer_open(int fd, unsigned int block_size,
+                                                       int64_t len, bool crc) {
+  if (block_size == 0 || block_size % 4) {
+    error("invalid block size %u", block_size);
+    return nullptr;
+  }
+
+  int64_t header_offset = lseek64(fd, 0, SEEK_CUR);
+  if (header_offset < 0) {
+    error_errno("lseek64");
+    return nullptr;
+  }
+
+  struct sparse_stream_writer* w =
+      reinterpret_cast<sparse_stream_writer*>(calloc(1, sizeof(struct sparse_stream_writer)));
+  if (!w) {
+    error_errno("malloc struct sparse_stream_writer");
+    return nullptr;
+  }
+
+  /* The header written here is a placeholder until sparse_stream_writer_close(). */
+  w->out = output_file_open_fd(fd, block_size, len, false, true, 0, crc);
+  if (!w->out) {
+    free(w);
+    return nullptr;
+  }
+  w->block_size = block_size;
+  w->header_offset = header_offset;
+
+  return w;
+}
+
+int sparse_stream_writer_append_data(struct sparse_stream_writer* w, const void* data,
+                                     uint64_t len) {
+  const char* ptr = reinterpret_cast<const char*>(data);
+  while (len) {
+    uint64_t chunk_len = std::min(len, MAX_STREAM_CHUNK_SIZE);
+    int ret = write_data_chunk(w->out, chunk_len, const_cast<char*>(ptr));
+    if (ret < 0) {
+      return ret;
+    }
+    ptr += chunk_len;
+    len -= chunk_len;
+  }
+  return 0;
+}
+
+int sparse_stream_writer_append_fill(struct sparse_stream_writer* w, uint32_t fill_val,
+                                     uint64_t len) {
+  while (len) {
+    uint64_t chunk_len = std::min(len, MAX_STREAM_CHUNK_SIZE);
+    int ret = write_fill_chunk(w->out, chunk_len, fill_val);
+    if (ret < 0) {
+      return ret;
+    }
+    len -= chunk_len;
+  }
+  return 0;
+}
+
+int sparse_stream_writer_append_skip(struct sparse_stream_writer* w, uint64_t len) {
+  if (len % w->block_size) {
+    error("skip length %" PRIu64 " is not a multiple of the block size", len);
+    return -EINVAL;
+  }
+
+  while (len) {
+    uint64_t chunk_len = std::min(len, MAX_STREAM_CHUNK_SIZE);
+    int ret = write_skip_chunk(w->out, chunk_len);
+    if (ret < 0) {
+      return ret;
+    }
+    len -= chunk_len;
+  }
+  return 0;
+}
+
+int sparse_stream_writer_close(struct sparse_stream_writer* w) {
+  int ret = output_file_close_seekable(w->out, w->header_offset);
+  free(w);
+  return ret;
+}
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <log/log_event_list.h>
+#include <stdbool.h>
 #include <sys/uio.h>
 
 #ifdef __cplusplus
@@ -26,6 +27,13 @@ void reset_log_context(android_log_context ctx);
 int write_to_logger(android_log_context context, log_id_t id);
 void note_log_drop(int error, int atom_tag);
 void stats_log_close();
+/*
+ * Buffers the atoms each thread writes and sends them to statsd in batches,
+ * rather than with a socket write each. Off by default.
+ */
+void stats_log_set_batching(bool enabled);
+/* Sends the atoms the calling thread has buffered. */
+void stats_log_flush();
 int android_log_write_char_array(android_log_context ctx, const char* value, size_t len);
 extern int (*write_to_statsd)(struct iovec* vec, size_t nr);
 
@@ -124,7 +124,16 @@ void note_log_drop(int error, int tag) {
     statsdLoggerWrite.noteDrop(error, tag);
 }
 
+void stats_log_set_batching(bool enabled) {
+    statsdLoggerWrite.setBatching(enabled);
+}
+
+void stats_log_flush() {
+    statsdLoggerWrite.flush();
+}
+
 void stats_log_close() {
+    statsdLoggerWrite.flush();
     statsd_writer_init_lock();
     write_to_statsd = __write_to_statsd_init;
     if (statsdLoggerWrite.close) {
@@ -41,6 +41,30 @@ static atomic_int dropped = 0;
 static atomic_int log_error = 0;
 static atomic_int atom_tag = 0;
 
+/*
+ * While batching is on, each thread packs the atoms it writes into a buffer
+ * of its own, and the buffer goes to statsd in one sendmmsg() once it is full,
+ * once it holds an atom older than STATSD_BATCH_TIMEOUT_NS, on flush(), or
+ * when the thread exits. An idle thread holds on to its atoms until one of
+ * those happens. Atoms that don't make it are reported through noteDrop().
+ */
+#define STATSD_BATCH_MAX_MSGS 32
+#define STATSD_BATCH_BYTES (16 * 1024)
+#define STATSD_BATCH_TIMEOUT_NS (100 * 1000 * 1000LL)
+
+struct statsd_batch {
+    size_t count;
+    size_t used;
+    struct timespec first_ts;
+    struct mmsghdr msgs[STATSD_BATCH_MAX_MSGS];
+    struct iovec iovs[STATSD_BATCH_MAX_MSGS];
+    unsigned char data[STATSD_BATCH_BYTES];
+};
+
+static atomic_bool batching = false;
+static pthread_once_t batch_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t batch_key;
+
 void statsd_writer_init_lock() {
     /*
      * If we trigger a signal handler in the middle of locked activity and the
@@ -62,6 +86,8 @@ static int statsdOpen();
 static void statsdClose();
 static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr);
 static void statsdNoteDrop();
+static void statsdSetBatching(bool enabled);
+static void statsdFlush();
 
 struct android_log_transport_write statsdLoggerWrite = {
         .name = "statsd",
@@ -71,6 +97,8 @@ struct android_log_transport_write statsdLoggerWrite = {
         .close = statsdClose,
         .write = statsdWrite,
         .noteDrop = statsdNoteDrop,
+        .setBatching = statsdSetBatching,
+        .flush = statsdFlush,
 };
 
 /* log_init_lock assumed */
@@ -153,6 +181,187 @@ static void statsdNoteDrop(int error, int tag) {
     atomic_exchange_explicit(&atom_tag, tag, memory_order_relaxed);
 }
 
+/* Tells statsd how many atoms have been dropped since it was last told. */
+static void statsdSendDropCount(int sock, android_log_header_t* header) {
+    int32_t snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (snapshot) {
+        struct iovec vec[2];
+        android_log_event_long_t buffer;
+        ssize_t ret;
+
+        header->id = LOG_ID_STATS;
+        // store the last log error in the tag field. This tag field is not used by statsd.
+        buffer.header.tag = atomic_load(&log_error);
+        buffer.payload.type = EVENT_TYPE_LONG;
+        // format:
+        // |atom_tag|dropped_count|
+        int64_t composed_long = atomic_load(&atom_tag);
+        // Send 2 int32's via an int64.
+        composed_long = ((composed_long << 32) | ((int64_t)snapshot));
+        buffer.payload.data = composed_long;
+
+        vec[0].iov_base = header;
+        vec[0].iov_len = sizeof(*header);
+        vec[1].iov_base = &buffer;
+        vec[1].iov_len = sizeof(buffer);
+
+        ret = TEMP_FAILURE_RETRY(writev(sock, vec, 2));
+        if (ret != (ssize_t)(sizeof(*header) + sizeof(buffer))) {
+            atomic_fetch_add_explicit(&dropped, snapshot, memory_order_relaxed);
+        }
+    }
+}
+
+static void statsdReconnect(int error) {
+    switch (error) {
+        case -ENOTCONN:
+        case -ECONNREFUSED:
+        case -ENOENT:
+            if (statd_writer_trylock()) {
+                return;
+            }
+            __statsdClose(error);
+            statsdOpen();
+            statsd_writer_init_unlock();
+            break;
+        default:
+            break;
+    }
+}
+
+/* Sends and empties the batch. */
+static void statsdFlushBatch(struct statsd_batch* batch) {
+    size_t sent = 0;
+    int error = -EBADF;
+
+    if (batch->count == 0) {
+        return;
+    }
+
+    int sock = atomic_load(&statsdLoggerWrite.sock);
+    if (sock >= 0) {
+        android_log_header_t header = *(android_log_header_t*)batch->data;
+        statsdSendDropCount(sock, &header);
+
+        while (sent < batch->count) {
+            int ret = TEMP_FAILURE_RETRY(sendmmsg(sock, batch->msgs + sent, batch->count - sent, 0));
+            if (ret <= 0) {
+                error = ret < 0 ? -errno : -EAGAIN;
+                break;
+            }
+            sent += ret;
+        }
+    } else {
+        error = sock;
+    }
+
+    if (sent < batch->count) {
+        // The atoms are lost either way; reconnect for the next batch.
+        statsdReconnect(error);
+        for (size_t i = sent; i < batch->count; i++) {
+            statsdNoteDrop(error, 0);
+        }
+    }
+    batch->count = 0;
+    batch->used = 0;
+}
+
+static void statsdBatchDestroy(void* arg) {
+    struct statsd_batch* batch = arg;
+    statsdFlushBatch(batch);
+    free(batch);
+}
+
+static void statsdBatchKeyInit() {
+    pthread_key_create(&batch_key, statsdBatchDestroy);
+}
+
+/* Turning batching off flushes the calling thread's batch only. */
+static void statsdSetBatching(bool enabled) {
+    pthread_once(&batch_key_once, statsdBatchKeyInit);
+    atomic_store(&batching, enabled);
+    if (!enabled) {
+        statsdFlush();
+    }
+}
+
+static void statsdFlush() {
+    pthread_once(&batch_key_once, statsdBatchKeyInit);
+    struct statsd_batch* batch = pthread_getspecific(batch_key);
+    if (batch) {
+        statsdFlushBatch(batch);
+    }
+}
+
+static int64_t statsdElapsedNs(const struct timespec* from, const struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000LL + (to->tv_nsec - from->tv_nsec);
+}
+
+/*
+ * Adds the atom to the calling thread's batch, sending the batch first if the
+ * atom doesn't fit and afterwards if it is due. Returns the number of payload
+ * bytes taken, or -errno if the atom can't be batched.
+ */
+static int statsdWriteBatched(struct timespec* ts, struct iovec* vec, size_t nr) {
+    struct statsd_batch* batch = pthread_getspecific(batch_key);
+    if (!batch) {
+        batch = calloc(1, sizeof(*batch));
+        if (!batch || pthread_setspecific(batch_key, batch)) {
+            free(batch);
+            return -ENOMEM;
+        }
+    }
+
+    size_t payloadSize = 0;
+    for (size_t i = 0; i < nr; i++) {
+        payloadSize += vec[i].iov_len;
+    }
+    if (payloadSize > LOGGER_ENTRY_MAX_PAYLOAD) {
+        payloadSize = LOGGER_ENTRY_MAX_PAYLOAD;
+    }
+    size_t msgSize = sizeof(android_log_header_t) + payloadSize;
+
+    if (batch->count == STATSD_BATCH_MAX_MSGS || batch->used + msgSize > STATSD_BATCH_BYTES) {
+        statsdFlushBatch(batch);
+    }
+    if (batch->count == 0) {
+        batch->first_ts = *ts;
+    }
+
+    unsigned char* msg = batch->data + batch->used;
+    android_log_header_t header;
+    header.id = LOG_ID_STATS;
+    header.tid = gettid();
+    header.realtime.tv_sec = ts->tv_sec;
+    header.realtime.tv_nsec = ts->tv_nsec;
+    memcpy(msg, &header, sizeof(header));
+
+    unsigned char* pos = msg + sizeof(header);
+    size_t remaining = payloadSize;
+    for (size_t i = 0; i < nr && remaining; i++) {
+        size_t len = vec[i].iov_len < remaining ? vec[i].iov_len : remaining;
+        memcpy(pos, vec[i].iov_base, len);
+        pos += len;
+        remaining -= len;
+    }
+
+    struct iovec* iov = &batch->iovs[batch->count];
+    iov->iov_base = msg;
+    iov->iov_len = msgSize;
+    struct mmsghdr* mmsg = &batch->msgs[batch->count];
+    memset(mmsg, 0, sizeof(*mmsg));
+    mmsg->msg_hdr.msg_iov = iov;
+    mmsg->msg_hdr.msg_iovlen = 1;
+    batch->count++;
+    batch->used += msgSize;
+
+    int64_t age = statsdElapsedNs(&batch->first_ts, ts);
+    if (batch->count == STATSD_BATCH_MAX_MSGS || age >= STATSD_BATCH_TIMEOUT_NS || age < 0) {
+        statsdFlushBatch(batch);
+    }
+    return payloadSize;
+}
+
 static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
     ssize_t ret;
     int sock;
@@ -162,6 +371,12 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
     size_t i, payloadSize;
 
     sock = atomic_load(&statsdLoggerWrite.sock);
+    if (sock >= 0 && atomic_load_explicit(&batching, memory_order_relaxed)) {
+        ret = statsdWriteBatched(ts, vec, nr);
+        if (ret >= 0) {
+            return ret;
+        }
+    }
     if (sock < 0) switch (sock) {
             case -ENOTCONN:
             case -ECONNREFUSED:
@@ -197,28 +412,7 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
 
     // If we dropped events before, try to tell statsd.
     if (sock >= 0) {
-        int32_t snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
-        if (snapshot) {
-            android_log_event_long_t buffer;
-            header.id = LOG_ID_STATS;
-            // store the last log error in the tag field. This tag field is not used by statsd.
-            buffer.header.tag = atomic_load(&log_error);
-            buffer.payload.type = EVENT_TYPE_LONG;
-            // format:
-            // |atom_tag|dropped_count|
-            int64_t composed_long = atomic_load(&atom_tag);
-            // Send 2 int32's via an int64.
-            composed_long = ((composed_long << 32) | ((int64_t)snapshot));
-            buffer.payload.data = composed_long;
-
-            newVec[headerLength].iov_base = &buffer;
-            newVec[headerLength].iov_len = sizeof(buffer);
-
-            ret = TEMP_FAILURE_RETRY(writev(sock, newVec, 2));
-            if (ret != (ssize_t)(sizeof(header) + sizeof(buffer))) {
-                atomic_fetch_add_explicit(&dropped, snapshot, memory_order_relaxed);
-            }
-        }
+        statsdSendDropCount(sock, &header);
     }
 
     header.id = LOG_ID_STATS;
@@ -19,6 +19,7 @@
 
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <sys/socket.h>
 
 /**
@@ -40,6 +41,10 @@ struct android_log_transport_write {
     int (*write)(struct timespec* ts, struct iovec* vec, size_t nr);
     /* note one log drop */
     void (*noteDrop)(int error, int tag);
+    /* buffer writes per thread and send them in batches, or stop doing so */
+    void (*setBatching)(bool enabled);
+    /* send what the calling thread has buffered */
+    void (*flush)();
 };
 
 #endif  // ANDROID_STATS_LOG_STATS_WRITER_H
@@ -37,6 +37,8 @@
  * break builds.
  */
 
+#include <stddef.h>
+
 #include "../ndk/sync.h"
 
 __BEGIN_DECLS
@@ -44,6 +46,24 @@ __BEGIN_DECLS
 /* timeout in msecs */
 int sync_wait(int fd, int timeout);
 
+enum {
+    SYNC_WAIT_ANY = 0, /* until any of the fences signals */
+    SYNC_WAIT_ALL = 1, /* until all of them have */
+};
+
+/* Waits on count fences in one poll. timeout in msecs covers the whole wait.
+ * Returns the index of a signaled fence in SYNC_WAIT_ANY mode and 0 in
+ * SYNC_WAIT_ALL mode, or -1 with errno set to ETIME on timeout or EINVAL if a
+ * fence is invalid or has an error.
+ */
+int sync_wait_many(const int* fds, size_t count, int timeout, int mode);
+
+/* Merges count fences into a new one named name. The fences are merged
+ * pairwise, so each sync_pt is copied O(log count) times instead of once per
+ * fence merged in after it. The fds passed in are left open.
+ */
+int sync_merge_many(const char* name, const int* fds, size_t count);
+
 __END_DECLS
 
 #endif /* __SYS_CORE_SYNC_H */
@@ -22,7 +22,10 @@
 #include <poll.h>
 #include <stdatomic.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -151,6 +154,101 @@ int sync_wait(int fd, int timeout)
     return ret;
 }
 
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int sync_wait_many(const int *fds, size_t count, int timeout, int mode)
+{
+    struct pollfd local_pfds[16];
+    struct pollfd *pfds = local_pfds;
+    size_t local_indexes[16];
+    size_t *indexes = local_indexes;
+    size_t pending = count;
+    int64_t deadline = timeout >= 0 ? now_ms() + timeout : 0;
+    int ret = -1;
+    size_t i;
+
+    if (!fds || count == 0 || (mode != SYNC_WAIT_ANY && mode != SYNC_WAIT_ALL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (fds[i] < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    if (count > sizeof(local_pfds) / sizeof(local_pfds[0])) {
+        // poll() wants the pollfds contiguous; the indexes ride along.
+        pfds = malloc(count * (sizeof(*pfds) + sizeof(*indexes)));
+        if (!pfds) {
+            errno = ENOMEM;
+            return -1;
+        }
+        indexes = (size_t *)(pfds + count);
+    }
+    for (i = 0; i < count; i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+        indexes[i] = i;
+    }
+
+    // In SYNC_WAIT_ALL mode the signaled fences drop out of the poll set, so
+    // each round only waits on the ones still pending.
+    while (pending > 0) {
+        int wait = timeout;
+        int n;
+
+        if (timeout > 0) {
+            int64_t left = deadline - now_ms();
+            wait = left > 0 ? (int)left : 0;
+        }
+        n = poll(pfds, pending, wait);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            goto out;
+        }
+        if (n == 0) {
+            errno = ETIME;
+            goto out;
+        }
+
+        for (i = 0; i < pending;) {
+            if (!pfds[i].revents) {
+                i++;
+                continue;
+            }
+            if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+                errno = EINVAL;
+                goto out;
+            }
+            if (mode == SYNC_WAIT_ANY) {
+                ret = indexes[i];
+                goto out;
+            }
+            pending--;
+            pfds[i] = pfds[pending];
+            indexes[i] = indexes[pending];
+        }
+    }
+    ret = 0;
+
+out:
+    if (pfds != local_pfds) {
+        int saved_errno = errno;
+        free(pfds);
+        errno = saved_errno;
+    }
+    return ret;
+}
+
 static int legacy_sync_merge(const char *name, int fd1, int fd2)
 {
     struct sync_legacy_merge_data data;
@@ -206,6 +304,83 @@ int sync_merge(const char *name, int fd1, int fd2)
     return ret;
 }
 
+int sync_merge_many(const char *name, const int *fds, size_t count)
+{
+    int *level;
+    const int *in = fds;
+    size_t in_count = count;
+    int owned = 0;
+    int ret;
+
+    if (!fds || count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (count == 1) {
+        return sync_merge(name, fds[0], fds[0]);
+    }
+
+    level = malloc(((count + 1) / 2) * sizeof(*level));
+    if (!level) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Merge pairwise, a level at a time, so that every sync_pt is copied
+    // O(log count) times rather than once per fence merged in after it. The
+    // first level reads the caller's fds; the later ones are built in place
+    // from the fences the level before made, which get closed as they go.
+    while (in_count > 1) {
+        size_t n = 0;
+        size_t i;
+
+        for (i = 0; i + 1 < in_count; i += 2) {
+            int fd = sync_merge(name, in[i], in[i + 1]);
+            if (fd < 0) {
+                int saved_errno = errno;
+                size_t j;
+                for (j = 0; j < n; j++) {
+                    close(level[j]);
+                }
+                for (j = i; owned && j < in_count; j++) {
+                    close(in[j]);
+                }
+                free(level);
+                errno = saved_errno;
+                return -1;
+            }
+            if (owned) {
+                close(in[i]);
+                close(in[i + 1]);
+            }
+            level[n++] = fd;
+        }
+        if (i < in_count) {
+            // The odd one out goes up a level as it is; keep it ours to close.
+            int fd = owned ? in[i] : dup(in[i]);
+            if (fd < 0) {
+                int saved_errno = errno;
+                size_t j;
+                for (j = 0; j < n; j++) {
+                    close(level[j]);
+                }
+                free(level);
+                errno = saved_errno;
+                return -1;
+            }
+            level[n++] = fd;
+        }
+
+        in = level;
+        in_count = n;
+        owned = 1;
+    }
+
+    ret = level[0];
+    free(level);
+    return ret;
+}
+
 static struct sync_fence_info_data *legacy_sync_fence_info(int fd)
 {
     struct sync_fence_info_data *legacy_info;
@@ -174,6 +174,11 @@ public:
             return;
         setFd(fd);
     }
+    // Takes ownership of fd.
+    explicit SyncFence(int fd) noexcept {
+        if (fd >= 0)
+            setFd(fd);
+    }
     SyncFence(const vector<SyncFence> &sources) noexcept {
         assert(sources.size());
         SyncFence temp(*begin(sources));
@@ -477,6 +482,62 @@ TEST(FenceTest, MultiTimelineWait) {
     ASSERT_EQ(mergedFence.wait(100), 0);
 }
 
+TEST(FenceTest, WaitManyAny) {
+    SyncTimeline timelineA, timelineB;
+    ASSERT_TRUE(timelineA.isValid());
+    ASSERT_TRUE(timelineB.isValid());
+
+    SyncFence fenceA(timelineA, 1);
+    SyncFence fenceB(timelineB, 1);
+    ASSERT_TRUE(fenceA.isValid());
+    ASSERT_TRUE(fenceB.isValid());
+    const int fds[] = {fenceA.getFd(), fenceB.getFd()};
+
+    ASSERT_EQ(sync_wait_many(fds, 2, 0, SYNC_WAIT_ANY), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    ASSERT_EQ(timelineB.inc(1), 0);
+    ASSERT_EQ(sync_wait_many(fds, 2, 100, SYNC_WAIT_ANY), 1);
+}
+
+TEST(FenceTest, WaitManyAll) {
+    SyncTimeline timelineA, timelineB;
+    ASSERT_TRUE(timelineA.isValid());
+    ASSERT_TRUE(timelineB.isValid());
+
+    SyncFence fenceA(timelineA, 1);
+    SyncFence fenceB(timelineB, 1);
+    ASSERT_TRUE(fenceA.isValid());
+    ASSERT_TRUE(fenceB.isValid());
+    const int fds[] = {fenceA.getFd(), fenceB.getFd()};
+
+    ASSERT_EQ(timelineA.inc(1), 0);
+    ASSERT_EQ(sync_wait_many(fds, 2, 0, SYNC_WAIT_ALL), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    thread signaler([&] {
+        usleep(10000);
+        timelineB.inc(1);
+    });
+    ASSERT_EQ(sync_wait_many(fds, 2, 1000, SYNC_WAIT_ALL), 0);
+    signaler.join();
+}
+
+TEST(FenceTest, WaitManyNegative) {
+    SyncTimeline timeline;
+    ASSERT_TRUE(timeline.isValid());
+    SyncFence fence(timeline, 1);
+    ASSERT_TRUE(fence.isValid());
+
+    const int fds[] = {fence.getFd(), -1};
+    ASSERT_EQ(sync_wait_many(fds, 2, 0, SYNC_WAIT_ANY), -1);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_EQ(sync_wait_many(fds, 0, 0, SYNC_WAIT_ANY), -1);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_EQ(sync_wait_many(fds, 1, 0, 42), -1);
+    ASSERT_EQ(errno, EINVAL);
+}
+
 TEST(FenceTest, GetInfoActive) {
     SyncTimeline timeline;
     ASSERT_TRUE(timeline.isValid());
@@ -681,6 +742,79 @@ TEST_P(MergeStressTest, RandomMerge) {
     ASSERT_EQ(fence.wait(0), 0);
 }
 
+// Waits on and merges fences from as many timelines as the parameter, with
+// sync_wait_many() and sync_merge_many() against the one-at-a-time calls
+// they stand in for.
+class ManyFencesTest : public ::testing::TestWithParam<int> {
+  protected:
+    void SetUp() override {
+        timelines = vector<SyncTimeline>(GetParam());
+        for (auto& timeline : timelines) {
+            ASSERT_TRUE(timeline.isValid());
+            fences.emplace_back(timeline, 1);
+            ASSERT_TRUE(fences.back().isValid());
+            fds.push_back(fences.back().getFd());
+        }
+    }
+
+    void signalAll() {
+        for (auto& timeline : timelines) {
+            ASSERT_EQ(timeline.inc(1), 0);
+        }
+    }
+
+    vector<SyncTimeline> timelines;
+    vector<SyncFence> fences;
+    vector<int> fds;
+};
+
+TEST_P(ManyFencesTest, WaitOneAtATime) {
+    signalAll();
+    for (auto& fence : fences) {
+        ASSERT_EQ(fence.wait(0), 0);
+    }
+}
+
+TEST_P(ManyFencesTest, WaitMany) {
+    ASSERT_EQ(sync_wait_many(fds.data(), fds.size(), 0, SYNC_WAIT_ALL), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    // The last fence to signal is the one the wait returns for.
+    ASSERT_EQ(timelines.back().inc(1), 0);
+    ASSERT_EQ(sync_wait_many(fds.data(), fds.size(), 0, SYNC_WAIT_ANY), fds.size() - 1);
+
+    signalAll();
+    ASSERT_EQ(sync_wait_many(fds.data(), fds.size(), 0, SYNC_WAIT_ALL), 0);
+}
+
+TEST_P(ManyFencesTest, MergeOneAtATime) {
+    SyncFence merged(fences);
+    ASSERT_TRUE(merged.isValid());
+    ASSERT_EQ(merged.getSize(), GetParam());
+}
+
+TEST_P(ManyFencesTest, MergeMany) {
+    int fd = sync_merge_many("mergeMany", fds.data(), fds.size());
+    ASSERT_GE(fd, 0);
+    SyncFence merged(fd);
+    ASSERT_EQ(merged.getSize(), GetParam());
+    ASSERT_EQ(merged.getActiveCount(), GetParam());
+    CheckModernLegacyInfoMatch(merged);
+
+    // The inputs stay open.
+    for (auto& fence : fences) {
+        ASSERT_TRUE(fence.isValid());
+    }
+
+    signalAll();
+    ASSERT_EQ(merged.wait(100), 0);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    ParameterizedManyFencesTest,
+    ManyFencesTest,
+    ::testing::Values(1, 2, 3, 16, 64, 256));
+
 INSTANTIATE_TEST_CASE_P(
     ParameterizedMergeStressTest,
     MergeStressTest,
@@ -42,6 +42,8 @@ private:
     Action mAction;
     char *mSubsystem;
     char *mParams[NL_PARAMS_MAX];
+    // Copy of a uevent, that mPath, mSubsystem and mParams point into.
+    char *mAsciiBuffer;
 
 public:
     NetlinkEvent();
@@ -44,6 +44,10 @@ public:
 protected:
     virtual bool onDataAvailable(SocketClient *cli);
     virtual void onEvent(NetlinkEvent *evt) = 0;
+
+private:
+    // Receives and handles all the uevents that are queued, in one batch.
+    bool onUeventsAvailable(int socket);
 };
 
 #endif
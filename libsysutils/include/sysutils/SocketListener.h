@@ -18,7 +18,9 @@
 
 #include <pthread.h>
 
+#include <deque>
 #include <unordered_map>
+#include <vector>
 
 #include <sysutils/SocketClient.h>
 #include "SocketClientCommand.h"
@@ -32,6 +34,13 @@ class SocketListener {
     int                     mCtrlPipe[2];
     pthread_t               mThread;
     bool                    mUseCmdNum;
+    int                     mEpollFd;
+    int                     mWorkerCount;
+    std::vector<pthread_t>  mWorkers;
+    std::deque<SocketClient*> mWork;
+    pthread_mutex_t         mWorkLock;
+    pthread_cond_t          mWorkCond;
+    bool                    mStopping;
 
 public:
     SocketListener(const char *socketName, bool listen);
@@ -49,11 +58,19 @@ public:
 
     bool release(SocketClient *c) { return release(c, true); }
 
+    // Has onDataAvailable() run on this many worker threads rather than on
+    // the listener thread, so that a slow command doesn't hold up the other
+    // clients. Commands from any one client are still handled in order, one
+    // at a time. Only for subclasses whose onDataAvailable() can run for
+    // several clients at once; must be called before startListener().
+    void setWorkerThreads(int count) { mWorkerCount = count; }
+
 protected:
     virtual bool onDataAvailable(SocketClient *c) = 0;
 
 private:
     static void *threadStart(void *obj);
+    static void *workerStart(void *obj);
 
     // Add all clients to a separate list, so we don't have to hold the lock
     // while processing it.
@@ -61,6 +78,10 @@ private:
 
     bool release(SocketClient *c, bool wakeup);
     void runListener();
+    void runWorker();
+    void stopWorkers();
+    void process(SocketClient *c);
+    bool watch(int fd, bool oneShot, int op);
     void init(const char *socketName, int socketFd, bool listen, bool useCmdNum);
 };
 #endif
@@ -199,10 +199,16 @@ NetlinkEvent::NetlinkEvent() {
     memset(mParams, 0, sizeof(mParams));
     mPath = nullptr;
     mSubsystem = nullptr;
+    mAsciiBuffer = nullptr;
 }
 
 NetlinkEvent::~NetlinkEvent() {
     int i;
+    if (mAsciiBuffer) {
+        // mPath, mSubsystem and mParams all point into it.
+        free(mAsciiBuffer);
+        return;
+    }
     if (mPath)
         free(mPath);
     if (mSubsystem)
@@ -770,7 +776,7 @@ has_prefix(const char* str, const char* end, const char* prefix, size_t prefixle
  * netlink socket.
  */
 bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
-    const char *s = buffer;
+    const char *s;
     const char *end;
     int param_idx = 0;
     int first = 1;
@@ -778,6 +784,17 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
     if (size == 0)
         return false;
 
+    /*
+     * Keep one copy of the whole uevent for the path, subsystem and params to
+     * point into, rather than a copy of each of them.
+     */
+    mAsciiBuffer = static_cast<char*>(malloc(size));
+    if (mAsciiBuffer == nullptr)
+        return false;
+    memcpy(mAsciiBuffer, buffer, size);
+    buffer = mAsciiBuffer;
+    s = buffer;
+
     /* Ensure the buffer is zero-terminated, the code below depends on this */
     buffer[size-1] = '\0';
 
@@ -791,7 +808,7 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     return false;
                 }
             }
-            mPath = strdup(p+1);
+            mPath = const_cast<char*>(p + 1);
             first = 0;
         } else {
             const char* a;
@@ -807,9 +824,9 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     SLOGE("NetlinkEvent::parseAsciiNetlinkMessage: failed to parse SEQNUM=%s", a);
                 }
             } else if ((a = HAS_CONST_PREFIX(s, end, "SUBSYSTEM=")) != nullptr) {
-                mSubsystem = strdup(a);
+                mSubsystem = const_cast<char*>(a);
             } else if (param_idx < NL_PARAMS_MAX) {
-                mParams[param_idx++] = strdup(s);
+                mParams[param_idx++] = const_cast<char*>(s);
             }
         }
         s += strlen(s) + 1;
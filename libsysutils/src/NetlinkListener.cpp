@@ -43,12 +43,77 @@ NetlinkListener::NetlinkListener(int socket, int format) :
                             SocketListener(socket, false), mFormat(format) {
 }
 
+// The kernel builds uevents in a 2KiB environment buffer, so one with its
+// "action@devpath" header fits in a slot of this size, and mBuffer holds
+// enough of them to be worth a recvmmsg(2).
+static constexpr size_t kUeventSlotSize = 4096;
+
+// Same checks as uevent_kernel_recv(): the message must come from the kernel,
+// with credentials, to a multicast group.
+static bool isKernelUevent(const msghdr& hdr) {
+    const cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_CREDENTIALS) return false;
+    auto addr = static_cast<const sockaddr_nl*>(hdr.msg_name);
+    return addr->nl_pid == 0 && addr->nl_groups != 0;
+}
+
+bool NetlinkListener::onUeventsAvailable(int socket) {
+    constexpr size_t kSlots = sizeof(mBuffer) / kUeventSlotSize;
+    mmsghdr msgs[kSlots];
+    iovec iovs[kSlots];
+    sockaddr_nl addrs[kSlots];
+    char control[kSlots][CMSG_SPACE(sizeof(ucred))];
+
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < kSlots; i++) {
+        iovs[i] = {mBuffer + i * kUeventSlotSize, kUeventSlotSize};
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+
+    int count = TEMP_FAILURE_RETRY(recvmmsg(socket, msgs, kSlots, MSG_DONTWAIT, nullptr));
+    if (count < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+        SLOGE("recvmmsg failed (%s)", strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        char* buffer = mBuffer + i * kUeventSlotSize;
+        if (!isKernelUevent(msgs[i].msg_hdr)) {
+            // clear residual potentially malicious data
+            bzero(buffer, kUeventSlotSize);
+            continue;
+        }
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            SLOGE("Dropping truncated uevent");
+            continue;
+        }
+
+        NetlinkEvent evt;
+        if (evt.decode(buffer, msgs[i].msg_len, mFormat)) {
+            onEvent(&evt);
+        } else {
+            SLOGE("Error decoding NetlinkEvent");
+        }
+    }
+    return true;
+}
+
 bool NetlinkListener::onDataAvailable(SocketClient *cli)
 {
     int socket = cli->getSocket();
     ssize_t count;
     uid_t uid = -1;
 
+    if (mFormat == NETLINK_FORMAT_ASCII) {
+        return onUeventsAvailable(socket);
+    }
+
     bool require_group = true;
     if (mFormat == NETLINK_FORMAT_BINARY_UNICAST) {
         require_group = false;
@@ -19,13 +19,14 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <iterator>
 #include <vector>
 
 #include <cutils/sockets.h>
@@ -53,7 +54,12 @@ void SocketListener::init(const char *socketName, int socketFd, bool listen, boo
     mSocketName = socketName;
     mSock = socketFd;
     mUseCmdNum = useCmdNum;
+    mEpollFd = -1;
+    mWorkerCount = 0;
+    mStopping = false;
     pthread_mutex_init(&mClientsLock, nullptr);
+    pthread_mutex_init(&mWorkLock, nullptr);
+    pthread_cond_init(&mWorkCond, nullptr);
 }
 
 SocketListener::~SocketListener() {
@@ -64,6 +70,8 @@ SocketListener::~SocketListener() {
         close(mCtrlPipe[0]);
         close(mCtrlPipe[1]);
     }
+    if (mEpollFd != -1)
+        close(mEpollFd);
     for (auto pair : mClients) {
         pair.second->decRef();
     }
@@ -100,8 +108,35 @@ int SocketListener::startListener(int backlog) {
         return -1;
     }
 
+    if ((mEpollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        SLOGE("epoll_create1 failed (%s)", strerror(errno));
+        return -1;
+    }
+
+    // Start the workers first: clients are watched one-shot when there are
+    // any, and would never be rearmed without them.
+    for (int i = 0; i < mWorkerCount; i++) {
+        pthread_t worker;
+        if (pthread_create(&worker, nullptr, SocketListener::workerStart, this)) {
+            SLOGE("pthread_create worker (%s)", strerror(errno));
+            break;
+        }
+        mWorkers.push_back(worker);
+    }
+    mWorkerCount = mWorkers.size();
+
+    if (!watch(mCtrlPipe[0], false, EPOLL_CTL_ADD) ||
+        (mListen && !watch(mSock, false, EPOLL_CTL_ADD))) {
+        stopWorkers();
+        return -1;
+    }
+    for (auto pair : mClients) {
+        watch(pair.first, mWorkerCount > 0, EPOLL_CTL_ADD);
+    }
+
     if (pthread_create(&mThread, nullptr, SocketListener::threadStart, this)) {
         SLOGE("pthread_create (%s)", strerror(errno));
+        stopWorkers();
         return -1;
     }
 
@@ -123,10 +158,13 @@ int SocketListener::stopListener() {
         SLOGE("Error joining to listener thread (%s)", strerror(errno));
         return -1;
     }
+    stopWorkers();
     close(mCtrlPipe[0]);
     close(mCtrlPipe[1]);
     mCtrlPipe[0] = -1;
     mCtrlPipe[1] = -1;
+    close(mEpollFd);
+    mEpollFd = -1;
 
     if (mSocketName && mSock > -1) {
         close(mSock);
@@ -148,81 +186,146 @@ void *SocketListener::threadStart(void *obj) {
     return nullptr;
 }
 
-void SocketListener::runListener() {
-    while (true) {
-        std::vector<pollfd> fds;
+void *SocketListener::workerStart(void *obj) {
+    SocketListener *me = reinterpret_cast<SocketListener *>(obj);
 
-        pthread_mutex_lock(&mClientsLock);
-        fds.reserve(2 + mClients.size());
-        fds.push_back({.fd = mCtrlPipe[0], .events = POLLIN});
-        if (mListen) fds.push_back({.fd = mSock, .events = POLLIN});
-        for (auto pair : mClients) {
-            // NB: calling out to an other object with mClientsLock held (safe)
-            const int fd = pair.second->getSocket();
-            if (fd != pair.first) SLOGE("fd mismatch: %d != %d", fd, pair.first);
-            fds.push_back({.fd = fd, .events = POLLIN});
-        }
-        pthread_mutex_unlock(&mClientsLock);
+    me->runWorker();
+    pthread_exit(nullptr);
+    return nullptr;
+}
+
+void SocketListener::stopWorkers() {
+    pthread_mutex_lock(&mWorkLock);
+    mStopping = true;
+    pthread_cond_broadcast(&mWorkCond);
+    pthread_mutex_unlock(&mWorkLock);
+
+    for (pthread_t worker : mWorkers) {
+        pthread_join(worker, nullptr);
+    }
+    mWorkers.clear();
+    for (SocketClient* c : mWork) {
+        c->decRef();
+    }
+    mWork.clear();
+    mStopping = false;
+}
+
+bool SocketListener::watch(int fd, bool oneShot, int op) {
+    struct epoll_event ev = {
+            .events = EPOLLIN | (oneShot ? EPOLLONESHOT : 0u),
+            .data = {.fd = fd},
+    };
+    if (epoll_ctl(mEpollFd, op, fd, &ev)) {
+        SLOGE("epoll_ctl(%d, %d) failed (%s)", op, fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void SocketListener::runListener() {
+    struct epoll_event events[16];
 
+    while (true) {
         SLOGV("mListen=%d, mSocketName=%s", mListen, mSocketName);
-        int rc = TEMP_FAILURE_RETRY(poll(fds.data(), fds.size(), -1));
+        int rc = TEMP_FAILURE_RETRY(epoll_wait(mEpollFd, events, std::size(events), -1));
         if (rc < 0) {
-            SLOGE("poll failed (%s) mListen=%d", strerror(errno), mListen);
+            SLOGE("epoll_wait failed (%s) mListen=%d", strerror(errno), mListen);
             sleep(1);
             continue;
         }
 
-        if (fds[0].revents & (POLLIN | POLLERR)) {
-            char c = CtrlPipe_Shutdown;
-            TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
-            if (c == CtrlPipe_Shutdown) {
-                break;
+        // Clients that are watched one-shot won't be reported again, so the
+        // whole batch is handled even when there was something on the pipe.
+        std::vector<SocketClient*> pending;
+        for (int i = 0; i < rc; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == mCtrlPipe[0]) {
+                char c = CtrlPipe_Shutdown;
+                TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
+                if (c == CtrlPipe_Shutdown) {
+                    for (SocketClient* p : pending) p->decRef();
+                    return;
+                }
+                continue;
             }
-            continue;
-        }
-        if (mListen && (fds[1].revents & (POLLIN | POLLERR))) {
-            int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
-            if (c < 0) {
-                SLOGE("accept failed (%s)", strerror(errno));
-                sleep(1);
+            if (mListen && fd == mSock) {
+                int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
+                if (c < 0) {
+                    SLOGE("accept failed (%s)", strerror(errno));
+                    sleep(1);
+                    continue;
+                }
+                pthread_mutex_lock(&mClientsLock);
+                mClients[c] = new SocketClient(c, true, mUseCmdNum);
+                watch(c, mWorkerCount > 0, EPOLL_CTL_ADD);
+                pthread_mutex_unlock(&mClientsLock);
                 continue;
             }
+
+            // Take a reference, so we can release the lock before invoking
+            // the callbacks.
             pthread_mutex_lock(&mClientsLock);
-            mClients[c] = new SocketClient(c, true, mUseCmdNum);
+            auto it = mClients.find(fd);
+            if (it == mClients.end()) {
+                SLOGE("fd vanished: %d", fd);
+            } else {
+                it->second->incRef();
+                pending.push_back(it->second);
+            }
             pthread_mutex_unlock(&mClientsLock);
         }
 
-        // Add all active clients to the pending list first, so we can release
-        // the lock before invoking the callbacks.
-        std::vector<SocketClient*> pending;
-        pthread_mutex_lock(&mClientsLock);
-        const int size = fds.size();
-        for (int i = mListen ? 2 : 1; i < size; ++i) {
-            const struct pollfd& p = fds[i];
-            if (p.revents & (POLLIN | POLLERR)) {
-                auto it = mClients.find(p.fd);
-                if (it == mClients.end()) {
-                    SLOGE("fd vanished: %d", p.fd);
-                    continue;
-                }
-                SocketClient* c = it->second;
-                pending.push_back(c);
-                c->incRef();
-            }
+        if (mWorkerCount > 0) {
+            pthread_mutex_lock(&mWorkLock);
+            mWork.insert(mWork.end(), pending.begin(), pending.end());
+            pthread_cond_broadcast(&mWorkCond);
+            pthread_mutex_unlock(&mWorkLock);
+            continue;
         }
-        pthread_mutex_unlock(&mClientsLock);
-
         for (SocketClient* c : pending) {
-            // Process it, if false is returned, remove from the map
-            SLOGV("processing fd %d", c->getSocket());
-            if (!onDataAvailable(c)) {
-                release(c, false);
-            }
+            process(c);
             c->decRef();
         }
     }
 }
 
+void SocketListener::runWorker() {
+    while (true) {
+        pthread_mutex_lock(&mWorkLock);
+        while (mWork.empty() && !mStopping) {
+            pthread_cond_wait(&mWorkCond, &mWorkLock);
+        }
+        if (mStopping) {
+            pthread_mutex_unlock(&mWorkLock);
+            return;
+        }
+        SocketClient* c = mWork.front();
+        mWork.pop_front();
+        pthread_mutex_unlock(&mWorkLock);
+
+        process(c);
+        c->decRef();
+    }
+}
+
+void SocketListener::process(SocketClient* c) {
+    // Process it, if false is returned, remove from the map
+    SLOGV("processing fd %d", c->getSocket());
+    if (!onDataAvailable(c)) {
+        release(c, false);
+    } else if (mWorkerCount > 0) {
+        // Only now let the client's next command in; the fd may meanwhile
+        // have been released, and even reused by a new client.
+        pthread_mutex_lock(&mClientsLock);
+        auto it = mClients.find(c->getSocket());
+        if (it != mClients.end() && it->second == c) {
+            watch(c->getSocket(), true, EPOLL_CTL_MOD);
+        }
+        pthread_mutex_unlock(&mClientsLock);
+    }
+}
+
 bool SocketListener::release(SocketClient* c, bool wakeup) {
     bool ret = false;
     /* if our sockets are connection-based, remove and destroy it */
@@ -231,6 +334,8 @@ bool SocketListener::release(SocketClient* c, bool wakeup) {
         SLOGV("going to zap %d for %s", c->getSocket(), mSocketName);
         pthread_mutex_lock(&mClientsLock);
         ret = (mClients.erase(c->getSocket()) != 0);
+        // The fd is still open here, so it can't have been reused yet.
+        if (ret) epoll_ctl(mEpollFd, EPOLL_CTL_DEL, c->getSocket(), nullptr);
         pthread_mutex_unlock(&mClientsLock);
         if (ret) {
             ret = c->decRef();
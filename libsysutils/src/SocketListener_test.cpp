@@ -16,6 +16,7 @@
 
 #include <sysutils/FrameworkCommand.h>
 #include <sysutils/FrameworkListener.h>
+#include <sysutils/SocketListener.h>
 
 #include <poll.h>
 #include <string.h>
@@ -23,7 +24,9 @@
 #include <sys/un.h>
 
 #include <algorithm>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -118,6 +121,35 @@ class TestListener : public FrameworkListener {
     }
 };
 
+// A listener that echoes back whatever it reads. Reading "wait" holds the
+// reply back until some other client has sent "go".
+class WaitingListener : public SocketListener {
+  public:
+    WaitingListener(int fd) : SocketListener(fd, true) {}
+
+  protected:
+    bool onDataAvailable(SocketClient* c) override {
+        char buf[64];
+        ssize_t len = TEMP_FAILURE_RETRY(read(c->getSocket(), buf, sizeof(buf)));
+        if (len <= 0) return false;
+        std::string msg(buf, buf + len);
+        if (msg == std::string("wait") + '\0') {
+            std::unique_lock<std::mutex> lock(mLock);
+            mCv.wait_for(lock, std::chrono::seconds(5), [this] { return mGo; });
+        } else if (msg == std::string("go") + '\0') {
+            std::lock_guard<std::mutex> lock(mLock);
+            mGo = true;
+            mCv.notify_all();
+        }
+        return c->sendData(msg.data(), msg.size()) == 0;
+    }
+
+  private:
+    std::mutex mLock;
+    std::condition_variable mCv;
+    bool mGo = false;
+};
+
 }  // unnamed namespace
 
 class FrameworkListenerTest : public testing::Test {
@@ -181,3 +213,23 @@ TEST_F(FrameworkListenerTest, MultipleClients) {
     EXPECT_EQ(std::string("42 test,2") + '\0', recvReply(client2.get()));
     EXPECT_EQ(std::string("42 test,1") + '\0', recvReply(client1.get()));
 }
+
+TEST(SocketListenerTest, WorkerThreads) {
+    std::string path = testSocketPath();
+    unique_fd server_fd = serverSocket(path);
+    WaitingListener listener(server_fd.get());
+    listener.setWorkerThreads(2);
+    ASSERT_EQ(0, listener.startListener());
+
+    // The waiting command mustn't keep the other client from being served.
+    unique_fd client1 = clientSocket(path);
+    unique_fd client2 = clientSocket(path);
+    sendCmd(client1.get(), "wait");
+    sendCmd(client2.get(), "go");
+
+    EXPECT_EQ(std::string("go") + '\0', recvReply(client2.get()));
+    EXPECT_EQ(std::string("wait") + '\0', recvReply(client1.get()));
+
+    EXPECT_EQ(0, listener.stopListener());
+    unlink(path.c_str());
+}
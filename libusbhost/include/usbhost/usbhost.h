@@ -252,6 +252,11 @@ int usb_device_reset(struct usb_device *device);
 struct usb_request *usb_request_new(struct usb_device *dev,
         const struct usb_endpoint_descriptor *ep_desc);
 
+/* Creates a new usb_request for an isochronous endpoint. Its buffer is split
+ * evenly between num_packets packets when it is queued. */
+struct usb_request *usb_request_new_iso(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc, int num_packets);
+
 /* Releases all resources associated with the request */
 void usb_request_free(struct usb_request *req);
 
@@ -264,6 +269,20 @@ int usb_request_queue(struct usb_request *req);
   */
 struct usb_request *usb_request_wait(struct usb_device *dev, int timeoutMillis);
 
+/* Waits like usb_request_wait for one request to complete, then also takes
+ * any others that have completed by then, up to count, without waiting.
+ * For keeping many requests queued on an endpoint.
+ * Returns the number of requests stored in reqs, or -1 for error.
+ */
+int usb_request_wait_many(struct usb_device *dev, struct usb_request **reqs, int count,
+        int timeoutMillis);
+
+/* Gets the length received or sent for one packet of a completed
+ * isochronous request. Returns the packet's status, 0 or a negative errno,
+ * or -EINVAL if there is no such packet.
+ */
+int usb_request_get_iso_packet(struct usb_request *req, int packet, int *actual_length);
+
 /* Cancels a pending usb_request_queue() operation. */
 int usb_request_cancel(struct usb_request *req);
 
@@ -62,6 +62,10 @@
 
 #define MAX_USBFS_WD_COUNT      10
 
+// usbfs numbers buses from 1 to 64 and devices on them from 1 to 127
+#define MAX_USB_BUS             64
+#define MAX_USB_DEVICE          127
+
 struct usb_host_context {
     int                         fd;
     usb_device_added_cb         cb_added;
@@ -70,6 +74,8 @@ struct usb_host_context {
     int                         wds[MAX_USBFS_WD_COUNT];
     int                         wdd;
     int                         wddbus;
+    /* devices already passed to cb_added, one bit per device on each bus */
+    uint64_t                    seen[MAX_USB_BUS + 1][2];
 };
 
 struct usb_device {
@@ -88,9 +94,43 @@ static inline int badname(const char *name)
     return 0;
 }
 
-static int find_existing_devices_bus(char *busname,
-                                     usb_device_added_cb added_cb,
-                                     void *client_data)
+/* Returns the bit for dev_name in context->seen, or NULL if it isn't a device. */
+static uint64_t *seen_device(struct usb_host_context *context, const char *dev_name, uint64_t *bit)
+{
+    int bus, device;
+    if (sscanf(dev_name, USB_FS_ID_SCANNER, &bus, &device) != 2 ||
+            bus < 1 || bus > MAX_USB_BUS || device < 1 || device > MAX_USB_DEVICE)
+        return NULL;
+    *bit = 1ULL << (device % 64);
+    return &context->seen[bus][device / 64];
+}
+
+/* Reports a device to cb_added unless it has been already. The directories
+ * are scanned again when they reappear, and a device created during a scan
+ * is also seen by inotify, but there's no need to open it and read its
+ * descriptors twice. */
+static int device_added(struct usb_host_context *context, const char *dev_name)
+{
+    uint64_t bit;
+    uint64_t *seen = seen_device(context, dev_name, &bit);
+    if (seen) {
+        if (*seen & bit)
+            return 0;
+        *seen |= bit;
+    }
+    return context->cb_added(dev_name, context->data);
+}
+
+static int device_removed(struct usb_host_context *context, const char *dev_name)
+{
+    uint64_t bit;
+    uint64_t *seen = seen_device(context, dev_name, &bit);
+    if (seen)
+        *seen &= ~bit;
+    return context->cb_removed(dev_name, context->data);
+}
+
+static int find_existing_devices_bus(struct usb_host_context *context, char *busname)
 {
     char devname[32];
     DIR *devdir;
@@ -104,7 +144,7 @@ static int find_existing_devices_bus(char *busname,
         if(badname(de->d_name)) continue;
 
         snprintf(devname, sizeof(devname), "%s/%s", busname, de->d_name);
-        done = added_cb(devname, client_data);
+        done = device_added(context, devname);
     } // end of devdir while
     closedir(devdir);
 
@@ -112,8 +152,7 @@ static int find_existing_devices_bus(char *busname,
 }
 
 /* returns true if one of the callbacks indicates we are done */
-static int find_existing_devices(usb_device_added_cb added_cb,
-                                  void *client_data)
+static int find_existing_devices(struct usb_host_context *context)
 {
     char busname[32];
     DIR *busdir;
@@ -127,8 +166,7 @@ static int find_existing_devices(usb_device_added_cb added_cb,
         if(badname(de->d_name)) continue;
 
         snprintf(busname, sizeof(busname), USB_FS_DIR "/%s", de->d_name);
-        done = find_existing_devices_bus(busname, added_cb,
-                                         client_data);
+        done = find_existing_devices_bus(context, busname);
     } //end of busdir while
     closedir(busdir);
 
@@ -213,7 +251,7 @@ int usb_host_load(struct usb_host_context *context,
     watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
 
     /* check for existing devices first, after we have inotify set up */
-    done = find_existing_devices(added_cb, client_data);
+    done = find_existing_devices(context);
     if (discovery_done_cb)
         done |= discovery_done_cb(client_data);
 
@@ -242,14 +280,15 @@ int usb_host_read_event(struct usb_host_context *context)
                         done = 1;
                     } else {
                         watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
-                        done = find_existing_devices(context->cb_added, context->data);
+                        done = find_existing_devices(context);
                     }
                 }
             } else if (wd == context->wddbus) {
                 if ((event->mask & IN_CREATE) && !strcmp(event->name, "usb")) {
                     watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
-                    done = find_existing_devices(context->cb_added, context->data);
+                    done = find_existing_devices(context);
                 } else if ((event->mask & IN_DELETE) && !strcmp(event->name, "usb")) {
+                    memset(context->seen, 0, sizeof(context->seen));
                     for (i = 0; i < MAX_USBFS_WD_COUNT; i++) {
                         if (context->wds[i] >= 0) {
                             inotify_rm_watch(context->fd, context->wds[i]);
@@ -269,9 +308,9 @@ int usb_host_read_event(struct usb_host_context *context)
                                 IN_CREATE | IN_DELETE);
                         if (local_ret >= 0)
                             context->wds[i] = local_ret;
-                        done = find_existing_devices_bus(path, context->cb_added,
-                                context->data);
+                        done = find_existing_devices_bus(context, path);
                     } else if (event->mask & IN_DELETE) {
+                        memset(context->seen[i], 0, sizeof(context->seen[i]));
                         inotify_rm_watch(context->fd, context->wds[i]);
                         context->wds[i] = -1;
                     }
@@ -282,10 +321,10 @@ int usb_host_read_event(struct usb_host_context *context)
                         snprintf(path, sizeof(path), USB_FS_DIR "/%03d/%s", i, event->name);
                         if (event->mask == IN_CREATE) {
                             D("new device %s\n", path);
-                            done = context->cb_added(path, context->data);
+                            done = device_added(context, path);
                         } else if (event->mask == IN_DELETE) {
                             D("gone device %s\n", path);
-                            done = context->cb_removed(path, context->data);
+                            done = device_removed(context, path);
                         }
                     }
                 }
@@ -683,10 +722,11 @@ int usb_device_reset(struct usb_device *device)
     return ioctl(device->fd, USBDEVFS_RESET);
 }
 
-struct usb_request *usb_request_new(struct usb_device *dev,
-        const struct usb_endpoint_descriptor *ep_desc)
+static struct usb_request *request_new(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc, int num_packets)
 {
-    struct usbdevfs_urb *urb = calloc(1, sizeof(struct usbdevfs_urb));
+    struct usbdevfs_urb *urb = calloc(1, sizeof(struct usbdevfs_urb) +
+            num_packets * sizeof(struct usbdevfs_iso_packet_desc));
     if (!urb)
         return NULL;
 
@@ -694,7 +734,12 @@ struct usb_request *usb_request_new(struct usb_device *dev,
         urb->type = USBDEVFS_URB_TYPE_BULK;
     else if ((ep_desc->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) == USB_ENDPOINT_XFER_INT)
         urb->type = USBDEVFS_URB_TYPE_INTERRUPT;
-    else {
+    else if ((ep_desc->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) == USB_ENDPOINT_XFER_ISOC &&
+            num_packets > 0) {
+        urb->type = USBDEVFS_URB_TYPE_ISO;
+        urb->flags = USBDEVFS_URB_ISO_ASAP;
+        urb->number_of_packets = num_packets;
+    } else {
         D("Unsupported endpoint type %d", ep_desc->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK);
         free(urb);
         return NULL;
@@ -716,6 +761,20 @@ struct usb_request *usb_request_new(struct usb_device *dev,
     return req;
 }
 
+struct usb_request *usb_request_new(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc)
+{
+    return request_new(dev, ep_desc, 0);
+}
+
+struct usb_request *usb_request_new_iso(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc, int num_packets)
+{
+    if (num_packets <= 0)
+        return NULL;
+    return request_new(dev, ep_desc, num_packets);
+}
+
 void usb_request_free(struct usb_request *req)
 {
     free(req->private_data);
@@ -730,6 +789,15 @@ int usb_request_queue(struct usb_request *req)
     urb->status = -1;
     urb->buffer = req->buffer;
     urb->buffer_length = req->buffer_length;
+    if (urb->type == USBDEVFS_URB_TYPE_ISO) {
+        /* split the buffer evenly between the packets */
+        int i;
+        for (i = 0; i < urb->number_of_packets; i++) {
+            urb->iso_frame_desc[i].length = req->buffer_length / urb->number_of_packets;
+            urb->iso_frame_desc[i].actual_length = 0;
+            urb->iso_frame_desc[i].status = 0;
+        }
+    }
 
     do {
         res = ioctl(req->dev->fd, USBDEVFS_SUBMITURB, urb);
@@ -772,6 +840,44 @@ struct usb_request *usb_request_wait(struct usb_device *dev, int timeoutMillis)
     }
 }
 
+int usb_request_wait_many(struct usb_device *dev, struct usb_request **reqs, int count,
+        int timeoutMillis)
+{
+    int reaped = 0;
+
+    if (count <= 0)
+        return 0;
+
+    /* wait for the first one as usb_request_wait() would */
+    reqs[0] = usb_request_wait(dev, timeoutMillis);
+    if (!reqs[0])
+        return -1;
+    reaped++;
+
+    /* then take whatever else has completed, without waiting */
+    while (reaped < count) {
+        struct usbdevfs_urb *urb = NULL;
+        int res = TEMP_FAILURE_RETRY(ioctl(dev->fd, USBDEVFS_REAPURBNDELAY, &urb));
+        if (res < 0)
+            break;
+
+        struct usb_request *req = (struct usb_request*)urb->usercontext;
+        req->actual_length = urb->actual_length;
+        reqs[reaped++] = req;
+    }
+
+    return reaped;
+}
+
+int usb_request_get_iso_packet(struct usb_request *req, int packet, int *actual_length)
+{
+    struct usbdevfs_urb *urb = (struct usbdevfs_urb*)req->private_data;
+    if (urb->type != USBDEVFS_URB_TYPE_ISO || packet < 0 || packet >= urb->number_of_packets)
+        return -EINVAL;
+    *actual_length = urb->iso_frame_desc[packet].actual_length;
+    return urb->iso_frame_desc[packet].status;
+}
+
 int usb_request_cancel(struct usb_request *req)
 {
     struct usbdevfs_urb *urb = ((struct usbdevfs_urb*)req->private_data);
@@ -19,14 +19,153 @@
 #include <utils/Printer.h>
 #include <utils/Errors.h>
 #include <utils/Log.h>
+#include <utils/Timers.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <mutex>
 
 #include <backtrace/Backtrace.h>
+#include <backtrace/BacktraceMap.h>
 
 #define CALLSTACK_WEAK  // Don't generate weak definitions.
 #include <utils/CallStack.h>
 
 namespace android {
 
+namespace {
+
+constexpr size_t kMaxRawFrames = 64;
+
+// How often the shared maps may be rebuilt because they don't cover a pc.
+constexpr nsecs_t kMapRefreshIntervalNs = 1000000000;
+
+// The maps of this process used by updateRaw() and for printing raw stacks,
+// so that captures don't each read /proc/self/maps and open the ELF files.
+// Replaced, rather than updated, when libraries are loaded, since other
+// threads may still be using the old one.
+std::mutex gMapLock;
+std::shared_ptr<BacktraceMap> gMap;
+nsecs_t gMapBuildTime = 0;
+
+std::shared_ptr<BacktraceMap> processMap() {
+    std::lock_guard<std::mutex> guard(gMapLock);
+    if (gMap == nullptr) {
+        gMap.reset(BacktraceMap::Create(getpid()));
+        gMapBuildTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+    return gMap;
+}
+
+// Returns a map that may cover pcs that |stale| didn't, or null if the map
+// was rebuilt too recently to expect any difference.
+std::shared_ptr<BacktraceMap> refreshProcessMap(const std::shared_ptr<BacktraceMap>& stale) {
+    std::lock_guard<std::mutex> guard(gMapLock);
+    if (gMap != stale) {
+        return gMap;
+    }
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (now - gMapBuildTime < kMapRefreshIntervalNs) {
+        return nullptr;
+    }
+    gMap.reset(BacktraceMap::Create(getpid()));
+    gMapBuildTime = now;
+    return gMap;
+}
+
+bool isMapped(BacktraceMap* map, uint64_t pc) {
+    backtrace_map_t info;
+    map->FillIn(pc, &info);
+    return info.end > 0;
+}
+
+// Skips its own frame, so that |ignoreDepth| counts from the caller as it
+// does for update().
+__attribute__((noinline)) void unwindRaw(BacktraceMap* map, int32_t ignoreDepth,
+                                         std::vector<uint64_t>* pcs) {
+    pcs->clear();
+    std::unique_ptr<Backtrace> backtrace(
+            Backtrace::Create(BACKTRACE_CURRENT_PROCESS, BACKTRACE_CURRENT_THREAD, map));
+    if (!backtrace->Unwind(ignoreDepth + 1)) {
+        ALOGW("%s: Failed to unwind callstack.", __FUNCTION__);
+    }
+    for (size_t i = 0; i < backtrace->NumFrames() && i < kMaxRawFrames; i++) {
+        pcs->push_back(backtrace->GetFrame(i)->pc);
+    }
+}
+
+// Every arm64 platform library keeps frame pointers, so walking them gives
+// a full stack without reading any unwind info.
+#if defined(__aarch64__) && defined(__ANDROID__)
+#define CALLSTACK_FRAME_POINTERS 1
+
+struct FrameRecord {
+    uintptr_t next;
+    uintptr_t returnAddress;
+};
+
+// Strips pointer authentication codes and tags from return addresses.
+constexpr uintptr_t kPcMask = (uintptr_t(1) << 48) - 1;
+
+thread_local uintptr_t tStackLow = 0;
+thread_local uintptr_t tStackHigh = 0;
+
+bool getStackBounds(uintptr_t* low, uintptr_t* high) {
+    if (tStackHigh == 0) {
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+            return false;
+        }
+        void* stack;
+        size_t size;
+        int err = pthread_attr_getstack(&attr, &stack, &size);
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            return false;
+        }
+        tStackLow = reinterpret_cast<uintptr_t>(stack);
+        tStackHigh = tStackLow + size;
+    }
+    *low = tStackLow;
+    *high = tStackHigh;
+    return true;
+}
+
+// Like Backtrace::Unwind(), the first pc is in the caller of this function.
+// Every record is checked to lie on this thread's stack, above the previous
+// one, so a frame without a frame pointer ends the walk instead of crashing.
+__attribute__((noinline)) bool chaseFramePointers(int32_t ignoreDepth,
+                                                  std::vector<uint64_t>* pcs) {
+    uintptr_t low, high;
+    if (!getStackBounds(&low, &high)) {
+        return false;
+    }
+    pcs->clear();
+    uintptr_t fp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+    for (int32_t depth = 0; pcs->size() < kMaxRawFrames; depth++) {
+        if (fp < low || fp > high - sizeof(FrameRecord) || fp % alignof(FrameRecord) != 0) {
+            break;
+        }
+        const FrameRecord* record = reinterpret_cast<const FrameRecord*>(fp);
+        uintptr_t pc = record->returnAddress & kPcMask;
+        if (pc == 0) {
+            break;
+        }
+        if (depth >= ignoreDepth) {
+            pcs->push_back(pc);
+        }
+        if (record->next <= fp) {
+            break;
+        }
+        fp = record->next;
+    }
+    return true;
+}
+#endif
+
+}  // namespace
+
 CallStack::CallStack() {
 }
 
@@ -40,6 +179,7 @@ CallStack::~CallStack() {
 
 void CallStack::update(int32_t ignoreDepth, pid_t tid) {
     mFrameLines.clear();
+    mPcs.clear();
 
     std::unique_ptr<Backtrace> backtrace(Backtrace::Create(BACKTRACE_CURRENT_PROCESS, tid));
     if (!backtrace->Unwind(ignoreDepth)) {
@@ -50,6 +190,40 @@ void CallStack::update(int32_t ignoreDepth, pid_t tid) {
     }
 }
 
+void CallStack::update(int32_t ignoreDepth, pid_t tid, BacktraceMap* map) {
+    mFrameLines.clear();
+    mPcs.clear();
+
+    std::unique_ptr<Backtrace> backtrace(Backtrace::Create(BACKTRACE_CURRENT_PROCESS, tid, map));
+    if (!backtrace->Unwind(ignoreDepth)) {
+        ALOGW("%s: Failed to unwind callstack.", __FUNCTION__);
+    }
+    for (size_t i = 0; i < backtrace->NumFrames(); i++) {
+      mFrameLines.push_back(String8(backtrace->FormatFrameData(i).c_str()));
+    }
+}
+
+void CallStack::updateRaw(int32_t ignoreDepth) {
+    mFrameLines.clear();
+
+#ifdef CALLSTACK_FRAME_POINTERS
+    if (chaseFramePointers(ignoreDepth, &mPcs) && !mPcs.empty()) {
+        return;
+    }
+#endif
+
+    // The unwind stops at the first pc outside the map, so a truncated stack
+    // may just mean that a library was loaded since the map was built.
+    std::shared_ptr<BacktraceMap> map = processMap();
+    unwindRaw(map.get(), ignoreDepth, &mPcs);
+    if (!mPcs.empty() && !isMapped(map.get(), mPcs.back())) {
+        map = refreshProcessMap(map);
+        if (map != nullptr) {
+            unwindRaw(map.get(), ignoreDepth, &mPcs);
+        }
+    }
+}
+
 void CallStack::log(const char* logtag, android_LogPriority priority, const char* prefix) const {
     LogPrinter printer(logtag, priority, prefix, /*ignoreBlankLines*/false);
     print(printer);
@@ -70,11 +244,44 @@ String8 CallStack::toString(const char* prefix) const {
 }
 
 void CallStack::print(Printer& printer) const {
+    if (!mPcs.empty()) {
+        printRaw(printer);
+        return;
+    }
     for (size_t i = 0; i < mFrameLines.size(); i++) {
         printer.printLine(mFrameLines[i]);
     }
 }
 
+void CallStack::printRaw(Printer& printer) const {
+    std::shared_ptr<BacktraceMap> map = processMap();
+    for (uint64_t pc : mPcs) {
+        if (!isMapped(map.get(), pc)) {
+            std::shared_ptr<BacktraceMap> fresh = refreshProcessMap(map);
+            if (fresh != nullptr) {
+                map = fresh;
+            }
+            break;
+        }
+    }
+
+    std::unique_ptr<Backtrace> backtrace(
+            Backtrace::Create(BACKTRACE_CURRENT_PROCESS, BACKTRACE_CURRENT_THREAD, map.get()));
+    for (size_t i = 0; i < mPcs.size(); i++) {
+        backtrace_frame_data_t frame;
+        frame.num = i;
+        frame.pc = mPcs[i];
+        frame.sp = 0;
+        frame.stack_size = 0;
+        map->FillIn(frame.pc, &frame.map);
+        frame.rel_pc = frame.map.end > 0 ? frame.pc - frame.map.start + frame.map.load_bias
+                                         : frame.pc;
+        frame.func_offset = 0;
+        frame.func_name = backtrace->GetFunctionName(frame.pc, &frame.func_offset, &frame.map);
+        printer.printLine(backtrace->FormatFrameData(&frame).c_str());
+    }
+}
+
 // The following four functions may be used via weak symbol references from libutils.
 // Clients assume that if any of these symbols are available, then deleteStack() is.
 
@@ -82,7 +289,7 @@ void CallStack::print(Printer& printer) const {
 
 CallStack::CallStackUPtr CallStack::getCurrentInternal(int ignoreDepth) {
     CallStack::CallStackUPtr stack(new CallStack());
-    stack->update(ignoreDepth + 1);
+    stack->updateRaw(ignoreDepth + 1);
     return stack;
 }
 
@@ -45,6 +45,8 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
     callstackPtr->log(logTagChars, static_cast<android_LogPriority>(logPriority), prefixChars);
     callstackPtr->update(ignoreDepth, tid);
     callstackPtr->log(logTagChars, static_cast<android_LogPriority>(logPriority), prefixChars);
+    callstackPtr->updateRaw(ignoreDepth);
+    callstackPtr->log(logTagChars, static_cast<android_LogPriority>(logPriority), prefixChars);
 
     return 0;
 }
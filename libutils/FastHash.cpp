@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <utils/FastHash.h>
+
+namespace android {
+
+static constexpr uint64_t kPrime0 = 0xa0761d6478bd642fULL;
+static constexpr uint64_t kPrime1 = 0xe7037ed1a0b428dbULL;
+static constexpr uint64_t kPrime2 = 0x8ebc6af09c88c6e3ULL;
+static constexpr uint64_t kPrime3 = 0x589965cc75374cc3ULL;
+
+static inline uint64_t load64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t load32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Multiplies a and b, and folds the high half of the product into the low one.
+#ifdef __clang__
+__attribute__((no_sanitize("integer")))
+#endif
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#else
+    // 32 bit targets have no 128 bit type: build the product from 32 bit halves.
+    uint64_t aLo = a & 0xffffffff, aHi = a >> 32;
+    uint64_t bLo = b & 0xffffffff, bHi = b >> 32;
+    uint64_t lolo = aLo * bLo, lohi = aLo * bHi, hilo = aHi * bLo, hihi = aHi * bHi;
+    uint64_t middle = (lolo >> 32) + (lohi & 0xffffffff) + (hilo & 0xffffffff);
+    uint64_t lo = (lolo & 0xffffffff) | (middle << 32);
+    uint64_t hi = hihi + (lohi >> 32) + (hilo >> 32) + (middle >> 32);
+    return lo ^ hi;
+#endif
+}
+
+#ifdef __clang__
+__attribute__((no_sanitize("integer")))
+#endif
+uint64_t FastHashBytes(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    seed ^= kPrime0;
+    uint64_t a;
+    uint64_t b;
+    if (size <= 16) {
+        if (size >= 4) {
+            // Two overlapping reads from each end cover every byte.
+            size_t middle = (size >> 3) << 2;
+            a = (load32(p) << 32) | load32(p + middle);
+            b = (load32(p + size - 4) << 32) | load32(p + size - 4 - middle);
+        } else if (size > 0) {
+            a = (uint64_t(p[0]) << 16) | (uint64_t(p[size >> 1]) << 8) | p[size - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t remaining = size;
+        if (remaining > 48) {
+            // Three lanes, so that the multiplies don't wait on each other.
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = mix(load64(p) ^ kPrime1, load64(p + 8) ^ seed);
+                seed1 = mix(load64(p + 16) ^ kPrime2, load64(p + 24) ^ seed1);
+                seed2 = mix(load64(p + 32) ^ kPrime3, load64(p + 40) ^ seed2);
+                p += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (remaining > 16) {
+            seed = mix(load64(p) ^ kPrime1, load64(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+        // The last 16 bytes, which may overlap those already read.
+        a = load64(p + remaining - 16);
+        b = load64(p + remaining - 8);
+    }
+    return mix(kPrime1 ^ size, mix(a ^ kPrime1, b ^ seed));
+}
+
+}
@@ -46,6 +46,68 @@ using namespace android;
 
 /*static*/ long FileMap::mPageSize = -1;
 
+#if !defined(__MINGW32__)
+// The size of a transparent huge page on the devices we care about.
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+static size_t roundUpToPage(size_t length)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    return (length + pageSize - 1) & ~(pageSize - 1);
+}
+
+// Apply the madvise() hints among the create flags. These are only hints, so
+// failure, e.g. EINVAL from a kernel without huge pages for files, isn't an error.
+static void adviseCreated(void* ptr, size_t length, uint32_t createFlags)
+{
+#if defined(MADV_HUGEPAGE)
+    if ((createFlags & FileMap::CREATE_HUGEPAGE) && madvise(ptr, length, MADV_HUGEPAGE) != 0) {
+        ALOGV("madvise(MADV_HUGEPAGE) failed: %s\n", strerror(errno));
+    }
+#endif
+    if ((createFlags & FileMap::CREATE_WILLNEED) && madvise(ptr, length, MADV_WILLNEED) != 0) {
+        ALOGV("madvise(MADV_WILLNEED) failed: %s\n", strerror(errno));
+    }
+}
+
+// As mmap64(), but for mappings of at least a huge page, place the mapping at
+// an address that is the same as the offset modulo the huge page size. Only
+// then can the huge pages of the file's page cache be mapped as such.
+static void* mmapHugePageAligned(size_t length, int prot, int flags, int fd, off64_t offset)
+{
+    size_t mappedLength = roundUpToPage(length);
+    size_t reservedLength = mappedLength + kHugePageSize;
+    if (length < kHugePageSize || reservedLength < length) {
+        return mmap64(nullptr, length, prot, flags, fd, offset);
+    }
+    void* reserved = mmap(nullptr, reservedLength, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+        return mmap64(nullptr, length, prot, flags, fd, offset);
+    }
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(reserved);
+    size_t delta = (static_cast<uintptr_t>(offset) - start) & (kHugePageSize - 1);
+    void* ptr = mmap64(reinterpret_cast<void*>(start + delta), length, prot, flags | MAP_FIXED,
+                       fd, offset);
+    if (ptr == MAP_FAILED) {
+        int savedErrno = errno;
+        munmap(reserved, reservedLength);
+        errno = savedErrno;
+        return MAP_FAILED;
+    }
+
+    // Give back the parts of the reservation on either side.
+    if (delta != 0) {
+        munmap(reserved, delta);
+    }
+    if (reservedLength - delta - mappedLength != 0) {
+        munmap(static_cast<char*>(ptr) + mappedLength, reservedLength - delta - mappedLength);
+    }
+    return ptr;
+}
+#endif // !defined(__MINGW32__)
+
 // Constructor.  Create an empty object.
 FileMap::FileMap(void)
     : mFileName(nullptr),
@@ -134,8 +196,16 @@ FileMap::~FileMap(void)
 // Returns "false" on failure.
 bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t length,
         bool readOnly)
+{
+    return create(origFileName, fd, offset, length, readOnly, 0);
+}
+
+bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t length,
+        bool readOnly, uint32_t createFlags)
 {
 #if defined(__MINGW32__)
+    (void) createFlags;  // These are only hints.
+
     int     adjust;
     off64_t adjOffset;
     size_t  adjLength;
@@ -196,10 +266,18 @@ bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t le
     }
 
     int flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+    if (createFlags & CREATE_POPULATE) flags |= MAP_POPULATE;
+#endif
     int prot = PROT_READ;
     if (!readOnly) prot |= PROT_WRITE;
 
-    void* ptr = mmap64(nullptr, adjLength, prot, flags, fd, adjOffset);
+    void* ptr;
+    if (createFlags & CREATE_HUGEPAGE) {
+        ptr = mmapHugePageAligned(adjLength, prot, flags, fd, adjOffset);
+    } else {
+        ptr = mmap64(nullptr, adjLength, prot, flags, fd, adjOffset);
+    }
     if (ptr == MAP_FAILED) {
         if (errno == EINVAL && length == 0) {
             ptr = nullptr;
@@ -209,6 +287,9 @@ bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t le
             return false;
         }
     }
+    if (ptr != nullptr) {
+        adviseCreated(ptr, adjLength, createFlags);
+    }
     mBasePtr = ptr;
 #endif // !defined(__MINGW32__)
 
@@ -226,19 +307,26 @@ bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t le
 
 // Provide guidance to the system.
 #if !defined(_WIN32)
+static int toSysAdvice(FileMap::MapAdvice advice)
+{
+    switch (advice) {
+        case FileMap::NORMAL:       return MADV_NORMAL;
+        case FileMap::RANDOM:       return MADV_RANDOM;
+        case FileMap::SEQUENTIAL:   return MADV_SEQUENTIAL;
+        case FileMap::WILLNEED:     return MADV_WILLNEED;
+        case FileMap::DONTNEED:     return MADV_DONTNEED;
+    }
+    assert(false);
+    return -1;
+}
+
 int FileMap::advise(MapAdvice advice)
 {
     int cc, sysAdvice;
 
-    switch (advice) {
-        case NORMAL:        sysAdvice = MADV_NORMAL;        break;
-        case RANDOM:        sysAdvice = MADV_RANDOM;        break;
-        case SEQUENTIAL:    sysAdvice = MADV_SEQUENTIAL;    break;
-        case WILLNEED:      sysAdvice = MADV_WILLNEED;      break;
-        case DONTNEED:      sysAdvice = MADV_DONTNEED;      break;
-        default:
-                            assert(false);
-                            return -1;
+    sysAdvice = toSysAdvice(advice);
+    if (sysAdvice == -1) {
+        return -1;
     }
 
     cc = madvise(mBasePtr, mBaseLength, sysAdvice);
@@ -247,9 +335,147 @@ int FileMap::advise(MapAdvice advice)
     return cc;
 }
 
+int FileMap::advise(MapAdvice advice, size_t offset, size_t length)
+{
+    int cc, sysAdvice;
+
+    sysAdvice = toSysAdvice(advice);
+    if (sysAdvice == -1) {
+        return -1;
+    }
+
+    if (offset > mDataLength || length > mDataLength - offset) {
+        ALOGW("advise(%zu, %zu) is outside the %zu byte mapping\n", offset, length, mDataLength);
+        errno = EINVAL;
+        return -1;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    // madvise() wants a page aligned address. The mapping starts on a page, so
+    // rounding down doesn't leave it.
+    uintptr_t start = reinterpret_cast<uintptr_t>(mDataPtr) + offset;
+    uintptr_t alignedStart = start & ~(static_cast<uintptr_t>(mPageSize) - 1);
+    cc = madvise(reinterpret_cast<void*>(alignedStart), start + length - alignedStart, sysAdvice);
+    if (cc != 0)
+        ALOGW("madvise(%d) failed: %s\n", sysAdvice, strerror(errno));
+    return cc;
+}
+
 #else
 int FileMap::advise(MapAdvice /* advice */)
 {
     return -1;
 }
+
+int FileMap::advise(MapAdvice /* advice */, size_t /* offset */, size_t /* length */)
+{
+    return -1;
+}
+#endif
+
+FileMapRegion::FileMapRegion()
+    : mBasePtr(nullptr),
+      mLength(0),
+      mUsed(0)
+{
+}
+
+#if !defined(__MINGW32__)
+FileMapRegion::~FileMapRegion()
+{
+    if (mBasePtr && munmap(mBasePtr, mLength) != 0) {
+        ALOGD("munmap(%p, %zu) failed\n", mBasePtr, mLength);
+    }
+}
+
+bool FileMapRegion::reserve(size_t length)
+{
+    assert(mBasePtr == nullptr);
+
+    size_t reservedLength = roundUpToPage(length);
+    if (reservedLength < length) {
+        ALOGE("reserve(%zu) overflows", length);
+        return false;
+    }
+
+    void* ptr = mmap(nullptr, reservedLength, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        ALOGE("mmap(%zu) failed: %s\n", reservedLength, strerror(errno));
+        return false;
+    }
+    mBasePtr = ptr;
+    mLength = reservedLength;
+    mUsed = 0;
+    return true;
+}
+
+void* FileMapRegion::map(int fd, off64_t offset, size_t length, uint32_t createFlags)
+{
+    assert(fd >= 0);
+    assert(offset >= 0);
+
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t adjust = offset % pageSize;
+    off64_t adjOffset = offset - adjust;
+    size_t adjLength;
+    if (__builtin_add_overflow(length, adjust, &adjLength)) {
+        ALOGE("adjusted length overflow: length %zu adjust %zu", length, adjust);
+        return nullptr;
+    }
+    if (length == 0) {
+        // mmap() fails with EINVAL for an empty mapping; there is nothing to map.
+        return static_cast<char*>(mBasePtr) + mUsed;
+    }
+
+    // As in FileMap::create(), line large mappings up with huge pages if asked.
+    size_t start = mUsed;
+    if ((createFlags & FileMap::CREATE_HUGEPAGE) && adjLength >= kHugePageSize) {
+        uintptr_t base = reinterpret_cast<uintptr_t>(mBasePtr) + start;
+        start += (static_cast<uintptr_t>(adjOffset) - base) & (kHugePageSize - 1);
+    }
+    size_t mappedLength = roundUpToPage(adjLength);
+    if (mappedLength < adjLength || start > mLength || mappedLength > mLength - start) {
+        ALOGE("mapping %zu bytes doesn't fit in the %zu bytes left of the region\n", adjLength,
+              mLength - mUsed);
+        return nullptr;
+    }
+
+    int flags = MAP_SHARED | MAP_FIXED;
+#if defined(MAP_POPULATE)
+    if (createFlags & FileMap::CREATE_POPULATE) flags |= MAP_POPULATE;
+#endif
+    char* addr = static_cast<char*>(mBasePtr) + start;
+    void* ptr = mmap64(addr, adjLength, PROT_READ, flags, fd, adjOffset);
+    if (ptr == MAP_FAILED) {
+        ALOGE("mmap(%lld,%zu) failed: %s\n", (long long)adjOffset, adjLength, strerror(errno));
+        // A failed MAP_FIXED mapping can leave a hole; put the reservation back
+        // so that nothing else is mapped there before the region is destroyed.
+        mmap(addr, mappedLength, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+             -1, 0);
+        return nullptr;
+    }
+    adviseCreated(ptr, adjLength, createFlags);
+
+    mUsed = start + mappedLength;
+    return static_cast<char*>(ptr) + adjust;
+}
+
+#else
+FileMapRegion::~FileMapRegion()
+{
+}
+
+bool FileMapRegion::reserve(size_t /* length */)
+{
+    return false;
+}
+
+void* FileMapRegion::map(int /* fd */, off64_t /* offset */, size_t /* length */,
+                         uint32_t /* createFlags */)
+{
+    return nullptr;
+}
 #endif
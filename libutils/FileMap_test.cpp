@@ -16,6 +16,10 @@
 
 #include "utils/FileMap.h"
 
+#include <string.h>
+
+#include <string>
+
 #include <gtest/gtest.h>
 
 #include "android-base/file.h"
@@ -65,3 +69,87 @@ TEST(FileMap, offset_overflow) {
     android::FileMap m;
     ASSERT_FALSE(m.create("test", tf.fd, offset, length, true));
 }
+
+static std::string makeContents(size_t length) {
+    std::string contents(length, '\0');
+    for (size_t i = 0; i < length; i++) {
+        contents[i] = static_cast<char>(i * 7 + i / 4096);
+    }
+    return contents;
+}
+
+TEST(FileMap, create_flags) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    // Big enough to be placed for huge pages.
+    std::string contents = makeContents(3 * 1024 * 1024);
+    ASSERT_TRUE(android::base::WriteStringToFd(contents, tf.fd));
+
+    for (uint32_t flags : {0U, uint32_t(android::FileMap::CREATE_POPULATE),
+                           uint32_t(android::FileMap::CREATE_HUGEPAGE),
+                           uint32_t(android::FileMap::CREATE_WILLNEED),
+                           uint32_t(android::FileMap::CREATE_POPULATE |
+                                    android::FileMap::CREATE_HUGEPAGE |
+                                    android::FileMap::CREATE_WILLNEED)}) {
+        android::FileMap m;
+        ASSERT_TRUE(m.create("test", tf.fd, 100, contents.size() - 100, true, flags));
+        ASSERT_EQ(contents.size() - 100, m.getDataLength());
+        ASSERT_EQ(0, memcmp(contents.data() + 100, m.getDataPtr(), m.getDataLength()))
+                << "flags " << flags;
+        if (flags & android::FileMap::CREATE_HUGEPAGE) {
+            // The file offset of the start of the mapping is 0.
+            uintptr_t base = reinterpret_cast<uintptr_t>(m.getDataPtr()) - 100;
+            EXPECT_EQ(0u, base % (2 * 1024 * 1024));
+        }
+    }
+}
+
+TEST(FileMap, advise_range) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    std::string contents = makeContents(64 * 1024);
+    ASSERT_TRUE(android::base::WriteStringToFd(contents, tf.fd));
+
+    android::FileMap m;
+    ASSERT_TRUE(m.create("test", tf.fd, 10, contents.size() - 10, true));
+    EXPECT_EQ(0, m.advise(android::FileMap::WILLNEED, 5000, 10000));
+    EXPECT_EQ(0, m.advise(android::FileMap::RANDOM, 0, m.getDataLength()));
+    EXPECT_EQ(0, m.advise(android::FileMap::NORMAL, m.getDataLength(), 0));
+    EXPECT_EQ(-1, m.advise(android::FileMap::WILLNEED, 1, m.getDataLength()));
+    EXPECT_EQ(-1, m.advise(android::FileMap::WILLNEED, m.getDataLength() + 1, 0));
+}
+
+TEST(FileMap, region) {
+    TemporaryFile tf1;
+    TemporaryFile tf2;
+    ASSERT_TRUE(tf1.fd != -1);
+    ASSERT_TRUE(tf2.fd != -1);
+    std::string contents1 = makeContents(10000);
+    std::string contents2 = makeContents(3 * 1024 * 1024);
+    ASSERT_TRUE(android::base::WriteStringToFd(contents1, tf1.fd));
+    ASSERT_TRUE(android::base::WriteStringToFd(contents2, tf2.fd));
+
+    android::FileMapRegion region;
+    // Room for both files, with a gap of up to a huge page before the second.
+    ASSERT_TRUE(region.reserve(6 * 1024 * 1024));
+
+    char* data1 = static_cast<char*>(region.map(tf1.fd, 123, contents1.size() - 123));
+    ASSERT_NE(nullptr, data1);
+    EXPECT_EQ(0, memcmp(contents1.data() + 123, data1, contents1.size() - 123));
+
+    char* data2 = static_cast<char*>(
+            region.map(tf2.fd, 0, contents2.size(),
+                       android::FileMap::CREATE_HUGEPAGE | android::FileMap::CREATE_WILLNEED));
+    ASSERT_NE(nullptr, data2);
+    EXPECT_EQ(0, memcmp(contents2.data(), data2, contents2.size()));
+    EXPECT_LT(data1, data2);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(data2) % (2 * 1024 * 1024));
+    EXPECT_LE(region.getUsedLength(), region.getLength());
+
+    // Too big for what is left.
+    EXPECT_EQ(nullptr, region.map(tf2.fd, 0, contents2.size()));
+    EXPECT_EQ(nullptr, region.map(tf2.fd, 0, SIZE_MAX));
+
+    // Failing doesn't disturb what is already mapped.
+    EXPECT_EQ(0, memcmp(contents1.data() + 123, data1, contents1.size() - 123));
+}
@@ -20,6 +20,8 @@
  **/
 
 #include <stdlib.h>
+#include <string.h>
+
 #include <utils/JenkinsHash.h>
 
 namespace android {
@@ -34,15 +36,39 @@ hash_t JenkinsHashWhiten(uint32_t hash) {
     return hash;
 }
 
+// Little-endian loads, so that each word is the one the byte-at-a-time
+// definition builds, as a single (possibly unaligned) load.
+static inline uint32_t load32(const uint8_t* bytes) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32_t data;
+    memcpy(&data, bytes, sizeof(data));
+    return data;
+#else
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
+#endif
+}
+
+static inline uint64_t load64(const uint8_t* bytes) {
+    return load32(bytes) | (uint64_t(load32(bytes + 4)) << 32);
+}
+
+// Each mix depends on the one before, so the words can't be mixed in parallel:
+// the loops only read the input a 64-bit word at a time, which halves the loads
+// and the loop overhead around the chain of mixes.
 uint32_t JenkinsHashMixBytes(uint32_t hash, const uint8_t* bytes, size_t size) {
     if (size > UINT32_MAX) {
         abort();
     }
     hash = JenkinsHashMix(hash, (uint32_t)size);
-    size_t i;
-    for (i = 0; i < (size & -4); i += 4) {
-        uint32_t data = bytes[i] | (bytes[i+1] << 8) | (bytes[i+2] << 16) | (bytes[i+3] << 24);
-        hash = JenkinsHashMix(hash, data);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t data = load64(bytes + i);
+        hash = JenkinsHashMix(hash, (uint32_t)data);
+        hash = JenkinsHashMix(hash, (uint32_t)(data >> 32));
+    }
+    if (i + 4 <= size) {
+        hash = JenkinsHashMix(hash, load32(bytes + i));
+        i += 4;
     }
     if (size & 3) {
         uint32_t data = bytes[i];
@@ -58,8 +84,17 @@ uint32_t JenkinsHashMixShorts(uint32_t hash, const uint16_t* shorts, size_t size
         abort();
     }
     hash = JenkinsHashMix(hash, (uint32_t)size);
-    size_t i;
-    for (i = 0; i < (size & -2); i += 2) {
+    size_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Two shorts in memory order make the word shorts[i] | (shorts[i+1] << 16).
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(shorts);
+    for (; i + 4 <= size; i += 4) {
+        uint64_t data = load64(bytes + i * sizeof(uint16_t));
+        hash = JenkinsHashMix(hash, (uint32_t)data);
+        hash = JenkinsHashMix(hash, (uint32_t)(data >> 32));
+    }
+#endif
+    for (; i < (size & -2); i += 2) {
         uint32_t data = shorts[i] | (shorts[i+1] << 16);
         hash = JenkinsHashMix(hash, data);
     }
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <utils/FastHash.h>
+#include <utils/JenkinsHash.h>
+
+// Sizes from a glyph cache key up to a large bitmap row.
+#define HASH_SIZES Arg(8)->Arg(24)->Arg(64)->Arg(1024)->Arg(16384)
+
+static void BM_JenkinsHashMixBytes(benchmark::State& state) {
+    std::vector<uint8_t> bytes(state.range(0), 0x5a);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(android::JenkinsHashMixBytes(0, bytes.data(), bytes.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_JenkinsHashMixBytes)->HASH_SIZES;
+
+static void BM_JenkinsHashMixShorts(benchmark::State& state) {
+    std::vector<uint16_t> shorts(state.range(0) / sizeof(uint16_t), 0x5a5a);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(android::JenkinsHashMixShorts(0, shorts.data(), shorts.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * shorts.size() * sizeof(uint16_t));
+}
+BENCHMARK(BM_JenkinsHashMixShorts)->HASH_SIZES;
+
+static void BM_FastHashBytes(benchmark::State& state) {
+    std::vector<uint8_t> bytes(state.range(0), 0x5a);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(android::FastHashBytes(bytes.data(), bytes.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_FastHashBytes)->HASH_SIZES;
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <utils/FastHash.h>
+#include <utils/JenkinsHash.h>
+
+using namespace android;
+
+// The definitions of the Jenkins hashes, one element at a time.
+static uint32_t referenceMixBytes(uint32_t hash, const uint8_t* bytes, size_t size) {
+    hash = JenkinsHashMix(hash, (uint32_t)size);
+    size_t i;
+    for (i = 0; i < (size & -4); i += 4) {
+        uint32_t data = bytes[i] | (bytes[i+1] << 8) | (bytes[i+2] << 16) | (bytes[i+3] << 24);
+        hash = JenkinsHashMix(hash, data);
+    }
+    if (size & 3) {
+        uint32_t data = bytes[i];
+        data |= ((size & 3) > 1) ? (bytes[i+1] << 8) : 0;
+        data |= ((size & 3) > 2) ? (bytes[i+2] << 16) : 0;
+        hash = JenkinsHashMix(hash, data);
+    }
+    return hash;
+}
+
+static uint32_t referenceMixShorts(uint32_t hash, const uint16_t* shorts, size_t size) {
+    hash = JenkinsHashMix(hash, (uint32_t)size);
+    size_t i;
+    for (i = 0; i < (size & -2); i += 2) {
+        uint32_t data = shorts[i] | (shorts[i+1] << 16);
+        hash = JenkinsHashMix(hash, data);
+    }
+    if (size & 1) {
+        uint32_t data = shorts[i];
+        hash = JenkinsHashMix(hash, data);
+    }
+    return hash;
+}
+
+static std::vector<uint8_t> testBytes(size_t size) {
+    std::vector<uint8_t> bytes(size);
+    for (size_t i = 0; i < size; i++) {
+        bytes[i] = static_cast<uint8_t>(i * 37 + 11);
+    }
+    return bytes;
+}
+
+TEST(JenkinsHash, MixBytesMatchesDefinition) {
+    std::vector<uint8_t> bytes = testBytes(200);
+    // Every length and alignment of the 8 byte loads.
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t size = 0; size + offset <= bytes.size(); size++) {
+            EXPECT_EQ(referenceMixBytes(0x1234, bytes.data() + offset, size),
+                      JenkinsHashMixBytes(0x1234, bytes.data() + offset, size))
+                    << "offset " << offset << " size " << size;
+        }
+    }
+}
+
+TEST(JenkinsHash, MixShortsMatchesDefinition) {
+    std::vector<uint16_t> shorts(100);
+    for (size_t i = 0; i < shorts.size(); i++) {
+        shorts[i] = static_cast<uint16_t>(i * 40503 + 7);
+    }
+    for (size_t offset = 0; offset < 4; offset++) {
+        for (size_t size = 0; size + offset <= shorts.size(); size++) {
+            EXPECT_EQ(referenceMixShorts(0x1234, shorts.data() + offset, size),
+                      JenkinsHashMixShorts(0x1234, shorts.data() + offset, size))
+                    << "offset " << offset << " size " << size;
+        }
+    }
+}
+
+TEST(FastHash, EveryByteChangesHash) {
+    std::vector<uint8_t> bytes = testBytes(160);
+    for (size_t size = 1; size <= bytes.size(); size++) {
+        uint64_t hash = FastHashBytes(bytes.data(), size);
+        for (size_t i = 0; i < size; i++) {
+            bytes[i] ^= 1;
+            EXPECT_NE(hash, FastHashBytes(bytes.data(), size)) << "size " << size << " byte " << i;
+            bytes[i] ^= 1;
+        }
+    }
+}
+
+TEST(FastHash, SizeAndSeedChangeHash) {
+    std::vector<uint8_t> zeros(64, 0);
+    for (size_t size = 0; size < zeros.size(); size++) {
+        EXPECT_NE(FastHashBytes(zeros.data(), size), FastHashBytes(zeros.data(), size + 1));
+        EXPECT_NE(FastHashBytes(zeros.data(), size, 1), FastHashBytes(zeros.data(), size, 2));
+    }
+}
+
+TEST(FastHash, IndependentOfAlignment) {
+    std::vector<uint8_t> bytes = testBytes(100);
+    std::vector<uint8_t> buffer(bytes.size() + 8);
+    for (size_t offset = 0; offset < 8; offset++) {
+        memcpy(buffer.data() + offset, bytes.data(), bytes.size());
+        for (size_t size = 0; size <= bytes.size(); size++) {
+            EXPECT_EQ(FastHashBytes(bytes.data(), size),
+                      FastHashBytes(buffer.data() + offset, size));
+        }
+    }
+}
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LockProfiler"
+
+#include <utils/LockProfiler.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <dlfcn.h>
+#endif
+
+#include <cutils/properties.h>
+#include <cutils/threads.h>
+#include <utils/Printer.h>
+#include <utils/Timers.h>
+#include <utils/misc.h>
+
+namespace android {
+
+#if !defined(_WIN32)
+
+namespace lock_profiler {
+std::atomic<bool> gEnabled{false};
+}  // namespace lock_profiler
+
+// The profiler's own state is guarded by std::mutex, never by android::Mutex,
+// so that recording contention can't itself be profiled.
+namespace {
+
+constexpr const char* kEnableProperty = "debug.libutils.lock_profiling";
+
+// Enabled if either the property or setLockProfilingEnabled() says so, so that
+// an unrelated property change doesn't undo an explicit request.
+std::mutex gEnableLock;
+bool gEnabledByProperty = false;
+bool gEnabledByCaller = false;
+
+void updateEnabled() {
+    lock_profiler::gEnabled.store(gEnabledByProperty || gEnabledByCaller,
+                                  std::memory_order_relaxed);
+}
+
+}  // namespace
+
+void setLockProfilingEnabled(bool enabled) {
+    std::lock_guard<std::mutex> guard(gEnableLock);
+    gEnabledByCaller = enabled;
+    updateEnabled();
+}
+
+namespace {
+
+// Contended acquisitions each thread keeps. Older ones are overwritten.
+constexpr size_t kRecordsPerThread = 256;
+
+// Records kept from threads that have exited.
+constexpr size_t kMaxRetiredRecords = 4096;
+
+// The last thread to take each lock, indexed by a hash of the lock's address.
+// Locks that collide share a slot, so the holder is only a hint.
+constexpr size_t kHolderSlots = 1024;
+
+enum class LockKind : uint8_t { kMutex, kRead, kWrite };
+
+struct ContentionRecord {
+    const void* lock;
+    const void* site;
+    pid_t holder;
+    LockKind kind;
+    nsecs_t waitNs;
+};
+
+struct ThreadRecords {
+    // Only ever contended by dumpLockContention() and resetLockContention().
+    std::mutex lock;
+    size_t count = 0;
+    ContentionRecord records[kRecordsPerThread];
+};
+
+struct Registry {
+    std::mutex lock;
+    std::vector<ThreadRecords*> threads;
+    std::vector<ContentionRecord> retired;
+    size_t nextRetired = 0;
+};
+
+// Leaked so that threads exiting during process teardown can still retire
+// their records.
+Registry& registry() {
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+std::atomic<pid_t> gHolders[kHolderSlots];
+
+std::atomic<pid_t>& holderSlot(const void* lock) {
+    return gHolders[(reinterpret_cast<uintptr_t>(lock) >> 4) % kHolderSlots];
+}
+
+// Owns the calling thread's records and hands them to the registry when the
+// thread exits.
+class ThreadRecordsOwner {
+  public:
+    ~ThreadRecordsOwner() {
+        if (mRecords == nullptr) return;
+
+        Registry& r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        r.threads.erase(std::find(r.threads.begin(), r.threads.end(), mRecords));
+        size_t n = std::min(mRecords->count, kRecordsPerThread);
+        for (size_t i = 0; i < n; i++) {
+            if (r.retired.size() < kMaxRetiredRecords) {
+                r.retired.push_back(mRecords->records[i]);
+            } else {
+                r.retired[r.nextRetired] = mRecords->records[i];
+                r.nextRetired = (r.nextRetired + 1) % kMaxRetiredRecords;
+            }
+        }
+        delete mRecords;
+        mRecords = nullptr;
+    }
+
+    ThreadRecords* get() {
+        if (mRecords == nullptr) {
+            mRecords = new ThreadRecords;
+            Registry& r = registry();
+            std::lock_guard<std::mutex> guard(r.lock);
+            r.threads.push_back(mRecords);
+        }
+        return mRecords;
+    }
+
+  private:
+    ThreadRecords* mRecords = nullptr;
+};
+
+thread_local ThreadRecordsOwner tRecords;
+thread_local pid_t tTid = 0;
+
+pid_t currentTid() {
+    if (tTid == 0) tTid = gettid();
+    return tTid;
+}
+
+void record(const void* lock, const void* site, LockKind kind, pid_t holder, nsecs_t waitNs) {
+    ThreadRecords* records = tRecords.get();
+    std::lock_guard<std::mutex> guard(records->lock);
+    records->records[records->count++ % kRecordsPerThread] = {lock, site, holder, kind, waitNs};
+}
+
+// Tries the lock first, so that only acquisitions that actually have to wait
+// pay for the clock reads and get recorded.
+template <typename TryLock, typename Lock>
+int profiledLock(const void* lock, const void* site, LockKind kind, TryLock tryLock,
+                 Lock blockingLock) {
+    int err = tryLock();
+    if (err == EBUSY) {
+        pid_t holder = holderSlot(lock).load(std::memory_order_relaxed);
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        err = blockingLock();
+        if (err == 0) {
+            record(lock, site, kind, holder, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+        }
+    }
+    if (err == 0) {
+        holderSlot(lock).store(currentTid(), std::memory_order_relaxed);
+    }
+    return err;
+}
+
+const char* kindName(LockKind kind) {
+    switch (kind) {
+        case LockKind::kMutex:
+            return "mutex";
+        case LockKind::kRead:
+            return "rwlock(read)";
+        case LockKind::kWrite:
+            return "rwlock(write)";
+    }
+    return "?";
+}
+
+std::string describeSite(const void* site) {
+    Dl_info info;
+    if (dladdr(site, &info) == 0 || info.dli_fname == nullptr) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%p", site);
+        return buf;
+    }
+    const char* name = strrchr(info.dli_fname, '/');
+    name = name ? name + 1 : info.dli_fname;
+    char buf[512];
+    uintptr_t offset =
+            reinterpret_cast<uintptr_t>(site) - reinterpret_cast<uintptr_t>(info.dli_fbase);
+    if (info.dli_sname != nullptr) {
+        uintptr_t symOffset =
+                reinterpret_cast<uintptr_t>(site) - reinterpret_cast<uintptr_t>(info.dli_saddr);
+        snprintf(buf, sizeof(buf), "%s+0x%zx (%s+0x%zx)", name, static_cast<size_t>(offset),
+                 info.dli_sname, static_cast<size_t>(symOffset));
+    } else {
+        snprintf(buf, sizeof(buf), "%s+0x%zx", name, static_cast<size_t>(offset));
+    }
+    return buf;
+}
+
+void collectRecords(std::vector<ContentionRecord>* out) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    *out = r.retired;
+    for (ThreadRecords* records : r.threads) {
+        std::lock_guard<std::mutex> threadGuard(records->lock);
+        size_t n = std::min(records->count, kRecordsPerThread);
+        out->insert(out->end(), records->records, records->records + n);
+    }
+}
+
+void updateFromProperty() {
+    std::lock_guard<std::mutex> guard(gEnableLock);
+    gEnabledByProperty = property_get_bool(kEnableProperty, false);
+    updateEnabled();
+}
+
+__attribute__((constructor)) void lockProfilerInit() {
+    updateFromProperty();
+    add_sysprop_change_callback(updateFromProperty, 0);
+}
+
+}  // namespace
+
+namespace lock_profiler {
+
+int lockMutex(pthread_mutex_t* mutex) {
+    return profiledLock(
+            mutex, __builtin_return_address(0), LockKind::kMutex,
+            [mutex] { return pthread_mutex_trylock(mutex); },
+            [mutex] { return pthread_mutex_lock(mutex); });
+}
+
+int readLock(pthread_rwlock_t* rwlock) {
+    return profiledLock(
+            rwlock, __builtin_return_address(0), LockKind::kRead,
+            [rwlock] { return pthread_rwlock_tryrdlock(rwlock); },
+            [rwlock] { return pthread_rwlock_rdlock(rwlock); });
+}
+
+int writeLock(pthread_rwlock_t* rwlock) {
+    return profiledLock(
+            rwlock, __builtin_return_address(0), LockKind::kWrite,
+            [rwlock] { return pthread_rwlock_trywrlock(rwlock); },
+            [rwlock] { return pthread_rwlock_wrlock(rwlock); });
+}
+
+}  // namespace lock_profiler
+
+void dumpLockContention(Printer& printer, size_t maxEntries) {
+    std::vector<ContentionRecord> records;
+    collectRecords(&records);
+
+    struct SiteStats {
+        size_t count = 0;
+        nsecs_t totalNs = 0;
+        nsecs_t maxNs = 0;
+        pid_t lastHolder = 0;
+    };
+    std::map<std::tuple<const void*, const void*, LockKind>, SiteStats> sites;
+    for (const auto& record : records) {
+        SiteStats& stats = sites[std::make_tuple(record.lock, record.site, record.kind)];
+        stats.count++;
+        stats.totalNs += record.waitNs;
+        stats.maxNs = std::max(stats.maxNs, record.waitNs);
+        stats.lastHolder = record.holder;
+    }
+
+    std::vector<std::pair<std::tuple<const void*, const void*, LockKind>, SiteStats>> sorted(
+            sites.begin(), sites.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second.totalNs > b.second.totalNs;
+    });
+
+    printer.printFormatLine("Lock contention (%s): %zu recent waits at %zu sites",
+                            isLockProfilingEnabled() ? "enabled" : "disabled", records.size(),
+                            sorted.size());
+    for (size_t i = 0; i < sorted.size() && i < maxEntries; i++) {
+        const void* lock = std::get<0>(sorted[i].first);
+        const void* site = std::get<1>(sorted[i].first);
+        LockKind kind = std::get<2>(sorted[i].first);
+        const SiteStats& stats = sorted[i].second;
+        printer.printFormatLine(
+                "  %s %p: %zu waits, %.3f ms total, %.3f ms max, last holder tid %d, at %s",
+                kindName(kind), lock, stats.count, stats.totalNs / 1e6, stats.maxNs / 1e6,
+                stats.lastHolder, describeSite(site).c_str());
+    }
+}
+
+void resetLockContention() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.retired.clear();
+    r.nextRetired = 0;
+    for (ThreadRecords* records : r.threads) {
+        std::lock_guard<std::mutex> threadGuard(records->lock);
+        records->count = 0;
+    }
+}
+
+#else  // defined(_WIN32)
+
+void setLockProfilingEnabled(bool) {}
+
+void dumpLockContention(Printer& printer, size_t) {
+    printer.printLine("Lock contention profiling is not supported.");
+}
+
+void resetLockContention() {}
+
+#endif  // !defined(_WIN32)
+
+}  // namespace android
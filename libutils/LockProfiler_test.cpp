@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include <future>
+#include <thread>
+
+#include <gtest/gtest.h>
+#include <utils/LockProfiler.h>
+#include <utils/Mutex.h>
+#include <utils/Printer.h>
+#include <utils/RWLock.h>
+#include <utils/String8.h>
+
+using namespace android;
+
+class LockProfilerTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        setLockProfilingEnabled(true);
+        resetLockContention();
+    }
+    void TearDown() override { setLockProfilingEnabled(false); }
+
+    String8 dump() {
+        String8 out;
+        String8Printer printer(&out);
+        dumpLockContention(printer);
+        return out;
+    }
+};
+
+// Holds |lock| on another thread until |release| is ready, and returns once
+// the lock is held.
+template <typename Lock, typename Acquire>
+static std::thread holdLock(Lock& lock, Acquire acquire, std::future<void> release) {
+    std::promise<void> held;
+    auto heldFuture = held.get_future();
+    std::thread holder([&lock, acquire, &held, release = std::move(release)]() mutable {
+        acquire(lock);
+        held.set_value();
+        release.wait();
+        lock.unlock();
+    });
+    heldFuture.wait();
+    return holder;
+}
+
+TEST_F(LockProfilerTest, uncontendedIsNotRecorded) {
+    Mutex mutex;
+    for (int i = 0; i < 10; i++) {
+        Mutex::Autolock _l(mutex);
+    }
+    EXPECT_NE(-1, dump().find("0 recent waits at 0 sites"));
+}
+
+TEST_F(LockProfilerTest, contendedMutex) {
+    Mutex mutex;
+    std::promise<void> release;
+    std::thread holder = holdLock(
+            mutex, [](Mutex& m) { m.lock(); }, release.get_future());
+
+    std::thread releaser([&release] {
+        usleep(20000);
+        release.set_value();
+    });
+    ASSERT_EQ(NO_ERROR, mutex.lock());
+    mutex.unlock();
+    holder.join();
+    releaser.join();
+
+    String8 out = dump();
+    EXPECT_NE(-1, out.find("1 recent waits at 1 sites")) << out;
+    EXPECT_NE(-1, out.find("mutex ")) << out;
+    EXPECT_NE(-1, out.find("1 waits")) << out;
+}
+
+TEST_F(LockProfilerTest, contendedRWLock) {
+    RWLock rwlock;
+    std::promise<void> release;
+    std::thread holder = holdLock(
+            rwlock, [](RWLock& l) { l.writeLock(); }, release.get_future());
+
+    std::thread releaser([&release] {
+        usleep(20000);
+        release.set_value();
+    });
+    ASSERT_EQ(NO_ERROR, rwlock.readLock());
+    rwlock.unlock();
+    holder.join();
+    releaser.join();
+
+    String8 out = dump();
+    EXPECT_NE(-1, out.find("rwlock(read)")) << out;
+}
+
+TEST_F(LockProfilerTest, survivesThreadExit) {
+    Mutex mutex;
+    mutex.lock();
+    std::thread waiter([&mutex] {
+        mutex.lock();
+        mutex.unlock();
+    });
+    usleep(20000);
+    mutex.unlock();
+    waiter.join();
+
+    EXPECT_NE(-1, dump().find("1 waits")) << dump();
+}
+
+TEST_F(LockProfilerTest, reset) {
+    Mutex mutex;
+    mutex.lock();
+    std::thread waiter([&mutex] {
+        mutex.lock();
+        mutex.unlock();
+    });
+    usleep(20000);
+    mutex.unlock();
+    waiter.join();
+
+    resetLockContention();
+    EXPECT_NE(-1, dump().find("0 recent waits at 0 sites"));
+}
+
+TEST_F(LockProfilerTest, disabledIsNotRecorded) {
+    setLockProfilingEnabled(false);
+    Mutex mutex;
+    mutex.lock();
+    std::thread waiter([&mutex] {
+        mutex.lock();
+        mutex.unlock();
+    });
+    usleep(20000);
+    mutex.unlock();
+    waiter.join();
+
+    EXPECT_NE(-1, dump().find("0 recent waits at 0 sites"));
+}
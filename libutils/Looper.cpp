@@ -14,20 +14,68 @@
 #define DEBUG_CALLBACKS 0
 
 #include <utils/Looper.h>
+#include <utils/SystemClock.h>
 
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <algorithm>
 #include <cinttypes>
 
 namespace android {
 
 namespace {
 
+constexpr uint64_t TIMER_FD_SEQ = 0;
 constexpr uint64_t WAKE_EVENT_FD_SEQ = 1;
 
 epoll_event createEpollEvent(uint32_t events, uint64_t seq) {
     return {.events = events, .data = {.u64 = seq}};
 }
 
+// Heap comparator for the message queue: the earliest message, and the first one
+// sent among those with the same uptime, ends up at the front.
+template <typename MessageEnvelope>
+bool isLaterMessage(const MessageEnvelope& a, const MessageEnvelope& b) {
+    if (a.uptime != b.uptime) return a.uptime > b.uptime;
+    return a.seq > b.seq;
+}
+
+constexpr uint32_t kEmptySlot = UINT32_MAX;
+constexpr size_t kMinRequestSlots = 16;
+
+// Fibonacci hashing, so that consecutive sequence numbers and fds spread out
+// over the table.  |slots| is a power of two.
+size_t hashSlot(uint64_t key, size_t slots) {
+    return (key * 0x9e3779b97f4a7c15ULL) >> (64 - __builtin_ctzll(slots));
+}
+
+template <typename Slots, typename K>
+size_t findSlot(const Slots& slots, K key) {
+    const size_t mask = slots.size() - 1;
+    size_t i = hashSlot(static_cast<uint64_t>(key), slots.size());
+    while (slots[i].index != kEmptySlot && slots[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Empties slot |i|, shifting later entries of its probe run back so that
+// lookups never have to skip over tombstones.
+template <typename Slots>
+void eraseSlot(Slots& slots, size_t i) {
+    const size_t mask = slots.size() - 1;
+    for (size_t j = (i + 1) & mask; slots[j].index != kEmptySlot; j = (j + 1) & mask) {
+        size_t home = hashSlot(static_cast<uint64_t>(slots[j].key), slots.size());
+        // Leave the entry where it is if its home slot lies cyclically in (i, j].
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+            continue;
+        }
+        slots[i] = slots[j];
+        i = j;
+    }
+    slots[i].index = kEmptySlot;
+}
+
 }  // namespace
 
 // --- WeakMessageHandler ---
@@ -61,9 +109,72 @@ int SimpleLooperCallback::handleEvent(int fd, int events, void* data) {
 }
 
 
+// --- Looper::RequestTable ---
+
+const Looper::Request* Looper::RequestTable::find(SequenceNumber seq) const {
+    if (mEntries.empty()) return nullptr;
+    const auto& slot = mSeqSlots[findSlot(mSeqSlots, seq)];
+    return slot.index != kEmptySlot ? &mEntries[slot.index].request : nullptr;
+}
+
+bool Looper::RequestTable::findSequenceNumber(int fd, SequenceNumber* outSeq) const {
+    if (mEntries.empty()) return false;
+    const auto& slot = mFdSlots[findSlot(mFdSlots, fd)];
+    if (slot.index == kEmptySlot) return false;
+    *outSeq = mEntries[slot.index].seq;
+    return true;
+}
+
+void Looper::RequestTable::insert(SequenceNumber seq, const Request& request) {
+    // Keep the tables at most half full so that probe runs stay short.
+    if ((mEntries.size() + 1) * 2 > mSeqSlots.size()) {
+        grow();
+    }
+    const uint32_t index = mEntries.size();
+    mEntries.push_back({.seq = seq, .request = request});
+    mSeqSlots[findSlot(mSeqSlots, seq)] = {.key = seq, .index = index};
+    mFdSlots[findSlot(mFdSlots, request.fd)] = {.key = request.fd, .index = index};
+}
+
+bool Looper::RequestTable::erase(SequenceNumber seq, int* outFd) {
+    if (mEntries.empty()) return false;
+    const size_t seqSlot = findSlot(mSeqSlots, seq);
+    const uint32_t index = mSeqSlots[seqSlot].index;
+    if (index == kEmptySlot) return false;
+
+    const int fd = mEntries[index].request.fd;
+    eraseSlot(mSeqSlots, seqSlot);
+    eraseSlot(mFdSlots, findSlot(mFdSlots, fd));
+
+    // Move the last entry into the hole to keep the entries dense.
+    const uint32_t last = mEntries.size() - 1;
+    if (index != last) {
+        mEntries[index] = std::move(mEntries[last]);
+        mSeqSlots[findSlot(mSeqSlots, mEntries[index].seq)].index = index;
+        mFdSlots[findSlot(mFdSlots, mEntries[index].request.fd)].index = index;
+    }
+    mEntries.pop_back();
+
+    *outFd = fd;
+    return true;
+}
+
+void Looper::RequestTable::grow() {
+    const size_t slots = std::max(kMinRequestSlots, mSeqSlots.size() * 2);
+    mSeqSlots.assign(slots, {.key = 0, .index = kEmptySlot});
+    mFdSlots.assign(slots, {.key = -1, .index = kEmptySlot});
+    for (uint32_t i = 0; i < mEntries.size(); i++) {
+        const Entry& entry = mEntries[i];
+        mSeqSlots[findSlot(mSeqSlots, entry.seq)] = {.key = entry.seq, .index = i};
+        mFdSlots[findSlot(mFdSlots, entry.request.fd)] = {.key = entry.request.fd, .index = i};
+    }
+    mEntries.reserve(slots / 2);
+}
+
+
 // --- Looper ---
 
-// Maximum number of file descriptors for which to retrieve poll events each iteration.
+// Default maximum number of file descriptors for which to retrieve poll events each iteration.
 static const int EPOLL_MAX_EVENTS = 16;
 
 static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
@@ -71,12 +182,18 @@ static pthread_key_t gTLSKey = 0;
 
 Looper::Looper(bool allowNonCallbacks)
     : mAllowNonCallbacks(allowNonCallbacks),
+      mNextMessageSeq(0),
+      mCancelledMessageCount(0),
       mSendingMessage(false),
       mPolling(false),
       mEpollRebuildRequired(false),
       mNextRequestSeq(WAKE_EVENT_FD_SEQ + 1),
       mResponseIndex(0),
-      mNextMessageUptime(LLONG_MAX) {
+      mNextMessageUptime(LLONG_MAX),
+      mEventItems(EPOLL_MAX_EVENTS),
+      mBusyPollDuration(0),
+      mTimerDeadline(LLONG_MAX) {
+    mResponses.reserve(EPOLL_MAX_EVENTS);
     mWakeEventFd.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
     LOG_ALWAYS_FATAL_IF(mWakeEventFd.get() < 0, "Could not make wake event fd: %s", strerror(errno));
 
@@ -157,6 +274,13 @@ void Looper::rebuildEpollLocked() {
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake event fd to epoll instance: %s",
                         strerror(errno));
 
+    if (mTimerFd >= 0) {
+        epoll_event timerEvent = createEpollEvent(EPOLLIN, TIMER_FD_SEQ);
+        result = epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, mTimerFd.get(), &timerEvent);
+        LOG_ALWAYS_FATAL_IF(result != 0, "Could not add timer fd to epoll instance: %s",
+                            strerror(errno));
+    }
+
     for (const auto& [seq, request] : mRequests) {
         epoll_event eventItem = createEpollEvent(request.getEpollEvents(), seq);
 
@@ -182,7 +306,7 @@ int Looper::pollOnce(int timeoutMillis, int* outFd, int* outEvents, void** outDa
     int result = 0;
     for (;;) {
         while (mResponseIndex < mResponses.size()) {
-            const Response& response = mResponses.itemAt(mResponseIndex++);
+            const Response& response = mResponses[mResponseIndex++];
             int ident = response.request.ident;
             if (ident >= 0) {
                 int fd = response.request.fd;
@@ -220,12 +344,18 @@ int Looper::pollInner(int timeoutMillis) {
 #endif
 
     // Adjust the timeout based on when the next message is due.
+    nsecs_t timerDeadline = LLONG_MAX;
     if (timeoutMillis != 0 && mNextMessageUptime != LLONG_MAX) {
-        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t now = uptimeNanosInline();
         int messageTimeoutMillis = toMillisecondTimeoutDelay(now, mNextMessageUptime);
         if (messageTimeoutMillis >= 0
                 && (timeoutMillis < 0 || messageTimeoutMillis < timeoutMillis)) {
-            timeoutMillis = messageTimeoutMillis;
+            if (mTimerFd >= 0 && messageTimeoutMillis > 0) {
+                // The timer fd wakes us up when the message is due.
+                timerDeadline = mNextMessageUptime;
+            } else {
+                timeoutMillis = messageTimeoutMillis;
+            }
         }
 #if DEBUG_POLL_AND_WAKE
         ALOGD("%p ~ pollOnce - next message in %" PRId64 "ns, adjusted timeout: timeoutMillis=%d",
@@ -236,13 +366,18 @@ int Looper::pollInner(int timeoutMillis) {
     // Poll.
     int result = POLL_WAKE;
     mResponses.clear();
+    mResponses.reserve(mEventItems.size());
     mResponseIndex = 0;
 
+    if (mTimerFd >= 0) {
+        armTimer(timerDeadline);
+    }
+
     // We are about to idle.
     mPolling = true;
 
-    struct epoll_event eventItems[EPOLL_MAX_EVENTS];
-    int eventCount = epoll_wait(mEpollFd.get(), eventItems, EPOLL_MAX_EVENTS, timeoutMillis);
+    const epoll_event* eventItems = mEventItems.data();
+    int eventCount = waitForEvents(timeoutMillis);
 
     // No longer idling.
     mPolling = false;
@@ -290,16 +425,22 @@ int Looper::pollInner(int timeoutMillis) {
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x on wake event fd.", epollEvents);
             }
+        } else if (seq == TIMER_FD_SEQ) {
+            uint64_t expirations;
+            TEMP_FAILURE_RETRY(read(mTimerFd.get(), &expirations, sizeof(uint64_t)));
+            mTimerDeadline = LLONG_MAX;
+            // Report the timer on its own the same way as an epoll_wait timeout.
+            if (eventCount == 1) {
+                result = POLL_TIMEOUT;
+            }
         } else {
-            const auto& request_it = mRequests.find(seq);
-            if (request_it != mRequests.end()) {
-                const auto& request = request_it->second;
+            if (const Request* request = mRequests.find(seq)) {
                 int events = 0;
                 if (epollEvents & EPOLLIN) events |= EVENT_INPUT;
                 if (epollEvents & EPOLLOUT) events |= EVENT_OUTPUT;
                 if (epollEvents & EPOLLERR) events |= EVENT_ERROR;
                 if (epollEvents & EPOLLHUP) events |= EVENT_HANGUP;
-                mResponses.push({.seq = seq, .events = events, .request = request});
+                mResponses.push_back({.seq = seq, .events = events, .request = *request});
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x for sequence number %" PRIu64
                       " that is no longer registered.",
@@ -311,18 +452,21 @@ Done: ;
 
     // Invoke pending message callbacks.
     mNextMessageUptime = LLONG_MAX;
-    while (mMessageEnvelopes.size() != 0) {
-        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-        const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(0);
+    while (!mMessageEnvelopes.empty()) {
+        nsecs_t now = uptimeNanosInline();
+        const MessageEnvelope& messageEnvelope = mMessageEnvelopes.front();
         if (messageEnvelope.uptime <= now) {
-            // Remove the envelope from the list.
+            // Remove the envelope from the queue.
             // We keep a strong reference to the handler until the call to handleMessage
             // finishes.  Then we drop it so that the handler can be deleted *before*
             // we reacquire our lock.
             { // obtain handler
                 sp<MessageHandler> handler = messageEnvelope.handler;
                 Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                std::pop_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                              isLaterMessage<MessageEnvelope>);
+                mMessageEnvelopes.pop_back();
+                popCancelledMessagesLocked();
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -348,7 +492,7 @@ Done: ;
 
     // Invoke all response callbacks.
     for (size_t i = 0; i < mResponses.size(); i++) {
-        Response& response = mResponses.editItemAt(i);
+        Response& response = mResponses[i];
         if (response.request.ident == POLL_CALLBACK) {
             int fd = response.request.fd;
             int events = response.events;
@@ -375,6 +519,46 @@ Done: ;
     return result;
 }
 
+int Looper::waitForEvents(int timeoutMillis) {
+    const int maxEvents = mEventItems.size();
+    if (mBusyPollDuration > 0 && timeoutMillis != 0) {
+        const nsecs_t start = uptimeNanosInline();
+        const nsecs_t timeoutTime = timeoutMillis > 0 ? start + ms2ns(timeoutMillis) : LLONG_MAX;
+        const nsecs_t spinEnd = std::min(start + mBusyPollDuration, timeoutTime);
+        nsecs_t now;
+        do {
+            int eventCount = epoll_wait(mEpollFd.get(), mEventItems.data(), maxEvents, 0);
+            if (eventCount != 0) {
+                return eventCount;
+            }
+            now = uptimeNanosInline();
+        } while (now < spinEnd);
+
+        if (timeoutMillis > 0) {
+            timeoutMillis = toMillisecondTimeoutDelay(now, timeoutTime);
+        }
+    }
+    return epoll_wait(mEpollFd.get(), mEventItems.data(), maxEvents, timeoutMillis);
+}
+
+void Looper::armTimer(nsecs_t deadline) {
+    if (deadline == mTimerDeadline) {
+        return;
+    }
+
+    // A zero it_value disarms the timer.
+    itimerspec spec = {};
+    if (deadline != LLONG_MAX) {
+        spec.it_value.tv_sec = deadline / 1000000000LL;
+        spec.it_value.tv_nsec = deadline % 1000000000LL;
+    }
+    if (timerfd_settime(mTimerFd.get(), TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        ALOGE("Could not set timer fd: %s", strerror(errno));
+        return;
+    }
+    mTimerDeadline = deadline;
+}
+
 int Looper::pollAll(int timeoutMillis, int* outFd, int* outEvents, void** outData) {
     if (timeoutMillis <= 0) {
         int result;
@@ -383,7 +567,7 @@ int Looper::pollAll(int timeoutMillis, int* outFd, int* outEvents, void** outDat
         } while (result == POLL_CALLBACK);
         return result;
     } else {
-        nsecs_t endTime = systemTime(SYSTEM_TIME_MONOTONIC)
+        nsecs_t endTime = uptimeNanosInline()
                 + milliseconds_to_nanoseconds(timeoutMillis);
 
         for (;;) {
@@ -392,7 +576,7 @@ int Looper::pollAll(int timeoutMillis, int* outFd, int* outEvents, void** outDat
                 return result;
             }
 
-            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            nsecs_t now = uptimeNanosInline();
             timeoutMillis = toMillisecondTimeoutDelay(now, endTime);
             if (timeoutMillis == 0) {
                 return POLL_TIMEOUT;
@@ -455,8 +639,8 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
 
     { // acquire lock
         AutoMutex _l(mLock);
-        // There is a sequence number reserved for the WakeEventFd.
-        if (mNextRequestSeq == WAKE_EVENT_FD_SEQ) mNextRequestSeq++;
+        // There are sequence numbers reserved for the WakeEventFd and the TimerFd.
+        if (mNextRequestSeq <= WAKE_EVENT_FD_SEQ) mNextRequestSeq = WAKE_EVENT_FD_SEQ + 1;
         const SequenceNumber seq = mNextRequestSeq++;
 
         Request request;
@@ -467,15 +651,14 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
         request.data = data;
 
         epoll_event eventItem = createEpollEvent(request.getEpollEvents(), seq);
-        auto seq_it = mSequenceNumberByFd.find(fd);
-        if (seq_it == mSequenceNumberByFd.end()) {
+        SequenceNumber oldSeq;
+        if (!mRequests.findSequenceNumber(fd, &oldSeq)) {
             int epollResult = epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, fd, &eventItem);
             if (epollResult < 0) {
                 ALOGE("Error adding epoll events for fd %d: %s", fd, strerror(errno));
                 return -1;
             }
-            mRequests.emplace(seq, request);
-            mSequenceNumberByFd.emplace(fd, seq);
+            mRequests.insert(seq, request);
         } else {
             int epollResult = epoll_ctl(mEpollFd.get(), EPOLL_CTL_MOD, fd, &eventItem);
             if (epollResult < 0) {
@@ -510,10 +693,9 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
                     return -1;
                 }
             }
-            const SequenceNumber oldSeq = seq_it->second;
-            mRequests.erase(oldSeq);
-            mRequests.emplace(seq, request);
-            seq_it->second = seq;
+            int oldFd;
+            mRequests.erase(oldSeq, &oldFd);
+            mRequests.insert(seq, request);
         }
     } // release lock
     return 1;
@@ -521,11 +703,11 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
 
 int Looper::removeFd(int fd) {
     AutoMutex _l(mLock);
-    const auto& it = mSequenceNumberByFd.find(fd);
-    if (it == mSequenceNumberByFd.end()) {
+    SequenceNumber seq;
+    if (!mRequests.findSequenceNumber(fd, &seq)) {
         return 0;
     }
-    return removeSequenceNumberLocked(it->second);
+    return removeSequenceNumberLocked(seq);
 }
 
 int Looper::removeSequenceNumberLocked(SequenceNumber seq) {
@@ -533,16 +715,12 @@ int Looper::removeSequenceNumberLocked(SequenceNumber seq) {
     ALOGD("%p ~ removeFd - fd=%d, seq=%u", this, fd, seq);
 #endif
 
-    const auto& request_it = mRequests.find(seq);
-    if (request_it == mRequests.end()) {
+    // Always remove the FD from the request table even if an error occurs while
+    // updating the epoll set so that we avoid accidentally leaking callbacks.
+    int fd;
+    if (!mRequests.erase(seq, &fd)) {
         return 0;
     }
-    const int fd = request_it->second.fd;
-
-    // Always remove the FD from the request map even if an error occurs while
-    // updating the epoll set so that we avoid accidentally leaking callbacks.
-    mRequests.erase(request_it);
-    mSequenceNumberByFd.erase(fd);
 
     int epollResult = epoll_ctl(mEpollFd.get(), EPOLL_CTL_DEL, fd, nullptr);
     if (epollResult < 0) {
@@ -577,13 +755,13 @@ int Looper::removeSequenceNumberLocked(SequenceNumber seq) {
 }
 
 void Looper::sendMessage(const sp<MessageHandler>& handler, const Message& message) {
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t now = uptimeNanosInline();
     sendMessageAtTime(now, handler, message);
 }
 
 void Looper::sendMessageDelayed(nsecs_t uptimeDelay, const sp<MessageHandler>& handler,
         const Message& message) {
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t now = uptimeNanosInline();
     sendMessageAtTime(now + uptimeDelay, handler, message);
 }
 
@@ -594,17 +772,15 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
             this, uptime, handler.get(), message.what);
 #endif
 
-    size_t i = 0;
+    bool atHead;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
-
-        MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        const uint64_t seq = mNextMessageSeq++;
+        mMessageEnvelopes.emplace_back(uptime, seq, handler, message);
+        std::push_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                       isLaterMessage<MessageEnvelope>);
+        atHead = mMessageEnvelopes.front().seq == seq;
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
@@ -616,7 +792,7 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
     } // release lock
 
     // Wake the poll loop only when we enqueue a new message at the head.
-    if (i == 0) {
+    if (atHead) {
         wake();
     }
 }
@@ -629,12 +805,9 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        removeMessagesLocked([&handler](const MessageEnvelope& messageEnvelope) {
+            return messageEnvelope.handler == handler;
+        });
     } // release lock
 }
 
@@ -646,20 +819,90 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler
-                    && messageEnvelope.message.what == what) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        removeMessagesLocked([&handler, what](const MessageEnvelope& messageEnvelope) {
+            return messageEnvelope.handler == handler && messageEnvelope.message.what == what;
+        });
     } // release lock
 }
 
+// Cancelled messages stay in the heap with their handler cleared, since taking
+// them out of the middle would break the heap order.  They are dropped when they
+// reach the head, or all at once when they make up more than half of the queue.
+template <typename Predicate>
+void Looper::removeMessagesLocked(Predicate predicate) {
+    for (MessageEnvelope& messageEnvelope : mMessageEnvelopes) {
+        if (messageEnvelope.handler != nullptr && predicate(messageEnvelope)) {
+            messageEnvelope.handler.clear();
+            mCancelledMessageCount++;
+        }
+    }
+    popCancelledMessagesLocked();
+
+    if (mCancelledMessageCount > mMessageEnvelopes.size() / 2) {
+        auto end = std::remove_if(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                                  [](const MessageEnvelope& messageEnvelope) {
+                                      return messageEnvelope.handler == nullptr;
+                                  });
+        mMessageEnvelopes.erase(end, mMessageEnvelopes.end());
+        std::make_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                       isLaterMessage<MessageEnvelope>);
+        mCancelledMessageCount = 0;
+    }
+}
+
+void Looper::popCancelledMessagesLocked() {
+    while (!mMessageEnvelopes.empty() && mMessageEnvelopes.front().handler == nullptr) {
+        std::pop_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                      isLaterMessage<MessageEnvelope>);
+        mMessageEnvelopes.pop_back();
+        mCancelledMessageCount--;
+    }
+}
+
 bool Looper::isPolling() const {
     return mPolling;
 }
 
+void Looper::setMaxEventsPerPoll(size_t maxEvents) {
+    if (maxEvents == 0 || maxEvents > INT_MAX / sizeof(epoll_event)) {
+        ALOGE("Invalid attempt to set max events per poll to %zu.", maxEvents);
+        return;
+    }
+    // The responses buffer grows to match at the start of the next poll; it may be
+    // in use by pollOnce now if we are called from a callback.
+    mEventItems.resize(maxEvents);
+}
+
+void Looper::setBusyPollDuration(nsecs_t duration) {
+    mBusyPollDuration = std::max<nsecs_t>(duration, 0);
+}
+
+void Looper::setHighResolutionMessageTimeouts(bool enabled) {
+    AutoMutex _l(mLock);
+    if (enabled == (mTimerFd >= 0)) {
+        return;
+    }
+
+    if (!enabled) {
+        epoll_ctl(mEpollFd.get(), EPOLL_CTL_DEL, mTimerFd.get(), nullptr);
+        mTimerFd.reset();
+        mTimerDeadline = LLONG_MAX;
+        return;
+    }
+
+    android::base::unique_fd timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+    if (timerFd < 0) {
+        ALOGE("Could not make timer fd: %s", strerror(errno));
+        return;
+    }
+    epoll_event timerEvent = createEpollEvent(EPOLLIN, TIMER_FD_SEQ);
+    if (epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, timerFd.get(), &timerEvent) < 0) {
+        ALOGE("Could not add timer fd to epoll instance: %s", strerror(errno));
+        return;
+    }
+    mTimerFd = std::move(timerFd);
+}
+
 uint32_t Looper::Request::getEpollEvents() const {
     uint32_t epollEvents = 0;
     if (events & EVENT_INPUT) epollEvents |= EPOLLIN;
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/Looper.h>
+
+#include <memory>
+#include <vector>
+
+#include "Looper_test_pipe.h"
+
+using android::Looper;
+using android::Message;
+using android::MessageHandler;
+using android::sp;
+
+class NopMessageHandler : public MessageHandler {
+  public:
+    void handleMessage(const Message&) override {}
+};
+
+static int keepCallback(int, int, void*) {
+    return 1;
+}
+
+static std::vector<std::unique_ptr<Pipe>> addPipes(const sp<Looper>& looper, int count) {
+    std::vector<std::unique_ptr<Pipe>> pipes;
+    for (int i = 0; i < count; i++) {
+        pipes.push_back(std::make_unique<Pipe>());
+        looper->addFd(pipes.back()->receiveFd, 0, Looper::EVENT_INPUT, keepCallback, nullptr);
+    }
+    return pipes;
+}
+
+// Re-registers one fd out of the given number of registered fds, as happens
+// when a connection is torn down and another one set up.
+void BM_Looper_removeAndAddFd(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false);
+    auto pipes = addPipes(looper, state.range(0));
+
+    size_t i = 0;
+    for (auto _ : state) {
+        int fd = pipes[i]->receiveFd;
+        looper->removeFd(fd);
+        looper->addFd(fd, 0, Looper::EVENT_INPUT, keepCallback, nullptr);
+        i = (i + 1) % pipes.size();
+    }
+}
+BENCHMARK(BM_Looper_removeAndAddFd)->Arg(16)->Arg(256)->Arg(1024);
+
+// Dispatches callbacks for 16 signalled fds out of the given number of
+// registered fds.  The signals are never read, so the fds stay readable.
+void BM_Looper_pollOnce(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false);
+    auto pipes = addPipes(looper, state.range(0));
+    for (size_t i = 0; i < pipes.size() && i < 16; i++) {
+        pipes[i]->writeSignal();
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(looper->pollOnce(0));
+    }
+}
+BENCHMARK(BM_Looper_pollOnce)->Arg(16)->Arg(256)->Arg(1024);
+
+// Sends a delayed message and cancels it again, with the given number of
+// other delayed messages pending.
+void BM_Looper_sendAndRemoveMessage(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false);
+    sp<MessageHandler> pending = sp<NopMessageHandler>::make();
+    sp<MessageHandler> handler = sp<NopMessageHandler>::make();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < state.range(0); i++) {
+        looper->sendMessageAtTime(now + seconds_to_nanoseconds(100 + i % 97), pending,
+                                  Message(i));
+    }
+
+    int i = 0;
+    for (auto _ : state) {
+        looper->sendMessageAtTime(now + seconds_to_nanoseconds(100 + i++ % 89), handler,
+                                  Message());
+        looper->removeMessages(handler);
+    }
+}
+BENCHMARK(BM_Looper_sendAndRemoveMessage)->Arg(16)->Arg(256)->Arg(4096);
+
+// Sends the given number of delayed messages with uptimes in the past, and
+// dispatches them all.
+void BM_Looper_sendAndDispatchMessages(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false);
+    sp<MessageHandler> handler = sp<NopMessageHandler>::make();
+
+    for (auto _ : state) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < state.range(0); i++) {
+            looper->sendMessageAtTime(now - i % 97, handler, Message(i));
+        }
+        looper->pollOnce(0);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Looper_sendAndDispatchMessages)->Arg(16)->Arg(256)->Arg(4096);
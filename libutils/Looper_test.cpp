@@ -8,6 +8,7 @@
 #include <utils/Looper.h>
 #include <utils/StopWatch.h>
 #include <utils/Timers.h>
+#include <memory>
 #include <thread>
 #include <unordered_map>
 #include <utility>
@@ -112,6 +113,20 @@ protected:
     }
 };
 
+// Consumes the signal on each callback, so that the fd stops being readable.
+class ReadSignalCallbackHandler : public StubCallbackHandler {
+public:
+    ReadSignalCallbackHandler() : StubCallbackHandler(true) {
+    }
+
+protected:
+    virtual int handler(int fd, int events) {
+        char buf;
+        EXPECT_EQ(1, read(fd, &buf, 1));
+        return StubCallbackHandler::handler(fd, events);
+    }
+};
+
 class StubMessageHandler : public MessageHandler {
 public:
     Vector<Message> messages;
@@ -460,6 +475,37 @@ TEST_F(LooperTest, PollOnce_WhenCallbackAddedTwice_OnlySecondCallbackShouldBeInv
             << "replacement handler callback should be invoked";
 }
 
+TEST_F(LooperTest, PollOnce_WhenManyCallbacksAddedAndSomeRemoved_OnlyRemainingCallbacksShouldBeInvoked) {
+    // Enough fds for the request table to grow several times, and for removals to
+    // shift entries around in it.
+    constexpr int kNumPipes = 200;
+    std::vector<std::unique_ptr<Pipe>> pipes;
+    std::vector<std::unique_ptr<ReadSignalCallbackHandler>> handlers;
+    for (int i = 0; i < kNumPipes; i++) {
+        pipes.push_back(std::make_unique<Pipe>());
+        handlers.push_back(std::make_unique<ReadSignalCallbackHandler>());
+        handlers[i]->setCallback(mLooper, pipes[i]->receiveFd, Looper::EVENT_INPUT);
+    }
+    for (int i = 0; i < kNumPipes; i += 3) {
+        EXPECT_EQ(1, mLooper->removeFd(pipes[i]->receiveFd));
+    }
+    for (int i = 0; i < kNumPipes; i++) {
+        pipes[i]->writeSignal();
+    }
+
+    while (mLooper->pollOnce(0) == Looper::POLL_CALLBACK) {
+    }
+
+    for (int i = 0; i < kNumPipes; i++) {
+        EXPECT_EQ(i % 3 == 0 ? 0 : 1, handlers[i]->callbackCount)
+                << "callback for pipe " << i;
+        if (i % 3 != 0) {
+            EXPECT_EQ(pipes[i]->receiveFd, handlers[i]->fd);
+            EXPECT_EQ(1, mLooper->removeFd(pipes[i]->receiveFd));
+        }
+    }
+}
+
 TEST_F(LooperTest, SendMessage_WhenOneMessageIsEnqueue_ShouldInvokeHandlerDuringNextPoll) {
     sp<StubMessageHandler> handler = new StubMessageHandler();
     mLooper->sendMessage(handler, Message(MSG_TEST1));
@@ -713,6 +759,50 @@ TEST_F(LooperTest, RemoveMessage_WhenRemovingSomeMessagesForHandler_ShouldRemove
             << "no more messages to handle";
 }
 
+TEST_F(LooperTest, SendMessageAtTime_WhenManyMessagesAreEnqueued_ShouldInvokeHandlersInUptimeThenSendOrder) {
+    // Uptimes in the past, out of order, with many sent for the same uptime.
+    constexpr int kNumMessages = 500;
+    constexpr int kNumUptimes = 7;
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    sp<StubMessageHandler> removedHandler = new StubMessageHandler();
+    nsecs_t base = systemTime(SYSTEM_TIME_MONOTONIC) - ms2ns(kNumUptimes);
+    for (int i = 0; i < kNumMessages; i++) {
+        nsecs_t uptime = base + ms2ns((i * 3) % kNumUptimes);
+        mLooper->sendMessageAtTime(uptime, handler, Message(i));
+        if (i % 5 == 0) {
+            mLooper->sendMessageAtTime(uptime, removedHandler, Message(i));
+        }
+    }
+    mLooper->removeMessages(removedHandler);
+    for (int i = 0; i < kNumMessages; i += 10) {
+        mLooper->removeMessages(handler, i);
+    }
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    EXPECT_EQ(size_t(0), removedHandler->messages.size())
+            << "removed messages should not be handled";
+    ASSERT_EQ(size_t(kNumMessages - kNumMessages / 10), handler->messages.size())
+            << "all messages that were not removed should be handled";
+
+    // Within one uptime, messages were sent in increasing order of what.
+    int last = -1;
+    int lastUptime = 0;
+    for (size_t i = 0; i < handler->messages.size(); i++) {
+        int what = handler->messages[i].what;
+        int uptime = (what * 3) % kNumUptimes;
+        EXPECT_NE(0, what % 10) << "removed message was handled";
+        ASSERT_GE(uptime, lastUptime) << "messages should be handled in order of uptime";
+        if (uptime == lastUptime) {
+            EXPECT_GT(what, last) << "messages with the same uptime should be handled in order";
+        }
+        last = what;
+        lastUptime = uptime;
+    }
+}
+
 class LooperEventCallback : public LooperCallback {
   public:
     using Callback = std::function<int(int fd, int events)>;
@@ -723,6 +813,109 @@ class LooperEventCallback : public LooperCallback {
     Callback mCallback;
 };
 
+TEST_F(LooperTest, PollOnce_WhenMaxEventsPerPollIsOne_InvokesOneCallbackPerPoll) {
+    Pipe pipe1;
+    Pipe pipe2;
+    ReadSignalCallbackHandler handler1;
+    ReadSignalCallbackHandler handler2;
+
+    mLooper->setMaxEventsPerPoll(1);
+    handler1.setCallback(mLooper, pipe1.receiveFd, Looper::EVENT_INPUT);
+    handler2.setCallback(mLooper, pipe2.receiveFd, Looper::EVENT_INPUT);
+    pipe1.writeSignal();
+    pipe2.writeSignal();
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because FDs were signalled";
+    EXPECT_EQ(1, handler1.callbackCount + handler2.callbackCount)
+            << "only one callback should be invoked per poll";
+
+    result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because an FD is still signalled";
+    EXPECT_EQ(1, handler1.callbackCount)
+            << "first callback should have been invoked once over both polls";
+    EXPECT_EQ(1, handler2.callbackCount)
+            << "second callback should have been invoked once over both polls";
+}
+
+TEST_F(LooperTest, PollOnce_WhenBusyPollingAndSignalledFDWhileSpinning_PromptlyInvokesCallbackAndReturns) {
+    Pipe pipe;
+    StubCallbackHandler handler(true);
+    sp<DelayedWriteSignal> delayedWriteSignal = new DelayedWriteSignal(100, & pipe);
+
+    mLooper->setBusyPollDuration(ms2ns(1000));
+    handler.setCallback(mLooper, pipe.receiveFd, Looper::EVENT_INPUT);
+    delayedWriteSignal->run("LooperTest");
+
+    StopWatch stopWatch("pollOnce");
+    int result = mLooper->pollOnce(2000);
+    int32_t elapsedMillis = ns2ms(stopWatch.elapsedTime());
+
+    ASSERT_EQ(OK, pipe.readSignal())
+            << "signal should actually have been written";
+    EXPECT_NEAR(100, elapsedMillis, TIMING_TOLERANCE_MS)
+            << "elapsed time should approx. equal signal delay";
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because FD was signalled";
+    EXPECT_EQ(1, handler.callbackCount)
+            << "callback should be invoked exactly once";
+}
+
+TEST_F(LooperTest, PollOnce_WhenBusyPollingLongerThanTimeout_WaitsForTimeoutAndReturns) {
+    mLooper->setBusyPollDuration(ms2ns(1000));
+
+    StopWatch stopWatch("pollOnce");
+    int result = mLooper->pollOnce(100);
+    int32_t elapsedMillis = ns2ms(stopWatch.elapsedTime());
+
+    EXPECT_NEAR(100, elapsedMillis, TIMING_TOLERANCE_MS)
+            << "elapsed time should approx. equal timeout rather than the spin duration";
+    EXPECT_EQ(Looper::POLL_TIMEOUT, result)
+            << "pollOnce result should be Looper::POLL_TIMEOUT";
+}
+
+TEST_F(LooperTest, SendMessageDelayed_WhenHighResolutionTimeouts_ShouldInvokeHandlerAfterDelayTime) {
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    mLooper->setHighResolutionMessageTimeouts(true);
+    nsecs_t uptime = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(100);
+    mLooper->sendMessageAtTime(uptime, handler, Message(MSG_TEST1));
+
+    StopWatch stopWatch("pollOnce");
+    int result = mLooper->pollOnce(1000);
+
+    EXPECT_EQ(Looper::POLL_WAKE, result)
+            << "pollOnce result should be Looper::POLL_WAKE due to wakeup";
+    EXPECT_EQ(size_t(0), handler->messages.size())
+            << "no message handled yet";
+
+    result = mLooper->pollOnce(1000);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    int32_t elapsedMillis = ns2ms(stopWatch.elapsedTime());
+
+    EXPECT_EQ(size_t(1), handler->messages.size())
+            << "handled message";
+    EXPECT_GE(now, uptime)
+            << "message should not be handled before its uptime";
+    EXPECT_NEAR(100, elapsedMillis, TIMING_TOLERANCE_MS)
+            << "second poll should end around the time of the delayed message dispatch";
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because message was sent";
+
+    mLooper->setHighResolutionMessageTimeouts(false);
+    mLooper->sendMessageDelayed(ms2ns(100), handler, Message(MSG_TEST2));
+    mLooper->pollOnce(1000);
+    result = mLooper->pollOnce(1000);
+
+    EXPECT_EQ(size_t(2), handler->messages.size())
+            << "handled message after disabling high resolution timeouts";
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because message was sent";
+}
+
 // A utility class that allows for pipes to be added and removed from the looper, and polls the
 // looper from a different thread.
 class ThreadedLooperUtil {
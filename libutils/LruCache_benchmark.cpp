@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mutex>
+
+#include <benchmark/benchmark.h>
+#include <utils/LruCache.h>
+#include <utils/ShardedLruCache.h>
+
+// Every thread mostly looks up keys, from a set that is larger than the cache,
+// and puts the ones that missed: the pattern of a cache shared by binder threads.
+static constexpr int kCapacity = 1024;
+static constexpr int kKeys = 2 * kCapacity;
+
+// The baseline: a single LruCache behind a mutex, as callers use it today.
+class LockedLruCache {
+public:
+    LockedLruCache() : mCache(kCapacity) {}
+
+    int get(int key) {
+        std::lock_guard<std::mutex> guard(mLock);
+        return mCache.get(key);
+    }
+
+    void put(int key, int value) {
+        std::lock_guard<std::mutex> guard(mLock);
+        mCache.put(key, value);
+    }
+
+private:
+    std::mutex mLock;
+    android::LruCache<int, int> mCache;
+};
+
+template <typename Cache>
+static void BM_cache_get_put(benchmark::State& state, Cache& cache) {
+    // Each thread walks the keys with its own stride, so threads don't march in step.
+    int key = state.thread_index();
+    int stride = 2 * state.thread_index() + 7;
+    for (auto _ : state) {
+        if (!cache.get(key)) {
+            cache.put(key, key + 1);
+        }
+        key = (key + stride) % kKeys;
+    }
+}
+
+static void BM_locked_lru_cache(benchmark::State& state) {
+    static LockedLruCache cache;
+    BM_cache_get_put(state, cache);
+}
+BENCHMARK(BM_locked_lru_cache)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_sharded_lru_cache(benchmark::State& state) {
+    static android::ShardedLruCache<int, int> cache(kCapacity);
+    BM_cache_get_put(state, cache);
+}
+BENCHMARK(BM_sharded_lru_cache)->ThreadRange(1, 8)->UseRealTime();
@@ -20,6 +20,11 @@
 #include <gtest/gtest.h>
 #include <utils/JenkinsHash.h>
 #include <utils/LruCache.h>
+#include <utils/ShardedLruCache.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
 
 namespace {
 
@@ -456,4 +461,97 @@ TEST_F(LruCacheTest, DontCopyKeyInGet) {
     cache.get(KeyFailsOnCopy(0));
 }
 
+TEST_F(LruCacheTest, ShardedSimple) {
+    ShardedLruCache<SimpleKey, StringValue> cache(100);
+
+    EXPECT_EQ(nullptr, cache.get(0));
+    EXPECT_TRUE(cache.put(1, "one"));
+    EXPECT_TRUE(cache.put(2, "two"));
+    EXPECT_FALSE(cache.put(2, "deux"));
+    EXPECT_STREQ("one", cache.get(1));
+    EXPECT_STREQ("two", cache.get(2));
+    EXPECT_EQ(2u, cache.size());
+
+    EXPECT_TRUE(cache.remove(1));
+    EXPECT_FALSE(cache.remove(1));
+    EXPECT_EQ(nullptr, cache.get(1));
+    EXPECT_EQ(1u, cache.size());
+}
+
+TEST_F(LruCacheTest, ShardedMaxCapacity) {
+    ShardedLruCache<SimpleKey, StringValue> cache(64, 4);
+
+    for (int i = 0; i < 1000; i++) {
+        cache.put(i, "value");
+    }
+    EXPECT_LE(cache.size(), 64u);
+    EXPECT_GE(cache.size(), 4u);
+    // Within its shard, the most recently added key is the youngest.
+    EXPECT_STREQ("value", cache.get(999));
+}
+
+TEST_F(LruCacheTest, ShardedCallback) {
+    EntryRemovedCallback callback;
+    ShardedLruCache<SimpleKey, StringValue> cache(1, 1);
+    cache.setOnEntryRemovedListener(&callback);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    EXPECT_EQ(1, callback.callbackCount);
+    EXPECT_EQ(1, callback.lastKey);
+    EXPECT_STREQ("one", callback.lastValue);
+
+    cache.clear();
+    EXPECT_EQ(2, callback.callbackCount);
+    EXPECT_EQ(2, callback.lastKey);
+    EXPECT_EQ(0u, cache.size());
+}
+
+TEST_F(LruCacheTest, ShardedComplexKeysAreReleased) {
+    {
+        ShardedLruCache<ComplexKey, ComplexValue> cache(8);
+        for (int i = 0; i < 100; i++) {
+            cache.put(ComplexKey(i), ComplexValue(i));
+        }
+        EXPECT_EQ(99, cache.get(ComplexKey(99)).v);
+    }
+    // TearDown checks that no keys or values are left behind.
+}
+
+class CountingCallback : public OnEntryRemoved<SimpleKey, SimpleKey> {
+public:
+    void operator()(SimpleKey&, SimpleKey&) { count++; }
+    std::atomic<int> count{0};
+};
+
+TEST_F(LruCacheTest, ShardedConcurrentUse) {
+    constexpr int kThreads = 4;
+    constexpr int kKeysPerThread = 1000;
+    CountingCallback callback;
+    ShardedLruCache<SimpleKey, SimpleKey> cache(LruCache<SimpleKey, SimpleKey>::kUnlimitedCapacity);
+    cache.setOnEntryRemovedListener(&callback);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&cache, t]() {
+            for (int i = 0; i < kKeysPerThread; i++) {
+                int key = t * kKeysPerThread + i;
+                EXPECT_TRUE(cache.put(key, key + 1));
+                EXPECT_EQ(key + 1, cache.get(key));
+                if (i % 2) {
+                    EXPECT_TRUE(cache.remove(key));
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(size_t(kThreads * kKeysPerThread / 2), cache.size());
+    EXPECT_EQ(kThreads * kKeysPerThread / 2, callback.count);
+    cache.clear();
+    EXPECT_EQ(kThreads * kKeysPerThread, callback.count);
+}
+
 }
@@ -22,8 +22,12 @@
 #include <dirent.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <thread>
 
+#include <backtrace/BacktraceMap.h>
 #include <utils/Printer.h>
 
 namespace android {
@@ -126,16 +130,14 @@ void ProcessCallStack::clear() {
     mTimeUpdated = tm();
 }
 
-void ProcessCallStack::update() {
+bool ProcessCallStack::startUpdate(std::vector<pid_t>* tids) {
     std::unique_ptr<DIR, decltype(&closedir)> dp(opendir(PATH_SELF_TASK), closedir);
     if (dp == nullptr) {
         ALOGE("%s: Failed to update the process's call stacks: %s",
               __FUNCTION__, strerror(errno));
-        return;
+        return false;
     }
 
-    pid_t selfPid = getpid();
-
     clear();
 
     // Get current time.
@@ -162,7 +164,24 @@ void ProcessCallStack::update() {
                   __FUNCTION__, PATH_SELF_TASK, ep->d_name);
             continue;
         }
+        tids->push_back(tid);
+    }
+    std::sort(tids->begin(), tids->end());
+    return true;
+}
+
+void ProcessCallStack::update() {
+    std::vector<pid_t> tids;
+    if (!startUpdate(&tids)) {
+        return;
+    }
+
+    pid_t selfTid = gettid();
+
+    // Read the process's maps and ELF files once, rather than once per thread.
+    std::unique_ptr<BacktraceMap> map(BacktraceMap::Create(getpid()));
 
+    for (pid_t tid : tids) {
         ssize_t idx = mThreadMap.add(tid, ThreadInfo());
         if (idx < 0) { // returns negative error value on error
             ALOGE("%s: Failed to add new ThreadInfo: %s",
@@ -176,10 +195,10 @@ void ProcessCallStack::update() {
          * Ignore CallStack::update and ProcessCallStack::update for current thread
          * - Every other thread doesn't need this since we call update off-thread
          */
-        int ignoreDepth = (selfPid == tid) ? IGNORE_DEPTH_CURRENT_THREAD : 0;
+        int ignoreDepth = (selfTid == tid) ? IGNORE_DEPTH_CURRENT_THREAD : 0;
 
         // Update thread's call stacks
-        threadInfo.callStack.update(ignoreDepth, tid);
+        threadInfo.callStack.update(ignoreDepth, tid, map.get());
 
         // Read/save thread name
         threadInfo.threadName = getThreadName(tid);
@@ -189,6 +208,56 @@ void ProcessCallStack::update() {
     }
 }
 
+void ProcessCallStack::update(size_t maxWorkers) {
+    std::vector<pid_t> tids;
+    if (!startUpdate(&tids)) {
+        return;
+    }
+
+    pid_t selfTid = gettid();
+    std::unique_ptr<BacktraceMap> map(BacktraceMap::Create(getpid()));
+    std::vector<ThreadInfo> threadInfos(tids.size());
+
+    // Unwind this thread here, before the workers start, so that its stack
+    // doesn't show it waiting for them.
+    for (size_t i = 0; i < tids.size(); i++) {
+        if (tids[i] == selfTid) {
+            threadInfos[i].callStack.update(IGNORE_DEPTH_CURRENT_THREAD, selfTid, map.get());
+            threadInfos[i].threadName = getThreadName(selfTid);
+        }
+    }
+
+    // The workers aren't in tids, having been started after the listing.
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t i = next++; i < tids.size(); i = next++) {
+            if (tids[i] == selfTid) {
+                continue;
+            }
+            threadInfos[i].callStack.update(0, tids[i], map.get());
+            threadInfos[i].threadName = getThreadName(tids[i]);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(maxWorkers, tids.size()); i++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // tids are sorted, so these are appended.
+    mThreadMap.setCapacity(tids.size());
+    for (size_t i = 0; i < tids.size(); i++) {
+        ssize_t idx = mThreadMap.add(tids[i], threadInfos[i]);
+        if (idx < 0) {
+            ALOGE("%s: Failed to add new ThreadInfo: %s",
+                  __FUNCTION__, strerror(-idx));
+        }
+    }
+}
+
 void ProcessCallStack::log(const char* logtag, android_LogPriority priority,
                            const char* prefix) const {
     LogPrinter printer(logtag, priority, prefix, /*ignoreBlankLines*/false);
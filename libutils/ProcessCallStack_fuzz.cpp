@@ -49,7 +49,11 @@ void spawnThreads(FuzzedDataProvider* dataProvider) {
 
     // Collect thread information
     ProcessCallStack callStack = ProcessCallStack();
-    callStack.update();
+    if (dataProvider->ConsumeBool()) {
+        callStack.update();
+    } else {
+        callStack.update(dataProvider->ConsumeIntegralInRange<size_t>(1, MAX_THREADS));
+    }
 
     // Tell our patiently waiting threads they can be done now.
     ranCallStackUpdate.store(true);
@@ -61,6 +61,45 @@
 #include <utils/CallStack.h>
 #endif
 
+// Low-overhead tracing, which unlike DEBUG_REFS is cheap enough to build in
+// always: it is switched on at run time for chosen objects or types with
+// trackMe() and trackMyType(), and costs the others a load of mFlags per
+// operation. Each thread records its operations on traced objects in a ring
+// buffer of its own, and printRefs() collects them. Ignored if DEBUG_REFS is
+// set, and only supported on linux type platforms.
+#if !DEBUG_REFS && defined(__linux__)
+#define DEBUG_REFS_TRACE 1
+#else
+#define DEBUG_REFS_TRACE 0
+#endif
+
+// The following three are ignored unless DEBUG_REFS_TRACE is set.
+
+// number of operations each thread remembers
+#define DEBUG_REFS_TRACE_ENTRIES 256
+
+// a call stack is captured for one in this many operations on each thread
+#define DEBUG_REFS_TRACE_STACK_INTERVAL 16
+
+// maximum number of frames kept for each captured call stack
+#define DEBUG_REFS_TRACE_STACK_FRAMES 8
+
+#if DEBUG_REFS_TRACE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <unwind.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <cutils/threads.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#endif
+
 // ---------------------------------------------------------------------------
 
 namespace android {
@@ -151,6 +190,303 @@ namespace android {
 
 // ---------------------------------------------------------------------------
 
+#if DEBUG_REFS_TRACE
+
+namespace {
+
+enum RefTraceKind : uint32_t {
+    REF_TRACE_STRONG,
+    REF_TRACE_WEAK,
+    // The weakref_impl was destroyed, so older entries for the same address
+    // belong to an earlier object.
+    REF_TRACE_DESTROYED,
+};
+
+// One operation on a traced object. An entry is only written by the thread
+// owning its ring, but may be read by printRefs() on any other, so the fields
+// are guarded by a sequence count which is odd while the entry is written.
+struct RefTraceEntry {
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> kind;
+    std::atomic<const void*> refs;
+    std::atomic<const void*> id;
+    // As in DEBUG_REFS: the count before the operation, negated for a decrement.
+    std::atomic<int32_t> ref;
+    std::atomic<pid_t> tid;
+    std::atomic<nsecs_t> when;
+    std::atomic<uint32_t> frameCount;
+    std::atomic<uintptr_t> frames[DEBUG_REFS_TRACE_STACK_FRAMES];
+};
+
+// A consistent copy of an entry, as read by printRefs().
+struct RefTraceRecord {
+    uint32_t kind;
+    const void* id;
+    int32_t ref;
+    pid_t tid;
+    nsecs_t when;
+    uint32_t frameCount;
+    uintptr_t frames[DEBUG_REFS_TRACE_STACK_FRAMES];
+};
+
+// The ring buffer of one thread. Rings are never freed: the ring of a thread
+// that exits is handed to the next thread that needs one, so what the thread
+// did can still be printed until its entries are overwritten.
+struct RefTraceRing {
+    RefTraceRing* next;
+    std::atomic<bool> inUse;
+    // Only touched by the owning thread.
+    uint32_t head;
+    uint32_t untilStack;
+    RefTraceEntry entries[DEBUG_REFS_TRACE_ENTRIES];
+};
+
+// Every ring, newest first. Rings are only ever pushed onto the list.
+std::atomic<RefTraceRing*> gRefTraceRings;
+
+thread_local RefTraceRing* tRefTraceRing;
+
+struct RefTraceRingReleaser {
+    ~RefTraceRingReleaser() {
+        if (tRefTraceRing != nullptr) {
+            tRefTraceRing->inUse.store(false, std::memory_order_release);
+            tRefTraceRing = nullptr;
+        }
+    }
+};
+
+thread_local RefTraceRingReleaser tRefTraceRingReleaser;
+
+RefTraceRing* refTraceRing() {
+    RefTraceRing* ring = tRefTraceRing;
+    if (ring != nullptr) {
+        return ring;
+    }
+    for (ring = gRefTraceRings.load(std::memory_order_acquire); ring != nullptr;
+         ring = ring->next) {
+        bool inUse = false;
+        if (ring->inUse.compare_exchange_strong(inUse, true, std::memory_order_acquire)) {
+            break;
+        }
+    }
+    if (ring == nullptr) {
+        // Value-initialized, so every entry starts out zeroed.
+        ring = new RefTraceRing();
+        ring->inUse.store(true, std::memory_order_relaxed);
+        ring->next = gRefTraceRings.load(std::memory_order_relaxed);
+        while (!gRefTraceRings.compare_exchange_weak(ring->next, ring,
+                                                     std::memory_order_release,
+                                                     std::memory_order_relaxed)) {
+        }
+    }
+    // Using the releaser registers its destructor for this thread.
+    (void)&tRefTraceRingReleaser;
+    tRefTraceRing = ring;
+    return ring;
+}
+
+struct RefTraceUnwindState {
+    uintptr_t* frames;
+    size_t count;
+    size_t skip;
+};
+
+_Unwind_Reason_Code refTraceUnwindFrame(_Unwind_Context* context, void* arg) {
+    RefTraceUnwindState* state = static_cast<RefTraceUnwindState*>(arg);
+    uintptr_t pc = _Unwind_GetIP(context);
+    if (pc == 0) {
+        return _URC_END_OF_STACK;
+    }
+    if (state->skip > 0) {
+        state->skip--;
+        return _URC_NO_REASON;
+    }
+    state->frames[state->count++] = pc;
+    return state->count < DEBUG_REFS_TRACE_STACK_FRAMES ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+
+// Only the return addresses are kept; they are symbolized by printRefs().
+__attribute__((noinline)) size_t captureRefTraceStack(uintptr_t* frames) {
+    // Skip ourselves and traceRef().
+    RefTraceUnwindState state = {frames, 0, 2};
+    _Unwind_Backtrace(refTraceUnwindFrame, &state);
+    return state.count;
+}
+
+__attribute__((noinline)) void traceRef(const void* refs, RefTraceKind kind, const void* id,
+                                        int32_t ref) {
+    RefTraceRing* ring = refTraceRing();
+    RefTraceEntry& entry = ring->entries[ring->head++ % DEBUG_REFS_TRACE_ENTRIES];
+
+    uintptr_t frames[DEBUG_REFS_TRACE_STACK_FRAMES];
+    size_t frameCount = 0;
+    if (ring->untilStack == 0) {
+        ring->untilStack = DEBUG_REFS_TRACE_STACK_INTERVAL - 1;
+        frameCount = captureRefTraceStack(frames);
+    } else {
+        ring->untilStack--;
+    }
+
+    uint32_t seq = entry.seq.load(std::memory_order_relaxed);
+    entry.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.kind.store(kind, std::memory_order_relaxed);
+    entry.refs.store(refs, std::memory_order_relaxed);
+    entry.id.store(id, std::memory_order_relaxed);
+    entry.ref.store(ref, std::memory_order_relaxed);
+    entry.tid.store(gettid(), std::memory_order_relaxed);
+    entry.when.store(systemTime(SYSTEM_TIME_MONOTONIC), std::memory_order_relaxed);
+    entry.frameCount.store(frameCount, std::memory_order_relaxed);
+    for (size_t i = 0; i < frameCount; i++) {
+        entry.frames[i].store(frames[i], std::memory_order_relaxed);
+    }
+    entry.seq.store(seq + 2, std::memory_order_release);
+}
+
+bool readRefTraceEntry(const RefTraceEntry& entry, const void* refs, RefTraceRecord* record) {
+    uint32_t seq = entry.seq.load(std::memory_order_acquire);
+    if ((seq & 1) != 0 || entry.refs.load(std::memory_order_relaxed) != refs) {
+        return false;
+    }
+    record->kind = entry.kind.load(std::memory_order_relaxed);
+    record->id = entry.id.load(std::memory_order_relaxed);
+    record->ref = entry.ref.load(std::memory_order_relaxed);
+    record->tid = entry.tid.load(std::memory_order_relaxed);
+    record->when = entry.when.load(std::memory_order_relaxed);
+    record->frameCount = std::min<uint32_t>(entry.frameCount.load(std::memory_order_relaxed),
+                                            DEBUG_REFS_TRACE_STACK_FRAMES);
+    for (size_t i = 0; i < record->frameCount; i++) {
+        record->frames[i] = entry.frames[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // An entry being overwritten meanwhile is dropped: it is the oldest anyway.
+    return entry.seq.load(std::memory_order_relaxed) == seq;
+}
+
+// The operations every thread still remembers on refs, oldest first.
+std::vector<RefTraceRecord> collectRefTrace(const void* refs) {
+    std::vector<RefTraceRecord> records;
+    for (const RefTraceRing* ring = gRefTraceRings.load(std::memory_order_acquire);
+         ring != nullptr; ring = ring->next) {
+        for (const RefTraceEntry& entry : ring->entries) {
+            RefTraceRecord record;
+            if (readRefTraceEntry(entry, refs, &record)) {
+                records.push_back(record);
+            }
+        }
+    }
+    std::stable_sort(records.begin(), records.end(),
+                     [](const RefTraceRecord& a, const RefTraceRecord& b) {
+                         return a.when < b.when;
+                     });
+    for (size_t i = records.size(); i > 0; i--) {
+        if (records[i - 1].kind == REF_TRACE_DESTROYED) {
+            records.erase(records.begin(), records.begin() + i);
+            break;
+        }
+    }
+    return records;
+}
+
+void appendRefTrace(String8* out, const std::vector<RefTraceRecord>& records, uint32_t kind) {
+    for (const RefTraceRecord& record : records) {
+        if (record.kind != kind) {
+            continue;
+        }
+        char inc = record.ref >= 0 ? '+' : '-';
+        out->appendFormat("\t%c ID %p (ref %d) on thread %d at %" PRId64 " ns:\n", inc,
+                          record.id, record.ref, record.tid, record.when);
+        if (record.frameCount == 0) {
+            out->append("\t\t(call stack not sampled)\n");
+        }
+        for (size_t i = 0; i < record.frameCount; i++) {
+            // Laid out like the frames printed by CallStack.
+            uintptr_t pc = record.frames[i];
+            Dl_info info;
+            if (dladdr(reinterpret_cast<const void*>(pc), &info) == 0 ||
+                info.dli_fname == nullptr) {
+                out->appendFormat("\t\t#%02zu pc %08" PRIxPTR "  <unknown>\n", i, pc);
+            } else if (info.dli_sname == nullptr) {
+                out->appendFormat("\t\t#%02zu pc %08" PRIxPTR "  %s\n", i,
+                                  pc - reinterpret_cast<uintptr_t>(info.dli_fbase),
+                                  info.dli_fname);
+            } else {
+                out->appendFormat("\t\t#%02zu pc %08" PRIxPTR "  %s (%s+%" PRIuPTR ")\n", i,
+                                  pc - reinterpret_cast<uintptr_t>(info.dli_fbase),
+                                  info.dli_fname, info.dli_sname,
+                                  pc - reinterpret_cast<uintptr_t>(info.dli_saddr));
+            }
+        }
+    }
+}
+
+// Types whose objects are traced from their first strong reference on, by the
+// address of their vtable, which tells the most derived type apart without RTTI.
+constexpr size_t kMaxTracedTypes = 8;
+std::atomic<const void*> gTracedTypes[kMaxTracedTypes];
+std::atomic<uint32_t> gTracedTypeCount;
+
+const void* refTraceTypeKey(const RefBase* base) {
+    const void* vtable;
+    memcpy(&vtable, static_cast<const void*>(base), sizeof(vtable));
+    return vtable;
+}
+
+bool isTracedType(const void* key) {
+    if (gTracedTypeCount.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    for (const auto& type : gTracedTypes) {
+        if (type.load(std::memory_order_relaxed) == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void setTracedType(const void* key, bool enable) {
+    if (enable) {
+        if (isTracedType(key)) {
+            return;
+        }
+        for (auto& type : gTracedTypes) {
+            const void* empty = nullptr;
+            if (type.compare_exchange_strong(empty, key, std::memory_order_relaxed)) {
+                gTracedTypeCount.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        ALOGW("RefBase: can't trace more than %zu types", kMaxTracedTypes);
+    } else {
+        for (auto& type : gTracedTypes) {
+            const void* expected = key;
+            if (type.compare_exchange_strong(expected, nullptr, std::memory_order_relaxed)) {
+                gTracedTypeCount.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+}  // namespace
+
+#endif  // DEBUG_REFS_TRACE
+
+#if DEBUG_REFS || DEBUG_REFS_TRACE
+// Writes the output of printRefs() for refs to DEBUG_REFS_CALLSTACK_PATH.
+static void saveRefs(const void* refs, const String8& text) {
+    char name[100];
+    snprintf(name, sizeof(name), DEBUG_REFS_CALLSTACK_PATH "/%p.stack", refs);
+    int rc = open(name, O_RDWR | O_CREAT | O_APPEND, 644);
+    if (rc >= 0) {
+        (void)write(rc, text.string(), text.length());
+        close(rc);
+        ALOGD("STACK TRACE for %p saved in %s", refs, name);
+    }
+    else ALOGE("FAILED TO PRINT STACK TRACE for %p in %s: %s", refs,
+              name, strerror(errno));
+}
+#endif
+
 class RefBase::weakref_impl : public RefBase::weakref_type
 {
 public:
@@ -169,6 +505,86 @@ public:
     {
     }
 
+#if DEBUG_REFS_TRACE
+
+    ~weakref_impl()
+    {
+        if (isTraced()) {
+            traceRef(this, REF_TRACE_DESTROYED, nullptr, 0);
+        }
+    }
+
+    void addStrongRef(const void* id) {
+        if (isTraced()) {
+            traceRef(this, REF_TRACE_STRONG, id, mStrong.load(std::memory_order_relaxed));
+        }
+    }
+
+    void removeStrongRef(const void* id) {
+        if (isTraced()) {
+            traceRef(this, REF_TRACE_STRONG, id, -mStrong.load(std::memory_order_relaxed));
+        }
+    }
+
+    void addWeakRef(const void* id) {
+        if (isTraced()) {
+            traceRef(this, REF_TRACE_WEAK, id, mWeak.load(std::memory_order_relaxed));
+        }
+    }
+
+    void removeWeakRef(const void* id) {
+        if (isTraced()) {
+            traceRef(this, REF_TRACE_WEAK, id, -mWeak.load(std::memory_order_relaxed));
+        }
+    }
+
+    // The trace is a history of operations, so there is nothing to rename.
+    void renameStrongRefId(const void* /*old_id*/, const void* /*new_id*/) { }
+    void renameWeakRefId(const void* /*old_id*/, const void* /*new_id*/) { }
+
+    // retain is implied: every operation is recorded until overwritten.
+    void trackMe(bool track, bool /*retain*/) {
+        if (track) {
+            mFlags.fetch_or(TRACE_REFS, std::memory_order_relaxed);
+        } else {
+            mFlags.fetch_and(~TRACE_REFS, std::memory_order_relaxed);
+        }
+    }
+
+    void trackType(bool track) const {
+        setTracedType(refTraceTypeKey(mBase), track);
+    }
+
+    // Called once the object has been constructed, so that its vtable is that
+    // of its most derived type.
+    void onFirstStrongRef() {
+        if (isTracedType(refTraceTypeKey(mBase))) {
+            mFlags.fetch_or(TRACE_REFS, std::memory_order_relaxed);
+        }
+    }
+
+    void printRefs() const
+    {
+        std::vector<RefTraceRecord> records = collectRefTrace(this);
+        String8 text;
+        text.appendFormat("Strong references on RefBase %p (weakref_type %p):\n", mBase, this);
+        appendRefTrace(&text, records, REF_TRACE_STRONG);
+        text.appendFormat("Weak references on RefBase %p (weakref_type %p):\n", mBase, this);
+        appendRefTrace(&text, records, REF_TRACE_WEAK);
+        saveRefs(this, text);
+    }
+
+private:
+    // Kept in mFlags, next to the lifetime, so that untraced objects only pay
+    // for loading a word that shares a cache line with the counts.
+    static constexpr int32_t TRACE_REFS = 0x40000000;
+
+    bool isTraced() const {
+        return (mFlags.load(std::memory_order_relaxed) & TRACE_REFS) != 0;
+    }
+
+#else
+
     void addStrongRef(const void* /*id*/) { }
     void removeStrongRef(const void* /*id*/) { }
     void renameStrongRefId(const void* /*old_id*/, const void* /*new_id*/) { }
@@ -177,6 +593,10 @@ public:
     void renameWeakRefId(const void* /*old_id*/, const void* /*new_id*/) { }
     void printRefs() const { }
     void trackMe(bool, bool) { }
+    void trackType(bool) const { }
+    void onFirstStrongRef() { }
+
+#endif
 
 #else
 
@@ -192,6 +612,9 @@ public:
     {
     }
 
+    void trackType(bool) const { }
+    void onFirstStrongRef() { }
+
     ~weakref_impl()
     {
         bool dumpStack = false;
@@ -293,19 +716,7 @@ public:
             printRefsLocked(&text, mWeakRefs);
         }
 
-        {
-            char name[100];
-            snprintf(name, sizeof(name), DEBUG_REFS_CALLSTACK_PATH "/%p.stack",
-                     this);
-            int rc = open(name, O_RDWR | O_CREAT | O_APPEND, 644);
-            if (rc >= 0) {
-                (void)write(rc, text.string(), text.length());
-                close(rc);
-                ALOGD("STACK TRACE for %p saved in %s", this, name);
-            }
-            else ALOGE("FAILED TO PRINT STACK TRACE for %p in %s: %s", this,
-                      name, strerror(errno));
-        }
+        saveRefs(this, text);
     }
 
 private:
@@ -435,6 +846,7 @@ void RefBase::incStrong(const void* id) const
     int32_t old __unused = refs->mStrong.fetch_sub(INITIAL_STRONG_VALUE, std::memory_order_relaxed);
     // A decStrong() must still happen after us.
     ALOG_ASSERT(old > INITIAL_STRONG_VALUE, "0x%x too small", old);
+    refs->onFirstStrongRef();
     refs->mBase->onFirstRef();
 }
 
@@ -504,6 +916,7 @@ void RefBase::forceIncStrong(const void* id) const
     case INITIAL_STRONG_VALUE:
         refs->mStrong.fetch_sub(INITIAL_STRONG_VALUE,
                 std::memory_order_relaxed);
+        refs->onFirstStrongRef();
         FALLTHROUGH_INTENDED;
     case 0:
         refs->mBase->onFirstRef();
@@ -672,6 +1085,7 @@ bool RefBase::weakref_type::attemptIncStrong(const void* id)
     if (curCount == INITIAL_STRONG_VALUE) {
         impl->mStrong.fetch_sub(INITIAL_STRONG_VALUE,
                 std::memory_order_relaxed);
+        impl->onFirstStrongRef();
     }
 
     return true;
@@ -716,6 +1130,11 @@ void RefBase::weakref_type::trackMe(bool enable, bool retain)
     static_cast<weakref_impl*>(this)->trackMe(enable, retain);
 }
 
+void RefBase::trackMyType(bool enable) const
+{
+    mRefs->trackType(enable);
+}
+
 RefBase::weakref_type* RefBase::createWeak(const void* id) const
 {
     mRefs->incWeak(id);
@@ -21,6 +21,7 @@
 
 #include <thread>
 #include <atomic>
+#include <vector>
 #include <sched.h>
 #include <errno.h>
 
@@ -430,3 +431,65 @@ TEST(RefBase, RacingPromotions) {
         ASSERT_EQ(NITERS, deleteCount) << "Deletions missed!";
     }  // Otherwise this is slow and probably pointless on a uniprocessor.
 }
+
+class Traced : public RefBase {
+public:
+    explicit Traced(std::atomic<int>* deleteCount) : mDeleteCount(deleteCount) {}
+    ~Traced() { ++*mDeleteCount; }
+
+private:
+    std::atomic<int>* mDeleteCount;
+};
+
+static void copyRefs(const sp<Traced>& traced, int count) {
+    for (int i = 0; i < count; ++i) {
+        sp<Traced> sp1 = traced;
+        wp<Traced> wp1 = sp1;
+        sp<Traced> sp2 = wp1.promote();
+        ASSERT_EQ(sp1, sp2);
+    }
+}
+
+TEST(RefBase, TracedTypeKeepsCounts) {
+    std::atomic<int> deleteCount(0);
+    {
+        sp<Traced> first = sp<Traced>::make(&deleteCount);
+        first->trackMyType(true);
+        // Traced from its first strong reference on, like every later one.
+        sp<Traced> traced = sp<Traced>::make(&deleteCount);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back(copyRefs, traced, 10000);
+        }
+        for (int i = 0; i < 10; ++i) {
+            // Reads the other threads' rings while they are written.
+            traced->printRefs();
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        EXPECT_EQ(1, traced->getStrongCount());
+        EXPECT_EQ(1, traced->getWeakRefs()->getWeakCount());
+        traced->printRefs();
+        first->trackMyType(false);
+    }
+    EXPECT_EQ(2, deleteCount);
+}
+
+TEST(RefBase, TrackMeSurvivesAddressReuse) {
+    bool isDeleted;
+    for (int i = 0; i < 3; ++i) {
+        // Every object is allocated at the same address, so the trace of
+        // each must start after the destruction of the one before.
+        sp<FooFixedAlloc> foo = sp<FooFixedAlloc>::make(&isDeleted);
+        foo->trackMe(true, false);
+        {
+            sp<FooFixedAlloc> foo2 = foo;
+            wp<FooFixedAlloc> wp1 = foo2;
+        }
+        foo->printRefs();
+        ASSERT_EQ(1, foo->getStrongCount());
+        foo = nullptr;
+        ASSERT_TRUE(isDeleted);
+    }
+}
@@ -41,6 +41,7 @@ SharedBuffer* SharedBuffer::alloc(size_t size)
         // The following is OK on Android-supported platforms.
         sb->mRefs.store(1, std::memory_order_relaxed);
         sb->mSize = size;
+        sb->mReserved = 0;
         sb->mClientMetadata = 0;
     }
     return sb;
@@ -78,6 +79,7 @@ SharedBuffer* SharedBuffer::editResize(size_t newSize) const
         buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
         if (buf != nullptr) {
             buf->mSize = newSize;
+            buf->mReserved = 0;
             return buf;
         }
     }
@@ -90,6 +92,41 @@ SharedBuffer* SharedBuffer::editResize(size_t newSize) const
     return sb;    
 }
 
+SharedBuffer* SharedBuffer::editReserve(size_t newSize, size_t capacity) const
+{
+    if (capacity < newSize) capacity = newSize;
+    // The slack is recorded in 32 bits, so don't keep more than that.
+    if (capacity - newSize > UINT32_MAX) capacity = newSize + UINT32_MAX;
+
+    if (onlyOwner()) {
+        SharedBuffer* buf = const_cast<SharedBuffer*>(this);
+        const size_t allocated = buf->capacity();
+        if (capacity <= allocated && allocated - newSize <= UINT32_MAX) {
+            buf->mSize = newSize;
+            buf->mReserved = allocated - newSize;
+            return buf;
+        }
+        LOG_ALWAYS_FATAL_IF((capacity >= (SIZE_MAX - sizeof(SharedBuffer))),
+                            "Invalid buffer size %zu", capacity);
+
+        buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + capacity);
+        if (buf != nullptr) {
+            buf->mSize = newSize;
+            buf->mReserved = capacity - newSize;
+            return buf;
+        }
+    }
+    SharedBuffer* sb = alloc(capacity);
+    if (sb) {
+        const size_t mySize = mSize;
+        memcpy(sb->data(), data(), newSize < mySize ? newSize : mySize);
+        sb->mSize = newSize;
+        sb->mReserved = capacity - newSize;
+        release();
+    }
+    return sb;
+}
+
 SharedBuffer* SharedBuffer::attemptEdit() const
 {
     if (onlyOwner()) {
@@ -58,6 +58,9 @@ public:
 
     //! get size of the buffer
     inline          size_t                  size() const;
+
+    //! get how large the buffer can grow without being reallocated
+    inline          size_t                  capacity() const;
  
     //! get back a SharedBuffer object from its data
     static  inline  SharedBuffer*           bufferFromData(void* data);
@@ -74,6 +77,12 @@ public:
     //! edit the buffer, resizing if needed
                     SharedBuffer*           editResize(size_t size) const;
 
+    /*! like editResize(), but keep room for at least 'capacity' bytes so
+     *  that the buffer can later grow to that size in place. The storage
+     *  is only reallocated if it is shared or too small.
+     */
+                    SharedBuffer*           editReserve(size_t size, size_t capacity) const;
+
     //! like edit() but fails if a copy is required
                     SharedBuffer*           attemptEdit() const;
     
@@ -102,6 +111,7 @@ private:
         // Must be sized to preserve correct alignment.
         mutable std::atomic<int32_t>        mRefs;
                 size_t                      mSize;
+                // Bytes allocated past mSize, see editReserve().
                 uint32_t                    mReserved;
 public:
         // mClientMetadata is reserved for client use.  It is initialized to 0
@@ -128,6 +138,10 @@ size_t SharedBuffer::size() const {
     return mSize;
 }
 
+size_t SharedBuffer::capacity() const {
+    return mSize + mReserved;
+}
+
 SharedBuffer* SharedBuffer::bufferFromData(void* data) {
     return data ? static_cast<SharedBuffer *>(data)-1 : nullptr;
 }
@@ -25,6 +25,7 @@
 
 #include <ctype.h>
 
+#include <algorithm>
 #include <string>
 
 #include "SharedBuffer.h"
@@ -42,16 +43,21 @@ namespace android {
 // to OS_PATH_SEPARATOR.
 #define RES_PATH_SEPARATOR '/'
 
+// The empty string is shared by all empty String8s and is never freed, so its
+// reference count is left alone; see acquire(), release() and editResize().
 static inline char* getEmptyString() {
-    static SharedBuffer* gEmptyStringBuf = [] {
+    static char* gEmptyString = [] {
         SharedBuffer* buf = SharedBuffer::alloc(1);
         char* str = static_cast<char*>(buf->data());
         *str = 0;
-        return buf;
+        return str;
     }();
 
-    gEmptyStringBuf->acquire();
-    return static_cast<char*>(gEmptyStringBuf->data());
+    return gEmptyString;
+}
+
+static inline bool isEmptyString(const char* str) {
+    return str == getEmptyString();
 }
 
 // ---------------------------------------------------------------------------
@@ -130,7 +136,13 @@ String8::String8()
 String8::String8(const String8& o)
     : mString(o.mString)
 {
-    SharedBuffer::bufferFromData(mString)->acquire();
+    acquire();
+}
+
+String8::String8(String8&& o) noexcept
+    : mString(o.mString)
+{
+    o.mString = getEmptyString();
 }
 
 String8::String8(const char* o)
@@ -174,7 +186,14 @@ String8::String8(const char32_t* o, size_t len)
 
 String8::~String8()
 {
-    SharedBuffer::bufferFromData(mString)->release();
+    release();
+}
+
+String8& String8::operator=(String8&& other) noexcept {
+    release();
+    mString = other.mString;
+    other.mString = getEmptyString();
+    return *this;
 }
 
 size_t String8::length() const
@@ -201,21 +220,22 @@ String8 String8::formatV(const char* fmt, va_list args)
 }
 
 void String8::clear() {
-    SharedBuffer::bufferFromData(mString)->release();
+    release();
     mString = getEmptyString();
 }
 
 void String8::setTo(const String8& other)
 {
-    SharedBuffer::bufferFromData(other.mString)->acquire();
-    SharedBuffer::bufferFromData(mString)->release();
+    if (mString == other.mString) return;
+    release();
     mString = other.mString;
+    acquire();
 }
 
 status_t String8::setTo(const char* other)
 {
     const char *newString = allocFromUTF8(other, strlen(other));
-    SharedBuffer::bufferFromData(mString)->release();
+    release();
     mString = newString;
     if (mString) return OK;
 
@@ -226,7 +246,7 @@ status_t String8::setTo(const char* other)
 status_t String8::setTo(const char* other, size_t len)
 {
     const char *newString = allocFromUTF8(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
+    release();
     mString = newString;
     if (mString) return OK;
 
@@ -237,7 +257,7 @@ status_t String8::setTo(const char* other, size_t len)
 status_t String8::setTo(const char16_t* other, size_t len)
 {
     const char *newString = allocFromUTF16(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
+    release();
     mString = newString;
     if (mString) return OK;
 
@@ -248,7 +268,7 @@ status_t String8::setTo(const char16_t* other, size_t len)
 status_t String8::setTo(const char32_t* other, size_t len)
 {
     const char *newString = allocFromUTF32(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
+    release();
     mString = newString;
     if (mString) return OK;
 
@@ -298,33 +318,57 @@ status_t String8::appendFormat(const char* fmt, ...)
 
 status_t String8::appendFormatV(const char* fmt, va_list args)
 {
-    int n, result = OK;
-    va_list tmp_args;
+    const size_t oldLength = length();
+
+    // Format into the spare capacity if we can edit the buffer in place, and
+    // into a stack buffer otherwise, so that most appends need only one
+    // vsnprintf() pass. Only output that doesn't fit there is formatted again.
+    char stackBuf[256];
+    char* dest = stackBuf;
+    size_t avail = sizeof(stackBuf);
+    if (!isEmptyString(mString)) {
+        const SharedBuffer* sb = SharedBuffer::bufferFromData(mString);
+        if (sb->onlyOwner() && sb->capacity() - oldLength > avail) {
+            dest = const_cast<char*>(mString) + oldLength;
+            avail = sb->capacity() - oldLength;
+        }
+    }
 
     /* args is undefined after vsnprintf.
      * So we need a copy here to avoid the
      * second vsnprintf access undefined args.
      */
+    va_list tmp_args;
     va_copy(tmp_args, args);
-    n = vsnprintf(nullptr, 0, fmt, tmp_args);
+    int n = vsnprintf(dest, avail, fmt, tmp_args);
     va_end(tmp_args);
 
+    if (dest != stackBuf && (n < 0 || static_cast<size_t>(n) >= avail)) {
+        // vsnprintf() wrote over our terminator.
+        dest[0] = '\0';
+    }
     if (n < 0) return UNKNOWN_ERROR;
+    if (n == 0) return OK;
 
-    if (n > 0) {
-        size_t oldLength = length();
-        if (static_cast<size_t>(n) > std::numeric_limits<size_t>::max() - 1 ||
-            oldLength > std::numeric_limits<size_t>::max() - n - 1) {
-            return NO_MEMORY;
-        }
-        char* buf = lockBuffer(oldLength + n);
-        if (buf) {
-            vsnprintf(buf + oldLength, n + 1, fmt, args);
-        } else {
-            result = NO_MEMORY;
+    if (static_cast<size_t>(n) > std::numeric_limits<size_t>::max() - 1 ||
+        oldLength > std::numeric_limits<size_t>::max() - n - 1) {
+        return NO_MEMORY;
+    }
+    if (static_cast<size_t>(n) < avail) {
+        if (dest == stackBuf) {
+            return real_append(stackBuf, n);
         }
+        // Already in place, within the capacity, so this can't reallocate.
+        lockBuffer(oldLength + n);
+        return OK;
     }
-    return result;
+
+    char* buf = lockBuffer(oldLength + n);
+    if (!buf) {
+        return NO_MEMORY;
+    }
+    vsnprintf(buf + oldLength, n + 1, fmt, args);
+    return OK;
 }
 
 status_t String8::real_append(const char* other, size_t otherLen) {
@@ -334,7 +378,7 @@ status_t String8::real_append(const char* other, size_t otherLen) {
     size_t newLen;
     if (__builtin_add_overflow(myLen, otherLen, &newLen) ||
         __builtin_add_overflow(newLen, 1, &newLen) ||
-        (buf = SharedBuffer::bufferFromData(mString)->editResize(newLen)) == nullptr) {
+        (buf = static_cast<SharedBuffer*>(editResize(newLen))) == nullptr) {
         return NO_MEMORY;
     }
 
@@ -348,8 +392,7 @@ status_t String8::real_append(const char* other, size_t otherLen) {
 
 char* String8::lockBuffer(size_t size)
 {
-    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-        ->editResize(size+1);
+    SharedBuffer* buf = static_cast<SharedBuffer*>(editResize(size+1));
     if (buf) {
         char* str = (char*)buf->data();
         mString = str;
@@ -366,8 +409,11 @@ void String8::unlockBuffer()
 status_t String8::unlockBuffer(size_t size)
 {
     if (size != this->size()) {
-        SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-            ->editResize(size+1);
+        // Give back what lockBuffer() over-allocated, rather than keeping it
+        // as capacity.
+        SharedBuffer* buf = size < this->size()
+                ? SharedBuffer::bufferFromData(mString)->editResize(size + 1)
+                : static_cast<SharedBuffer*>(editResize(size + 1));
         if (! buf) {
             return NO_MEMORY;
         }
@@ -380,6 +426,70 @@ status_t String8::unlockBuffer(size_t size)
     return OK;
 }
 
+status_t String8::reserve(size_t capacity)
+{
+    size_t bufferSize;
+    if (__builtin_add_overflow(capacity, 1, &bufferSize)) {
+        return NO_MEMORY;
+    }
+    if (isEmptyString(mString)) {
+        SharedBuffer* buf = SharedBuffer::alloc(bufferSize);
+        if (!buf) {
+            return NO_MEMORY;
+        }
+        buf = buf->editReserve(1, bufferSize);
+        char* str = static_cast<char*>(buf->data());
+        *str = '\0';
+        mString = str;
+        return OK;
+    }
+
+    const SharedBuffer* buf = SharedBuffer::bufferFromData(mString);
+    if (bufferSize <= buf->capacity() && buf->onlyOwner()) {
+        return OK;
+    }
+    SharedBuffer* edited = buf->editReserve(buf->size(), bufferSize);
+    if (!edited) {
+        return NO_MEMORY;
+    }
+    mString = static_cast<char*>(edited->data());
+    return OK;
+}
+
+void* String8::editResize(size_t newSize)
+{
+    if (isEmptyString(mString)) {
+        // Never let the shared empty string be resized in place or released.
+        SharedBuffer* buf = SharedBuffer::alloc(newSize);
+        if (buf && newSize > 0) {
+            *static_cast<char*>(buf->data()) = '\0';
+        }
+        return buf;
+    }
+    // Grow geometrically, so that a string built by repeated appends is only
+    // reallocated a logarithmic number of times.
+    const SharedBuffer* buf = SharedBuffer::bufferFromData(mString);
+    size_t capacity = buf->capacity();
+    if (newSize > capacity) {
+        capacity = std::max(newSize, capacity + capacity / 2);
+    }
+    return buf->editReserve(newSize, capacity);
+}
+
+void String8::acquire()
+{
+    if (!isEmptyString(mString)) {
+        SharedBuffer::bufferFromData(mString)->acquire();
+    }
+}
+
+void String8::release()
+{
+    if (!isEmptyString(mString)) {
+        SharedBuffer::bufferFromData(mString)->release();
+    }
+}
+
 ssize_t String8::find(const char* other, size_t start) const
 {
     size_t len = size();
@@ -114,3 +114,90 @@ TEST_F(String8Test, append) {
     EXPECT_EQ(NO_MEMORY, s.append("baz", SIZE_MAX));
     EXPECT_STREQ("foobar", s);
 }
+
+TEST_F(String8Test, MoveConstructor) {
+    String8 src("Hello, world!");
+    const char* data = src.c_str();
+    String8 dst(std::move(src));
+    EXPECT_EQ(data, dst.c_str());
+    EXPECT_STREQ("Hello, world!", dst);
+    EXPECT_TRUE(src.isEmpty());
+}
+
+TEST_F(String8Test, MoveAssignment) {
+    String8 src("Hello, world!");
+    const char* data = src.c_str();
+    String8 dst("Goodbye");
+    dst = std::move(src);
+    EXPECT_EQ(data, dst.c_str());
+    EXPECT_STREQ("Hello, world!", dst);
+    EXPECT_TRUE(src.isEmpty());
+    src = "reused";
+    EXPECT_STREQ("reused", src);
+}
+
+TEST_F(String8Test, EditingEmptyStringLeavesOtherEmptyStringsAlone) {
+    String8 empty;
+    String8 s;
+    String8 copy(s);
+    EXPECT_EQ(empty.c_str(), s.c_str()) << "empty strings should share storage";
+
+    EXPECT_EQ(OK, s.append("foo"));
+    EXPECT_STREQ("foo", s);
+    char* buf = copy.lockBuffer(3);
+    ASSERT_NE(nullptr, buf);
+    memcpy(buf, "bar", 4);
+    copy.unlockBuffer();
+    EXPECT_STREQ("bar", copy);
+
+    EXPECT_STREQ("", empty);
+    EXPECT_STREQ("", String8());
+    s.clear();
+    copy.setTo(s);
+    EXPECT_EQ(empty.c_str(), copy.c_str());
+}
+
+TEST_F(String8Test, appendFormat) {
+    String8 s("x=");
+    EXPECT_EQ(OK, s.appendFormat("%d, y=%s", 42, "foo"));
+    EXPECT_STREQ("x=42, y=foo", s);
+    EXPECT_EQ(11U, s.length());
+
+    // Longer than anything formatted on the stack.
+    std::string longArg(1000, 'a');
+    EXPECT_EQ(OK, s.appendFormat("[%s]", longArg.c_str()));
+    EXPECT_EQ("x=42, y=foo[" + longArg + "]", std::string(s.c_str()));
+    EXPECT_EQ(11U + 1002U, s.length());
+
+    EXPECT_EQ(OK, s.appendFormat("%s", ""));
+    EXPECT_EQ(11U + 1002U, s.length());
+}
+
+TEST_F(String8Test, appendFormatLeavesCopiesAlone) {
+    String8 s;
+    ASSERT_EQ(OK, s.reserve(4096));
+    s.append("foo");
+    String8 copy(s);
+    EXPECT_EQ(OK, s.appendFormat("%s", std::string(300, 'b').c_str()));
+    EXPECT_STREQ("foo", copy);
+    EXPECT_EQ(303U, s.length());
+}
+
+TEST_F(String8Test, reserve) {
+    String8 s;
+    ASSERT_EQ(OK, s.reserve(4096));
+    EXPECT_STREQ("", s);
+    EXPECT_EQ(0U, s.length());
+
+    const char* data = s.c_str();
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(OK, s.appendFormat("line %d\n", i));
+        ASSERT_EQ(OK, s.append("more "));
+    }
+    EXPECT_EQ(data, s.c_str()) << "appends within the reserved capacity reallocated";
+    EXPECT_EQ(0, strncmp("line 0\nmore line 1\n", s.c_str(), 19));
+
+    EXPECT_EQ(OK, s.reserve(10));
+    EXPECT_EQ(data, s.c_str());
+    EXPECT_EQ(NO_MEMORY, s.reserve(SIZE_MAX));
+}
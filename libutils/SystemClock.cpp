@@ -47,7 +47,11 @@ int64_t uptimeMillis()
  */
 int64_t uptimeNanos()
 {
+#if defined(__linux__)
+    return uptimeNanosInline();
+#else
     return systemTime(SYSTEM_TIME_MONOTONIC);
+#endif
 }
 
 /*
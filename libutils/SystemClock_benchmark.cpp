@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/SystemClock.h>
+#include <utils/Timers.h>
+
+static void BM_systemTime(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(systemTime(SYSTEM_TIME_MONOTONIC));
+    }
+}
+BENCHMARK(BM_systemTime);
+
+static void BM_uptimeNanos(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(android::uptimeNanos());
+    }
+}
+BENCHMARK(BM_uptimeNanos);
+
+static void BM_uptimeMillis(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(android::uptimeMillis());
+    }
+}
+BENCHMARK(BM_uptimeMillis);
+
+static void BM_uptimeNanosInline(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(android::uptimeNanosInline());
+    }
+}
+BENCHMARK(BM_uptimeNanosInline);
+
+static void BM_uptimeNanosCoarse(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(android::uptimeNanosCoarse());
+    }
+}
+BENCHMARK(BM_uptimeNanosCoarse);
+
+static void BM_uptimeMillisCoarse(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(android::uptimeMillisCoarse());
+    }
+}
+BENCHMARK(BM_uptimeMillisCoarse);
+
+static void BM_elapsedRealtimeNano(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(android::elapsedRealtimeNano());
+    }
+}
+BENCHMARK(BM_elapsedRealtimeNano);
+
+static void BM_elapsedRealtimeNanoInline(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(android::elapsedRealtimeNanoInline());
+    }
+}
+BENCHMARK(BM_elapsedRealtimeNanoInline);
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sched.h>
+
+#include <future>
+
+#include <gtest/gtest.h>
+#include <utils/Thread.h>
+
+using namespace android;
+
+static cpu_set_t getAffinity() {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    EXPECT_EQ(0, sched_getaffinity(0, sizeof(cpus), &cpus));
+    return cpus;
+}
+
+// A set holding just the last CPU we may run on, which differs from what new
+// threads inherit unless there is only one.
+static cpu_set_t lastAllowedCpu() {
+    cpu_set_t allowed = getAffinity();
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu = CPU_SETSIZE - 1; cpu >= 0; cpu--) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            CPU_SET(cpu, &cpus);
+            break;
+        }
+    }
+    return cpus;
+}
+
+static int recordAffinity(void* user) {
+    static_cast<std::promise<cpu_set_t>*>(user)->set_value(getAffinity());
+    return 0;
+}
+
+TEST(Thread, RawThreadAppliesCpuSet) {
+    ThreadAttributes attrs;
+    attrs.cpuSet = lastAllowedCpu();
+    std::promise<cpu_set_t> affinity;
+    ASSERT_TRUE(createRawThreadEtc(recordAffinity, &affinity, "affinity", PRIORITY_DEFAULT, 0,
+                                   attrs));
+    cpu_set_t cpus = affinity.get_future().get();
+    EXPECT_TRUE(CPU_EQUAL(&attrs.cpuSet, &cpus));
+}
+
+TEST(Thread, MissingClusterIsIgnored) {
+    ThreadAttributes attrs;
+    attrs.cluster = 1000;
+    std::promise<cpu_set_t> affinity;
+    ASSERT_TRUE(createRawThreadEtc(recordAffinity, &affinity, "affinity", PRIORITY_DEFAULT, 0,
+                                   attrs));
+    cpu_set_t expected = getAffinity();
+    cpu_set_t cpus = affinity.get_future().get();
+    EXPECT_TRUE(CPU_EQUAL(&expected, &cpus));
+}
+
+class AffinityThread : public Thread {
+public:
+    AffinityThread() : Thread(false) {}
+
+    std::promise<cpu_set_t> affinity;
+
+private:
+    status_t readyToRun() override {
+        affinity.set_value(getAffinity());
+        return OK;
+    }
+
+    bool threadLoop() override { return false; }
+};
+
+TEST(Thread, RunAppliesCpuSetBeforeReadyToRun) {
+    ThreadAttributes attrs;
+    attrs.cpuSet = lastAllowedCpu();
+    sp<AffinityThread> thread = sp<AffinityThread>::make();
+    ASSERT_EQ(OK, thread->run("affinity", PRIORITY_DEFAULT, 0, attrs));
+    cpu_set_t cpus = thread->affinity.get_future().get();
+    EXPECT_TRUE(CPU_EQUAL(&attrs.cpuSet, &cpus));
+    EXPECT_EQ(OK, thread->join());
+}
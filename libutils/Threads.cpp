@@ -31,14 +31,25 @@
 #endif
 
 #if defined(__linux__)
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
 #include <sys/prctl.h>
+
+#include <algorithm>
 #endif
 
+#include <cutils/threads.h>
 #include <utils/Log.h>
 
 #if defined(__ANDROID__)
 #include <processgroup/processgroup.h>
 #include <processgroup/sched_policy.h>
+
+// libutils doesn't depend on libprocessgroup: ThreadAttributes::taskProfiles
+// only works in processes that link it themselves.
+extern bool SetTaskProfiles(int tid, const std::vector<std::string>& profiles,
+                            bool use_fd_cache) __attribute__((weak));
 #endif
 
 #if defined(__ANDROID__)
@@ -67,26 +78,34 @@ using namespace android;
 
 typedef void* (*android_pthread_entry)(void*);
 
-#if defined(__ANDROID__)
+#if defined(__linux__)
 struct thread_data_t {
     thread_func_t   entryFunction;
     void*           userData;
     int             priority;
     char *          threadName;
+    ThreadAttributes* attrs;
 
     // we use this trampoline when we need to set the priority with
-    // nice/setpriority, and name with prctl.
+    // nice/setpriority, name with prctl, or apply ThreadAttributes.
     static int trampoline(const thread_data_t* t) {
         thread_func_t f = t->entryFunction;
         void* u = t->userData;
-        int prio = t->priority;
+        int prio __android_unused = t->priority;
         char * name = t->threadName;
+        ThreadAttributes* attrs = t->attrs;
         delete t;
+#if defined(__ANDROID__)
         setpriority(PRIO_PROCESS, 0, prio);
 
         if (name) {
             androidSetThreadName(name);
-            free(name);
+        }
+#endif
+        free(name);
+        if (attrs) {
+            applyThreadAttributes(*attrs);
+            delete attrs;
         }
         return f(u);
     }
@@ -114,19 +133,24 @@ void androidSetThreadName(const char* name) {
 #endif
 }
 
-int androidCreateRawThreadEtc(android_thread_func_t entryFunction,
-                               void *userData,
-                               const char* threadName __android_unused,
-                               int32_t threadPriority,
-                               size_t threadStackSize,
-                               android_thread_id_t *threadId)
+static int createRawThread(android_thread_func_t entryFunction,
+                           void *userData,
+                           const char* threadName __android_unused,
+                           int32_t threadPriority,
+                           size_t threadStackSize,
+                           const ThreadAttributes* attrs,
+                           android_thread_id_t *threadId)
 {
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
+#if defined(__linux__)
+    bool needsTrampoline = attrs != nullptr;
 #if defined(__ANDROID__)  /* valgrind is rejecting RT-priority create reqs */
-    if (threadPriority != PRIORITY_DEFAULT || threadName != NULL) {
+    needsTrampoline |= threadPriority != PRIORITY_DEFAULT || threadName != NULL;
+#endif
+    if (needsTrampoline) {
         // Now that the pthread_t has a method to find the associated
         // android_thread_id_t (pid) from pthread_t, it would be possible to avoid
         // this trampoline in some cases as the parent could set the properties
@@ -136,7 +160,12 @@ int androidCreateRawThreadEtc(android_thread_func_t entryFunction,
         // proposed but not yet accepted.
         thread_data_t* t = new thread_data_t;
         t->priority = threadPriority;
+#if defined(__ANDROID__)
         t->threadName = threadName ? strdup(threadName) : NULL;
+#else
+        t->threadName = NULL;
+#endif
+        t->attrs = attrs ? new ThreadAttributes(*attrs) : nullptr;
         t->entryFunction = entryFunction;
         t->userData = userData;
         entryFunction = (android_thread_func_t)&thread_data_t::trampoline;
@@ -157,6 +186,14 @@ int androidCreateRawThreadEtc(android_thread_func_t entryFunction,
         ALOGE("androidCreateRawThreadEtc failed (entry=%p, res=%d, %s)\n"
              "(android threadPriority=%d)",
             entryFunction, result, strerror(errno), threadPriority);
+#if defined(__linux__)
+        if (entryFunction == (android_thread_func_t)&thread_data_t::trampoline) {
+            thread_data_t* t = static_cast<thread_data_t*>(userData);
+            free(t->threadName);
+            delete t->attrs;
+            delete t;
+        }
+#endif
         return 0;
     }
 
@@ -169,6 +206,130 @@ int androidCreateRawThreadEtc(android_thread_func_t entryFunction,
     return 1;
 }
 
+int androidCreateRawThreadEtc(android_thread_func_t entryFunction,
+                               void *userData,
+                               const char* threadName,
+                               int32_t threadPriority,
+                               size_t threadStackSize,
+                               android_thread_id_t *threadId)
+{
+    return createRawThread(entryFunction, userData, threadName, threadPriority,
+                           threadStackSize, nullptr, threadId);
+}
+
+#if defined(__linux__)
+// Reads a sysfs list of CPUs, such as "0-3,6" or "0 1 2 3", into cpus.
+static bool readCpuList(const char* path, cpu_set_t* cpus)
+{
+    FILE* fp = fopen(path, "re");
+    if (fp == nullptr) {
+        return false;
+    }
+    char buf[1024];
+    size_t length = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[length] = '\0';
+
+    CPU_ZERO(cpus);
+    for (char* p = buf; *p != '\0';) {
+        if (!isdigit(*p)) {
+            p++;
+            continue;
+        }
+        long first = strtol(p, &p, 10);
+        long last = first;
+        if (*p == '-') {
+            last = strtol(p + 1, &p, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+
+// Finds the CPUs of a cluster, numbered as described by ThreadAttributes.
+static bool getClusterCpus(int cluster, cpu_set_t* cpus)
+{
+    // Policies are named after their first CPU, so they sort in cluster order.
+    std::vector<int> policies;
+    DIR* dir = opendir("/sys/devices/system/cpu/cpufreq");
+    if (dir != nullptr) {
+        while (dirent* entry = readdir(dir)) {
+            int policy;
+            if (sscanf(entry->d_name, "policy%d", &policy) == 1) {
+                policies.push_back(policy);
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(policies.begin(), policies.end());
+
+    char path[PATH_MAX];
+    if (!policies.empty()) {
+        if (static_cast<size_t>(cluster) >= policies.size()) {
+            return false;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpufreq/policy%d/related_cpus",
+                 policies[cluster]);
+    } else {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", cluster);
+    }
+    return readCpuList(path, cpus);
+}
+
+namespace android {
+
+void applyThreadAttributes(const ThreadAttributes& attrs)
+{
+    cpu_set_t cpus = attrs.cpuSet;
+    bool setAffinity = CPU_COUNT(&cpus) > 0;
+    cpu_set_t clusterCpus;
+    if (attrs.cluster >= 0 && getClusterCpus(attrs.cluster, &clusterCpus)) {
+        if (!setAffinity) {
+            cpus = clusterCpus;
+            setAffinity = true;
+        } else {
+            cpu_set_t both;
+            CPU_AND(&both, &cpus, &clusterCpus);
+            if (CPU_COUNT(&both) > 0) {
+                cpus = both;
+            }
+        }
+    }
+    if (setAffinity && sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        ALOGW("Couldn't set the CPU affinity of thread %d: %s", gettid(), strerror(errno));
+    }
+
+    if (!attrs.taskProfiles.empty()) {
+#if defined(__ANDROID__)
+        if (reinterpret_cast<uintptr_t>(SetTaskProfiles) == 0) {
+            ALOGW("SetTaskProfiles not linked, can't apply task profiles to thread %d",
+                  gettid());
+        } else if (!SetTaskProfiles(gettid(), attrs.taskProfiles, false)) {
+            ALOGW("Couldn't apply the task profiles of thread %d", gettid());
+        }
+#else
+        ALOGW("Task profiles aren't supported, ignoring those of thread %d", gettid());
+#endif
+    }
+}
+
+bool createRawThreadEtc(thread_func_t entryFunction,
+                        void *userData,
+                        const char* threadName,
+                        int32_t threadPriority,
+                        size_t threadStackSize,
+                        const ThreadAttributes& attrs,
+                        thread_id_t *threadId)
+{
+    return createRawThread(entryFunction, userData, threadName, threadPriority,
+                           threadStackSize, &attrs, threadId) ? true : false;
+}
+
+}  // namespace android
+#endif
+
 #if defined(__ANDROID__)
 static pthread_t android_thread_id_t_to_pthread(android_thread_id_t thread)
 {
@@ -656,6 +817,35 @@ status_t Thread::readyToRun()
 }
 
 status_t Thread::run(const char* name, int32_t priority, size_t stack)
+{
+    return runInternal(name, priority, stack, nullptr);
+}
+
+#if defined(__linux__)
+status_t Thread::run(const char* name, int32_t priority, size_t stack,
+                     const ThreadAttributes& attrs)
+{
+    return runInternal(name, priority, stack, &attrs);
+}
+
+// What _threadLoopWithAttributes() is started with.
+struct thread_loop_data_t {
+    Thread* self;
+    ThreadAttributes attrs;
+};
+
+int Thread::_threadLoopWithAttributes(void* user)
+{
+    thread_loop_data_t* data = static_cast<thread_loop_data_t*>(user);
+    Thread* const self = data->self;
+    applyThreadAttributes(data->attrs);
+    delete data;
+    return _threadLoop(self);
+}
+#endif
+
+status_t Thread::runInternal(const char* name, int32_t priority, size_t stack,
+                             const ThreadAttributes* attrs __android_unused)
 {
     LOG_ALWAYS_FATAL_IF(name == nullptr, "thread name not provided to Thread::run");
 
@@ -677,16 +867,32 @@ status_t Thread::run(const char* name, int32_t priority, size_t stack)
 
     mRunning = true;
 
+    thread_func_t entryFunction = _threadLoop;
+    void* userData = this;
+#if defined(__linux__)
+    // Applied by _threadLoopWithAttributes() rather than the raw trampoline,
+    // since threads that can call Java are created by the runtime's function.
+    thread_loop_data_t* data = nullptr;
+    if (attrs != nullptr) {
+        data = new thread_loop_data_t{this, *attrs};
+        entryFunction = _threadLoopWithAttributes;
+        userData = data;
+    }
+#endif
+
     bool res;
     if (mCanCallJava) {
-        res = createThreadEtc(_threadLoop,
-                this, name, priority, stack, &mThread);
+        res = createThreadEtc(entryFunction,
+                userData, name, priority, stack, &mThread);
     } else {
-        res = androidCreateRawThreadEtc(_threadLoop,
-                this, name, priority, stack, &mThread);
+        res = androidCreateRawThreadEtc(entryFunction,
+                userData, name, priority, stack, &mThread);
     }
 
     if (res == false) {
+#if defined(__linux__)
+        delete data;
+#endif
         mStatus = UNKNOWN_ERROR;   // something happened!
         mRunning = false;
         mThread = thread_id_t(-1);
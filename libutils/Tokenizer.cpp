@@ -18,6 +18,7 @@
 
 #include <utils/Tokenizer.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <utils/Log.h>
 
@@ -27,9 +28,34 @@
 
 namespace android {
 
-static inline bool isDelimiter(char ch, const char* delimiters) {
-    return strchr(delimiters, ch) != nullptr;
-}
+/*
+ * The set of delimiter characters passed to nextToken() or skipDelimiters(),
+ * looked up in a table rather than by strchr() for each character. As with
+ * strchr(), the terminating null counts as one of the delimiters, which is what
+ * makes tokens stop at embedded nulls.
+ */
+class DelimiterSet {
+public:
+    explicit DelimiterSet(const char* delimiters) : mBits() {
+        add('\0');
+        while (*delimiters) {
+            add(*delimiters++);
+        }
+    }
+
+    inline bool contains(char ch) const {
+        uint8_t index = static_cast<uint8_t>(ch);
+        return mBits[index / 64] & (uint64_t(1) << (index % 64));
+    }
+
+private:
+    inline void add(char ch) {
+        uint8_t index = static_cast<uint8_t>(ch);
+        mBits[index / 64] |= uint64_t(1) << (index % 64);
+    }
+
+    uint64_t mBits[4];
+};
 
 Tokenizer::Tokenizer(const String8& filename, FileMap* fileMap, char* buffer,
         bool ownBuffer, size_t length) :
@@ -110,32 +136,42 @@ String8 Tokenizer::getLocation() const {
 }
 
 String8 Tokenizer::peekRemainderOfLine() const {
+    std::string_view line = peekRemainderOfLineView();
+    return String8(line.data(), line.size());
+}
+
+std::string_view Tokenizer::peekRemainderOfLineView() const {
     const char* end = getEnd();
-    const char* eol = mCurrent;
-    while (eol != end) {
-        char ch = *eol;
-        if (ch == '\n') {
-            break;
+    const char* eol = end;
+    if (mCurrent != end) {
+        eol = static_cast<const char*>(memchr(mCurrent, '\n', end - mCurrent));
+        if (eol == nullptr) {
+            eol = end;
         }
-        eol += 1;
     }
-    return String8(mCurrent, eol - mCurrent);
+    return std::string_view(mCurrent, eol - mCurrent);
 }
 
 String8 Tokenizer::nextToken(const char* delimiters) {
+    std::string_view token = nextTokenView(delimiters);
+    return String8(token.data(), token.size());
+}
+
+std::string_view Tokenizer::nextTokenView(const char* delimiters) {
 #if DEBUG_TOKENIZER
     ALOGD("nextToken");
 #endif
+    DelimiterSet delimiterSet(delimiters);
     const char* end = getEnd();
     const char* tokenStart = mCurrent;
     while (mCurrent != end) {
         char ch = *mCurrent;
-        if (ch == '\n' || isDelimiter(ch, delimiters)) {
+        if (ch == '\n' || delimiterSet.contains(ch)) {
             break;
         }
         mCurrent += 1;
     }
-    return String8(tokenStart, mCurrent - tokenStart);
+    return std::string_view(tokenStart, mCurrent - tokenStart);
 }
 
 void Tokenizer::nextLine() {
@@ -156,10 +192,11 @@ void Tokenizer::skipDelimiters(const char* delimiters) {
 #if DEBUG_TOKENIZER
     ALOGD("skipDelimiters");
 #endif
+    DelimiterSet delimiterSet(delimiters);
     const char* end = getEnd();
     while (mCurrent != end) {
         char ch = *mCurrent;
-        if (ch == '\n' || !isDelimiter(ch, delimiters)) {
+        if (ch == '\n' || !delimiterSet.contains(ch)) {
             break;
         }
         mCurrent += 1;
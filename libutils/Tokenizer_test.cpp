@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/Tokenizer.h>
+
+#include <memory>
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+namespace android {
+
+static const char* WHITESPACE = " \t\r";
+
+static std::unique_ptr<Tokenizer> fromContents(const char* contents) {
+    Tokenizer* tokenizer;
+    EXPECT_EQ(OK, Tokenizer::fromContents(String8("test.kl"), contents, &tokenizer));
+    return std::unique_ptr<Tokenizer>(tokenizer);
+}
+
+TEST(TokenizerTest, Tokens) {
+    auto tokenizer = fromContents("key 1   ESCAPE\n\tkey 2 1 # comment\n");
+
+    EXPECT_EQ("key", tokenizer->nextTokenView(WHITESPACE));
+    tokenizer->skipDelimiters(WHITESPACE);
+    EXPECT_STREQ("1", tokenizer->nextToken(WHITESPACE).c_str());
+    tokenizer->skipDelimiters(WHITESPACE);
+    EXPECT_EQ("ESCAPE", tokenizer->nextTokenView(WHITESPACE));
+    EXPECT_TRUE(tokenizer->isEol());
+    EXPECT_EQ("", tokenizer->nextTokenView(WHITESPACE));
+
+    tokenizer->nextLine();
+    EXPECT_EQ(2, tokenizer->getLineNumber());
+    EXPECT_EQ("", tokenizer->nextTokenView(WHITESPACE)) << "should stop at a delimiter";
+    tokenizer->skipDelimiters(WHITESPACE);
+    EXPECT_EQ("key 2 1 # comment", tokenizer->peekRemainderOfLineView());
+    EXPECT_STREQ("key 2 1 # comment", tokenizer->peekRemainderOfLine().c_str());
+    EXPECT_EQ("key", tokenizer->nextTokenView(WHITESPACE));
+
+    tokenizer->nextLine();
+    EXPECT_TRUE(tokenizer->isEof());
+    EXPECT_EQ("", tokenizer->peekRemainderOfLineView());
+    EXPECT_EQ("", tokenizer->nextTokenView(WHITESPACE));
+}
+
+TEST(TokenizerTest, ViewsPointIntoBuffer) {
+    const char* contents = "first second";
+    auto tokenizer = fromContents(contents);
+
+    std::string_view first = tokenizer->nextTokenView(WHITESPACE);
+    tokenizer->skipDelimiters(WHITESPACE);
+    std::string_view second = tokenizer->peekRemainderOfLineView();
+    EXPECT_EQ(contents, first.data());
+    EXPECT_EQ(contents + 6, second.data());
+    EXPECT_EQ(6u, second.size());
+}
+
+TEST(TokenizerTest, HighBitDelimiters) {
+    auto tokenizer = fromContents("a\xA0\xA0" "b c");
+
+    EXPECT_EQ("a", tokenizer->nextTokenView("\xA0"));
+    tokenizer->skipDelimiters("\xA0");
+    EXPECT_EQ("b c", tokenizer->nextTokenView("\xA0"));
+}
+
+TEST(TokenizerTest, EmbeddedNulls) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    ASSERT_TRUE(android::base::WriteStringToFd(std::string("ab\0\0cd\n", 7), tf.fd));
+
+    Tokenizer* rawTokenizer;
+    ASSERT_EQ(OK, Tokenizer::open(String8(tf.path), &rawTokenizer));
+    std::unique_ptr<Tokenizer> tokenizer(rawTokenizer);
+
+    EXPECT_EQ("ab", tokenizer->nextTokenView(""));
+    tokenizer->skipDelimiters("");
+    EXPECT_EQ("cd", tokenizer->nextTokenView(WHITESPACE));
+    EXPECT_TRUE(tokenizer->isEol());
+}
+
+} // namespace android
@@ -18,10 +18,19 @@
 
 #include <android-base/macros.h>
 #include <limits.h>
+#include <string.h>
 #include <utils/Unicode.h>
 
 #include <log/log.h>
 
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 extern "C" {
 
 static const char32_t kByteMask = 0x000000BF;
@@ -52,6 +61,94 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+// --------------------------------------------------------------------------
+// ASCII
+// --------------------------------------------------------------------------
+
+// Most strings converted between UTF-8 and UTF-16, like binder interface
+// descriptors, are entirely ASCII. The helpers below convert the ASCII prefix of
+// a string a vector at a time; the callers then handle the next character one
+// code point at a time as before. If dst is null they only measure the prefix.
+// An ASCII character is one unit in either encoding, so this doesn't change
+// what is accepted or how anything else is converted.
+
+static size_t utf8_to_utf16_ascii_prefix(const uint8_t* src, size_t len, char16_t* dst)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(bytes)) break;
+        if (dst) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(bytes, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8),
+                             _mm_unpackhi_epi8(bytes, zero));
+        }
+    }
+#elif defined(__aarch64__)
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t bytes = vld1q_u8(src + i);
+        if (vmaxvq_u8(bytes) >= 0x80) break;
+        if (dst) {
+            vst1q_u16(reinterpret_cast<uint16_t*>(dst + i), vmovl_u8(vget_low_u8(bytes)));
+            vst1q_u16(reinterpret_cast<uint16_t*>(dst + i + 8), vmovl_u8(vget_high_u8(bytes)));
+        }
+    }
+#else
+    for (; i + 8 <= len; i += 8) {
+        uint64_t bytes;
+        memcpy(&bytes, src + i, sizeof(bytes));
+        if (bytes & 0x8080808080808080ULL) break;
+        if (dst) {
+            for (size_t j = 0; j < 8; j++) dst[i + j] = src[i + j];
+        }
+    }
+#endif
+    for (; i < len && src[i] < 0x80; i++) {
+        if (dst) dst[i] = src[i];
+    }
+    return i;
+}
+
+static size_t utf16_to_utf8_ascii_prefix(const char16_t* src, size_t len, char* dst)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i nonAsciiMask = _mm_set1_epi16(static_cast<short>(0xFF80));
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= len; i += 8) {
+        __m128i units = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(units, nonAsciiMask), zero);
+        if (_mm_movemask_epi8(ascii) != 0xFFFF) break;
+        if (dst) {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(units, units));
+        }
+    }
+#elif defined(__aarch64__)
+    for (; i + 8 <= len; i += 8) {
+        uint16x8_t units = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i));
+        if (vmaxvq_u16(units) >= 0x80) break;
+        if (dst) {
+            vst1_u8(reinterpret_cast<uint8_t*>(dst + i), vmovn_u16(units));
+        }
+    }
+#else
+    for (; i + 4 <= len; i += 4) {
+        uint64_t units;
+        memcpy(&units, src + i, sizeof(units));
+        if (units & 0xFF80FF80FF80FF80ULL) break;
+        if (dst) {
+            for (size_t j = 0; j < 4; j++) dst[i + j] = static_cast<char>(src[i + j]);
+        }
+    }
+#endif
+    for (; i < len && src[i] < 0x80; i++) {
+        if (dst) dst[i] = static_cast<char>(src[i]);
+    }
+    return i;
+}
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -290,6 +387,15 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst, size_t dst_le
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
+        size_t ascii = utf16_to_utf8_ascii_prefix(
+                cur_utf16, std::min<size_t>(end_utf16 - cur_utf16, dst_len), cur);
+        cur_utf16 += ascii;
+        cur += ascii;
+        dst_len -= ascii;
+        if (cur_utf16 == end_utf16) {
+            break;
+        }
+
         char32_t utf32;
         // surrogate pairs
         if((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16
@@ -324,7 +430,11 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     const char16_t* const end = src + src_len;
     while (src < end) {
         size_t char_len;
-        if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
+        size_t ascii = utf16_to_utf8_ascii_prefix(src, end - src, nullptr);
+        if (ascii) {
+            char_len = ascii;
+            src += ascii;
+        } else if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
                 && (*(src + 1) & 0xFC00) == 0xDC00) {
             // surrogate pairs are always 4 bytes.
             char_len = 4;
@@ -402,6 +512,13 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len, bool overreadIs
     /* Validate that the UTF-8 is the correct len */
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
+        size_t ascii = utf8_to_utf16_ascii_prefix(u8cur, u8end - u8cur, nullptr);
+        u16measuredLen += ascii;
+        u8cur += ascii;
+        if (u8cur == u8end) {
+            break;
+        }
+
         u16measuredLen++;
         int u8charLen = utf8_codepoint_len(*u8cur);
         // Malformed utf8, some characters are beyond the end.
@@ -455,6 +572,14 @@ char16_t* utf8_to_utf16_no_null_terminator(
     char16_t* u16cur = dst;
 
     while (u8cur < u8end && u16cur < u16end) {
+        size_t ascii = utf8_to_utf16_ascii_prefix(
+                u8cur, std::min<size_t>(u8end - u8cur, u16end - u16cur), u16cur);
+        u8cur += ascii;
+        u16cur += ascii;
+        if (u8cur == u8end || u16cur == u16end) {
+            break;
+        }
+
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
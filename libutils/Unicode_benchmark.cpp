@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+// An ASCII string the size of the benchmark argument, like a binder interface
+// descriptor.
+static std::string asciiString(benchmark::State& state) {
+    std::string s;
+    while (s.size() < static_cast<size_t>(state.range(0))) {
+        s += "android.hardware.IDescriptor.";
+    }
+    s.resize(state.range(0));
+    return s;
+}
+
+// The same string with a non-ASCII character every 16 bytes, which keeps the
+// ASCII fast paths from getting very far.
+static std::string mixedString(benchmark::State& state) {
+    std::string s;
+    while (s.size() < static_cast<size_t>(state.range(0))) {
+        s += "android.hardw\xC3\xA9.";
+    }
+    s.resize(state.range(0));
+    return s;
+}
+
+static void BM_String16_from_utf8(benchmark::State& state, const std::string& s) {
+    for (auto _ : state) {
+        android::String16 u16(s.c_str(), s.size());
+        benchmark::DoNotOptimize(u16.string());
+    }
+    state.SetBytesProcessed(state.iterations() * s.size());
+}
+
+static void BM_String8_from_utf16(benchmark::State& state, const std::string& s) {
+    android::String16 u16(s.c_str(), s.size());
+    for (auto _ : state) {
+        android::String8 u8(u16);
+        benchmark::DoNotOptimize(u8.c_str());
+    }
+    state.SetBytesProcessed(state.iterations() * s.size());
+}
+
+static void BM_String16_from_ascii(benchmark::State& state) {
+    BM_String16_from_utf8(state, asciiString(state));
+}
+BENCHMARK(BM_String16_from_ascii)->Arg(16)->Arg(64)->Arg(1024);
+
+static void BM_String16_from_mixed(benchmark::State& state) {
+    BM_String16_from_utf8(state, mixedString(state));
+}
+BENCHMARK(BM_String16_from_mixed)->Arg(16)->Arg(64)->Arg(1024);
+
+static void BM_String8_from_ascii(benchmark::State& state) {
+    BM_String8_from_utf16(state, asciiString(state));
+}
+BENCHMARK(BM_String8_from_ascii)->Arg(16)->Arg(64)->Arg(1024);
+
+static void BM_String8_from_mixed(benchmark::State& state) {
+    BM_String8_from_utf16(state, mixedString(state));
+}
+BENCHMARK(BM_String8_from_mixed)->Arg(16)->Arg(64)->Arg(1024);
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the UTF-8 <-> UTF-16 conversions in Unicode.cpp, which have vector
+// fast paths for ASCII, against the plain one-code-point-at-a-time versions
+// they were written from.
+
+#include <string.h>
+
+#include <vector>
+
+#include "fuzzer/FuzzedDataProvider.h"
+#include "utils/Unicode.h"
+
+static constexpr size_t MAX_STRING_UNITS = 1024;
+
+namespace {
+
+size_t ref_utf32_codepoint_utf8_length(char32_t srcChar) {
+    if (srcChar < 0x00000080) {
+        return 1;
+    } else if (srcChar < 0x00000800) {
+        return 2;
+    } else if (srcChar < 0x00010000) {
+        if ((srcChar < 0x0000D800) || (srcChar > 0x0000DFFF)) {
+            return 3;
+        } else {
+            // Surrogates are invalid UTF-32 characters.
+            return 0;
+        }
+    } else if (srcChar <= 0x0010FFFF) {
+        return 4;
+    } else {
+        // Invalid UTF-32 character.
+        return 0;
+    }
+}
+
+void ref_utf32_codepoint_to_utf8(uint8_t* dstP, char32_t srcChar, size_t bytes) {
+    static const char32_t kFirstByteMark[] = {0x00000000, 0x00000000, 0x000000C0, 0x000000E0,
+                                              0x000000F0};
+    dstP += bytes;
+    switch (bytes) {
+        case 4:
+            *--dstP = (uint8_t)((srcChar | 0x80) & 0xBF);
+            srcChar >>= 6;
+            [[fallthrough]];
+        case 3:
+            *--dstP = (uint8_t)((srcChar | 0x80) & 0xBF);
+            srcChar >>= 6;
+            [[fallthrough]];
+        case 2:
+            *--dstP = (uint8_t)((srcChar | 0x80) & 0xBF);
+            srcChar >>= 6;
+            [[fallthrough]];
+        case 1:
+            *--dstP = (uint8_t)(srcChar | kFirstByteMark[bytes]);
+    }
+}
+
+ssize_t ref_utf16_to_utf8_length(const char16_t* src, size_t src_len) {
+    if (src == nullptr || src_len == 0) {
+        return -1;
+    }
+    size_t ret = 0;
+    const char16_t* const end = src + src_len;
+    while (src < end) {
+        if ((*src & 0xFC00) == 0xD800 && (src + 1) < end && (*(src + 1) & 0xFC00) == 0xDC00) {
+            ret += 4;
+            src += 2;
+        } else {
+            ret += ref_utf32_codepoint_utf8_length((char32_t)*src++);
+        }
+    }
+    return ret;
+}
+
+void ref_utf16_to_utf8(const char16_t* src, size_t src_len, char* dst) {
+    const char16_t* cur_utf16 = src;
+    const char16_t* const end_utf16 = src + src_len;
+    char* cur = dst;
+    while (cur_utf16 < end_utf16) {
+        char32_t utf32;
+        if ((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16 &&
+            (*(cur_utf16 + 1) & 0xFC00) == 0xDC00) {
+            utf32 = (*cur_utf16++ - 0xD800) << 10;
+            utf32 |= *cur_utf16++ - 0xDC00;
+            utf32 += 0x10000;
+        } else {
+            utf32 = (char32_t)*cur_utf16++;
+        }
+        const size_t len = ref_utf32_codepoint_utf8_length(utf32);
+        ref_utf32_codepoint_to_utf8((uint8_t*)cur, utf32, len);
+        cur += len;
+    }
+    *cur = '\0';
+}
+
+size_t ref_utf8_codepoint_len(uint8_t ch) {
+    return ((0xe5000000 >> ((ch >> 3) & 0x1e)) & 3) + 1;
+}
+
+uint32_t ref_utf8_to_utf32_codepoint(const uint8_t* src, size_t length) {
+    uint32_t unicode = src[0] & (0xff >> (length == 1 ? 0 : length + 1));
+    for (size_t i = 1; i < length; i++) {
+        unicode = (unicode << 6) | (src[i] & 0x3F);
+    }
+    return unicode;
+}
+
+ssize_t ref_utf8_to_utf16_length(const uint8_t* u8str, size_t u8len) {
+    const uint8_t* const u8end = u8str + u8len;
+    const uint8_t* u8cur = u8str;
+    size_t u16measuredLen = 0;
+    while (u8cur < u8end) {
+        u16measuredLen++;
+        size_t u8charLen = ref_utf8_codepoint_len(*u8cur);
+        if (u8cur + u8charLen - 1 >= u8end) {
+            return -1;
+        }
+        if (ref_utf8_to_utf32_codepoint(u8cur, u8charLen) > 0xFFFF) u16measuredLen++;
+        u8cur += u8charLen;
+    }
+    return u16measuredLen;
+}
+
+char16_t* ref_utf8_to_utf16_no_null_terminator(const uint8_t* src, size_t srcLen, char16_t* dst,
+                                               size_t dstLen) {
+    const uint8_t* const u8end = src + srcLen;
+    const uint8_t* u8cur = src;
+    const char16_t* const u16end = dst + dstLen;
+    char16_t* u16cur = dst;
+    while (u8cur < u8end && u16cur < u16end) {
+        size_t u8len = ref_utf8_codepoint_len(*u8cur);
+        uint32_t codepoint = ref_utf8_to_utf32_codepoint(u8cur, u8len);
+        if (codepoint <= 0xFFFF) {
+            *u16cur++ = (char16_t)codepoint;
+        } else {
+            codepoint = codepoint - 0x10000;
+            *u16cur++ = (char16_t)((codepoint >> 10) + 0xD800);
+            if (u16cur >= u16end) {
+                return u16cur - 1;
+            }
+            *u16cur++ = (char16_t)((codepoint & 0x3FF) + 0xDC00);
+        }
+        u8cur += u8len;
+    }
+    return u16cur;
+}
+
+#define CHECK(cond) \
+    if (!(cond)) __builtin_trap()
+
+void checkUtf8(const std::vector<uint8_t>& u8) {
+    ssize_t u16len = utf8_to_utf16_length(u8.data(), u8.size());
+    CHECK(u16len == ref_utf8_to_utf16_length(u8.data(), u8.size()));
+    if (u16len < 0) {
+        return;
+    }
+
+    // Also convert into a buffer that is too short, which stops part way.
+    for (size_t dstLen : {static_cast<size_t>(u16len), static_cast<size_t>(u16len) / 2}) {
+        std::vector<char16_t> actual(dstLen + 1, 0xAAAA);
+        std::vector<char16_t> expected(dstLen + 1, 0xAAAA);
+        char16_t* actualEnd =
+                utf8_to_utf16_no_null_terminator(u8.data(), u8.size(), actual.data(), dstLen);
+        char16_t* expectedEnd = ref_utf8_to_utf16_no_null_terminator(u8.data(), u8.size(),
+                                                                     expected.data(), dstLen);
+        CHECK(actualEnd - actual.data() == expectedEnd - expected.data());
+        CHECK(actual == expected);
+    }
+}
+
+void checkUtf16(const std::vector<char16_t>& u16) {
+    ssize_t u8len = utf16_to_utf8_length(u16.data(), u16.size());
+    CHECK(u8len == ref_utf16_to_utf8_length(u16.data(), u16.size()));
+    if (u8len < 0) {
+        return;
+    }
+
+    std::vector<char> actual(u8len + 1, 0x55);
+    std::vector<char> expected(u8len + 1, 0x55);
+    utf16_to_utf8(u16.data(), u16.size(), actual.data(), actual.size());
+    ref_utf16_to_utf8(u16.data(), u16.size(), expected.data());
+    CHECK(actual == expected);
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    FuzzedDataProvider dataProvider(data, size);
+
+    // Surround the fuzzed units with runs of ASCII, so that the fast paths see
+    // whole vectors and are left part way through one.
+    size_t prefix = dataProvider.ConsumeIntegralInRange<size_t>(0, 64);
+    size_t suffix = dataProvider.ConsumeIntegralInRange<size_t>(0, 64);
+    std::vector<uint8_t> bytes = dataProvider.ConsumeBytes<uint8_t>(
+            dataProvider.ConsumeIntegralInRange<size_t>(0, MAX_STRING_UNITS));
+
+    std::vector<uint8_t> u8(prefix, 'a');
+    u8.insert(u8.end(), bytes.begin(), bytes.end());
+    u8.insert(u8.end(), suffix, 'z');
+    checkUtf8(u8);
+
+    std::vector<char16_t> u16(prefix, u'a');
+    for (size_t i = 0; i + 1 < bytes.size(); i += 2) {
+        // Keep most units in the ASCII range, so that runs of ASCII are broken
+        // up by the occasional Latin-1 unit, wider unit or surrogate.
+        char16_t unit = bytes[i] | (bytes[i + 1] << 8);
+        if (bytes[i + 1] & 0x80) {
+            u16.push_back(unit);
+        } else if (bytes[i + 1] & 0x40) {
+            u16.push_back(unit & 0xFF);
+        } else {
+            u16.push_back(unit & 0x7F);
+        }
+    }
+    u16.insert(u16.end(), suffix, u'z');
+    checkUtf16(u16);
+
+    return 0;
+}
@@ -19,6 +19,8 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <string>
+
 #include <log/log.h>
 #include <utils/Unicode.h>
 
@@ -186,4 +188,67 @@ TEST_F(UnicodeTest, InvalidUtf8OverreadDetected) {
             true /* overreadIsFatal */), "" /* regex for ASSERT_DEATH */);
 }
 
+// The conversions handle runs of ASCII a vector at a time; check that a
+// non-ASCII character is found wherever it falls relative to a vector.
+TEST_F(UnicodeTest, UTF8toUTF16NonASCIIAtEachPosition) {
+    for (size_t pos = 0; pos < 40; pos++) {
+        std::string utf8(40, 'a');
+        utf8.replace(pos, 1, "\xC4\x80");  // U+0100
+
+        const uint8_t* str = reinterpret_cast<const uint8_t*>(utf8.data());
+        ASSERT_EQ(40, utf8_to_utf16_length(str, utf8.size())) << "at " << pos;
+
+        char16_t output[41];
+        char16_t* end = utf8_to_utf16(str, utf8.size(), output, 41);
+        ASSERT_EQ(output + 40, end) << "at " << pos;
+        for (size_t i = 0; i < 40; i++) {
+            EXPECT_EQ(i == pos ? 0x0100 : 'a', output[i]) << "at " << pos << ", " << i;
+        }
+
+        // A buffer that ends before the non-ASCII character.
+        end = utf8_to_utf16_no_null_terminator(str, utf8.size(), output, pos);
+        EXPECT_EQ(output + pos, end) << "at " << pos;
+    }
+}
+
+TEST_F(UnicodeTest, UTF8toUTF16TruncatedAfterASCII) {
+    std::string utf8(37, 'a');
+    utf8 += "\xE2\x8C";  // U+2323, missing its last byte
+
+    EXPECT_EQ(-1, utf8_to_utf16_length(reinterpret_cast<const uint8_t*>(utf8.data()),
+                                       utf8.size()));
+}
+
+TEST_F(UnicodeTest, UTF16toUTF8NonASCIIAtEachPosition) {
+    for (size_t pos = 0; pos < 40; pos++) {
+        std::u16string utf16(40, u'a');
+        utf16[pos] = 0x00E9;  // 2 UTF-8 bytes
+
+        ASSERT_EQ(41, utf16_to_utf8_length(utf16.data(), utf16.size())) << "at " << pos;
+
+        char output[42];
+        utf16_to_utf8(utf16.data(), utf16.size(), output, sizeof(output));
+        std::string expected(40, 'a');
+        expected.replace(pos, 1, "\xC3\xA9");
+        EXPECT_EQ(expected, output) << "at " << pos;
+    }
+}
+
+TEST_F(UnicodeTest, UTF16toUTF8SurrogatePairAfterASCII) {
+    std::u16string utf16(20, u'a');
+    utf16 += u"\xD83D\xDE00";  // U+1F600
+    utf16 += std::u16string(20, u'b');
+
+    ASSERT_EQ(44, utf16_to_utf8_length(utf16.data(), utf16.size()));
+    char output[45];
+    utf16_to_utf8(utf16.data(), utf16.size(), output, sizeof(output));
+    EXPECT_EQ(std::string(20, 'a') + "\xF0\x9F\x98\x80" + std::string(20, 'b'), output);
+}
+
+TEST_F(UnicodeTest, UTF16toUTF8BufferTooSmall) {
+    std::u16string utf16(40, u'a');
+    char output[40];
+    ASSERT_DEATH(utf16_to_utf8(utf16.data(), utf16.size(), output, sizeof(output)), "");
+}
+
 }
@@ -35,6 +35,25 @@ namespace android {
 
 const size_t kMinVectorCapacity = 4;
 
+// Whether the items in |sb| can be moved to new storage with memcpy(), and the
+// old storage freed without destroying them.  That needs the storage to be ours
+// alone, as other vectors sharing it still refer to the items.
+static inline bool isRelocatable(uint32_t flags, const SharedBuffer* sb) {
+    const bool trivialMove = (flags & VectorImpl::HAS_TRIVIAL_MOVE) ||
+            ((flags & VectorImpl::HAS_TRIVIAL_COPY) && (flags & VectorImpl::HAS_TRIVIAL_DTOR));
+    return trivialMove && sb->onlyOwner();
+}
+
+// setCapacity() records the requested capacity in the storage's client metadata,
+// so that removing items does not shrink the storage below it.
+static inline size_t reservedCapacity(const SharedBuffer* sb) {
+    return sb->mClientMetadata;
+}
+
+static inline void setReservedCapacity(SharedBuffer* sb, size_t capacity) {
+    sb->mClientMetadata = capacity < UINT32_MAX ? capacity : UINT32_MAX;
+}
+
 static inline size_t max(size_t a, size_t b) {
     return a>b ? a : b;
 }
@@ -339,15 +358,23 @@ ssize_t VectorImpl::setCapacity(size_t new_capacity)
 
     size_t new_allocation_size = 0;
     LOG_ALWAYS_FATAL_IF(__builtin_mul_overflow(new_capacity, mItemSize, &new_allocation_size));
-    SharedBuffer* sb = SharedBuffer::alloc(new_allocation_size);
-    if (sb) {
-        void* array = sb->data();
-        _do_copy(array, mStorage, size());
-        release_storage();
-        mStorage = const_cast<void*>(array);
+    SharedBuffer* sb;
+    const SharedBuffer* cur_sb = mStorage ? SharedBuffer::bufferFromData(mStorage) : nullptr;
+    if (cur_sb && isRelocatable(mFlags, cur_sb)) {
+        sb = cur_sb->editResize(new_allocation_size);
+        if (!sb) {
+            return NO_MEMORY;
+        }
     } else {
-        return NO_MEMORY;
+        sb = SharedBuffer::alloc(new_allocation_size);
+        if (!sb) {
+            return NO_MEMORY;
+        }
+        _do_copy(sb->data(), mStorage, size());
+        release_storage();
     }
+    setReservedCapacity(sb, new_capacity);
+    mStorage = sb->data();
     return new_capacity;
 }
 
@@ -405,14 +432,13 @@ void* VectorImpl::_grow(size_t where, size_t amount)
                             "new_alloc_size overflow");
 
         // ALOGV("grow vector %p, new_capacity=%d", this, (int)new_capacity);
-        if ((mStorage) &&
-            (mCount==where) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
-        {
-            const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
+        const SharedBuffer* cur_sb = mStorage ? SharedBuffer::bufferFromData(mStorage) : nullptr;
+        const bool relocatable = cur_sb && isRelocatable(mFlags, cur_sb);
+        const size_t reserved = cur_sb ? reservedCapacity(cur_sb) : 0;
+        if (relocatable && mCount == where) {
             SharedBuffer* sb = cur_sb->editResize(new_alloc_size);
             if (sb) {
+                setReservedCapacity(sb, reserved);
                 mStorage = sb->data();
             } else {
                 return nullptr;
@@ -421,15 +447,24 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_alloc_size);
             if (sb) {
                 void* array = sb->data();
-                if (where != 0) {
-                    _do_copy(array, mStorage, where);
-                }
-                if (where != mCount) {
-                    const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
-                    void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
-                    _do_copy(dest, from, mCount-where);
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
+                if (relocatable) {
+                    // Move the items over and free the old storage without
+                    // destroying them.
+                    memcpy(array, mStorage, where*mItemSize);
+                    memcpy(dest, from, (mCount-where)*mItemSize);
+                    SharedBuffer::dealloc(cur_sb);
+                } else {
+                    if (where != 0) {
+                        _do_copy(array, mStorage, where);
+                    }
+                    if (where != mCount) {
+                        _do_copy(dest, from, mCount-where);
+                    }
+                    release_storage();
                 }
-                release_storage();
+                setReservedCapacity(sb, reserved);
                 mStorage = const_cast<void*>(array);
             } else {
                 return nullptr;
@@ -463,23 +498,27 @@ void VectorImpl::_shrink(size_t where, size_t amount)
     size_t new_size;
     LOG_ALWAYS_FATAL_IF(__builtin_sub_overflow(mCount, amount, &new_size));
 
-    if (new_size < (capacity() / 2)) {
+    const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
+    const size_t min_capacity = max(kMinVectorCapacity, reservedCapacity(cur_sb));
+    if (new_size < (capacity() / 2) && capacity() > min_capacity) {
         // NOTE: (new_size * 2) is safe because capacity didn't overflow and
         // new_size < (capacity / 2)).
-        const size_t new_capacity = max(kMinVectorCapacity, new_size * 2);
+        const size_t new_capacity = max(min_capacity, new_size * 2);
+        const size_t reserved = reservedCapacity(cur_sb);
+        const bool relocatable = isRelocatable(mFlags, cur_sb);
 
         // NOTE: (new_capacity * mItemSize), (where * mItemSize) and
         // ((where + amount) * mItemSize) beyond this point are safe because
         // we are always reducing the capacity of the underlying SharedBuffer.
         // In other words, (old_capacity * mItemSize) did not overflow, and
         // where < (where + amount) < new_capacity < old_capacity.
-        if ((where == new_size) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
+        if (relocatable &&
+            (where == new_size) &&
             (mFlags & HAS_TRIVIAL_DTOR))
         {
-            const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
             if (sb) {
+                setReservedCapacity(sb, reserved);
                 mStorage = sb->data();
             } else {
                 return;
@@ -488,15 +527,25 @@ void VectorImpl::_shrink(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
                 void* array = sb->data();
-                if (where != 0) {
-                    _do_copy(array, mStorage, where);
-                }
-                if (where != new_size) {
-                    const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
-                    void* dest = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
-                    _do_copy(dest, from, new_size - where);
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                void* dest = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
+                if (relocatable) {
+                    // Destroy the removed items, and move the others over
+                    // without destroying them.
+                    _do_destroy(reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize, amount);
+                    memcpy(array, mStorage, where*mItemSize);
+                    memcpy(dest, from, (new_size - where)*mItemSize);
+                    SharedBuffer::dealloc(cur_sb);
+                } else {
+                    if (where != 0) {
+                        _do_copy(array, mStorage, where);
+                    }
+                    if (where != new_size) {
+                        _do_copy(dest, from, new_size - where);
+                    }
+                    release_storage();
                 }
-                release_storage();
+                setReservedCapacity(sb, reserved);
                 mStorage = const_cast<void*>(array);
             } else{
                 return;
@@ -546,11 +595,19 @@ void VectorImpl::_do_splat(void* dest, const void* item, size_t num) const {
 }
 
 void VectorImpl::_do_move_forward(void* dest, const void* from, size_t num) const {
-    do_move_forward(dest, from, num);
+    if (!(mFlags & HAS_TRIVIAL_MOVE)) {
+        do_move_forward(dest, from, num);
+    } else {
+        memmove(dest, from, num*itemSize());
+    }
 }
 
 void VectorImpl::_do_move_backward(void* dest, const void* from, size_t num) const {
-    do_move_backward(dest, from, num);
+    if (!(mFlags & HAS_TRIVIAL_MOVE)) {
+        do_move_backward(dest, from, num);
+    } else {
+        memmove(dest, from, num*itemSize());
+    }
 }
 
 /*****************************************************************************/
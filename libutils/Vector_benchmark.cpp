@@ -15,6 +15,9 @@
  */
 
 #include <benchmark/benchmark.h>
+#include <utils/KeyedVector.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 #include <vector>
 
@@ -50,4 +53,77 @@ void BM_prepend_std_vector(benchmark::State& state) {
 }
 BENCHMARK(BM_prepend_std_vector);
 
+// Inserting into and removing from the middle moves half of the items each
+// time; for types with non-trivial copy constructors, like sp<> and String8,
+// that used to mean copying and destroying each of them.
+template <typename T>
+static void BM_insert_remove_middle(benchmark::State& state, const T& item) {
+    android::Vector<T> v;
+    for (int i = 0; i < state.range(0); i++) {
+        v.add(item);
+    }
+    while (state.KeepRunning()) {
+        v.insertAt(item, v.size() / 2);
+        v.removeAt(v.size() / 2);
+    }
+}
+
+class Item : public android::RefBase {};
+
+void BM_insert_remove_middle_sp(benchmark::State& state) {
+    BM_insert_remove_middle(state, android::sp<Item>::make());
+}
+BENCHMARK(BM_insert_remove_middle_sp)->Arg(16)->Arg(256)->Arg(4096);
+
+void BM_insert_remove_middle_string8(benchmark::State& state) {
+    BM_insert_remove_middle(state, android::String8("item"));
+}
+BENCHMARK(BM_insert_remove_middle_string8)->Arg(16)->Arg(256)->Arg(4096);
+
+// Growing reallocates; for items that are relocatable this no longer copies them.
+void BM_fill_android_vector_string8(benchmark::State& state) {
+    android::String8 item("item");
+    while (state.KeepRunning()) {
+        android::Vector<android::String8> v;
+        for (int i = 0; i < state.range(0); i++) {
+            v.push(item);
+        }
+    }
+}
+BENCHMARK(BM_fill_android_vector_string8)->Arg(16)->Arg(256)->Arg(4096);
+
+// Fills and drains a vector whose capacity was set up front, as users of
+// setCapacity() do for a queue; this used to shrink and regrow each time.
+void BM_fill_drain_reserved_android_vector(benchmark::State& state) {
+    android::Vector<android::String8> v;
+    v.setCapacity(state.range(0));
+    android::String8 item("item");
+    while (state.KeepRunning()) {
+        for (int i = 0; i < state.range(0); i++) {
+            v.push(item);
+        }
+        while (!v.isEmpty()) {
+            v.pop();
+        }
+    }
+}
+BENCHMARK(BM_fill_drain_reserved_android_vector)->Arg(16)->Arg(256)->Arg(4096);
+
+// KeyedVector is a SortedVector of key/value pairs, so adding and removing
+// keys moves the pairs after them.
+void BM_keyed_vector_add_lookup_remove(benchmark::State& state) {
+    android::KeyedVector<int, android::String8> v;
+    for (int i = 0; i < state.range(0); i++) {
+        v.add(i * 2, android::String8("value"));
+    }
+    int key = 1;
+    while (state.KeepRunning()) {
+        v.add(key, android::String8("value"));
+        benchmark::DoNotOptimize(v.indexOfKey(key));
+        v.removeItem(key);
+        key = (key + 2 * 7919) % (state.range(0) * 2);
+    }
+}
+BENCHMARK(BM_keyed_vector_add_lookup_remove)->Arg(16)->Arg(256)->Arg(4096);
+
 BENCHMARK_MAIN();
@@ -22,6 +22,8 @@
 
 #include <android/log.h>
 #include <gtest/gtest.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 
 namespace android {
@@ -145,4 +147,71 @@ TEST_F(VectorTest, removeItemsAt_overflow) {
     ASSERT_DEATH(v.removeItemsAt(SIZE_MAX, SIZE_MAX), "overflow");
 }
 
+TEST_F(VectorTest, Traits_DetectTriviallyCopyableTypes) {
+    struct Point {
+        int x;
+        int y;
+    };
+    EXPECT_TRUE(traits<Point>::has_trivial_copy);
+    EXPECT_TRUE(traits<Point>::has_trivial_move);
+    EXPECT_TRUE(traits<Point>::has_trivial_dtor);
+    EXPECT_FALSE(traits<String8>::has_trivial_copy);
+    EXPECT_TRUE(traits<String8>::has_trivial_move);
+}
+
+TEST_F(VectorTest, Relocation_KeepsReferenceCounts) {
+    class Counted : public RefBase {};
+    sp<Counted> item = sp<Counted>::make();
+
+    Vector<sp<Counted>> vector;
+    for (int i = 0; i < 100; i++) {
+        // Insert at the front and the back, so that both growing in place and
+        // into new storage move items.
+        vector.insertAt(item, 0);
+        vector.add(item);
+    }
+    EXPECT_EQ(201, item->getStrongCount());
+
+    while (vector.size() > 2) {
+        vector.removeAt(vector.size() / 2);
+    }
+    EXPECT_EQ(3, item->getStrongCount());
+
+    // Storage shared with a copy can't be relocated.
+    Vector<sp<Counted>> copy = vector;
+    for (int i = 0; i < 20; i++) {
+        vector.insertAt(item, 1);
+    }
+    EXPECT_EQ(25, item->getStrongCount());
+    EXPECT_EQ(2U, copy.size());
+
+    vector.clear();
+    copy.clear();
+    EXPECT_EQ(1, item->getStrongCount());
+}
+
+TEST_F(VectorTest, SetCapacity_RemovingItemsKeepsCapacity) {
+    Vector<String8> vector;
+    vector.setCapacity(64);
+    for (int i = 0; i < 48; i++) {
+        vector.add(String8::format("%d", i));
+    }
+    EXPECT_EQ(64U, vector.capacity());
+
+    vector.removeItemsAt(1, 46);
+    EXPECT_EQ(64U, vector.capacity()) << "removing items should not shrink below capacity set";
+    EXPECT_STREQ("0", vector[0].c_str());
+    EXPECT_STREQ("47", vector[1].c_str());
+
+    vector.clear();
+    EXPECT_EQ(64U, vector.capacity()) << "clearing should not shrink below capacity set";
+
+    for (int i = 0; i < 100; i++) {
+        vector.add(String8::format("%d", i));
+    }
+    vector.removeItemsAt(1, 98);
+    EXPECT_EQ(64U, vector.capacity()) << "shrinking should stop at the capacity set";
+    EXPECT_STREQ("99", vector[1].c_str());
+}
+
 } // namespace android
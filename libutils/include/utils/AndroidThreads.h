@@ -24,6 +24,12 @@
 # include <pthread.h>
 #endif
 
+#if defined(__cplusplus) && defined(__linux__)
+# include <sched.h>
+# include <string>
+# include <vector>
+#endif
+
 #include <utils/ThreadDefs.h>
 
 // ---------------------------------------------------------------------------
@@ -112,6 +118,44 @@ inline bool createThreadEtc(thread_func_t entryFunction,
         threadPriority, threadStackSize, threadId) ? true : false;
 }
 
+#if defined(__linux__)
+// Attributes that a new thread applies to itself before it calls its entry
+// function, so that none of its code runs on the wrong CPUs or with the wrong
+// profiles, as it could if the creator set them afterwards.
+struct ThreadAttributes {
+    ThreadAttributes() { CPU_ZERO(&cpuSet); }
+
+    // CPUs the thread may run on. Empty to keep the affinity inherited from
+    // the creating thread.
+    cpu_set_t cpuSet;
+
+    // Index of a CPU cluster to run on, counting from the one holding CPU 0:
+    // the cpufreq policies or, where there are none, the NUMA nodes. -1 for
+    // none. This is only a hint, ignored if there is no such cluster or it has
+    // none of the CPUs in cpuSet.
+    int cluster = -1;
+
+    // Task profiles, applied with SetTaskProfiles(). Only supported on
+    // Android, and only in processes linking libprocessgroup; ignored with a
+    // warning elsewhere.
+    std::vector<std::string> taskProfiles;
+};
+
+// Create a thread as androidCreateRawThreadEtc() does, which applies attrs to
+// itself before calling entryFunction. Attributes that can't be applied are
+// logged, and don't stop the thread.
+bool createRawThreadEtc(thread_func_t entryFunction,
+                        void *userData,
+                        const char* threadName,
+                        int32_t threadPriority,
+                        size_t threadStackSize,
+                        const ThreadAttributes& attrs,
+                        thread_id_t *threadId = nullptr);
+
+// Apply attrs to the calling thread.
+void applyThreadAttributes(const ThreadAttributes& attrs);
+#endif
+
 // Get some sort of unique identifier for the current thread.
 inline thread_id_t getThreadId() {
     return androidGetThreadId();
@@ -18,6 +18,7 @@
 #define ANDROID_CALLSTACK_H
 
 #include <memory>
+#include <vector>
 
 #include <android/log.h>
 #include <backtrace/backtrace_constants.h>
@@ -40,6 +41,8 @@
 
 #define ALWAYS_INLINE __attribute__((always_inline))
 
+class BacktraceMap;
+
 namespace android {
 
 class Printer;
@@ -55,12 +58,26 @@ public:
     ~CallStack();
 
     // Reset the stack frames (same as creating an empty call stack).
-    void clear() { mFrameLines.clear(); }
+    void clear() {
+        mFrameLines.clear();
+        mPcs.clear();
+    }
 
     // Immediately collect the stack traces for the specified thread.
     // The default is to dump the stack of the current call.
     void update(int32_t ignoreDepth = 1, pid_t tid = BACKTRACE_CURRENT_THREAD);
 
+    // As above, but look up frames in the given map of the current process,
+    // so that several threads' stacks can share the parsed maps and ELF files.
+    void update(int32_t ignoreDepth, pid_t tid, BacktraceMap* map);
+
+    // Collect only the program counters of the current thread's stack, and
+    // look up their symbols when the stack is printed. This is much cheaper
+    // than update() for callers that capture many more stacks than they print.
+    // Where the platform keeps frame pointers the stack is walked directly,
+    // otherwise it is unwound against maps shared by the whole process.
+    void updateRaw(int32_t ignoreDepth = 1);
+
     // Dump a stack trace to the log using the supplied logtag.
     void log(const char* logtag,
              android_LogPriority priority = ANDROID_LOG_DEBUG,
@@ -76,7 +93,7 @@ public:
     void print(Printer& printer) const;
 
     // Get the count of stack frames that are in this call stack.
-    size_t size() const { return mFrameLines.size(); }
+    size_t size() const { return mPcs.empty() ? mFrameLines.size() : mPcs.size(); }
 
     // DO NOT USE ANYTHING BELOW HERE. The following public members are expected
     // to disappear again shortly, once a better replacement facility exists.
@@ -151,6 +168,8 @@ public:
 #endif // !WEAKS_AVAILABLE
 
   private:
+    void printRaw(Printer& printer) const;
+
 #ifdef WEAKS_AVAILABLE
     static CallStackUPtr CALLSTACK_WEAK getCurrentInternal(int32_t ignoreDepth);
     static void CALLSTACK_WEAK logStackInternal(const char* logtag, const CallStack* stack,
@@ -162,6 +181,8 @@ public:
 #endif // WEAKS_AVAILABLE
 
     Vector<String8> mFrameLines;
+    // Set instead of mFrameLines by updateRaw().
+    std::vector<uint64_t> mPcs;
 };
 
 }  // namespace android
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FAST_HASH_H
+#define ANDROID_FAST_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+/* A fast 64 bit hash of size bytes, in the style of wyhash: the input is read
+ * 8 bytes at a time and folded in with 64x64->128 bit multiplies, three
+ * independent lanes at a time for long inputs.
+ *
+ * It is a different function from the Jenkins hash, for new callers that hash
+ * whole buffers at once, such as cache keys. It isn't incremental, and its
+ * values may change between releases and differ between architectures, so they
+ * must not be stored or sent to other processes. It isn't meant to resist
+ * attackers choosing its input. */
+uint64_t FastHashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+}
+
+#endif // ANDROID_FAST_HASH_H
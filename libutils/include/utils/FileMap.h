@@ -20,6 +20,7 @@
 #ifndef __LIBS_FILE_MAP_H
 #define __LIBS_FILE_MAP_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <utils/Compat.h>
@@ -66,6 +67,29 @@ public:
     bool create(const char* origFileName, int fd,
                 off64_t offset, size_t length, bool readOnly);
 
+    /*
+     * Flags for create(), for mappings that are about to be read through, such
+     * as assets parsed at app start. Without them, each page is faulted in on
+     * first access.
+     */
+    enum CreateFlags {
+        // Read the whole mapping in before create() returns (MAP_POPULATE).
+        CREATE_POPULATE = 1 << 0,
+        // Ask for transparent huge pages (MADV_HUGEPAGE). Mappings of at least
+        // one huge page are placed so that they can be backed by them. Kernels
+        // without huge pages for files ignore this.
+        CREATE_HUGEPAGE = 1 << 1,
+        // Start reading the mapping in without waiting for it (MADV_WILLNEED).
+        CREATE_WILLNEED = 1 << 2,
+    };
+
+    /*
+     * As above, with a combination of CreateFlags. The flags are hints: if the
+     * system doesn't support one, it is ignored rather than failing.
+     */
+    bool create(const char* origFileName, int fd,
+                off64_t offset, size_t length, bool readOnly, uint32_t createFlags);
+
     ~FileMap(void);
 
     /*
@@ -103,6 +127,15 @@ public:
      */
     int advise(MapAdvice advice);
 
+    /*
+     * Apply an madvise() call to part of the file, e.g. WILLNEED for a range
+     * that is about to be read. offset is relative to getDataPtr(); the range
+     * is widened to whole pages.
+     *
+     * Returns 0 on success, -1 on failure.
+     */
+    int advise(MapAdvice advice, size_t offset, size_t length);
+
 protected:
 
 private:
@@ -124,6 +157,52 @@ private:
     static long mPageSize;
 };
 
+/*
+ * A range of address space reserved up front, into which several files are
+ * then mapped next to each other. This saves finding room for each mapping
+ * separately, and the data of related files, e.g. an app's resources, stays
+ * together. Everything is unmapped when the region is destroyed, so pointers
+ * returned by map() are valid for the region's lifetime.
+ *
+ * Not supported on Windows.
+ */
+class FileMapRegion {
+public:
+    FileMapRegion();
+    ~FileMapRegion();
+
+    /*
+     * Reserve length bytes, rounded up to whole pages.
+     *
+     * Returns "false" on failure.
+     */
+    bool reserve(size_t length);
+
+    /*
+     * Map length bytes of fd from offset, read-only, at the start of the
+     * unused part of the region. createFlags are as for FileMap::create().
+     *
+     * Returns a pointer to the data, or nullptr if it doesn't fit or can't be
+     * mapped.
+     */
+    void* map(int fd, off64_t offset, size_t length, uint32_t createFlags = 0);
+
+    /*
+     * Get the size of the region, and how much of it is used.
+     */
+    size_t getLength() const { return mLength; }
+    size_t getUsedLength() const { return mUsed; }
+
+private:
+    // these are not implemented
+    FileMapRegion(const FileMapRegion& src);
+    const FileMapRegion& operator=(const FileMapRegion& src);
+
+    void*       mBasePtr;       // base of the reservation; page aligned
+    size_t      mLength;        // length of the reservation
+    size_t      mUsed;          // bytes mapped so far, in whole pages
+};
+
 }  // namespace android
 
 #endif // __LIBS_FILE_MAP_H
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UTILS_LOCK_PROFILER_H
+#define ANDROID_UTILS_LOCK_PROFILER_H
+
+#include <stddef.h>
+
+#include <atomic>
+
+#if !defined(_WIN32)
+# include <pthread.h>
+#endif
+
+namespace android {
+
+class Printer;
+
+/*
+ * Opt-in contention profiling for Mutex and RWLock.
+ *
+ * While enabled, every lock() that can't take its lock immediately records how
+ * long it waited, the thread that last took the lock and the code that asked
+ * for it into a per-thread buffer. dumpLockContention() prints a summary of
+ * the worst sites, e.g. from a service's dump() method.
+ *
+ * Profiling is off by default. Set debug.libutils.lock_profiling to true, or
+ * call setLockProfilingEnabled(), to turn it on. While it is off, the only
+ * cost to a lock is a relaxed load and a branch.
+ *
+ * Only code compiled against this version of Mutex.h and RWLock.h is profiled,
+ * since their lock methods are inline.
+ */
+void setLockProfilingEnabled(bool enabled);
+
+// Prints the contended lock sites with the most total wait time, worst first.
+void dumpLockContention(Printer& printer, size_t maxEntries = 20);
+
+// Discards everything recorded so far.
+void resetLockContention();
+
+#if !defined(_WIN32)
+
+namespace lock_profiler {
+
+// Weak so that code that only uses the headers, without linking libutils,
+// still links and never takes the profiled path.
+extern std::atomic<bool> gEnabled __attribute__((weak, visibility("default")));
+
+inline bool isEnabled() {
+    return &gEnabled != nullptr && gEnabled.load(std::memory_order_relaxed);
+}
+
+// Take the lock and record any contention. Return 0 or an errno value, like
+// the pthread functions they wrap.
+int lockMutex(pthread_mutex_t* mutex) __attribute__((weak, visibility("default")));
+int readLock(pthread_rwlock_t* rwlock) __attribute__((weak, visibility("default")));
+int writeLock(pthread_rwlock_t* rwlock) __attribute__((weak, visibility("default")));
+
+}  // namespace lock_profiler
+
+inline bool isLockProfilingEnabled() {
+    return lock_profiler::isEnabled();
+}
+
+#else
+
+inline bool isLockProfilingEnabled() {
+    return false;
+}
+
+#endif  // !defined(_WIN32)
+
+}  // namespace android
+
+#endif  // ANDROID_UTILS_LOCK_PROFILER_H
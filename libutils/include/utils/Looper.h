@@ -26,8 +26,8 @@
 
 #include <android-base/unique_fd.h>
 
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace android {
 
@@ -398,6 +398,35 @@ public:
      */
     bool isPolling() const;
 
+    /**
+     * Sets the maximum number of file descriptor events retrieved from epoll
+     * in one poll.  Loopers watching many busy file descriptors can raise it
+     * to dispatch more of them per wakeup.  The default is 16.
+     *
+     * Must be called on the thread that polls the looper.
+     */
+    void setMaxEventsPerPoll(size_t maxEvents);
+
+    /**
+     * Sets how long pollOnce() keeps checking for events without blocking
+     * before it sleeps in epoll_wait().  Spinning trades CPU time for a lower
+     * wakeup latency, since the thread does not have to be scheduled again
+     * when an event arrives early in the window.  The spin never extends past
+     * the timeout.  The default, zero, never spins.
+     *
+     * Must be called on the thread that polls the looper.
+     */
+    void setBusyPollDuration(nsecs_t duration);
+
+    /**
+     * Enables or disables waking up for messages with a timerfd armed for
+     * the message's exact uptime, rather than an epoll_wait() timeout that is
+     * rounded up to the next millisecond.  Disabled by default.
+     *
+     * Must be called on the thread that polls the looper.
+     */
+    void setHighResolutionMessageTimeouts(bool enabled);
+
     /**
      * Prepares a looper associated with the calling thread, and returns it.
      * If the thread already has a looper, it is returned.  Otherwise, a new
@@ -434,6 +463,43 @@ private:
       uint32_t getEpollEvents() const;
   };
 
+    // Monitoring requests, stored densely and indexed both by sequence number and by fd
+    // through open-addressed tables with linear probing.  Capacity is never given back,
+    // so once a looper has seen its steady-state number of fds, adding and removing them
+    // does not allocate.
+    class RequestTable {
+      public:
+        struct Entry {
+            SequenceNumber seq;
+            Request request;
+        };
+
+        // Returns nullptr if there is no request with this sequence number.
+        const Request* find(SequenceNumber seq) const;
+        // Returns false if there is no request for this fd.
+        bool findSequenceNumber(int fd, SequenceNumber* outSeq) const;
+        // Adds a request; there must not already be one for request.fd.
+        void insert(SequenceNumber seq, const Request& request);
+        // Removes a request, returning false if there is none with this sequence number.
+        bool erase(SequenceNumber seq, int* outFd);
+
+        std::vector<Entry>::const_iterator begin() const { return mEntries.begin(); }
+        std::vector<Entry>::const_iterator end() const { return mEntries.end(); }
+
+      private:
+        template <typename K>
+        struct Slot {
+            K key;
+            uint32_t index;  // into mEntries, or kEmptySlot
+        };
+
+        void grow();
+
+        std::vector<Entry> mEntries;
+        std::vector<Slot<SequenceNumber>> mSeqSlots;
+        std::vector<Slot<int>> mFdSlots;
+    };
+
     struct Response {
         SequenceNumber seq;
         int events;
@@ -441,12 +507,13 @@ private:
     };
 
     struct MessageEnvelope {
-        MessageEnvelope() : uptime(0) { }
+        MessageEnvelope() : uptime(0), seq(0) { }
 
-        MessageEnvelope(nsecs_t u, sp<MessageHandler> h, const Message& m)
-            : uptime(u), handler(std::move(h)), message(m) {}
+        MessageEnvelope(nsecs_t u, uint64_t s, sp<MessageHandler> h, const Message& m)
+            : uptime(u), seq(s), handler(std::move(h)), message(m) {}
 
         nsecs_t uptime;
+        uint64_t seq;  // orders messages with equal uptimes by when they were sent
         sp<MessageHandler> handler;
         Message message;
     };
@@ -456,7 +523,11 @@ private:
     android::base::unique_fd mWakeEventFd;  // immutable
     Mutex mLock;
 
-    Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    // A binary min-heap ordered by uptime, then seq.  Removed messages are left in
+    // place with a null handler until they reach the head; the head never is one.
+    std::vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    uint64_t mNextMessageSeq; // guarded by mLock
+    size_t mCancelledMessageCount; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
 
     // Whether we are currently waiting for work.  Not protected by a lock,
@@ -466,23 +537,35 @@ private:
     android::base::unique_fd mEpollFd;  // guarded by mLock but only modified on the looper thread
     bool mEpollRebuildRequired; // guarded by mLock
 
-    // Locked maps of fds and sequence numbers monitoring requests.
-    // Both maps must be kept in sync at all times.
-    std::unordered_map<SequenceNumber, Request> mRequests;               // guarded by mLock
-    std::unordered_map<int /*fd*/, SequenceNumber> mSequenceNumberByFd;  // guarded by mLock
+    // Locked table of monitoring requests, by sequence number and by fd.
+    RequestTable mRequests;  // guarded by mLock
 
     // The sequence number to use for the next fd that is added to the looper.
-    // The sequence number 0 is reserved for the WakeEventFd.
+    // The sequence numbers 0 and 1 are reserved for the TimerFd and the WakeEventFd.
     SequenceNumber mNextRequestSeq;  // guarded by mLock
 
     // This state is only used privately by pollOnce and does not require a lock since
-    // it runs on a single thread.
-    Vector<Response> mResponses;
+    // it runs on a single thread.  The buffer is reused from one poll to the next.
+    std::vector<Response> mResponses;
     size_t mResponseIndex;
     nsecs_t mNextMessageUptime; // set to LLONG_MAX when none
 
+    // Poll options, only changed on the polling thread.
+    std::vector<epoll_event> mEventItems;  // sized to the maximum events per poll
+    nsecs_t mBusyPollDuration;
+
+    // Wakes up pollOnce for the next message when high resolution message timeouts are
+    // enabled.  Added to the epoll set under mLock, otherwise only used by pollOnce.
+    android::base::unique_fd mTimerFd;
+    nsecs_t mTimerDeadline;  // set to LLONG_MAX when disarmed
+
     int pollInner(int timeoutMillis);
+    int waitForEvents(int timeoutMillis);
+    void armTimer(nsecs_t deadline);
     int removeSequenceNumberLocked(SequenceNumber seq);  // requires mLock
+    template <typename Predicate>
+    void removeMessagesLocked(Predicate predicate);  // requires mLock
+    void popCancelledMessagesLocked();               // requires mLock
     void awoken();
     void rebuildEpollLocked();
     void scheduleEpollRebuildLocked();
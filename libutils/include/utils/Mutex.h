@@ -26,6 +26,7 @@
 #endif
 
 #include <utils/Errors.h>
+#include <utils/LockProfiler.h>
 #include <utils/Timers.h>
 
 // Enable thread safety attributes only with clang.
@@ -180,6 +181,9 @@ inline Mutex::~Mutex() {
     pthread_mutex_destroy(&mMutex);
 }
 inline status_t Mutex::lock() {
+    if (__builtin_expect(lock_profiler::isEnabled(), false)) {
+        return -lock_profiler::lockMutex(&mMutex);
+    }
     return -pthread_mutex_lock(&mMutex);
 }
 inline void Mutex::unlock() {
@@ -25,6 +25,8 @@
 #include <time.h>
 #include <sys/types.h>
 
+#include <vector>
+
 namespace android {
 
 class Printer;
@@ -41,6 +43,12 @@ public:
     // Immediately collect the stack traces for all threads.
     void update();
 
+    // As update(), but unwind up to maxWorkers threads at once. This is for
+    // dumps of processes with many threads, e.g. from a watchdog, where doing
+    // them one after the other takes long enough to matter. The result is laid
+    // out the same way, sorted by tid.
+    void update(size_t maxWorkers);
+
     // Print all stack traces to the log using the supplied logtag.
     void log(const char* logtag, android_LogPriority priority = ANDROID_LOG_DEBUG,
              const char* prefix = nullptr) const;
@@ -63,6 +71,9 @@ private:
     // Reset the process's stack frames and metadata.
     void clear();
 
+    // Reset, record the time and list the threads to collect, in tid order.
+    bool startUpdate(std::vector<pid_t>* tids);
+
     struct ThreadInfo {
         CallStack callStack;
         String8 threadName;
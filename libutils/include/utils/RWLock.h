@@ -25,6 +25,7 @@
 #endif
 
 #include <utils/Errors.h>
+#include <utils/LockProfiler.h>
 #include <utils/ThreadDefs.h>
 
 // ---------------------------------------------------------------------------
@@ -102,12 +103,18 @@ inline RWLock::~RWLock() {
     pthread_rwlock_destroy(&mRWLock);
 }
 inline status_t RWLock::readLock() {
+    if (__builtin_expect(lock_profiler::isEnabled(), false)) {
+        return -lock_profiler::readLock(&mRWLock);
+    }
     return -pthread_rwlock_rdlock(&mRWLock);
 }
 inline status_t RWLock::tryReadLock() {
     return -pthread_rwlock_tryrdlock(&mRWLock);
 }
 inline status_t RWLock::writeLock() {
+    if (__builtin_expect(lock_profiler::isEnabled(), false)) {
+        return -lock_profiler::writeLock(&mRWLock);
+    }
     return -pthread_rwlock_wrlock(&mRWLock);
 }
 inline status_t RWLock::tryWriteLock() {
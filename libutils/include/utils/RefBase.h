@@ -336,6 +336,14 @@ public:
         getWeakRefs()->trackMe(enable, retain); 
     }
 
+            //! DEBUGGING ONLY: Enable tracking of every object of the same type
+            // as this one that gets its first strong reference from now on.
+            // Where supported this uses a low-overhead trace, in which each
+            // thread remembers its recent operations on tracked objects in a
+            // ring buffer, with a call stack for one in every few; printRefs()
+            // collects what they remember. trackMe() uses the same trace.
+            void            trackMyType(bool enable) const;
+
 protected:
     // When constructing these objects, prefer using sp::make<>. Using a RefBase
     // object on the stack or with other refcount mechanisms (e.g.
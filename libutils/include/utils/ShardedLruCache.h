@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UTILS_SHARDED_LRU_CACHE_H
+#define ANDROID_UTILS_SHARDED_LRU_CACHE_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils/LruCache.h"
+
+namespace android {
+
+/**
+ * A thread-safe LruCache that may be used from several threads without an
+ * outer lock.
+ *
+ * Keys are spread over a number of shards by hash_type(), and each shard is an
+ * LruCache with its own lock, so threads using different keys rarely contend.
+ * The price is that eviction is least-recently-used within a shard rather than
+ * across the whole cache: each shard holds at most its share of maxCapacity.
+ *
+ * Values are returned by copy, since a reference into the cache could be
+ * invalidated by another thread as soon as the shard is unlocked.
+ *
+ * The OnEntryRemoved listener is called with the key and value of each entry
+ * removed, as it is by LruCache. It is called with the entry's shard locked, so
+ * it must not call back into the cache, and it may be called from several
+ * threads at once for entries in different shards.
+ */
+template <typename TKey, typename TValue>
+class ShardedLruCache {
+public:
+    static constexpr size_t kDefaultShardCount = 16;
+
+    // numShards is rounded up to a power of two.
+    explicit ShardedLruCache(uint32_t maxCapacity, size_t numShards = kDefaultShardCount);
+
+    // Not safe to call while other threads are using the cache.
+    void setOnEntryRemovedListener(OnEntryRemoved<TKey, TValue>* listener);
+    size_t size() const;
+    TValue get(const TKey& key);
+    bool put(const TKey& key, const TValue& value);
+    bool remove(const TKey& key);
+    void clear();
+
+private:
+    ShardedLruCache(const ShardedLruCache& that);  // disallow copy constructor
+
+    // Each shard on its own cache line, so that locking one doesn't slow down
+    // threads using its neighbours.
+    struct alignas(64) Shard {
+        explicit Shard(uint32_t maxCapacity) : cache(maxCapacity) {}
+
+        mutable std::mutex lock;
+        LruCache<TKey, TValue> cache;
+    };
+
+    Shard& shardFor(const TKey& key) const {
+        // Use the top bits of the hash: the shard's LruCache picks its bucket
+        // from the low bits, which would otherwise be the same for every key in
+        // the shard.
+        uint32_t hash = static_cast<uint32_t>(hash_type(key)) * 0x9E3779B9U;
+        return *mShards[mShardBits ? hash >> (32 - mShardBits) : 0];
+    }
+
+    uint32_t mShardBits;
+    std::vector<std::unique_ptr<Shard>> mShards;
+};
+
+// Implementation is here, because it's fully templated
+template <typename TKey, typename TValue>
+ShardedLruCache<TKey, TValue>::ShardedLruCache(uint32_t maxCapacity, size_t numShards)
+    : mShardBits(0) {
+    while ((size_t(1) << mShardBits) < numShards && mShardBits < 16) {
+        mShardBits++;
+    }
+    size_t shardCount = size_t(1) << mShardBits;
+
+    uint32_t shardCapacity = LruCache<TKey, TValue>::kUnlimitedCapacity;
+    if (maxCapacity != LruCache<TKey, TValue>::kUnlimitedCapacity) {
+        shardCapacity = (maxCapacity + shardCount - 1) / shardCount;
+    }
+    mShards.reserve(shardCount);
+    for (size_t i = 0; i < shardCount; i++) {
+        mShards.emplace_back(new Shard(shardCapacity));
+    }
+}
+
+template <typename TKey, typename TValue>
+void ShardedLruCache<TKey, TValue>::setOnEntryRemovedListener(
+        OnEntryRemoved<TKey, TValue>* listener) {
+    for (auto& shard : mShards) {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        shard->cache.setOnEntryRemovedListener(listener);
+    }
+}
+
+template <typename TKey, typename TValue>
+size_t ShardedLruCache<TKey, TValue>::size() const {
+    size_t size = 0;
+    for (const auto& shard : mShards) {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        size += shard->cache.size();
+    }
+    return size;
+}
+
+template <typename TKey, typename TValue>
+TValue ShardedLruCache<TKey, TValue>::get(const TKey& key) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.cache.get(key);
+}
+
+template <typename TKey, typename TValue>
+bool ShardedLruCache<TKey, TValue>::put(const TKey& key, const TValue& value) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.cache.put(key, value);
+}
+
+template <typename TKey, typename TValue>
+bool ShardedLruCache<TKey, TValue>::remove(const TKey& key) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.cache.remove(key);
+}
+
+template <typename TKey, typename TValue>
+void ShardedLruCache<TKey, TValue>::clear() {
+    for (auto& shard : mShards) {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        shard->cache.clear();
+    }
+}
+
+}
+#endif // ANDROID_UTILS_SHARDED_LRU_CACHE_H
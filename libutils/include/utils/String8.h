@@ -42,6 +42,7 @@ class String8
 public:
                                 String8();
                                 String8(const String8& o);
+                                String8(String8&& o) noexcept;
     explicit                    String8(const char* o);
     explicit                    String8(const char* o, size_t numChars);
 
@@ -72,6 +73,10 @@ public:
 
             void                clear();
 
+            // Make room for a length of at least capacity, so that appending
+            // up to it doesn't reallocate. Never shrinks the storage.
+            status_t            reserve(size_t capacity);
+
             void                setTo(const String8& other);
             status_t            setTo(const char* other);
             status_t            setTo(const char* other, size_t numChars);
@@ -88,6 +93,7 @@ public:
             status_t            appendFormatV(const char* fmt, va_list args);
 
     inline  String8&            operator=(const String8& other);
+            String8&            operator=(String8&& other) noexcept;
     inline  String8&            operator=(const char* other);
 
     inline  String8&            operator+=(const String8& other);
@@ -215,6 +221,14 @@ private:
             status_t            real_append(const char* other, size_t numChars);
             char*               find_extension(void) const;
 
+    /*
+     * editResize() returns void* so that SharedBuffer class is not exposed.
+     */
+            void*               editResize(size_t newSize);
+
+            void                acquire();
+            void                release();
+
             const char* mString;
 };
 
@@ -20,6 +20,10 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#if defined(__linux__)
+#include <time.h>
+#endif
+
 // See https://developer.android.com/reference/android/os/SystemClock
 // to learn more about Android's timekeeping facilities.
 
@@ -34,6 +38,38 @@ int64_t elapsedRealtime();
 // Returns nanoseconds since boot, including time spent in sleep.
 int64_t elapsedRealtimeNano();
 
+#if defined(__linux__)
+// Header-only versions of the clocks above, for callers reading them in tight
+// loops. They inline the clock_gettime() call, which the C library serves from
+// the vDSO without entering the kernel.
+inline int64_t clockNanos(clockid_t clock) {
+    struct timespec ts = {};
+    clock_gettime(clock, &ts);
+    return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+inline int64_t uptimeNanosInline() {
+    return clockNanos(CLOCK_MONOTONIC);
+}
+
+inline int64_t elapsedRealtimeNanoInline() {
+    return clockNanos(CLOCK_BOOTTIME);
+}
+
+// Coarse versions of uptimeNanos() and uptimeMillis(). They return the time of
+// the last scheduler tick, which is cheaper to read again, but only as precise
+// as a tick: typically 1-10ms, see clock_getres(CLOCK_MONOTONIC_COARSE). Use
+// them for timestamps that can tolerate that, not to time short intervals or
+// to decide whether a deadline has passed. There is no coarse boot time clock.
+inline int64_t uptimeNanosCoarse() {
+    return clockNanos(CLOCK_MONOTONIC_COARSE);
+}
+
+inline int64_t uptimeMillisCoarse() {
+    return uptimeNanosCoarse() / 1000000LL;
+}
+#endif
+
 }  // namespace android
 
 #endif // ANDROID_UTILS_SYSTEMCLOCK_H
@@ -25,6 +25,7 @@
 # include <pthread.h>
 #endif
 
+#include <utils/AndroidThreads.h>
 #include <utils/Condition.h>
 #include <utils/Errors.h>
 #include <utils/Mutex.h>
@@ -36,6 +37,8 @@
 namespace android {
 // ---------------------------------------------------------------------------
 
+struct ThreadAttributes;
+
 // DO NOT USE: please use std::thread
 
 class Thread : virtual public RefBase
@@ -51,6 +54,15 @@ public:
     virtual status_t    run(    const char* name,
                                 int32_t priority = PRIORITY_DEFAULT,
                                 size_t stack = 0);
+
+#if defined(__linux__)
+    // Start the thread as run() does, having it apply attrs to itself before
+    // it calls readyToRun().
+            status_t    run(    const char* name,
+                                int32_t priority,
+                                size_t stack,
+                                const ThreadAttributes& attrs);
+#endif
     
     // Ask this object's thread to exit. This function is asynchronous, when the
     // function returns the thread might still be running. Of course, this
@@ -93,7 +105,12 @@ private:
 
 private:
     Thread& operator=(const Thread&);
+            status_t        runInternal(const char* name, int32_t priority, size_t stack,
+                                        const ThreadAttributes* attrs);
     static  int             _threadLoop(void* user);
+#if defined(__linux__)
+    static  int             _threadLoopWithAttributes(void* user);
+#endif
     const   bool            mCanCallJava;
     // always hold mLock when reading or writing
             thread_id_t     mThread;
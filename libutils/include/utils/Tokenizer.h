@@ -18,6 +18,7 @@
 #define _UTILS_TOKENIZER_H
 
 #include <assert.h>
+#include <string_view>
 #include <utils/Errors.h>
 #include <utils/FileMap.h>
 #include <utils/String8.h>
@@ -88,6 +89,12 @@ public:
      */
     String8 peekRemainderOfLine() const;
 
+    /**
+     * As peekRemainderOfLine(), but returns a view of the tokenizer's buffer rather
+     * than a copy. The view is valid for as long as the tokenizer is.
+     */
+    std::string_view peekRemainderOfLineView() const;
+
     /**
      * Gets the character at the current position and advances past it.
      * Returns null at end of file.
@@ -103,6 +110,12 @@ public:
      */
     String8 nextToken(const char* delimiters);
 
+    /**
+     * As nextToken(), but returns a view of the tokenizer's buffer rather than a
+     * copy. The view is valid for as long as the tokenizer is.
+     */
+    std::string_view nextTokenView(const char* delimiters);
+
     /**
      * Advances to the next line.
      * Does nothing if already at the end of the file.
@@ -39,19 +39,26 @@ template <typename T> struct trait_trivial_move { enum { value = false }; };
 template <typename T> struct trait_pointer      { enum { value = false }; };
 template <typename T> struct trait_pointer<T*>  { enum { value = true }; };
 
+// The trait_trivial_* specializations are only needed for types that are not
+// detected through <type_traits>, such as types that can be relocated with
+// memmove but are not trivially copyable.
 template <typename TYPE>
 struct traits {
     enum {
         // whether this type is a pointer
         is_pointer          = trait_pointer<TYPE>::value,
         // whether this type's constructor is a no-op
-        has_trivial_ctor    = is_pointer || trait_trivial_ctor<TYPE>::value,
+        has_trivial_ctor    = is_pointer || trait_trivial_ctor<TYPE>::value
+                || std::is_trivially_default_constructible<TYPE>::value,
         // whether this type's destructor is a no-op
-        has_trivial_dtor    = is_pointer || trait_trivial_dtor<TYPE>::value,
+        has_trivial_dtor    = is_pointer || trait_trivial_dtor<TYPE>::value
+                || std::is_trivially_destructible<TYPE>::value,
         // whether this type type can be copy-constructed with memcpy
-        has_trivial_copy    = is_pointer || trait_trivial_copy<TYPE>::value,
+        has_trivial_copy    = is_pointer || trait_trivial_copy<TYPE>::value
+                || std::is_trivially_copyable<TYPE>::value,
         // whether this type can be moved with memmove
         has_trivial_move    = is_pointer || trait_trivial_move<TYPE>::value
+                || std::is_trivially_copyable<TYPE>::value
     };
 };
 
@@ -180,7 +187,7 @@ void splat_type(TYPE* where, const TYPE* what, size_t n) {
     } else {
         while (n > 0) {
             n--;
-            *where++ = *what;
+            memcpy(where++, what, sizeof(TYPE));
         }
     }
 }
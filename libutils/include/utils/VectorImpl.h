@@ -44,6 +44,8 @@ public:
         HAS_TRIVIAL_CTOR    = 0x00000001,
         HAS_TRIVIAL_DTOR    = 0x00000002,
         HAS_TRIVIAL_COPY    = 0x00000004,
+        // Items can be relocated with memcpy(), without destroying the source.
+        HAS_TRIVIAL_MOVE    = 0x00000008,
     };
 
                             VectorImpl(size_t itemSize, uint32_t flags);
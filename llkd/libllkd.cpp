@@ -28,9 +28,10 @@
 #include <sys/cdefs.h>  // ___STRING, __predict_true() and _predict_false()
 #include <sys/mman.h>   // mlockall()
 #include <sys/prctl.h>
-#include <sys/stat.h>     // lstat()
-#include <sys/syscall.h>  // __NR_getdents64
-#include <sys/sysinfo.h>  // get_nprocs_conf()
+#include <sys/resource.h>  // getrlimit()
+#include <sys/stat.h>      // lstat()
+#include <sys/syscall.h>   // __NR_getdents64
+#include <sys/sysinfo.h>   // get_nprocs_conf()
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -39,6 +40,7 @@
 #include <ios>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -233,6 +235,89 @@ std::string ReadFile(std::string&& path) {
     return content;
 }
 
+// /proc/<tid>/stat, held open across passes so that each pass only has to
+// pread(2) it again.  Once a task exits, reads of the old file fail with
+// ESRCH, even if the tid has been reused, and we go back to open(2).  The
+// number of files held open is kept well clear of RLIMIT_NOFILE, the
+// remainder of the tasks are opened and closed every pass as before.
+class statFile {
+    int fd;
+
+    static size_t held;
+    static size_t maxHeld(void) {
+        static size_t max = 0;
+        if (max == 0) {
+            rlimit rl;
+            max = ((::getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur != RLIM_INFINITY))
+                          ? rl.rlim_cur / 2
+                          : 512;
+            if (max == 0) max = 1;
+        }
+        return max;
+    }
+
+  public:
+    statFile() : fd(-1) {}
+    statFile(const statFile& c) = delete;
+    statFile(statFile&& c) : fd(c.fd) { c.fd = -1; }
+    statFile& operator=(statFile&& c) {
+        if (this != &c) {
+            reset();
+            fd = c.fd;
+            c.fd = -1;
+        }
+        return *this;
+    }
+
+    ~statFile() { reset(); }
+
+    void reset(void) {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+            --held;
+        }
+    }
+
+    // Returns the nul terminated content, in a buffer shared by all callers
+    // and only good until the next read, or nullptr if the task is gone.
+    const char* read(const std::string& piddir) {
+        // Audit finds /proc/<tid>/stat is rarely more than 300 bytes.
+        static char buffer[1024];
+        ssize_t rc;
+        if (fd >= 0) {
+            rc = TEMP_FAILURE_RETRY(::pread(fd, buffer, sizeof(buffer) - 1, 0));
+            if (rc > 0) {
+                buffer[rc] = '\0';
+                return buffer;
+            }
+            reset();
+        }
+        auto path = piddir + "/stat";
+        int newFd = TEMP_FAILURE_RETRY(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (newFd < 0) {
+            PLOG(DEBUG) << "Read " << path << " failed";
+            return nullptr;
+        }
+        rc = TEMP_FAILURE_RETRY(::pread(newFd, buffer, sizeof(buffer) - 1, 0));
+        if (rc <= 0) {
+            PLOG(DEBUG) << "Read " << path << " failed";
+            ::close(newFd);
+            return nullptr;
+        }
+        buffer[rc] = '\0';
+        if (held < maxHeld()) {
+            fd = newFd;
+            ++held;
+        } else {
+            ::close(newFd);
+        }
+        return buffer;
+    }
+};
+
+size_t statFile::held = 0;
+
 std::string llkProcGetName(pid_t tid, const char* node = "/cmdline") {
     std::string content = ReadFile(procdir + std::to_string(tid) + node);
     static constexpr char needles[] = " \t\r\n";  // including trailing nul
@@ -295,6 +380,7 @@ struct proc {
     unsigned time;                 // sum of /proc/<tid>/stat field 14 utime &
                                    // 15 stime for coarse ABA problem detection.
     std::string cmdline;           // cached /cmdline content
+    statFile stat;                 // /proc/<tid>/stat held open
     char state;                    // /proc/<tid>/stat field 3: Z or D
                                    // (others we do not monitor: S, R, T or ?)
 #ifdef __PTRACE_ENABLED__          // Privileged state checking
@@ -802,6 +888,20 @@ long long getSchedValue(const std::string& schedString, const char* key) {
 }
 
 #ifdef __PTRACE_ENABLED__
+// llkCheckStackSymbols by name, to the index kept in proc::stack.  The keys
+// refer to the strings of llkCheckStackSymbols, which is not changed once
+// llkInit has set it up.
+std::unordered_map<std::string_view, char> llkCheckStackIndex;
+
+void llkCheckStackIndexInit(void) {
+    llkCheckStackIndex.clear();
+    char idx = -1;
+    for (const auto& stack : llkCheckStackSymbols) {
+        if (++idx < 0) break;
+        llkCheckStackIndex.emplace(stack, idx);
+    }
+}
+
 bool llkCheckStack(proc* procp, const std::string& piddir) {
     if (llkCheckStackSymbols.empty()) return false;
     if (procp->state == 'Z') {  // No brains for Zombies
@@ -818,18 +918,31 @@ bool llkCheckStack(proc* procp, const std::string& piddir) {
                      << " cmdline=" << procp->getCmdline();
         return false;
     }
-    // A scheduling incident that should not reset count_stack
-    if (kernel_stack.find(" cpu_worker_pools+0x") != std::string::npos) return false;
-    char idx = -1;
+    // Walk the frames once, looking each symbol up, rather than searching
+    // the whole stack for every one of llkCheckStackSymbols.  Frames are of
+    // the form "[<0>] symbol+0x10/0x20", with an optional ".cfi" suffix on
+    // the symbol.
     char match = -1;
-    std::string matched_stack_symbol = "<unknown>";
-    for (const auto& stack : llkCheckStackSymbols) {
-        if (++idx < 0) break;
-        if ((kernel_stack.find(" "s + stack + "+0x") != std::string::npos) ||
-            (kernel_stack.find(" "s + stack + ".cfi+0x") != std::string::npos)) {
-            match = idx;
-            matched_stack_symbol = stack;
-            break;
+    std::string_view matched_stack_symbol = "<unknown>";
+    std::string_view frames(kernel_stack);
+    while (!frames.empty()) {
+        auto eol = frames.find('\n');
+        auto frame = frames.substr(0, eol);
+        frames.remove_prefix((eol == frames.npos) ? frames.size() : eol + 1);
+        auto pos = frame.find("] ");
+        if (pos == frame.npos) continue;
+        frame.remove_prefix(pos + 2);
+        pos = frame.find("+0x");
+        if (pos == frame.npos) continue;
+        auto symbol = frame.substr(0, pos);
+        // A scheduling incident that should not reset count_stack
+        if (symbol == "cpu_worker_pools") return false;
+        if (match != char(-1)) continue;
+        if (android::base::EndsWith(symbol, ".cfi")) symbol.remove_suffix(strlen(".cfi"));
+        auto found = llkCheckStackIndex.find(symbol);
+        if (found != llkCheckStackIndex.end()) {
+            match = found->second;
+            matched_stack_symbol = found->first;
         }
     }
     if (procp->stack != match) {
@@ -1020,9 +1133,14 @@ milliseconds llkCheck(bool checkRunning) {
                 continue;
             }
 
-            // Get the process stat
-            std::string stat = ReadFile(piddir + "/stat");
-            if (stat.empty()) {
+            // Get the process stat, through the file we already hold open
+            // for a task we have seen before.
+            pid_t dtid = -1;
+            android::base::ParseInt(tp->d_name, &dtid);
+            auto procp = llkTidLookup(dtid);
+            statFile newStat;
+            auto stat = (procp != nullptr) ? procp->stat.read(piddir) : newStat.read(piddir);
+            if (stat == nullptr) {
                 continue;
             }
             unsigned tid = -1;
@@ -1035,7 +1153,7 @@ milliseconds llkCheck(bool checkRunning) {
             pdir[0] = '\0';
             // tid should not change value
             auto match = ::sscanf(
-                stat.c_str(),
+                stat,
                 "%u (%" ___STRING(
                     TASK_COMM_LEN) "[^)]) %c %u %*d %*d %*d %*d %*d %*d %*d %*d %*d %u %u %d",
                 &tid, pdir, &state, &ppid, &utime, &stime, &dummy);
@@ -1048,18 +1166,15 @@ milliseconds llkCheck(bool checkRunning) {
                 continue;
             }
 
-            // Get the process cgroup
-            auto cgroup = ReadFile(piddir + "/cgroup");
-            auto frozen = cgroup.find(":freezer:/frozen") != std::string::npos;
-
-            auto procp = llkTidLookup(tid);
+            if ((procp != nullptr) && (procp->tid != pid_t(tid))) {
+                procp = llkTidLookup(tid);
+            }
             if (procp == nullptr) {
-                procp = llkTidAlloc(tid, pid, ppid, pdir, utime + stime, state, frozen);
+                procp = llkTidAlloc(tid, pid, ppid, pdir, utime + stime, state, false);
+                procp->stat = std::move(newStat);
             } else {
                 // comm can change ...
                 procp->setComm(pdir);
-                // frozen can change, too...
-                procp->setFrozen(frozen);
                 procp->updated = true;
                 // pid/ppid/tid wrap?
                 if (((procp->update != prevUpdate) && (procp->update != llkUpdate)) ||
@@ -1099,6 +1214,11 @@ milliseconds llkCheck(bool checkRunning) {
             if ((tid == myTid) || llkSkipPid(tid)) {
                 continue;
             }
+
+            // Get the process cgroup, only for the tasks we go on to check,
+            // frozen can change from pass to pass.
+            auto cgroup = ReadFile(piddir + "/cgroup");
+            procp->setFrozen(cgroup.find(":freezer:/frozen") != std::string::npos);
             if (procp->isFrozen()) {
                 break;
             }
@@ -1320,6 +1440,7 @@ bool llkInit(const char* threadname) {
     if (debuggable) {
         llkCheckStackSymbols = llkSplit(LLK_CHECK_STACK_PROPERTY, LLK_CHECK_STACK_DEFAULT);
     }
+    llkCheckStackIndexInit();
     std::string defaultIgnorelistStack(LLK_IGNORELIST_STACK_DEFAULT);
     if (!debuggable) defaultIgnorelistStack += ",logd,/system/bin/logd";
     llkIgnorelistStack = llkSplit(LLK_IGNORELIST_STACK_PROPERTY, defaultIgnorelistStack);
@@ -11,6 +11,15 @@
 
 #include <stdarg.h>
 #include <fcntl.h>
+#include <pthread.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#define LZ4_HC_STATIC_LINKING_ONLY
+#include <lz4.h>
+#include <lz4hc.h>
 
 #include <private/android_filesystem_config.h>
 #include <private/fs_config.h>
@@ -22,6 +31,10 @@
 ** - dotfiles are ignored
 ** - directories named 'root' are ignored
 ** - device notes, pipes, etc are not supported (error)
+** - with -z the archive comes out lz4 compressed in the legacy frame
+**   format the kernel unpacks, like 'lz4 -l -12 --favor-decSpeed' would
+**   make it; -j spreads the compression of the blocks over threads, and
+**   the output is the same whatever the thread count
 */
 
 void die(const char *why, ...)
@@ -42,6 +55,7 @@ struct fs_config_entry {
 };
 
 static struct fs_config_entry* canned_config = NULL;
+static struct fs_config_matcher* matcher = NULL;
 static char *target_out_path = NULL;
 
 /* Each line in the canned file should be a path plus three ints (uid,
@@ -57,6 +71,177 @@ static char *target_out_path = NULL;
 static int verbose = 0;
 static int total_size = 0;
 
+/* Output.
+**
+** Everything goes through out_write() and out_copy_file(). Uncompressed,
+** file contents go from the input to stdout with sendfile() where possible.
+** Compressed, the archive is cut into LZ4_BLOCK_SIZE blocks, which are
+** compressed on up to num_threads threads and written out in order.
+*/
+
+#define LZ4_LEGACY_MAGIC 0x184C2102
+#define LZ4_BLOCK_SIZE (8 << 20)
+#define LZ4_LEVEL 12
+#define MAX_THREADS 64
+
+static int compress_lz4 = 0;
+static int num_threads = 1;
+
+struct lz4_block {
+    char *src;
+    int src_len;
+    char *dst;
+    int dst_len;
+    pthread_t thread;
+    int busy;
+};
+
+static struct lz4_block lz4_blocks[MAX_THREADS];
+static int lz4_current = 0;
+
+static void write_fully(const void *data, size_t len)
+{
+    if (len && fwrite(data, len, 1, stdout) != 1) die("cannot write output");
+}
+
+static void write_le32(unsigned value)
+{
+    unsigned char b[4] = { value, value >> 8, value >> 16, value >> 24 };
+    write_fully(b, sizeof(b));
+}
+
+static void *lz4_compress_block(void *arg)
+{
+    struct lz4_block *b = arg;
+    LZ4_streamHC_t *state = LZ4_createStreamHC();
+    if (!state) die("cannot allocate lz4 state");
+    LZ4_resetStreamHC_fast(state, LZ4_LEVEL);
+    LZ4_favorDecompressionSpeed(state, 1);
+    b->dst_len = LZ4_compress_HC_continue(state, b->src, b->dst, b->src_len,
+                                          LZ4_compressBound(LZ4_BLOCK_SIZE));
+    LZ4_freeStreamHC(state);
+    return NULL;
+}
+
+static void lz4_write_block(struct lz4_block *b)
+{
+    if (!b->busy) return;
+    if (num_threads > 1) pthread_join(b->thread, NULL);
+    if (b->dst_len <= 0) die("lz4 compression failed");
+    write_le32(b->dst_len);
+    write_fully(b->dst, b->dst_len);
+    b->busy = 0;
+    b->src_len = 0;
+}
+
+/* Hands the current block over for compression, and moves on to the next
+** one, writing out the block that was last in it first. */
+static void lz4_submit_block(void)
+{
+    struct lz4_block *b = &lz4_blocks[lz4_current];
+    if (b->src_len == 0) return;
+    b->busy = 1;
+    if (num_threads > 1) {
+        if (pthread_create(&b->thread, NULL, lz4_compress_block, b)) {
+            die("cannot create compression thread");
+        }
+    } else {
+        lz4_compress_block(b);
+    }
+    lz4_current = (lz4_current + 1) % num_threads;
+    lz4_write_block(&lz4_blocks[lz4_current]);
+}
+
+/* Returns the space left in the current block, allocating it if needed. */
+static char *lz4_block_space(size_t *len)
+{
+    struct lz4_block *b = &lz4_blocks[lz4_current];
+    if (!b->src) {
+        b->src = malloc(LZ4_BLOCK_SIZE);
+        b->dst = malloc(LZ4_compressBound(LZ4_BLOCK_SIZE));
+        if (!b->src || !b->dst) die("cannot allocate lz4 buffers");
+    }
+    if (b->src_len == LZ4_BLOCK_SIZE) {
+        lz4_submit_block();
+        return lz4_block_space(len);
+    }
+    *len = LZ4_BLOCK_SIZE - b->src_len;
+    return b->src + b->src_len;
+}
+
+static void out_write(const void *data, size_t len)
+{
+    if (!compress_lz4) {
+        write_fully(data, len);
+        return;
+    }
+    while (len > 0) {
+        size_t space;
+        char *dst = lz4_block_space(&space);
+        if (space > len) space = len;
+        memcpy(dst, data, space);
+        lz4_blocks[lz4_current].src_len += space;
+        data = (const char *)data + space;
+        len -= space;
+    }
+}
+
+static void out_copy_file(int fd, const char *path, size_t len)
+{
+    if (compress_lz4) {
+        /* Straight into the blocks. */
+        while (len > 0) {
+            size_t space;
+            char *dst = lz4_block_space(&space);
+            if (space > len) space = len;
+            ssize_t n = read(fd, dst, space);
+            if (n <= 0) die("cannot read '%s'", path);
+            lz4_blocks[lz4_current].src_len += n;
+            len -= n;
+        }
+        return;
+    }
+
+    fflush(stdout);
+#if defined(__linux__)
+    while (len > 0) {
+        ssize_t n = sendfile(STDOUT_FILENO, fd, NULL, len);
+        if (n <= 0) break;
+        len -= n;
+    }
+#endif
+    while (len > 0) {
+        char buf[65536];
+        ssize_t n = read(fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+        if (n <= 0) die("cannot read '%s'", path);
+        write_fully(buf, n);
+        len -= n;
+    }
+}
+
+static void out_start(void)
+{
+    if (compress_lz4) write_le32(LZ4_LEGACY_MAGIC);
+}
+
+static void out_finish(void)
+{
+    if (compress_lz4) {
+        int i;
+        lz4_submit_block();
+        for (i = 0; i < num_threads; i++) {
+            lz4_write_block(&lz4_blocks[(lz4_current + i) % num_threads]);
+        }
+    }
+    if (fflush(stdout)) die("cannot write output");
+}
+
+static void out_zeroes(size_t len)
+{
+    static const char zeroes[4];
+    out_write(zeroes, len);
+}
+
 static void fix_stat(const char *path, struct stat *s)
 {
     uint64_t capabilities;
@@ -81,31 +266,39 @@ static void fix_stat(const char *path, struct stat *s)
         s->st_gid = empty_path_config->gid;
         s->st_mode = empty_path_config->mode | (s->st_mode & ~07777);
     } else {
-        // Use the compiled-in fs_config() function.
+        // Use the compiled-in fs_config() rules.
         unsigned st_mode = s->st_mode;
         int is_dir = S_ISDIR(s->st_mode) || strcmp(path, TRAILER) == 0;
-        fs_config(path, is_dir, target_out_path, &s->st_uid, &s->st_gid, &st_mode, &capabilities);
+        if (!matcher) {
+            matcher = fs_config_matcher_create(target_out_path);
+            if (!matcher) die("cannot read fs_config rules");
+        }
+        fs_config_matcher_lookup(matcher, path, is_dir, &s->st_uid, &s->st_gid, &st_mode,
+                                 &capabilities);
         s->st_mode = (typeof(s->st_mode)) st_mode;
     }
 }
 
-static void _eject(struct stat *s, char *out, int olen, char *data, unsigned datasize)
+static void _eject(struct stat *s, char *out, int olen, char *data, int fd, unsigned datasize)
 {
     // Nothing is special about this value, just picked something in the
     // approximate range that was being used already, and avoiding small
     // values which may be special.
     static unsigned next_inode = 300000;
 
-    while(total_size & 3) {
-        total_size++;
-        putchar(0);
+    char header[6 + 8*13 + 1];
+
+    if (total_size & 3) {
+        out_zeroes(4 - (total_size & 3));
+        total_size = (total_size + 3) & ~3;
     }
 
     fix_stat(out, s);
 //    fprintf(stderr, "_eject %s: mode=0%o\n", out, s->st_mode);
 
-    printf("%06x%08x%08x%08x%08x%08x%08x"
-           "%08x%08x%08x%08x%08x%08x%08x%s%c",
+    snprintf(header, sizeof(header),
+           "%06x%08x%08x%08x%08x%08x%08x"
+           "%08x%08x%08x%08x%08x%08x%08x",
            0x070701,
            next_inode++,  //  s.st_ino,
            s->st_mode,
@@ -119,22 +312,26 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
            0, // devmajor
            0, // devminor,
            olen + 1,
-           0,
-           out,
            0
            );
+    out_write(header, 6 + 8*13);
+    out_write(out, olen + 1);
 
     total_size += 6 + 8*13 + olen + 1;
 
     if(strlen(out) != (unsigned int)olen) die("ACK!");
 
-    while(total_size & 3) {
-        total_size++;
-        putchar(0);
+    if (total_size & 3) {
+        out_zeroes(4 - (total_size & 3));
+        total_size = (total_size + 3) & ~3;
     }
 
     if(datasize) {
-        fwrite(data, datasize, 1, stdout);
+        if (data) {
+            out_write(data, datasize);
+        } else {
+            out_copy_file(fd, out, datasize);
+        }
         total_size += datasize;
     }
 }
@@ -143,11 +340,11 @@ static void _eject_trailer()
 {
     struct stat s;
     memset(&s, 0, sizeof(s));
-    _eject(&s, TRAILER, 10, 0, 0);
+    _eject(&s, TRAILER, 10, 0, -1, 0);
 
     while(total_size & 0xff) {
+        out_zeroes(1);
         total_size++;
-        putchar(0);
     }
 }
 
@@ -242,32 +439,23 @@ static void _archive(char *in, char *out, int ilen, int olen)
     if(lstat(in, &s)) die("could not stat '%s'\n", in);
 
     if(S_ISREG(s.st_mode)){
-        char *tmp;
         int fd;
 
         fd = open(in, O_RDONLY);
         if(fd < 0) die("cannot open '%s' for read", in);
 
-        tmp = (char*) malloc(s.st_size);
-        if(tmp == 0) die("cannot allocate %d bytes", s.st_size);
+        _eject(&s, out, olen, 0, fd, s.st_size);
 
-        if(read(fd, tmp, s.st_size) != s.st_size) {
-            die("cannot read %d bytes", s.st_size);
-        }
-
-        _eject(&s, out, olen, tmp, s.st_size);
-
-        free(tmp);
         close(fd);
     } else if(S_ISDIR(s.st_mode)) {
-        _eject(&s, out, olen, 0, 0);
+        _eject(&s, out, olen, 0, -1, 0);
         _archive_dir(in, out, ilen, olen);
     } else if(S_ISLNK(s.st_mode)) {
         char buf[1024];
         int size;
         size = readlink(in, buf, 1024);
         if(size < 0) die("cannot read symlink '%s'", in);
-        _eject(&s, out, olen, buf, size);
+        _eject(&s, out, olen, buf, -1, size);
     } else {
         die("Unknown '%s' (mode %d)?\n", in, s.st_mode);
     }
@@ -335,6 +523,22 @@ int main(int argc, char *argv[])
     argc--;
     argv++;
 
+    while (argc > 0 && (strcmp(argv[0], "-z") == 0 || strcmp(argv[0], "-j") == 0)) {
+        if (strcmp(argv[0], "-z") == 0) {
+            compress_lz4 = 1;
+            argc--;
+            argv++;
+        } else {
+            if (argc < 2) die("-j needs a thread count");
+            num_threads = atoi(argv[1]);
+            if (num_threads < 1 || num_threads > MAX_THREADS) {
+                die("thread count must be between 1 and %d", MAX_THREADS);
+            }
+            argc -= 2;
+            argv += 2;
+        }
+    }
+
     if (argc > 1 && strcmp(argv[0], "-d") == 0) {
         target_out_path = argv[1];
         argc -= 2;
@@ -349,6 +553,8 @@ int main(int argc, char *argv[])
 
     if(argc == 0) die("no directories to process?!");
 
+    out_start();
+
     while(argc-- > 0){
         char *x = strchr(*argv, '=');
         if(x != 0) {
@@ -363,6 +569,7 @@ int main(int argc, char *argv[])
     }
 
     _eject_trailer();
+    out_finish();
 
     return 0;
 }
@@ -54,6 +54,19 @@ struct TrieNodeInternal {
   uint32_t exact_match_entries;
 };
 
+// A minimal perfect hash over the full names of all exact matches, checked before walking the
+// Trie. A name can only be the exact match in entry
+//   ExactMatchHash(name, seeds[ExactMatchHash(name, 0) % num_buckets]) % num_entries
+// and since any other name hashes to some entry too, the entry's name must still be compared.
+// Entries hold the context and type that walking the Trie returns for their name.
+struct ExactMatchHashInternal {
+  uint32_t num_buckets;
+  uint32_t seeds;
+
+  uint32_t num_entries;
+  uint32_t entries;
+};
+
 struct PropertyInfoAreaHeader {
   // The current version of this data as created by property service.
   uint32_t current_version;
@@ -63,8 +76,23 @@ struct PropertyInfoAreaHeader {
   uint32_t contexts_offset;
   uint32_t types_offset;
   uint32_t root_offset;
+  // Version 2 and later: the ExactMatchHashInternal, or 0 if there is none.
+  uint32_t exact_match_hash_offset;
 };
 
+// Seeded FNV-1a, as used by ExactMatchHashInternal. It is part of the serialized format, so it
+// must not change.
+inline uint32_t ExactMatchHash(const char* name, uint32_t seed) {
+  uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+  for (; *name != '\0'; ++name) {
+    hash = (hash ^ static_cast<unsigned char>(*name)) * 16777619u;
+  }
+  hash ^= hash >> 15;
+  hash *= 0x2c1b3c6du;
+  hash ^= hash >> 12;
+  return hash;
+}
+
 class SerializedData {
  public:
   uint32_t size() const {
@@ -174,6 +202,7 @@ class PropertyInfoArea : private SerializedData {
  private:
   void CheckPrefixMatch(const char* remaining_name, const TrieNode& trie_node,
                         uint32_t* context_index, uint32_t* type_index) const;
+  bool FindExactMatch(const char* name, uint32_t* context_index, uint32_t* type_index) const;
 
   const PropertyInfoAreaHeader* header() const {
     return reinterpret_cast<const PropertyInfoAreaHeader*>(data_base());
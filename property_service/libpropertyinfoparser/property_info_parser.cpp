@@ -107,8 +107,29 @@ void PropertyInfoArea::CheckPrefixMatch(const char* remaining_name, const TrieNo
   }
 }
 
+bool PropertyInfoArea::FindExactMatch(const char* name, uint32_t* context_index,
+                                      uint32_t* type_index) const {
+  if (current_version() < 2 || header()->exact_match_hash_offset == 0) return false;
+
+  auto hash = reinterpret_cast<const ExactMatchHashInternal*>(
+      data_base() + header()->exact_match_hash_offset);
+  if (hash->num_buckets == 0 || hash->num_entries == 0) return false;
+
+  uint32_t seed = uint32_array(hash->seeds)[ExactMatchHash(name, 0) % hash->num_buckets];
+  uint32_t entry_offset =
+      uint32_array(hash->entries)[ExactMatchHash(name, seed) % hash->num_entries];
+  auto entry = reinterpret_cast<const PropertyEntry*>(data_base() + entry_offset);
+  if (strcmp(c_string(entry->name_offset), name)) return false;
+
+  if (context_index != nullptr) *context_index = entry->context_index;
+  if (type_index != nullptr) *type_index = entry->type_index;
+  return true;
+}
+
 void PropertyInfoArea::GetPropertyInfoIndexes(const char* name, uint32_t* context_index,
                                               uint32_t* type_index) const {
+  if (FindExactMatch(name, context_index, type_index)) return;
+
   uint32_t return_context_index = ~0u;
   uint32_t return_type_index = ~0u;
   const char* remaining_name = name;
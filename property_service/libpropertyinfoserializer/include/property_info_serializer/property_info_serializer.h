@@ -36,9 +36,18 @@ struct PropertyInfoEntry {
   bool exact_match;
 };
 
+// How the nodes of the Trie are laid out in the serialized data. Either one can be read by any
+// reader; kBreadthFirst writes the children of each node next to each other, so that lookups
+// touch fewer cache lines and pages.
+enum class TrieLayout {
+  kDepthFirst,
+  kBreadthFirst,
+};
+
 bool BuildTrie(const std::vector<PropertyInfoEntry>& property_info,
                const std::string& default_context, const std::string& default_type,
-               std::string* serialized_trie, std::string* error);
+               std::string* serialized_trie, std::string* error,
+               TrieLayout layout = TrieLayout::kDepthFirst);
 
 void ParsePropertyInfoFile(const std::string& file_contents, bool require_prefix_or_exact,
                            std::vector<PropertyInfoEntry>* property_infos,
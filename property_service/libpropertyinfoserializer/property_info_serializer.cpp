@@ -28,7 +28,7 @@ namespace properties {
 
 bool BuildTrie(const std::vector<PropertyInfoEntry>& property_info,
                const std::string& default_context, const std::string& default_type,
-               std::string* serialized_trie, std::string* error) {
+               std::string* serialized_trie, std::string* error, TrieLayout layout) {
   // Check that names are legal first
   auto trie_builder = TrieBuilder(default_context, default_type);
 
@@ -39,7 +39,7 @@ bool BuildTrie(const std::vector<PropertyInfoEntry>& property_info,
   }
 
   auto trie_serializer = TrieSerializer();
-  *serialized_trie = trie_serializer.SerializeTrie(trie_builder);
+  *serialized_trie = trie_serializer.SerializeTrie(trie_builder, layout);
   return true;
 }
 
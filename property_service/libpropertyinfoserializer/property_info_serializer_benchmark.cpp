@@ -0,0 +1,217 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Benchmarks for building the property info Trie and looking properties up in it, in both
+// layouts. The inputs are the device's property_contexts files, or on the host, the copies in
+// testdata/. Lookups are split by how the name resolves: exact matches, names under a prefix
+// match with and without a dot, names that only get the default context, and names mutated
+// from all of those the way a fuzzer would.
+
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+#include <property_info_parser/property_info_parser.h>
+#include <property_info_serializer/property_info_serializer.h>
+
+using namespace android::properties;
+
+static std::vector<PropertyInfoEntry> LoadPropertyInfo(const std::vector<std::string>& paths) {
+  std::vector<PropertyInfoEntry> property_infos;
+  for (const auto& path : paths) {
+    std::string contents;
+    if (!android::base::ReadFileToString(path, &contents)) continue;
+    std::vector<std::string> errors;
+    ParsePropertyInfoFile(contents, false, &property_infos, &errors);
+  }
+  return property_infos;
+}
+
+static const std::vector<PropertyInfoEntry>& RealPropertyInfo() {
+  static const auto property_infos = [] {
+    auto property_infos = LoadPropertyInfo({
+        "/system/etc/selinux/plat_property_contexts",
+        "/system_ext/etc/selinux/system_ext_property_contexts",
+        "/vendor/etc/selinux/vendor_property_contexts",
+        "/product/etc/selinux/product_property_contexts",
+        "/odm/etc/selinux/odm_property_contexts",
+    });
+    if (property_infos.empty()) {
+      auto testdata = android::base::GetExecutableDirectory() + "/testdata/";
+      property_infos = LoadPropertyInfo({
+          testdata + "plat_property_contexts",
+          testdata + "vendor_property_contexts",
+      });
+    }
+    return property_infos;
+  }();
+  return property_infos;
+}
+
+enum class Workload {
+  kExact,
+  kPrefix,
+  kDotPrefix,
+  kMiss,
+  kFuzzed,
+};
+
+static std::vector<std::string> WorkloadNames(Workload workload) {
+  std::vector<std::string> names;
+  for (const auto& property_info : RealPropertyInfo()) {
+    const auto& name = property_info.name;
+    switch (workload) {
+      case Workload::kExact:
+        if (property_info.exact_match) names.emplace_back(name);
+        break;
+      case Workload::kPrefix:
+        if (!property_info.exact_match && name.back() != '.') names.emplace_back(name + "_suffix");
+        break;
+      case Workload::kDotPrefix:
+        if (!property_info.exact_match && name.back() == '.') names.emplace_back(name + "suffix");
+        break;
+      case Workload::kMiss:
+        names.emplace_back("benchmark.missing." + name);
+        break;
+      case Workload::kFuzzed:
+        names.emplace_back(name);
+        break;
+    }
+  }
+
+  // Truncate, extend, and flip characters of names, with a fixed seed so that runs compare.
+  if (workload == Workload::kFuzzed) {
+    std::mt19937 random(0);
+    for (auto& name : names) {
+      switch (random() % 3) {
+        case 0:
+          name.resize(random() % (name.size() + 1));
+          break;
+        case 1:
+          name += (random() % 2) ? ".fuzzed" : "fuzzed";
+          break;
+        case 2:
+          if (!name.empty()) name[random() % name.size()] = ".az09_"[random() % 6];
+          break;
+      }
+    }
+  }
+  return names;
+}
+
+static bool BuildRealTrie(benchmark::State& state, std::string* serialized_trie) {
+  if (RealPropertyInfo().empty()) {
+    state.SkipWithError("no property_contexts found");
+    return false;
+  }
+  std::string error;
+  if (!BuildTrie(RealPropertyInfo(), "u:object_r:default_prop:s0", "string", serialized_trie,
+                 &error, static_cast<TrieLayout>(state.range(0)))) {
+    state.SkipWithError(error.c_str());
+    return false;
+  }
+  state.counters["size"] = serialized_trie->size();
+  return true;
+}
+
+static void BM_BuildTrie(benchmark::State& state) {
+  std::string serialized_trie;
+  if (!BuildRealTrie(state, &serialized_trie)) return;
+
+  for (auto _ : state) {
+    std::string error;
+    BuildTrie(RealPropertyInfo(), "u:object_r:default_prop:s0", "string", &serialized_trie,
+              &error, static_cast<TrieLayout>(state.range(0)));
+    benchmark::DoNotOptimize(serialized_trie);
+  }
+  state.counters["entries"] = RealPropertyInfo().size();
+}
+BENCHMARK(BM_BuildTrie)
+    ->Arg(static_cast<int>(TrieLayout::kDepthFirst))
+    ->Arg(static_cast<int>(TrieLayout::kBreadthFirst))
+    ->Unit(benchmark::kMicrosecond);
+
+static void LayoutsAndWorkloads(benchmark::internal::Benchmark* benchmark) {
+  for (auto layout : {TrieLayout::kDepthFirst, TrieLayout::kBreadthFirst}) {
+    for (auto workload : {Workload::kExact, Workload::kPrefix, Workload::kDotPrefix,
+                          Workload::kMiss, Workload::kFuzzed}) {
+      benchmark->Args({static_cast<int>(layout), static_cast<int>(workload)});
+    }
+  }
+}
+
+static void BM_GetPropertyInfo(benchmark::State& state) {
+  std::string serialized_trie;
+  if (!BuildRealTrie(state, &serialized_trie)) return;
+  auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
+  auto names = WorkloadNames(static_cast<Workload>(state.range(1)));
+  if (names.empty()) {
+    state.SkipWithError("no names for this workload");
+    return;
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    const char* context;
+    const char* type;
+    property_info_area->GetPropertyInfo(names[i].c_str(), &context, &type);
+    benchmark::DoNotOptimize(context);
+    benchmark::DoNotOptimize(type);
+    if (++i == names.size()) i = 0;
+  }
+}
+BENCHMARK(BM_GetPropertyInfo)->Apply(LayoutsAndWorkloads);
+
+// Most processes only look up a few properties now and then, by which time the property info
+// has left the CPU caches, so also time lookups after the caches have been flushed.
+static void BM_GetPropertyInfo_Cold(benchmark::State& state) {
+  static constexpr size_t kLookupsPerFlush = 16;
+  static constexpr size_t kFlushSize = 16 * 1024 * 1024;
+
+  std::string serialized_trie;
+  if (!BuildRealTrie(state, &serialized_trie)) return;
+  auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
+  auto names = WorkloadNames(Workload::kFuzzed);
+  std::vector<char> flush(kFlushSize);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    memset(flush.data(), i, flush.size());
+    benchmark::ClobberMemory();
+    state.ResumeTiming();
+
+    for (size_t j = 0; j < kLookupsPerFlush; ++j) {
+      const char* context;
+      property_info_area->GetPropertyInfo(names[i].c_str(), &context, nullptr);
+      benchmark::DoNotOptimize(context);
+      // Step through the names, so that lookups don't share a path through the Trie.
+      i = (i + 97) % names.size();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kLookupsPerFlush);
+}
+// The flush dominates the run time, so use a fixed number of iterations.
+BENCHMARK(BM_GetPropertyInfo_Cold)
+    ->Arg(static_cast<int>(TrieLayout::kDepthFirst))
+    ->Arg(static_cast<int>(TrieLayout::kBreadthFirst))
+    ->Iterations(2000);
+
+BENCHMARK_MAIN();
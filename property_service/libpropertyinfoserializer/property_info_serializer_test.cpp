@@ -18,6 +18,7 @@
 
 #include "property_info_parser/property_info_parser.h"
 
+#include <android-base/stringprintf.h>
 #include <gtest/gtest.h>
 
 namespace android {
@@ -39,7 +40,7 @@ TEST(propertyinfoserializer, TrieNodeCheck) {
   auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
 
   // Initial checks for property area.
-  EXPECT_EQ(1U, property_info_area->current_version());
+  EXPECT_EQ(2U, property_info_area->current_version());
   EXPECT_EQ(1U, property_info_area->minimum_supported_version());
 
   // Check the root node
@@ -888,5 +889,147 @@ TEST(propertyinfoserializer, GetPropertyInfo_empty_context_and_type) {
   EXPECT_STREQ("5th", type);
 }
 
+TEST(propertyinfoserializer, GetPropertyInfo_exact_match_hash) {
+  auto property_info = std::vector<PropertyInfoEntry>{
+      {"persist.", "1st", "", false},
+      {"persist.exact_match", "", "", true},
+      {"persist.exact_match_typed", "", "2nd", true},
+      {"persist.radio.", "3rd", "3rd", false},
+      {"persist.radio.exact", "4th", "", true},
+      {"persist.radio.exa", "5th", "5th", false},
+  };
+  for (int i = 0; i < 500; ++i) {
+    property_info.emplace_back(android::base::StringPrintf("ro.exact.%d.name", i),
+                               android::base::StringPrintf("ctx%d", i % 7), "", true);
+  }
+
+  auto serialized_trie = std::string();
+  auto build_trie_error = std::string();
+  ASSERT_TRUE(BuildTrie(property_info, "default", "default", &serialized_trie, &build_trie_error))
+      << build_trie_error;
+
+  auto header = reinterpret_cast<const PropertyInfoAreaHeader*>(serialized_trie.data());
+  ASSERT_NE(0U, header->exact_match_hash_offset);
+
+  // Without the hash, as a version 1 reader would see the same data, the Trie must give the
+  // same results.
+  auto v1_trie = serialized_trie;
+  reinterpret_cast<PropertyInfoAreaHeader*>(v1_trie.data())->current_version = 1;
+
+  auto names = std::vector<std::string>{
+      "persist.exact_match",   "persist.exact_match_typed", "persist.exact_match.not",
+      "persist.exact_matc",    "persist.radio.exact",       "persist.radio.exactly",
+      "persist.radio.exa",     "persist.other",             "ro.exact.1000.name",
+      "ro.exact.1.name.other", "notpersist.exact_match",    "",
+  };
+  for (int i = 0; i < 500; ++i) {
+    names.emplace_back(android::base::StringPrintf("ro.exact.%d.name", i));
+  }
+
+  for (const auto* data : {&serialized_trie, &v1_trie}) {
+    auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(data->data());
+    const char* context;
+    const char* type;
+    property_info_area->GetPropertyInfo("persist.exact_match", &context, &type);
+    EXPECT_STREQ("1st", context);
+    EXPECT_STREQ("default", type);
+    property_info_area->GetPropertyInfo("persist.exact_match_typed", &context, &type);
+    EXPECT_STREQ("1st", context);
+    EXPECT_STREQ("2nd", type);
+    property_info_area->GetPropertyInfo("persist.radio.exact", &context, &type);
+    EXPECT_STREQ("4th", context);
+    EXPECT_STREQ("5th", type);
+    property_info_area->GetPropertyInfo("ro.exact.123.name", &context, &type);
+    EXPECT_STREQ("ctx4", context);
+    EXPECT_STREQ("default", type);
+  }
+
+  auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
+  auto v1_property_info_area = reinterpret_cast<const PropertyInfoArea*>(v1_trie.data());
+  for (const auto& name : names) {
+    uint32_t context_index, type_index, v1_context_index, v1_type_index;
+    property_info_area->GetPropertyInfoIndexes(name.c_str(), &context_index, &type_index);
+    v1_property_info_area->GetPropertyInfoIndexes(name.c_str(), &v1_context_index,
+                                                  &v1_type_index);
+    EXPECT_EQ(v1_context_index, context_index) << name;
+    EXPECT_EQ(v1_type_index, type_index) << name;
+  }
+}
+
+TEST(propertyinfoserializer, BreadthFirstLayout) {
+  auto property_info = std::vector<PropertyInfoEntry>{
+      {"persist.", "1st", "1st", false},
+      {"persist.radio.", "2nd", "", false},
+      {"persist.radio.long.", "3rd", "3rd", false},
+      {"persist.radio.long.prefix", "4th", "", false},
+      {"persist.radio.long.exact", "5th", "5th", true},
+      {"persist.sys.", "6th", "", false},
+      {"persist.sys.exact", "", "7th", true},
+      {"ro.a.", "8th", "8th", false},
+      {"ro.b.", "9th", "9th", false},
+      {"ro.c", "10th", "10th", false},
+  };
+
+  auto depth_first_trie = std::string();
+  auto breadth_first_trie = std::string();
+  auto build_trie_error = std::string();
+  ASSERT_TRUE(BuildTrie(property_info, "default", "default", &depth_first_trie,
+                        &build_trie_error, TrieLayout::kDepthFirst))
+      << build_trie_error;
+  ASSERT_TRUE(BuildTrie(property_info, "default", "default", &breadth_first_trie,
+                        &build_trie_error, TrieLayout::kBreadthFirst))
+      << build_trie_error;
+
+  auto depth_first_area = reinterpret_cast<const PropertyInfoArea*>(depth_first_trie.data());
+  auto breadth_first_area = reinterpret_cast<const PropertyInfoArea*>(breadth_first_trie.data());
+
+  // The children of a node are written before anything below them.
+  auto root_node = breadth_first_area->root_node();
+  ASSERT_EQ(2U, root_node.num_child_nodes());
+  TrieNode persist_node;
+  TrieNode ro_node;
+  ASSERT_TRUE(root_node.FindChildForString("persist", 7, &persist_node));
+  ASSERT_TRUE(root_node.FindChildForString("ro", 2, &ro_node));
+  TrieNode radio_node;
+  ASSERT_TRUE(persist_node.FindChildForString("radio", 5, &radio_node));
+  EXPECT_LT(ro_node.name(), radio_node.name());
+
+  auto names = std::vector<std::string>{
+      "persist.something",         "persist.radio.something",   "persist.radio.long.something",
+      "persist.radio.long.prefix", "persist.radio.long.prefixx", "persist.radio.long.exact",
+      "persist.radio.long.exactt", "persist.sys.exact",         "persist.sys.exact.not",
+      "ro.a.b",                    "ro.b",                      "ro.cc",
+      "ro.d",                      "other",                     "",
+  };
+  for (const auto& name : names) {
+    uint32_t depth_first_context, depth_first_type, breadth_first_context, breadth_first_type;
+    depth_first_area->GetPropertyInfoIndexes(name.c_str(), &depth_first_context,
+                                             &depth_first_type);
+    breadth_first_area->GetPropertyInfoIndexes(name.c_str(), &breadth_first_context,
+                                               &breadth_first_type);
+    EXPECT_EQ(depth_first_context, breadth_first_context) << name;
+    EXPECT_EQ(depth_first_type, breadth_first_type) << name;
+  }
+}
+
+TEST(propertyinfoserializer, GetPropertyInfo_no_exact_matches) {
+  auto property_info = std::vector<PropertyInfoEntry>{
+      {"persist.", "1st", "1st", false},
+  };
+
+  auto serialized_trie = std::string();
+  auto build_trie_error = std::string();
+  ASSERT_TRUE(BuildTrie(property_info, "default", "default", &serialized_trie, &build_trie_error))
+      << build_trie_error;
+
+  auto header = reinterpret_cast<const PropertyInfoAreaHeader*>(serialized_trie.data());
+  EXPECT_EQ(0U, header->exact_match_hash_offset);
+
+  auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
+  const char* context;
+  property_info_area->GetPropertyInfo("persist.something", &context, nullptr);
+  EXPECT_STREQ("1st", context);
+}
+
 }  // namespace properties
 }  // namespace android
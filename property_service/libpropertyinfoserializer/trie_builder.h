@@ -20,6 +20,8 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace android {
@@ -39,25 +41,23 @@ class TrieBuilderNode {
   TrieBuilderNode(const std::string& name) : property_entry_(name, nullptr, nullptr) {}
 
   TrieBuilderNode* FindChild(const std::string& name) {
-    for (auto& child : children_) {
-      if (child.name() == name) return &child;
-    }
-    return nullptr;
+    auto it = child_indexes_.find(name);
+    return it != child_indexes_.end() ? &children_[it->second] : nullptr;
   }
 
   const TrieBuilderNode* FindChild(const std::string& name) const {
-    for (const auto& child : children_) {
-      if (child.name() == name) return &child;
-    }
-    return nullptr;
+    auto it = child_indexes_.find(name);
+    return it != child_indexes_.end() ? &children_[it->second] : nullptr;
   }
 
-  TrieBuilderNode* AddChild(const std::string& name) { return &children_.emplace_back(name); }
+  TrieBuilderNode* AddChild(const std::string& name) {
+    child_indexes_.emplace(name, children_.size());
+    return &children_.emplace_back(name);
+  }
 
   bool AddPrefixContext(const std::string& prefix, const std::string* context,
                         const std::string* type) {
-    if (std::find_if(prefixes_.begin(), prefixes_.end(),
-                     [&prefix](const auto& t) { return t.name == prefix; }) != prefixes_.end()) {
+    if (!prefix_names_.emplace(prefix).second) {
       return false;
     }
 
@@ -67,9 +67,7 @@ class TrieBuilderNode {
 
   bool AddExactMatchContext(const std::string& exact_match, const std::string* context,
                             const std::string* type) {
-    if (std::find_if(exact_matches_.begin(), exact_matches_.end(), [&exact_match](const auto& t) {
-          return t.name == exact_match;
-        }) != exact_matches_.end()) {
+    if (!exact_match_names_.emplace(exact_match).second) {
       return false;
     }
 
@@ -94,6 +92,12 @@ class TrieBuilderNode {
   std::vector<TrieBuilderNode> children_;
   std::vector<PropertyEntryBuilder> prefixes_;
   std::vector<PropertyEntryBuilder> exact_matches_;
+
+  // Platform and vendor property_contexts together put thousands of entries at some nodes, so
+  // names are indexed rather than searched for.
+  std::unordered_map<std::string, size_t> child_indexes_;
+  std::unordered_set<std::string> prefix_names_;
+  std::unordered_set<std::string> exact_match_names_;
 };
 
 class TrieBuilder {
@@ -102,7 +106,7 @@ class TrieBuilder {
   bool AddToTrie(const std::string& name, const std::string& context, const std::string& type,
                  bool exact, std::string* error);
 
-  const TrieBuilderNode builder_root() const { return builder_root_; }
+  const TrieBuilderNode& builder_root() const { return builder_root_; }
   const std::set<std::string>& contexts() const { return contexts_; }
   const std::set<std::string>& types() const { return types_; }
 
@@ -16,6 +16,9 @@
 
 #include "trie_serializer.h"
 
+#include <algorithm>
+#include <queue>
+
 namespace android {
 namespace properties {
 
@@ -55,17 +58,26 @@ uint32_t TrieSerializer::WritePropertyEntry(const PropertyEntryBuilder& property
   return offset;
 }
 
-uint32_t TrieSerializer::WriteTrieNode(const TrieBuilderNode& builder_node) {
-  uint32_t trie_offset;
-  auto trie = arena_->AllocateObject<TrieNodeInternal>(&trie_offset);
+// Sorting copies of the builder's nodes would copy whole subtrees, so sort pointers to them.
+template <typename T>
+static std::vector<const T*> SortedPointers(const std::vector<T>& elements) {
+  std::vector<const T*> pointers;
+  pointers.reserve(elements.size());
+  for (const auto& element : elements) {
+    pointers.emplace_back(&element);
+  }
+  return pointers;
+}
 
-  trie->property_entry = WritePropertyEntry(builder_node.property_entry());
+void TrieSerializer::WriteMatches(const TrieBuilderNode& builder_node, uint32_t trie_offset) {
+  auto trie = arena_->GetObject<TrieNodeInternal>(trie_offset);
 
   // Write prefix matches
-  auto sorted_prefix_matches = builder_node.prefixes();
+  auto sorted_prefix_matches = SortedPointers(builder_node.prefixes());
   // Prefixes are sorted by descending length
-  std::sort(sorted_prefix_matches.begin(), sorted_prefix_matches.end(),
-            [](const auto& lhs, const auto& rhs) { return lhs.name.size() > rhs.name.size(); });
+  std::stable_sort(
+      sorted_prefix_matches.begin(), sorted_prefix_matches.end(),
+      [](const auto* lhs, const auto* rhs) { return lhs->name.size() > rhs->name.size(); });
 
   trie->num_prefixes = sorted_prefix_matches.size();
 
@@ -73,15 +85,15 @@ uint32_t TrieSerializer::WriteTrieNode(const TrieBuilderNode& builder_node) {
   trie->prefix_entries = prefix_entries_array_offset;
 
   for (unsigned int i = 0; i < sorted_prefix_matches.size(); ++i) {
-    uint32_t property_entry_offset = WritePropertyEntry(sorted_prefix_matches[i]);
+    uint32_t property_entry_offset = WritePropertyEntry(*sorted_prefix_matches[i]);
     arena_->uint32_array(prefix_entries_array_offset)[i] = property_entry_offset;
   }
 
   // Write exact matches
-  auto sorted_exact_matches = builder_node.exact_matches();
+  auto sorted_exact_matches = SortedPointers(builder_node.exact_matches());
   // Exact matches are sorted alphabetically
   std::sort(sorted_exact_matches.begin(), sorted_exact_matches.end(),
-            [](const auto& lhs, const auto& rhs) { return lhs.name < rhs.name; });
+            [](const auto* lhs, const auto* rhs) { return lhs->name < rhs->name; });
 
   trie->num_exact_matches = sorted_exact_matches.size();
 
@@ -90,32 +102,187 @@ uint32_t TrieSerializer::WriteTrieNode(const TrieBuilderNode& builder_node) {
   trie->exact_match_entries = exact_match_entries_array_offset;
 
   for (unsigned int i = 0; i < sorted_exact_matches.size(); ++i) {
-    uint32_t property_entry_offset = WritePropertyEntry(sorted_exact_matches[i]);
+    uint32_t property_entry_offset = WritePropertyEntry(*sorted_exact_matches[i]);
     arena_->uint32_array(exact_match_entries_array_offset)[i] = property_entry_offset;
   }
+}
+
+uint32_t TrieSerializer::WriteTrieNode(const TrieBuilderNode& builder_node) {
+  uint32_t trie_offset;
+  auto trie = arena_->AllocateObject<TrieNodeInternal>(&trie_offset);
+
+  trie->property_entry = WritePropertyEntry(builder_node.property_entry());
+
+  WriteMatches(builder_node, trie_offset);
 
   // Write children
-  auto sorted_children = builder_node.children();
+  auto sorted_children = SortedPointers(builder_node.children());
   std::sort(sorted_children.begin(), sorted_children.end(),
-            [](const auto& lhs, const auto& rhs) { return lhs.name() < rhs.name(); });
+            [](const auto* lhs, const auto* rhs) { return lhs->name() < rhs->name(); });
 
   trie->num_child_nodes = sorted_children.size();
   uint32_t children_offset_array_offset = arena_->AllocateUint32Array(sorted_children.size());
   trie->child_nodes = children_offset_array_offset;
 
   for (unsigned int i = 0; i < sorted_children.size(); ++i) {
-    arena_->uint32_array(children_offset_array_offset)[i] = WriteTrieNode(sorted_children[i]);
+    arena_->uint32_array(children_offset_array_offset)[i] = WriteTrieNode(*sorted_children[i]);
   }
   return trie_offset;
 }
 
+// Lookups binary search a node's children by name, then check the prefixes of the child they
+// descend into. So rather than writing each subtree in one piece, each node's children are
+// written together: the offset array, and each child's node and name right after one another.
+// Sets of children that fit into a cache line are kept from straddling two.
+uint32_t TrieSerializer::WriteTrieBreadthFirst(const TrieBuilderNode& builder_root) {
+  static constexpr uint32_t kCacheLineSize = 64;
+
+  uint32_t root_offset;
+  auto root = arena_->AllocateObject<TrieNodeInternal>(&root_offset);
+  root->property_entry = WritePropertyEntry(builder_root.property_entry());
+
+  std::queue<std::pair<const TrieBuilderNode*, uint32_t>> queue;
+  queue.emplace(&builder_root, root_offset);
+  while (!queue.empty()) {
+    auto [builder_node, trie_offset] = queue.front();
+    queue.pop();
+
+    WriteMatches(*builder_node, trie_offset);
+
+    auto sorted_children = SortedPointers(builder_node->children());
+    std::sort(sorted_children.begin(), sorted_children.end(),
+              [](const auto* lhs, const auto* rhs) { return lhs->name() < rhs->name(); });
+
+    uint32_t children_size = sorted_children.size() * sizeof(uint32_t);
+    for (const auto* child : sorted_children) {
+      children_size += sizeof(TrieNodeInternal) + sizeof(PropertyEntry) +
+                       ((child->name().size() + sizeof(uint32_t)) & ~(sizeof(uint32_t) - 1));
+    }
+    uint32_t line_offset = arena_->size() % kCacheLineSize;
+    if (children_size <= kCacheLineSize && line_offset + children_size > kCacheLineSize) {
+      arena_->AllocateData(kCacheLineSize - line_offset, nullptr);
+    }
+
+    auto trie = arena_->GetObject<TrieNodeInternal>(trie_offset);
+    trie->num_child_nodes = sorted_children.size();
+    uint32_t children_offset_array_offset = arena_->AllocateUint32Array(sorted_children.size());
+    trie->child_nodes = children_offset_array_offset;
+
+    for (unsigned int i = 0; i < sorted_children.size(); ++i) {
+      uint32_t child_offset;
+      auto child = arena_->AllocateObject<TrieNodeInternal>(&child_offset);
+      child->property_entry = WritePropertyEntry(sorted_children[i]->property_entry());
+      arena_->uint32_array(children_offset_array_offset)[i] = child_offset;
+      queue.emplace(sorted_children[i], child_offset);
+    }
+  }
+  return root_offset;
+}
+
+static void CollectExactMatchNames(const TrieBuilderNode& builder_node, const std::string& prefix,
+                                   std::vector<std::string>* names) {
+  for (const auto& exact_match : builder_node.exact_matches()) {
+    names->emplace_back(prefix + exact_match.name);
+  }
+  for (const auto& child : builder_node.children()) {
+    CollectExactMatchNames(child, prefix + child.name() + ".", names);
+  }
+}
+
+uint32_t TrieSerializer::WriteExactMatchHash(const TrieBuilder& trie_builder) {
+  // Buckets hold two names on average, which keeps finding seeds quick, while the seeds take
+  // up half as much space as the entries.
+  static constexpr uint32_t kNamesPerBucket = 2;
+  static constexpr uint32_t kMaxSeed = 1u << 20;
+
+  std::vector<std::string> names;
+  CollectExactMatchNames(trie_builder.builder_root(), "", &names);
+  if (names.empty()) return 0;
+
+  // Store what the Trie returns for each name, so that the hash gives the same results.
+  std::vector<std::pair<uint32_t, uint32_t>> indexes(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    serialized_info()->GetPropertyInfoIndexes(names[i].c_str(), &indexes[i].first,
+                                              &indexes[i].second);
+  }
+
+  const uint32_t num_entries = names.size();
+  const uint32_t num_buckets = (num_entries + kNamesPerBucket - 1) / kNamesPerBucket;
+  std::vector<std::vector<uint32_t>> buckets(num_buckets);
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    buckets[ExactMatchHash(names[i].c_str(), 0) % num_buckets].emplace_back(i);
+  }
+
+  // Place the largest buckets first, while most entries are still free.
+  std::vector<uint32_t> bucket_order(num_buckets);
+  for (uint32_t i = 0; i < num_buckets; ++i) bucket_order[i] = i;
+  std::stable_sort(bucket_order.begin(), bucket_order.end(), [&buckets](auto lhs, auto rhs) {
+    return buckets[lhs].size() > buckets[rhs].size();
+  });
+
+  std::vector<uint32_t> seeds(num_buckets, 0);
+  std::vector<uint32_t> entry_names(num_entries, ~0u);
+  std::vector<uint32_t> bucket_entries;
+  for (auto bucket : bucket_order) {
+    if (buckets[bucket].empty()) break;
+
+    uint32_t seed = 1;
+    for (; seed < kMaxSeed; ++seed) {
+      bucket_entries.clear();
+      for (auto name : buckets[bucket]) {
+        uint32_t entry = ExactMatchHash(names[name].c_str(), seed) % num_entries;
+        if (entry_names[entry] != ~0u ||
+            std::find(bucket_entries.begin(), bucket_entries.end(), entry) !=
+                bucket_entries.end()) {
+          break;
+        }
+        bucket_entries.emplace_back(entry);
+      }
+      if (bucket_entries.size() == buckets[bucket].size()) break;
+    }
+    // Readers fall back to walking the Trie without a hash, so this isn't an error.
+    if (seed == kMaxSeed) return 0;
+
+    seeds[bucket] = seed;
+    for (size_t i = 0; i < bucket_entries.size(); ++i) {
+      entry_names[bucket_entries[i]] = buckets[bucket][i];
+    }
+  }
+
+  uint32_t hash_offset;
+  auto hash = arena_->AllocateObject<ExactMatchHashInternal>(&hash_offset);
+  hash->num_buckets = num_buckets;
+  hash->num_entries = num_entries;
+
+  uint32_t seeds_array_offset = arena_->AllocateUint32Array(num_buckets);
+  hash->seeds = seeds_array_offset;
+  for (uint32_t i = 0; i < num_buckets; ++i) {
+    arena_->uint32_array(seeds_array_offset)[i] = seeds[i];
+  }
+
+  uint32_t entries_array_offset = arena_->AllocateUint32Array(num_entries);
+  hash->entries = entries_array_offset;
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    const auto& name = names[entry_names[i]];
+    uint32_t property_entry_offset;
+    auto property_entry = arena_->AllocateObject<PropertyEntry>(&property_entry_offset);
+    property_entry->name_offset = arena_->AllocateAndWriteString(name);
+    property_entry->namelen = name.size();
+    property_entry->context_index = indexes[entry_names[i]].first;
+    property_entry->type_index = indexes[entry_names[i]].second;
+    arena_->uint32_array(entries_array_offset)[i] = property_entry_offset;
+  }
+  return hash_offset;
+}
+
 TrieSerializer::TrieSerializer() {}
 
-std::string TrieSerializer::SerializeTrie(const TrieBuilder& trie_builder) {
+std::string TrieSerializer::SerializeTrie(const TrieBuilder& trie_builder, TrieLayout layout) {
   arena_.reset(new TrieNodeArena());
 
   auto header = arena_->AllocateObject<PropertyInfoAreaHeader>(nullptr);
-  header->current_version = 1;
+  // Version 2 only adds the exact match hash, which version 1 readers ignore.
+  header->current_version = 2;
   header->minimum_supported_version = 1;
 
   // Store where we're about to write the contexts.
@@ -129,9 +296,16 @@ std::string TrieSerializer::SerializeTrie(const TrieBuilder& trie_builder) {
   // We need to store size() up to this point now for Find*Offset() to work.
   header->size = arena_->size();
 
-  uint32_t root_trie_offset = WriteTrieNode(trie_builder.builder_root());
+  const auto& builder_root = trie_builder.builder_root();
+  uint32_t root_trie_offset = layout == TrieLayout::kBreadthFirst
+                                  ? WriteTrieBreadthFirst(builder_root)
+                                  : WriteTrieNode(builder_root);
   header->root_offset = root_trie_offset;
 
+  // The hash is built by looking names up in the Trie written so far.
+  header->size = arena_->size();
+  header->exact_match_hash_offset = WriteExactMatchHash(trie_builder);
+
   // Record the real size now that we've written everything
   header->size = arena_->size();
 
@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "property_info_parser/property_info_parser.h"
+#include "property_info_serializer/property_info_serializer.h"
 
 #include "trie_builder.h"
 #include "trie_node_arena.h"
@@ -32,16 +33,26 @@ class TrieSerializer {
  public:
   TrieSerializer();
 
-  std::string SerializeTrie(const TrieBuilder& trie_builder);
+  std::string SerializeTrie(const TrieBuilder& trie_builder, TrieLayout layout);
 
  private:
   void SerializeStrings(const std::set<std::string>& strings);
   uint32_t WritePropertyEntry(const PropertyEntryBuilder& property_entry);
 
+  // Writes the prefix and exact matches of the TrieNode at trie_offset.
+  void WriteMatches(const TrieBuilderNode& builder_node, uint32_t trie_offset);
+
   // Writes a new TrieNode to arena, and recursively writes its children.
   // Returns the offset within arena.
   uint32_t WriteTrieNode(const TrieBuilderNode& builder_node);
 
+  // Writes the whole Trie in TrieLayout::kBreadthFirst order. Returns the root's offset.
+  uint32_t WriteTrieBreadthFirst(const TrieBuilderNode& builder_root);
+
+  // Writes the ExactMatchHashInternal for every exact match in trie_builder, once the Trie
+  // itself is written. Returns its offset within arena, or 0 if no hash was written.
+  uint32_t WriteExactMatchHash(const TrieBuilder& trie_builder);
+
   const PropertyInfoArea* serialized_info() const {
     return reinterpret_cast<const PropertyInfoArea*>(arena_->data().data());
   }
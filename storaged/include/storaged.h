@@ -142,6 +142,12 @@ class storaged_t : public RefBase {
 
     uint32_t get_recent_perf(void) { return storage_info->get_recent_perf(); }
 
+    bool get_disk_latency(latency_histogram* read, latency_histogram* write) {
+        if (!mDsm || !mDsm->enabled()) return false;
+        mDsm->get_latency(read, write);
+        return true;
+    }
+
     map<uint64_t, struct uid_records> get_uid_records(
             double hours, uint64_t threshold, bool force_report) {
         return mUidm.dump(hours, threshold, force_report);
@@ -166,5 +172,6 @@ class storaged_t : public RefBase {
 #define EVENTLOGTAG_DISKSTATS ( 2732 )
 #define EVENTLOGTAG_EMMCINFO ( 2733 )
 #define EVENTLOGTAG_UID_IO_ALERT ( 2734 )
+#define EVENTLOGTAG_DISKLATENCY ( 2735 )
 
 #endif /* _STORAGED_H_ */
@@ -19,6 +19,9 @@
 
 #include <stdint.h>
 
+#include <mutex>
+#include <string>
+
 #include <aidl/android/hardware/health/IHealth.h>
 
 // number of attributes diskstats has
@@ -141,6 +144,26 @@ public:
     }
 };
 
+// I/O counts by latency, in log2 buckets of milliseconds: bucket 0 is under
+// 1ms, and bucket i from 2^(i-1) up to 2^i ms, with the last one open ended.
+// diskstats only has the total wait time of each type of I/O, so the latency
+// of the I/Os of each update is the average for that update; the histogram
+// shows the updates in which the disk was slow, weighted by their I/Os.
+class latency_histogram {
+public:
+    static constexpr int BUCKETS = 16;
+
+    latency_histogram() : mCounts{} {};
+    void add(uint64_t ios, uint64_t ticks);
+    uint64_t count(int bucket) const { return mCounts[bucket]; }
+    // the upper bound of the bucket the given percentile of I/Os falls in, in
+    // ms, or 0 without any I/Os
+    uint64_t get_percentile(double percentile) const;
+    std::string to_string() const;
+private:
+    uint64_t mCounts[BUCKETS];
+};
+
 class disk_stats_monitor {
 private:
     FRIEND_TEST(storaged_test, disk_stats_monitor);
@@ -163,6 +186,13 @@ private:
     struct disk_perf mMean;
     struct disk_perf mStd;
     std::shared_ptr<aidl::android::hardware::health::IHealth> mHealth;
+    // read by dumpsys, protected by mLatencyLock
+    latency_histogram mReadLatency;
+    latency_histogram mWriteLatency;
+    // reset after publish
+    latency_histogram mReadLatency_pub;
+    latency_histogram mWriteLatency_pub;
+    std::mutex mLatencyLock;
 
     void update_mean();
     void update_std();
@@ -195,6 +225,8 @@ public:
   bool enabled() { return mHealth != nullptr || DISK_STATS_PATH != nullptr; }
   void update(void);
   void publish(void);
+  // since storaged started
+  void get_latency(latency_histogram* read, latency_histogram* write);
 };
 
 #endif /* _STORAGED_DISKSTATS_H_ */
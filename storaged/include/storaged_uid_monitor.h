@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -39,7 +40,7 @@ using namespace android::os::storaged;
 
 class uid_info : public UidInfo {
 public:
-    bool parse_uid_io_stats(string&& s);
+    bool parse_uid_io_stats(string_view s);
 };
 
 class io_usage {
@@ -83,6 +84,12 @@ private:
 
     // last dump from /proc/uid_io/stats, uid -> uid_info
     unordered_map<uint32_t, uid_info> last_uid_io_stats_;
+    // the contents of /proc/uid_io/stats, kept to reuse the allocation
+    string uid_io_buffer_;
+    // names from the package manager, uid -> name, or the uid itself if it has none.
+    // A uid drops out of /proc/uid_io/stats when its package is removed, and its
+    // name is looked up again if the uid comes back.
+    unordered_map<uint32_t, string> uid_names_;
     // current io usage for next report, app name -> uid_io_usage
     unordered_map<string, uid_io_usage> curr_io_stats_;
     // io usage records, end timestamp -> {start timestamp, vector of records}
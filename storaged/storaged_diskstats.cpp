@@ -19,7 +19,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <mutex>
 #include <sstream>
+#include <string>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -61,8 +63,60 @@ void log_event_disk_stats(struct disk_stats* stats, const char* type) {
         << LOG_ID_EVENTS;
 }
 
+void log_event_disk_latency(const latency_histogram& read, const latency_histogram& write,
+                            const char* type) {
+    if (read.get_percentile(100) == 0 && write.get_percentile(100) == 0) return;
+
+    android_log_event_list(EVENTLOGTAG_DISKLATENCY)
+        << type
+        << read.get_percentile(50) << read.get_percentile(99) << read.get_percentile(100)
+        << write.get_percentile(50) << write.get_percentile(99) << write.get_percentile(100)
+        << LOG_ID_EVENTS;
+}
+
 } // namespace
 
+void latency_histogram::add(uint64_t ios, uint64_t ticks)
+{
+    if (ios == 0) return;
+    uint64_t latency = ticks / ios;
+    int bucket = 0;
+    while (latency > 0 && bucket < BUCKETS - 1) {
+        latency >>= 1;
+        bucket++;
+    }
+    mCounts[bucket] += ios;
+}
+
+uint64_t latency_histogram::get_percentile(double percentile) const
+{
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        total += mCounts[i];
+    }
+    if (total == 0) return 0;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += mCounts[i];
+        if (mCounts[i] && seen >= total * percentile / 100) {
+            return 1ULL << i;
+        }
+    }
+    return 1ULL << (BUCKETS - 1);
+}
+
+std::string latency_histogram::to_string() const
+{
+    std::string s = "<1ms:" + std::to_string(mCounts[0]);
+    for (int i = 1; i < BUCKETS; i++) {
+        s += " " + std::to_string(1ULL << (i - 1));
+        s += i < BUCKETS - 1 ? "-" + std::to_string(1ULL << i) + "ms:" : "+ms:";
+        s += std::to_string(mCounts[i]);
+    }
+    return s;
+}
+
 bool get_time(struct timespec* ts) {
     // Use monotonic to exclude suspend time so that we measure IO bytes/sec
     // when system is running.
@@ -261,6 +315,14 @@ void disk_stats_monitor::update(struct disk_stats* curr)
     struct disk_perf perf = get_disk_perf(&inc);
     log_debug_disk_perf(&perf, "regular");
 
+    {
+        std::lock_guard<std::mutex> lock(mLatencyLock);
+        mReadLatency.add(inc.read_ios, inc.read_ticks);
+        mWriteLatency.add(inc.write_ios, inc.write_ticks);
+    }
+    mReadLatency_pub.add(inc.read_ios, inc.read_ticks);
+    mWriteLatency_pub.add(inc.write_ios, inc.write_ticks);
+
     add(&perf);
     mBuffer.push(perf);
     if (mBuffer.size() > mWindow) {
@@ -313,6 +375,16 @@ void disk_stats_monitor::publish(void)
     struct disk_perf perf = get_disk_perf(&mAccumulate_pub);
     log_debug_disk_perf(&perf, "regular");
     log_event_disk_stats(&mAccumulate, "regular");
+    log_event_disk_latency(mReadLatency_pub, mWriteLatency_pub, "regular");
     // Reset global structures
     memset(&mAccumulate_pub, 0, sizeof(struct disk_stats));
+    mReadLatency_pub = {};
+    mWriteLatency_pub = {};
+}
+
+void disk_stats_monitor::get_latency(latency_histogram* read, latency_histogram* write)
+{
+    std::lock_guard<std::mutex> lock(mLatencyLock);
+    *read = mReadLatency;
+    *write = mWriteLatency;
 }
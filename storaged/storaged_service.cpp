@@ -107,6 +107,7 @@ status_t StoragedService::dump(int fd, const Vector<String16>& args) {
     uint64_t threshold = 0;
     bool force_report = false;
     bool debug = false;
+    bool disk_latency = false;
     for (size_t i = 0; i < args.size(); i++) {
         const auto& arg = args[i];
         if (arg == String16("--hours")) {
@@ -138,6 +139,21 @@ status_t StoragedService::dump(int fd, const Vector<String16>& args) {
             debug = true;
             continue;
         }
+        if (arg == String16("--disk_latency")) {
+            disk_latency = true;
+            continue;
+        }
+    }
+
+    if (disk_latency) {
+        latency_histogram read, write;
+        if (!storaged_sp->get_disk_latency(&read, &write)) {
+            dprintf(fd, "disk stats unavailable\n");
+            return OK;
+        }
+        dprintf(fd, "read %s\n", read.to_string().c_str());
+        dprintf(fd, "write %s\n", write.to_string().c_str());
+        return OK;
     }
 
     uint64_t last_ts = 0;
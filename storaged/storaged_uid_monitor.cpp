@@ -19,7 +19,9 @@
 #include <stdint.h>
 #include <time.h>
 
+#include <charconv>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -44,9 +46,26 @@ using namespace storaged_proto;
 
 namespace {
 
-bool refresh_uid_names;
 const char* UID_IO_STATS_PATH = "/proc/uid_io/stats";
 
+// Takes the text up to the next delim (or the end) off the front of s, without
+// copying it the way Split() would.
+std::string_view next_field(std::string_view* s, char delim)
+{
+    size_t end = s->find(delim);
+    std::string_view field = s->substr(0, end);
+    s->remove_prefix(end == std::string_view::npos ? s->size() : end + 1);
+    return field;
+}
+
+template <typename T>
+bool parse_field(std::string_view field, T* value)
+{
+    const char* end = field.data() + field.size();
+    auto [ptr, ec] = std::from_chars(field.data(), end, *value);
+    return !field.empty() && ec == std::errc() && ptr == end;
+}
+
 } // namepsace
 
 std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats()
@@ -56,21 +75,25 @@ std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats()
 };
 
 /* return true on parse success and false on failure */
-bool uid_info::parse_uid_io_stats(std::string&& s)
+bool uid_info::parse_uid_io_stats(std::string_view s)
 {
-    std::vector<std::string> fields = Split(s, " ");
-    if (fields.size() < 11 ||
-        !ParseUint(fields[0],  &uid) ||
-        !ParseUint(fields[1],  &io[FOREGROUND].rchar) ||
-        !ParseUint(fields[2],  &io[FOREGROUND].wchar) ||
-        !ParseUint(fields[3],  &io[FOREGROUND].read_bytes) ||
-        !ParseUint(fields[4],  &io[FOREGROUND].write_bytes) ||
-        !ParseUint(fields[5],  &io[BACKGROUND].rchar) ||
-        !ParseUint(fields[6],  &io[BACKGROUND].wchar) ||
-        !ParseUint(fields[7],  &io[BACKGROUND].read_bytes) ||
-        !ParseUint(fields[8],  &io[BACKGROUND].write_bytes) ||
-        !ParseUint(fields[9],  &io[FOREGROUND].fsync) ||
-        !ParseUint(fields[10], &io[BACKGROUND].fsync)) {
+    std::string_view fields[11];
+    std::string_view rest = s;
+    for (auto& field : fields) {
+        if (rest.empty()) break;
+        field = next_field(&rest, ' ');
+    }
+    if (!parse_field(fields[0],  &uid) ||
+        !parse_field(fields[1],  &io[FOREGROUND].rchar) ||
+        !parse_field(fields[2],  &io[FOREGROUND].wchar) ||
+        !parse_field(fields[3],  &io[FOREGROUND].read_bytes) ||
+        !parse_field(fields[4],  &io[FOREGROUND].write_bytes) ||
+        !parse_field(fields[5],  &io[BACKGROUND].rchar) ||
+        !parse_field(fields[6],  &io[BACKGROUND].wchar) ||
+        !parse_field(fields[7],  &io[BACKGROUND].read_bytes) ||
+        !parse_field(fields[8],  &io[BACKGROUND].write_bytes) ||
+        !parse_field(fields[9],  &io[FOREGROUND].fsync) ||
+        !parse_field(fields[10], &io[BACKGROUND].fsync)) {
         LOG(WARNING) << "Invalid uid I/O stats: \"" << s << "\"";
         return false;
     }
@@ -78,27 +101,36 @@ bool uid_info::parse_uid_io_stats(std::string&& s)
 }
 
 /* return true on parse success and false on failure */
-bool task_info::parse_task_io_stats(std::string&& s)
+bool task_info::parse_task_io_stats(std::string_view s)
 {
-    std::vector<std::string> fields = Split(s, ",");
-    size_t size = fields.size();
-    if (size < 13 ||
-        !ParseInt(fields[size - 11],  &pid) ||
-        !ParseUint(fields[size - 10],  &io[FOREGROUND].rchar) ||
-        !ParseUint(fields[size - 9],  &io[FOREGROUND].wchar) ||
-        !ParseUint(fields[size - 8],  &io[FOREGROUND].read_bytes) ||
-        !ParseUint(fields[size - 7],  &io[FOREGROUND].write_bytes) ||
-        !ParseUint(fields[size - 6],  &io[BACKGROUND].rchar) ||
-        !ParseUint(fields[size - 5],  &io[BACKGROUND].wchar) ||
-        !ParseUint(fields[size - 4],  &io[BACKGROUND].read_bytes) ||
-        !ParseUint(fields[size - 3], &io[BACKGROUND].write_bytes) ||
-        !ParseUint(fields[size - 2], &io[FOREGROUND].fsync) ||
-        !ParseUint(fields[size - 1], &io[BACKGROUND].fsync)) {
+    // "task,<comm>,<pid>,<10 counters>", where the comm may have commas of its own.
+    size_t tail = s.size();
+    for (int i = 0; i < 11 && tail != std::string_view::npos; i++) {
+        tail = tail == 0 ? std::string_view::npos : s.rfind(',', tail - 1);
+    }
+    size_t head = s.find(',');
+    std::string_view fields[11];
+    if (tail != std::string_view::npos && head < tail) {
+        std::string_view rest = s.substr(tail + 1);
+        for (auto& field : fields) {
+            field = next_field(&rest, ',');
+        }
+    }
+    if (!parse_field(fields[0],  &pid) ||
+        !parse_field(fields[1],  &io[FOREGROUND].rchar) ||
+        !parse_field(fields[2],  &io[FOREGROUND].wchar) ||
+        !parse_field(fields[3],  &io[FOREGROUND].read_bytes) ||
+        !parse_field(fields[4],  &io[FOREGROUND].write_bytes) ||
+        !parse_field(fields[5],  &io[BACKGROUND].rchar) ||
+        !parse_field(fields[6],  &io[BACKGROUND].wchar) ||
+        !parse_field(fields[7],  &io[BACKGROUND].read_bytes) ||
+        !parse_field(fields[8],  &io[BACKGROUND].write_bytes) ||
+        !parse_field(fields[9],  &io[FOREGROUND].fsync) ||
+        !parse_field(fields[10], &io[BACKGROUND].fsync)) {
         LOG(WARNING) << "Invalid task I/O stats: \"" << s << "\"";
         return false;
     }
-    comm = Join(std::vector<std::string>(
-                fields.begin() + 1, fields.end() - 11), ',');
+    comm = s.substr(head + 1, tail - head - 1);
     return true;
 }
 
@@ -117,18 +149,19 @@ bool io_usage::is_zero() const
 
 namespace {
 
-void get_uid_names(const vector<int>& uids, const vector<std::string*>& uid_names)
+/* return true if the package manager could be asked for the names */
+bool get_uid_names(const vector<int>& uids, const vector<std::string*>& uid_names)
 {
     sp<IServiceManager> sm = defaultServiceManager();
     if (sm == NULL) {
         LOG(ERROR) << "defaultServiceManager failed";
-        return;
+        return false;
     }
 
     sp<IBinder> binder = sm->getService(String16("package_native"));
     if (binder == NULL) {
         LOG(ERROR) << "getService package_native failed";
-        return;
+        return false;
     }
 
     sp<IPackageManagerNative> package_mgr = interface_cast<IPackageManagerNative>(binder);
@@ -136,7 +169,7 @@ void get_uid_names(const vector<int>& uids, const vector<std::string*>& uid_name
     binder::Status status = package_mgr->getNamesForUids(uids, &names);
     if (!status.isOk()) {
         LOG(ERROR) << "package_native::getNamesForUids failed: " << status.exceptionMessage();
-        return;
+        return false;
     }
 
     for (uint32_t i = 0; i < uid_names.size(); i++) {
@@ -144,8 +177,7 @@ void get_uid_names(const vector<int>& uids, const vector<std::string*>& uid_name
             *uid_names[i] = names[i];
         }
     }
-
-    refresh_uid_names = false;
+    return true;
 }
 
 } // namespace
@@ -153,44 +185,53 @@ void get_uid_names(const vector<int>& uids, const vector<std::string*>& uid_name
 std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats_locked()
 {
     std::unordered_map<uint32_t, uid_info> uid_io_stats;
-    std::string buffer;
-    if (!ReadFileToString(UID_IO_STATS_PATH, &buffer)) {
+    if (!ReadFileToString(UID_IO_STATS_PATH, &uid_io_buffer_)) {
         PLOG(ERROR) << UID_IO_STATS_PATH << ": ReadFileToString failed";
         return uid_io_stats;
     }
 
-    std::vector<std::string> io_stats = Split(std::move(buffer), "\n");
+    std::string_view io_stats = uid_io_buffer_;
     uid_info u;
+    // the uids that need their names looked up
     vector<int> uids;
     vector<std::string*> uid_names;
 
-    for (uint32_t i = 0; i < io_stats.size(); i++) {
-        if (io_stats[i].empty()) {
+    while (!io_stats.empty()) {
+        std::string_view line = next_field(&io_stats, '\n');
+        if (line.empty()) {
             continue;
         }
 
-        if (io_stats[i].compare(0, 4, "task")) {
-            if (!u.parse_uid_io_stats(std::move(io_stats[i])))
+        if (line.compare(0, 4, "task")) {
+            if (!u.parse_uid_io_stats(line))
                 continue;
-            uid_io_stats[u.uid] = u;
-            uid_io_stats[u.uid].name = std::to_string(u.uid);
-            uids.push_back(u.uid);
-            uid_names.push_back(&uid_io_stats[u.uid].name);
-            if (last_uid_io_stats_.find(u.uid) == last_uid_io_stats_.end()) {
-                refresh_uid_names = true;
+            uid_info& info = uid_io_stats[u.uid] = u;
+            auto name = uid_names_.find(u.uid);
+            if (name != uid_names_.end()) {
+                info.name = name->second;
             } else {
-                uid_io_stats[u.uid].name = last_uid_io_stats_[u.uid].name;
+                info.name = std::to_string(u.uid);
+                uids.push_back(u.uid);
+                uid_names.push_back(&info.name);
             }
         } else {
             task_info t;
-            if (!t.parse_task_io_stats(std::move(io_stats[i])))
+            if (!t.parse_task_io_stats(line))
                 continue;
             uid_io_stats[u.uid].tasks[t.pid] = t;
         }
     }
 
-    if (!uids.empty() && refresh_uid_names) {
-        get_uid_names(uids, uid_names);
+    // Forget the names of uids that are gone, and remember the ones the package
+    // manager has (or doesn't have) for the new ones. If it can't be reached, the
+    // new uids are looked up again next time.
+    for (auto it = uid_names_.begin(); it != uid_names_.end();) {
+        it = uid_io_stats.count(it->first) ? std::next(it) : uid_names_.erase(it);
+    }
+    if (!uids.empty() && get_uid_names(uids, uid_names)) {
+        for (size_t i = 0; i < uids.size(); i++) {
+            uid_names_[uids[i]] = *uid_names[i];
+        }
     }
 
     return uid_io_stats;
@@ -219,19 +260,22 @@ void uid_monitor::add_records_locked(uint64_t curr_ts)
     }
 
     struct uid_records new_records;
+    new_records.entries.reserve(curr_io_stats_.size());
     for (const auto& p : curr_io_stats_) {
-        struct uid_record record = {};
-        record.name = p.first;
         if (!p.second.uid_ios.is_zero()) {
+            struct uid_record record = {};
+            record.name = p.first;
             record.ios.user_id = p.second.user_id;
             record.ios.uid_ios = p.second.uid_ios;
             for (const auto& p_task : p.second.task_ios) {
                 if (!p_task.second.is_zero())
-                    record.ios.task_ios[p_task.first] = p_task.second;
+                    record.ios.task_ios.emplace(p_task.first, p_task.second);
             }
-            new_records.entries.push_back(record);
+            new_records.entries.push_back(std::move(record));
         }
     }
+    // The records stay around for days, so don't keep the spare capacity.
+    new_records.entries.shrink_to_fit();
 
     curr_io_stats_.clear();
     new_records.start_ts = start_ts_;
@@ -243,7 +287,7 @@ void uid_monitor::add_records_locked(uint64_t curr_ts)
     // make some room for new records
     maybe_shrink_history_for_items(new_records.entries.size());
 
-    io_history_[curr_ts] = new_records;
+    io_history_[curr_ts] = std::move(new_records);
 }
 
 void uid_monitor::maybe_shrink_history_for_items(size_t nitems) {
@@ -308,23 +352,30 @@ void uid_monitor::update_curr_io_stats_locked()
         return;
     }
 
+    static const uid_info no_stats = {};
+    static const task_info no_task_stats = {};
+
+    // Only the uids and tasks that did some I/O since last time make it into the
+    // records, so there's no need to keep the others in curr_io_stats either.
     for (const auto& it : uid_io_stats) {
         const uid_info& uid = it.second;
-        if (curr_io_stats_.find(uid.name) == curr_io_stats_.end()) {
-            curr_io_stats_[uid.name] = {};
-        }
-
-        struct uid_io_usage& usage = curr_io_stats_[uid.name];
-        usage.user_id = multiuser_get_user_id(uid.uid);
+        auto last_it = last_uid_io_stats_.find(uid.uid);
+        const uid_info& last = last_it != last_uid_io_stats_.end() ? last_it->second : no_stats;
 
         int64_t fg_rd_delta = uid.io[FOREGROUND].read_bytes -
-            last_uid_io_stats_[uid.uid].io[FOREGROUND].read_bytes;
+            last.io[FOREGROUND].read_bytes;
         int64_t bg_rd_delta = uid.io[BACKGROUND].read_bytes -
-            last_uid_io_stats_[uid.uid].io[BACKGROUND].read_bytes;
+            last.io[BACKGROUND].read_bytes;
         int64_t fg_wr_delta = uid.io[FOREGROUND].write_bytes -
-            last_uid_io_stats_[uid.uid].io[FOREGROUND].write_bytes;
+            last.io[FOREGROUND].write_bytes;
         int64_t bg_wr_delta = uid.io[BACKGROUND].write_bytes -
-            last_uid_io_stats_[uid.uid].io[BACKGROUND].write_bytes;
+            last.io[BACKGROUND].write_bytes;
+        if (fg_rd_delta <= 0 && bg_rd_delta <= 0 && fg_wr_delta <= 0 && bg_wr_delta <= 0) {
+            continue;
+        }
+
+        struct uid_io_usage& usage = curr_io_stats_[uid.name];
+        usage.user_id = multiuser_get_user_id(uid.uid);
 
         usage.uid_ios.bytes[READ][FOREGROUND][charger_stat_] +=
             (fg_rd_delta < 0) ? 0 : fg_rd_delta;
@@ -339,14 +390,21 @@ void uid_monitor::update_curr_io_stats_locked()
             const task_info& task = task_it.second;
             const pid_t pid = task_it.first;
             const std::string& comm = task_it.second.comm;
+            auto last_task_it = last.tasks.find(pid);
+            const task_info& last_task =
+                last_task_it != last.tasks.end() ? last_task_it->second : no_task_stats;
             int64_t task_fg_rd_delta = task.io[FOREGROUND].read_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[FOREGROUND].read_bytes;
+                last_task.io[FOREGROUND].read_bytes;
             int64_t task_bg_rd_delta = task.io[BACKGROUND].read_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[BACKGROUND].read_bytes;
+                last_task.io[BACKGROUND].read_bytes;
             int64_t task_fg_wr_delta = task.io[FOREGROUND].write_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[FOREGROUND].write_bytes;
+                last_task.io[FOREGROUND].write_bytes;
             int64_t task_bg_wr_delta = task.io[BACKGROUND].write_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[BACKGROUND].write_bytes;
+                last_task.io[BACKGROUND].write_bytes;
+            if (task_fg_rd_delta <= 0 && task_bg_rd_delta <= 0 &&
+                task_fg_wr_delta <= 0 && task_bg_wr_delta <= 0) {
+                continue;
+            }
 
             io_usage& task_usage = usage.task_ios[comm];
             task_usage.bytes[READ][FOREGROUND][charger_stat_] +=
@@ -360,7 +418,7 @@ void uid_monitor::update_curr_io_stats_locked()
         }
     }
 
-    last_uid_io_stats_ = uid_io_stats;
+    last_uid_io_stats_ = std::move(uid_io_stats);
 }
 
 void uid_monitor::report(unordered_map<int, StoragedProto>* protos)
@@ -379,16 +437,27 @@ void uid_monitor::report(unordered_map<int, StoragedProto>* protos)
 
 namespace {
 
+// Only the non-zero counters are set: unset fields read back as zero, and a
+// record rarely has counters for both charger states, or for both reads and
+// writes in the foreground and background.
 void set_io_usage_proto(IOUsage* usage_proto, const io_usage& usage)
 {
-    usage_proto->set_rd_fg_chg_on(usage.bytes[READ][FOREGROUND][CHARGER_ON]);
-    usage_proto->set_rd_fg_chg_off(usage.bytes[READ][FOREGROUND][CHARGER_OFF]);
-    usage_proto->set_rd_bg_chg_on(usage.bytes[READ][BACKGROUND][CHARGER_ON]);
-    usage_proto->set_rd_bg_chg_off(usage.bytes[READ][BACKGROUND][CHARGER_OFF]);
-    usage_proto->set_wr_fg_chg_on(usage.bytes[WRITE][FOREGROUND][CHARGER_ON]);
-    usage_proto->set_wr_fg_chg_off(usage.bytes[WRITE][FOREGROUND][CHARGER_OFF]);
-    usage_proto->set_wr_bg_chg_on(usage.bytes[WRITE][BACKGROUND][CHARGER_ON]);
-    usage_proto->set_wr_bg_chg_off(usage.bytes[WRITE][BACKGROUND][CHARGER_OFF]);
+    if (uint64_t bytes = usage.bytes[READ][FOREGROUND][CHARGER_ON])
+        usage_proto->set_rd_fg_chg_on(bytes);
+    if (uint64_t bytes = usage.bytes[READ][FOREGROUND][CHARGER_OFF])
+        usage_proto->set_rd_fg_chg_off(bytes);
+    if (uint64_t bytes = usage.bytes[READ][BACKGROUND][CHARGER_ON])
+        usage_proto->set_rd_bg_chg_on(bytes);
+    if (uint64_t bytes = usage.bytes[READ][BACKGROUND][CHARGER_OFF])
+        usage_proto->set_rd_bg_chg_off(bytes);
+    if (uint64_t bytes = usage.bytes[WRITE][FOREGROUND][CHARGER_ON])
+        usage_proto->set_wr_fg_chg_on(bytes);
+    if (uint64_t bytes = usage.bytes[WRITE][FOREGROUND][CHARGER_OFF])
+        usage_proto->set_wr_fg_chg_off(bytes);
+    if (uint64_t bytes = usage.bytes[WRITE][BACKGROUND][CHARGER_ON])
+        usage_proto->set_wr_bg_chg_on(bytes);
+    if (uint64_t bytes = usage.bytes[WRITE][BACKGROUND][CHARGER_OFF])
+        usage_proto->set_wr_bg_chg_off(bytes);
 }
 
 void get_io_usage_proto(io_usage* usage, const IOUsage& io_proto)
@@ -504,7 +573,7 @@ void uid_monitor::load_uid_io_proto(userid_t user_id, const UidIOUsage& uid_io_p
                     &record.ios.task_ios[task_io_proto.task_name()],
                     task_io_proto.ios());
             }
-            recs->entries.push_back(record);
+            recs->entries.push_back(std::move(record));
         }
 
         // We already added items, so this will just cull down to the maximum
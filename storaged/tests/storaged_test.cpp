@@ -695,3 +695,75 @@ TEST(storaged_test, load_uid_io_proto) {
     uidm.load_uid_io_proto(0, user_0);
     ASSERT_LE(io_history.size(), size_t(uid_monitor::MAX_UID_RECORDS_SIZE));
 }
+
+TEST(storaged_test, parse_io_stats) {
+    uid_info u;
+    ASSERT_TRUE(u.parse_uid_io_stats("10057 1 2 3 4 5 6 7 8 9 10"));
+    EXPECT_EQ(u.uid, 10057U);
+    EXPECT_EQ(u.io[FOREGROUND].rchar, 1UL);
+    EXPECT_EQ(u.io[FOREGROUND].write_bytes, 4UL);
+    EXPECT_EQ(u.io[BACKGROUND].rchar, 5UL);
+    EXPECT_EQ(u.io[BACKGROUND].write_bytes, 8UL);
+    EXPECT_EQ(u.io[FOREGROUND].fsync, 9UL);
+    EXPECT_EQ(u.io[BACKGROUND].fsync, 10UL);
+    EXPECT_FALSE(u.parse_uid_io_stats("10057 1 2 3 4 5 6 7 8 9"));
+    EXPECT_FALSE(u.parse_uid_io_stats("10057 1 2 3 4 5 6 7 8 9 -10"));
+
+    task_info t;
+    ASSERT_TRUE(t.parse_task_io_stats("task,Binder:1,2,123,1,2,3,4,5,6,7,8,9,10"));
+    EXPECT_EQ(t.comm, "Binder:1,2");
+    EXPECT_EQ(t.pid, 123);
+    EXPECT_EQ(t.io[FOREGROUND].rchar, 1UL);
+    EXPECT_EQ(t.io[BACKGROUND].write_bytes, 8UL);
+    EXPECT_EQ(t.io[BACKGROUND].fsync, 10UL);
+    ASSERT_TRUE(t.parse_task_io_stats("task,,123,1,2,3,4,5,6,7,8,9,10"));
+    EXPECT_EQ(t.comm, "");
+    EXPECT_FALSE(t.parse_task_io_stats("task,123,1,2,3,4,5,6,7,8,9,10"));
+    EXPECT_FALSE(t.parse_task_io_stats("task,comm,123,1,2,3,4,5,6,7,8,9,"));
+}
+
+TEST(storaged_test, uid_io_proto_skips_zero_counters) {
+    uid_monitor uidm;
+    auto& io_history = uidm.io_history();
+
+    io_history[200] = {
+        .start_ts = 100,
+        .entries = {
+            { "app1", {
+                .user_id = 0,
+                .uid_ios.bytes[WRITE][FOREGROUND][CHARGER_ON] = 1000,
+              }
+            },
+        },
+    };
+
+    unordered_map<int, StoragedProto> protos;
+    uidm.update_uid_io_proto(&protos);
+
+    ASSERT_EQ(protos[0].uid_io_usage().uid_io_items_size(), 1);
+    const IOUsage& uid_io = protos[0].uid_io_usage().uid_io_items(0).records().entries(0).uid_io();
+    EXPECT_TRUE(uid_io.has_wr_fg_chg_on());
+    EXPECT_EQ(uid_io.wr_fg_chg_on(), 1000UL);
+    EXPECT_FALSE(uid_io.has_wr_fg_chg_off());
+    EXPECT_FALSE(uid_io.has_rd_fg_chg_on());
+    EXPECT_FALSE(uid_io.has_rd_bg_chg_off());
+}
+
+TEST(storaged_test, latency_histogram) {
+    latency_histogram histogram;
+    EXPECT_EQ(histogram.get_percentile(50), 0UL);
+
+    histogram.add(0, 100);     // no I/Os, ignored
+    histogram.add(90, 45);     // 0ms each
+    histogram.add(9, 27);      // 3ms each
+    histogram.add(1, 100000);  // 100s, in the open ended bucket
+
+    EXPECT_EQ(histogram.count(0), 90UL);
+    EXPECT_EQ(histogram.count(2), 9UL);
+    EXPECT_EQ(histogram.count(latency_histogram::BUCKETS - 1), 1UL);
+
+    EXPECT_EQ(histogram.get_percentile(50), 1UL);
+    EXPECT_EQ(histogram.get_percentile(95), 4UL);
+    EXPECT_EQ(histogram.get_percentile(100), 1UL << (latency_histogram::BUCKETS - 1));
+    EXPECT_EQ(histogram.to_string().substr(0, 26), "<1ms:90 1-2ms:0 2-4ms:9 4-");
+}
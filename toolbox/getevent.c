@@ -8,6 +8,7 @@
 #include <sys/inotify.h>
 #include <sys/limits.h>
 #include <sys/poll.h>
+#include <time.h>
 #include <linux/input.h>
 #include <err.h>
 #include <errno.h>
@@ -37,6 +38,46 @@ static struct pollfd *ufds;
 static char **device_names;
 static int nfds;
 
+/*
+ * Binary capture format (-b), read back by -D. A capture_header is followed by
+ * capture_records in host byte order. An ADD_DEVICE record carries the device
+ * path in the next |value| bytes, padded to a multiple of 4. Device numbers
+ * are the ones the text output uses, so a REMOVE_DEVICE renumbers the devices
+ * after it.
+ */
+#define CAPTURE_MAGIC 0x43564547 /* "GEVC" */
+#define CAPTURE_VERSION 1
+
+enum {
+    CAPTURE_EVENT           = 0,
+    CAPTURE_ADD_DEVICE      = 1,
+    CAPTURE_REMOVE_DEVICE   = 2,
+};
+
+struct capture_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct capture_record {
+    uint32_t sec; /* CLOCK_MONOTONIC */
+    uint32_t usec;
+    uint16_t kind;
+    uint16_t device;
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+};
+
+static int get_time;
+static int sync_rate;
+static int64_t last_sync_time;
+static const char *newline = "\n";
+
+static int capture_fd = -1;
+static char capture_buf[64 * 1024];
+static size_t capture_len;
+
 enum {
     PRINT_DEVICE_ERRORS     = 1U << 0,
     PRINT_DEVICE            = 1U << 1,
@@ -52,6 +93,50 @@ enum {
     PRINT_LABELS            = 1U << 16,
 };
 
+static void capture_flush(void)
+{
+    size_t pos = 0;
+    while(pos < capture_len) {
+        ssize_t res = write(capture_fd, capture_buf + pos, capture_len - pos);
+        if(res < 0) {
+            if(errno == EINTR)
+                continue;
+            err(1, "could not write capture");
+        }
+        pos += res;
+    }
+    capture_len = 0;
+}
+
+static void capture_write(const void *data, size_t size)
+{
+    if(capture_len + size > sizeof(capture_buf))
+        capture_flush();
+    memcpy(capture_buf + capture_len, data, size);
+    capture_len += size;
+}
+
+static void capture_device(int kind, int device, const char *name)
+{
+    struct capture_record record;
+    struct timespec now;
+    size_t len = name ? strlen(name) : 0;
+    static const char pad[4];
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    memset(&record, 0, sizeof(record));
+    record.sec = now.tv_sec;
+    record.usec = now.tv_nsec / 1000;
+    record.kind = kind;
+    record.device = device;
+    record.value = len;
+    capture_write(&record, sizeof(record));
+    if(len) {
+        capture_write(name, len);
+        capture_write(pad, -len & 3);
+    }
+}
+
 static const char *get_label(const struct label *labels, int value)
 {
     while(labels->name && value != labels->value) {
@@ -403,6 +488,8 @@ static int open_device(const char *device, int print_flags)
     ufds[nfds].fd = fd;
     ufds[nfds].events = POLLIN;
     device_names[nfds] = strdup(device);
+    if(capture_fd >= 0)
+        capture_device(CAPTURE_ADD_DEVICE, nfds, device);
     nfds++;
 
     return 0;
@@ -420,6 +507,8 @@ int close_device(const char *device, int print_flags)
             memmove(device_names + i, device_names + i + 1, sizeof(device_names[0]) * count);
             memmove(ufds + i, ufds + i + 1, sizeof(ufds[0]) * count);
             nfds--;
+            if(capture_fd >= 0)
+                capture_device(CAPTURE_REMOVE_DEVICE, i, NULL);
             return 0;
         }
     }
@@ -494,9 +583,115 @@ static int scan_dir(const char *dirname, int print_flags)
     return 0;
 }
 
+static void print_text_event(const char *device_name, long sec, long usec,
+                             int type, int code, int value, int print_flags)
+{
+    if(get_time) {
+        printf("[%8ld.%06ld] ", sec, usec);
+    }
+    if(device_name)
+        printf("%s: ", device_name);
+    print_event(type, code, value, print_flags);
+    if(sync_rate && type == 0 && code == 0) {
+        int64_t now = sec * 1000000LL + usec;
+        if(last_sync_time)
+            printf(" rate %lld", 1000000LL / (now - last_sync_time));
+        last_sync_time = now;
+    }
+    printf("%s", newline);
+}
+
+static void capture_event(int device, const struct input_event *event)
+{
+    struct capture_record record;
+
+    record.sec = event->time.tv_sec;
+    record.usec = event->time.tv_usec;
+    record.kind = CAPTURE_EVENT;
+    record.device = device;
+    record.type = event->type;
+    record.code = event->code;
+    record.value = event->value;
+    capture_write(&record, sizeof(record));
+}
+
+static int decode_capture(const char *path, int print_flags, int event_count)
+{
+    FILE *file;
+    struct capture_header header;
+    struct capture_record record;
+    char **names;
+    int count = 1; /* device 0 is the inotify fd when capturing */
+    char *name;
+    int i;
+
+    file = strcmp(path, "-") ? fopen(path, "re") : stdin;
+    if(file == NULL) {
+        fprintf(stderr, "could not open %s, %s\n", path, strerror(errno));
+        return 1;
+    }
+    if(fread(&header, sizeof(header), 1, file) != 1 ||
+       header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+        fprintf(stderr, "%s is not an event capture\n", path);
+        return 1;
+    }
+    names = calloc(1, sizeof(names[0]));
+    while(fread(&record, sizeof(record), 1, file) == 1) {
+        switch(record.kind) {
+        case CAPTURE_ADD_DEVICE:
+            if(record.device != count || record.value < 0 || record.value > PATH_MAX)
+                goto corrupt;
+            name = calloc(1, record.value + 1);
+            names = realloc(names, sizeof(names[0]) * (count + 1));
+            if(name == NULL || names == NULL)
+                err(1, "out of memory");
+            if(fread(name, 1, (record.value + 3) & ~3, file) < (size_t)record.value)
+                goto corrupt;
+            name[record.value] = '\0';
+            names[count++] = name;
+            if(print_flags & PRINT_DEVICE)
+                printf("add device %d: %s\n", record.device, name);
+            break;
+        case CAPTURE_REMOVE_DEVICE:
+            if(record.device == 0 || record.device >= count)
+                goto corrupt;
+            if(print_flags & PRINT_DEVICE)
+                printf("remove device %d: %s\n", record.device, names[record.device]);
+            free(names[record.device]);
+            memmove(names + record.device, names + record.device + 1,
+                    sizeof(names[0]) * (count - record.device - 1));
+            count--;
+            break;
+        case CAPTURE_EVENT:
+            if(record.device >= count)
+                goto corrupt;
+            print_text_event(names[record.device], record.sec, record.usec,
+                             record.type, record.code, record.value, print_flags);
+            if(event_count && --event_count == 0)
+                return 0;
+            break;
+        default:
+            goto corrupt;
+        }
+    }
+    if(ferror(file)) {
+        fprintf(stderr, "could not read %s, %s\n", path, strerror(errno));
+        return 1;
+    }
+    for(i = 1; i < count; i++)
+        free(names[i]);
+    free(names);
+    return 0;
+
+corrupt:
+    fprintf(stderr, "%s: corrupt capture\n", path);
+    return 1;
+}
+
 static void usage(char *name)
 {
-    fprintf(stderr, "Usage: %s [-t] [-n] [-s switchmask] [-S] [-v [mask]] [-d] [-p] [-i] [-l] [-q] [-c count] [-r] [device]\n", name);
+    fprintf(stderr, "Usage: %s [-t] [-n] [-s switchmask] [-S] [-v [mask]] [-d] [-p] [-i] [-l] [-q] [-c count] [-r] [-b file] [device]\n"
+                    "       %s [-t] [-n] [-l] [-q] [-c count] [-r] -D file\n", name, name);
     fprintf(stderr, "    -t: show time stamps\n");
     fprintf(stderr, "    -n: don't print newlines\n");
     fprintf(stderr, "    -s: print switch states for given bits\n");
@@ -509,6 +704,8 @@ static void usage(char *name)
     fprintf(stderr, "    -q: quiet (clear verbosity mask)\n");
     fprintf(stderr, "    -c: print given number of events then exit\n");
     fprintf(stderr, "    -r: print rate events are received\n");
+    fprintf(stderr, "    -b: write a binary capture of the events to file (- for stdout)\n");
+    fprintf(stderr, "    -D: print the events of a capture written by -b\n");
 }
 
 int getevent_main(int argc, char *argv[])
@@ -516,26 +713,25 @@ int getevent_main(int argc, char *argv[])
     int c;
     int i;
     int res;
-    int get_time = 0;
+    int j, count;
     int print_device = 0;
-    char *newline = "\n";
     uint16_t get_switch = 0;
-    struct input_event event;
+    struct input_event events[64];
     int print_flags = 0;
     int print_flags_set = 0;
     int dont_block = -1;
     int event_count = 0;
-    int sync_rate = 0;
-    int64_t last_sync_time = 0;
     const char *device = NULL;
     const char *device_path = "/dev/input";
+    const char *capture_path = NULL;
+    const char *decode_path = NULL;
 
-    /* disable buffering on stdout */
-    setbuf(stdout, NULL);
+    /* buffer stdout, it gets flushed every time we wait for more events */
+    setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
 
     opterr = 0;
     do {
-        c = getopt(argc, argv, "tns:Sv::dpilqc:rh");
+        c = getopt(argc, argv, "tns:Sv::dpilqc:rb:D:h");
         if (c == EOF)
             break;
         switch (c) {
@@ -591,6 +787,12 @@ int getevent_main(int argc, char *argv[])
         case 'r':
             sync_rate = 1;
             break;
+        case 'b':
+            capture_path = optarg;
+            break;
+        case 'D':
+            decode_path = optarg;
+            break;
         case '?':
             fprintf(stderr, "%s: invalid option -%c\n",
                 argv[0], optopt);
@@ -606,10 +808,28 @@ int getevent_main(int argc, char *argv[])
         device = argv[optind];
         optind++;
     }
-    if (optind != argc) {
+    if (optind != argc || (decode_path && (device || capture_path))) {
         usage(argv[0]);
         exit(1);
     }
+    if(decode_path) {
+        if(!print_flags_set)
+            print_flags |= PRINT_DEVICE;
+        return decode_capture(decode_path, print_flags, event_count);
+    }
+    if(capture_path) {
+        struct capture_header header = { CAPTURE_MAGIC, CAPTURE_VERSION };
+        if(strcmp(capture_path, "-") == 0) {
+            capture_fd = STDOUT_FILENO;
+        } else {
+            capture_fd = open(capture_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if(capture_fd < 0) {
+                fprintf(stderr, "could not open %s, %s\n", capture_path, strerror(errno));
+                return 1;
+            }
+        }
+        capture_write(&header, sizeof(header));
+    }
     nfds = 1;
     ufds = calloc(1, sizeof(ufds[0]));
     ufds[0].fd = inotify_init();
@@ -617,6 +837,8 @@ int getevent_main(int argc, char *argv[])
     if(device) {
         if(!print_flags_set)
             print_flags |= PRINT_DEVICE_ERRORS;
+        if(capture_fd == STDOUT_FILENO)
+            print_flags &= PRINT_DEVICE_ERRORS;
         res = open_device(device, print_flags);
         if(res < 0) {
             return 1;
@@ -624,6 +846,8 @@ int getevent_main(int argc, char *argv[])
     } else {
         if(!print_flags_set)
             print_flags |= PRINT_DEVICE_ERRORS | PRINT_DEVICE | PRINT_DEVICE_NAME;
+        if(capture_fd == STDOUT_FILENO)
+            print_flags &= PRINT_DEVICE_ERRORS;
         print_device = 1;
 		res = inotify_add_watch(ufds[0].fd, device_path, IN_DELETE | IN_CREATE);
         if(res < 0) {
@@ -654,6 +878,8 @@ int getevent_main(int argc, char *argv[])
         return 0;
 
     while(1) {
+        capture_flush();
+        fflush(stdout);
         //int pollres =
         poll(ufds, nfds, -1);
         //printf("poll %d, returned %d\n", nfds, pollres);
@@ -663,26 +889,28 @@ int getevent_main(int argc, char *argv[])
         for(i = 1; i < nfds; i++) {
             if(ufds[i].revents) {
                 if(ufds[i].revents & POLLIN) {
-                    res = read(ufds[i].fd, &event, sizeof(event));
-                    if(res < (int)sizeof(event)) {
+                    // Take everything the device has queued, as one burst of
+                    // a fast device can be a lot of events.
+                    res = read(ufds[i].fd, events, sizeof(events));
+                    if(res < (int)sizeof(events[0])) {
+                        capture_flush();
                         fprintf(stderr, "could not get event\n");
                         return 1;
                     }
-                    if(get_time) {
-                        printf("[%8ld.%06ld] ", event.time.tv_sec, event.time.tv_usec);
-                    }
-                    if(print_device)
-                        printf("%s: ", device_names[i]);
-                    print_event(event.type, event.code, event.value, print_flags);
-                    if(sync_rate && event.type == 0 && event.code == 0) {
-                        int64_t now = event.time.tv_sec * 1000000LL + event.time.tv_usec;
-                        if(last_sync_time)
-                            printf(" rate %lld", 1000000LL / (now - last_sync_time));
-                        last_sync_time = now;
+                    count = res / sizeof(events[0]);
+                    for(j = 0; j < count; j++) {
+                        if(capture_fd >= 0)
+                            capture_event(i, &events[j]);
+                        else
+                            print_text_event(print_device ? device_names[i] : NULL,
+                                             events[j].time.tv_sec, events[j].time.tv_usec,
+                                             events[j].type, events[j].code, events[j].value,
+                                             print_flags);
+                        if(event_count && --event_count == 0) {
+                            capture_flush();
+                            return 0;
+                        }
                     }
-                    printf("%s", newline);
-                    if(event_count && --event_count == 0)
-                        return 0;
                 }
             }
         }
@@ -15,8 +15,10 @@
  */
 
 #include <getopt.h>
+#include <string.h>
 #include <sys/system_properties.h>
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -65,9 +67,22 @@ void PrintAllProperties(ResultType result_type) {
         }
     }
 
+    // Format everything up front and write it out once, rather than flushing after each of the
+    // thousand or so properties, since bugreports read the whole list through a pipe.
+    size_t size = 0;
     for (const auto& [name, value] : properties) {
-        std::cout << "[" << name << "]: [" << value << "]" << std::endl;
+        size += name.size() + value.size() + strlen("[]: []\n");
     }
+    std::string output;
+    output.reserve(size);
+    for (const auto& [name, value] : properties) {
+        output += "[";
+        output += name;
+        output += "]: [";
+        output += value;
+        output += "]\n";
+    }
+    std::cout << output << std::flush;
 }
 
 void PrintProperty(const char* name, const char* default_value, ResultType result_type) {
@@ -551,23 +551,39 @@ Return<void> TrustyKeymaster4Device::update(uint64_t operationHandle,
     request.op_handle = operationHandle;
     request.additional_params.Reinitialize(KmParamSet(extendedParams));
 
-    size_t inp_size = input.size();
     size_t ser_size = request.SerializedSize();
 
     if (ser_size > TRUSTY_KEYMASTER_SEND_BUF_SIZE) {
         response.error = KM_ERROR_INVALID_INPUT_LENGTH;
     } else {
-        if (ser_size + inp_size > TRUSTY_KEYMASTER_SEND_BUF_SIZE) {
-            inp_size = TRUSTY_KEYMASTER_SEND_BUF_SIZE - ser_size;
-        }
-        request.input.Reinitialize(input.data(), inp_size);
-
-        impl_->UpdateOperation(request, &response);
+        // Feed the secure side as much of the input as each message can hold
+        // until it has taken all of it, rather than handing the partial
+        // consumption back to the caller one message at a time.
+        std::vector<uint8_t> output;
+        do {
+            size_t inp_size = input.size() - resultConsumed;
+            if (ser_size + inp_size > TRUSTY_KEYMASTER_SEND_BUF_SIZE) {
+                inp_size = TRUSTY_KEYMASTER_SEND_BUF_SIZE - ser_size;
+            }
+            request.input.Reinitialize(input.data() + resultConsumed, inp_size);
+
+            impl_->UpdateOperation(request, &response);
+            if (response.error != KM_ERROR_OK) break;
+
+            resultConsumed += response.input_consumed;
+            output.insert(output.end(), response.output.peek_read(),
+                          response.output.peek_read() + response.output.available_read());
+            if (response.input_consumed == 0) break;
+            // Parameters such as associated data go with the first chunk
+            // only; the auth token is needed on every one.
+            request.additional_params.Reinitialize(
+                    KmParamSet(injectAuthToken(hidl_vec<KeyParameter>(), authToken)));
+            ser_size = request.SerializedSize();
+        } while (resultConsumed < input.size());
 
         if (response.error == KM_ERROR_OK) {
-            resultConsumed = response.input_consumed;
             resultParams = kmParamSet2Hidl(response.output_params);
-            resultBlob = kmBuffer2hidlVec(response.output);
+            resultBlob = output;
         }
     }
     _hidl_cb(legacy_enum_conversion(response.error), resultConsumed, resultParams, resultBlob);
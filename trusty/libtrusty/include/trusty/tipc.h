@@ -21,13 +21,31 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <sys/uio.h>
 #include <trusty/ipc.h>
 
+/*
+ * A dma-buf mapped into this process, for passing payloads to a Trusty app
+ * without copying them through the tipc device. Only for apps whose protocol
+ * takes a memref.
+ */
+struct tipc_shm_buf {
+    int fd;
+    void* base;
+    size_t size;
+};
+
 int tipc_connect(const char *dev_name, const char *srv_name);
 ssize_t tipc_send(int fd, const struct iovec* iov, int iovcnt, struct trusty_shm* shm, int shmcnt);
 int tipc_close(int fd);
 
+/* Allocates and maps a buffer of at least size bytes from the system heap. */
+int tipc_shm_alloc(struct tipc_shm_buf* buf, size_t size);
+void tipc_shm_free(struct tipc_shm_buf* buf);
+/* Sends a message with buf shared with the receiving app. */
+ssize_t tipc_send_shm(int fd, const struct iovec* iov, int iovcnt, const struct tipc_shm_buf* buf);
+
 #ifdef __cplusplus
 }
 #endif
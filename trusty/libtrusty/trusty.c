@@ -23,11 +23,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+#include <BufferAllocator/BufferAllocatorWrapper.h>
 #include <log/log.h>
 
 #include <trusty/ipc.h>
+#include <trusty/tipc.h>
 
 int tipc_connect(const char* dev_name, const char* srv_name) {
     int fd;
@@ -68,6 +71,56 @@ ssize_t tipc_send(int fd, const struct iovec* iov, int iovcnt, struct trusty_shm
     return rc;
 }
 
-void tipc_close(int fd) {
-    close(fd);
+int tipc_close(int fd) {
+    return close(fd);
+}
+
+int tipc_shm_alloc(struct tipc_shm_buf* buf, size_t size) {
+    size_t page_size = getpagesize();
+    size = (size + page_size - 1) & ~(page_size - 1);
+
+    BufferAllocator* allocator = CreateDmabufHeapBufferAllocator();
+    if (!allocator) {
+        ALOGE("%s: failed to create dma-buf allocator\n", __func__);
+        return -ENOMEM;
+    }
+    int fd = DmabufHeapAlloc(allocator, "system", size, 0, 0 /* legacy align */);
+    FreeDmabufHeapBufferAllocator(allocator);
+    if (fd < 0) {
+        ALOGE("%s: failed to allocate dma-buf of size %zu (err=%d)\n", __func__, size, fd);
+        return fd;
+    }
+
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        int rc = -errno;
+        ALOGE("%s: failed to map dma-buf: %s\n", __func__, strerror(errno));
+        close(fd);
+        return rc;
+    }
+
+    buf->fd = fd;
+    buf->base = base;
+    buf->size = size;
+    return 0;
+}
+
+void tipc_shm_free(struct tipc_shm_buf* buf) {
+    if (buf->base) {
+        munmap(buf->base, buf->size);
+    }
+    if (buf->fd >= 0) {
+        close(buf->fd);
+    }
+    buf->fd = -1;
+    buf->base = NULL;
+    buf->size = 0;
+}
+
+ssize_t tipc_send_shm(int fd, const struct iovec* iov, int iovcnt, const struct tipc_shm_buf* buf) {
+    struct trusty_shm shm = {
+            .fd = buf->fd,
+            .transfer = TRUSTY_SHARE,
+    };
+    return tipc_send(fd, iov, iovcnt, &shm, 1);
 }
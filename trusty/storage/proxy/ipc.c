@@ -15,6 +15,7 @@
  */
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -64,6 +65,16 @@ void ipc_disconnect(void)
     tipc_fd = -1;
 }
 
+/* returns true if a message arrives within timeout_ms */
+bool ipc_wait_msg(int timeout_ms)
+{
+    struct pollfd pfd = {.fd = tipc_fd, .events = POLLIN};
+
+    assert(tipc_fd >=  0);
+
+    return TEMP_FAILURE_RETRY(poll(&pfd, 1, timeout_ms)) > 0;
+}
+
 ssize_t ipc_get_msg(struct storage_msg *msg, void *req_buf, size_t req_buf_len)
 {
     ssize_t rc;
@@ -15,10 +15,12 @@
  */
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <trusty/interface/storage.h>
 
 int ipc_connect(const char *device, const char *service_name);
 void ipc_disconnect(void);
+bool ipc_wait_msg(int timeout_ms);
 ssize_t ipc_get_msg(struct storage_msg *msg, void *req_buf, size_t req_buf_len);
 int ipc_respond(struct storage_msg *msg, void *out, size_t out_size);
@@ -33,6 +33,11 @@
 #include "storage.h"
 
 #define REQ_BUFFER_SIZE 4096
+/*
+ * How long to wait for the next request before releasing the RPMB wake lock.
+ * A secure storage transaction sends its RPMB requests within well under this.
+ */
+#define RPMB_IDLE_TIMEOUT_MS 10
 static uint8_t req_buffer[REQ_BUFFER_SIZE + 1];
 
 static const char* ss_data_root;
@@ -201,6 +206,11 @@ static int proxy_loop(void) {
 
     /* enter main message handling loop */
     while (true) {
+        /* let go of the RPMB wake lock once requests stop coming */
+        if (rpmb_wake_lock_held() && !ipc_wait_msg(RPMB_IDLE_TIMEOUT_MS)) {
+            rpmb_release_wake_lock();
+        }
+
         /* get incoming message */
         rc = ipc_get_msg(&msg, req_buffer, REQ_BUFFER_SIZE);
         if (rc < 0) return rc;
@@ -117,6 +117,7 @@ static uint8_t read_buf[4096];
 static enum dev_type dev_type = UNKNOWN_RPMB;
 
 static const char* UFS_WAKE_LOCK_NAME = "ufs_seq_wakelock";
+static bool ufs_wake_lock_held;
 
 /**
  * log_buf - Log a byte buffer to the android log.
@@ -395,10 +396,17 @@ static int send_ufs_rpmb_req(int sg_fd, const struct storage_rpmb_send_req* req)
 
     bool is_request_write = req->reliable_write_size > 0;
 
-    wl_rc = acquire_wake_lock(PARTIAL_WAKE_LOCK, UFS_WAKE_LOCK_NAME);
-    if (wl_rc < 0) {
-        ALOGE("%s: failed to acquire wakelock: %d, %s\n", __func__, wl_rc, strerror(errno));
-        return wl_rc;
+    /*
+     * The wake lock stays held across back-to-back requests, and is released
+     * by the proxy loop once it sees no more coming.
+     */
+    if (!ufs_wake_lock_held) {
+        wl_rc = acquire_wake_lock(PARTIAL_WAKE_LOCK, UFS_WAKE_LOCK_NAME);
+        if (wl_rc < 0) {
+            ALOGE("%s: failed to acquire wakelock: %d, %s\n", __func__, wl_rc, strerror(errno));
+            return wl_rc;
+        }
+        ufs_wake_lock_held = true;
     }
 
     if (req->reliable_write_size) {
@@ -458,11 +466,6 @@ static int send_ufs_rpmb_req(int sg_fd, const struct storage_rpmb_send_req* req)
     }
 
 err_op:
-    wl_rc = release_wake_lock(UFS_WAKE_LOCK_NAME);
-    if (wl_rc < 0) {
-        ALOGE("%s: failed to release wakelock: %d, %s\n", __func__, wl_rc, strerror(errno));
-    }
-
     return rc;
 }
 
@@ -617,7 +620,22 @@ int rpmb_open(const char* rpmb_devname, enum dev_type open_dev_type) {
     return 0;
 }
 
+bool rpmb_wake_lock_held(void) {
+    return ufs_wake_lock_held;
+}
+
+void rpmb_release_wake_lock(void) {
+    if (!ufs_wake_lock_held) return;
+
+    int wl_rc = release_wake_lock(UFS_WAKE_LOCK_NAME);
+    if (wl_rc < 0) {
+        ALOGE("%s: failed to release wakelock: %d, %s\n", __func__, wl_rc, strerror(errno));
+    }
+    ufs_wake_lock_held = false;
+}
+
 void rpmb_close(void) {
+    rpmb_release_wake_lock();
     close(rpmb_fd);
     rpmb_fd = -1;
 }
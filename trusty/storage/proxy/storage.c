@@ -32,6 +32,7 @@
 
 #define FD_TBL_SIZE 64
 #define MAX_READ_SIZE 4096
+#define MAX_DIRTY_DIRS 4
 
 #define ALTERNATE_DATA_DIR "alternate/"
 
@@ -46,6 +47,10 @@ static const char *ssdir_name;
 static enum sync_state fs_state;
 static enum sync_state fd_state[FD_TBL_SIZE];
 
+/* directories with new entries that have not been synced yet */
+static char* dirty_dirs[MAX_DIRTY_DIRS];
+static uint dirty_dir_count;
+
 static bool alternate_mode;
 
 static struct {
@@ -223,6 +228,62 @@ static void sync_parent(const char* path) {
     }
 }
 
+/*
+ * Leaves syncing the parent directory of a new file to the next close or
+ * checkpoint, so that a transaction creating several files in one directory
+ * syncs it once.
+ */
+static void defer_sync_parent(const char* path) {
+    char* copy = strdup(path);
+    if (copy == NULL) {
+        sync_parent(path);
+        return;
+    }
+    char* parent_path = strdup(dirname(copy));
+    free(copy);
+    if (parent_path == NULL) {
+        sync_parent(path);
+        return;
+    }
+
+    for (uint i = 0; i < dirty_dir_count; i++) {
+        if (!strcmp(dirty_dirs[i], parent_path)) {
+            free(parent_path);
+            return;
+        }
+    }
+    if (dirty_dir_count == MAX_DIRTY_DIRS) {
+        free(parent_path);
+        sync_parent(path);
+        return;
+    }
+    dirty_dirs[dirty_dir_count++] = parent_path;
+}
+
+static int sync_dirty_dirs(void) {
+    int ret = 0;
+    int error = 0;
+
+    for (uint i = 0; i < dirty_dir_count; i++) {
+        int dir_fd = TEMP_FAILURE_RETRY(open(dirty_dirs[i], O_RDONLY | O_DIRECTORY));
+        if (dir_fd < 0 || fsync(dir_fd) < 0) {
+            error = errno;
+            ret = -1;
+            ALOGE("%s: failed to sync directory \"%s\": %s\n", __func__, dirty_dirs[i],
+                  strerror(error));
+        }
+        if (dir_fd >= 0) {
+            close(dir_fd);
+        }
+        free(dirty_dirs[i]);
+    }
+    dirty_dir_count = 0;
+    if (ret < 0) {
+        errno = error;
+    }
+    return ret;
+}
+
 int storage_file_open(struct storage_msg* msg, const void* r, size_t req_len) {
     char* path = NULL;
     const struct storage_file_open_req *req = r;
@@ -285,7 +346,7 @@ int storage_file_open(struct storage_msg* msg, const void* r, size_t req_len) {
             char* parent_path = dirname(path);
             rc = mkdir(parent_path, S_IRWXU);
             if (rc == 0) {
-                sync_parent(parent_path);
+                defer_sync_parent(parent_path);
             } else if (errno != EEXIST) {
                 ALOGE("%s: Could not create parent directory \"%s\": %s\n", __func__, parent_path,
                       strerror(errno));
@@ -326,7 +387,7 @@ int storage_file_open(struct storage_msg* msg, const void* r, size_t req_len) {
     }
 
     if (open_flags & O_CREAT) {
-        sync_parent(path);
+        defer_sync_parent(path);
     }
     free(path);
 
@@ -356,10 +417,19 @@ int storage_file_close(struct storage_msg *msg,
         goto err_response;
     }
 
+    /*
+     * Anything written before the last checkpoint has been synced already, so
+     * only files written since need it.
+     */
+    bool dirty = req->handle < FD_TBL_SIZE ? fd_state[req->handle] == SS_DIRTY
+                                            : fs_state == SS_DIRTY;
     int fd = remove_fd(req->handle);
     ALOGV("%s: handle = %u: fd = %u\n", __func__, req->handle, fd);
 
-    int rc = fsync(fd);
+    int rc = dirty ? fsync(fd) : 0;
+    if (rc == 0) {
+        rc = sync_dirty_dirs();
+    }
     if (rc < 0) {
         rc = errno;
         ALOGE("%s: fsync failed for fd=%u: %s\n",
@@ -537,9 +607,9 @@ int storage_sync_checkpoint(void)
          if (fd_state[fd] == SS_DIRTY) {
              if (fs_state == SS_CLEAN) {
                  /* need to sync individual fd */
-                 rc = fsync(fd);
+                 rc = fdatasync(fd);
                  if (rc < 0) {
-                     ALOGE("fsync for fd=%d failed: %s\n", fd, strerror(errno));
+                     ALOGE("fdatasync for fd=%d failed: %s\n", fd, strerror(errno));
                      return rc;
                  }
              }
@@ -560,6 +630,6 @@ int storage_sync_checkpoint(void)
         fs_state = SS_CLEAN;
     }
 
-    return 0;
+    return sync_dirty_dirs();
 }
 